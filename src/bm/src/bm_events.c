@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -55,19 +56,31 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /*****************************************************************************/
 static struct ev_loop *     _evloop = NULL;
 
-static pthread_mutex_t      bm_cb_lock;
 static ev_async             bm_cb_async;
-static ds_dlist_t           bm_cb_queue;
-static int                  bm_cb_queue_len = 0;
 
 static bool                 _bsal_initialized = false;
 
+/*
+ * BSAL events are passed from the BSAL thread to the main loop through a
+ * single producer/single consumer ring of BM_CB_QUEUE_MAX preallocated
+ * entries. The BSAL thread only writes bm_cb_head, the main loop only
+ * writes bm_cb_tail. Both free run and are masked on access.
+ */
 typedef struct {
     bsal_event_t            event;
-
-    ds_dlist_node_t         node;
+    unsigned int            count;      // Probe requests coalesced in event
 } bm_cb_entry_t;
 
+static bm_cb_entry_t        *bm_cb_ring = NULL;
+static unsigned int         bm_cb_head = 0;
+static unsigned int         bm_cb_tail = 0;
+static unsigned int         bm_cb_dropped = 0;  // Written by the BSAL thread
+
+static bm_events_stats_t    bm_cb_stats;
+
+#define BM_CB_RING_MASK     (BM_CB_QUEUE_MAX - 1)
+#define BM_CB_HASH_SIZE     (BM_CB_QUEUE_MAX * 2)
+
 static c_item_t map_bsal_disc_sources[] = {
     C_ITEM_STR(BSAL_DISC_SOURCE_LOCAL,              "Local"),
     C_ITEM_STR(BSAL_DISC_SOURCE_REMOTE,             "Remote")
@@ -114,7 +127,7 @@ static c_item_t map_bsal_disc_reasons[] = {
 };
 
 /*****************************************************************************/
-static void     bm_events_handle_event(bsal_event_t *event );
+static void     bm_events_handle_event(bsal_event_t *event, unsigned int count);
 /*****************************************************************************/
 
 // Callback function for BSAL upon receiving steering events from the driver
@@ -122,73 +135,153 @@ static void
 bm_events_bsal_event_cb(bsal_event_t *event)
 {
     bm_cb_entry_t       *cb_entry;
-    int                 ret = 0;
+    unsigned int        head;
+    unsigned int        tail;
 
-    pthread_mutex_lock( &bm_cb_lock );
-
-    if( bm_cb_queue_len >= BM_CB_QUEUE_MAX ) {
-        LOGW( "BM CB queue full! Ignoring event..." );
-        goto exit;
-    }
+    head = bm_cb_head;
+    tail = __atomic_load_n(&bm_cb_tail, __ATOMIC_ACQUIRE);
 
-    if( !(cb_entry = calloc( 1, sizeof( *cb_entry ))) ) {
-        LOGE( "Failed to allocate memory for BM CB queue object" );
-        goto exit;
+    if (head - tail >= BM_CB_QUEUE_MAX) {
+        // Reported by the main loop, logging here would slow the driver down
+        __atomic_add_fetch(&bm_cb_dropped, 1, __ATOMIC_RELAXED);
+        return;
     }
 
+    cb_entry = &bm_cb_ring[head & BM_CB_RING_MASK];
     memcpy( &cb_entry->event, event, sizeof( cb_entry->event ) );
+    cb_entry->count = 1;
 
-    ds_dlist_insert_tail( &bm_cb_queue, cb_entry );
-    bm_cb_queue_len++;
-    if (bm_cb_queue_len > 5)
-        LOGT("bm_cm_queue_len++ (%d)", bm_cb_queue_len);
-    ret = 1;
+    __atomic_store_n(&bm_cb_head, head + 1, __ATOMIC_RELEASE);
 
-exit:
-    pthread_mutex_unlock( &bm_cb_lock );
-    if( ret && _evloop ) {
-            ev_async_send( _evloop, &bm_cb_async );
+    if( _evloop ) {
+        ev_async_send( _evloop, &bm_cb_async );
     }
 
     return;
 }
 
+static bool
+bm_events_probe_match(const bsal_event_t *a, const bsal_event_t *b)
+{
+    return !memcmp(a->data.probe_req.client_addr, b->data.probe_req.client_addr,
+                   sizeof(a->data.probe_req.client_addr)) &&
+           a->data.probe_req.ssid_null == b->data.probe_req.ssid_null &&
+           a->data.probe_req.blocked == b->data.probe_req.blocked &&
+           !strcmp(a->ifname, b->ifname);
+}
+
+static unsigned int
+bm_events_probe_hash(const bsal_event_t *event)
+{
+    const uint8_t       *mac = event->data.probe_req.client_addr;
+    const char          *c;
+    unsigned int        hash = 2166136261u;
+    unsigned int        i;
+
+    for (i = 0; i < BSAL_MAC_ADDR_LEN; i++) {
+        hash = (hash ^ mac[i]) * 16777619u;
+    }
+    for (c = event->ifname; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Coalesces the probe requests of a batch into the latest probe request of
+ * the same client on the same interface, with the same ssid_null/blocked
+ * flags. Any other event acts as a barrier, so that probe requests are not
+ * moved across the connection state changes they depend on.
+ */
+static void
+bm_events_coalesce(unsigned int tail, unsigned int head)
+{
+    uint16_t            hash[BM_CB_HASH_SIZE];
+    bm_cb_entry_t       *cb_entry;
+    bm_cb_entry_t       *latest;
+    unsigned int        slot;
+    unsigned int        i;
+
+    memset(hash, 0xff, sizeof(hash));
+
+    for (i = head; i != tail; i--) {
+        cb_entry = &bm_cb_ring[(i - 1) & BM_CB_RING_MASK];
+
+        if (cb_entry->event.type != BSAL_EVENT_PROBE_REQ) {
+            memset(hash, 0xff, sizeof(hash));
+            continue;
+        }
+
+        slot = bm_events_probe_hash(&cb_entry->event) % BM_CB_HASH_SIZE;
+        while (hash[slot] != UINT16_MAX) {
+            latest = &bm_cb_ring[hash[slot]];
+            if (bm_events_probe_match(&latest->event, &cb_entry->event)) {
+                latest->count += cb_entry->count;
+                cb_entry->count = 0;
+                bm_cb_stats.coalesced++;
+                break;
+            }
+            slot = (slot + 1) % BM_CB_HASH_SIZE;
+        }
+
+        if (cb_entry->count != 0) {
+            hash[slot] = (i - 1) & BM_CB_RING_MASK;
+        }
+    }
+}
+
 // Asynchronous callback to process events in CB queue
 static void
 bm_events_async_cb( EV_P_ ev_async *w, int revents )
 {
     bm_cb_entry_t       *cb_entry;
-    bsal_event_t        *event;
+    unsigned int        dropped;
+    unsigned int        head;
+    unsigned int        tail;
 
     while( true )
     {
-        pthread_mutex_lock( &bm_cb_lock );
-        cb_entry = ds_dlist_is_empty( &bm_cb_queue ) ? NULL : ds_dlist_remove_head( &bm_cb_queue );
-        if ( cb_entry )
-        {
-            bm_cb_queue_len--;
-            if (bm_cb_queue_len > 4)
-                LOGT("bm_cm_queue_len-- (%d)", bm_cb_queue_len);
+        head = __atomic_load_n(&bm_cb_head, __ATOMIC_ACQUIRE);
+        tail = bm_cb_tail;
+        if (head == tail) {
+            break;
         }
-        pthread_mutex_unlock( &bm_cb_lock );
 
-        if ( !cb_entry )
-        {
-            break;
+        bm_cb_stats.batches++;
+        if (head - tail > bm_cb_stats.max_batch) {
+            bm_cb_stats.max_batch = head - tail;
+        }
+        if (head - tail > 5) {
+            LOGT("bm_cb_queue batch (%u)", head - tail);
         }
 
-        event = &cb_entry->event;
+        bm_events_coalesce(tail, head);
 
-        bm_events_handle_event(event);
+        for ( ; tail != head; tail++) {
+            cb_entry = &bm_cb_ring[tail & BM_CB_RING_MASK];
+            if (cb_entry->count != 0) {
+                bm_events_handle_event(&cb_entry->event, cb_entry->count);
+                bm_cb_stats.events++;
+            }
 
-        free( cb_entry );
+            // Hand the entry back to the BSAL thread
+            __atomic_store_n(&bm_cb_tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    dropped = __atomic_load_n(&bm_cb_dropped, __ATOMIC_RELAXED);
+    if (dropped != bm_cb_stats.dropped) {
+        LOGW("BM CB queue full! %u events ignored (%u total)",
+             dropped - bm_cb_stats.dropped, dropped);
+        bm_cb_stats.dropped = dropped;
     }
 
     return;
 }
 
 static void
-bm_events_handle_event(bsal_event_t *event)
+bm_events_handle_event(bsal_event_t *event, unsigned int count)
 {
     bm_client_stats_t           *stats;
     bm_client_times_t           *times;
@@ -240,16 +333,16 @@ bm_events_handle_event(bsal_event_t *event)
         stats->probe.last = now;
         if (event->data.probe_req.ssid_null) {
             stats->probe.last_null = now;
-            stats->probe.null_cnt++;
+            stats->probe.null_cnt += count;
             if (event->data.probe_req.blocked) {
-                stats->probe.null_blocked++;
+                stats->probe.null_blocked += count;
             }
         }
         else {
             stats->probe.last_direct = now;
-            stats->probe.direct_cnt++;
+            stats->probe.direct_cnt += count;
             if (event->data.probe_req.blocked) {
-                stats->probe.direct_blocked++;
+                stats->probe.direct_blocked += count;
             }
         }
 
@@ -817,12 +910,15 @@ bm_events_init(struct ev_loop *loop)
 
     _evloop             = loop;
 
-    // Initialize CB queue
-    ds_dlist_init( &bm_cb_queue, bm_cb_entry_t, node );
-    bm_cb_queue_len     = 0;
-
-    // Initialize mutex lock for CB queue
-    pthread_mutex_init( &bm_cb_lock, NULL );
+    // Initialize CB ring
+    if (!(bm_cb_ring = calloc(BM_CB_QUEUE_MAX, sizeof(*bm_cb_ring)))) {
+        LOGE("Failed to allocate memory for BM CB ring");
+        return false;
+    }
+    bm_cb_head          = 0;
+    bm_cb_tail          = 0;
+    bm_cb_dropped       = 0;
+    memset(&bm_cb_stats, 0, sizeof(bm_cb_stats));
 
     // Initialize async watcher
     ev_async_init( &bm_cb_async, bm_events_async_cb );
@@ -839,17 +935,37 @@ bm_events_init(struct ev_loop *loop)
     return true;
 }
 
+const bm_events_stats_t *
+bm_events_get_stats(void)
+{
+    return &bm_cb_stats;
+}
+
+void
+bm_events_dump_stats(void)
+{
+    LOGI("BM CB queue: %"PRIu64" events processed in %"PRIu64" batches (max %u),"
+         " %"PRIu64" probe requests coalesced, %u dropped",
+         bm_cb_stats.events, bm_cb_stats.batches, bm_cb_stats.max_batch,
+         bm_cb_stats.coalesced, bm_cb_stats.dropped);
+}
+
 bool
 bm_events_cleanup(void)
 {
     LOGI( "Events cleaning up" );
 
+    bm_events_dump_stats();
+
     ev_async_stop( _evloop, &bm_cb_async );
-    pthread_mutex_destroy( &bm_cb_lock );
 
     target_bsal_cleanup();
     _bsal_initialized   = false;
     _evloop            = NULL;
 
+    // The BSAL thread is gone, release the CB ring
+    free(bm_cb_ring);
+    bm_cb_ring          = NULL;
+
     return true;
 }
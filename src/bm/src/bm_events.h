@@ -31,10 +31,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef BM_EVENTS_H_INCLUDED
 #define BM_EVENTS_H_INCLUDED
 
-#define                 BM_CB_QUEUE_MAX     256
+#define                 BM_CB_QUEUE_MAX     256     // Must be a power of 2
+
+typedef struct {
+    uint64_t            events;         // Events processed
+    uint64_t            batches;        // Batches of events drained
+    uint64_t            coalesced;      // Probe requests coalesced
+    unsigned int        dropped;        // Events dropped, queue full
+    unsigned int        max_batch;      // Largest batch drained
+} bm_events_stats_t;
 
 extern bool             bm_events_init(struct ev_loop *loop);
 extern bool             bm_events_cleanup(void);
+extern const bm_events_stats_t *
+                        bm_events_get_stats(void);
+extern void             bm_events_dump_stats(void);
 
 void bm_event_action_frame(const char *ifname, const uint8_t *data, unsigned int data_len);
 void bm_events_handle_rssi_xing(bm_client_t *client, bsal_event_t *event);
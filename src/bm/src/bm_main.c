@@ -91,6 +91,7 @@ handle_usr1_signal(struct ev_loop *loop, ev_signal *w, int revents)
 {
     LOGI("Received USR1 signal - dump stats");
     bm_client_dump_dbg_events();
+    bm_events_dump_stats();
     return;
 }
 
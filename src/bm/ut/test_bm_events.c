@@ -0,0 +1,309 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <string.h>
+
+#include "bm.h"
+#include "log.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "bm_events_tests";
+
+#define TEST_BM_IFNAME "wl0"
+
+static struct ev_loop *g_loop;
+static bsal_event_cb_t g_bsal_event_cb;
+static bm_group_t g_group;
+static bm_client_t g_clients[2];
+static int g_probe_reports;
+static int g_connects;
+
+static const uint8_t g_macs[2][BSAL_MAC_ADDR_LEN] =
+{
+    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 },
+    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x66 },
+};
+
+
+/*
+ * Stubs of the BSAL target and of the BM modules the event handler calls
+ */
+int
+target_bsal_init(bsal_event_cb_t event_cb, struct ev_loop *loop)
+{
+    g_bsal_event_cb = event_cb;
+    return 0;
+}
+
+int
+target_bsal_cleanup(void)
+{
+    g_bsal_event_cb = NULL;
+    return 0;
+}
+
+int
+target_bsal_client_info(const char *ifname, const uint8_t *mac_addr,
+                        bsal_client_info_t *info)
+{
+    return -1;
+}
+
+bm_group_t *
+bm_group_find_by_ifname(const char *ifname)
+{
+    return strcmp(ifname, TEST_BM_IFNAME) ? NULL : &g_group;
+}
+
+radio_type_t
+bm_group_find_radio_type_by_ifname(const char *ifname)
+{
+    return strcmp(ifname, TEST_BM_IFNAME) ? RADIO_TYPE_NONE : RADIO_TYPE_2G;
+}
+
+bm_client_t *
+bm_client_find_by_macaddr(os_macaddr_t mac_addr)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(g_clients); i++)
+    {
+        if (!memcmp(mac_addr.addr, g_macs[i], sizeof(g_macs[i]))) return &g_clients[i];
+    }
+
+    return NULL;
+}
+
+bm_client_t *
+bm_client_find_or_add_by_macaddr(os_macaddr_t *mac_addr)
+{
+    return bm_client_find_by_macaddr(*mac_addr);
+}
+
+void
+bm_stats_add_event_to_report(bm_client_t *client, bsal_event_t *event,
+                             dpp_bs_client_event_type_t bs_event, bool backoff_enabled)
+{
+    if (bs_event == PROBE) g_probe_reports++;
+}
+
+void
+bm_client_check_connected(bm_client_t *client, bm_group_t *group, const char *ifname)
+{
+    g_connects++;
+}
+
+bool bm_client_bs_ifname_allowed(bm_client_t *client, const char *ifname) { return true; }
+void bm_client_cs_check_rssi_xing(bm_client_t *client, bsal_event_t *event) {}
+void bm_client_disable_client_steering(bm_client_t *client) {}
+void bm_client_disconnected(bm_client_t *client) {}
+bm_client_reject_t bm_client_get_reject_detection(bm_client_t *client) { return BM_CLIENT_REJECT_NONE; }
+void bm_client_handle_ext_activity(bm_client_t *client, const char *ifname, bool active) {}
+void bm_client_handle_ext_xing(bm_client_t *client, const char *ifname, bsal_event_t *event) {}
+void bm_client_rejected(bm_client_t *client, bsal_event_t *event) {}
+void bm_client_reset_last_probe_snr(bm_client_t *client) {}
+void bm_client_send_rrm_req(bm_client_t *client, bm_client_rrm_req_type_t rrm_req_type, int delay) {}
+void bm_client_set_state(bm_client_t *client, bm_client_state_t state) {}
+bool bm_client_update_cs_state(bm_client_t *client) { return false; }
+bool bm_kick(bm_client_t *client, bm_kick_type_t type, uint8_t rssi) { return true; }
+void bm_kick_cancel_btm_retry_task(bm_client_t *client) {}
+void bm_kick_measurement(os_macaddr_t macaddr, uint8_t rssi) {}
+void bm_event_action_frame(const char *ifname, const uint8_t *data, unsigned int data_len) {}
+
+
+void
+setUp(void)
+{
+    size_t i;
+
+    memset(&g_group, 0, sizeof(g_group));
+    memset(g_clients, 0, sizeof(g_clients));
+    for (i = 0; i < ARRAY_SIZE(g_clients); i++)
+    {
+        snprintf(g_clients[i].mac_addr, sizeof(g_clients[i].mac_addr), PRI(os_macaddr_t),
+                 FMT(os_macaddr_pt, (os_macaddr_t *)g_macs[i]));
+        STRSCPY(g_clients[i].ifcfg[0].ifname, TEST_BM_IFNAME);
+        g_clients[i].ifcfg_num = 1;
+    }
+    g_probe_reports = 0;
+    g_connects = 0;
+
+    g_loop = ev_loop_new(0);
+    TEST_ASSERT_TRUE(bm_events_init(g_loop));
+    TEST_ASSERT_NOT_NULL(g_bsal_event_cb);
+}
+
+
+void
+tearDown(void)
+{
+    bm_events_cleanup();
+    ev_loop_destroy(g_loop);
+    g_loop = NULL;
+}
+
+
+/**
+ * @brief queues an event from the (simulated) BSAL thread
+ */
+static void
+test_bm_probe(int client, uint8_t rssi, bool ssid_null)
+{
+    bsal_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = BSAL_EVENT_PROBE_REQ;
+    STRSCPY(event.ifname, TEST_BM_IFNAME);
+    memcpy(event.data.probe_req.client_addr, g_macs[client], BSAL_MAC_ADDR_LEN);
+    event.data.probe_req.rssi = rssi;
+    event.data.probe_req.ssid_null = ssid_null;
+    g_bsal_event_cb(&event);
+}
+
+static void
+test_bm_connect(int client)
+{
+    bsal_event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = BSAL_EVENT_CLIENT_CONNECT;
+    STRSCPY(event.ifname, TEST_BM_IFNAME);
+    memcpy(event.data.connect.client_addr, g_macs[client], BSAL_MAC_ADDR_LEN);
+    g_bsal_event_cb(&event);
+}
+
+
+/**
+ * @brief a burst of probe requests of one client is handled once
+ */
+void
+test_events_coalesce_burst(void)
+{
+    const bm_events_stats_t *stats = bm_events_get_stats();
+    bm_client_stats_t *cstats = &g_clients[0].ifcfg[0].stats;
+    int i;
+
+    for (i = 0; i < 100; i++) test_bm_probe(0, 40 + (i % 5), false);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    TEST_ASSERT_EQUAL_UINT64(1, stats->batches);
+    TEST_ASSERT_EQUAL_UINT(100, stats->max_batch);
+    TEST_ASSERT_EQUAL_UINT64(99, stats->coalesced);
+    TEST_ASSERT_EQUAL_UINT64(1, stats->events);
+    TEST_ASSERT_EQUAL_UINT(0, stats->dropped);
+
+    /* The coalesced requests are still counted, with the latest RSSI */
+    TEST_ASSERT_EQUAL_UINT(100, cstats->probe.direct_cnt);
+    TEST_ASSERT_EQUAL_UINT(0, cstats->probe.null_cnt);
+    TEST_ASSERT_EQUAL_UINT(44, cstats->probe.last_snr);
+    TEST_ASSERT_EQUAL_INT(1, g_probe_reports);
+}
+
+
+/**
+ * @brief only probe requests of the same client and kind are coalesced
+ */
+void
+test_events_coalesce_clients(void)
+{
+    const bm_events_stats_t *stats = bm_events_get_stats();
+    int i;
+
+    for (i = 0; i < 10; i++)
+    {
+        test_bm_probe(0, 40, false);
+        test_bm_probe(1, 40, false);
+        test_bm_probe(0, 40, true);
+    }
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    TEST_ASSERT_EQUAL_UINT64(27, stats->coalesced);
+    TEST_ASSERT_EQUAL_UINT64(3, stats->events);
+    TEST_ASSERT_EQUAL_UINT(10, g_clients[0].ifcfg[0].stats.probe.direct_cnt);
+    TEST_ASSERT_EQUAL_UINT(10, g_clients[0].ifcfg[0].stats.probe.null_cnt);
+    TEST_ASSERT_EQUAL_UINT(10, g_clients[1].ifcfg[0].stats.probe.direct_cnt);
+}
+
+
+/**
+ * @brief probe requests are not coalesced across other events
+ */
+void
+test_events_coalesce_barrier(void)
+{
+    const bm_events_stats_t *stats = bm_events_get_stats();
+    int i;
+
+    for (i = 0; i < 5; i++) test_bm_probe(0, 40, false);
+    test_bm_connect(0);
+    for (i = 0; i < 5; i++) test_bm_probe(0, 40, false);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    TEST_ASSERT_EQUAL_UINT64(8, stats->coalesced);
+    TEST_ASSERT_EQUAL_UINT64(3, stats->events);
+    TEST_ASSERT_EQUAL_INT(1, g_connects);
+    TEST_ASSERT_EQUAL_UINT(10, g_clients[0].ifcfg[0].stats.probe.direct_cnt);
+}
+
+
+/**
+ * @brief events beyond the queue size are dropped and reported
+ */
+void
+test_events_queue_full(void)
+{
+    const bm_events_stats_t *stats = bm_events_get_stats();
+    int i;
+
+    for (i = 0; i < BM_CB_QUEUE_MAX + 10; i++) test_bm_probe(0, 40, false);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    TEST_ASSERT_EQUAL_UINT(10, stats->dropped);
+    TEST_ASSERT_EQUAL_UINT64(BM_CB_QUEUE_MAX - 1, stats->coalesced);
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX, g_clients[0].ifcfg[0].stats.probe.direct_cnt);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_events_coalesce_burst);
+    RUN_TEST(test_events_coalesce_clients);
+    RUN_TEST(test_events_coalesce_barrier);
+    RUN_TEST(test_events_queue_full);
+
+    return UNITY_END();
+}
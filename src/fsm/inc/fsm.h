@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ev.h>
 #include <libmnl/libmnl.h>
 #include <pcap.h>
+#include <pthread.h>
 #include <sys/sysinfo.h>
 #include <time.h>
 
@@ -294,6 +295,8 @@ struct fsm_dpi_plugin
     struct fsm_session *session;
     char *targets;
     char *excluded_targets;
+    struct om_mac_set *targets_set;
+    struct om_mac_set *excluded_targets_set;
     bool bound;
     bool clients_init;
     ds_tree_t dpi_clients;
@@ -354,6 +357,7 @@ struct fsm_session
     struct fsm_policy_client policy_client;
     struct fsm_session *provider_plugin;
     struct fsm_web_cat_ops *provider_ops;
+    pthread_mutex_t lock;            /* session state vs nfqueue workers */
 };
 
 
@@ -381,6 +385,8 @@ struct fsm_mgr
     int (*set_dpi_state)(struct net_header_parser *net_hdr,
                          enum fsm_dpi_state state);
     bool (*update_session_tap)(struct fsm_session *); /* session tap update */
+    pthread_rwlock_t dispatch_lock; /* main loop vs nfqueue workers */
+    bool nfq_workers;         /* nfqueues processed by worker threads */
 };
 
 
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define FSM_INTERNAL_H_INCLUDED
 
 #include "fsm.h"
+#include "nf_utils.h"
 #include "network_metadata_report.h"
 #include "policy_tags.h"
 
@@ -84,6 +85,39 @@ bool
 fsm_nfq_tap_update(struct fsm_session *session);
 
 
+/**
+ * @brief nfqueue packet handler
+ *
+ * Parses the packet headers and hands the packet to the session's parser.
+ * Invoked from the nfqueue worker threads when several queues are used.
+ *
+ * @param pkt_info the nfqueue packet
+ * @param data the fsm session
+ */
+void
+fsm_nfq_net_header_parse(struct nfq_pkt_info *pkt_info, void *data);
+
+
+/**
+ * @brief lock state shared by the nfqueue workers
+ *
+ * No-op unless the nfqueues are served by worker threads.
+ *
+ * @param lock the lock guarding the shared state
+ */
+void
+fsm_nfq_lock(pthread_mutex_t *lock);
+
+
+/**
+ * @brief unlock state shared by the nfqueue workers
+ *
+ * @param lock the lock guarding the shared state
+ */
+void
+fsm_nfq_unlock(pthread_mutex_t *lock);
+
+
 /**
  * @brief update raw socket settings for the given session
  *
@@ -63,7 +63,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static struct imc_context g_imc_client =
 {
     .initialized = false,
-    .endpoint = "ipc:///tmp/imc_fsm2fcm",
+    .endpoint = IMC_FSM2FCM_ENDPOINT,
 };
 
 static struct unix_context g_unix_client =
@@ -322,6 +322,40 @@ fsm_is_dpi(struct fsm_session *session)
 }
 
 
+/**
+ * @brief sets the targeted and excluded devices of a dpi plugin
+ *
+ * Retrieves the plugin's targeted and excluded devices from its
+ * other_config, and compiles them in mac sets checked per packet.
+ * @param session the dpi plugin session
+ * @param plugin the dpi plugin
+ */
+static void
+fsm_dpi_plugin_set_targets(struct fsm_session *session,
+                           struct fsm_dpi_plugin *plugin)
+{
+    plugin->targets = fsm_get_other_config_val(session, "targeted_devices");
+    plugin->excluded_targets = fsm_get_other_config_val(session,
+                                                        "excluded_devices");
+
+    /* The string checks remain in use if the compilation fails */
+    om_mac_set_free(plugin->targets_set);
+    plugin->targets_set = NULL;
+    if (plugin->targets != NULL)
+    {
+        plugin->targets_set = om_mac_set_alloc(&plugin->targets, 1);
+    }
+
+    om_mac_set_free(plugin->excluded_targets_set);
+    plugin->excluded_targets_set = NULL;
+    if (plugin->excluded_targets != NULL)
+    {
+        plugin->excluded_targets_set =
+            om_mac_set_alloc(&plugin->excluded_targets, 1);
+    }
+}
+
+
 /**
  * @brief initiates a dpi plugin session
  *
@@ -344,9 +378,7 @@ fsm_init_dpi_plugin(struct fsm_session *session)
     dpi_plugin->bound = false;
     dpi_plugin->clients_init = false;
 
-    dpi_plugin->targets = fsm_get_other_config_val(session, "targeted_devices");
-    dpi_plugin->excluded_targets = fsm_get_other_config_val(session,
-                                                            "excluded_devices");
+    fsm_dpi_plugin_set_targets(session, dpi_plugin);
 
     ret = fsm_dpi_add_plugin_to_dispatcher(session);
     if (!ret) return ret;
@@ -567,6 +599,17 @@ fsm_free_dpi_plugin(struct fsm_session *session)
     struct net_md_aggregator *aggr;
     struct fsm_session *dispatcher;
 
+    /* Release the targets mac sets */
+    dpi_context = session->dpi;
+    if (dpi_context != NULL)
+    {
+        dpi_plugin = &dpi_context->plugin;
+        om_mac_set_free(dpi_plugin->targets_set);
+        dpi_plugin->targets_set = NULL;
+        om_mac_set_free(dpi_plugin->excluded_targets_set);
+        dpi_plugin->excluded_targets_set = NULL;
+    }
+
     /* Retrieve the dispatcher */
     dispatcher = fsm_dpi_find_dispatcher(session);
     if (dispatcher == NULL) return;
@@ -627,17 +670,27 @@ fsm_dpi_find_mac_in_val(os_macaddr_t *mac, char *val)
 /**
  * @brief check if any mac of a ethernet header matches a given tag
  *
- * @param the mac address to check
+ * @param eth_hdr the ethernet header to check
+ * @param set the compiled representation of val, if any
  * @param val an opensync tag name or the string representation of a mac address
  * @return true if the mac matches the value, false otherwise
  */
 static bool
-fsm_dpi_find_macs_in_val(struct eth_header *eth_hdr, char *val)
+fsm_dpi_find_macs_in_val(struct eth_header *eth_hdr, struct om_mac_set *set,
+                         char *val)
 {
     bool rc;
 
     if (val == NULL) return false;
 
+    if (set != NULL)
+    {
+        rc = om_mac_set_in(set, eth_hdr->srcmac);
+        rc |= om_mac_set_in(set, eth_hdr->dstmac);
+
+        return rc;
+    }
+
     rc = fsm_dpi_find_mac_in_val(eth_hdr->srcmac, val);
     rc |= fsm_dpi_find_mac_in_val(eth_hdr->dstmac, val);
 
@@ -1220,10 +1273,7 @@ fsm_update_dpi_plugin(struct fsm_session *session)
     plugin_dpi_context = session->dpi;
     plugin = &plugin_dpi_context->plugin;
 
-    plugin->targets = fsm_get_other_config_val(session,
-                                               "targeted_devices");
-    plugin->excluded_targets = fsm_get_other_config_val(session,
-                                                        "excluded_devices");
+    fsm_dpi_plugin_set_targets(session, plugin);
     LOGD("%s: %s: targeted_devices: %s", __func__, session->name,
          plugin->targets ? plugin->targets : "None");
     LOGD("%s: %s: excluded_devices: %s", __func__, session->name,
@@ -1460,7 +1510,13 @@ void
 fsm_dpi_mark_for_report(struct fsm_session *session,
                         struct net_md_stats_accumulator *acc)
 {
+    struct fsm_dpi_dispatcher *dispatch;
+
+    /* The aggregator belongs to the dispatcher session */
+    dispatch = acc->aggr->context;
+    fsm_nfq_lock(&dispatch->session->lock);
     fsm_dpi_mark_acc_for_report(acc->aggr, acc);
+    fsm_nfq_unlock(&dispatch->session->lock);
 }
 
 
@@ -1509,6 +1565,11 @@ fsm_dispatch_pkt(struct fsm_session *session,
     drop = false;
     pass = true;
 
+    /*
+     * The flow's plugin contexts are only used by the worker serving
+     * the flow: the nfqueue balancing hash is symmetric. A plugin's
+     * session state is serialized by its session lock.
+     */
     while (info != NULL && !drop)
     {
         dpi_plugin = info->session;
@@ -1523,6 +1584,7 @@ fsm_dispatch_pkt(struct fsm_session *session,
         else
         {
             excluded = fsm_dpi_find_macs_in_val(eth_hdr,
+                                                plugin->excluded_targets_set,
                                                 plugin->excluded_targets);
         }
         if (excluded)
@@ -1539,7 +1601,9 @@ fsm_dispatch_pkt(struct fsm_session *session,
         }
         else
         {
-            included = fsm_dpi_find_macs_in_val(eth_hdr, plugin->targets);
+            included = fsm_dpi_find_macs_in_val(eth_hdr,
+                                                plugin->targets_set,
+                                                plugin->targets);
         }
         if (!included)
         {
@@ -1566,7 +1630,9 @@ fsm_dispatch_pkt(struct fsm_session *session,
                 info = ds_tree_next(tree, info);
                 continue;
             }
+            fsm_nfq_lock(&dpi_plugin->lock);
             dpi_plugin_ops->handler(dpi_plugin, net_parser);
+            fsm_nfq_unlock(&dpi_plugin->lock);
         }
 
         drop = (info->decision == FSM_DPI_DROP);
@@ -1575,7 +1641,6 @@ fsm_dispatch_pkt(struct fsm_session *session,
         info = ds_tree_next(tree, info);
     }
 
-
     if (session->tap_type == FSM_TAP_NFQ)
     {
         if (drop) nf_queue_set_verdict(net_parser->packet_id, NF_UTIL_NFQ_DROP);
@@ -1636,8 +1701,14 @@ fsm_dpi_handler(struct fsm_session *session,
 
     dispatch = &dpi_context->dispatch;
 
+    /* The flow table is shared by the nfqueue workers */
+    fsm_nfq_lock(&session->lock);
     acc = fsm_net_parser_to_acc(net_parser, dispatch->aggr);
-    if (acc == NULL) return;
+    if (acc == NULL)
+    {
+        fsm_nfq_unlock(&session->lock);
+        return;
+    }
 
     counters.packets_count = acc->counters.packets_count + 1;
     counters.bytes_count = acc->counters.bytes_count + net_parser->packet_len;
@@ -1646,6 +1717,7 @@ fsm_dpi_handler(struct fsm_session *session,
     net_md_set_counters(dispatch->aggr, acc, &counters);
 
     fsm_dpi_alloc_flow_context(session, acc);
+    fsm_nfq_unlock(&session->lock);
     net_parser->acc = acc;
 
     filter = fsm_dpi_filter_packet(net_parser);
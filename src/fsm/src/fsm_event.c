@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "fsm.h"
 #include "log.h"
+#include "nf_utils.h"
 
 // Intervals and timeouts in seconds
 #define FSM_TIMER_INTERVAL 5
@@ -86,6 +87,7 @@ fsm_event_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
     struct fsm_session *session = ds_tree_head(sessions);
     struct mem_usage mem = { 0 };
     struct nfqnl_counters nfq_counters = { 0 };
+    struct nfq_batch_stats batch_stats;
     time_t now = time(NULL);
     bool reset;
 
@@ -120,6 +122,12 @@ fsm_event_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
         nfq_counters.queue_dropped,
         nfq_counters.queue_user_dropped);
 
+    nf_queue_get_batch_stats(&batch_stats);
+    LOGI("netlink queue batching: packets: %" PRIu64 " recv calls: %" PRIu64
+         " verdicts: %" PRIu64 " verdict msgs: %" PRIu64 " verdict calls: %" PRIu64,
+         batch_stats.rcv_pkts, batch_stats.rcv_calls, batch_stats.verdicts,
+         batch_stats.verdict_msgs, batch_stats.verdict_calls);
+
     fsm_get_memory(&mem);
     LOGI("pid %s: mem usage: real mem: %u, virt mem %u",
          mgr->pid, mem.curr_real_mem, mem.curr_virt_mem);
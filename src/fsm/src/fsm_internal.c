@@ -192,7 +192,7 @@ void fsm_free_tap_resources(struct fsm_session *session)
 
     case FSM_TAP_NFQ:
         /* Free nfq resources */
-        nf_queue_exit();
+        fsm_nfq_close(session);
         break;
 
     case FSM_TAP_RAW:
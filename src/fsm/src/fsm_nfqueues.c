@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <errno.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -59,13 +60,14 @@ void util_populate_sockaddr(int af, void *ip, struct sockaddr_storage *dst)
  *
  * @return 0 if the parsing is successful, -1 otherwise
  */
-static void
+void
 fsm_nfq_net_header_parse(struct nfq_pkt_info *pkt_info, void *data)
 {
     struct net_header_parser net_parser;
     struct fsm_parser_ops *parser_ops;
     struct fsm_session *session;
     struct sockaddr_storage key;
+    struct fsm_mgr *mgr;
     struct ip6_hdr *ipv6hdr;
     struct iphdr *ipv4hdr;
     os_macaddr_t src_mac;
@@ -151,15 +153,158 @@ fsm_nfq_net_header_parse(struct nfq_pkt_info *pkt_info, void *data)
 
     session = (struct fsm_session *)data;
     parser_ops = &session->p_ops->parser_ops;
-    parser_ops->handler(session, &net_parser);
+
+    mgr = fsm_get_mgr();
+    if (!mgr->nfq_workers)
+    {
+        parser_ops->handler(session, &net_parser);
+        return;
+    }
+
+    /*
+     * Workers only exclude the main loop callbacks, and each other on
+     * the state they share: the dpi dispatcher locks its flow table and
+     * each plugin session, other parsers are serialized per session.
+     * The caches shared by the plugins have their own locks, and the
+     * main loop watchers are left to the main loop.
+     */
+    pthread_rwlock_rdlock(&mgr->dispatch_lock);
+    if (session->type == FSM_DPI_DISPATCH)
+    {
+        parser_ops->handler(session, &net_parser);
+    }
+    else
+    {
+        pthread_mutex_lock(&session->lock);
+        parser_ops->handler(session, &net_parser);
+        pthread_mutex_unlock(&session->lock);
+    }
+    pthread_rwlock_unlock(&mgr->dispatch_lock);
 
     return;
 }
 
 
+/**
+ * @brief lock state shared by the nfqueue workers, see fsm_internal.h
+ */
+void
+fsm_nfq_lock(pthread_mutex_t *lock)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+
+    if (mgr->nfq_workers) pthread_mutex_lock(lock);
+}
+
+
+/**
+ * @brief unlock state shared by the nfqueue workers, see fsm_internal.h
+ */
+void
+fsm_nfq_unlock(pthread_mutex_t *lock)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+
+    if (mgr->nfq_workers) pthread_mutex_unlock(lock);
+}
+
+
+/**
+ * @brief main loop release callback, see ev_set_loop_release_cb()
+ */
+static void
+fsm_nfq_loop_release(EV_P)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+
+    pthread_rwlock_unlock(&mgr->dispatch_lock);
+}
+
+
+/**
+ * @brief main loop acquire callback, see ev_set_loop_release_cb()
+ */
+static void
+fsm_nfq_loop_acquire(EV_P)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+
+    pthread_rwlock_wrlock(&mgr->dispatch_lock);
+}
+
+
+/**
+ * @brief share the fsm state between the main loop and nfqueue workers
+ *
+ * The main loop holds the dispatch lock exclusively while running its
+ * callbacks and releases it while waiting for events. The workers take
+ * it shared. Called from a main loop callback, the lock is taken right
+ * away.
+ *
+ * @param mgr the fsm manager
+ */
+static void
+fsm_nfq_workers_enable(struct fsm_mgr *mgr)
+{
+    pthread_rwlock_wrlock(&mgr->dispatch_lock);
+    if (mgr->loop != NULL)
+    {
+        ev_set_loop_release_cb(mgr->loop, fsm_nfq_loop_release,
+                               fsm_nfq_loop_acquire);
+    }
+    mgr->nfq_workers = true;
+}
+
+
+/**
+ * @brief stop sharing the fsm state with nfqueue workers
+ *
+ * The workers must be stopped at this point.
+ *
+ * @param mgr the fsm manager
+ * @param locked true if the dispatch lock is held
+ */
+static void
+fsm_nfq_workers_disable(struct fsm_mgr *mgr, bool locked)
+{
+    if (mgr->loop != NULL) ev_set_loop_release_cb(mgr->loop, NULL, NULL);
+    if (locked) pthread_rwlock_unlock(&mgr->dispatch_lock);
+    mgr->nfq_workers = false;
+}
+
+
+/**
+ * @brief read a numeric nfqueue setting from the session's other_config
+ *
+ * @param session the fsm session
+ * @param key the other_config key
+ * @param value updated with the setting if present
+ */
+static void
+fsm_nfq_get_config_u32(struct fsm_session *session, char *key, uint32_t *value)
+{
+    char *str;
+
+    str = fsm_get_other_config_val(session, key);
+    if (str == NULL) return;
+
+    errno = 0;
+    *value = strtoul(str, NULL, 10);
+    if (errno != 0)
+    {
+        LOGD("%s: error reading value %s: %s", __func__,
+             str, strerror(errno));
+    }
+}
+
+
 /**
  * @brief update nfqueues settings for the given session
  *
+ * other_config nfqueue_num_queues sets the number of queues, bound from
+ * queue 0 to match iptables' NFQUEUE --queue-balance 0:<n - 1>.
+ * When more than one queue is used, each queue is served by a worker thread.
+ *
  * @param session the fsm session involved
  * @return true if the nfqueue settings were successful, false otherwise
  */
@@ -169,61 +314,89 @@ fsm_nfq_tap_update(struct fsm_session *session)
     bool ret;
     struct nfq_settings nfqs;
     struct fsm_mgr *mgr;
-    char   *buf_size_str;
-    char   *queue_len_str;
+    uint32_t batch_size = NF_QUEUE_DEFAULT_BATCH_SIZE;
     uint32_t nlbuf_sz = 3*(1024 * 1024); // 3M netlink packet buffer.
     uint32_t queue_len = 10240;  // number of packets in queue.
+    uint32_t num_queues = 1;
 
     if (session->tap_type != FSM_TAP_NFQ) return false;
 
+    fsm_nfq_get_config_u32(session, "nfqueue_batch_size", &batch_size);
+    fsm_nfq_get_config_u32(session, "nfqueue_num_queues", &num_queues);
+    if (num_queues == 0 || num_queues > NF_QUEUE_MAX_QUEUES)
+    {
+        LOGE("%s: invalid number of queues %u, using 1", __func__, num_queues);
+        num_queues = 1;
+    }
+
     mgr = fsm_get_mgr();
+    memset(&nfqs, 0, sizeof(nfqs));
     nfqs.loop = mgr->loop;
     nfqs.nfq_cb = fsm_nfq_net_header_parse;
     nfqs.queue_num = 0;
+    nfqs.num_queues = num_queues;
+    nfqs.worker_threads = (num_queues > 1);
+    nfqs.batch_size = batch_size;
     nfqs.data = session;
 
+    if (nfqs.worker_threads && !mgr->nfq_workers) fsm_nfq_workers_enable(mgr);
+
     ret = nf_queue_init(&nfqs);
     if (ret == false)
     {
         LOGE("%s : nfqs init failed", __func__);
+        if (mgr->nfq_workers) fsm_nfq_workers_disable(mgr, true);
         return false;
     }
 
-    buf_size_str = fsm_get_other_config_val(session, "nfqueue_buff_size");
-    if (buf_size_str != NULL)
-    {
-        errno = 0;
-        nlbuf_sz = strtoul(buf_size_str, NULL, 10);
-        if (errno != 0)
-        {
-            LOGD("%s: error reading value %s: %s", __func__,
-                 buf_size_str, strerror(errno));
-        }
-    }
-
+    fsm_nfq_get_config_u32(session, "nfqueue_buff_size", &nlbuf_sz);
     ret = nf_queue_set_nlsock_buffsz(nlbuf_sz);
     if (ret == false)
     {
         LOGE("%s: Failed to set netlink sock buf size[%u].",__func__, nlbuf_sz);
     }
 
-    queue_len_str = fsm_get_other_config_val(session, "nfqueue_length");
-    if (queue_len_str != NULL)
+    fsm_nfq_get_config_u32(session, "nfqueue_length", &queue_len);
+    ret = nf_queue_set_queue_maxlen(queue_len);
+    if (ret == false)
     {
-        errno = 0;
-        queue_len = strtoul(queue_len_str, NULL, 10);
-        if (errno != 0)
-        {
-            LOGD("%s: error reading value %s: %s", __func__,
-                 buf_size_str, strerror(errno));
-        }
+        LOGE("%s: Failed to set default nfueue length[%u].",__func__,queue_len);
     }
 
-    ret = nf_queue_set_queue_maxlen(queue_len);
+    /* Queues served by workers are sized at init time */
+    if (mgr->nfq_workers) return true;
+
+    ret = nf_queue_set_batch_size(batch_size);
     if (ret == false)
     {
-        LOGE("%s: Failed to set default nfueue length[%u].",__func__,queue_len);
+        LOGE("%s: Failed to set nfqueue batch size[%u].", __func__, batch_size);
     }
 
     return true;
 }
+
+
+/**
+ * @brief free allocated nfqueue resources
+ *
+ * @param session the fsm session involved
+ */
+void
+fsm_nfq_close(struct fsm_session *session)
+{
+    struct fsm_mgr *mgr;
+
+    (void)session;
+
+    mgr = fsm_get_mgr();
+    if (!mgr->nfq_workers)
+    {
+        nf_queue_exit();
+        return;
+    }
+
+    /* Let the workers complete their pending dispatch before joining them */
+    pthread_rwlock_unlock(&mgr->dispatch_lock);
+    nf_queue_exit();
+    fsm_nfq_workers_disable(mgr, false);
+}
@@ -24,6 +24,7 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -161,12 +162,22 @@ fsm_tag_update_init(void)
 void
 fsm_init_mgr(struct ev_loop *loop)
 {
+    pthread_rwlockattr_t attr;
     struct fsm_mgr *mgr;
     int rc;
 
     mgr = fsm_get_mgr();
     memset(mgr, 0, sizeof(*mgr));
     mgr->loop = loop;
+
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    /* The main loop must not starve behind the nfqueue workers */
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&mgr->dispatch_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
     snprintf(mgr->pid, sizeof(mgr->pid), "%d", (int)getpid());
     ds_tree_init(&mgr->fsm_sessions, fsm_sessions_cmp,
                  struct fsm_session, fsm_node);
@@ -821,6 +832,8 @@ fsm_alloc_session(struct schema_Flow_Service_Manager_Config *conf)
     session = calloc(1, sizeof(struct fsm_session));
     if (session == NULL) return NULL;
 
+    pthread_mutex_init(&session->lock, NULL);
+
     session->name = strdup(conf->handler);
     if (session->name == NULL) goto err_free_session;
 
@@ -912,6 +925,8 @@ fsm_free_session(struct fsm_session *session)
     /* Free the session provider */
     free(session->provider);
 
+    pthread_mutex_destroy(&session->lock);
+
     /* Finally free the session */
     free(session);
 }
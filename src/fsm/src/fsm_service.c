@@ -193,6 +193,8 @@ fsm_dup_web_cat_session(struct fsm_session *session)
     service = calloc(1, sizeof(struct fsm_session));
     if (service == NULL) return NULL;
 
+    pthread_mutex_init(&service->lock, NULL);
+
     service->name = strdup(service_name);
     if (service->name == NULL) goto err_free_session;
 
@@ -28,12 +28,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <net/if.h>
+#include <linux/if_ether.h>
+#include <netinet/ip.h>
 
 #include "fsm.h"
 #include "fsm_internal.h"
 #include "log.h"
+#include "neigh_table.h"
 #include "network_metadata_report.h"
 #include "target.h"
 #include "unity.h"
@@ -550,6 +555,26 @@ struct schema_Flow_Service_Manager_Config g_confs[] =
         },
         .other_config_len = 3,
     },
+
+    /* dpi plugin, nfqueue workers, idx: 20 */
+    {
+        .handler = "fsm_session_test_20",
+        .plugin = "plugin_20",
+        .type = "dpi_plugin",
+        .other_config_keys =
+        {
+            "mqtt_v",                       /* topic */
+            "dso_init",                     /* plugin init routine */
+            "dpi_dispatcher",               /* dpi dispatcher */
+        },
+        .other_config =
+        {
+            "dev-test/IP/Flows/ut/0/20",    /* topic */
+            "test_20_dso_init",             /* plugin init routine */
+            "fsm_session_test_6",           /* dpi dispatcher */
+        },
+        .other_config_len = 3,
+    },
 };
 
 /**
@@ -698,6 +723,106 @@ test_14_dso_init(struct fsm_session *session)
 }
 
 
+#define TEST_NFQ_MAX_FLOWS 32
+
+/**
+ * @brief packets of a flow seen by the nfqueue workers test plugin
+ */
+struct test_nfq_flow
+{
+    struct net_md_stats_accumulator *acc;
+    pthread_t thread;
+    uint8_t *seen;
+    size_t npkts;
+    size_t dups;
+    size_t moved;
+};
+
+struct test_nfq_flows
+{
+    pthread_mutex_t lock;
+    struct test_nfq_flow flows[TEST_NFQ_MAX_FLOWS];
+    size_t nflows;
+    size_t max_id;
+    size_t unknown;
+} g_nfq_flows =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+/**
+ * @brief records the flow, the worker and the packet id of a packet
+ */
+static void
+test_nfq_plugin_handler(struct fsm_session *session,
+                        struct net_header_parser *net_parser)
+{
+    struct test_nfq_flows *flows = &g_nfq_flows;
+    struct test_nfq_flow *flow;
+    size_t id;
+    size_t i;
+
+    pthread_mutex_lock(&flows->lock);
+
+    flow = NULL;
+    for (i = 0; i < flows->nflows; i++)
+    {
+        if (flows->flows[i].acc != net_parser->acc) continue;
+        flow = &flows->flows[i];
+        break;
+    }
+
+    if (flow == NULL && flows->nflows < TEST_NFQ_MAX_FLOWS)
+    {
+        flow = &flows->flows[flows->nflows++];
+        flow->acc = net_parser->acc;
+        flow->thread = pthread_self();
+        flow->seen = calloc(flows->max_id, sizeof(*flow->seen));
+    }
+
+    id = net_parser->packet_id;
+    if (flow == NULL || flow->seen == NULL || id >= flows->max_id)
+    {
+        flows->unknown++;
+        pthread_mutex_unlock(&flows->lock);
+        return;
+    }
+
+    if (!pthread_equal(flow->thread, pthread_self())) flow->moved++;
+    if (flow->seen[id]++ != 0) flow->dups++;
+    flow->npkts++;
+
+    pthread_mutex_unlock(&flows->lock);
+}
+
+
+static void
+test_nfq_flows_reset(size_t max_id)
+{
+    struct test_nfq_flows *flows = &g_nfq_flows;
+    size_t i;
+
+    for (i = 0; i < flows->nflows; i++) free(flows->flows[i].seen);
+    memset(flows->flows, 0, sizeof(flows->flows));
+    flows->nflows = 0;
+    flows->max_id = max_id;
+    flows->unknown = 0;
+}
+
+
+int
+test_20_dso_init(struct fsm_session *session)
+{
+    struct fsm_dpi_plugin_ops *ops;
+
+    ops = &session->p_ops->dpi_plugin_ops;
+    ops->handler = test_nfq_plugin_handler;
+
+    return 0;
+}
+
+
 typedef int (*dso_init)(struct fsm_session *session);;
 
 /**
@@ -718,6 +843,10 @@ struct ut_dso_init
         .fname = "test_14_dso_init",
         .fn = test_14_dso_init,
     },
+    {
+        .fname = "test_20_dso_init",
+        .fn = test_20_dso_init,
+    },
 };
 
 
@@ -3066,6 +3195,216 @@ test_11_dpi_dispatcher_reserved_port_originator(void)
     TEST_ASSERT_NULL(info);
 }
 
+/**
+ * @brief the captured trace replayed by the nfqueue workers benchmark
+ *
+ * Frames of pcap.c in capture order: http, https, quic, openvpn, ssdp
+ * and lan traffic flows, both directions.
+ */
+static const struct test_nfq_frame
+{
+    const uint8_t *pkt;
+    size_t len;
+} g_nfq_capture[] =
+{
+    { pkt1, sizeof(pkt1) },
+    { pkt18, sizeof(pkt18) },
+    { pkt41, sizeof(pkt41) },
+    { pkt42, sizeof(pkt42) },
+    { pkt98, sizeof(pkt98) },
+    { pkt200, sizeof(pkt200) },
+    { pkt201, sizeof(pkt201) },
+    { pkt202, sizeof(pkt202) },
+    { pkt203, sizeof(pkt203) },
+    { pkt372, sizeof(pkt372) },
+    { pkt486, sizeof(pkt486) },
+    { pkt858, sizeof(pkt858) },
+    { pkt862, sizeof(pkt862) },
+    { pkt869, sizeof(pkt869) },
+    { pkt870, sizeof(pkt870) },
+};
+
+#define TEST_NFQ_CAPTURE_LEN (sizeof(g_nfq_capture) / sizeof(*g_nfq_capture))
+#define TEST_NFQ_MAX_WORKERS 4
+
+struct test_nfq_worker
+{
+    pthread_t thread;
+    struct fsm_session *session;
+    int queue_num;
+    size_t frames[TEST_NFQ_CAPTURE_LEN];
+    size_t nframes;
+    size_t rounds;
+    size_t npkts;
+    uint8_t pkt[2048];
+};
+
+
+/**
+ * @brief maps a frame to a queue as nfqueue --queue-balance does
+ *
+ * The kernel hashes the xor of the ip addresses and the protocol, so
+ * both directions of a flow land on the same queue.
+ */
+static int
+test_nfq_capture_queue(const struct test_nfq_frame *frame, int num_queues)
+{
+    const struct iphdr *iph;
+    uint32_t hash;
+
+    iph = (const struct iphdr *)(frame->pkt + ETH_HLEN);
+    hash = (iph->saddr ^ iph->daddr) + iph->protocol;
+    hash *= 2654435761U;
+
+    return ((uint64_t)hash * num_queues) >> 32;
+}
+
+
+/**
+ * @brief replays its share of the capture through the nfqueue handler
+ *
+ * Each frame is copied to the worker's buffer, as nf_queue copies it out
+ * of the netlink message, and gets a packet id unique across workers.
+ */
+static void *
+test_nfq_worker_replay(void *arg)
+{
+    const struct test_nfq_frame *frame;
+    struct test_nfq_worker *worker;
+    struct nfq_pkt_info pkt_info;
+    size_t round;
+    size_t idx;
+    size_t i;
+
+    worker = (struct test_nfq_worker *)arg;
+
+    memset(&pkt_info, 0, sizeof(pkt_info));
+    pkt_info.queue_num = worker->queue_num;
+    pkt_info.hw_protocol = ETH_P_IP;
+    pkt_info.hw_addr = &worker->pkt[ETH_ALEN];
+    pkt_info.payload = &worker->pkt[ETH_HLEN];
+
+    for (round = 0; round < worker->rounds; round++)
+    {
+        for (i = 0; i < worker->nframes; i++)
+        {
+            idx = worker->frames[i];
+            frame = &g_nfq_capture[idx];
+            memcpy(worker->pkt, frame->pkt, frame->len);
+            pkt_info.payload_len = frame->len - ETH_HLEN;
+            pkt_info.packet_id = round * TEST_NFQ_CAPTURE_LEN + idx;
+            fsm_nfq_net_header_parse(&pkt_info, worker->session);
+            worker->npkts++;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief benchmark the nfqueue workers dispatch
+ *
+ * Replays the captured trace through 1 to 4 workers, the frames spread
+ * over the workers' queues as the kernel balances flows over nfqueues.
+ * Header parsing, neighbour lookups and verdicts run in parallel, the
+ * workers only contend on the flow table and on the dpi plugins.
+ * Reports the throughput of each run and validates that the plugin sees
+ * every packet exactly once, and the packets of a flow from a single
+ * worker.
+ */
+void
+test_nfq_workers_replay(void)
+{
+    struct test_nfq_worker workers[TEST_NFQ_MAX_WORKERS];
+    struct schema_Flow_Service_Manager_Config *conf;
+    struct test_nfq_flows *flows = &g_nfq_flows;
+    struct test_nfq_worker *worker;
+    struct test_nfq_flow *flow;
+    struct fsm_session *session;
+    size_t rounds = 4000;
+    struct timespec start;
+    struct timespec end;
+    ds_tree_t *sessions;
+    size_t nworkers;
+    double elapsed;
+    size_t seen;
+    size_t total;
+    size_t busy;
+    size_t i;
+    int queue;
+    int rc;
+
+    neigh_table_init();
+
+    /* Add the dpi plugin recording the packets */
+    conf = &g_confs[20];
+    fsm_add_session(conf);
+    sessions = fsm_get_sessions();
+    TEST_ASSERT_NOT_NULL(ds_tree_find(sessions, conf->handler));
+
+    conf = &g_confs[6];
+    fsm_add_session(conf);
+    session = ds_tree_find(sessions, conf->handler);
+    TEST_ASSERT_NOT_NULL(session);
+
+    g_mgr->nfq_workers = true;
+    for (nworkers = 1; nworkers <= TEST_NFQ_MAX_WORKERS; nworkers *= 2)
+    {
+        memset(workers, 0, sizeof(workers));
+        for (i = 0; i < TEST_NFQ_CAPTURE_LEN; i++)
+        {
+            queue = test_nfq_capture_queue(&g_nfq_capture[i], nworkers);
+            worker = &workers[queue];
+            worker->frames[worker->nframes++] = i;
+        }
+
+        test_nfq_flows_reset(rounds * TEST_NFQ_CAPTURE_LEN);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < nworkers; i++)
+        {
+            workers[i].session = session;
+            workers[i].queue_num = i;
+            workers[i].rounds = rounds;
+            rc = pthread_create(&workers[i].thread, NULL,
+                                test_nfq_worker_replay, &workers[i]);
+            TEST_ASSERT_EQUAL_INT(0, rc);
+        }
+
+        total = 0;
+        busy = 0;
+        for (i = 0; i < nworkers; i++)
+        {
+            pthread_join(workers[i].thread, NULL);
+            total += workers[i].npkts;
+            if (workers[i].npkts != 0) busy++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        elapsed = (end.tv_sec - start.tv_sec) * 1e3;
+        elapsed += (end.tv_nsec - start.tv_nsec) / 1e6;
+        LOGI("%s: %zu worker(s), %zu busy: %zu packets in %.2f ms, %.0f pkts/s",
+             __func__, nworkers, busy, total, elapsed,
+             elapsed > 0 ? (total * 1e3) / elapsed : 0);
+
+        /* Every packet delivered once, each flow from a single worker */
+        TEST_ASSERT_EQUAL_UINT(rounds * TEST_NFQ_CAPTURE_LEN, total);
+        TEST_ASSERT_EQUAL_UINT(0, flows->unknown);
+        seen = 0;
+        for (i = 0; i < flows->nflows; i++)
+        {
+            flow = &flows->flows[i];
+            TEST_ASSERT_EQUAL_UINT(0, flow->dups);
+            TEST_ASSERT_EQUAL_UINT(0, flow->moved);
+            seen += flow->npkts;
+        }
+        TEST_ASSERT_EQUAL_UINT(total, seen);
+    }
+    g_mgr->nfq_workers = false;
+    test_nfq_flows_reset(0);
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -3107,6 +3446,7 @@ main(int argc, char *argv[])
     RUN_TEST(test_9_dpi_dispatcher_excluded_devices);
     RUN_TEST(test_10_dpi_dispatcher_included_excluded_devices);
     RUN_TEST(test_11_dpi_dispatcher_reserved_port_originator);
+    RUN_TEST(test_nfq_workers_replay);
 
     return UNITY_END();
 }
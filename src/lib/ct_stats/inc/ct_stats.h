@@ -77,6 +77,50 @@ struct flow_tracker
     ds_tree_node_t  ft_tnode;
 };
 
+/**
+ * Entry of the persistent conntrack flow table maintained from conntrack
+ * events. Keyed by the original direction tuple and the conntrack zone.
+ */
+struct ct_flow_key
+{
+    layer3_ct_info_t layer3_info;
+    uint16_t ct_zone;
+};
+
+typedef struct ct_flow_entry
+{
+    struct ct_flow_key key;
+    ct_flow_t orig;
+    ct_flow_t reply;
+    bool has_counters;
+    bool has_reply;
+    bool seen; // refreshed by the ongoing resync dump
+    bool ended; // destroyed, reported by the next multi zones collection
+    ds_tree_node_t ct_node;
+} ct_flow_entry_t;
+
+/**
+ * Conntrack event subscription state
+ */
+struct ct_stats_events
+{
+    bool enabled;
+    struct mnl_socket *nl;
+    struct ev_io ev_io_mnl;
+    ds_tree_t flows;            // persistent flow table
+    size_t num_flows;
+    bool resync;                // events were lost, the table needs a resync
+    int resync_interval;        // collect intervals between resyncs, 0: on overflow only
+    int intervals;              // collect intervals since the last resync
+
+    /* counters */
+    uint64_t new_events;
+    uint64_t update_events;
+    uint64_t destroy_events;
+    uint64_t overflows;
+    uint64_t resyncs;
+};
+
 typedef struct flow_stats_
 {
     fcm_collect_plugin_t *collector;
@@ -110,6 +154,7 @@ typedef struct flow_stats_mgr_
     int max_sessions;
     flow_stats_t *active;
     bool debug;
+    struct ct_stats_events events;
 } flow_stats_mgr_t;
 
 
@@ -131,6 +176,49 @@ ct_stats_get_ct_flow(int af_family);
 int
 data_cb(const struct nlmsghdr *nlh, void *data);
 
+/**
+ * @brief subscribes to conntrack events and loads the flow table
+ *
+ * @param mgr the plugin global state
+ * @return 0 if successful, -1 otherwise
+ */
+int
+ct_stats_events_init(flow_stats_mgr_t *mgr);
+
+/**
+ * @brief unsubscribes from conntrack events and frees the flow table
+ *
+ * @param mgr the plugin global state
+ */
+void
+ct_stats_events_exit(flow_stats_mgr_t *mgr);
+
+/**
+ * @brief mnl callback processing a conntrack event
+ *
+ * NEW and UPDATE events refresh the flow table. DESTROY events feed the
+ * final counters of the flow to the aggregator and drop the flow from
+ * the table; when the zones are merged, the flow is kept for the next
+ * collection instead. Dump replies are processed as UPDATE events.
+ *
+ * @param nlh the netlink message
+ * @param data the plugin global state
+ * @return MNL_CB_OK when successful, MNL_CB_ERROR otherwise
+ */
+int
+ct_stats_event_cb(const struct nlmsghdr *nlh, void *data);
+
+/**
+ * @brief reloads the flow table from a conntrack dump
+ *
+ * Flows gone from conntrack while events were lost are reported as ended.
+ *
+ * @param mgr the plugin global state
+ * @return 0 if successful, -1 otherwise
+ */
+int
+ct_stats_events_resync(flow_stats_mgr_t *mgr);
+
 void
 ct_stats_collect_cb(fcm_collect_plugin_t *collector);
 
@@ -72,7 +72,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static struct imc_context g_imc_server =
 {
     .initialized = false,
-    .endpoint = "ipc:///tmp/imc_fsm2fcm",
+    .endpoint = IMC_FSM2FCM_ENDPOINT,
 };
 
 static struct unix_context g_unix_server =
@@ -97,6 +97,7 @@ static struct imc_context g_imc_app_server =
 static struct imc_dso g_imc_context = { 0 };
 
 static int flow_cmp(void *a, void *b);
+static int ct_flow_key_cmp(void *a, void *b);
 
 /**
  * Temporary list to merge similar flows across zones.
@@ -1003,77 +1004,88 @@ get_counter(const struct nlattr *nest, ct_flow_t *_flow)
 
 
 /**
- * @brief callback parsing the content of a netlink message
+ * Content of a conntrack message relevant to ct_stats
+ */
+struct ct_stats_msg
+{
+    ct_flow_t orig;
+    ct_flow_t reply;
+    uint16_t ct_zone;
+    bool protoinfo;
+    bool orig_counters;
+    bool reply_counters;
+};
+
+
+/**
+ * @brief parses a conntrack message
  *
- * @param nhl the netlink header message
- * @param data the opaque context passed to mnl processing
- * @return MNL_CB_OK when successful, -1 otherwise
+ * Dump replies always carry the protocol info and the counters. Events may
+ * not: DESTROY events come without protocol info, and UPDATE events only
+ * carry it when it changed.
+ *
+ * @param nlh the netlink message
+ * @param ct_stats the active session
+ * @param msg the parsed content
+ * @param strict true if protocol info and original counters are mandatory
+ * @return 1 if the message describes a flow to account, 0 if it is to be
+ *         skipped, -1 on a malformed message
  */
-int
-data_cb(const struct nlmsghdr *nlh, void *data)
+static int
+ct_stats_parse_msg(const struct nlmsghdr *nlh, flow_stats_t *ct_stats,
+                   struct ct_stats_msg *msg, bool strict)
 {
     struct nlattr *tb[CTA_MAX+1];
-    ctflow_info_t *flow_info_1;
-    ctflow_info_t *flow_info;
-    flow_stats_t *ct_stats;
     struct nfgenmsg *nfg;
     ct_flow_t *flow_1;
-    uint16_t ct_zone;
     ct_flow_t *flow;
     int rc;
     int af;
 
     memset(tb, 0, (CTA_MAX+1) * sizeof(tb[0]));
-    ct_stats = (flow_stats_t *)data;
+    memset(msg, 0, sizeof(*msg));
     nfg = mnl_nlmsg_get_payload(nlh);
 
     rc = mnl_attr_parse(nlh, sizeof(*nfg), data_attr_cb, tb);
-    if (rc < 0) return MNL_CB_ERROR;
+    if (rc < 0) return -1;
 
     if (tb[CTA_ZONE] != NULL)
     {
-        ct_zone = ntohs(mnl_attr_get_u16(tb[CTA_ZONE]));
+        msg->ct_zone = ntohs(mnl_attr_get_u16(tb[CTA_ZONE]));
     }
     else
     {
-        ct_zone = 0; /* Zone = 0 flows will not have CTA_ZONE */
+        msg->ct_zone = 0; /* Zone = 0 flows will not have CTA_ZONE */
     }
 
     LOGT("%s: Lookup IP flow for ct_zone: %d, retrieved: %d", __func__,
-         ct_stats->ct_zone, ct_zone);
+         ct_stats->ct_zone, msg->ct_zone);
 
     if (ct_stats->ct_zone != USHRT_MAX &&
-        ct_stats->ct_zone != ct_zone) return MNL_CB_OK;
+        ct_stats->ct_zone != msg->ct_zone) return 0;
 
     LOGT("%s: Included IP flow for ct_zone: %d", __func__,
-          ct_zone);
+          msg->ct_zone);
 
-    flow_info = calloc(1, sizeof(struct ctflow_info));
-    if(flow_info == NULL) return MNL_CB_OK;
-    flow =  &flow_info->flow;
-
-    flow_info_1 = calloc(1, sizeof(struct ctflow_info));
-    if(flow_info_1 == NULL) goto flow_info_free;
-    flow_1 =  &flow_info_1->flow;
+    flow = &msg->orig;
+    flow_1 = &msg->reply;
 
-    if (tb[CTA_TUPLE_ORIG] == NULL) goto flow_info_1_free;
+    if (tb[CTA_TUPLE_ORIG] == NULL) return 0;
 
     rc = get_tuple(tb[CTA_TUPLE_ORIG], flow);
-    if (rc < 0) goto flow_info_1_free;
+    if (rc < 0) return 0;
 
-    if (tb[CTA_TUPLE_REPLY] == NULL) goto flow_info_1_free;
+    if (tb[CTA_TUPLE_REPLY] == NULL) return 0;
 
     rc = get_tuple(tb[CTA_TUPLE_REPLY], flow_1);
-    if (rc < 0) goto flow_info_1_free;
+    if (rc < 0) return 0;
 
     af = flow->layer3_info.dst_ip.ss_family;
-    if (ct_stats_filter_ip(af, &flow->layer3_info.dst_ip)) goto flow_info_1_free;
+    if (ct_stats_filter_ip(af, &flow->layer3_info.dst_ip)) return 0;
 
     af = flow_1->layer3_info.src_ip.ss_family;
-    if (ct_stats_filter_ip(af, &flow_1->layer3_info.src_ip)) goto flow_info_1_free;
+    if (ct_stats_filter_ip(af, &flow_1->layer3_info.src_ip)) return 0;
 
-
-    af = flow_1->layer3_info.src_ip.ss_family;
     // Getting the original ip for v4 NAT'ed case.
     if (af == AF_INET)
     {
@@ -1081,65 +1093,99 @@ data_cb(const struct nlmsghdr *nlh, void *data)
         flow_1->layer3_info.dst_ip = flow->layer3_info.src_ip;
     }
 
-    if (flow->layer3_info.proto_type != 17  &&
-        tb[CTA_PROTOINFO] == NULL)
+    if (flow->layer3_info.proto_type != 17)
+    {
+        if (tb[CTA_PROTOINFO] != NULL)
+        {
+            rc = get_protoinfo(tb[CTA_PROTOINFO], flow);
+            if (rc < 0) return 0;
+            msg->protoinfo = true;
+        }
+        else if (strict)
+        {
+            LOGT("%s: Missing protocol info.Dropping the ct_flow", __func__);
+            return 0;
+        }
+    }
+
+    if (tb[CTA_COUNTERS_ORIG] != NULL)
     {
-        LOGT("%s: Missing protocol info.Dropping the ct_flow", __func__);
-        goto flow_info_1_free;
+        rc = get_counter(tb[CTA_COUNTERS_ORIG], flow);
+        if (rc < 0) return 0;
+        msg->orig_counters = true;
+    }
+    else if (strict)
+    {
+        return 0;
     }
 
-    if (flow->layer3_info.proto_type != 17)
+    if (tb[CTA_COUNTERS_REPLY] != NULL)
     {
-        rc = get_protoinfo(tb[CTA_PROTOINFO], flow);
-        if (rc < 0) goto flow_info_1_free;
+        rc = get_counter(tb[CTA_COUNTERS_REPLY], flow_1);
+        msg->reply_counters = (rc >= 0);
     }
 
-    if (tb[CTA_COUNTERS_ORIG] == NULL) goto flow_info_1_free;
+    return 1;
+}
+
+
+/**
+ * @brief callback parsing the content of a netlink message
+ *
+ * @param nhl the netlink header message
+ * @param data the opaque context passed to mnl processing
+ * @return MNL_CB_OK when successful, -1 otherwise
+ */
+int
+data_cb(const struct nlmsghdr *nlh, void *data)
+{
+    ctflow_info_t *flow_info_1;
+    ctflow_info_t *flow_info;
+    struct ct_stats_msg msg;
+    flow_stats_t *ct_stats;
+    int rc;
+
+    ct_stats = (flow_stats_t *)data;
 
-    rc = get_counter(tb[CTA_COUNTERS_ORIG], flow);
-    if (rc < 0) goto flow_info_1_free;
+    rc = ct_stats_parse_msg(nlh, ct_stats, &msg, true);
+    if (rc < 0) return MNL_CB_ERROR;
+    if (rc == 0) return MNL_CB_OK;
 
-    if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info, ct_zone);
+    flow_info = calloc(1, sizeof(struct ctflow_info));
+    if (flow_info == NULL) return MNL_CB_OK;
+    memcpy(&flow_info->flow, &msg.orig, sizeof(flow_info->flow));
 
+    if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info, msg.ct_zone);
 
     ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info);
     ct_stats->node_count++;
 
-    if (tb[CTA_COUNTERS_REPLY] == NULL) goto reply_dir_free;
+    if (!msg.reply_counters) return MNL_CB_OK;
 
-    rc = get_counter(tb[CTA_COUNTERS_REPLY], flow_1);
-    if (rc < 0) goto reply_dir_free;
+    flow_info_1 = calloc(1, sizeof(struct ctflow_info));
+    if (flow_info_1 == NULL) return MNL_CB_OK;
+    memcpy(&flow_info_1->flow, &msg.reply, sizeof(flow_info_1->flow));
 
-    if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info_1, ct_zone);
+    if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info_1, msg.ct_zone);
 
     ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info_1);
     ct_stats->node_count++;
     return MNL_CB_OK;
-
-flow_info_1_free:
-    free(flow_info_1);
-flow_info_free:
-    free(flow_info);
-    return MNL_CB_OK;
-
-reply_dir_free:
-    free(flow_info_1);
-    return MNL_CB_OK;
 }
 
 
 /**
- * @brief probes conntrack info for the requested inet family
+ * @brief dumps the conntrack table for the requested inet family
  *
  * @param af the inet family targeted by the conntrack probe
- * @return MNL_CB_OK when successful, -1 otherwise
+ * @param cb the callback processing each conntrack entry
+ * @param data the opaque context passed to the callback
+ * @return 0 when successful, -1 otherwise
  */
-int
-ct_stats_get_ct_flow(int af_family)
+static int
+ct_stats_dump_ct(int af_family, mnl_cb_t cb, void *data)
 {
     char buf[MNL_SOCKET_BUFFER_SIZE];
-    flow_stats_t *ct_stats;
-    flow_stats_mgr_t *mgr;
     struct mnl_socket *nl;
     struct nlmsghdr *nlh;
     struct nfgenmsg *nfh;
@@ -1147,9 +1193,6 @@ ct_stats_get_ct_flow(int af_family)
     int ret;
     int rc;
 
-    ct_stats = ct_stats_get_active_instance();
-    if (ct_stats == NULL) return -1;
-
     nl = mnl_socket_open(NETLINK_NETFILTER);
     if (nl == NULL)
     {
@@ -1194,7 +1237,7 @@ ct_stats_get_ct_flow(int af_family)
             goto sock_err;
         }
 
-        ret = mnl_cb_run(buf, ret, seq, portid, data_cb, ct_stats);
+        ret = mnl_cb_run(buf, ret, seq, portid, cb, data);
         if (ret == -1)
         {
             ret = errno;
@@ -1205,6 +1248,37 @@ ct_stats_get_ct_flow(int af_family)
     }
 
     mnl_socket_close(nl);
+    return 0;
+
+sock_err:
+    mnl_socket_close(nl);
+    return -1;
+}
+
+
+/**
+ * @brief probes conntrack info for the requested inet family
+ *
+ * @param af the inet family targeted by the conntrack probe
+ * @return MNL_CB_OK when successful, -1 otherwise
+ */
+int
+ct_stats_get_ct_flow(int af_family)
+{
+    flow_stats_t *ct_stats;
+    flow_stats_mgr_t *mgr;
+    int rc;
+
+    ct_stats = ct_stats_get_active_instance();
+    if (ct_stats == NULL) return -1;
+
+    rc = ct_stats_dump_ct(af_family, data_cb, ct_stats);
+    if (rc != 0)
+    {
+        if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+            LOGT("%s: total ct flow %d", __func__, ct_stats->node_count);
+        return -1;
+    }
 
     mgr = ct_stats_get_mgr();
     if (mgr->debug)
@@ -1219,12 +1293,6 @@ ct_stats_get_ct_flow(int af_family)
     if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
         LOGT("%s: total ct flow %d", __func__, ct_stats->node_count);
     return 0;
-
-sock_err:
-    mnl_socket_close(nl);
-    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-        LOGT("%s: total ct flow %d", __func__, ct_stats->node_count);
-    return -1;
 }
 
 
@@ -1294,45 +1362,153 @@ ct_stats_print_contrack(ct_flow_t *flow)
  * @brief apply the named filter to the given flow
  *
  * @param filter_name the filter name
- * @param mac_filter the mac filter
+ * @param smac the flow source mac
+ * @param dmac the flow destination mac
  * @param flow the flow to filter
  */
 static bool
-apply_filter(char *filter_name, fcm_filter_l2_info_t *mac_filter,
+apply_filter(char *filter_name, os_macaddr_t *smac, os_macaddr_t *dmac,
              ct_flow_t *flow)
 {
-    fcm_filter_l3_info_t filter;
+    struct sockaddr_in6 *in6;
+    struct sockaddr_in *in4;
+    fcm_filter_flow_t filter;
     fcm_filter_stats_t pkt;
     bool action;
-    int rc;
 
     if (filter_name == NULL) return true;
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.src_ip, sizeof(filter.src_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    memset(&filter, 0, sizeof(filter));
+    filter.has_l2 = true;
+    filter.smac = *smac;
+    filter.dmac = *dmac;
+    filter.smac_valid = true;
+    filter.dmac_valid = true;
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.dst_ip, sizeof(filter.dst_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    filter.has_l3 = true;
+    filter.af = flow->layer3_info.src_ip.ss_family;
+    if (filter.af == AF_INET)
+    {
+        in4 = (struct sockaddr_in *)&flow->layer3_info.src_ip;
+        memcpy(filter.src_ip, &in4->sin_addr, sizeof(in4->sin_addr));
+        in4 = (struct sockaddr_in *)&flow->layer3_info.dst_ip;
+        memcpy(filter.dst_ip, &in4->sin_addr, sizeof(in4->sin_addr));
+    }
+    else if (filter.af == AF_INET6)
+    {
+        in6 = (struct sockaddr_in6 *)&flow->layer3_info.src_ip;
+        memcpy(filter.src_ip, &in6->sin6_addr, sizeof(in6->sin6_addr));
+        in6 = (struct sockaddr_in6 *)&flow->layer3_info.dst_ip;
+        memcpy(filter.dst_ip, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+    else
+    {
+        return false;
+    }
 
     filter.sport = ntohs(flow->layer3_info.src_port);
     filter.dport = ntohs(flow->layer3_info.dst_port);
     filter.l4_proto = flow->layer3_info.proto_type;
-    filter.ip_type = flow->layer3_info.family_type;
 
     pkt.pkt_cnt = flow->pkt_info.pkt_cnt;
     pkt.bytes = flow->pkt_info.bytes;
 
-    fcm_filter_7tuple_apply(filter_name, mac_filter, &filter, &pkt, NULL, &action);
+    fcm_filter_flow_apply(filter_name, &filter, &pkt, NULL, &action);
 
     return action;
 }
 
+/**
+ * @brief adds a conntrack flow to the plugin aggregator
+ *
+ * @param ct_stats the aggregator container
+ * @param flow the flow to add
+ * @return 1 if the flow was added, 0 if filtered out, -1 on error
+ */
+static int
+ct_stats_add_flow_sample(flow_stats_t *ct_stats, ct_flow_t *flow)
+{
+    struct flow_counters     pkts_ct;
+    struct net_md_flow_key   key;
+    bool                     smac_lookup;
+    bool                     dmac_lookup;
+    struct sockaddr_storage *ssrc;
+    struct sockaddr_storage *sdst;
+    os_macaddr_t             smac;
+    os_macaddr_t             dmac;
+    int                      af;
+    bool                     ret;
+
+    memset(&smac, 0, sizeof(os_macaddr_t));
+    memset(&dmac, 0, sizeof(os_macaddr_t));
+
+    af = flow->layer3_info.src_ip.ss_family;
+
+    ssrc = &flow->layer3_info.src_ip;
+    sdst = &flow->layer3_info.dst_ip;
+
+    // Lookup source ip.
+    smac_lookup = neigh_table_lookup(ssrc, &smac);
+    if (!smac_lookup)
+    {
+        LOGD("ct_stats: Failed to get mac for src ip of the flow.");
+    }
+
+    dmac_lookup = neigh_table_lookup(sdst, &dmac);
+    // Lookup dest ip.
+    if (!dmac_lookup)
+    {
+        LOGD("ct_stats: Failed to get mac for dst ip of the flow.");
+    }
+
+
+    if (!apply_filter(ct_stats->collect_filter, &smac, &dmac, flow)) return 0;
+
+    memset(&key, 0, sizeof(struct net_md_flow_key));
+    memset(&pkts_ct, 0, sizeof(struct flow_counters));
+    if (smac_lookup) key.smac = &smac;
+    if (dmac_lookup) key.dmac = &dmac;
+
+    key.ip_version = (af == AF_INET ? 4 : 6);
+    if (af == AF_INET)
+    {
+        struct sockaddr_in *ssrc;
+        struct sockaddr_in *sdst;
+
+        ssrc = (struct sockaddr_in *)&flow->layer3_info.src_ip;
+        sdst = (struct sockaddr_in *)&flow->layer3_info.dst_ip;
+        key.src_ip = (uint8_t *)&ssrc->sin_addr.s_addr;
+        key.dst_ip = (uint8_t *)&sdst->sin_addr.s_addr;
+    }
+    else if (af == AF_INET6)
+    {
+        struct sockaddr_in6 *ssrc;
+        struct sockaddr_in6 *sdst;
+
+        ssrc = (struct sockaddr_in6 *)&flow->layer3_info.src_ip;
+        sdst = (struct sockaddr_in6 *)&flow->layer3_info.dst_ip;
+        key.src_ip = ssrc->sin6_addr.s6_addr;
+        key.dst_ip = sdst->sin6_addr.s6_addr;
+    }
+    key.ipprotocol = flow->layer3_info.proto_type;
+    key.sport = flow->layer3_info.src_port;
+    key.dport = flow->layer3_info.dst_port;
+    pkts_ct.packets_count = flow->pkt_info.pkt_cnt;
+    pkts_ct.bytes_count = flow->pkt_info.bytes;
+    if (flow->start) key.fstart = true;
+    if (flow->end) key.fend = true;
+
+    ret = net_md_add_sample(ct_stats->aggr, &key, &pkts_ct);
+    if (!ret)
+    {
+        LOGW("%s: some error with net_md_add_sample", __func__);
+        return -1;
+    }
+
+    return 1;
+}
+
+
 /**
  * @brief adds collected conntrack info to the plugin aggregator
  *
@@ -1341,114 +1517,589 @@ apply_filter(char *filter_name, fcm_filter_l2_info_t *mac_filter,
 void
 ct_flow_add_sample(flow_stats_t *ct_stats)
 {
-    struct net_md_aggregator *aggr;
-    struct flow_counters pkts_ct;
-    struct net_md_flow_key key;
     ctflow_info_t *flow_info;
     int sample_count;
-    ct_flow_t *flow;
-    bool ret;
+    int rc;
 
-    aggr = ct_stats->aggr;
     sample_count = 0;
 
     ds_dlist_foreach(&ct_stats->ctflow_list, flow_info)
     {
-        bool                     smac_lookup;
-        bool                     dmac_lookup;
-        fcm_filter_l2_info_t     mac_filter;
-        struct sockaddr_storage *ssrc;
-        struct sockaddr_storage *sdst;
-        os_macaddr_t             smac;
-        os_macaddr_t             dmac;
-        int                      af;
+        rc = ct_stats_add_flow_sample(ct_stats, &flow_info->flow);
+        if (rc < 0) break;
+
+        sample_count += rc;
+    }
+    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+    {
+        LOGT("%s: sample add %d count %d", __func__,
+             sample_count, ct_stats->node_count);
+    }
+    free_ct_flow_list(ct_stats);
+}
+
+
+/*
+ * Event driven collection
+ *
+ * Instead of dumping the whole conntrack table on every collection
+ * interval, the plugin can subscribe to the conntrack NEW, UPDATE and
+ * DESTROY events and maintain a persistent flow table. Collection then
+ * walks the table. DESTROY events carry the final counters of a flow and
+ * are fed to the aggregator right away, or with the next collection when
+ * the flows of all zones are merged. The kernel drops events when the
+ * socket buffer overflows: the table is then resynced from a dump, and
+ * periodically to catch up with losses the kernel did not report.
+ */
+
+#define CT_STATS_EVENTS_SOCK_BUF_SIZE (3 * 1024 * 1024)
+#define CT_STATS_EVENTS_MAX_READS 64
+#define CT_STATS_EVENTS_RESYNC_INTERVAL 30
+
+/**
+ * @brief compare flow table keys
+ *
+ * @param a key pointer
+ * @param b key pointer
+ * @return 0 if keys match
+ */
+static int
+ct_flow_key_cmp(void *a, void *b)
+{
+    return memcmp(a, b, sizeof(struct ct_flow_key));
+}
+
+
+/**
+ * @brief refreshes a flow table entry from a parsed conntrack message
+ *
+ * Attributes absent from the message keep their previous values.
+ *
+ * @param entry the flow table entry
+ * @param msg the parsed conntrack message
+ */
+static void
+ct_stats_entry_update(ct_flow_entry_t *entry, struct ct_stats_msg *msg)
+{
+    memcpy(&entry->orig.layer3_info, &msg->orig.layer3_info,
+           sizeof(entry->orig.layer3_info));
+
+    if (msg->protoinfo)
+    {
+        entry->orig.start = msg->orig.start;
+        entry->orig.end = msg->orig.end;
+    }
+
+    if (msg->orig_counters)
+    {
+        entry->orig.pkt_info = msg->orig.pkt_info;
+        entry->has_counters = true;
+    }
+
+    if (msg->reply_counters)
+    {
+        memcpy(&entry->reply.layer3_info, &msg->reply.layer3_info,
+               sizeof(entry->reply.layer3_info));
+        entry->reply.pkt_info = msg->reply.pkt_info;
+        entry->has_reply = true;
+    }
+}
+
+
+/**
+ * @brief adds the flows of a table entry to the plugin aggregator
+ *
+ * @param ct_stats the aggregator container
+ * @param entry the flow table entry
+ * @return the number of flows added, -1 on error
+ */
+static int
+ct_stats_add_entry_samples(flow_stats_t *ct_stats, ct_flow_entry_t *entry)
+{
+    int count;
+    int rc;
+
+    /* Mirror the dump: flows without counters are not reported */
+    if (!entry->has_counters) return 0;
+
+    rc = ct_stats_add_flow_sample(ct_stats, &entry->orig);
+    if (rc < 0) return -1;
+    count = rc;
+
+    if (!entry->has_reply) return count;
+
+    rc = ct_stats_add_flow_sample(ct_stats, &entry->reply);
+    if (rc < 0) return -1;
+
+    return count + rc;
+}
+
+
+/**
+ * @brief reports a flow gone from conntrack and drops it from the table
+ *
+ * @param mgr the plugin global state
+ * @param entry the flow table entry
+ */
+static void
+ct_stats_entry_end(flow_stats_mgr_t *mgr, ct_flow_entry_t *entry)
+{
+    struct ct_stats_events *events;
+    flow_stats_t *ct_stats;
+
+    events = &mgr->events;
+    ct_stats = mgr->active;
+
+    entry->orig.end = true;
+    entry->reply.end = true;
+
+    /* Merged with the other zones' flows on collection, see below */
+    if (ct_stats != NULL && ct_stats->ct_zone == USHRT_MAX)
+    {
+        entry->ended = true;
+        return;
+    }
+
+    if (ct_stats != NULL) ct_stats_add_entry_samples(ct_stats, entry);
+
+    ds_tree_remove(&events->flows, entry);
+    events->num_flows--;
+    free(entry);
+}
+
+
+/**
+ * @brief frees the flow table entries without reporting them
+ *
+ * @param events the conntrack event subscription state
+ */
+static void
+ct_stats_events_flush(struct ct_stats_events *events)
+{
+    ct_flow_entry_t *entry;
+    ct_flow_entry_t *next;
+
+    entry = ds_tree_head(&events->flows);
+    while (entry != NULL)
+    {
+        next = ds_tree_next(&events->flows, entry);
+        ds_tree_remove(&events->flows, entry);
+        free(entry);
+        entry = next;
+    }
+    events->num_flows = 0;
+}
+
+
+int
+ct_stats_event_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct ct_stats_events *events;
+    struct ct_flow_key key;
+    ct_flow_entry_t *entry;
+    struct ct_stats_msg msg;
+    flow_stats_t *ct_stats;
+    flow_stats_mgr_t *mgr;
+    bool destroy;
+    bool dump;
+    int type;
+    int rc;
+
+    mgr = (flow_stats_mgr_t *)data;
+    events = &mgr->events;
+
+    ct_stats = mgr->active;
+    if (ct_stats == NULL) return MNL_CB_OK;
+
+    type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+    destroy = (type == IPCTNL_MSG_CT_DELETE);
+    if (!destroy && type != IPCTNL_MSG_CT_NEW) return MNL_CB_OK;
+
+    /* Replies to a resync dump are processed as updates, not counted */
+    dump = ((nlh->nlmsg_flags & NLM_F_MULTI) != 0);
+    if (destroy)
+    {
+        events->destroy_events++;
+    }
+    else if (!dump)
+    {
+        if (nlh->nlmsg_flags & (NLM_F_CREATE | NLM_F_EXCL)) events->new_events++;
+        else events->update_events++;
+    }
+
+    /* A malformed event must not stop the processing of the batch */
+    rc = ct_stats_parse_msg(nlh, ct_stats, &msg, false);
+    if (rc <= 0) return MNL_CB_OK;
+
+    memset(&key, 0, sizeof(key));
+    memcpy(&key.layer3_info, &msg.orig.layer3_info, sizeof(key.layer3_info));
+    key.ct_zone = msg.ct_zone;
+
+    entry = ds_tree_find(&events->flows, &key);
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(*entry));
+        if (entry == NULL) return MNL_CB_OK;
+
+        memcpy(&entry->key, &key, sizeof(entry->key));
+        ds_tree_insert(&events->flows, entry, &entry->key);
+        events->num_flows++;
+    }
+
+    /* The tuple is in use again before the end was reported */
+    if (!destroy && entry->ended)
+    {
+        entry->ended = false;
+        entry->orig.end = false;
+        entry->reply.end = false;
+    }
+
+    ct_stats_entry_update(entry, &msg);
+    entry->seen = true;
+
+    /* Final counters go to the aggregator, the flow leaves the table */
+    if (destroy) ct_stats_entry_end(mgr, entry);
 
-        memset(&smac, 0, sizeof(os_macaddr_t));
-        memset(&dmac, 0, sizeof(os_macaddr_t));
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief ev callback draining the conntrack event socket
+ */
+static void
+ct_stats_events_read_cb(struct ev_loop *loop, struct ev_io *watcher,
+                        int revents)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct ct_stats_events *events;
+    flow_stats_mgr_t *mgr;
+    int ret;
+    int i;
 
-        flow = &flow_info->flow;
-        af = flow->layer3_info.src_ip.ss_family;
+    if (EV_ERROR & revents)
+    {
+        LOGE("%s: Invalid mnl socket event", __func__);
+        return;
+    }
 
-        ssrc = &flow->layer3_info.src_ip;
-        sdst = &flow->layer3_info.dst_ip;
+    mgr = watcher->data;
+    events = &mgr->events;
 
-        // Lookup source ip.
-        smac_lookup = neigh_table_lookup(ssrc, &smac);
-        if (!smac_lookup)
+    /* Bounded so that a burst of events does not starve the loop */
+    for (i = 0; i < CT_STATS_EVENTS_MAX_READS; i++)
+    {
+        ret = mnl_socket_recvfrom(events->nl, buf, sizeof(buf));
+        if (ret == -1)
         {
-            LOGD("ct_stats: Failed to get mac for src ip of the flow.");
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == ENOBUFS)
+            {
+                /* The kernel dropped events, the flow table is stale */
+                events->overflows++;
+                events->resync = true;
+                LOGD("%s: conntrack events lost, resync scheduled", __func__);
+                continue;
+            }
+
+            LOGE("%s: mnl_socket_recvfrom failed: %s", __func__,
+                 strerror(errno));
+            break;
         }
 
-        dmac_lookup = neigh_table_lookup(sdst, &dmac);
-        // Lookup dest ip.
-        if (!dmac_lookup)
+        ret = mnl_cb_run(buf, ret, 0, 0, ct_stats_event_cb, mgr);
+        if (ret == -1) LOGD("%s: mnl_cb_run failed", __func__);
+    }
+}
+
+
+int
+ct_stats_events_init(flow_stats_mgr_t *mgr)
+{
+    static const int groups[] =
+    {
+        NFNLGRP_CONNTRACK_NEW,
+        NFNLGRP_CONNTRACK_UPDATE,
+        NFNLGRP_CONNTRACK_DESTROY,
+    };
+    struct ct_stats_events *events;
+    struct mnl_socket *nl;
+    uint32_t nlbuf_sz;
+    size_t i;
+    int group;
+    int flags;
+    int rc;
+    int fd;
+
+    events = &mgr->events;
+    if (events->enabled) return 0;
+
+    nl = mnl_socket_open(NETLINK_NETFILTER);
+    if (nl == NULL)
+    {
+        LOGE("%s: mnl_socket_open failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    rc = mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID);
+    if (rc < 0)
+    {
+        LOGE("%s: mnl_socket_bind failed: %s", __func__, strerror(errno));
+        goto err_sock;
+    }
+
+    for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++)
+    {
+        group = groups[i];
+        rc = mnl_socket_setsockopt(nl, NETLINK_ADD_MEMBERSHIP, &group,
+                                   sizeof(int));
+        if (rc < 0)
         {
-            LOGD("ct_stats: Failed to get mac for dst ip of the flow.");
+            LOGE("%s: mnl_socket_setsockopt failed: %s", __func__,
+                 strerror(errno));
+            goto err_sock;
         }
+    }
+
+    fd = mnl_socket_get_fd(nl);
+
+    nlbuf_sz = CT_STATS_EVENTS_SOCK_BUF_SIZE;
+    rc = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &nlbuf_sz,
+                    sizeof(nlbuf_sz));
+    if (rc == -1)
+    {
+        LOGW("%s: Failed to set socket buff size to %u: %s", __func__,
+             nlbuf_sz, strerror(errno));
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+    rc = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (rc == -1)
+    {
+        LOGE("%s: fcntl failed: %s", __func__, strerror(errno));
+        goto err_sock;
+    }
+
+    events->nl = nl;
 
+    ev_io_init(&events->ev_io_mnl, ct_stats_events_read_cb, fd, EV_READ);
+    events->ev_io_mnl.data = mgr;
+    ev_io_start(mgr->loop, &events->ev_io_mnl);
 
-        snprintf(mac_filter.src_mac, sizeof(mac_filter.src_mac),
-                 "%02x:%02x:%02x:%02x:%02x:%02x",
-                 smac.addr[0], smac.addr[1],
-                 smac.addr[2], smac.addr[3],
-                 smac.addr[4], smac.addr[5]);
-        snprintf(mac_filter.dst_mac, sizeof(mac_filter.src_mac),
-                 "%02x:%02x:%02x:%02x:%02x:%02x",
-                 dmac.addr[0], dmac.addr[1],
-                 dmac.addr[2], dmac.addr[3],
-                 dmac.addr[4], dmac.addr[5]);
+    /* Load the flows established before the subscription */
+    events->resync = true;
+    events->enabled = true;
 
-        if (apply_filter(ct_stats->collect_filter, &mac_filter, flow))
+    LOGI("%s: subscribed to conntrack events", __func__);
+
+    return 0;
+
+err_sock:
+    mnl_socket_close(nl);
+    return -1;
+}
+
+
+void
+ct_stats_events_exit(flow_stats_mgr_t *mgr)
+{
+    struct ct_stats_events *events;
+
+    events = &mgr->events;
+    if (events->enabled)
+    {
+        ev_io_stop(mgr->loop, &events->ev_io_mnl);
+        mnl_socket_close(events->nl);
+        events->nl = NULL;
+        events->enabled = false;
+        LOGI("%s: unsubscribed from conntrack events", __func__);
+    }
+
+    ct_stats_events_flush(events);
+    events->resync = false;
+}
+
+
+int
+ct_stats_events_resync(flow_stats_mgr_t *mgr)
+{
+    struct ct_stats_events *events;
+    ct_flow_entry_t *entry;
+    ct_flow_entry_t *next;
+    int ended;
+    int rc;
+
+    events = &mgr->events;
+    if (mgr->active == NULL) return -1;
+
+    ds_tree_foreach(&events->flows, entry)
+    {
+        entry->seen = false;
+    }
+
+    rc = ct_stats_dump_ct(AF_INET, ct_stats_event_cb, mgr);
+    if (rc == 0) rc = ct_stats_dump_ct(AF_INET6, ct_stats_event_cb, mgr);
+    if (rc != 0)
+    {
+        LOGE("%s: conntrack dump failed", __func__);
+        return -1;
+    }
+
+    /* Flows missing from the dump ended while events were lost */
+    ended = 0;
+    entry = ds_tree_head(&events->flows);
+    while (entry != NULL)
+    {
+        next = ds_tree_next(&events->flows, entry);
+        if (!entry->seen && !entry->ended)
         {
-            memset(&key, 0, sizeof(struct net_md_flow_key));
-            memset(&pkts_ct, 0, sizeof(struct flow_counters));
-            if (smac_lookup) key.smac = &smac;
-            if (dmac_lookup) key.dmac = &dmac;
+            ct_stats_entry_end(mgr, entry);
+            ended++;
+        }
+        entry = next;
+    }
 
-            key.ip_version = (af == AF_INET ? 4 : 6);
-            if (af == AF_INET)
-            {
-                struct sockaddr_in *ssrc;
-                struct sockaddr_in *sdst;
+    events->resync = false;
+    events->intervals = 0;
+    events->resyncs++;
 
-                ssrc = (struct sockaddr_in *)&flow->layer3_info.src_ip;
-                sdst = (struct sockaddr_in *)&flow->layer3_info.dst_ip;
-                key.src_ip = (uint8_t *)&ssrc->sin_addr.s_addr;
-                key.dst_ip = (uint8_t *)&sdst->sin_addr.s_addr;
-            }
-            else if (af == AF_INET6)
-            {
-                struct sockaddr_in6 *ssrc;
-                struct sockaddr_in6 *sdst;
+    LOGI("%s: %zu flows tracked, %d ended while out of sync", __func__,
+         events->num_flows, ended);
 
-                ssrc = (struct sockaddr_in6 *)&flow->layer3_info.src_ip;
-                sdst = (struct sockaddr_in6 *)&flow->layer3_info.dst_ip;
-                key.src_ip = ssrc->sin6_addr.s6_addr;
-                key.dst_ip = sdst->sin6_addr.s6_addr;
-            }
-            key.ipprotocol = flow->layer3_info.proto_type;
-            key.sport = flow->layer3_info.src_port;
-            key.dport = flow->layer3_info.dst_port;
-            pkts_ct.packets_count = flow->pkt_info.pkt_cnt;
-            pkts_ct.bytes_count = flow->pkt_info.bytes;
-            if (flow->start) key.fstart = true;
-            if (flow->end) key.fend = true;
-            sample_count++;
-
-            ret =  net_md_add_sample(aggr, &key, &pkts_ct);
-            if (!ret)
+    return 0;
+}
+
+
+/**
+ * @brief discards the flow table after a change of the zone filter
+ *
+ * The flows are reloaded with the new filter on the next collection.
+ */
+static void
+ct_stats_events_zone_changed(void)
+{
+    struct ct_stats_events *events;
+    flow_stats_mgr_t *mgr;
+
+    mgr = ct_stats_get_mgr();
+    events = &mgr->events;
+    if (!events->enabled) return;
+
+    ct_stats_events_flush(events);
+    events->resync = true;
+}
+
+
+/**
+ * @brief reads the periodic resync setting of a collector
+ *
+ * @param collector the collector info passed by fcm
+ */
+static void
+ct_stats_events_set_resync_interval(fcm_collect_plugin_t *collector)
+{
+    struct ct_stats_events *events;
+    flow_stats_mgr_t *mgr;
+    char *str_interval;
+
+    mgr = ct_stats_get_mgr();
+    events = &mgr->events;
+    if (!events->enabled) return;
+
+    str_interval = collector->get_other_config(collector,
+                                               "ct_resync_interval");
+    events->resync_interval = CT_STATS_EVENTS_RESYNC_INTERVAL;
+    if (str_interval != NULL) events->resync_interval = atoi(str_interval);
+}
+
+
+/**
+ * @brief adds the flow table content to the plugin aggregator
+ *
+ * @param ct_stats the aggregator container
+ */
+static void
+ct_stats_events_collect(flow_stats_t *ct_stats)
+{
+    struct ct_stats_events *events;
+    ctflow_info_t *flow_info;
+    ct_flow_entry_t *entry;
+    ct_flow_entry_t *next;
+    flow_stats_mgr_t *mgr;
+    int count;
+    int rc;
+
+    mgr = ct_stats_get_mgr();
+    events = &mgr->events;
+
+    if (events->resync_interval > 0 &&
+        ++events->intervals >= events->resync_interval)
+    {
+        events->resync = true;
+    }
+
+    if (events->resync) ct_stats_events_resync(mgr);
+
+    count = 0;
+    if (ct_stats->ct_zone == USHRT_MAX)
+    {
+        /* The cross zones merge operates on the flow list */
+        ds_tree_foreach(&events->flows, entry)
+        {
+            if (!entry->has_counters) continue;
+
+            flow_info = calloc(1, sizeof(*flow_info));
+            if (flow_info == NULL) break;
+            memcpy(&flow_info->flow, &entry->orig, sizeof(flow_info->flow));
+            flow_merge_multi_zonestats(flow_info, entry->key.ct_zone);
+            ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info);
+            ct_stats->node_count++;
+
+            if (!entry->has_reply) continue;
+
+            flow_info = calloc(1, sizeof(*flow_info));
+            if (flow_info == NULL) break;
+            memcpy(&flow_info->flow, &entry->reply, sizeof(flow_info->flow));
+            flow_merge_multi_zonestats(flow_info, entry->key.ct_zone);
+            ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info);
+            ct_stats->node_count++;
+        }
+        count = ct_stats->node_count;
+        process_merged_multi_zonestats(&ct_stats->ctflow_list,
+                                       &flow_tracker_list);
+        flow_free_merged_multi_zonestats(&flow_tracker_list);
+        ct_flow_add_sample(ct_stats);
+
+        /* Ended flows got their final report, drop them */
+        entry = ds_tree_head(&events->flows);
+        while (entry != NULL)
+        {
+            next = ds_tree_next(&events->flows, entry);
+            if (entry->ended)
             {
-                LOGW("%s: some error with net_md_add_sample", __func__);
-                break;
+                ds_tree_remove(&events->flows, entry);
+                events->num_flows--;
+                free(entry);
             }
+            entry = next;
         }
     }
-    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+    else
     {
-        LOGT("%s: sample add %d count %d", __func__,
-             sample_count, ct_stats->node_count);
+        ds_tree_foreach(&events->flows, entry)
+        {
+            rc = ct_stats_add_entry_samples(ct_stats, entry);
+            if (rc < 0) break;
+            count += rc;
+        }
     }
-    free_ct_flow_list(ct_stats);
+
+    LOGD("%s: %zu flows, %d samples, events: new %" PRIu64 " update %" PRIu64
+         " destroy %" PRIu64 ", overflows %" PRIu64 ", resyncs %" PRIu64,
+         __func__, events->num_flows, count, events->new_events,
+         events->update_events, events->destroy_events, events->overflows,
+         events->resyncs);
 }
 
 
@@ -1743,6 +2394,13 @@ ct_stats_collect_cb(fcm_collect_plugin_t *collector)
     ct_stats = collector->plugin_ctx;
     if (ct_stats != mgr->active) return;
 
+    if (mgr->events.enabled)
+    {
+        ct_stats->collect_filter = collector->filters.collect;
+        ct_stats_events_collect(ct_stats);
+        return;
+    }
+
     rc = ct_stats_get_ct_flow(AF_INET);
     if (rc == -1)
     {
@@ -1806,8 +2464,11 @@ ct_stats_report_cb(fcm_collect_plugin_t *collector)
     {
         ct_stats->ct_zone = tmp_zone;
         LOGD("%s: updated zone: %d", __func__, ct_stats->ct_zone);
+        ct_stats_events_zone_changed();
     }
 
+    ct_stats_events_set_resync_interval(collector);
+
     str_max_flows = collector->get_other_config(collector,
                                                 "max_flows_per_window");
     max_flows = 0;
@@ -1970,6 +2631,7 @@ ct_stats_plugin_init(fcm_collect_plugin_t *collector)
     flow_stats_t *ct_stats;
     flow_stats_mgr_t *mgr;
     char *str_max_flows;
+    char *ct_events;
     char *ct_zone;
     char *active;
     char *name;
@@ -2040,6 +2702,15 @@ ct_stats_plugin_init(fcm_collect_plugin_t *collector)
 
     ct_stats->initialized = true;
 
+    /* Check if the session requests event driven collection */
+    ct_events = collector->get_other_config(collector, "ct_events");
+    if (ct_events != NULL && !strcmp(ct_events, "true"))
+    {
+        rc = ct_stats_events_init(mgr);
+        if (rc != 0) LOGW("%s: falling back to conntrack dumps", __func__);
+    }
+    ct_stats_events_set_resync_interval(collector);
+
     /* Check if the session has a name */
     name = collector->name;
     mgr->num_sessions++;
@@ -2082,6 +2753,7 @@ ct_stats_plugin_exit(fcm_collect_plugin_t *collector)
     struct net_md_aggregator *aggr;
     flow_stats_t *ct_stats;
     flow_stats_mgr_t *mgr;
+    bool was_active;
 
     mgr = ct_stats_get_mgr();
     if (!mgr->initialized) return;
@@ -2097,6 +2769,8 @@ ct_stats_plugin_exit(fcm_collect_plugin_t *collector)
         return;
     }
 
+    was_active = (mgr->active == ct_stats);
+
     /* free the aggregator */
     aggr = ct_stats->aggr;
     net_md_close_active_window(aggr);
@@ -2108,7 +2782,11 @@ ct_stats_plugin_exit(fcm_collect_plugin_t *collector)
 
     /* mark the remaining session as active if any */
     ct_stats = ds_tree_head(&mgr->ct_stats_sessions);
-    if (ct_stats != NULL) mgr->active = ct_stats;
+    mgr->active = ct_stats;
+
+    /* the flow table was filtered by the removed session's zone */
+    if (was_active) ct_stats_events_zone_changed();
+    if (ct_stats == NULL) ct_stats_events_exit(mgr);
 
     return;
 }
@@ -2125,6 +2803,8 @@ ct_stats_init_mgr(struct ev_loop *loop)
     mgr->max_sessions = 2;
     ds_tree_init(&mgr->ct_stats_sessions, ct_stats_session_cmp,
                  flow_stats_t, ct_stats_node);
+    ds_tree_init(&mgr->events.flows, ct_flow_key_cmp, ct_flow_entry_t,
+                 ct_node);
 
     rc = ct_stats_imc_init();
     if (rc != 0) goto err;
@@ -2149,6 +2829,7 @@ ct_stats_exit_mgr(void)
     nf_ct_exit();
 
     mgr = ct_stats_get_mgr();
+    ct_stats_events_exit(mgr);
     memset(mgr, 0, sizeof(*mgr));
     mgr->initialized = false;
 }
@@ -31,6 +31,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <libmnl/libmnl.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
 
 #include "ct_stats.h"
 #include "os_types.h"
@@ -429,6 +431,203 @@ test_process_v6_zones(void)
 
 
 
+/**
+ * @brief replays a captured conntrack dump through the given callback
+ */
+static void
+test_replay_dump(struct mnl_buf *mnl_bufs, mnl_cb_t cb, void *data)
+{
+    struct mnl_buf *p_mnl;
+    uint32_t portid;
+    uint32_t seq;
+    bool loop;
+    int idx;
+    int ret;
+
+    loop = true;
+    idx = 0;
+    while (loop)
+    {
+        p_mnl = &mnl_bufs[idx];
+        portid = g_portid;
+        if (p_mnl->portid != 0) portid = p_mnl->portid;
+        seq = g_seq;
+        if (p_mnl->seq != 0) seq = p_mnl->seq;
+        ret = mnl_cb_run(p_mnl->data, p_mnl->len, seq, portid, cb, data);
+        if (ret == -1)
+        {
+            ret = errno;
+            LOGE("%s: mnl_cb_run failed: %s", __func__, strerror(ret));
+            loop = false;
+        }
+        else if (ret <= MNL_CB_STOP) loop = false;
+        idx++;
+    }
+}
+
+
+/**
+ * @brief finds a captured conntrack message carrying original counters
+ */
+static struct nlmsghdr *
+test_find_counted_msg(struct mnl_buf *mnl_bufs)
+{
+    const struct nlattr *attr;
+    struct nlmsghdr *nlh;
+    int len;
+    int idx;
+
+    for (idx = 0;; idx++)
+    {
+        len = mnl_bufs[idx].len;
+        nlh = (struct nlmsghdr *)mnl_bufs[idx].data;
+        while (mnl_nlmsg_ok(nlh, len))
+        {
+            if (nlh->nlmsg_type == NLMSG_DONE) return NULL;
+
+            mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg))
+            {
+                if (mnl_attr_get_type(attr) == CTA_COUNTERS_ORIG) return nlh;
+            }
+            nlh = mnl_nlmsg_next(nlh, &len);
+        }
+    }
+
+    return NULL;
+}
+
+
+void
+test_events_replay(void)
+{
+    struct net_md_aggregator *aggr;
+    struct ct_stats_events *events;
+    flow_stats_t *ct_stats;
+    flow_stats_mgr_t *mgr;
+    struct nlmsghdr *nlh;
+    uint8_t buf[4096];
+    size_t total_flows;
+    size_t num_flows;
+    int ret;
+
+    mgr = ct_stats_get_mgr();
+    TEST_ASSERT_NOT_NULL(mgr);
+    events = &mgr->events;
+
+    ct_stats = ct_stats_get_active_instance();
+    TEST_ASSERT_NOT_NULL(ct_stats);
+
+    aggr = ct_stats->aggr;
+    TEST_ASSERT_NOT_NULL(aggr);
+
+    /* Single zone: ended flows are reported right away */
+    ct_stats->ct_zone = 0;
+
+    /* Dump replies populate the flow table */
+    test_replay_dump(g_mnl_buf_ipv4, ct_stats_event_cb, mgr);
+    num_flows = events->num_flows;
+    TEST_ASSERT_TRUE(num_flows > 0);
+    LOGI("%s: %zu flows tracked", __func__, num_flows);
+
+    /* Replaying the same flows refreshes the entries in place */
+    test_replay_dump(g_mnl_buf_ipv4, ct_stats_event_cb, mgr);
+    TEST_ASSERT_EQUAL_UINT(num_flows, events->num_flows);
+
+    /* No sample is added until collection or flow end */
+    total_flows = aggr->total_flows;
+    TEST_ASSERT_EQUAL_UINT(0, total_flows);
+
+    /* Turn a captured flow into a DESTROY event */
+    nlh = test_find_counted_msg(g_mnl_buf_ipv4);
+    TEST_ASSERT_NOT_NULL(nlh);
+    TEST_ASSERT_TRUE(nlh->nlmsg_len <= sizeof(buf));
+    memcpy(buf, nlh, nlh->nlmsg_len);
+    nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE;
+    nlh->nlmsg_flags = 0;
+    nlh->nlmsg_seq = 0;
+    nlh->nlmsg_pid = 0;
+
+    ret = mnl_cb_run(buf, nlh->nlmsg_len, 0, 0, ct_stats_event_cb, mgr);
+    TEST_ASSERT_TRUE(ret >= MNL_CB_STOP);
+
+    /* The final counters went to the aggregator, the flow left the table */
+    TEST_ASSERT_EQUAL_UINT(1, events->destroy_events);
+    TEST_ASSERT_EQUAL_UINT(num_flows - 1, events->num_flows);
+    TEST_ASSERT_TRUE(aggr->total_flows > total_flows);
+
+    ct_stats_events_exit(mgr);
+}
+
+
+/**
+ * @brief validates ended flows are merged across zones before reporting
+ */
+void
+test_events_zones_destroy(void)
+{
+    struct net_md_aggregator *aggr;
+    struct ct_stats_events *events;
+    fcm_collect_plugin_t *collector;
+    flow_stats_t *ct_stats;
+    flow_stats_mgr_t *mgr;
+    struct nlmsghdr *nlh;
+    uint8_t buf[4096];
+    size_t total_flows;
+    size_t num_flows;
+    int ret;
+
+    mgr = ct_stats_get_mgr();
+    TEST_ASSERT_NOT_NULL(mgr);
+    events = &mgr->events;
+
+    ct_stats = ct_stats_get_active_instance();
+    TEST_ASSERT_NOT_NULL(ct_stats);
+
+    collector = ct_stats->collector;
+    TEST_ASSERT_NOT_NULL(collector);
+
+    aggr = ct_stats->aggr;
+    TEST_ASSERT_NOT_NULL(aggr);
+
+    /* Collect from the flow table, without resync dumps */
+    ct_stats->ct_zone = USHRT_MAX;
+    events->enabled = true;
+    events->resync = false;
+    events->resync_interval = 0;
+
+    test_replay_dump(g_mnl_buf_zones_ipv4, ct_stats_event_cb, mgr);
+    num_flows = events->num_flows;
+    TEST_ASSERT_TRUE(num_flows > 0);
+
+    nlh = test_find_counted_msg(g_mnl_buf_zones_ipv4);
+    TEST_ASSERT_NOT_NULL(nlh);
+    TEST_ASSERT_TRUE(nlh->nlmsg_len <= sizeof(buf));
+    memcpy(buf, nlh, nlh->nlmsg_len);
+    nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE;
+    nlh->nlmsg_flags = 0;
+    nlh->nlmsg_seq = 0;
+    nlh->nlmsg_pid = 0;
+
+    /* The ended flow waits for the merge of the next collection */
+    total_flows = aggr->total_flows;
+    ret = mnl_cb_run(buf, nlh->nlmsg_len, 0, 0, ct_stats_event_cb, mgr);
+    TEST_ASSERT_TRUE(ret >= MNL_CB_STOP);
+    TEST_ASSERT_EQUAL_UINT(num_flows, events->num_flows);
+    TEST_ASSERT_EQUAL_UINT(total_flows, aggr->total_flows);
+
+    /* Collection reports it and drops it from the table */
+    ct_stats_collect_cb(collector);
+    TEST_ASSERT_EQUAL_UINT(num_flows - 1, events->num_flows);
+    TEST_ASSERT_TRUE(aggr->total_flows > total_flows);
+
+    /* No subscription to close */
+    events->enabled = false;
+    ct_stats_events_exit(mgr);
+}
+
+
 void
 test_ct_stat_v4(void)
 {
@@ -505,6 +704,8 @@ main(int argc, char *argv[])
     RUN_TEST(test_process_v6);
     RUN_TEST(test_process_v4_zones);
     RUN_TEST(test_process_v6_zones);
+    RUN_TEST(test_events_replay);
+    RUN_TEST(test_events_zones_destroy);
 #if !defined(__x86_64__)
     RUN_TEST(test_ct_stat_v4);
     RUN_TEST(test_ct_stat_v6);
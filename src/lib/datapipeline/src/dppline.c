@@ -195,6 +195,163 @@ typedef struct dpp_stats
 /* Internal variables */
 ds_dlist_t  g_dppline_list; /* double linked list used to hold stats queue */
 
+/*
+ * Report arena: every object of the Sts__Report being built is carved out
+ * of large chunks and the whole report is released at once after packing.
+ * Each block is preceded by its size so that dppline_realloc() can copy
+ * it; the last block of a chunk grows in place.
+ */
+#define DPPLINE_ARENA_CHUNK_SIZE    (16*1024)
+#define DPPLINE_ARENA_ALIGN         sizeof(uint64_t)
+#define DPPLINE_ARENA_HDR_SIZE      DPPLINE_ARENA_ALIGN
+#define DPPLINE_ARENA_BLOCK(size)   (DPPLINE_ARENA_HDR_SIZE + \
+        (((size) + DPPLINE_ARENA_ALIGN - 1) & ~(DPPLINE_ARENA_ALIGN - 1)))
+
+typedef struct dppline_arena_chunk
+{
+    struct dppline_arena_chunk     *next;
+    size_t                          size;
+    size_t                          used;
+    size_t                          last;   /* offset of the last block */
+    uint64_t                        data[];
+} dppline_arena_chunk_t;
+
+typedef struct
+{
+    dppline_arena_chunk_t          *chunk;  /* current chunk, older ones chained */
+    size_t                          used;   /* bytes handed out since reset */
+    size_t                          hint;   /* size of the previous report */
+} dppline_arena_t;
+
+static dppline_arena_t g_dppline_arena;
+
+static void * dppline_arena_alloc(void *allocator_data, size_t size)
+{
+    dppline_arena_t *arena = allocator_data;
+    dppline_arena_chunk_t *chunk = arena->chunk;
+    size_t need = DPPLINE_ARENA_BLOCK(size);
+    size_t chunk_size;
+    uint8_t *block;
+
+    if (chunk == NULL || chunk->size - chunk->used < need)
+    {
+        // start with the size of the previous report, then double
+        chunk_size = DPPLINE_ARENA_CHUNK_SIZE;
+        if (chunk == NULL && arena->hint > chunk_size) chunk_size = arena->hint;
+        if (chunk != NULL && 2 * chunk->size > chunk_size) chunk_size = 2 * chunk->size;
+        if (need > chunk_size) chunk_size = need;
+
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (chunk == NULL)
+        {
+            LOG(ERR, "Unable to allocate %zu bytes report chunk", chunk_size);
+            return NULL;
+        }
+        chunk->next = arena->chunk;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->last = 0;
+        arena->chunk = chunk;
+    }
+
+    block = (uint8_t *)chunk->data + chunk->used;
+    *(size_t *)block = size;
+    chunk->last = chunk->used;
+    chunk->used += need;
+    arena->used += need;
+
+    return block + DPPLINE_ARENA_HDR_SIZE;
+}
+
+static void dppline_arena_free(void *allocator_data, void *ptr)
+{
+    /* blocks are released with the arena, see dppline_arena_reset() */
+}
+
+/* release the whole report, keeping one chunk sized for the next one */
+static void dppline_arena_reset(dppline_arena_t *arena)
+{
+    dppline_arena_chunk_t *chunk = arena->chunk;
+
+    if (chunk == NULL) return;
+
+    if (chunk->next == NULL)
+    {
+        chunk->used = 0;
+        chunk->last = 0;
+    }
+    else
+    {
+        while ((chunk = arena->chunk) != NULL)
+        {
+            arena->chunk = chunk->next;
+            free(chunk);
+        }
+        arena->hint = arena->used;
+    }
+    arena->used = 0;
+}
+
+/* protobuf-c allocator backed by the report arena */
+static ProtobufCAllocator g_dppline_allocator =
+{
+    .alloc = dppline_arena_alloc,
+    .free = dppline_arena_free,
+    .allocator_data = &g_dppline_arena,
+};
+
+static void * dppline_alloc(size_t size)
+{
+    return g_dppline_allocator.alloc(g_dppline_allocator.allocator_data, size);
+}
+
+static void * dppline_calloc(size_t nmemb, size_t size)
+{
+    void *ptr = dppline_alloc(nmemb * size);
+
+    if (ptr != NULL) memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+static void * dppline_realloc(void *ptr, size_t size)
+{
+    dppline_arena_chunk_t *chunk = g_dppline_arena.chunk;
+    uint8_t *block;
+    size_t old_size;
+    void *new_ptr;
+
+    if (ptr == NULL) return dppline_alloc(size);
+
+    block = (uint8_t *)ptr - DPPLINE_ARENA_HDR_SIZE;
+    old_size = *(size_t *)block;
+
+    // the last block of the current chunk is resized in place
+    if (block == (uint8_t *)chunk->data + chunk->last &&
+        chunk->last + DPPLINE_ARENA_BLOCK(size) <= chunk->size)
+    {
+        g_dppline_arena.used -= chunk->used - chunk->last;
+        chunk->used = chunk->last + DPPLINE_ARENA_BLOCK(size);
+        g_dppline_arena.used += chunk->used - chunk->last;
+        *(size_t *)block = size;
+        return ptr;
+    }
+
+    if (size <= old_size) return ptr;
+
+    new_ptr = dppline_alloc(size);
+    if (new_ptr != NULL) memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+static char * dppline_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *dup = dppline_alloc(len);
+
+    if (dup != NULL) memcpy(dup, str, len);
+    return dup;
+}
+
 /* private functions    */
 static dppline_stats_t * dpp_alloc_stat()
 {
@@ -754,7 +911,7 @@ static char * getNodeid()
 {
     char * buff = NULL;
 
-    buff = malloc(TARGET_ID_SZ);
+    buff = dppline_alloc(TARGET_ID_SZ);
     if (buff == NULL)
     {
         LOG(ERR, "Unable to allocate memory for node id.");
@@ -764,7 +921,6 @@ static char * getNodeid()
     if (!osp_unit_id_get(buff, TARGET_ID_SZ))
     {
         LOG(ERR, "Error acquiring node id.");
-        free(buff);
         return NULL;
     }
 
@@ -848,11 +1004,11 @@ static void dppline_add_stat_survey(Sts__Report *r, dppline_stats_t *s)
     r->n_survey++;
 
     // allocate or extend the size of surveys
-    r->survey = realloc(r->survey,
+    r->survey = dppline_realloc(r->survey,
             r->n_survey * sizeof(Sts__Survey*));
 
     // allocate new buffer Sts__Survey
-    sr = malloc(sizeof(Sts__Survey));
+    sr = dppline_alloc(sizeof(Sts__Survey));
     assert(sr);
     r->survey[r->n_survey - 1] = sr;
 
@@ -864,14 +1020,14 @@ static void dppline_add_stat_survey(Sts__Report *r, dppline_stats_t *s)
     sr->timestamp_ms = survey->timestamp_ms;
     sr->has_timestamp_ms = true;
     if (REPORT_TYPE_AVERAGE == survey->report_type) {
-        sr->survey_avg = malloc(survey->qty * sizeof(*sr->survey_avg));
+        sr->survey_avg = dppline_alloc(survey->qty * sizeof(*sr->survey_avg));
         assert(sr->survey_avg);
         sr->n_survey_avg = survey->qty;
         for (i = 0; i < survey->qty; i++)
         {
             dpp_survey_record_avg_t *rec = &survey->avg[i];
             Sts__Survey__SurveyAvg *dr; // dest rec
-            dr = sr->survey_avg[i] = malloc(sizeof(**sr->survey_avg));
+            dr = sr->survey_avg[i] = dppline_alloc(sizeof(**sr->survey_avg));
             assert(dr);
             sts__survey__survey_avg__init(dr);
 
@@ -881,7 +1037,7 @@ static void dppline_add_stat_survey(Sts__Report *r, dppline_stats_t *s)
             Sts__AvgTypeSigned   *davgs;
 #define CP_AVG(_name, _name1) do { \
         if (rec->_name1.avg) { \
-            davg = dr->_name = malloc(sizeof(*dr->_name)); \
+            davg = dr->_name = dppline_alloc(sizeof(*dr->_name)); \
             sts__avg_type__init(davg); \
             davg->avg = rec->_name1.avg; \
             if(rec->_name1.min) { \
@@ -901,7 +1057,7 @@ static void dppline_add_stat_survey(Sts__Report *r, dppline_stats_t *s)
 
 #define CP_AVG_SIGNED(_name, _name1) do { \
         if (rec->_name1.avg) { \
-            davgs = dr->_name = malloc(sizeof(*dr->_name)); \
+            davgs = dr->_name = dppline_alloc(sizeof(*dr->_name)); \
             sts__avg_type_signed__init(davgs); \
             davgs->avg = rec->_name1.avg; \
             if(rec->_name1.min) { \
@@ -938,14 +1094,14 @@ static void dppline_add_stat_survey(Sts__Report *r, dppline_stats_t *s)
            s->u.survey.numrec * (sizeof(Sts__AvgType)*5)); */
     } else {
         /* RAW only due to legacy (revisit once PERCENTILE AND HISTOGRAM)*/
-        sr->survey_list = malloc(survey->qty * sizeof(*sr->survey_list));
+        sr->survey_list = dppline_alloc(survey->qty * sizeof(*sr->survey_list));
         assert(sr->survey_list);
         sr->n_survey_list = survey->qty;
         for (i = 0; i < survey->qty; i++)
         {
             dpp_survey_record_t *rec = &survey->list[i];
             Sts__Survey__SurveySample *dr; // dest rec
-            dr = sr->survey_list[i] = malloc(sizeof(**sr->survey_list));
+            dr = sr->survey_list[i] = dppline_alloc(sizeof(**sr->survey_list));
             assert(dr);
             sts__survey__survey_sample__init(dr);
 
@@ -1011,12 +1167,12 @@ static void dppline_add_stat_neighbor(Sts__Report *r, dppline_stats_t *s)
     r->n_neighbors++;
 
     // allocate or extend the size of neighbors
-    r->neighbors = realloc(r->neighbors,
+    r->neighbors = dppline_realloc(r->neighbors,
             r->n_neighbors * sizeof(Sts__Neighbor*));
     size += sizeof(Sts__Neighbor*);
 
     // allocate new buffer Sts__Neighbor
-    sr = malloc(sizeof(Sts__Neighbor));
+    sr = dppline_alloc(sizeof(Sts__Neighbor));
     size += sizeof(Sts__Neighbor);
     assert(sr);
     r->neighbors[r->n_neighbors - 1] = sr;
@@ -1028,7 +1184,7 @@ static void dppline_add_stat_neighbor(Sts__Report *r, dppline_stats_t *s)
     sr->has_report_type = true;
     sr->timestamp_ms = neighbor->timestamp_ms;
     sr->has_timestamp_ms = true;
-    sr->bss_list = malloc(neighbor->qty * sizeof(*sr->bss_list));
+    sr->bss_list = dppline_alloc(neighbor->qty * sizeof(*sr->bss_list));
     size += neighbor->qty * sizeof(*sr->bss_list);
     assert(sr->bss_list);
     sr->n_bss_list = neighbor->qty;
@@ -1036,14 +1192,14 @@ static void dppline_add_stat_neighbor(Sts__Report *r, dppline_stats_t *s)
     {
         dpp_neighbor_record_t *rec = &neighbor->list[i];
         Sts__Neighbor__NeighborBss *dr; // dest rec
-        dr = sr->bss_list[i] = malloc(sizeof(**sr->bss_list));
+        dr = sr->bss_list[i] = dppline_alloc(sizeof(**sr->bss_list));
         size += sizeof(**sr->bss_list);
         assert(dr);
         sts__neighbor__neighbor_bss__init(dr);
 
-        dr->bssid = strdup(rec->bssid);
+        dr->bssid = dppline_strdup(rec->bssid);
         size += strlen(rec->bssid) + 1;
-        dr->ssid = strdup(rec->ssid);
+        dr->ssid = dppline_strdup(rec->ssid);
         size += strlen(rec->ssid) + 1;
         if (rec->sig) {
             dr->rssi = rec->sig;
@@ -1133,11 +1289,11 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
     r->n_clients++;
 
     // allocate or extend the size of clients
-    r->clients = realloc(r->clients,
+    r->clients = dppline_realloc(r->clients,
             r->n_clients * sizeof(Sts__ClientReport*));
 
     // allocate new buffer
-    sr = malloc(sizeof(Sts__ClientReport));
+    sr = dppline_alloc(sizeof(Sts__ClientReport));
     size += sizeof(Sts__ClientReport);
     assert(sr);
     r->clients[r->n_clients - 1] = sr;
@@ -1147,23 +1303,23 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
     sr->timestamp_ms = client->timestamp_ms;
     sr->has_timestamp_ms = true;
     sr->channel = client->channel;
-    sr->client_list = malloc(client->qty * sizeof(*sr->client_list));
+    sr->client_list = dppline_alloc(client->qty * sizeof(*sr->client_list));
     size += client->qty * sizeof(*sr->client_list);
     assert(sr->client_list);
     sr->n_client_list = client->qty;
     for (i = 0; i < client->qty; i++)
     {
         dpp_client_record_t *rec = &client->list[i].rec;
-        dr = sr->client_list[i] = malloc(sizeof(**sr->client_list));
+        dr = sr->client_list[i] = dppline_alloc(sizeof(**sr->client_list));
         size += sizeof(**sr->client_list);
         assert(dr);
         sts__client__init(dr);
 
-        dr->mac_address = malloc(MACADDR_STR_LEN);
+        dr->mac_address = dppline_alloc(MACADDR_STR_LEN);
         dpp_mac_to_str(rec->info.mac, dr->mac_address);
         size += MACADDR_STR_LEN;
 
-        dr->ssid = strdup(rec->info.essid);
+        dr->ssid = dppline_strdup(rec->info.essid);
         size += strlen(rec->info.essid) + 1;
 
         dr->connected = rec->is_connected;
@@ -1192,7 +1348,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
         dr->has_disconnect_count = true;
         dr->has_duration_ms = true;
 
-        dr->stats = malloc(sizeof(*dr->stats));
+        dr->stats = dppline_alloc(sizeof(*dr->stats));
         size += sizeof(*dr->stats);
         sts__client__stats__init(dr->stats);
 
@@ -1249,7 +1405,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
             dr->stats->has_tx_rate_perceived = true;
         }
 
-        dr->rx_stats = malloc(client->list[i].rx_qty * sizeof(*dr->rx_stats));
+        dr->rx_stats = dppline_alloc(client->list[i].rx_qty * sizeof(*dr->rx_stats));
         size += client->list[i].rx_qty * sizeof(*dr->rx_stats);
         assert(dr->rx_stats);
         dr->n_rx_stats = client->list[i].rx_qty;
@@ -1258,7 +1414,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
             Sts__Client__RxStats   *drx;
             dpp_client_stats_rx_t  *srx = &client->list[i].rx[j];
 
-            drx = dr->rx_stats[j] = malloc(sizeof(**dr->rx_stats));
+            drx = dr->rx_stats[j] = dppline_alloc(sizeof(**dr->rx_stats));
             sts__client__rx_stats__init(drx);
 
             drx->mcs        = srx->mcs;
@@ -1295,7 +1451,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
             }
         }
 
-        dr->tx_stats = malloc(client->list[i].tx_qty * sizeof(*dr->tx_stats));
+        dr->tx_stats = dppline_alloc(client->list[i].tx_qty * sizeof(*dr->tx_stats));
         size += client->list[i].tx_qty * sizeof(*dr->tx_stats);
         assert(dr->tx_stats);
         dr->n_tx_stats = client->list[i].tx_qty;
@@ -1304,7 +1460,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
             Sts__Client__TxStats *dtx;
             dpp_client_stats_tx_t *stx = &client->list[i].tx[j];
 
-            dtx = dr->tx_stats[j] = malloc(sizeof(**dr->tx_stats));
+            dtx = dr->tx_stats[j] = dppline_alloc(sizeof(**dr->tx_stats));
             sts__client__tx_stats__init(dtx);
 
             dtx->mcs     = stx->mcs;
@@ -1337,7 +1493,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
             }
         }
 
-        dr->tid_stats = malloc(client->list[i].tid_qty * sizeof(*dr->tid_stats));
+        dr->tid_stats = dppline_alloc(client->list[i].tid_qty * sizeof(*dr->tid_stats));
         size += client->list[i].tid_qty * sizeof(*dr->tid_stats);
         assert(dr->tid_stats);
         dr->n_tid_stats = client->list[i].tid_qty;
@@ -1345,20 +1501,20 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
         {
             Sts__Client__TidStats *dtid;
             dpp_client_tid_record_list_t *stid = &client->list[i].tid[j];
-            dtid = dr->tid_stats[j] = malloc(sizeof(**dr->tid_stats));
+            dtid = dr->tid_stats[j] = dppline_alloc(sizeof(**dr->tid_stats));
             sts__client__tid_stats__init(dtid);
 
             dtid->offset_ms =
                 sr->timestamp_ms - stid->timestamp_ms;
             dtid->has_offset_ms = true;
 
-            dtid->sojourn = malloc(CLIENT_MAX_TID_RECORDS * sizeof(*dtid->sojourn));
+            dtid->sojourn = dppline_alloc(CLIENT_MAX_TID_RECORDS * sizeof(*dtid->sojourn));
             for (n = 0, j1 = 0; j1 < CLIENT_MAX_TID_RECORDS; j1++)
             {
                 Sts__Client__TidStats__Sojourn *drr;
                 dpp_client_stats_tid_t *srr = &stid->entry[n];
                 if (!(srr->num_msdus)) continue;
-                drr = dtid->sojourn[n] = malloc(sizeof(**dtid->sojourn));
+                drr = dtid->sojourn[n] = dppline_alloc(sizeof(**dtid->sojourn));
                 sts__client__tid_stats__sojourn__init(drr);
                 drr->ac = dppline_to_proto_wmm_ac_type(srr->ac);
                 drr->tid = srr->tid;
@@ -1378,7 +1534,7 @@ static void dppline_add_stat_client(Sts__Report *r, dppline_stats_t *s)
                 n++;
             }
             dtid->n_sojourn = n;
-            dtid->sojourn = realloc(dtid->sojourn, n * sizeof(*dtid->sojourn));
+            dtid->sojourn = dppline_realloc(dtid->sojourn, n * sizeof(*dtid->sojourn));
             size += n * sizeof(*dtid->sojourn);
         }
     }
@@ -1397,12 +1553,12 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     r->n_device++;
 
     // allocate or extend the size of devices
-    r->device = realloc(r->device,
+    r->device = dppline_realloc(r->device,
             r->n_device * sizeof(Sts__Device*));
     size += sizeof(Sts__Device*);
 
     // allocate new buffer Sts__Device
-    sr = malloc(sizeof(Sts__Device));
+    sr = dppline_alloc(sizeof(Sts__Device));
     size += sizeof(Sts__Device);
     assert(sr);
     r->device[r->n_device - 1] = sr;
@@ -1411,7 +1567,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     sr->timestamp_ms = device->timestamp_ms;
     sr->has_timestamp_ms = true;
 
-    sr->load = malloc(sizeof(*sr->load));
+    sr->load = dppline_alloc(sizeof(*sr->load));
     size += sizeof(*sr->load);
     assert(sr->load);
     sts__device__load_avg__init(sr->load);
@@ -1425,7 +1581,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     sr->uptime = device->record.uptime;
     sr->has_uptime = true;
 
-    sr->mem_util = malloc(sizeof(*sr->mem_util));
+    sr->mem_util = dppline_alloc(sizeof(*sr->mem_util));
     size += sizeof(*sr->mem_util);
     assert(sr->mem_util);
     sts__device__mem_util__init(sr->mem_util);
@@ -1436,13 +1592,13 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     sr->mem_util->swap_used = device->record.mem_util.swap_used;
     sr->mem_util->has_swap_used = true;
 
-    sr->fs_util = malloc(DPP_DEVICE_FS_TYPE_QTY * sizeof(*sr->fs_util));
+    sr->fs_util = dppline_alloc(DPP_DEVICE_FS_TYPE_QTY * sizeof(*sr->fs_util));
     size += DPP_DEVICE_FS_TYPE_QTY * sizeof(*sr->fs_util);
     assert(sr->fs_util);
     sr->n_fs_util = DPP_DEVICE_FS_TYPE_QTY;
     for (i = 0; i < sr->n_fs_util; i++)
     {
-        sr->fs_util[i] = malloc(sizeof(**sr->fs_util));
+        sr->fs_util[i] = dppline_alloc(sizeof(**sr->fs_util));
         size += sizeof(**sr->fs_util);
         assert(sr->fs_util[i]);
         sts__device__fs_util__init(sr->fs_util[i]);
@@ -1452,7 +1608,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
         sr->fs_util[i]->fs_type = (Sts__FsType)device->record.fs_util[i].fs_type;
     }
 
-    sr->cpuutil = malloc(sizeof(*sr->cpuutil));
+    sr->cpuutil = dppline_alloc(sizeof(*sr->cpuutil));
     size += sizeof(*sr->cpuutil);
     assert(sr->cpuutil);
     sts__device__cpu_util__init(sr->cpuutil);
@@ -1463,17 +1619,17 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     sr->n_ps_cpu_util = device->record.n_top_cpu;
     if (sr->n_ps_cpu_util > 0)
     {
-        sr->ps_cpu_util = malloc(sr->n_ps_cpu_util * sizeof(*sr->ps_cpu_util));
+        sr->ps_cpu_util = dppline_alloc(sr->n_ps_cpu_util * sizeof(*sr->ps_cpu_util));
         assert(sr->ps_cpu_util);
         size += sizeof(*sr->ps_cpu_util);
         for (i = 0; i < sr->n_ps_cpu_util; i++)
         {
-            sr->ps_cpu_util[i] = malloc(sizeof(**sr->ps_cpu_util));
+            sr->ps_cpu_util[i] = dppline_alloc(sizeof(**sr->ps_cpu_util));
             assert(sr->ps_cpu_util[i]);
             size += sizeof(**sr->ps_cpu_util);
             sts__device__per_process_util__init(sr->ps_cpu_util[i]);
             sr->ps_cpu_util[i]->pid = device->record.top_cpu[i].pid;
-            sr->ps_cpu_util[i]->cmd = strdup(device->record.top_cpu[i].cmd);
+            sr->ps_cpu_util[i]->cmd = dppline_strdup(device->record.top_cpu[i].cmd);
             sr->ps_cpu_util[i]->util = device->record.top_cpu[i].util;
         }
     }
@@ -1482,31 +1638,31 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     sr->n_ps_mem_util = device->record.n_top_mem;
     if (sr->n_ps_mem_util > 0)
     {
-        sr->ps_mem_util = malloc(sr->n_ps_mem_util * sizeof(*sr->ps_mem_util));
+        sr->ps_mem_util = dppline_alloc(sr->n_ps_mem_util * sizeof(*sr->ps_mem_util));
         assert(sr->ps_mem_util);
         size += sizeof(*sr->ps_mem_util);
         for (i = 0; i < sr->n_ps_mem_util; i++)
         {
-            sr->ps_mem_util[i] = malloc(sizeof(**sr->ps_mem_util));
+            sr->ps_mem_util[i] = dppline_alloc(sizeof(**sr->ps_mem_util));
             assert(sr->ps_mem_util[i]);
             size += sizeof(**sr->ps_mem_util);
             sts__device__per_process_util__init(sr->ps_mem_util[i]);
             sr->ps_mem_util[i]->pid = device->record.top_mem[i].pid;
-            sr->ps_mem_util[i]->cmd = strdup(device->record.top_mem[i].cmd);
+            sr->ps_mem_util[i]->cmd = dppline_strdup(device->record.top_mem[i].cmd);
             sr->ps_mem_util[i]->util = device->record.top_mem[i].util;
         }
     }
 
     if (device->qty > 0)
     {
-        sr->radio_temp = malloc(device->qty * sizeof(*sr->radio_temp));
+        sr->radio_temp = dppline_alloc(device->qty * sizeof(*sr->radio_temp));
         size += device->qty * sizeof(*sr->radio_temp);
         assert(sr->radio_temp);
     }
     sr->n_radio_temp = device->qty;
     for (i = 0; i < device->qty; i++)
     {
-        sr->radio_temp[i] = malloc(sizeof(**sr->radio_temp));
+        sr->radio_temp[i] = dppline_alloc(sizeof(**sr->radio_temp));
         size += sizeof(**sr->radio_temp);
         assert(sr->radio_temp[i]);
         sts__device__radio_temp__init(sr->radio_temp[i]);
@@ -1519,7 +1675,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
 
     if (device->thermal_qty > 0)
     {
-        sr->thermal_stats = malloc(device->thermal_qty * sizeof(*sr->thermal_stats));
+        sr->thermal_stats = dppline_alloc(device->thermal_qty * sizeof(*sr->thermal_stats));
         size += device->thermal_qty * sizeof(*sr->thermal_stats);
         assert(sr->thermal_stats);
     }
@@ -1527,7 +1683,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
     for (i = 0; i < device->thermal_qty; i++)
     {
         Sts__Device__Thermal *dts; 
-        dts = sr->thermal_stats[i] = malloc(sizeof(**sr->thermal_stats));
+        dts = sr->thermal_stats[i] = dppline_alloc(sizeof(**sr->thermal_stats));
         size += sizeof(**sr->thermal_stats);
         assert(sr->thermal_stats[i]);
         sts__device__thermal__init(sr->thermal_stats[i]);
@@ -1541,7 +1697,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
         sr->thermal_stats[i]->timestamp_ms = device->thermal_list[i].timestamp_ms;
         sr->thermal_stats[i]->has_timestamp_ms = true;
 
-        sr->thermal_stats[i]->txchainmask = malloc(DPP_DEVICE_TX_CHAINMASK_MAX * sizeof(*dts->txchainmask));
+        sr->thermal_stats[i]->txchainmask = dppline_alloc(DPP_DEVICE_TX_CHAINMASK_MAX * sizeof(*dts->txchainmask));
         size += DPP_DEVICE_TX_CHAINMASK_MAX * sizeof(*dts->txchainmask);
         sr->thermal_stats[i]->n_txchainmask = 0; 
 
@@ -1551,7 +1707,7 @@ static void dppline_add_stat_device(Sts__Report *r, dppline_stats_t *s)
             Sts__Device__Thermal__RadioTxChainMask  *txchainmask;
             if (device->thermal_list[i].radio_txchainmasks[j].type != RADIO_TYPE_NONE)
             {
-                txchainmask = sr->thermal_stats[i]->txchainmask[j] = malloc(sizeof(**sr->thermal_stats[i]->txchainmask));
+                txchainmask = sr->thermal_stats[i]->txchainmask[j] = dppline_alloc(sizeof(**sr->thermal_stats[i]->txchainmask));
                 sts__device__thermal__radio_tx_chain_mask__init(txchainmask);
                 size += sizeof(**sr->thermal_stats[i]->txchainmask);
                 txchainmask->band =  dppline_to_proto_radio(device->thermal_list[i].radio_txchainmasks[j].type);
@@ -1575,11 +1731,11 @@ static void dppline_add_stat_capacity(Sts__Report *r, dppline_stats_t *s)
     r->n_capacity++;
 
     // allocate or extend the size of capacities
-    r->capacity = realloc(r->capacity,
+    r->capacity = dppline_realloc(r->capacity,
             r->n_capacity * sizeof(Sts__Capacity*));
 
     // allocate new buffer Sts__Capacity
-    sr = malloc(sizeof(Sts__Capacity));
+    sr = dppline_alloc(sizeof(Sts__Capacity));
     assert(sr);
     r->capacity[r->n_capacity - 1] = sr;
 
@@ -1587,7 +1743,7 @@ static void dppline_add_stat_capacity(Sts__Report *r, dppline_stats_t *s)
     sr->band = dppline_to_proto_radio(capacity->radio_type);
     sr->timestamp_ms = capacity->timestamp_ms;
     sr->has_timestamp_ms = true;
-    sr->queue_list = malloc(capacity->qty * sizeof(*sr->queue_list));
+    sr->queue_list = dppline_alloc(capacity->qty * sizeof(*sr->queue_list));
     assert(sr->queue_list);
     sr->n_queue_list = capacity->qty;
     for (i = 0; i < capacity->qty; i++)
@@ -1595,7 +1751,7 @@ static void dppline_add_stat_capacity(Sts__Report *r, dppline_stats_t *s)
         dpp_capacity_record_t *rec = &capacity->list[i];
 
         Sts__Capacity__QueueSample *dr; // dest rec
-        dr = sr->queue_list[i] = malloc(sizeof(**sr->queue_list));
+        dr = sr->queue_list[i] = dppline_alloc(sizeof(**sr->queue_list));
         assert(dr);
         sts__capacity__queue_sample__init(dr);
 
@@ -1668,12 +1824,12 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
     r->n_bs_report++;
 
     // allocate or extend the size of bs_report array
-    r->bs_report = realloc(r->bs_report,
+    r->bs_report = dppline_realloc(r->bs_report,
             r->n_bs_report * sizeof(Sts__BSReport*));
     assert(r->bs_report);
 
     // allocate new buffer Sts__BSReport
-    sr = malloc(sizeof(Sts__BSReport));
+    sr = dppline_alloc(sizeof(Sts__BSReport));
     assert(sr);
 
     // append report
@@ -1684,7 +1840,7 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
     sr->timestamp_ms = bs_client->timestamp_ms;
 
     // Append clients, so client array needs to be resided
-    sr->clients = realloc(sr->clients,
+    sr->clients = dppline_realloc(sr->clients,
             (sr->n_clients + bs_client->qty) * sizeof(*sr->clients));
     assert(sr->clients);
 
@@ -1704,12 +1860,12 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
         dpp_bs_client_record_t *c_rec = &bs_client->list[client];
 
         // Allocate memory for the BS Client
-        cr = sr->clients[sr->n_clients] = malloc(sizeof(**sr->clients));
+        cr = sr->clients[sr->n_clients] = dppline_alloc(sizeof(**sr->clients));
         sr->n_clients++;
         assert(cr);
         sts__bsclient__init(cr);
 
-        cr->mac_address = malloc(MACADDR_STR_LEN);
+        cr->mac_address = dppline_alloc(MACADDR_STR_LEN);
         dpp_mac_to_str(c_rec->mac, cr->mac_address);
 
         // alloc band list
@@ -1727,7 +1883,7 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
             cr->n_bs_band_report++;
         }
 
-        cr->bs_band_report = calloc(cr->n_bs_band_report, sizeof(*cr->bs_band_report));
+        cr->bs_band_report = dppline_calloc(cr->n_bs_band_report, sizeof(*cr->bs_band_report));
         assert(cr->bs_band_report);
 
         // For each band per client
@@ -1740,7 +1896,7 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
             }
 
             // Allocate memory for the band report
-            br = cr->bs_band_report[band_report] = malloc(sizeof(Sts__BSClient__BSBandReport));
+            br = cr->bs_band_report[band_report] = dppline_alloc(sizeof(Sts__BSClient__BSBandReport));
             band_report++;
             assert(br);
             sts__bsclient__bsband_report__init(br);
@@ -1778,10 +1934,10 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
             br->probe_bcast_cnt = b_rec->probe_bcast_cnt;
             br->has_probe_bcast_cnt = true;
 
-            br->ifname = strdup(b_rec->ifname);
+            br->ifname = dppline_strdup(b_rec->ifname);
 
             // alloc event list
-            br->event_list = calloc(b_rec->num_event_records, sizeof(*br->event_list));
+            br->event_list = dppline_calloc(b_rec->num_event_records, sizeof(*br->event_list));
             assert(br->event_list);
             br->n_event_list = b_rec->num_event_records;
 
@@ -1791,7 +1947,7 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
                 dpp_bs_client_event_record_t *e_rec = &b_rec->event_record[event];
 
                 // alloc event
-                er = br->event_list[event] = malloc(sizeof(Sts__BSClient__BSEvent));
+                er = br->event_list[event] = dppline_alloc(sizeof(Sts__BSClient__BSEvent));
                 assert(er);
                 sts__bsclient__bsevent__init(er);
 
@@ -1883,7 +2039,7 @@ static void dppline_add_stat_bs_client(Sts__Report * r, dppline_stats_t * s)
                 er->has_rrm_caps_ftm_range_rpt = true;
 
                 if (e_rec->assoc_ies_len) {
-                    er->assoc_ies.data = malloc(e_rec->assoc_ies_len);
+                    er->assoc_ies.data = dppline_alloc(e_rec->assoc_ies_len);
                     if (er->assoc_ies.data) {
                         memcpy(er->assoc_ies.data, e_rec->assoc_ies, e_rec->assoc_ies_len);
                         er->assoc_ies.len = e_rec->assoc_ies_len;
@@ -1930,11 +2086,11 @@ static void dppline_add_stat_rssi(Sts__Report *r, dppline_stats_t *s)
     r->n_rssi_report++;
 
     // allocate or extend the size of rssi_report
-    r->rssi_report = realloc(r->rssi_report,
+    r->rssi_report = dppline_realloc(r->rssi_report,
             r->n_rssi_report * sizeof(Sts__RssiReport*));
 
     // allocate new buffer
-    sr = malloc(sizeof(Sts__RssiReport));
+    sr = dppline_alloc(sizeof(Sts__RssiReport));
     size += sizeof(Sts__RssiReport);
     assert(sr);
     r->rssi_report[r->n_rssi_report - 1] = sr;
@@ -1944,19 +2100,19 @@ static void dppline_add_stat_rssi(Sts__Report *r, dppline_stats_t *s)
     sr->report_type = dppline_to_proto_report_type(rssi->report_type);
     sr->timestamp_ms = rssi->timestamp_ms;
     sr->has_timestamp_ms = true;
-    sr->peer_list = malloc(rssi->qty * sizeof(*sr->peer_list));
+    sr->peer_list = dppline_alloc(rssi->qty * sizeof(*sr->peer_list));
     size += rssi->qty * sizeof(*sr->peer_list);
     assert(sr->peer_list);
     sr->n_peer_list = rssi->qty;
     for (i = 0; i < rssi->qty; i++)
     {
         dpp_rssi_record_t *rec = &rssi->list[i].rec;
-        dr = sr->peer_list[i] = malloc(sizeof(**sr->peer_list));
+        dr = sr->peer_list[i] = dppline_alloc(sizeof(**sr->peer_list));
         size += sizeof(**sr->peer_list);
         assert(dr);
         sts__rssi_peer__init(dr);
 
-        dr->mac_address = malloc(MACADDR_STR_LEN);
+        dr->mac_address = dppline_alloc(MACADDR_STR_LEN);
         dpp_mac_to_str(rec->mac, dr->mac_address);
         size += MACADDR_STR_LEN;
 
@@ -1966,7 +2122,7 @@ static void dppline_add_stat_rssi(Sts__Report *r, dppline_stats_t *s)
         }
 
         if (REPORT_TYPE_RAW == rssi->report_type) {
-            dr->rssi_list = malloc(rssi->list[i].raw_qty * sizeof(*dr->rssi_list));
+            dr->rssi_list = dppline_alloc(rssi->list[i].raw_qty * sizeof(*dr->rssi_list));
             size += rssi->list[i].raw_qty * sizeof(*dr->rssi_list);
             assert(dr->rssi_list);
             dr->n_rssi_list = rssi->list[i].raw_qty;
@@ -1975,7 +2131,7 @@ static void dppline_add_stat_rssi(Sts__Report *r, dppline_stats_t *s)
                 Sts__RssiPeer__RssiSample   *draw;
                 dpp_rssi_raw_t  *sraw = &rssi->list[i].raw[j];
 
-                draw = dr->rssi_list[j] = malloc(sizeof(**dr->rssi_list));
+                draw = dr->rssi_list[j] = dppline_alloc(sizeof(**dr->rssi_list));
                 sts__rssi_peer__rssi_sample__init(draw);
 
                 draw->rssi = sraw->rssi;
@@ -1989,7 +2145,7 @@ static void dppline_add_stat_rssi(Sts__Report *r, dppline_stats_t *s)
             Sts__AvgType   *davg;
             dpp_avg_t      *savg = &rssi->list[i].rec.rssi.avg;
 
-            davg = dr->rssi_avg = malloc(sizeof(*dr->rssi_avg));
+            davg = dr->rssi_avg = dppline_alloc(sizeof(*dr->rssi_avg));
             sts__avg_type__init(davg);
 
             if (savg->avg) {
@@ -2032,16 +2188,16 @@ static void dppline_add_stat_client_auth_fails(Sts__Report *r, dppline_stats_t *
     r->n_client_auth_fails_report++;
 
     // allocate or extend the size of rssi_report
-    r->client_auth_fails_report = realloc(r->client_auth_fails_report, r->n_client_auth_fails_report * sizeof(Sts__ClientAuthFailsReport*));
+    r->client_auth_fails_report = dppline_realloc(r->client_auth_fails_report, r->n_client_auth_fails_report * sizeof(Sts__ClientAuthFailsReport*));
 
     // allocate new buffer
-    sr = malloc(sizeof(Sts__ClientAuthFailsReport));
+    sr = dppline_alloc(sizeof(Sts__ClientAuthFailsReport));
     assert(sr);
     r->client_auth_fails_report[r->n_client_auth_fails_report - 1] = sr;
 
     sts__client_auth_fails_report__init(sr);
     sr->band = dppline_to_proto_radio(client_auth_fails->radio_type);
-    sr->bss_list = malloc(client_auth_fails->qty * sizeof(*sr->bss_list));
+    sr->bss_list = dppline_alloc(client_auth_fails->qty * sizeof(*sr->bss_list));
     assert(sr->bss_list);
     sr->n_bss_list = client_auth_fails->qty;
     for (i = 0; i < client_auth_fails->qty; i++)
@@ -2050,13 +2206,13 @@ static void dppline_add_stat_client_auth_fails(Sts__Report *r, dppline_stats_t *
         Sts__ClientAuthFailsReport__BSS *br;
 
         bss = &client_auth_fails->list[i];
-        br = sr->bss_list[i] = malloc(sizeof(Sts__ClientAuthFailsReport__BSS));
+        br = sr->bss_list[i] = dppline_alloc(sizeof(Sts__ClientAuthFailsReport__BSS));
         assert(br);
 
         sts__client_auth_fails_report__bss__init(br);
-        br->ifname = strdup(bss->if_name);
+        br->ifname = dppline_strdup(bss->if_name);
 
-        br->client_list = malloc(bss->qty * sizeof(*br->client_list));
+        br->client_list = dppline_alloc(bss->qty * sizeof(*br->client_list));
         assert(br->client_list);
         br->n_client_list = bss->qty;
 
@@ -2066,11 +2222,11 @@ static void dppline_add_stat_client_auth_fails(Sts__Report *r, dppline_stats_t *
             Sts__ClientAuthFailsReport__BSS__Client *cr;
 
             client = &bss->list[j];
-            cr = br->client_list[j] = malloc(sizeof(Sts__ClientAuthFailsReport__BSS__Client));
+            cr = br->client_list[j] = dppline_alloc(sizeof(Sts__ClientAuthFailsReport__BSS__Client));
             assert(cr);
 
             sts__client_auth_fails_report__bss__client__init(cr);
-            cr->mac_address = strdup(client->mac);
+            cr->mac_address = dppline_strdup(client->mac);
             cr->auth_fails = client->auth_fails;
             cr->invalid_psk = client->invalid_psk;
         }
@@ -2298,10 +2454,14 @@ bool dpp_get_report(uint8_t * buff, size_t sz, uint32_t * packed_sz)
         return false;
     }
 
-    /* initialize report structure. Note - it has to be on heap,
-     * otherwise __free_unpacked function fails
+    /* initialize report structure, the report and all its
+     * sub-messages are allocated from the report arena
      */
-    Sts__Report * report = malloc(sizeof(Sts__Report));
+    Sts__Report * report = dppline_alloc(sizeof(Sts__Report));
+    if (report == NULL)
+    {
+        return false;
+    }
     sts__report__init(report);
     report->nodeid = getNodeid();
 
@@ -2351,9 +2511,9 @@ bool dpp_get_report(uint8_t * buff, size_t sz, uint32_t * packed_sz)
     }
 
     /* in any case,
-     * free memory used for report using system allocator
+     * release the whole report at once
      */
-    sts__report__free_unpacked(report, NULL);
+    dppline_arena_reset(&g_dppline_arena);
     dppline_log_queue();
 
     return ret;
@@ -2388,10 +2548,15 @@ bool dpp_get_report2(uint8_t **pbuff, size_t suggest_sz, uint32_t *packed_sz)
         return false;
     }
 
-    /* initialize report structure. Note - it has to be on heap,
-     * otherwise __free_unpacked function fails
+    /* initialize report structure, the report and all its
+     * sub-messages are allocated from the report arena
      */
-    Sts__Report * report = malloc(sizeof(Sts__Report));
+    Sts__Report * report = dppline_alloc(sizeof(Sts__Report));
+    if (report == NULL)
+    {
+        free(buff);
+        return false;
+    }
     sts__report__init(report);
     report->nodeid = getNodeid();
 
@@ -2454,8 +2619,8 @@ bool dpp_get_report2(uint8_t **pbuff, size_t suggest_sz, uint32_t *packed_sz)
     // pack current report to return buffer
     *packed_sz = sts__report__pack(report, buff);
 
-    // free memory used for report using system allocator
-    sts__report__free_unpacked(report, NULL);
+    // release the whole report at once
+    dppline_arena_reset(&g_dppline_arena);
 
     // debug
     dppline_log_queue();
@@ -0,0 +1,352 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dpp_client.h"
+#include "dpp_survey.h"
+#include "dppline.h"
+#include "log.h"
+#include "opensync_stats.pb-c.h"
+#include "os.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "dppline_tests";
+
+#define TEST_DPP_NUM_CLIENTS    64
+#define TEST_DPP_NUM_RATES      20
+#define TEST_DPP_NUM_SURVEYS    30
+#define TEST_DPP_REPORT_SIZE    (256 * 1024)
+
+static dpp_client_report_data_t g_client_report;
+static dpp_survey_report_data_t g_survey_report;
+static uint8_t g_report_buf[TEST_DPP_REPORT_SIZE];
+
+
+void
+setUp(void)
+{
+    // pass
+}
+
+
+void
+tearDown(void)
+{
+    // pass
+}
+
+
+/**
+ * @brief builds a client report and a raw survey report
+ *
+ * The client report holds TEST_DPP_NUM_CLIENTS clients, each with
+ * TEST_DPP_NUM_RATES rx and tx rate records and one TID record.
+ */
+static void
+test_dpp_build_reports(void)
+{
+    dpp_client_tid_record_list_t *tid;
+    dpp_client_stats_rx_t *rx;
+    dpp_client_stats_tx_t *tx;
+    dpp_client_record_t *client;
+    dpp_survey_record_t *survey;
+    int i, j;
+
+    ds_dlist_init(&g_client_report.list, dpp_client_record_t, node);
+    g_client_report.radio_type = RADIO_TYPE_5G;
+    g_client_report.channel = 36;
+    g_client_report.timestamp_ms = 1000;
+    for (i = 0; i < TEST_DPP_NUM_CLIENTS; i++)
+    {
+        client = dpp_client_record_alloc();
+        TEST_ASSERT_NOT_NULL(client);
+        client->info.mac[5] = i;
+        client->info.type = RADIO_TYPE_5G;
+        snprintf(client->info.essid, sizeof(client->info.essid), "ssid-%d", i % 4);
+        client->stats.bytes_tx = 1000 + i;
+        client->stats.bytes_rx = 2000 + i;
+        client->stats.rssi = -40 - (i % 30);
+        client->stats.rate_tx = 100.5;
+        client->is_connected = 1;
+        client->duration_ms = 5000;
+
+        for (j = 0; j < TEST_DPP_NUM_RATES; j++)
+        {
+            rx = dpp_client_stats_rx_record_alloc();
+            TEST_ASSERT_NOT_NULL(rx);
+            rx->mcs = j % 10;
+            rx->nss = j / 10;
+            rx->bytes = j * 100;
+            rx->mpdu = j;
+            rx->rssi = -50;
+            ds_dlist_insert_tail(&client->stats_rx, rx);
+
+            tx = dpp_client_stats_tx_record_alloc();
+            TEST_ASSERT_NOT_NULL(tx);
+            tx->mcs = j % 10;
+            tx->nss = j / 10;
+            tx->bytes = j * 200;
+            tx->msdu = j;
+            ds_dlist_insert_tail(&client->stats_tx, tx);
+        }
+
+        tid = dpp_client_tid_record_alloc();
+        TEST_ASSERT_NOT_NULL(tid);
+        tid->timestamp_ms = 900;
+        for (j = 0; j < 16; j++)
+        {
+            tid->entry[j].tid = j;
+            tid->entry[j].num_msdus = j + 1;
+        }
+        ds_dlist_insert_tail(&client->tid_record_list, tid);
+
+        ds_dlist_insert_tail(&g_client_report.list, client);
+    }
+
+    ds_dlist_init(&g_survey_report.list, dpp_survey_record_t, node);
+    g_survey_report.radio_type = RADIO_TYPE_5G;
+    g_survey_report.report_type = REPORT_TYPE_RAW;
+    g_survey_report.scan_type = RADIO_SCAN_TYPE_OFFCHAN;
+    g_survey_report.timestamp_ms = 1000;
+    for (i = 0; i < TEST_DPP_NUM_SURVEYS; i++)
+    {
+        survey = dpp_survey_record_alloc();
+        TEST_ASSERT_NOT_NULL(survey);
+        survey->info.chan = 36 + 4 * (i % 8);
+        survey->info.timestamp_ms = 990;
+        survey->chan_busy = i;
+        survey->chan_rx = i / 2;
+        survey->chan_noise = -95;
+        survey->duration_ms = 50;
+        ds_dlist_insert_tail(&g_survey_report.list, survey);
+    }
+}
+
+
+static void
+test_dpp_free_reports(void)
+{
+    dpp_client_tid_record_list_t *tid;
+    dpp_client_stats_rx_t *rx;
+    dpp_client_stats_tx_t *tx;
+    dpp_client_record_t *client;
+    dpp_survey_record_t *survey;
+
+    while ((client = ds_dlist_remove_head(&g_client_report.list)) != NULL)
+    {
+        while ((rx = ds_dlist_remove_head(&client->stats_rx)) != NULL)
+        {
+            dpp_client_stats_rx_record_free(rx);
+        }
+        while ((tx = ds_dlist_remove_head(&client->stats_tx)) != NULL)
+        {
+            dpp_client_stats_tx_record_free(tx);
+        }
+        while ((tid = ds_dlist_remove_head(&client->tid_record_list)) != NULL)
+        {
+            dpp_client_tid_record_free(tid);
+        }
+        dpp_client_record_free(client);
+    }
+
+    while ((survey = ds_dlist_remove_head(&g_survey_report.list)) != NULL)
+    {
+        dpp_survey_record_free(survey);
+    }
+}
+
+
+/**
+ * @brief queues the test reports and gets the packed report
+ *
+ * @param buf the packed report, owned by the caller
+ * @return the packed size, 0 on failure
+ */
+static uint32_t
+test_dpp_get_report(uint8_t **buf)
+{
+    uint32_t packed_sz = 0;
+    bool ret;
+
+    ret = dpp_put_client(&g_client_report);
+    TEST_ASSERT_TRUE(ret);
+    ret = dpp_put_survey(&g_survey_report);
+    TEST_ASSERT_TRUE(ret);
+
+#ifdef DPP_FAST_PACK
+    ret = dpp_get_report2(buf, TEST_DPP_REPORT_SIZE, &packed_sz);
+#else
+    *buf = g_report_buf;
+    ret = dpp_get_report(*buf, sizeof(g_report_buf), &packed_sz);
+#endif
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_INT(0, dpp_get_queue_elements());
+
+    return packed_sz;
+}
+
+
+static void
+test_dpp_release_report(uint8_t *buf)
+{
+#ifdef DPP_FAST_PACK
+    free(buf);
+#else
+    (void)buf;
+#endif
+}
+
+
+/**
+ * @brief validates the report built in the report arena
+ *
+ * The report is unpacked and checked, then built again: the arena
+ * reuses its memory and the packed report must not change.
+ */
+void
+test_dpp_report_content(void)
+{
+    Sts__ClientReport *client_report;
+    Sts__Report *report;
+    Sts__Client *client;
+    uint32_t packed_sz;
+    uint8_t *first;
+    uint8_t *buf;
+    size_t i;
+
+    packed_sz = test_dpp_get_report(&buf);
+    TEST_ASSERT_TRUE(packed_sz > 0);
+
+    report = sts__report__unpack(NULL, packed_sz, buf);
+    TEST_ASSERT_NOT_NULL(report);
+    TEST_ASSERT_EQUAL_UINT(1, report->n_clients);
+    TEST_ASSERT_EQUAL_UINT(1, report->n_survey);
+
+    client_report = report->clients[0];
+    TEST_ASSERT_EQUAL_UINT(TEST_DPP_NUM_CLIENTS, client_report->n_client_list);
+    for (i = 0; i < client_report->n_client_list; i++)
+    {
+        client = client_report->client_list[i];
+        TEST_ASSERT_EQUAL_UINT(TEST_DPP_NUM_RATES, client->n_rx_stats);
+        TEST_ASSERT_EQUAL_UINT(TEST_DPP_NUM_RATES, client->n_tx_stats);
+        TEST_ASSERT_EQUAL_UINT(1, client->n_tid_stats);
+    }
+    TEST_ASSERT_EQUAL_UINT(TEST_DPP_NUM_SURVEYS, report->survey[0]->n_survey_list);
+    sts__report__free_unpacked(report, NULL);
+
+    first = malloc(packed_sz);
+    TEST_ASSERT_NOT_NULL(first);
+    memcpy(first, buf, packed_sz);
+    test_dpp_release_report(buf);
+
+    for (i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT(packed_sz, test_dpp_get_report(&buf));
+        TEST_ASSERT_EQUAL_MEMORY(first, buf, packed_sz);
+        test_dpp_release_report(buf);
+    }
+    free(first);
+}
+
+
+static double
+test_dpp_elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 +
+           (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+
+/**
+ * @brief measures the report queueing, and the report build and pack
+ */
+void
+test_dpp_report_benchmark(void)
+{
+    struct timespec start, end;
+    uint32_t packed_sz;
+    double t_queue;
+    double t_report;
+    uint8_t *buf;
+    int iters;
+    int i;
+
+    iters = 2000;
+    t_queue = 0;
+    t_report = 0;
+    packed_sz = 0;
+    for (i = 0; i < iters; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        dpp_put_client(&g_client_report);
+        dpp_put_survey(&g_survey_report);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t_queue += test_dpp_elapsed(&start, &end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef DPP_FAST_PACK
+        dpp_get_report2(&buf, TEST_DPP_REPORT_SIZE, &packed_sz);
+#else
+        buf = g_report_buf;
+        dpp_get_report(buf, sizeof(g_report_buf), &packed_sz);
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t_report += test_dpp_elapsed(&start, &end);
+        test_dpp_release_report(buf);
+    }
+    TEST_ASSERT_TRUE(packed_sz > 0);
+
+    LOGI("%s: %u bytes report, %d clients: queue %.1f us, build + pack %.1f us",
+         __func__, packed_sz, TEST_DPP_NUM_CLIENTS,
+         t_queue / iters, t_report / iters);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+    dpp_init();
+    test_dpp_build_reports();
+
+    RUN_TEST(test_dpp_report_content);
+    RUN_TEST(test_dpp_report_benchmark);
+
+    test_dpp_free_reports();
+
+    return UNITY_END();
+}
@@ -27,12 +27,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef DNS_CACHE_H_INCLUDED
 #define DNS_CACHE_H_INCLUDED
 
+#include <pthread.h>
 #include <stdint.h>
 #include <time.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "ds_dlist.h"
 #include "ds_tree.h"
 #include "os.h"
 #include "os_types.h"
@@ -43,12 +45,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define SERVICE_PROVIDER_MAX_ELEMS 3
 
+/*
+ * ip2action cache counters
+ */
+struct dns_cache_stats
+{
+    uint64_t    hits;       /* lookups finding an entry */
+    uint64_t    misses;     /* lookups finding no entry */
+    uint64_t    expired;    /* entries removed on ttl expiry */
+    uint64_t    evicted;    /* entries removed to honor the memory cap */
+};
+
+struct ip2action;
+
 struct dns_cache_mgr
 {
     bool        initialized;
     uint8_t     refcount;
     uint32_t    cache_hit_count[SERVICE_PROVIDER_MAX_ELEMS];
     ds_tree_t   ip2a_tree;
+    struct ip2action **expiry_heap;   /* entries min-heap ordered by expiry */
+    size_t      heap_len;
+    size_t      heap_capacity;
+    ds_dlist_t  lru;                  /* entries, most recently hit first */
+    size_t      nentries;
+    size_t      memory;               /* bytes used by the cached entries */
+    size_t      max_memory;           /* memory cap in bytes, 0: no cap */
+    struct dns_cache_stats stats;
+    pthread_mutex_t lock;             /* cache vs fsm nfqueue workers */
 };
 
 #define URL_REPORT_MAX_ELEMS 8
@@ -101,6 +125,10 @@ struct ip2action
 #define cache_bc cache_info.bc_info
 #define cache_wb cache_info.wb_info
 #define cache_gk cache_info.gk_info
+    time_t                      expiry;        /* cache_ts + cache_ttl */
+    size_t                      heap_idx;      /* position in the expiry heap */
+    size_t                      mem_size;      /* accounted memory */
+    ds_dlist_node_t             lru_node;
     ds_tree_node_t              ip2a_tnode;
 };
 
@@ -217,6 +245,26 @@ print_dns_cache(void);
 int
 dns_cache_get_size(void);
 
+/**
+ * @brief sets the cache memory cap.
+ *
+ * Least recently hit entries are evicted when the cap is exceeded.
+ *
+ * @param max_memory the cap in bytes, 0 to disable it
+ */
+void
+dns_cache_set_max_memory(size_t max_memory);
+
+/**
+ * @brief returns the cache counters.
+ *
+ * @param None
+ *
+ * @return the cache counters
+ */
+struct dns_cache_stats *
+dns_cache_get_stats(void);
+
 /**
  * @brief print cache size.
  *
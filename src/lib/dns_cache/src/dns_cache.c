@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <inttypes.h>
 
 #include "os.h"
 #include "os_types.h"
@@ -42,8 +43,11 @@ mgr =
 {
     .initialized = false,
     .refcount = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
 };
 
+#define DNS_CACHE_HEAP_MIN_CAPACITY 64
+
 struct dns_cache_mgr *
 dns_cache_get_mgr(void)
 {
@@ -87,6 +91,138 @@ dns_cache_ip2action_cmp(void *_a, void *_b)
     return 0;
 }
 
+static void
+dns_cache_heap_set(struct dns_cache_mgr *mgr, size_t idx, struct ip2action *i2a)
+{
+    mgr->expiry_heap[idx] = i2a;
+    i2a->heap_idx = idx;
+}
+
+
+static void
+dns_cache_heap_sift_up(struct dns_cache_mgr *mgr, size_t idx)
+{
+    struct ip2action *i2a;
+    struct ip2action *parent;
+
+    i2a = mgr->expiry_heap[idx];
+    while (idx > 0)
+    {
+        parent = mgr->expiry_heap[(idx - 1) / 2];
+        if (parent->expiry <= i2a->expiry) break;
+
+        dns_cache_heap_set(mgr, idx, parent);
+        idx = (idx - 1) / 2;
+    }
+    dns_cache_heap_set(mgr, idx, i2a);
+}
+
+
+static void
+dns_cache_heap_sift_down(struct dns_cache_mgr *mgr, size_t idx)
+{
+    struct ip2action *i2a;
+    struct ip2action *child;
+    size_t cidx;
+
+    i2a = mgr->expiry_heap[idx];
+    for (;;)
+    {
+        cidx = 2 * idx + 1;
+        if (cidx >= mgr->heap_len) break;
+
+        child = mgr->expiry_heap[cidx];
+        if (cidx + 1 < mgr->heap_len &&
+            mgr->expiry_heap[cidx + 1]->expiry < child->expiry)
+        {
+            cidx++;
+            child = mgr->expiry_heap[cidx];
+        }
+        if (i2a->expiry <= child->expiry) break;
+
+        dns_cache_heap_set(mgr, idx, child);
+        idx = cidx;
+    }
+    dns_cache_heap_set(mgr, idx, i2a);
+}
+
+
+/**
+ * @brief adds an entry to the expiry heap
+ *
+ * @return true if added, false on allocation failure
+ */
+static bool
+dns_cache_heap_push(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    struct ip2action **heap;
+    size_t capacity;
+
+    if (mgr->heap_len == mgr->heap_capacity)
+    {
+        capacity = mgr->heap_capacity * 2;
+        if (capacity == 0) capacity = DNS_CACHE_HEAP_MIN_CAPACITY;
+
+        heap = realloc(mgr->expiry_heap, capacity * sizeof(*heap));
+        if (heap == NULL) return false;
+
+        mgr->expiry_heap = heap;
+        mgr->heap_capacity = capacity;
+    }
+
+    dns_cache_heap_set(mgr, mgr->heap_len, i2a);
+    mgr->heap_len++;
+    dns_cache_heap_sift_up(mgr, i2a->heap_idx);
+
+    return true;
+}
+
+
+/**
+ * @brief restores the heap order after an entry's expiry changed
+ */
+static void
+dns_cache_heap_update(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    dns_cache_heap_sift_up(mgr, i2a->heap_idx);
+    dns_cache_heap_sift_down(mgr, i2a->heap_idx);
+}
+
+
+static void
+dns_cache_heap_remove(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    struct ip2action *last;
+    size_t idx;
+
+    idx = i2a->heap_idx;
+    mgr->heap_len--;
+    if (idx == mgr->heap_len) return;
+
+    last = mgr->expiry_heap[mgr->heap_len];
+    dns_cache_heap_set(mgr, idx, last);
+    dns_cache_heap_update(mgr, last);
+}
+
+
+/**
+ * @brief computes the memory accounted to an entry
+ */
+static size_t
+dns_cache_ip2action_mem_size(struct ip2action *i2a)
+{
+    size_t size;
+
+    size = sizeof(*i2a) + sizeof(*i2a->device_mac) + sizeof(*i2a->ip_addr);
+    if (i2a->service_id == IP2ACTION_GK_SVC && i2a->cache_gk.gk_policy != NULL)
+    {
+        size += strlen(i2a->cache_gk.gk_policy) + 1;
+    }
+
+    return size;
+}
+
+
 static void
 print_dns_cache_entry(struct ip2action *i2a)
 {
@@ -156,6 +292,9 @@ dns_cache_init_mgr(struct dns_cache_mgr *mgr)
 
     ds_tree_init(&mgr->ip2a_tree, dns_cache_ip2action_cmp,
                  struct ip2action, ip2a_tnode);
+    ds_dlist_init(&mgr->lru, struct ip2action, lru_node);
+    mgr->max_memory = (size_t)CONFIG_LIBDNS_CACHE_MAX_MEMORY * 1024;
+    memset(&mgr->stats, 0, sizeof(mgr->stats));
 
     mgr->initialized = true;
     mgr->refcount++;
@@ -176,7 +315,9 @@ dns_cache_init(void)
     struct dns_cache_mgr *mgr;
 
     mgr = dns_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
     dns_cache_init_mgr(mgr);
+    pthread_mutex_unlock(&mgr->lock);
 
     return true;
 
@@ -209,10 +350,53 @@ dns_cache_free_ip2action(struct ip2action *i2a)
    return;
 }
 
-void
-dns_cache_cleanup(void)
+
+/**
+ * @brief unlinks an entry from the cache and frees it
+ */
+static void
+dns_cache_remove_ip2action(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    dns_cache_heap_remove(mgr, i2a);
+    ds_dlist_remove(&mgr->lru, i2a);
+    ds_tree_remove(&mgr->ip2a_tree, i2a);
+    mgr->memory -= i2a->mem_size;
+    mgr->nentries--;
+
+    dns_cache_free_ip2action(i2a);
+    free(i2a);
+}
+
+
+/**
+ * @brief evicts the least recently hit entries until the memory cap is met
+ *
+ * The most recently hit entry is kept.
+ */
+static void
+dns_cache_enforce_max_memory(struct dns_cache_mgr *mgr)
+{
+    struct ip2action *i2a;
+
+    if (mgr->max_memory == 0) return;
+
+    while (mgr->memory > mgr->max_memory && mgr->nentries > 1)
+    {
+        i2a = ds_dlist_tail(&mgr->lru);
+        LOGD("%s: ip2action_cache evicting entry:", __func__);
+        print_dns_cache_entry(i2a);
+
+        dns_cache_remove_ip2action(mgr, i2a);
+        mgr->stats.evicted++;
+    }
+}
+
+/**
+ * @brief frees all the cached entries, called with the cache locked
+ */
+static void
+dns_cache_flush(struct dns_cache_mgr *mgr)
 {
-    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action *i2a_entry, *i2a_next;
     ds_tree_t *tree;
 
@@ -223,14 +407,26 @@ dns_cache_cleanup(void)
     while (i2a_entry != NULL)
     {
         i2a_next = ds_tree_next(tree, i2a_entry);
-        ds_tree_remove(tree, i2a_entry);
-        dns_cache_free_ip2action(i2a_entry);
-        free(i2a_entry);
+        dns_cache_remove_ip2action(mgr, i2a_entry);
         i2a_entry = i2a_next;
     }
+
+    free(mgr->expiry_heap);
+    mgr->expiry_heap = NULL;
+    mgr->heap_capacity = 0;
     return;
 }
 
+void
+dns_cache_cleanup(void)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+
+    pthread_mutex_lock(&mgr->lock);
+    dns_cache_flush(mgr);
+    pthread_mutex_unlock(&mgr->lock);
+}
+
 /**
  * @brief cleanup allocated memory.
  *
@@ -244,18 +440,25 @@ dns_cache_cleanup_mgr(void)
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     uint8_t service_id;
 
-    if (!mgr->initialized) return;
+    pthread_mutex_lock(&mgr->lock);
+    if (!mgr->initialized)
+    {
+        pthread_mutex_unlock(&mgr->lock);
+        return;
+    }
     mgr->refcount--;
 
     if (mgr->refcount == 0)
     {
-        dns_cache_cleanup();
+        dns_cache_flush(mgr);
         for (service_id = 0; service_id < SERVICE_PROVIDER_MAX_ELEMS; service_id++)
         {
             mgr->cache_hit_count[service_id] = 0;
         }
+        memset(&mgr->stats, 0, sizeof(mgr->stats));
         mgr->initialized = false;
     }
+    pthread_mutex_unlock(&mgr->lock);
 }
 
 
@@ -294,6 +497,7 @@ dns_cache_update_ip2action(struct ip2action *i2a, struct ip2action_req *to_upd)
     i2a->redirect_flag = to_upd->redirect_flag;
     i2a->cache_ttl = to_upd->cache_ttl;
     i2a->cache_ts  = time(NULL);
+    i2a->expiry = i2a->cache_ts + i2a->cache_ttl;
     return true;
 }
 
@@ -400,22 +604,24 @@ dns_cache_set_gk_cache_entry(struct ip2action_gk_info *i2a_cache_gk,
  *
  * @return true for success and false for failure.
  */
-bool
-dns_cache_ip2action_lookup(struct ip2action_req *req)
+static bool
+dns_cache_ip2action_lookup_locked(struct dns_cache_mgr *mgr,
+                                  struct ip2action_req *req)
 {
-   struct dns_cache_mgr *mgr;
    struct ip2action *i2a;
    size_t index;
 
-   if (!req) return false;
-
-   mgr = dns_cache_get_mgr();
    i2a = dns_cache_lookup_ip2action(req);
    if (i2a == NULL)
    {
+       mgr->stats.misses++;
        return false;
    }
 
+   mgr->stats.hits++;
+   ds_dlist_remove(&mgr->lru, i2a);
+   ds_dlist_insert_head(&mgr->lru, i2a);
+
    req->action = i2a->action;
    req->cache_ttl = i2a->cache_ttl;
    req->policy_idx = i2a->policy_idx;
@@ -456,6 +662,28 @@ dns_cache_ip2action_lookup(struct ip2action_req *req)
    return true;
 }
 
+
+/**
+ * @brief Lookup cached action for given ip address and mac.
+ *
+ * A hit moves the entry ahead of the LRU list, the cache is locked.
+ */
+bool
+dns_cache_ip2action_lookup(struct ip2action_req *req)
+{
+   struct dns_cache_mgr *mgr;
+   bool rc;
+
+   if (!req) return false;
+
+   mgr = dns_cache_get_mgr();
+   pthread_mutex_lock(&mgr->lock);
+   rc = dns_cache_ip2action_lookup_locked(mgr, req);
+   pthread_mutex_unlock(&mgr->lock);
+
+   return rc;
+}
+
 static struct ip2action *
 dns_cache_alloc_ip2action(struct ip2action_req  *to_add)
 {
@@ -469,15 +697,18 @@ dns_cache_alloc_ip2action(struct ip2action_req  *to_add)
         LOGE("%s: Couldn't allocate memory for ip2action entry.",__func__);
         return NULL;
     }
-    i2a->device_mac = calloc(1, sizeof(struct ip2action));
+    i2a->device_mac = calloc(1, sizeof(os_macaddr_t));
+    if (i2a->device_mac == NULL) goto err;
     memcpy(i2a->device_mac, to_add->device_mac, sizeof(os_macaddr_t));
 
     i2a->ip_addr = calloc(1, sizeof(struct sockaddr_storage));
+    if (i2a->ip_addr == NULL) goto err;
     memcpy(i2a->ip_addr, to_add->ip_addr, sizeof(struct sockaddr_storage));
 
     i2a->action  = to_add->action;
     i2a->cache_ttl  = to_add->cache_ttl;
     i2a->cache_ts  = time(NULL);
+    i2a->expiry = i2a->cache_ts + i2a->cache_ttl;
     i2a->policy_idx = to_add->policy_idx;
     i2a->service_id = to_add->service_id;
     i2a->redirect_flag = to_add->redirect_flag;
@@ -511,6 +742,7 @@ dns_cache_alloc_ip2action(struct ip2action_req  *to_add)
     if (!rc) goto err;
 
     dns_cache_set_ip(i2a);
+    i2a->mem_size = dns_cache_ip2action_mem_size(i2a);
     return i2a;
 
 err:
@@ -529,18 +761,21 @@ err:
  *
  * @return true for success and false for failure.
  */
-bool
-dns_cache_add_entry(struct ip2action_req *to_add)
+static bool
+dns_cache_add_entry_locked(struct dns_cache_mgr *mgr,
+                           struct ip2action_req *to_add)
 {
-    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action     *i2a;
 
-    if (!mgr->initialized || !to_add) return false;
+    if (!mgr->initialized) return false;
 
     i2a = dns_cache_lookup_ip2action(to_add);
     if (i2a != NULL)
     {
         dns_cache_update_ip2action(i2a, to_add);
+        dns_cache_heap_update(mgr, i2a);
+        ds_dlist_remove(&mgr->lru, i2a);
+        ds_dlist_insert_head(&mgr->lru, i2a);
 
         LOGD("%s: ip2action_cache updated entry in cache:", __func__);
         print_dns_cache_entry(i2a);
@@ -554,11 +789,40 @@ dns_cache_add_entry(struct ip2action_req *to_add)
     LOGD("%s: ip2action_cache adding to cache:", __func__);
     print_dns_cache_entry(i2a);
 
+    if (!dns_cache_heap_push(mgr, i2a))
+    {
+        LOGE("%s: Couldn't grow the ip2action expiry heap.", __func__);
+        dns_cache_free_ip2action(i2a);
+        free(i2a);
+        return false;
+    }
+
     ds_tree_insert(&mgr->ip2a_tree, i2a, i2a);
+    ds_dlist_insert_head(&mgr->lru, i2a);
+    mgr->memory += i2a->mem_size;
+    mgr->nentries++;
+
+    dns_cache_enforce_max_memory(mgr);
 
     return true;
 }
 
+
+bool
+dns_cache_add_entry(struct ip2action_req *to_add)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+    bool rc;
+
+    if (!to_add) return false;
+
+    pthread_mutex_lock(&mgr->lock);
+    rc = dns_cache_add_entry_locked(mgr, to_add);
+    pthread_mutex_unlock(&mgr->lock);
+
+    return rc;
+}
+
 /**
  * @brief Delete fqdn entry.
  *
@@ -572,18 +836,23 @@ dns_cache_del_entry(struct ip2action_req *to_del)
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action     *i2a;
 
-    if (!mgr->initialized) return false;
+    pthread_mutex_lock(&mgr->lock);
+    if (!mgr->initialized)
+    {
+        pthread_mutex_unlock(&mgr->lock);
+        return false;
+    }
 
     i2a = dns_cache_lookup_ip2action(to_del);
-    if (i2a == NULL) return true;
-
-    LOGD("%s: ip2action_cache removing entry:", __func__);
-    print_dns_cache_entry(i2a);
+    if (i2a != NULL)
+    {
+        LOGD("%s: ip2action_cache removing entry:", __func__);
+        print_dns_cache_entry(i2a);
 
-    /* free ip2action entry  */
-    dns_cache_free_ip2action(i2a);
-    ds_tree_remove(&mgr->ip2a_tree, i2a);
-    free(i2a);
+        /* free ip2action entry  */
+        dns_cache_remove_ip2action(mgr, i2a);
+    }
+    pthread_mutex_unlock(&mgr->lock);
 
     return true;
 }
@@ -592,37 +861,34 @@ dns_cache_del_entry(struct ip2action_req *to_del)
 /**
  * @brief remove old cache entres.
  *
- * @param ttl
+ * Pops the expired entries off the expiry heap, leaving the others untouched.
  */
 bool
 dns_cache_ttl_cleanup(void)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
-    struct ip2action     *i2a, *next;
-    ds_tree_t            *tree;
+    struct ip2action     *i2a;
     time_t               now;
 
-    if (!mgr->initialized) return false;
+    pthread_mutex_lock(&mgr->lock);
+    if (!mgr->initialized)
+    {
+        pthread_mutex_unlock(&mgr->lock);
+        return false;
+    }
 
     LOGD("%s: ip2action_cache removing ttl expired entries", __func__);
     now = time(NULL);
 
-    tree = &mgr->ip2a_tree;
-
-    i2a = ds_tree_head(tree);
-    while (i2a != NULL)
+    while (mgr->heap_len != 0)
     {
-        if ((now - i2a->cache_ts) < i2a->cache_ttl)
-        {
-            i2a = ds_tree_next(tree, i2a);
-            continue;
-        }
-        next = ds_tree_next(tree, i2a);
-        ds_tree_remove(tree, i2a);
-        dns_cache_free_ip2action(i2a);
-        free(i2a);
-        i2a = next;
+        i2a = mgr->expiry_heap[0];
+        if (now < i2a->expiry) break;
+
+        dns_cache_remove_ip2action(mgr, i2a);
+        mgr->stats.expired++;
     }
+    pthread_mutex_unlock(&mgr->lock);
     return true;
 }
 
@@ -637,7 +903,12 @@ print_dns_cache(void)
     struct ip2action     *i2a;
     ds_tree_t            *tree;
 
-    if (!mgr->initialized) return;
+    pthread_mutex_lock(&mgr->lock);
+    if (!mgr->initialized)
+    {
+        pthread_mutex_unlock(&mgr->lock);
+        return;
+    }
 
     tree = &mgr->ip2a_tree;
 
@@ -648,6 +919,7 @@ print_dns_cache(void)
         print_dns_cache_entry(i2a);
     }
     LOGT("=====END=====");
+    pthread_mutex_unlock(&mgr->lock);
     return;
 }
 
@@ -662,20 +934,46 @@ int
 dns_cache_get_size(void)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
-    struct ip2action     *i2a;
-    ds_tree_t            *tree;
-    int no_of_elements;
 
     if (!mgr->initialized) return -1;
 
-    tree = &mgr->ip2a_tree;
-    no_of_elements = 0;
+    return (int)mgr->nentries;
+}
 
-    ds_tree_foreach(tree, i2a)
+
+/**
+ * @brief sets the cache memory cap.
+ *
+ * @param max_memory the cap in bytes, 0 to disable it
+ */
+void
+dns_cache_set_max_memory(size_t max_memory)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+
+    pthread_mutex_lock(&mgr->lock);
+    if (mgr->initialized)
     {
-        no_of_elements++;
+        mgr->max_memory = max_memory;
+        dns_cache_enforce_max_memory(mgr);
     }
-    return no_of_elements;
+    pthread_mutex_unlock(&mgr->lock);
+}
+
+
+/**
+ * @brief returns the cache counters.
+ *
+ * @param None
+ *
+ * @return the cache counters
+ */
+struct dns_cache_stats *
+dns_cache_get_stats(void)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+
+    return &mgr->stats;
 }
 
 /**
@@ -688,9 +986,20 @@ dns_cache_get_size(void)
 void
 print_dns_cache_size(void)
 {
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+    struct dns_cache_stats *stats;
     int no_of_elements;
+
+    pthread_mutex_lock(&mgr->lock);
     no_of_elements = dns_cache_get_size();
-    LOGT("%s: ip2action_cache %d IPs cached", __func__, no_of_elements);
+    LOGT("%s: ip2action_cache %d IPs cached, %zu/%zu bytes", __func__,
+         no_of_elements, mgr->memory, mgr->max_memory);
+
+    stats = &mgr->stats;
+    LOGT("%s: ip2action_cache hits: %" PRIu64 " misses: %" PRIu64
+         " expired: %" PRIu64 " evicted: %" PRIu64, __func__,
+         stats->hits, stats->misses, stats->expired, stats->evicted);
+    pthread_mutex_unlock(&mgr->lock);
     return;
 }
 
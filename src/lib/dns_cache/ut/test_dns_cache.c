@@ -1524,6 +1524,99 @@ void test_dns_cache_hit_count(void)
 }
 
 
+/**
+ * @brief fills a webpulse request for the ut expiry and eviction test
+ */
+static void
+dns_cache_fill_wp_req(struct ip2action_req *req, int i,
+                      struct sockaddr_storage *ip, os_macaddr_t *mac)
+{
+    uint32_t v4ip;
+
+    memset(req, 0, sizeof(*req));
+    memset(mac, 0, sizeof(*mac));
+    v4ip = htonl(0x0a000000 + i);
+    util_populate_sockaddr(AF_INET, &v4ip, ip);
+    mac->addr[5] = 0x42;
+    req->ip_addr = ip;
+    req->device_mac = mac;
+    req->action = FSM_ALLOW;
+    req->service_id = IP2ACTION_WP_SVC;
+    req->nelems = 1;
+    req->categories[0] = 1;
+    req->cache_wb.risk_level = 1;
+}
+
+void test_dns_cache_expiry_and_eviction(void)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+    struct dns_cache_stats before;
+    struct dns_cache_stats *stats;
+    struct sockaddr_storage ip;
+    struct ip2action_req req;
+    size_t entry_size;
+    os_macaddr_t mac;
+    bool rc;
+    int i;
+
+    LOGI("\n******************** %s: starting ****************\n", __func__);
+
+    stats = dns_cache_get_stats();
+    before = *stats;
+
+    /* Even entries expire on the next cleanup, odd entries last an hour */
+    for (i = 0; i < 100; i++)
+    {
+        dns_cache_fill_wp_req(&req, i, &ip, &mac);
+        req.cache_ttl = (i & 1) ? 3600 : 0;
+        rc = dns_cache_add_entry(&req);
+        TEST_ASSERT_TRUE(rc);
+    }
+    TEST_ASSERT_EQUAL_INT(100, dns_cache_get_size());
+
+    rc = dns_cache_ttl_cleanup();
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_EQUAL_INT(50, dns_cache_get_size());
+    TEST_ASSERT_EQUAL_UINT64(before.expired + 50, stats->expired);
+
+    dns_cache_fill_wp_req(&req, 2, &ip, &mac);
+    rc = dns_cache_ip2action_lookup(&req);
+    TEST_ASSERT_FALSE(rc);
+    TEST_ASSERT_EQUAL_UINT64(before.misses + 1, stats->misses);
+
+    /* Hit the oldest entry, making it the most recently hit one */
+    dns_cache_fill_wp_req(&req, 1, &ip, &mac);
+    rc = dns_cache_ip2action_lookup(&req);
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_EQUAL_UINT64(before.hits + 1, stats->hits);
+
+    /* Cap the cache to 10 entries */
+    entry_size = mgr->memory / 50;
+    dns_cache_set_max_memory(10 * entry_size);
+    TEST_ASSERT_EQUAL_INT(10, dns_cache_get_size());
+    TEST_ASSERT_EQUAL_UINT64(before.evicted + 40, stats->evicted);
+
+    /* The hit entry survived, the next oldest one did not */
+    rc = dns_cache_ip2action_lookup(&req);
+    TEST_ASSERT_TRUE(rc);
+    dns_cache_fill_wp_req(&req, 3, &ip, &mac);
+    rc = dns_cache_ip2action_lookup(&req);
+    TEST_ASSERT_FALSE(rc);
+
+    /* New entries keep evicting the least recently hit ones */
+    dns_cache_fill_wp_req(&req, 200, &ip, &mac);
+    req.cache_ttl = 3600;
+    rc = dns_cache_add_entry(&req);
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_EQUAL_INT(10, dns_cache_get_size());
+    TEST_ASSERT_EQUAL_UINT64(before.evicted + 41, stats->evicted);
+
+    print_dns_cache_size();
+    dns_cache_set_max_memory((size_t)CONFIG_LIBDNS_CACHE_MAX_MEMORY * 1024);
+
+    LOGI("\n******************** %s: completed ****************\n", __func__);
+}
+
 void test_events(void)
 {
     /* Test overall test duration */
@@ -1553,6 +1646,7 @@ int main(int argc, char *argv[])
     RUN_TEST(test_wp_dns_cache);
     RUN_TEST(test_gk_dns_cache);
     RUN_TEST(test_dns_cache_entries);
+    RUN_TEST(test_dns_cache_expiry_and_eviction);
 
     dns_cache_global_test_teardown();
     return UNITY_END();
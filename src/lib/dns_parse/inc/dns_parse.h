@@ -117,6 +117,50 @@ typedef struct
 } dns_info;
 
 
+typedef bool (*dns_ovsdb_updater)(const char *, const char *,
+                                  const char *, json_t *, ovs_uuid_t *);
+
+/* table, where, column, values to insert. Returns the mutated rows count */
+typedef int (*dns_ovsdb_mutator)(const char *, json_t *,
+                                 const char *, json_t *);
+
+/**
+ * @brief tag update coalescing counters
+ */
+struct dns_tag_update_stats
+{
+    uint64_t updates;            /* tag update requests */
+    uint64_t updates_deduped;    /* requests bringing no new IP */
+    uint64_t updates_coalesced;  /* requests merged in a pending update */
+    uint64_t ips;                /* IPs of the tag update requests */
+    uint64_t ips_deduped;        /* IPs already in the tag or pending */
+    uint64_t transactions;       /* emitted OVSDB transactions */
+    uint64_t mutates;            /* transactions inserting new values */
+    uint64_t upserts;            /* transactions rewriting the tag */
+    uint64_t failures;           /* failed transactions */
+};
+
+/**
+ * @brief IPs pending addition to a tag
+ */
+struct dns_tag_update
+{
+    char *tag;                   /* policy tag, i.e. ${@name} */
+    char name[MAX_TAG_NAME_LEN];
+    int tle_flag;
+    ds_tree_t ips;               /* struct dns_tag_update_ip */
+    size_t nips;
+    ds_tree_node_t node;
+};
+
+struct dns_tag_update_ip
+{
+    char ip[INET6_ADDRSTRLEN];
+    ds_tree_node_t node;
+};
+
+#define DNS_TAG_UPDATE_WINDOW 1.0 /* seconds */
+
 struct dns_cache
 {
     bool initialized;
@@ -127,6 +171,17 @@ struct dns_cache
     void (*update_tag)(struct fqdn_pending_req *);
     void (*policy_init)(void);
     void (*policy_check)(struct dns_device *, struct fqdn_pending_req *);
+    struct ev_loop *loop;
+    ds_tree_t tag_updates;       /* struct dns_tag_update */
+    ev_timer tag_update_timer;
+    ev_async tag_update_async;   /* arms the timer for nfqueue workers */
+    pthread_t loop_thread;
+    pthread_mutex_t tag_lock;    /* tag updates vs nfqueue workers */
+    double tag_update_window;    /* max latency of a tag update */
+    dns_ovsdb_updater tag_upsert;
+    dns_ovsdb_mutator tag_mutate;
+    struct dns_tag_update_stats tag_stats;
+    uint64_t tag_stats_logged;
 };
 
 
@@ -186,8 +241,6 @@ dns_generate_update_tag(struct fqdn_pending_req *req,
                         int *values_len, size_t max_capacity,
                         int ip_ver);
 
-typedef bool (*dns_ovsdb_updater)(const char *, const char *,
-                                  const char *, json_t *, ovs_uuid_t *);
 /**
  * @brief update Openflow_Tag to map to new row
  *
@@ -219,6 +272,78 @@ dns_forward(struct dns_session *dns_session, dns_info *dns,
 void
 dns_update_tag(struct fqdn_pending_req *req);
 
+
+/**
+ * @brief merges IPs in a tag's values, on top of the in memory tag state
+ *
+ * Once max_capacity is reached, values are overwritten circularly.
+ *
+ * @param        name         the tag name
+ * @param        addrs        the IPs to merge
+ * @param        naddrs       the number of IPs
+ * @param[out]   values       buffer to update values.
+ * @param[out]   values_len   length of the values updated.
+ * @param[in]    max_capacity the buffer maximum capacity
+ *
+ * @return true if an IP was added
+ */
+bool
+dns_tag_merge_values(char *name, char **addrs, int naddrs,
+                     char values[][MAX_TAG_VALUES_LEN],
+                     int *values_len, size_t max_capacity);
+
+
+/**
+ * @brief initializes the tag updates coalescer
+ *
+ * @param mgr the dns manager
+ */
+void
+dns_tag_update_init(struct dns_cache *mgr);
+
+
+/**
+ * @brief queues IPs for addition to a tag
+ *
+ * IPs already present in the tag or already queued are dropped.
+ * The queued IPs are written within the manager's tag_update_window.
+ *
+ * @param tag the policy tag, i.e. ${@name}
+ * @param addrs the IPs to add
+ * @param naddrs the number of IPs
+ */
+void
+dns_tag_update_add(char *tag, char **addrs, int naddrs);
+
+
+/**
+ * @brief writes the queued tag updates, one transaction per tag
+ */
+void
+dns_tag_update_flush(void);
+
+
+/**
+ * @brief logs the tag updates coalescing counters
+ */
+void
+dns_tag_update_report(void);
+
+
+/**
+ * @brief flushes the queued tag updates and stops the coalescing timer
+ */
+void
+dns_tag_update_exit(void);
+
+
+/**
+ * @brief default dns_ovsdb_mutator, inserting values in a set column
+ */
+int
+dns_ovsdb_mutate_insert(const char *table, json_t *where,
+                        const char *column, json_t *values);
+
 void
 dns_periodic(struct fsm_session  *session);
 
@@ -45,6 +45,7 @@ void print_packet(uint32_t, uint8_t *, uint32_t, uint32_t, u_int);
 static struct dns_cache cache_mgr =
 {
     .initialized = false,
+    .tag_lock = PTHREAD_MUTEX_INITIALIZER,
 };
 
 struct dns_cache *dns_get_mgr(void)
@@ -94,8 +95,10 @@ dns_parse_update(struct fsm_session *session)
     char *dbg_str = session->ops.get_config(session, "debug");
     char *cache_ip_str = session->ops.get_config(session, "cache_ip");
     char *mqtt_blocker_topic = session->ops.get_config(session, "blk_mqtt");
+    char *tag_update_window;
     char *hs_report_interval;
     char *hs_report_topic;
+    struct dns_cache *mgr;
     long interval;
     int val;
 
@@ -111,6 +114,16 @@ dns_parse_update(struct fsm_session *session)
                                               "wc_health_stats_topic");
     dns_session->health_stats_report_topic = hs_report_topic;
 
+    /* Max latency of the coalesced tag updates, 0 disables coalescing */
+    mgr = dns_get_mgr();
+    mgr->tag_update_window = DNS_TAG_UPDATE_WINDOW;
+    tag_update_window = session->ops.get_config(session, "tag_update_window");
+    if (tag_update_window != NULL)
+    {
+        mgr->tag_update_window = strtod(tag_update_window, NULL);
+    }
+    LOGI("%s: tag update window %.1f s", __func__, mgr->tag_update_window);
+
     if (dbg_str != NULL)
     {
         LOGT("%s: session %p: debug key value: %s",
@@ -317,6 +330,7 @@ dns_plugin_exit(struct fsm_session *session)
     mgr = dns_get_mgr();
     if (!mgr->initialized) return;
 
+    dns_tag_update_exit();
     dns_cache_cleanup_mgr();
     dns_delete_session(session);
 }
@@ -410,6 +424,7 @@ dns_mgr_init(void)
     mgr->policy_init = fsm_policy_init;
     mgr->policy_check = fqdn_policy_check;
     mgr->req_cache_ttl = REQ_CACHE_TTL;
+    dns_tag_update_init(mgr);
 
     /* Initialize the DNS cache */
     dns_cache_init();
@@ -443,6 +458,12 @@ dns_plugin_init(struct fsm_session *session)
     /* Bail if the session is already initialized */
     if (dns_session->initialized) return 0;
 
+    if (mgr->loop == NULL)
+    {
+        mgr->loop = session->loop;
+        ev_async_start(mgr->loop, &mgr->tag_update_async);
+    }
+
     session->ops.update = dns_parse_update;
     session->ops.periodic = dns_periodic;
     session->handler_ctxt = dns_session;
@@ -779,190 +800,6 @@ dns_forward(struct dns_session *dns_session, dns_info *dns,
 }
 
 
-bool
-dns_updatev4_tag(struct fqdn_pending_req *req)
-{
-    struct schema_Openflow_Local_Tag *local_tag;
-    struct schema_Openflow_Tag *regular_tag;
-    size_t max_capacity;
-    size_t value_len;
-    size_t elem_len;
-    int tle_flag;
-    bool result;
-    size_t len;
-
-    regular_tag = NULL;
-    local_tag = NULL;
-    max_capacity = 0;
-    result = false;
-    len = 0;
-
-    if (req->action != FSM_UPDATE_TAG) return false;
-
-    tle_flag = om_get_type_of_tag(req->updatev4_tag);
-
-    if (tle_flag == OM_TLE_FLAG_DEVICE ||
-        tle_flag == OM_TLE_FLAG_CLOUD)
-    {
-        regular_tag = CALLOC(1, sizeof(*regular_tag));
-        if (regular_tag == NULL) goto out;
-
-        value_len = sizeof(regular_tag->device_value);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
-
-        len = strlen(req->updatev4_tag);
-        os_util_strncpy(regular_tag->name, &req->updatev4_tag[3], len - 3);
-        regular_tag->name_exists = true;
-        regular_tag->name_present = true;
-
-        result = dns_generate_update_tag(req, regular_tag->device_value,
-                                         &regular_tag->device_value_len,
-                                         max_capacity, 4);
-        if (result)
-        {
-            result = dns_upsert_regular_tag(regular_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Tag not updated for request.", __func__);
-        }
-    }
-    else if (tle_flag == OM_TLE_FLAG_LOCAL)
-    {
-        local_tag = CALLOC(1, sizeof(*local_tag));
-        if (local_tag == NULL) goto out;
-
-        value_len = sizeof(local_tag->values);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
-
-        len = strlen(req->updatev4_tag);
-        os_util_strncpy(local_tag->name, &req->updatev4_tag[3], len - 3);
-        local_tag->name_exists = true;
-        local_tag->name_present = true;
-
-        result = dns_generate_update_tag(req, local_tag->values,
-                                         &local_tag->values_len,
-                                         max_capacity, 4);
-        if (result)
-        {
-            result = dns_upsert_local_tag(local_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-        }
-    }
-
-out:
-    FREE(regular_tag);
-    FREE(local_tag);
-
-    return result;
-}
-
-
-bool
-dns_updatev6_tag(struct fqdn_pending_req *req)
-{
-    struct schema_Openflow_Local_Tag *local_tag;
-    struct schema_Openflow_Tag *regular_tag;
-    size_t max_capacity;
-    size_t value_len;
-    size_t elem_len;
-    int tle_flag;
-    bool result;
-    size_t len;
-
-    regular_tag = NULL;
-    local_tag = NULL;
-    max_capacity = 0;
-    result = false;
-    len = 0;
-
-    if (req->action != FSM_UPDATE_TAG) return false;
-
-    tle_flag = om_get_type_of_tag(req->updatev6_tag);
-
-    if (tle_flag == OM_TLE_FLAG_DEVICE ||
-        tle_flag == OM_TLE_FLAG_CLOUD)
-    {
-        regular_tag = CALLOC(1, sizeof(*regular_tag));
-        if (regular_tag == NULL) goto out;
-
-        value_len = sizeof(regular_tag->device_value);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
-
-        len = strlen(req->updatev6_tag);
-        os_util_strncpy(regular_tag->name, &req->updatev6_tag[3], len - 3);
-        regular_tag->name_exists = true;
-        regular_tag->name_present = true;
-
-        result = dns_generate_update_tag(req, regular_tag->device_value,
-                                         &regular_tag->device_value_len,
-                                         max_capacity, 6);
-        if (result)
-        {
-            result = dns_upsert_regular_tag(regular_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Tag not updated for request.", __func__);
-        }
-    }
-    else if(tle_flag == OM_TLE_FLAG_LOCAL)
-    {
-        local_tag = CALLOC(1, sizeof(*local_tag));
-        if (local_tag == NULL) goto out;
-
-        value_len = sizeof(local_tag->values);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
-
-        len = strlen(req->updatev6_tag);
-        os_util_strncpy(local_tag->name, &req->updatev6_tag[3], len - 3);
-        local_tag->name_exists = true;
-        local_tag->name_present = true;
-
-        result = dns_generate_update_tag(req, local_tag->values,
-                                         &local_tag->values_len,
-                                         max_capacity, 6);
-        if (result)
-        {
-            result = dns_upsert_local_tag(local_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-        }
-    }
-
-out:
-    FREE(regular_tag);
-    FREE(local_tag);
-
-    return result;
-}
-
-
 static bool
 is_device_excluded(char *tag, os_macaddr_t *mac)
 {
@@ -990,24 +827,19 @@ dns_update_tag(struct fqdn_pending_req *req)
         return;
     }
 
+    if (req->action != FSM_UPDATE_TAG) return;
+
+    /* Queue the IPs, written to OVSDB once per tag update window */
     if (req->updatev4_tag &&
         req->ipv4_cnt != 0)
     {
-        rc = dns_updatev4_tag(req);
-        if (!rc)
-        {
-            LOGT("%s: Failed to update ipv4 OpenFlow tags.",__func__);
-        }
+        dns_tag_update_add(req->updatev4_tag, req->ipv4_addrs, req->ipv4_cnt);
     }
 
     if (req->updatev6_tag &&
         req->ipv6_cnt != 0)
     {
-        rc = dns_updatev6_tag(req);
-        if (!rc)
-        {
-            LOGT("%s: Failed to update ipv6 OpenFlow tags.",__func__);
-        }
+        dns_tag_update_add(req->updatev6_tag, req->ipv6_addrs, req->ipv6_cnt);
     }
 
     return;
@@ -1365,6 +1197,55 @@ set_provider_ops(struct dns_session *dns_session,
 }
 
 
+/**
+ * @brief resumes a request parked on a gatekeeper lookup
+ *
+ * Re-runs the policy check now the verdict is available, then
+ * processes the DNS reply stashed in the meantime.
+ * @param req the resumed request
+ */
+static void
+dns_resume_req(struct fqdn_pending_req *req)
+{
+    struct net_header_parser net_header;
+    struct fsm_url_request *req_info;
+    struct fsm_session *session;
+    struct dns_cache *mgr;
+    int i;
+
+    mgr = dns_get_mgr();
+    session = req->fsm_context;
+    req_info = req->req_info;
+
+    fsm_free_url_reply(req_info->reply);
+    req_info->reply = NULL;
+    req->categorized = FSM_FQDN_CAT_NOP;
+
+    mgr->policy_check(req->dev_session, req);
+    if (req->categorized == FSM_FQDN_CAT_PENDING) return;
+
+    if (req->response == NULL) return;
+
+    /* Replay the stashed reply. The request is checked now */
+    memset(&net_header, 0, sizeof(net_header));
+    net_header.start = req->response;
+    net_header.caplen = req->response_len;
+    req->response = NULL;
+    req->response_len = 0;
+
+    /* The reply will be accounted for again */
+    req->num_replies--;
+    for (i = 0; i < req->ipv4_cnt; i++) free(req->ipv4_addrs[i]);
+    req->ipv4_cnt = 0;
+    for (i = 0; i < req->ipv6_cnt; i++) free(req->ipv6_addrs[i]);
+    req->ipv6_cnt = 0;
+
+    LOGD("%s: replaying dns reply %u", __func__, req->req_id);
+    dns_handler(session, &net_header);
+    free(net_header.start);
+}
+
+
 void
 dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
 {
@@ -1494,6 +1375,7 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
     req->cat_match = -1;
     req->policy_table = session->policy_client.table;
     req->req_type = FSM_FQDN_REQ;
+    req->gatekeeper_resume = dns_resume_req;
     set_provider_ops(dns_session, req);
     req->provider = session->provider;
     req_info = req->req_info;
@@ -1876,6 +1758,12 @@ dns_free_req(struct fqdn_pending_req *req)
     struct fsm_url_request *req_info;
     int i;
 
+    /* the request may still be waiting on a gatekeeper lookup */
+    if (req->gk_lookup != NULL && req->gatekeeper_cancel != NULL)
+    {
+        req->gatekeeper_cancel(req);
+    }
+
     if (req->response != NULL) free(req->response);
     if (req->rule_name != NULL) free(req->rule_name);
     if (req->policy != NULL) free(req->policy);
@@ -1957,39 +1845,18 @@ is_in_device_set(char values[][MAX_TAG_VALUES_LEN], int values_len, char *checki
 
 
 bool
-dns_generate_update_tag(struct fqdn_pending_req *req,
-                        char values[][MAX_TAG_VALUES_LEN],
-                        int *values_len, size_t max_capacity,
-                        int ip_ver)
+dns_tag_merge_values(char *name, char **addrs, int naddrs,
+                     char values[][MAX_TAG_VALUES_LEN],
+                     int *values_len, size_t max_capacity)
 {
     bool added_information;
     om_tag_t *tag;
     char *adding;
-    char name[MAX_TAG_NAME_LEN] = {0};
-    int  name_len = 0;
     bool rc;
     int i;
 
-    if (req->action != FSM_UPDATE_TAG) return false;
-
     added_information = false;
-
-    if (ip_ver == 4)
-    {
-      name_len = strlen(req->updatev4_tag);
-      os_util_strncpy(name, &req->updatev4_tag[3], name_len - 3);
-      tag = om_tag_find_by_name(name, false);
-    }
-    else if (ip_ver == 6)
-    {
-      name_len = strlen(req->updatev6_tag);
-      os_util_strncpy(name, &req->updatev6_tag[3], name_len - 3);
-      tag = om_tag_find_by_name(name, false);
-    }
-    else
-    {
-      return false;
-    }
+    tag = om_tag_find_by_name(name, false);
 
     /* Load in current in memory tag state */
     if (tag != NULL)
@@ -2007,48 +1874,55 @@ dns_generate_update_tag(struct fqdn_pending_req *req,
         }
     }
 
-    if (ip_ver == 4)
+    for (i = 0; i < naddrs; i++)
     {
-        for (i = 0; i < req->ipv4_cnt; i++)
+        adding = addrs[i];
+        rc = is_in_device_set(values, *values_len, adding);
+        if (rc) continue;
+
+        if (*values_len == (int)(max_capacity))
         {
-            adding = req->ipv4_addrs[i];
-            rc = is_in_device_set(values, *values_len, adding);
-            if (rc) continue;
+            *values_len = *values_len % (int)max_capacity;
+            LOGD("%s: tag %s max capacity reached, adding circularly at index %d",
+                 __func__, name, *values_len);
+        }
 
-            if (*values_len == (int)(max_capacity))
-            {
-                *values_len = *values_len % (int)max_capacity;
-                LOGD("%s: tag %s max capacity reached, adding circularly at index %d",
-                     __func__, name, *values_len);
-            }
+        STRSCPY(values[*values_len], adding);
+        *values_len = *values_len + 1;
+        added_information = true;
+    }
 
-            STRSCPY(values[*values_len], adding);
-            *values_len = *values_len + 1;
-            added_information = true;
-        }
+    return added_information;
+}
+
+
+bool
+dns_generate_update_tag(struct fqdn_pending_req *req,
+                        char values[][MAX_TAG_VALUES_LEN],
+                        int *values_len, size_t max_capacity,
+                        int ip_ver)
+{
+    char name[MAX_TAG_NAME_LEN] = {0};
+    int  name_len = 0;
+
+    if (req->action != FSM_UPDATE_TAG) return false;
+
+    if (ip_ver == 4)
+    {
+      name_len = strlen(req->updatev4_tag);
+      os_util_strncpy(name, &req->updatev4_tag[3], name_len - 3);
+      return dns_tag_merge_values(name, req->ipv4_addrs, req->ipv4_cnt,
+                                  values, values_len, max_capacity);
     }
     else if (ip_ver == 6)
     {
-        for (i = 0; i < req->ipv6_cnt; i++)
-        {
-            adding = req->ipv6_addrs[i];
-            rc = is_in_device_set(values, *values_len, adding);
-            if (rc) continue;
-
-            if (*values_len == (int)(max_capacity))
-            {
-                *values_len = *values_len % (int)max_capacity;
-                LOGD("%s: tag %s max capacity reached, adding circularly at index %d",
-                     __func__, name, *values_len);
-            }
-
-            STRSCPY(values[*values_len], adding);
-            *values_len = *values_len + 1;
-            added_information = true;
-        }
+      name_len = strlen(req->updatev6_tag);
+      os_util_strncpy(name, &req->updatev6_tag[3], name_len - 3);
+      return dns_tag_merge_values(name, req->ipv6_addrs, req->ipv6_cnt,
+                                  values, values_len, max_capacity);
     }
 
-    return added_information;
+    return false;
 }
 
 
@@ -2176,6 +2050,8 @@ dns_periodic(struct fsm_session *session)
 
     /* Retire unresolved old requests */
     dns_retire_reqs(session);
+
+    dns_tag_update_report();
 }
 
 
@@ -2248,6 +2124,10 @@ fqdn_policy_check(struct dns_device *ds,
     preq.fqdn_req = req;
     req->fsm_checked = false;
     fsm_apply_policies(session, &preq);
+
+    /* The verdict is pending. The request is resumed once available */
+    if (req->categorized == FSM_FQDN_CAT_PENDING) return;
+
     req->action = preq.reply.action;
     req->updatev4_tag = preq.reply.updatev4_tag;
     req->updatev6_tag = preq.reply.updatev6_tag;
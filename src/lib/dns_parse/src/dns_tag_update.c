@@ -0,0 +1,507 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <ev.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "const.h"
+#include "os_util.h"
+#include "memutil.h"
+#include "policy_tags.h"
+#include "dns_parse.h"
+#include "ovsdb_utils.h"
+#include "ovsdb_sync.h"
+#include "schema.h"
+
+
+static int
+dns_tag_update_cmp(void *a, void *b)
+{
+    return strcmp((char *)a, (char *)b);
+}
+
+
+static void
+dns_tag_update_free(struct dns_tag_update *update)
+{
+    struct dns_tag_update_ip *ip, *remove;
+
+    ip = ds_tree_head(&update->ips);
+    while (ip != NULL)
+    {
+        remove = ip;
+        ip = ds_tree_next(&update->ips, ip);
+        ds_tree_remove(&update->ips, remove);
+        FREE(remove);
+    }
+
+    FREE(update->tag);
+    FREE(update);
+}
+
+
+static void
+dns_tag_update_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    dns_tag_update_flush();
+}
+
+
+static void dns_tag_update_arm(struct dns_cache *mgr);
+static void dns_tag_update_write(struct dns_cache *mgr);
+
+static void
+dns_tag_update_async_cb(EV_P_ ev_async *w, int revents)
+{
+    struct dns_cache *mgr;
+
+    mgr = dns_get_mgr();
+
+    pthread_mutex_lock(&mgr->tag_lock);
+    if (!ds_tree_is_empty(&mgr->tag_updates)) dns_tag_update_arm(mgr);
+    pthread_mutex_unlock(&mgr->tag_lock);
+}
+
+
+/**
+ * @brief initializes the tag updates coalescer
+ */
+void
+dns_tag_update_init(struct dns_cache *mgr)
+{
+    ds_tree_init(&mgr->tag_updates, dns_tag_update_cmp,
+                 struct dns_tag_update, node);
+    ev_timer_init(&mgr->tag_update_timer, dns_tag_update_timer_cb, 0., 0.);
+    ev_async_init(&mgr->tag_update_async, dns_tag_update_async_cb);
+    mgr->loop_thread = pthread_self();
+    mgr->tag_update_window = DNS_TAG_UPDATE_WINDOW;
+    mgr->tag_upsert = ovsdb_sync_upsert;
+    mgr->tag_mutate = dns_ovsdb_mutate_insert;
+    memset(&mgr->tag_stats, 0, sizeof(mgr->tag_stats));
+    mgr->tag_stats_logged = 0;
+}
+
+
+/**
+ * @brief default dns_ovsdb_mutator, inserting values in a set column
+ *
+ * Takes ownership of where and values.
+ */
+int
+dns_ovsdb_mutate_insert(const char *table, json_t *where,
+                        const char *column, json_t *values)
+{
+    json_t *mutations;
+    json_t *result;
+
+    mutations = json_array();
+    json_array_append_new(mutations,
+                          ovsdb_mutation(column, json_string("insert"),
+                                         ovsdb_tran_array_to_set(values, true)));
+
+    result = ovsdb_tran_call_s(table, OTR_MUTATE, where, mutations);
+
+    return ovsdb_get_update_result_count(result, table, "mutate");
+}
+
+
+/**
+ * @brief queues IPs for addition to a tag, called with the tag lock held
+ *
+ * @return true if the tag update is queued
+ */
+static bool
+dns_tag_update_queue(struct dns_cache *mgr, char *tag, int tle_flag,
+                     char **addrs, int naddrs)
+{
+    struct dns_tag_update_ip *ip;
+    struct dns_tag_update *update;
+    om_tag_t *om_tag;
+    bool coalesced;
+    bool added;
+    size_t len;
+    int i;
+
+    len = strlen(tag);
+    if (len <= 3) return false;
+
+    mgr->tag_stats.updates++;
+
+    update = ds_tree_find(&mgr->tag_updates, tag);
+    coalesced = (update != NULL);
+    added = false;
+
+    if (update == NULL)
+    {
+        update = CALLOC(1, sizeof(*update));
+        if (update == NULL) return false;
+
+        update->tag = STRDUP(tag);
+        if (update->tag == NULL)
+        {
+            FREE(update);
+            return false;
+        }
+        os_util_strncpy(update->name, &tag[3], len - 3);
+        update->tle_flag = tle_flag;
+        ds_tree_init(&update->ips, dns_tag_update_cmp,
+                     struct dns_tag_update_ip, node);
+    }
+
+    om_tag = om_tag_find_by_name(update->name, false);
+    for (i = 0; i < naddrs; i++)
+    {
+        mgr->tag_stats.ips++;
+
+        if (addrs[i] == NULL) continue;
+
+        if ((om_tag != NULL &&
+             om_tag_list_entry_find_by_value(&om_tag->values, addrs[i]) != NULL) ||
+            ds_tree_find(&update->ips, addrs[i]) != NULL)
+        {
+            mgr->tag_stats.ips_deduped++;
+            continue;
+        }
+
+        ip = CALLOC(1, sizeof(*ip));
+        if (ip == NULL) break;
+
+        STRSCPY(ip->ip, addrs[i]);
+        ds_tree_insert(&update->ips, ip, ip->ip);
+        update->nips++;
+        added = true;
+    }
+
+    if (!coalesced)
+    {
+        if (!added)
+        {
+            dns_tag_update_free(update);
+            mgr->tag_stats.updates_deduped++;
+            return false;
+        }
+        ds_tree_insert(&mgr->tag_updates, update, update->tag);
+    }
+    else
+    {
+        mgr->tag_stats.updates_coalesced++;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief arms the update window, called with the tag lock held
+ *
+ * The timer belongs to the main loop: nfqueue workers have the main
+ * loop arm it.
+ */
+static void
+dns_tag_update_arm(struct dns_cache *mgr)
+{
+    if (mgr->tag_update_window <= 0 || mgr->loop == NULL)
+    {
+        dns_tag_update_write(mgr);
+        return;
+    }
+
+    if (!pthread_equal(pthread_self(), mgr->loop_thread))
+    {
+        ev_async_send(mgr->loop, &mgr->tag_update_async);
+        return;
+    }
+
+    /* The first queued update arms the window */
+    if (ev_is_active(&mgr->tag_update_timer)) return;
+
+    ev_timer_set(&mgr->tag_update_timer, mgr->tag_update_window, 0.);
+    ev_timer_start(mgr->loop, &mgr->tag_update_timer);
+}
+
+
+/**
+ * @brief queues IPs for addition to a tag
+ */
+void
+dns_tag_update_add(char *tag, char **addrs, int naddrs)
+{
+    struct dns_cache *mgr;
+    int tle_flag;
+    bool queued;
+
+    mgr = dns_get_mgr();
+
+    tle_flag = om_get_type_of_tag(tag);
+    if (tle_flag != OM_TLE_FLAG_DEVICE &&
+        tle_flag != OM_TLE_FLAG_CLOUD &&
+        tle_flag != OM_TLE_FLAG_LOCAL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mgr->tag_lock);
+    queued = dns_tag_update_queue(mgr, tag, tle_flag, addrs, naddrs);
+    if (queued) dns_tag_update_arm(mgr);
+    pthread_mutex_unlock(&mgr->tag_lock);
+}
+
+
+/**
+ * @brief rewrites a tag with its queued IPs
+ *
+ * Used when the tag is not yet known, or its capacity would be exceeded:
+ * values are then overwritten circularly.
+ */
+static bool
+dns_tag_update_upsert(struct dns_cache *mgr, struct dns_tag_update *update,
+                      char **addrs, int naddrs)
+{
+    struct schema_Openflow_Local_Tag *local_tag;
+    struct schema_Openflow_Tag *regular_tag;
+    size_t max_capacity;
+    bool result;
+
+    result = false;
+
+    if (update->tle_flag == OM_TLE_FLAG_LOCAL)
+    {
+        local_tag = CALLOC(1, sizeof(*local_tag));
+        if (local_tag == NULL) return false;
+
+        max_capacity = ARRAY_SIZE(local_tag->values);
+        STRSCPY(local_tag->name, update->name);
+        local_tag->name_exists = true;
+        local_tag->name_present = true;
+
+        dns_tag_merge_values(update->name, addrs, naddrs, local_tag->values,
+                             &local_tag->values_len, max_capacity);
+        result = dns_upsert_local_tag(local_tag, mgr->tag_upsert);
+        FREE(local_tag);
+    }
+    else
+    {
+        regular_tag = CALLOC(1, sizeof(*regular_tag));
+        if (regular_tag == NULL) return false;
+
+        max_capacity = ARRAY_SIZE(regular_tag->device_value);
+        STRSCPY(regular_tag->name, update->name);
+        regular_tag->name_exists = true;
+        regular_tag->name_present = true;
+
+        dns_tag_merge_values(update->name, addrs, naddrs,
+                             regular_tag->device_value,
+                             &regular_tag->device_value_len, max_capacity);
+        result = dns_upsert_regular_tag(regular_tag, mgr->tag_upsert);
+        FREE(regular_tag);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief writes the queued IPs of a tag in a single transaction
+ *
+ * IPs which made it to the tag since they were queued are dropped.
+ * When they fit, the remaining IPs are inserted with a mutate transaction,
+ * leaving the tag's current values untouched.
+ */
+static void
+dns_tag_update_emit(struct dns_cache *mgr, struct dns_tag_update *update)
+{
+    struct dns_tag_update_ip *ip;
+    om_tag_list_entry_t *entry;
+    size_t max_capacity;
+    const char *column;
+    const char *table;
+    om_tag_t *om_tag;
+    json_t *values;
+    json_t *where;
+    size_t ncur;
+    char **addrs;
+    int naddrs;
+    bool rc;
+    int count;
+
+    addrs = CALLOC(update->nips, sizeof(*addrs));
+    if (addrs == NULL) return;
+
+    om_tag = om_tag_find_by_name(update->name, false);
+    naddrs = 0;
+    ds_tree_foreach(&update->ips, ip)
+    {
+        if (om_tag != NULL &&
+            om_tag_list_entry_find_by_value(&om_tag->values, ip->ip) != NULL)
+        {
+            mgr->tag_stats.ips_deduped++;
+            continue;
+        }
+        addrs[naddrs++] = ip->ip;
+    }
+
+    if (naddrs == 0) goto out;
+
+    if (update->tle_flag == OM_TLE_FLAG_LOCAL)
+    {
+        table = SCHEMA_TABLE(Openflow_Local_Tag);
+        column = SCHEMA_COLUMN(Openflow_Local_Tag, values);
+        max_capacity = ARRAY_SIZE(((struct schema_Openflow_Local_Tag *)0)->values);
+    }
+    else
+    {
+        table = SCHEMA_TABLE(Openflow_Tag);
+        column = SCHEMA_COLUMN(Openflow_Tag, device_value);
+        max_capacity = ARRAY_SIZE(((struct schema_Openflow_Tag *)0)->device_value);
+    }
+
+    ncur = 0;
+    if (om_tag != NULL)
+    {
+        ds_tree_foreach(&om_tag->values, entry) ncur++;
+    }
+
+    mgr->tag_stats.transactions++;
+    if (om_tag != NULL && ncur + naddrs <= max_capacity)
+    {
+        values = json_array();
+        for (count = 0; count < naddrs; count++)
+        {
+            json_array_append_new(values, json_string(addrs[count]));
+        }
+
+        /* Openflow_Tag and Openflow_Local_Tag are both keyed by name */
+        where = ovsdb_where_simple(SCHEMA_COLUMN(Openflow_Tag, name),
+                                   update->name);
+        count = mgr->tag_mutate(table, where, column, values);
+        if (count == 1)
+        {
+            LOGD("%s: inserted %d IPs in %s", __func__, naddrs, update->name);
+            mgr->tag_stats.mutates++;
+            goto out;
+        }
+
+        /* The row is gone, rewrite it */
+        mgr->tag_stats.transactions++;
+    }
+
+    rc = dns_tag_update_upsert(mgr, update, addrs, naddrs);
+    if (rc) mgr->tag_stats.upserts++;
+    else mgr->tag_stats.failures++;
+
+out:
+    FREE(addrs);
+}
+
+
+/**
+ * @brief writes the queued tag updates, called with the tag lock held
+ */
+static void
+dns_tag_update_write(struct dns_cache *mgr)
+{
+    struct dns_tag_update *update, *remove;
+
+    update = ds_tree_head(&mgr->tag_updates);
+    while (update != NULL)
+    {
+        remove = update;
+        update = ds_tree_next(&mgr->tag_updates, update);
+        ds_tree_remove(&mgr->tag_updates, remove);
+
+        dns_tag_update_emit(mgr, remove);
+        dns_tag_update_free(remove);
+    }
+}
+
+
+/**
+ * @brief writes the queued tag updates, one transaction per tag
+ */
+void
+dns_tag_update_flush(void)
+{
+    struct dns_cache *mgr;
+
+    mgr = dns_get_mgr();
+
+    pthread_mutex_lock(&mgr->tag_lock);
+    if (mgr->loop != NULL) ev_timer_stop(mgr->loop, &mgr->tag_update_timer);
+    dns_tag_update_write(mgr);
+    pthread_mutex_unlock(&mgr->tag_lock);
+}
+
+
+/**
+ * @brief logs the tag updates coalescing counters
+ */
+void
+dns_tag_update_report(void)
+{
+    struct dns_tag_update_stats *stats;
+    struct dns_cache *mgr;
+
+    mgr = dns_get_mgr();
+    stats = &mgr->tag_stats;
+
+    pthread_mutex_lock(&mgr->tag_lock);
+
+    /* Only log on activity */
+    if (stats->updates == mgr->tag_stats_logged)
+    {
+        pthread_mutex_unlock(&mgr->tag_lock);
+        return;
+    }
+    mgr->tag_stats_logged = stats->updates;
+
+    LOGI("%s: tag updates: %" PRIu64 " requests, %" PRIu64 " deduped, %"
+         PRIu64 " coalesced, IPs: %" PRIu64 " received, %" PRIu64
+         " deduped, transactions: %" PRIu64 " (%" PRIu64 " mutates, %"
+         PRIu64 " upserts, %" PRIu64 " failures)", __func__,
+         stats->updates, stats->updates_deduped, stats->updates_coalesced,
+         stats->ips, stats->ips_deduped, stats->transactions,
+         stats->mutates, stats->upserts, stats->failures);
+    pthread_mutex_unlock(&mgr->tag_lock);
+}
+
+
+/**
+ * @brief flushes the queued tag updates and stops the coalescing timer
+ */
+void
+dns_tag_update_exit(void)
+{
+    struct dns_cache *mgr;
+
+    mgr = dns_get_mgr();
+
+    dns_tag_update_flush();
+    if (mgr->loop != NULL) ev_async_stop(mgr->loop, &mgr->tag_update_async);
+    mgr->loop = NULL;
+}
@@ -1186,6 +1186,144 @@ test_update_v6_tag_generation_ip_expiration(void)
 }
 
 
+static int g_tag_mutates;
+static int g_tag_mutated_values;
+static int g_tag_mutate_count;
+static int g_tag_upserts;
+
+
+static int
+test_tag_mutate(const char *table, json_t *where, const char *column,
+                json_t *values)
+{
+    g_tag_mutates++;
+    g_tag_mutated_values += json_array_size(values);
+    json_decref(where);
+    json_decref(values);
+
+    return g_tag_mutate_count;
+}
+
+
+static bool
+test_tag_upsert(const char *table, const char *column, const char *value,
+                json_t *row, ovs_uuid_t *uuid)
+{
+    g_tag_upserts++;
+    json_decref(row);
+
+    return true;
+}
+
+
+static void
+test_tag_update_prepare(double window)
+{
+    g_tag_mutates = 0;
+    g_tag_mutated_values = 0;
+    g_tag_mutate_count = 1;
+    g_tag_upserts = 0;
+
+    g_dns_mgr->tag_mutate = test_tag_mutate;
+    g_dns_mgr->tag_upsert = test_tag_upsert;
+    g_dns_mgr->tag_update_window = window;
+    g_dns_mgr->loop = EV_DEFAULT;
+}
+
+
+/**
+ * @brief test tag updates coalescing within the update window
+ */
+void
+test_tag_update_coalescing(void)
+{
+    char *addrs_1[] = { "1.1.1.1", "2.2.2.2" };
+    char *addrs_2[] = { "2.2.2.2", "3.3.3.3", "3.3.3.3" };
+    char *addrs_3[] = { "2001::1" };
+    struct dns_tag_update_stats *stats;
+
+    test_tag_update_prepare(1.0);
+    stats = &g_dns_mgr->tag_stats;
+
+    dns_tag_update_add("${*upd_v4_tag}", addrs_1, 2);
+    dns_tag_update_add("${*upd_v4_tag}", addrs_2, 3);
+    dns_tag_update_add("${*upd_v4_tag}", addrs_1, 2);
+    dns_tag_update_add("${*upd_v6_tag}", addrs_3, 1);
+
+    /* Nothing is written before the window expires */
+    TEST_ASSERT_EQUAL_INT(0, g_tag_mutates);
+    TEST_ASSERT_TRUE(ev_is_active(&g_dns_mgr->tag_update_timer));
+
+    dns_tag_update_flush();
+    TEST_ASSERT_FALSE(ev_is_active(&g_dns_mgr->tag_update_timer));
+
+    /* One transaction per tag, carrying the unique IPs */
+    TEST_ASSERT_EQUAL_INT(2, g_tag_mutates);
+    TEST_ASSERT_EQUAL_INT(4, g_tag_mutated_values);
+    TEST_ASSERT_EQUAL_INT(0, g_tag_upserts);
+
+    TEST_ASSERT_EQUAL_UINT64(4, stats->updates);
+    TEST_ASSERT_EQUAL_UINT64(2, stats->updates_coalesced);
+    TEST_ASSERT_EQUAL_UINT64(8, stats->ips);
+    TEST_ASSERT_EQUAL_UINT64(4, stats->ips_deduped);
+    TEST_ASSERT_EQUAL_UINT64(2, stats->transactions);
+    TEST_ASSERT_EQUAL_UINT64(2, stats->mutates);
+
+    /* The window is cleared by the flush */
+    dns_tag_update_flush();
+    TEST_ASSERT_EQUAL_INT(2, g_tag_mutates);
+}
+
+
+/**
+ * @brief test tag updates with coalescing disabled
+ */
+void
+test_tag_update_no_window(void)
+{
+    char *addrs[] = { "1.1.1.1", "2.2.2.2" };
+
+    test_tag_update_prepare(0);
+
+    dns_tag_update_add("${*upd_v4_tag}", addrs, 2);
+    TEST_ASSERT_EQUAL_INT(1, g_tag_mutates);
+    TEST_ASSERT_EQUAL_INT(2, g_tag_mutated_values);
+
+    dns_tag_update_add("${*upd_v4_tag}", addrs, 2);
+    TEST_ASSERT_EQUAL_INT(2, g_tag_mutates);
+    TEST_ASSERT_FALSE(ev_is_active(&g_dns_mgr->tag_update_timer));
+}
+
+
+/**
+ * @brief test the tag rewrite fallback
+ */
+void
+test_tag_update_upsert_fallback(void)
+{
+    char *addrs[] = { "1.1.1.1", "2.2.2.2" };
+    struct dns_tag_update_stats *stats;
+
+    test_tag_update_prepare(0);
+    stats = &g_dns_mgr->tag_stats;
+
+    /* Unknown tag: the row is created */
+    dns_tag_update_add("${*unknown_tag}", addrs, 2);
+    TEST_ASSERT_EQUAL_INT(0, g_tag_mutates);
+    TEST_ASSERT_EQUAL_INT(1, g_tag_upserts);
+
+    /* The row vanished under the mutate */
+    g_tag_mutate_count = 0;
+    dns_tag_update_add("${*upd_v4_tag}", addrs, 2);
+    TEST_ASSERT_EQUAL_INT(1, g_tag_mutates);
+    TEST_ASSERT_EQUAL_INT(2, g_tag_upserts);
+
+    TEST_ASSERT_EQUAL_UINT64(3, stats->transactions);
+    TEST_ASSERT_EQUAL_UINT64(2, stats->upserts);
+    TEST_ASSERT_EQUAL_UINT64(0, stats->failures);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -1211,6 +1349,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_type_A_duplicate_query_duplicate_response);
     RUN_TEST(test_update_v4_tag_generation_ip_expiration);
     RUN_TEST(test_update_v6_tag_generation_ip_expiration);
+    RUN_TEST(test_tag_update_coalescing);
+    RUN_TEST(test_tag_update_no_window);
+    RUN_TEST(test_tag_update_upsert_fallback);
 
     return UNITY_END();
 }
@@ -17,6 +17,7 @@ else
 endif
 
 UNIT_SRC := src/dns_parse.c
+UNIT_SRC += src/dns_tag_update.c
 UNIT_SRC += src/network.c
 UNIT_SRC += src/rtypes.c
 UNIT_SRC += src/strutils.c
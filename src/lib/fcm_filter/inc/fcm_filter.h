@@ -32,8 +32,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ds_tree.h"
 #include "ds_dlist.h"
+#include "os_types.h"
 #include "network_metadata.h"
 #include "network_metadata_report.h"
+#include "fcm_filter_set.h"
 
 typedef struct fcm_filter_l3_info
 {
@@ -53,6 +55,29 @@ typedef struct fcm_filter_l2_info
     unsigned int    eth_type;
 } fcm_filter_l2_info_t;
 
+/*
+ * Binary flow key evaluated by fcm_filter_flow_apply().
+ * Addresses are in network byte order, ports in host byte order.
+ */
+typedef struct fcm_filter_flow
+{
+    bool            has_l2;     // l2 fields are set
+    bool            has_l3;     // l3 fields are set
+
+    os_macaddr_t    smac;
+    os_macaddr_t    dmac;
+    bool            smac_valid;
+    bool            dmac_valid;
+    unsigned int    vlan_id;
+
+    int             af;         // AF_INET or AF_INET6
+    uint8_t         src_ip[16];
+    uint8_t         dst_ip[16];
+    uint16_t        sport;
+    uint16_t        dport;
+    uint8_t         l4_proto;
+} fcm_filter_flow_t;
+
 typedef struct fcm_filter_stats
 {
     unsigned long pkt_cnt;
@@ -136,6 +161,15 @@ typedef struct _FCM_Filter_rule
 
     struct int_set *proto;
 
+    /* Binary forms of the above sets, compiled when the rule is set */
+    struct om_mac_set *smac_set;
+    struct om_mac_set *dmac_set;
+    struct fcm_ip_set *src_ip_set;
+    struct fcm_ip_set *dst_ip_set;
+    struct fcm_port_set *src_port_set;
+    struct fcm_port_set *dst_port_set;
+    uint32_t proto_map[256 / 32];
+
     enum fcm_operation dmac_op;
     enum fcm_operation smac_op;
     enum fcm_operation vlanid_op;
@@ -198,6 +232,23 @@ void fcm_filter_7tuple_apply(char *filter_name, struct fcm_filter_l2_info *l2_in
                              struct flow_key *fkey,
                              bool *action);
 
+/**
+ * @brief applies a filter to a binary flow key
+ *
+ * Same semantics as fcm_filter_7tuple_apply(), without the string
+ * conversions of the flow addresses.
+ *
+ * @param filter_name the filter name
+ * @param flow the flow key
+ * @param pkts the flow counters, may be NULL
+ * @param fkey the flow tags, may be NULL
+ * @param action set to true if the flow is included, false otherwise
+ */
+void fcm_filter_flow_apply(char *filter_name,
+                           struct fcm_filter_flow *flow,
+                           struct fcm_filter_stats *pkts,
+                           struct flow_key *fkey,
+                           bool *action);
 void fcm_filter_app_apply(char *filter_name,
                           struct flow_key *fkey,
                           bool *action);
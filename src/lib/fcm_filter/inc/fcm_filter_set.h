@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FCM_FILTER_SET_H_INCLUDED
+#define FCM_FILTER_SET_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct str_set;
+struct ip_port;
+
+/**
+ * @brief IP prefix trie node
+ *
+ * The trie consumes an address 4 bits at a time. A prefix ending within
+ * the node's nibble sets the bits of all the nibble values it covers.
+ */
+struct fcm_ip_trie_node
+{
+    struct fcm_ip_trie_node *child[16];
+    uint16_t match;
+};
+
+/**
+ * @brief compiled set of IPv4/IPv6 addresses and CIDR prefixes
+ *
+ * Values are either addresses, prefixes (address/length) or opensync tags
+ * holding such values. Sets referencing tags are recompiled on lookup when
+ * the tags changed since the set was built.
+ */
+struct fcm_ip_set
+{
+    struct fcm_ip_trie_node *root[2];   /* IPv4 and IPv6 tries */
+    bool any[2];                        /* a 0 length prefix was set */
+    struct str_set *values;             /* source values, not owned */
+    bool has_tags;
+    uint32_t tags_generation;
+};
+
+/**
+ * @brief inclusive port range
+ */
+struct fcm_port_range
+{
+    uint16_t lo;
+    uint16_t hi;
+};
+
+/**
+ * @brief compiled set of ports: sorted, non overlapping ranges
+ */
+struct fcm_port_set
+{
+    struct fcm_port_range *ranges;
+    size_t nranges;
+};
+
+
+/**
+ * @brief compiles a set of IP addresses and prefixes
+ *
+ * @param values the rule values. The set keeps a reference to them,
+ *        they must outlive the set.
+ * @return the compiled set, NULL on allocation failure
+ */
+struct fcm_ip_set *
+fcm_ip_set_alloc(struct str_set *values);
+
+
+/**
+ * @brief frees a compiled IP set
+ */
+void
+fcm_ip_set_free(struct fcm_ip_set *set);
+
+
+/**
+ * @brief checks if an address matches a compiled IP set
+ *
+ * @param set the compiled set
+ * @param af the address family, AF_INET or AF_INET6
+ * @param ip the address in network byte order
+ * @return true if the address matches a value of the set
+ */
+bool
+fcm_ip_set_in(struct fcm_ip_set *set, int af, const uint8_t *ip);
+
+
+/**
+ * @brief compiles a set of ports and port ranges
+ *
+ * @param ports the rule ports
+ * @param nports the number of ports
+ * @return the compiled set, NULL on allocation failure
+ */
+struct fcm_port_set *
+fcm_port_set_alloc(struct ip_port *ports, int nports);
+
+
+/**
+ * @brief frees a compiled port set
+ */
+void
+fcm_port_set_free(struct fcm_port_set *set);
+
+
+/**
+ * @brief checks if a port, in host byte order, is in a compiled port set
+ */
+bool
+fcm_port_set_in(struct fcm_port_set *set, uint16_t port);
+
+#endif /* FCM_FILTER_SET_H_INCLUDED */
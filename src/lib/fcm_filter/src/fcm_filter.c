@@ -29,11 +29,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <jansson.h>
 #include <sys/types.h>
 #include <netdb.h>
 #include <sys/stat.h>
+#include <arpa/inet.h>
 
 #include "util.h"
 #include "ovsdb.h"
@@ -165,6 +167,111 @@ char* convert_enum_str(enum fcm_operation op)
     }
 }
 
+/**
+ * fcm_filter_mac_set_alloc: compiles the mac values of a rule
+ * @macs: the rule's mac values
+ *
+ * Mac addresses are matched in binary form, regardless of their case.
+ * Returns the mac set if successful, NULL otherwise.
+ */
+static
+struct om_mac_set *fcm_filter_mac_set_alloc(struct str_set *macs)
+{
+    struct om_mac_set *set = NULL;
+    char **values;
+    size_t i, j;
+
+    if (macs->nelems == 0) return om_mac_set_alloc(NULL, 0);
+
+    values = calloc(macs->nelems, sizeof(*values));
+    if (!values) return NULL;
+
+    for (i = 0; i < macs->nelems; i++)
+    {
+        values[i] = strdup(macs->array[i]);
+        if (!values[i]) goto out;
+
+        /* Tag names are case sensitive */
+        if (om_tag_get_type(values[i]) != NOT_A_OPENSYNC_TAG) continue;
+
+        for (j = 0; values[i][j] != '\0'; j++)
+        {
+            values[i][j] = tolower((unsigned char)values[i][j]);
+        }
+    }
+
+    set = om_mac_set_alloc(values, macs->nelems);
+
+out:
+    for (i = 0; i < macs->nelems; i++) free(values[i]);
+    free(values);
+    return set;
+}
+
+/**
+ * fcm_filter_compile_rule: compiles the sets of a rule in binary forms
+ * @rule: the rule, its string and integer sets already set
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static
+int fcm_filter_compile_rule(schema_FCM_Filter_rule_t *rule)
+{
+    size_t i;
+    int proto;
+
+    if (rule->smac)
+    {
+        rule->smac_set = fcm_filter_mac_set_alloc(rule->smac);
+        if (!rule->smac_set) return -1;
+    }
+
+    if (rule->dmac)
+    {
+        rule->dmac_set = fcm_filter_mac_set_alloc(rule->dmac);
+        if (!rule->dmac_set) return -1;
+    }
+
+    if (rule->src_ip)
+    {
+        rule->src_ip_set = fcm_ip_set_alloc(rule->src_ip);
+        if (!rule->src_ip_set) return -1;
+    }
+
+    if (rule->dst_ip)
+    {
+        rule->dst_ip_set = fcm_ip_set_alloc(rule->dst_ip);
+        if (!rule->dst_ip_set) return -1;
+    }
+
+    if (rule->src_port)
+    {
+        rule->src_port_set = fcm_port_set_alloc(rule->src_port,
+                                                rule->src_port_len);
+        if (!rule->src_port_set) return -1;
+    }
+
+    if (rule->dst_port)
+    {
+        rule->dst_port_set = fcm_port_set_alloc(rule->dst_port,
+                                                rule->dst_port_len);
+        if (!rule->dst_port_set) return -1;
+    }
+
+    memset(rule->proto_map, 0, sizeof(rule->proto_map));
+    if (rule->proto)
+    {
+        for (i = 0; i < rule->proto->nelems; i++)
+        {
+            proto = rule->proto->array[i];
+            if (proto < 0 || proto > 255) continue;
+            rule->proto_map[proto / 32] |= (1u << (proto % 32));
+        }
+    }
+
+    return 0;
+}
+
 static
 int copy_from_schema_struct(schema_FCM_Filter_rule_t *rule,
                             struct schema_FCM_Filter *filter)
@@ -236,6 +343,13 @@ int copy_from_schema_struct(schema_FCM_Filter_rule_t *rule,
     rule->pktcnt_op = convert_math_str_enum(filter->pktcnt_op);
     rule->action = convert_action_enum(filter->action);
 
+    if (fcm_filter_compile_rule(rule) < 0)
+    {
+        LOGE("fcm_filter: failed to compile rule %s index %d",
+             rule->name, rule->index);
+        goto free_rule;
+    }
+
     return 0;
 
 free_rule:
@@ -292,7 +406,28 @@ int free_schema_struct(schema_FCM_Filter_rule_t *rule)
     free_int_set(rule->proto);
     rule->proto = NULL;
 
+    om_mac_set_free(rule->smac_set);
+    rule->smac_set = NULL;
+
+    om_mac_set_free(rule->dmac_set);
+    rule->dmac_set = NULL;
+
+    fcm_ip_set_free(rule->src_ip_set);
+    rule->src_ip_set = NULL;
+
+    fcm_ip_set_free(rule->dst_ip_set);
+    rule->dst_ip_set = NULL;
+
+    fcm_port_set_free(rule->src_port_set);
+    rule->src_port_set = NULL;
+
+    fcm_port_set_free(rule->dst_port_set);
+    rule->dst_port_set = NULL;
+
+    memset(rule->proto_map, 0, sizeof(rule->proto_map));
+
     free_str_tree(rule->other_config);
+    rule->other_config = NULL;
 
     rule->smac_op = FCM_OP_NONE;
     rule->dmac_op = FCM_OP_NONE;
@@ -388,56 +523,6 @@ bool fcm_find_app_names_in_tag(char *app_name, char *schema_tag)
     return (ret == 0);
 }
 
-/**
- * fcm_find_ip_addr_in_tag: looks up a mac address in a tag's value set
- * @ip_addr: string representation of a MAC
- * @schema_tag: tag name as read in ovsdb schema
- *
- * Looks up a tag by its name, then looks up the mac in the tag values set.
- * Returns true if found, false otherwise.
- */
-
-static
-bool fcm_find_ip_addr_in_tag(char *ip_addr, char *schema_tag)
-{
-    bool rc;
-    int ret;
-
-    if (schema_tag == NULL) return true;
-
-    rc = om_tag_in(ip_addr, schema_tag);
-    if (rc) return true;
-
-    ret = strncmp(ip_addr, schema_tag, strlen(ip_addr));
-
-    return (ret == 0);
-}
-
-/**
- * fcm_find_device_in_tag: looks up a mac address in a tag's value set
- * @mac_s: string representation of a MAC
- * @schema_tag: tag name as read in ovsdb schema
- *
- * Looks up a tag by its name, then looks up the mac in the tag values set.
- * Returns true if found, false otherwise.
- */
-
-static
-bool fcm_find_device_in_tag(char *mac_s, char *schema_tag)
-{
-    bool rc;
-    int ret;
-
-    if (schema_tag == NULL) return true;
-
-    rc = om_tag_in(mac_s, schema_tag);
-    if (rc) return true;
-
-    ret = strncmp(mac_s, schema_tag, strlen(mac_s));
-
-    return (ret == 0);
-}
-
 /**
  * fcm_app_name_in_set: looks up a rule that matches unique index
  * @rule: fcm_filter_app
@@ -470,32 +555,6 @@ bool fcm_app_name_in_set(struct fcm_filter_app *app, struct flow_key *fkey)
     return false;
 }
 
-/**
- * fcm_src_ip_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the dst ip address are present set of the rule
- * Returns true if found, false otherwise.
- */
-
-static
-bool fcm_src_ip_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l3_info_t *l3_info)
-{
-    char ipaddr[128] = { 0 };
-    size_t i = 0;
-    bool rc;
-
-    snprintf(ipaddr, sizeof(ipaddr), "%s", l3_info->src_ip);
-
-    for (i = 0; i < rule->src_ip->nelems; i++)
-    {
-        rc = fcm_find_ip_addr_in_tag(ipaddr, rule->src_ip->array[i]);
-        if (rc) return true;
-    }
-    return false;
-}
-
 static
 enum fcm_rule_op fcm_check_option(enum fcm_operation option, bool present)
 {
@@ -518,323 +577,115 @@ enum fcm_rule_op fcm_check_app_option(enum fcm_appname_op option, bool present)
 }
 
 /**
- * fcm_src_ip_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the src ip option like in / out in the rule.
+ * fcm_option_fails: checks an in / out rule option against a lookup result
+ * @option: the rule option
+ * @present: the lookup result
  *
- * Returns true if found ip is in set and op set to "in", false otherwise.
+ * Returns true if the option rules the flow out, false otherwise.
  */
-static
-enum fcm_rule_op fcm_src_ip_filter(struct fcm_filter_mgr *mgr,
-                                schema_FCM_Filter_rule_t *rule,
-                                fcm_filter_l3_info_t *l3_info)
+static inline
+bool fcm_option_fails(enum fcm_operation option, bool present)
 {
-    bool rc = false;
-
-    if (!rule->src_ip) return FCM_DEFAULT_TRUE;
-    rc = fcm_src_ip_in_set(rule, l3_info);
-    return fcm_check_option(rule->src_ip_op, rc);
+    return (fcm_check_option(option, present) == FCM_RULED_FALSE);
 }
 
-
-/**
- * fcm_dst_ip_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the dst ip address are present set of the rule
- * Returns true if found, false otherwise.
- */
+static inline
+bool fcm_proto_in_set(schema_FCM_Filter_rule_t *rule, uint8_t proto)
+{
+    return (rule->proto_map[proto / 32] & (1u << (proto % 32))) != 0;
+}
 
 static
-bool fcm_dst_ip_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l3_info_t *l3_info)
+bool fcm_vlanid_in_set(schema_FCM_Filter_rule_t *rule, unsigned int vlan_id)
 {
-    char ipaddr[128] = { 0 };
     size_t i = 0;
-    bool rc;
-
-    snprintf(ipaddr, sizeof(ipaddr), "%s", l3_info->dst_ip);
 
-    for (i = 0; i < rule->dst_ip->nelems; i++)
+    for (i = 0; i < rule->vlanid->nelems; i++)
     {
-        rc = fcm_find_ip_addr_in_tag(ipaddr,rule->dst_ip->array[i]);
-        if (rc) return true;
+        if (rule->vlanid->array[i] == (int)vlan_id) return true;
     }
     return false;
 }
 
 /**
- * fcm_dst_ip_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the dst ip option like in / out in the rule.
- *
- * Returns true if found ip is in set and op set to "in", false otherwise.
- */
-
-static
-enum fcm_rule_op fcm_dst_ip_filter(struct fcm_filter_mgr *mgr,
-                                schema_FCM_Filter_rule_t *rule,
-                                fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
-
-    if (!rule->dst_ip) return FCM_DEFAULT_TRUE;
-    rc = fcm_dst_ip_in_set(rule, l3_info);
-    return fcm_check_option(rule->dst_ip_op, rc);
-}
-
-/**
- * fcm_sport_in_set: looks up a rule that matches unique index
+ * fcm_filter_l3_match: checks the l3 options of a rule against a flow
  * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
+ * @flow: binary flow key
  *
- * Checking the sport are present set of the rule
- * Returns true if found, false otherwise.
+ * Options without operation, or not set in the rule, are not looked up.
+ * Returns false if an option rules the flow out, true otherwise.
  */
-
 static
-bool fcm_sport_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l3_info_t *l3_info)
+bool fcm_filter_l3_match(schema_FCM_Filter_rule_t *rule,
+                         struct fcm_filter_flow *flow)
 {
-    int i = 0;
+    bool in;
 
-    for (i = 0; i < rule->src_port_len; i++)
+    if (rule->src_ip_set && rule->src_ip_op != FCM_OP_NONE)
     {
-        if ((rule->src_port[i].port_max != 0) &&
-            (rule->src_port[i].port_min <= l3_info->sport
-             && l3_info->sport <= rule->src_port[i].port_max ))
-        {
-            return true;
-        }
-        else if (rule->src_port[i].port_min == l3_info->sport) return true;
+        in = fcm_ip_set_in(rule->src_ip_set, flow->af, flow->src_ip);
+        if (fcm_option_fails(rule->src_ip_op, in)) return false;
     }
 
-    return false;
-}
-
-static
-enum fcm_rule_op fcm_sport_filter(struct fcm_filter_mgr *mgr,
-                               schema_FCM_Filter_rule_t *rule,
-                               fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
-
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->src_port) return FCM_DEFAULT_TRUE;
-    rc = fcm_sport_in_set(rule, l3_info);
-    return fcm_check_option(rule->src_port_op, rc);
-}
-
-/**
- * fcm_dport_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the dst port are present set of the rule
- * Returns true if found, false otherwise.
- */
-
-static
-bool fcm_dport_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l3_info_t *l3_info)
-{
-    int i = 0;
-
-    for (i = 0; i < rule->dst_port_len; i++)
+    if (rule->dst_ip_set && rule->dst_ip_op != FCM_OP_NONE)
     {
-        if ((rule->dst_port[i].port_max != 0) &&
-            (rule->dst_port[i].port_min <= l3_info->dport
-             && l3_info->dport <= rule->dst_port[i].port_max ))
-        {
-            return true;
-        }
-        else if (rule->dst_port[i].port_min == l3_info->dport) return true;
+        in = fcm_ip_set_in(rule->dst_ip_set, flow->af, flow->dst_ip);
+        if (fcm_option_fails(rule->dst_ip_op, in)) return false;
     }
-    return false;
-}
-
-static
-enum fcm_rule_op fcm_dport_filter(struct fcm_filter_mgr *mgr,
-                               schema_FCM_Filter_rule_t *rule,
-                               fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
-
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->dst_port) return FCM_DEFAULT_TRUE;
-    rc = fcm_dport_in_set(rule, l3_info);
-    return fcm_check_option(rule->dst_port_op, rc);
-}
 
-/**
- * fcm_dport_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the l4 protocol are present set of the rule
- * Returns true if found, false otherwise.
- */
-static
-bool fcm_proto_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l3_info_t *l3_info)
-{
-    size_t i = 0;
-
-    for (i = 0; i < rule->proto->nelems; i++)
+    if (rule->src_port_set && rule->src_port_op != FCM_OP_NONE)
     {
-        if (rule->proto->array[i] == l3_info->l4_proto) return true;
+        in = fcm_port_set_in(rule->src_port_set, flow->sport);
+        if (fcm_option_fails(rule->src_port_op, in)) return false;
     }
 
-    return false;
-}
+    if (rule->dst_port_set && rule->dst_port_op != FCM_OP_NONE)
+    {
+        in = fcm_port_set_in(rule->dst_port_set, flow->dport);
+        if (fcm_option_fails(rule->dst_port_op, in)) return false;
+    }
 
-static
-enum fcm_rule_op fcm_l4_proto_filter(struct fcm_filter_mgr *mgr,
-                                  schema_FCM_Filter_rule_t *rule,
-                                  fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
+    if (rule->proto && rule->proto_op != FCM_OP_NONE)
+    {
+        in = fcm_proto_in_set(rule, flow->l4_proto);
+        if (fcm_option_fails(rule->proto_op, in)) return false;
+    }
 
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->proto) return FCM_DEFAULT_TRUE;
-    rc = fcm_proto_in_set(rule, l3_info);
-    return fcm_check_option(rule->proto_op, rc);
+    return true;
 }
 
 /**
- * fcm_smac_in_set: looks up a rule that matches unique index
+ * fcm_filter_l2_match: checks the l2 options of a rule against a flow
  * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
+ * @flow: binary flow key
  *
- * Checking the src mac address are present set of the rule
- * Returns true if found, false otherwise.
+ * Returns false if an option rules the flow out, true otherwise.
  */
-
 static
-int fcm_smac_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l2_info_t *l2_info)
+bool fcm_filter_l2_match(schema_FCM_Filter_rule_t *rule,
+                         struct fcm_filter_flow *flow)
 {
-    char mac_s[32] = { 0 };
-    size_t i = 0;
-    bool rc;
+    bool in;
 
-    snprintf(mac_s, sizeof(mac_s), "%s",l2_info->src_mac);
-
-    for (i = 0; i < rule->smac->nelems; i++)
+    if (rule->smac_set && rule->smac_op != FCM_OP_NONE)
     {
-        rc = fcm_find_device_in_tag(mac_s, rule->smac->array[i]);
-        if (rc) return true;
+        in = flow->smac_valid && om_mac_set_in(rule->smac_set, &flow->smac);
+        if (fcm_option_fails(rule->smac_op, in)) return false;
     }
-    return false;
-}
-
-/**
- * fcm_dmac_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the dst mac address are present set of the rule
- * Returns true if found, false otherwise.
- */
-
-static
-bool fcm_dmac_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l2_info_t *l2_info)
-{
-    char mac_s[32] = { 0 };
-    size_t i = 0;
-    bool rc;
-
-    snprintf(mac_s, sizeof(mac_s), "%s", l2_info->dst_mac);
 
-
-    for (i = 0; i < rule->dmac->nelems; i++)
+    if (rule->dmac_set && rule->dmac_op != FCM_OP_NONE)
     {
-        rc = fcm_find_device_in_tag(mac_s, rule->dmac->array[i]);
-        if (rc) return true;
+        in = flow->dmac_valid && om_mac_set_in(rule->dmac_set, &flow->dmac);
+        if (fcm_option_fails(rule->dmac_op, in)) return false;
     }
-    return false;
-}
-
-/**
- * fcm_vlanid_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the vlan_ids are present set of the rule
- * Returns true if found, false otherwise.
- */
-static
-bool fcm_vlanid_in_set(schema_FCM_Filter_rule_t *rule, fcm_filter_l2_info_t *l2_info)
-{
-    size_t i = 0;
 
-    for (i = 0; i < rule->vlanid->nelems; i++)
+    if (rule->vlanid && rule->vlanid_op != FCM_OP_NONE)
     {
-        if (rule->vlanid->array[i] == (int)l2_info->vlan_id) return true;
+        in = fcm_vlanid_in_set(rule, flow->vlan_id);
+        if (fcm_option_fails(rule->vlanid_op, in)) return false;
     }
-    return false;
-}
-
-/**
- * fcm_smacs_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the src mac option like in / out in the rule.
- *
- * Returns true if found mac is in set and op set to "in", false otherwise.
- */
 
-static
-enum fcm_rule_op fcm_smacs_filter(struct fcm_filter_mgr *mgr,
-                               schema_FCM_Filter_rule_t *rule,
-                               fcm_filter_l2_info_t *l2_info)
-{
-    bool rc = false;
-
-    /* No smac operation. Consider the rule successful. */
-    if (!rule->smac) return FCM_DEFAULT_TRUE;
-    rc = fcm_smac_in_set(rule, l2_info);
-    return fcm_check_option(rule->smac_op, rc);
-}
-
-/**
- * fcm_dmacs_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the dst mac option like in / out in the rule.
- *
- * Returns true if found mac is in set and op set to "in", false otherwise.
- */
-static
-enum fcm_rule_op fcm_dmacs_filter(struct fcm_filter_mgr *mgr,
-                               schema_FCM_Filter_rule_t *rule,
-                               fcm_filter_l2_info_t *l2_info)
-{
-    bool rc = false;
-
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->dmac) return FCM_DEFAULT_TRUE;
-    rc = fcm_dmac_in_set(rule, l2_info);
-    return fcm_check_option(rule->dmac_op, rc);
-}
-
-static
-enum fcm_rule_op fcm_vlanid_filter(struct fcm_filter_mgr *mgr,
-                                schema_FCM_Filter_rule_t *rule,
-                                fcm_filter_l2_info_t *l2_info)
-{
-    bool rc = false;
-
-    /* No valid operation. Consider the rule successful. */
-    if (!rule->vlanid) return FCM_DEFAULT_TRUE;
-    rc = fcm_vlanid_in_set(rule, l2_info);
-    return fcm_check_option(rule->vlanid_op, rc);
+    return true;
 }
 
 static
@@ -1296,24 +1147,74 @@ void callback_Openflow_Tag_Group(ovsdb_update_monitor_t *mon,
     }
 }
 
-void fcm_filter_layer2_apply(char *filter_name, struct fcm_filter_l2_info *l2_info,
-                           struct fcm_filter_stats *pkts, bool *action)
+/**
+ * fcm_filter_str2mac: converts the string representation of a mac address
+ * @mac_s: the string to convert
+ * @mac: the converted mac
+ *
+ * Returns true if converted, false otherwise.
+ */
+static
+bool fcm_filter_str2mac(char *mac_s, os_macaddr_t *mac)
 {
-    struct fcm_filter_mgr *mgr = get_filter_mgr();
-    struct fcm_filter *rule = NULL;
-    bool allow = true;
-    bool action_op = true;
+    int ret;
 
-    enum fcm_rule_op smac_allow, dmac_allow;
-    enum fcm_rule_op vlanid_allow, pktcnt_allow;
+    ret = sscanf(mac_s, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+                 &mac->addr[0], &mac->addr[1], &mac->addr[2],
+                 &mac->addr[3], &mac->addr[4], &mac->addr[5]);
+    return (ret == 6);
+}
 
-    ds_dlist_t *filter_head = NULL;
+static
+void fcm_filter_flow_set_l2(struct fcm_filter_flow *flow,
+                            struct fcm_filter_l2_info *l2_info)
+{
+    flow->has_l2 = true;
+    flow->smac_valid = fcm_filter_str2mac(l2_info->src_mac, &flow->smac);
+    flow->dmac_valid = fcm_filter_str2mac(l2_info->dst_mac, &flow->dmac);
+    flow->vlan_id = l2_info->vlan_id;
+}
 
-    if (!l2_info)
+static
+void fcm_filter_flow_set_l3(struct fcm_filter_flow *flow,
+                            struct fcm_filter_l3_info *l3_info)
+{
+    flow->has_l3 = true;
+    flow->sport = l3_info->sport;
+    flow->dport = l3_info->dport;
+    flow->l4_proto = l3_info->l4_proto;
+
+    /* Addresses which do not parse match no IP set */
+    flow->af = strchr(l3_info->src_ip, ':') ? AF_INET6 : AF_INET;
+    if (inet_pton(flow->af, l3_info->src_ip, flow->src_ip) != 1 ||
+        inet_pton(flow->af, l3_info->dst_ip, flow->dst_ip) != 1)
     {
-        *action = true;
-        return;
+        flow->af = AF_UNSPEC;
     }
+}
+
+/**
+ * fcm_filter_rules_apply: walks a filter's rules until one matches the flow
+ * @filter_name: the filter name
+ * @flow: binary flow key
+ * @pkts: the flow counters, may be NULL
+ * @fkey: the flow tags, may be NULL
+ * @pkts_required: when set, rules checking the packet count rule out
+ *                 flows without counters
+ * @action: set to the action of the matching rule, false if none matches
+ */
+static
+void fcm_filter_rules_apply(char *filter_name, struct fcm_filter_flow *flow,
+                            struct fcm_filter_stats *pkts,
+                            struct flow_key *fkey, bool pkts_required,
+                            bool *action)
+{
+    struct fcm_filter_mgr *mgr = get_filter_mgr();
+    schema_FCM_Filter_rule_t *frule;
+    struct fcm_filter *rule = NULL;
+    ds_dlist_t *filter_head = NULL;
+    bool allow;
+
     filter_head = fcm_filter_get_list_by_name(filter_name);
     if (!filter_head || ds_dlist_is_empty(filter_head))
     {
@@ -1323,169 +1224,87 @@ void fcm_filter_layer2_apply(char *filter_name, struct fcm_filter_l2_info *l2_in
 
     ds_dlist_foreach(filter_head, rule)
     {
-        allow = true;
-        smac_allow = fcm_smacs_filter(mgr, &rule->filter_rule, l2_info);
-        allow &= (smac_allow == FCM_RULED_FALSE? false: true);
-
-        dmac_allow = fcm_dmacs_filter(mgr, &rule->filter_rule, l2_info);
-        allow &= (dmac_allow == FCM_RULED_FALSE? false: true);
+        frule = &rule->filter_rule;
 
-        vlanid_allow = fcm_vlanid_filter(mgr, &rule->filter_rule, l2_info);
-        allow &= (vlanid_allow == FCM_RULED_FALSE? false: true);
+        allow = true;
+        if (flow->has_l3) allow = fcm_filter_l3_match(frule, flow);
+        if (allow && flow->has_l2) allow = fcm_filter_l2_match(frule, flow);
+        if (allow && fkey)
+        {
+            allow = (fcm_app_name_filter(&rule->app, fkey) != FCM_RULED_FALSE);
+        }
 
-        pktcnt_allow = fcm_pkt_cnt_filter(mgr, &rule->filter_rule, pkts);
-        allow &= (pktcnt_allow == FCM_RULED_FALSE? false: true);
+        /*
+         * If there is no packets count available and the the rule enforces
+         * packet count check, consider the situation as a failure
+         */
+        if (allow && !pkts && pkts_required)
+        {
+            allow = (frule->pktcnt_op == FCM_MATH_NONE);
+        }
+        else if (allow)
+        {
+            allow = (fcm_pkt_cnt_filter(mgr, frule, pkts) != FCM_RULED_FALSE);
+        }
 
         if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
         {
-            LOGT("fcm_filter: rule index %d --> smac_allow %d dmac_allow %d"
-                 "vlanid_allow %d pktcnt_allow %d"
-                 " rule sucess %s ",
-                 rule->filter_rule.index,
-                 smac_allow,
-                 dmac_allow,
-                 vlanid_allow,
-                 pktcnt_allow,
-                 allow?"YES":"NO" );
+            LOGT("fcm_filter: rule index %d --> rule success %s",
+                 frule->index, allow ? "YES" : "NO");
+        }
+
+        if (allow)
+        {
+            *action = fcm_action_filter(frule);
+            return;
         }
-        action_op = fcm_action_filter(&rule->filter_rule);
-        if (allow) goto out;
     }
-    action_op = false;
 
-out:
-    allow &=action_op;
-    *action = allow;
+    *action = false;
 }
 
-void fcm_filter_7tuple_apply(char *filter_name, struct fcm_filter_l2_info *l2_info,
-                             struct fcm_filter_l3_info *l3_info,
-                             struct fcm_filter_stats *pkts,
-                             struct flow_key *fkey,
-                             bool *action)
+void fcm_filter_layer2_apply(char *filter_name, struct fcm_filter_l2_info *l2_info,
+                           struct fcm_filter_stats *pkts, bool *action)
 {
-    struct fcm_filter_mgr *mgr = get_filter_mgr();
-    struct fcm_filter *rule = NULL;
-    bool allow = true;
-    bool action_op = true;
-    ds_dlist_t *filter_head = NULL;
-    enum fcm_rule_op src_ip_allow, dst_ip_allow;
-    enum fcm_rule_op sport_allow, dport_allow, proto_allow;
-
-    enum fcm_rule_op smac_allow, dmac_allow;
-    enum fcm_rule_op vlanid_allow, pktcnt_allow;
+    struct fcm_filter_flow flow;
 
-    enum fcm_rule_op name_allow;
-    if (!l2_info && !l3_info)
+    if (!l2_info)
     {
         *action = true;
         return;
     }
 
-    filter_head = fcm_filter_get_list_by_name(filter_name);
-    if (!filter_head || ds_dlist_is_empty(filter_head))
+    memset(&flow, 0, sizeof(flow));
+    fcm_filter_flow_set_l2(&flow, l2_info);
+    fcm_filter_rules_apply(filter_name, &flow, pkts, NULL, false, action);
+}
+
+void fcm_filter_flow_apply(char *filter_name, struct fcm_filter_flow *flow,
+                           struct fcm_filter_stats *pkts,
+                           struct flow_key *fkey, bool *action)
+{
+    if (!flow || (!flow->has_l2 && !flow->has_l3))
     {
         *action = true;
         return;
     }
-    ds_dlist_foreach(filter_head, rule)
-    {
-        allow = true;
-        if (l3_info)
-        {
-            src_ip_allow = fcm_src_ip_filter(mgr, &rule->filter_rule, l3_info);
-            allow &= (src_ip_allow == FCM_RULED_FALSE? false: true);
-
-            dst_ip_allow = fcm_dst_ip_filter(mgr, &rule->filter_rule, l3_info);
-            allow &= (dst_ip_allow == FCM_RULED_FALSE? false: true);
-
-            sport_allow = fcm_sport_filter(mgr, &rule->filter_rule, l3_info);
-            allow &= (sport_allow == FCM_RULED_FALSE? false: true);
-
-            dport_allow = fcm_dport_filter(mgr, &rule->filter_rule, l3_info);
-            allow &= (dport_allow == FCM_RULED_FALSE? false: true);
-
-            proto_allow = fcm_l4_proto_filter(mgr, &rule->filter_rule, l3_info);
-            allow &= (proto_allow == FCM_RULED_FALSE? false: true);
-            if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            {
-                LOGT("fcm_filter: rule index %d --> src_ip_allow %d dst_ip_allow %d "
-                     "sport_allow %d dport_allow %d proto_allow %d",
-                     rule->filter_rule.index,
-                     src_ip_allow,
-                     dst_ip_allow,
-                     sport_allow,
-                     dport_allow,
-                     proto_allow );
-            }
-        }
-        if (l2_info)
-        {
-            smac_allow = fcm_smacs_filter(mgr, &rule->filter_rule, l2_info);
-            allow &= (smac_allow == FCM_RULED_FALSE? false: true);
-
-            dmac_allow = fcm_dmacs_filter(mgr, &rule->filter_rule, l2_info);
-            allow &= (dmac_allow == FCM_RULED_FALSE? false: true);
-
-            vlanid_allow = fcm_vlanid_filter(mgr, &rule->filter_rule, l2_info);
-            allow &= (vlanid_allow == FCM_RULED_FALSE? false: true);
-
-            if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            {
-                LOGT("fcm_filter: rule index %d --> smac_allow %d dmac_allow %d"
-                     "vlanid_allow %d ",
-                     rule->filter_rule.index,
-                     smac_allow,
-                     dmac_allow,
-                     vlanid_allow);
-            }
-        }
-        if (fkey)
-        {
-            name_allow = fcm_app_name_filter(&rule->app, fkey);
-            allow &= (name_allow == FCM_RULED_FALSE? false: true);
-
-            LOGT("fcm_filter: rule index %d --> app_allow %d "
-                 "rule succeeded %s ",
-                 rule->filter_rule.index,
-                 name_allow,
-                 allow?"YES":"NO" );
-        }
 
-        /*
-         * If there is no packets count available and the the rule enforces
-         * packet count check, consider the situation as a failure
-         */
-        if (!pkts)
-        {
-            schema_FCM_Filter_rule_t *pkt_rule;
-
-            pkt_rule = &rule->filter_rule;
-            allow &= (pkt_rule->pktcnt_op == FCM_MATH_NONE);
-        }
-        else
-        {
-            pktcnt_allow = fcm_pkt_cnt_filter(mgr, &rule->filter_rule, pkts);
-            allow &= (pktcnt_allow == FCM_RULED_FALSE? false: true);
+    fcm_filter_rules_apply(filter_name, flow, pkts, fkey, true, action);
+}
 
-            if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            {
-                LOGT("fcm_filter: rule index %d --> pktcnt_allow %d ",
-                     rule->filter_rule.index,
-                     pktcnt_allow);
-            }
-        }
-        if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            LOGT("fcm_filter: rule success %s", allow?"YES":"NO" );
+void fcm_filter_7tuple_apply(char *filter_name, struct fcm_filter_l2_info *l2_info,
+                             struct fcm_filter_l3_info *l3_info,
+                             struct fcm_filter_stats *pkts,
+                             struct flow_key *fkey,
+                             bool *action)
+{
+    struct fcm_filter_flow flow;
 
-        action_op = fcm_action_filter(&rule->filter_rule);
-        if (allow) goto tuple_out;
-    }
-    action_op = false;
+    memset(&flow, 0, sizeof(flow));
+    if (l2_info) fcm_filter_flow_set_l2(&flow, l2_info);
+    if (l3_info) fcm_filter_flow_set_l3(&flow, l3_info);
 
-tuple_out:
-    allow &=action_op;
-    *action = allow;
+    fcm_filter_flow_apply(filter_name, &flow, pkts, fkey, action);
 }
 
 void fcm_filter_app_apply(char *filter_name,
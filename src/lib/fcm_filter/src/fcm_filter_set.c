@@ -0,0 +1,434 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "const.h"
+#include "log.h"
+#include "util.h"
+#include "ovsdb_utils.h"
+#include "policy_tags.h"
+#include "fcm_filter.h"
+#include "fcm_filter_set.h"
+
+#define FCM_IP_SET_V4 0
+#define FCM_IP_SET_V6 1
+
+
+/**
+ * @brief returns the nibble of an address at the given trie depth
+ */
+static inline int
+fcm_ip_nibble(const uint8_t *ip, int depth)
+{
+    return (ip[depth >> 1] >> ((depth & 1) ? 0 : 4)) & 0xf;
+}
+
+
+static void
+fcm_ip_trie_free(struct fcm_ip_trie_node *node)
+{
+    int i;
+
+    if (node == NULL) return;
+
+    for (i = 0; i < 16; i++) fcm_ip_trie_free(node->child[i]);
+    free(node);
+}
+
+
+/**
+ * @brief inserts a prefix in a trie
+ *
+ * The prefix is expanded within the nibble it ends in: a /30 sets the 4
+ * values of its last nibble matching the prefix' 2 significant bits.
+ *
+ * @param root the trie root
+ * @param ip the prefix address, in network byte order
+ * @param plen the prefix length, strictly positive
+ * @return true if inserted, false on allocation failure
+ */
+static bool
+fcm_ip_trie_insert(struct fcm_ip_trie_node **root, const uint8_t *ip, int plen)
+{
+    struct fcm_ip_trie_node *node;
+    int depth;
+    int last;
+    int span;
+    int base;
+    int nib;
+
+    if (*root == NULL)
+    {
+        *root = calloc(1, sizeof(**root));
+        if (*root == NULL) return false;
+    }
+
+    node = *root;
+    last = (plen - 1) / 4;
+    for (depth = 0; depth < last; depth++)
+    {
+        nib = fcm_ip_nibble(ip, depth);
+        if (node->child[nib] == NULL)
+        {
+            node->child[nib] = calloc(1, sizeof(*node));
+            if (node->child[nib] == NULL) return false;
+        }
+        node = node->child[nib];
+    }
+
+    /* 1 to 4 significant bits remain in the last nibble */
+    span = 1 << (4 - (plen - 4 * last));
+    base = fcm_ip_nibble(ip, last) & ~(span - 1);
+    node->match |= (uint16_t)(((1u << span) - 1) << base);
+
+    return true;
+}
+
+
+static bool
+fcm_ip_trie_lookup(struct fcm_ip_trie_node *node, const uint8_t *ip,
+                   int ndepth)
+{
+    int depth;
+    int nib;
+
+    for (depth = 0; node != NULL && depth < ndepth; depth++)
+    {
+        nib = fcm_ip_nibble(ip, depth);
+        if (node->match & (1u << nib)) return true;
+        node = node->child[nib];
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief adds an address or a prefix to the set
+ *
+ * Values which are not an address or a valid prefix are ignored.
+ *
+ * @return false on allocation failure, true otherwise
+ */
+static bool
+fcm_ip_set_add_value(struct fcm_ip_set *set, const char *value)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    uint8_t ip[16];
+    char *slash;
+    char *end;
+    int family;
+    int maxlen;
+    long plen;
+
+    if (value == NULL) return true;
+    if (STRSCPY(buf, value) < 0) return true;
+
+    slash = strchr(buf, '/');
+    if (slash != NULL) *slash = '\0';
+
+    if (inet_pton(AF_INET, buf, ip) == 1)
+    {
+        family = FCM_IP_SET_V4;
+        maxlen = 32;
+    }
+    else if (inet_pton(AF_INET6, buf, ip) == 1)
+    {
+        family = FCM_IP_SET_V6;
+        maxlen = 128;
+    }
+    else
+    {
+        LOGD("%s: ignoring %s", __func__, value);
+        return true;
+    }
+
+    plen = maxlen;
+    if (slash != NULL)
+    {
+        plen = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || plen < 0 || plen > maxlen)
+        {
+            LOGD("%s: ignoring %s, invalid prefix length", __func__, value);
+            return true;
+        }
+    }
+
+    if (plen == 0)
+    {
+        set->any[family] = true;
+        return true;
+    }
+
+    return fcm_ip_trie_insert(&set->root[family], ip, (int)plen);
+}
+
+
+/**
+ * @brief adds the values of an opensync tag to the set
+ *
+ * Honors the device/cloud/local markers the same way om_tag_in() does.
+ */
+static bool
+fcm_ip_set_add_tag(struct fcm_ip_set *set, char *tag_name)
+{
+    om_tag_list_entry_t *tle;
+    int match_flags;
+    om_tag_t *tag;
+
+    set->has_tags = true;
+
+    tag = om_tag_find(tag_name);
+    if (tag == NULL) return true;
+
+    match_flags = om_get_type_of_tag(tag_name);
+    if (match_flags == OM_TLE_FLAG_NONE) match_flags = 0;
+
+    ds_tree_foreach(&tag->values, tle)
+    {
+        if (match_flags && !(tle->flags & match_flags)) continue;
+        if (!fcm_ip_set_add_value(set, tle->value)) return false;
+    }
+
+    return true;
+}
+
+
+static void
+fcm_ip_set_reset(struct fcm_ip_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(set->root); i++)
+    {
+        fcm_ip_trie_free(set->root[i]);
+        set->root[i] = NULL;
+        set->any[i] = false;
+    }
+    set->has_tags = false;
+}
+
+
+/**
+ * @brief (re)compiles the set from its source values
+ */
+static bool
+fcm_ip_set_build(struct fcm_ip_set *set)
+{
+    char *value;
+    size_t i;
+    bool rc;
+
+    fcm_ip_set_reset(set);
+    set->tags_generation = om_tag_generation();
+
+    if (set->values == NULL) return true;
+
+    for (i = 0; i < set->values->nelems; i++)
+    {
+        value = set->values->array[i];
+        if (om_tag_get_type(value) != NOT_A_OPENSYNC_TAG)
+            rc = fcm_ip_set_add_tag(set, value);
+        else
+            rc = fcm_ip_set_add_value(set, value);
+
+        if (!rc)
+        {
+            LOGE("%s: failed to compile %s", __func__, value);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+struct fcm_ip_set *
+fcm_ip_set_alloc(struct str_set *values)
+{
+    struct fcm_ip_set *set;
+
+    set = calloc(1, sizeof(*set));
+    if (set == NULL) return NULL;
+
+    set->values = values;
+    if (!fcm_ip_set_build(set))
+    {
+        fcm_ip_set_free(set);
+        return NULL;
+    }
+
+    return set;
+}
+
+
+void
+fcm_ip_set_free(struct fcm_ip_set *set)
+{
+    if (set == NULL) return;
+
+    fcm_ip_set_reset(set);
+    free(set);
+}
+
+
+bool
+fcm_ip_set_in(struct fcm_ip_set *set, int af, const uint8_t *ip)
+{
+    int family;
+    int ndepth;
+
+    if (set == NULL || ip == NULL) return false;
+
+    /* Tags changed since the set was compiled. Best effort on failure */
+    if (set->has_tags && set->tags_generation != om_tag_generation())
+    {
+        fcm_ip_set_build(set);
+    }
+
+    if (af == AF_INET)
+    {
+        family = FCM_IP_SET_V4;
+        ndepth = 8;
+    }
+    else if (af == AF_INET6)
+    {
+        family = FCM_IP_SET_V6;
+        ndepth = 32;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (set->any[family]) return true;
+
+    return fcm_ip_trie_lookup(set->root[family], ip, ndepth);
+}
+
+
+static int
+fcm_port_range_cmp(const void *a, const void *b)
+{
+    const struct fcm_port_range *ra = a;
+    const struct fcm_port_range *rb = b;
+
+    return (int)ra->lo - (int)rb->lo;
+}
+
+
+/**
+ * A rule port is either a single port, or a min-max range. As in the
+ * original string based matching, the min port always matches, even when
+ * the range is empty.
+ */
+struct fcm_port_set *
+fcm_port_set_alloc(struct ip_port *ports, int nports)
+{
+    struct fcm_port_range *range;
+    struct fcm_port_set *set;
+    size_t n;
+    int i;
+
+    set = calloc(1, sizeof(*set));
+    if (set == NULL) return NULL;
+
+    if (ports == NULL || nports <= 0) return set;
+
+    set->ranges = calloc(nports, sizeof(*set->ranges));
+    if (set->ranges == NULL)
+    {
+        free(set);
+        return NULL;
+    }
+
+    for (i = 0; i < nports; i++)
+    {
+        range = &set->ranges[i];
+        range->lo = ports[i].port_min;
+        range->hi = ports[i].port_min;
+        if (ports[i].port_max > ports[i].port_min) range->hi = ports[i].port_max;
+    }
+
+    qsort(set->ranges, nports, sizeof(*set->ranges), fcm_port_range_cmp);
+
+    /* Merge overlapping and adjacent ranges */
+    n = 0;
+    for (i = 1; i < nports; i++)
+    {
+        range = &set->ranges[i];
+        if ((uint32_t)range->lo <= (uint32_t)set->ranges[n].hi + 1)
+        {
+            if (range->hi > set->ranges[n].hi) set->ranges[n].hi = range->hi;
+            continue;
+        }
+        set->ranges[++n] = *range;
+    }
+    set->nranges = n + 1;
+
+    return set;
+}
+
+
+void
+fcm_port_set_free(struct fcm_port_set *set)
+{
+    if (set == NULL) return;
+
+    free(set->ranges);
+    free(set);
+}
+
+
+bool
+fcm_port_set_in(struct fcm_port_set *set, uint16_t port)
+{
+    struct fcm_port_range *range;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (set == NULL) return false;
+
+    lo = 0;
+    hi = set->nranges;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        range = &set->ranges[mid];
+        if (port < range->lo) hi = mid;
+        else if (port > range->hi) lo = mid + 1;
+        else return true;
+    }
+
+    return false;
+}
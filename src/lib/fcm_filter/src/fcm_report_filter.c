@@ -91,60 +91,48 @@ static bool apply_filter(struct net_md_flow_key *key,
                          char *filter_name)
 {
     bool seven_tuple_action;
-    fcm_filter_l2_info_t mac_filter;
-    fcm_filter_l3_info_t filter;
-    os_macaddr_t null_mac;
-    os_macaddr_t *smac;
-    os_macaddr_t *dmac;
+    fcm_filter_flow_t filter;
+    size_t ip_len;
 
-    memset(&null_mac, 0, sizeof(null_mac));
     if (filter_name == NULL)
     {
         /* no filter name default included */
         return true;
     }
 
-    smac = (key->smac != NULL ? key->smac : &null_mac);
-    dmac = (key->dmac != NULL ? key->dmac : &null_mac);
+    memset(&filter, 0, sizeof(filter));
 
-    snprintf(mac_filter.src_mac, sizeof(mac_filter.src_mac),
-             PRI_os_macaddr_lower_t,
-             FMT_os_macaddr_pt(smac));
-    snprintf(mac_filter.dst_mac, sizeof(mac_filter.dst_mac),
-             PRI_os_macaddr_lower_t,
-             FMT_os_macaddr_pt(dmac));
+    /* Missing macs are matched as the null mac */
+    filter.has_l2 = true;
+    if (key->smac != NULL) filter.smac = *key->smac;
+    if (key->dmac != NULL) filter.dmac = *key->dmac;
+    filter.smac_valid = true;
+    filter.dmac_valid = true;
+    filter.vlan_id = key->vlan_id;
 
-    mac_filter.vlan_id = key->vlan_id;
-    mac_filter.eth_type = key->ethertype;
-
-    if (inet_ntop(AF_INET, key->src_ip, filter.src_ip,
-        INET6_ADDRSTRLEN) == NULL)
+    /* key->ip_version No ip (0), ipv4 (4), ipv6 (6) */
+    filter.has_l3 = true;
+    filter.af = (key->ip_version == 6) ? AF_INET6 : AF_INET;
+    ip_len = (filter.af == AF_INET6) ? 16 : 4;
+    if (key->src_ip != NULL && key->dst_ip != NULL)
     {
-        LOGE("%s: inet_ntop src_ip %s error: %s", __func__,
-             key->src_ip, strerror(errno));
-        return false;
+        memcpy(filter.src_ip, key->src_ip, ip_len);
+        memcpy(filter.dst_ip, key->dst_ip, ip_len);
     }
-    if (inet_ntop(AF_INET, key->dst_ip, filter.dst_ip,
-        INET6_ADDRSTRLEN) == NULL)
+    else
     {
-        LOGE("%s: inet_ntop dst_ip %s error: %s", __func__,
-             key->dst_ip, strerror(errno));
-        return false;
+        filter.af = AF_UNSPEC;
     }
 
     filter.sport = ntohs(key->sport);
     filter.dport = ntohs(key->dport);
     filter.l4_proto = key->ipprotocol;
 
-    /* key->ip_version No ip (0), ipv4 (4), ipv6 (6) */
-    filter.ip_type = (key->ip_version <= 4)? AF_INET: AF_INET6;
-
-    fcm_filter_7tuple_apply(filter_name,
-                             &mac_filter,
-                             &filter,
-                             pkt,
-                             fkey,
-                             &seven_tuple_action);
+    fcm_filter_flow_apply(filter_name,
+                          &filter,
+                          pkt,
+                          fkey,
+                          &seven_tuple_action);
     return seven_tuple_action;
 }
 
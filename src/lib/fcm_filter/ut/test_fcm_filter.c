@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "target.h"
@@ -37,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "fcm_filter.h"
 #include "network_metadata.h"
+#include "policy_tags.h"
 
 extern void callback_FCM_Filter(ovsdb_update_monitor_t *mon,
                          struct schema_FCM_Filter *old_rec,
@@ -755,6 +757,290 @@ void test_fcm_filter_app_update(void)
     TEST_ASSERT_TRUE(allow);
 }
 
+static void
+fcm_filter_ut_flow(fcm_filter_flow_t *flow, char *src_ip, char *dst_ip,
+                   uint16_t dport, uint8_t proto)
+{
+    memset(flow, 0, sizeof(*flow));
+    flow->has_l3 = true;
+    flow->af = strchr(src_ip, ':') ? AF_INET6 : AF_INET;
+    inet_pton(flow->af, src_ip, flow->src_ip);
+    inet_pton(flow->af, dst_ip, flow->dst_ip);
+    flow->sport = 40000;
+    flow->dport = dport;
+    flow->l4_proto = proto;
+}
+
+void test_fcm_filter_cidr(void)
+{
+    struct schema_FCM_Filter *sch_filter;
+    fcm_filter_l3_info_t l3_info;
+    fcm_filter_flow_t flow;
+    char *dst_ip;
+    bool allow;
+    size_t i;
+
+    struct
+    {
+        char *src_ip;
+        uint16_t dport;
+        uint8_t proto;
+        bool expected;
+    } flows[] =
+    {
+        { "192.168.40.121", 80, 6, true },
+        { "192.168.40.1", 1500, 6, true },
+        { "192.168.41.1", 80, 6, false },   /* out of the /24 */
+        { "192.168.40.1", 2001, 6, false }, /* out of the port range */
+        { "192.168.40.1", 80, 17, false },  /* wrong protocol */
+        { "2001:db8:1::5", 1000, 6, true },
+        { "2001:db9::5", 1000, 6, false },
+        { "10.2.3.4", 2000, 6, true },      /* host route */
+        { "10.2.3.5", 2000, 6, false },
+    };
+
+    sch_filter = calloc(2, sizeof(*sch_filter));
+    TEST_ASSERT_NOT_NULL(sch_filter);
+
+    STRSCPY(sch_filter[0].name, "fcm_filter_cidr");
+    sch_filter[0].index = 1;
+    sch_filter[0].src_ip_len = 3;
+    STRSCPY(sch_filter[0].src_ip[0], "192.168.40.0/24");
+    STRSCPY(sch_filter[0].src_ip[1], "2001:db8::/32");
+    STRSCPY(sch_filter[0].src_ip[2], "10.2.3.4");
+    STRSCPY(sch_filter[0].src_ip_op, "in");
+    sch_filter[0].dst_port_len = 2;
+    STRSCPY(sch_filter[0].dst_port[0], "1000-2000");
+    STRSCPY(sch_filter[0].dst_port[1], "80");
+    STRSCPY(sch_filter[0].dst_port_op, "in");
+    sch_filter[0].proto_len = 1;
+    sch_filter[0].proto[0] = 6;
+    STRSCPY(sch_filter[0].proto_op, "in");
+    STRSCPY(sch_filter[0].action, "include");
+
+    STRSCPY(sch_filter[1].name, "fcm_filter_cidr");
+    sch_filter[1].index = 2;
+    STRSCPY(sch_filter[1].action, "exclude");
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_FCM_Filter(&g_mon, NULL, &sch_filter[0]);
+    callback_FCM_Filter(&g_mon, NULL, &sch_filter[1]);
+
+    for (i = 0; i < ARRAY_SIZE(flows); i++)
+    {
+        dst_ip = strchr(flows[i].src_ip, ':') ? "2001:db8::1" : "10.2.20.32";
+        fcm_filter_ut_flow(&flow, flows[i].src_ip, dst_ip,
+                           flows[i].dport, flows[i].proto);
+        allow = !flows[i].expected;
+        fcm_filter_flow_apply("fcm_filter_cidr", &flow, &g_flow_pkt[0],
+                              NULL, &allow);
+        TEST_ASSERT_EQUAL_MESSAGE(flows[i].expected, allow, flows[i].src_ip);
+
+        /* The string based API yields the same results */
+        memset(&l3_info, 0, sizeof(l3_info));
+        STRSCPY(l3_info.src_ip, flows[i].src_ip);
+        STRSCPY(l3_info.dst_ip, dst_ip);
+        l3_info.dport = flows[i].dport;
+        l3_info.l4_proto = flows[i].proto;
+        allow = !flows[i].expected;
+        fcm_filter_7tuple_apply("fcm_filter_cidr", NULL, &l3_info,
+                                &g_flow_pkt[0], NULL, &allow);
+        TEST_ASSERT_EQUAL_MESSAGE(flows[i].expected, allow, flows[i].src_ip);
+    }
+
+    free(sch_filter);
+}
+
+void test_fcm_filter_ip_tag(void)
+{
+    struct schema_FCM_Filter *sch_filter;
+    struct schema_Openflow_Tag *tag;
+    fcm_filter_flow_t flow;
+    bool allow;
+
+    tag = calloc(1, sizeof(*tag));
+    TEST_ASSERT_NOT_NULL(tag);
+    STRSCPY(tag->name, "fcm_ut_subnets");
+    tag->device_value_len = 1;
+    STRSCPY(tag->device_value[0], "10.10.0.0/16");
+
+    sch_filter = calloc(1, sizeof(*sch_filter));
+    TEST_ASSERT_NOT_NULL(sch_filter);
+    STRSCPY(sch_filter->name, "fcm_filter_tag");
+    sch_filter->index = 1;
+    sch_filter->src_ip_len = 1;
+    STRSCPY(sch_filter->src_ip[0], "${fcm_ut_subnets}");
+    STRSCPY(sch_filter->src_ip_op, "in");
+    STRSCPY(sch_filter->action, "include");
+
+    /* The rule is compiled before the tag exists */
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_FCM_Filter(&g_mon, NULL, sch_filter);
+
+    fcm_filter_ut_flow(&flow, "10.10.3.4", "10.2.20.32", 80, 6);
+    allow = true;
+    fcm_filter_flow_apply("fcm_filter_tag", &flow, NULL, NULL, &allow);
+    TEST_ASSERT_FALSE(allow);
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_Openflow_Tag(&g_mon, NULL, tag);
+    fcm_filter_flow_apply("fcm_filter_tag", &flow, NULL, NULL, &allow);
+    TEST_ASSERT_TRUE(allow);
+
+    /* Tag updates are picked up by the compiled rule */
+    STRSCPY(tag->device_value[0], "10.20.0.0/16");
+    g_mon.mon_type = OVSDB_UPDATE_MODIFY;
+    callback_Openflow_Tag(&g_mon, NULL, tag);
+    fcm_filter_flow_apply("fcm_filter_tag", &flow, NULL, NULL, &allow);
+    TEST_ASSERT_FALSE(allow);
+
+    fcm_filter_ut_flow(&flow, "10.20.1.1", "10.2.20.32", 80, 6);
+    fcm_filter_flow_apply("fcm_filter_tag", &flow, NULL, NULL, &allow);
+    TEST_ASSERT_TRUE(allow);
+
+    g_mon.mon_type = OVSDB_UPDATE_DEL;
+    callback_Openflow_Tag(&g_mon, tag, NULL);
+    fcm_filter_flow_apply("fcm_filter_tag", &flow, NULL, NULL, &allow);
+    TEST_ASSERT_FALSE(allow);
+
+    free(sch_filter);
+    free(tag);
+}
+
+/**
+ * @brief evaluates 50k flows against 100 rules
+ *
+ * Each rule holds a handful of prefixes, ports and macs. Most flows walk
+ * the whole filter before hitting the trailing catch-all rule.
+ */
+void test_fcm_filter_benchmark(void)
+{
+    struct schema_FCM_Filter *sch_filter;
+    struct timespec start, end;
+    fcm_filter_l2_info_t *l2_info;
+    fcm_filter_l3_info_t *l3_info;
+    fcm_filter_flow_t *flows;
+    double flow_time, str_time;
+    int nincluded, nstr_included;
+    int nrules, nflows;
+    bool allow;
+    int i;
+
+    LOGI("starting test: %s ...", __func__);
+
+    nrules = 100;
+    nflows = 50000;
+
+    sch_filter = calloc(nrules, sizeof(*sch_filter));
+    flows = calloc(nflows, sizeof(*flows));
+    l2_info = calloc(nflows, sizeof(*l2_info));
+    l3_info = calloc(nflows, sizeof(*l3_info));
+    TEST_ASSERT_NOT_NULL(sch_filter);
+    TEST_ASSERT_NOT_NULL(flows);
+    TEST_ASSERT_NOT_NULL(l2_info);
+    TEST_ASSERT_NOT_NULL(l3_info);
+
+    for (i = 0; i < nrules - 1; i++)
+    {
+        STRSCPY(sch_filter[i].name, "fcm_filter_bench");
+        sch_filter[i].index = i + 1;
+        sch_filter[i].src_ip_len = 4;
+        snprintf(sch_filter[i].src_ip[0], sizeof(sch_filter[i].src_ip[0]),
+                 "10.%d.0.0/16", i);
+        snprintf(sch_filter[i].src_ip[1], sizeof(sch_filter[i].src_ip[1]),
+                 "172.16.%d.0/24", i);
+        snprintf(sch_filter[i].src_ip[2], sizeof(sch_filter[i].src_ip[2]),
+                 "192.168.%d.1", i);
+        snprintf(sch_filter[i].src_ip[3], sizeof(sch_filter[i].src_ip[3]),
+                 "2001:db8:%x::/48", i);
+        STRSCPY(sch_filter[i].src_ip_op, "in");
+        sch_filter[i].dst_port_len = 2;
+        snprintf(sch_filter[i].dst_port[0], sizeof(sch_filter[i].dst_port[0]),
+                 "%d-%d", 1000 + 10 * i, 1009 + 10 * i);
+        STRSCPY(sch_filter[i].dst_port[1], "443");
+        STRSCPY(sch_filter[i].dst_port_op, "in");
+        sch_filter[i].smac_len = 2;
+        snprintf(sch_filter[i].smac[0], sizeof(sch_filter[i].smac[0]),
+                 "02:00:00:00:00:%02x", i);
+        snprintf(sch_filter[i].smac[1], sizeof(sch_filter[i].smac[1]),
+                 "02:00:00:00:01:%02x", i);
+        STRSCPY(sch_filter[i].smac_op, "out");
+        STRSCPY(sch_filter[i].action, "include");
+    }
+    STRSCPY(sch_filter[i].name, "fcm_filter_bench");
+    sch_filter[i].index = i + 1;
+    STRSCPY(sch_filter[i].action, "exclude");
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    for (i = 0; i < nrules; i++) callback_FCM_Filter(&g_mon, NULL, &sch_filter[i]);
+
+    for (i = 0; i < nflows; i++)
+    {
+        snprintf(l3_info[i].src_ip, sizeof(l3_info[i].src_ip), "10.%d.%d.%d",
+                 (i * 7) % 200, (i >> 8) & 0xff, i & 0xff);
+        STRSCPY(l3_info[i].dst_ip, "10.2.20.32");
+        l3_info[i].sport = 40000 + (i % 1000);
+        l3_info[i].dport = (i % 3) ? 1000 + (i % 1000) : 443;
+        l3_info[i].l4_proto = 6;
+        snprintf(l2_info[i].src_mac, sizeof(l2_info[i].src_mac),
+                 "02:00:00:00:00:%02x", i & 0xff);
+        STRSCPY(l2_info[i].dst_mac, "02:00:00:00:ff:ff");
+
+        fcm_filter_ut_flow(&flows[i], l3_info[i].src_ip, l3_info[i].dst_ip,
+                           l3_info[i].dport, l3_info[i].l4_proto);
+        flows[i].sport = l3_info[i].sport;
+        flows[i].has_l2 = true;
+        flows[i].smac_valid = true;
+        flows[i].dmac_valid = true;
+        sscanf(l2_info[i].src_mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &flows[i].smac.addr[0], &flows[i].smac.addr[1],
+               &flows[i].smac.addr[2], &flows[i].smac.addr[3],
+               &flows[i].smac.addr[4], &flows[i].smac.addr[5]);
+        sscanf(l2_info[i].dst_mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &flows[i].dmac.addr[0], &flows[i].dmac.addr[1],
+               &flows[i].dmac.addr[2], &flows[i].dmac.addr[3],
+               &flows[i].dmac.addr[4], &flows[i].dmac.addr[5]);
+    }
+
+    nincluded = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nflows; i++)
+    {
+        fcm_filter_flow_apply("fcm_filter_bench", &flows[i], &g_flow_pkt[0],
+                              NULL, &allow);
+        nincluded += allow;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    flow_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    nstr_included = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nflows; i++)
+    {
+        fcm_filter_7tuple_apply("fcm_filter_bench", &l2_info[i], &l3_info[i],
+                                &g_flow_pkt[0], NULL, &allow);
+        nstr_included += allow;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    str_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    TEST_ASSERT_EQUAL_INT(nincluded, nstr_included);
+    TEST_ASSERT_TRUE(nincluded > 0);
+    TEST_ASSERT_TRUE(nincluded < nflows);
+
+    LOGI("%s: %d flows x %d rules, %d included: binary keys %.3f s"
+         " (%.0f ns/flow), string keys %.3f s (%.0f ns/flow)", __func__,
+         nflows, nrules, nincluded, flow_time, flow_time * 1e9 / nflows,
+         str_time, str_time * 1e9 / nflows);
+
+    free(l3_info);
+    free(l2_info);
+    free(flows);
+    free(sch_filter);
+
+    LOGI("ending test: %s", __func__);
+}
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -770,6 +1056,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_fcm_filter_delete);
     RUN_TEST(test_fcm_filter_update);
     RUN_TEST(test_fcm_filter_ip);
+    RUN_TEST(test_fcm_filter_cidr);
+    RUN_TEST(test_fcm_filter_ip_tag);
+    RUN_TEST(test_fcm_filter_benchmark);
     // App filter tests.
     RUN_TEST(test_fcm_filter_app_add);
     RUN_TEST(test_fcm_filter_app_delete);
@@ -388,6 +388,17 @@ fsm_dpi_sni_policy_req(struct fsm_session *session,
     policy_req.fqdn_req = &fqdn_req;
 
     fsm_apply_policies(session, &policy_req);
+
+    /* Verdict pending. Keep inspecting, the next lookup will hit the cache */
+    if (fqdn_req.categorized == FSM_FQDN_CAT_PENDING)
+    {
+        free(policy_req.reply.rule_name);
+        free(policy_req.reply.policy);
+        fsm_free_url_reply(fqdn_req.req_info->reply);
+        free(fqdn_req.req_info);
+        return FSM_DPI_INSPECT;
+    }
+
     /* overwrite the redirect action to block, as established
      * flows cannot be redirected.  This is required as the
      * GK could have updated the FQDN cache, and if the request
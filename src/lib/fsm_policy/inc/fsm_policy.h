@@ -246,6 +246,11 @@ struct fqdn_pending_req
                              struct fsm_policy *policy);
     bool (*gatekeeper_req)(struct fsm_session *session,
                            struct fsm_policy_req *req);
+    /* set by requesters able to hold the request until a pending verdict */
+    void (*gatekeeper_resume)(struct fqdn_pending_req *req);
+    /* set by the provider while the request is parked on a lookup */
+    void (*gatekeeper_cancel)(struct fqdn_pending_req *req);
+    void *gk_lookup;                   // provider's pending lookup
     ds_tree_node_t req_node;           // DS tree node
 };
 
@@ -285,6 +290,58 @@ struct fsm_policy_req
 
 #define FSM_MAX_POLICIES 60
 
+/**
+ * @brief node of a compiled fqdn trie
+ *
+ * Children of a node are chained through the sibling pointer.
+ * A terminal node marks the end of a provisioned fqdn entry.
+ */
+struct fsm_fqdn_trie_node
+{
+    struct fsm_fqdn_trie_node *child;
+    struct fsm_fqdn_trie_node *sibling;
+    char c;
+    bool terminal;
+};
+
+/**
+ * @brief precompiled wildcard pattern
+ *
+ * The pattern is split once in its labels. Labels without glob
+ * characters are compared as plain strings.
+ */
+struct fsm_fqdn_wild_entry
+{
+    char *pattern;      /* original pattern */
+    char *buf;          /* pattern copy, labels point in it */
+    char **labels;      /* pattern labels, left to right */
+    bool *has_glob;     /* per label glob indicator */
+    size_t nlabels;     /* number of labels */
+};
+
+#define FSM_FQDN_MAX_LEN 256
+#define FSM_FQDN_MAX_LABELS 128
+
+/**
+ * @brief compiled representation of a policy's fqdn set
+ *
+ * Built when the policy is loaded from ovsdb so that a lookup neither
+ * walks the whole set nor allocates memory:
+ * - exact match and start from left entries are stored in a trie
+ *   indexed from the first character of the entry,
+ * - start from right entries are stored in a trie indexed from the last
+ *   character of the entry,
+ * - wildcard entries are stored as arrays of precompiled labels.
+ */
+struct fsm_fqdn_matcher
+{
+    int op;                             /* FSM_FQDN_OP_* */
+    struct fsm_fqdn_trie_node *root;    /* XM, SFL and SFR lookups */
+    struct fsm_fqdn_wild_entry *wild;   /* wildcard lookups */
+    size_t nwild;
+    size_t nnodes;                      /* number of trie nodes */
+};
+
 /**
  * @brief representation of a policy rule.
  *
@@ -304,9 +361,11 @@ struct fsm_policy_rules
     bool mac_rule_present;
     int mac_op;
     struct str_set *macs;
+    struct om_mac_set *mac_set;
     bool fqdn_rule_present;
     int fqdn_op;
     struct str_set *fqdns;
+    struct fsm_fqdn_matcher *fqdn_matcher;
     bool cat_rule_present;
     int cat_op;
     struct int_set *categories;
@@ -419,4 +478,11 @@ void fsm_policy_update_clients(struct policy_table *table);
 bool find_mac_in_set(os_macaddr_t *mac, struct str_set *macs_set);
 void fsm_free_url_reply(struct fsm_url_reply *reply);
 int fsm_policy_get_req_type(struct fsm_policy_req *req);
+bool wildmatch(char *pattern, char *domain);
+int fsm_fqdn_get_op(int fqdn_op);
+bool fsm_fqdn_linear_in_set(struct str_set *fqdns_set, char *fqdn, int op);
+struct fsm_fqdn_matcher *fsm_fqdn_matcher_compile(struct str_set *fqdns_set,
+                                                  int op);
+void fsm_fqdn_matcher_free(struct fsm_fqdn_matcher *matcher);
+bool fsm_fqdn_matcher_lookup(struct fsm_fqdn_matcher *matcher, char *fqdn);
 #endif /* FSM_POLICY_H_INCLUDED */
@@ -199,7 +199,8 @@ bool find_mac_in_set(os_macaddr_t *mac, struct str_set *macs_set)
  *
  * Looks up a mac in the policy macs value set. An entry in the value set can be
  * the string representation of a MAC address (assumed to be using lower cases),
- * a tag or a tag group.
+ * a tag or a tag group. The compiled representation of the set is used
+ * when available.
  * @param req the fqdn check request
  * @param p the policy
  * @return true if found, false otherwise.
@@ -214,6 +215,8 @@ bool fsm_device_in_set(struct fsm_policy_req *req, struct fsm_policy *p)
 
     if (macs_set == NULL) return false;
 
+    if (p->rules.mac_set != NULL) return om_mac_set_in(p->rules.mac_set, mac);
+
     return find_mac_in_set(mac, macs_set);
 }
 
@@ -259,16 +262,23 @@ bool wildmatch(char *pattern, char *domain)
     char *delim = ".";
     char *saveptr1;
     char *saveptr2;
+    char *pattern_copy;
+    char *domain_copy;
     char *str1;
     char *str2;
     char *sub1;
     char *sub2;
+    bool match;
     int ret;
-    int j;
 
-   for (j = 1, str1 = strdup(pattern), str2 = strdup(domain); ;
-        j++, str1 = NULL, str2 = NULL)
-   {
+    pattern_copy = strdup(pattern);
+    domain_copy = strdup(domain);
+    match = false;
+    if ((pattern_copy == NULL) || (domain_copy == NULL)) goto out;
+
+    for (str1 = pattern_copy, str2 = domain_copy; ;
+         str1 = NULL, str2 = NULL)
+    {
         sub1 = strtok_r(str1, delim, &saveptr1);
         sub2 = strtok_r(str2, delim, &saveptr2);
         /*
@@ -277,71 +287,62 @@ bool wildmatch(char *pattern, char *domain)
          */
         if (sub1 == NULL && sub2 == NULL)
         {
-            free(str1);
-            free(str2);
-
-            return true;
+            match = true;
+            break;
         }
 
         /*
          * If one of the strings has ended, they weren't even and
          * there was no match
          */
-        if (sub1 == NULL || sub2 == NULL)
-        {
-            free(str1);
-            free(str2);
-
-            return false;
-        }
-
+        if (sub1 == NULL || sub2 == NULL) break;
 
         ret = fnmatch(sub1, sub2, 0);
-        if (ret)
-        {
-            free(str1);
-            free(str2);
-
-            return false;
-        }
+        if (ret) break;
+    }
 
-        free(str1);
-        free(str2);
-   }
+out:
+    free(pattern_copy);
+    free(domain_copy);
 
-   return false;
+    return match;
 }
 
 
 /**
- * fsm_fqdn_in_set: looks up a fqdn in a policy's fqdns values set.
- * @req: the policy request
- * @p: policy
+ * fsm_fqdn_linear_in_set: looks up a fqdn in a fqdns values set.
+ * @fqdns_set: the set of fqdns
+ * @fqdn: the fqdn to look up
  * @op: lookup
  *
- * Checks if the request's fqdn is either an exact match, start from right
- * or start form left superset of an entry in the policy's fqdn set entry.
+ * Checks if the fqdn is either an exact match, start from right
+ * or start form left superset of an entry in the fqdn set, or matches
+ * one of the set's wildcard patterns. Walks the whole set, policies rely on
+ * the compiled version, fsm_fqdn_matcher_lookup().
  */
-static bool fsm_fqdn_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
-                            int op)
+bool fsm_fqdn_linear_in_set(struct str_set *fqdns_set, char *fqdn, int op)
 {
-    struct str_set *fqdns_set;
     size_t nelems, i;
     int rc;
 
-    fqdns_set = p->rules.fqdns;
     if (fqdns_set == NULL) return false;
     nelems = fqdns_set->nelems;
     for (i = 0; i < nelems; i++)
     {
-        char *fqdn_req = req->url;
+        char *fqdn_req = fqdn;
         char *entry_set = fqdns_set->array[i];
-        int entry_set_len = strlen(entry_set);
-        int fqdn_req_len = strlen(fqdn_req);
+        int entry_set_len;
+        int fqdn_req_len;
 
-        if (entry_set_len > fqdn_req_len) continue;
+        if (op == FSM_FQDN_OP_WILD)
+        {
+            if (wildmatch(entry_set, fqdn_req)) return true;
+            continue;
+        }
 
-        if (op == FSM_FQDN_OP_WILD) return wildmatch(entry_set, fqdn_req);
+        entry_set_len = strlen(entry_set);
+        fqdn_req_len = strlen(fqdn_req);
+        if (entry_set_len > fqdn_req_len) continue;
 
         if (op == FSM_FQDN_OP_SFR) fqdn_req += (fqdn_req_len - entry_set_len);
 
@@ -351,6 +352,31 @@ static bool fsm_fqdn_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
     return false;
 }
 
+
+/**
+ * fsm_fqdn_in_set: looks up a fqdn in a policy's fqdns values set.
+ * @req: the policy request
+ * @p: policy
+ * @op: lookup
+ *
+ * Uses the policy's compiled fqdn set when available.
+ */
+static bool fsm_fqdn_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
+                            int op)
+{
+    struct fsm_policy_rules *rules;
+
+    rules = &p->rules;
+    if (rules->fqdns == NULL) return false;
+
+    if (rules->fqdn_matcher != NULL)
+    {
+        return fsm_fqdn_matcher_lookup(rules->fqdn_matcher, req->url);
+    }
+
+    return fsm_fqdn_linear_in_set(rules->fqdns, req->url, op);
+}
+
 /**
  * fsm_fqdn_check: check if a fqdn matches the policy's fqdn rule
  * @req: the request being processed
@@ -362,11 +388,9 @@ static bool fsm_fqdn_check(struct fsm_policy_req *req,
 {
     struct fsm_policy_rules *rules;
     bool rc = false;
-    bool in_policy, sfr, sfl, wild;
+    bool in_policy;
     int op;
 
-    op = FSM_FQDN_OP_XM;
-
     rules = &policy->rules;
     if (!rules->fqdn_rule_present) return true;
 
@@ -376,20 +400,7 @@ static bool fsm_fqdn_check(struct fsm_policy_req *req,
     in_policy |= (rules->fqdn_op == FQDN_OP_SFL_IN);
     in_policy |= (rules->fqdn_op == FQDN_OP_WILD_IN);
 
-
-    sfr = (rules->fqdn_op == FQDN_OP_SFR_IN);
-    sfr |= (rules->fqdn_op == FQDN_OP_SFR_OUT);
-    if (sfr) op = FSM_FQDN_OP_SFR;
-
-    sfl = (rules->fqdn_op == FQDN_OP_SFL_IN);
-    sfl |= (rules->fqdn_op == FQDN_OP_SFL_OUT);
-    if (sfl) op = FSM_FQDN_OP_SFL;
-
-
-    wild = (rules->fqdn_op == FQDN_OP_WILD_IN);
-    wild |= (rules->fqdn_op == FQDN_OP_WILD_OUT);
-    if (wild) op = FSM_FQDN_OP_WILD;
-
+    op = fsm_fqdn_get_op(rules->fqdn_op);
 
     rc = fsm_fqdn_in_set(req, policy, op);
 
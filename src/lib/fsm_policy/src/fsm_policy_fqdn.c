@@ -0,0 +1,478 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "log.h"
+#include "ovsdb_utils.h"
+#include "fsm_policy.h"
+
+
+/**
+ * @brief translates a policy fqdn operation in a lookup operation
+ *
+ * @param fqdn_op the policy fqdn operation (FQDN_OP_*)
+ * @return the lookup operation (FSM_FQDN_OP_*)
+ */
+int fsm_fqdn_get_op(int fqdn_op)
+{
+    switch (fqdn_op)
+    {
+        case FQDN_OP_SFR_IN:
+        case FQDN_OP_SFR_OUT:
+            return FSM_FQDN_OP_SFR;
+
+        case FQDN_OP_SFL_IN:
+        case FQDN_OP_SFL_OUT:
+            return FSM_FQDN_OP_SFL;
+
+        case FQDN_OP_WILD_IN:
+        case FQDN_OP_WILD_OUT:
+            return FSM_FQDN_OP_WILD;
+
+        default:
+            return FSM_FQDN_OP_XM;
+    }
+}
+
+
+/**
+ * @brief looks up the child of a trie node matching a character
+ *
+ * @param node the parent node
+ * @param c the character to look up
+ * @return the child node if found, NULL otherwise
+ */
+static struct fsm_fqdn_trie_node *
+fsm_fqdn_trie_find_child(struct fsm_fqdn_trie_node *node, char c)
+{
+    struct fsm_fqdn_trie_node *child;
+
+    for (child = node->child; child != NULL; child = child->sibling)
+    {
+        if (child->c == c) return child;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief inserts an entry in the trie
+ *
+ * @param matcher the matcher owning the trie
+ * @param entry the fqdn set entry
+ * @param reverse true if the entry is indexed from its last character
+ * @return true if the insertion succeeded, false otherwise
+ */
+static bool
+fsm_fqdn_trie_insert(struct fsm_fqdn_matcher *matcher, char *entry,
+                     bool reverse)
+{
+    struct fsm_fqdn_trie_node *child;
+    struct fsm_fqdn_trie_node *node;
+    size_t len;
+    size_t i;
+    char c;
+
+    node = matcher->root;
+    len = strlen(entry);
+    for (i = 0; i < len; i++)
+    {
+        c = reverse ? entry[len - 1 - i] : entry[i];
+
+        child = fsm_fqdn_trie_find_child(node, c);
+        if (child == NULL)
+        {
+            child = calloc(1, sizeof(*child));
+            if (child == NULL) return false;
+
+            child->c = c;
+            child->sibling = node->child;
+            node->child = child;
+            matcher->nnodes++;
+        }
+        node = child;
+    }
+    node->terminal = true;
+
+    return true;
+}
+
+
+/**
+ * @brief frees a trie
+ *
+ * Recursion only happens on children, siblings are walked iteratively.
+ * The depth of the recursion is bounded by the longest fqdn entry.
+ *
+ * @param node the trie root
+ */
+static void
+fsm_fqdn_trie_free(struct fsm_fqdn_trie_node *node)
+{
+    struct fsm_fqdn_trie_node *next;
+
+    while (node != NULL)
+    {
+        next = node->sibling;
+        fsm_fqdn_trie_free(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+
+/**
+ * @brief looks up a fqdn in the trie
+ *
+ * The fqdn matches if any entry of the trie is a prefix of the fqdn
+ * (or a suffix when the trie is reversed).
+ *
+ * @param root the trie root
+ * @param fqdn the fqdn to look up
+ * @param reverse true if the trie is indexed from the last character
+ * @return true if found, false otherwise
+ */
+static bool
+fsm_fqdn_trie_lookup(struct fsm_fqdn_trie_node *root, char *fqdn,
+                     bool reverse)
+{
+    struct fsm_fqdn_trie_node *node;
+    size_t len;
+    size_t i;
+    char c;
+
+    node = root;
+    if (node->terminal) return true;
+
+    len = strlen(fqdn);
+    for (i = 0; i < len; i++)
+    {
+        c = reverse ? fqdn[len - 1 - i] : fqdn[i];
+
+        node = fsm_fqdn_trie_find_child(node, c);
+        if (node == NULL) return false;
+        if (node->terminal) return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief splits a string in its labels, in place
+ *
+ * Empty labels are skipped, consistent with strtok_r().
+ *
+ * @param buf the string to split. Its separators are overwritten.
+ * @param labels the array of labels to fill
+ * @param max the size of the labels array
+ * @return the number of labels, or -1 if the string has too many labels
+ */
+static int
+fsm_fqdn_split_labels(char *buf, char **labels, size_t max)
+{
+    size_t nlabels;
+    char *p;
+
+    nlabels = 0;
+    p = buf;
+    while (*p != '\0')
+    {
+        if (*p == '.')
+        {
+            *p++ = '\0';
+            continue;
+        }
+
+        if (nlabels == max) return -1;
+        labels[nlabels++] = p;
+
+        while ((*p != '\0') && (*p != '.')) p++;
+    }
+
+    return (int)nlabels;
+}
+
+
+/**
+ * @brief precompiles a wildcard pattern
+ *
+ * @param wild the entry to fill
+ * @param pattern the wildcard pattern
+ * @return true if the compilation succeeded, false otherwise
+ */
+static bool
+fsm_fqdn_wild_compile(struct fsm_fqdn_wild_entry *wild, char *pattern)
+{
+    char *labels[FSM_FQDN_MAX_LABELS];
+    int nlabels;
+    int i;
+
+    wild->pattern = strdup(pattern);
+    if (wild->pattern == NULL) return false;
+
+    wild->buf = strdup(pattern);
+    if (wild->buf == NULL) goto err_free_pattern;
+
+    nlabels = fsm_fqdn_split_labels(wild->buf, labels, FSM_FQDN_MAX_LABELS);
+    if (nlabels < 0) goto err_free_buf;
+
+    wild->nlabels = nlabels;
+    if (nlabels == 0) return true;
+
+    wild->labels = calloc(nlabels, sizeof(*wild->labels));
+    if (wild->labels == NULL) goto err_free_buf;
+
+    wild->has_glob = calloc(nlabels, sizeof(*wild->has_glob));
+    if (wild->has_glob == NULL) goto err_free_labels;
+
+    for (i = 0; i < nlabels; i++)
+    {
+        wild->labels[i] = labels[i];
+        wild->has_glob[i] = (strpbrk(labels[i], "*?[\\") != NULL);
+    }
+
+    return true;
+
+err_free_labels:
+    free(wild->labels);
+
+err_free_buf:
+    free(wild->buf);
+
+err_free_pattern:
+    free(wild->pattern);
+    memset(wild, 0, sizeof(*wild));
+
+    return false;
+}
+
+
+static void
+fsm_fqdn_wild_free(struct fsm_fqdn_wild_entry *wild)
+{
+    free(wild->has_glob);
+    free(wild->labels);
+    free(wild->buf);
+    free(wild->pattern);
+}
+
+
+/**
+ * @brief matches a fqdn split in labels against a wildcard pattern
+ *
+ * @param wild the precompiled pattern
+ * @param labels the fqdn labels
+ * @param nlabels the number of fqdn labels
+ * @return true if the fqdn matches, false otherwise
+ */
+static bool
+fsm_fqdn_wild_match(struct fsm_fqdn_wild_entry *wild, char **labels,
+                    size_t nlabels)
+{
+    size_t i;
+    int rc;
+
+    if (wild->nlabels != nlabels) return false;
+
+    for (i = 0; i < nlabels; i++)
+    {
+        if (wild->has_glob[i])
+        {
+            rc = fnmatch(wild->labels[i], labels[i], 0);
+        }
+        else
+        {
+            rc = strcmp(wild->labels[i], labels[i]);
+        }
+        if (rc != 0) return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief looks up a fqdn against the precompiled wildcard patterns
+ *
+ * The fqdn is split in a stack buffer, no memory is allocated.
+ * Names too long for the stack buffer fall back to wildmatch().
+ *
+ * @param matcher the compiled fqdn set
+ * @param fqdn the fqdn to look up
+ * @return true if a pattern matches, false otherwise
+ */
+static bool
+fsm_fqdn_wild_lookup(struct fsm_fqdn_matcher *matcher, char *fqdn)
+{
+    char *labels[FSM_FQDN_MAX_LABELS];
+    char buf[FSM_FQDN_MAX_LEN];
+    size_t len;
+    int nlabels;
+    size_t i;
+    bool rc;
+
+    len = strlen(fqdn);
+    if (len >= sizeof(buf))
+    {
+        for (i = 0; i < matcher->nwild; i++)
+        {
+            rc = wildmatch(matcher->wild[i].pattern, fqdn);
+            if (rc) return true;
+        }
+        return false;
+    }
+
+    memcpy(buf, fqdn, len + 1);
+    nlabels = fsm_fqdn_split_labels(buf, labels, FSM_FQDN_MAX_LABELS);
+    if (nlabels < 0) return false;
+
+    for (i = 0; i < matcher->nwild; i++)
+    {
+        rc = fsm_fqdn_wild_match(&matcher->wild[i], labels, nlabels);
+        if (rc) return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief compiles a policy's fqdn set
+ *
+ * @param fqdns_set the policy's fqdn set
+ * @param op the lookup operation (FSM_FQDN_OP_*)
+ * @return the compiled set, NULL on failure
+ */
+struct fsm_fqdn_matcher *
+fsm_fqdn_matcher_compile(struct str_set *fqdns_set, int op)
+{
+    struct fsm_fqdn_matcher *matcher;
+    bool reverse;
+    size_t i;
+    bool rc;
+
+    if (fqdns_set == NULL) return NULL;
+
+    matcher = calloc(1, sizeof(*matcher));
+    if (matcher == NULL) return NULL;
+
+    matcher->op = op;
+    if (op == FSM_FQDN_OP_WILD)
+    {
+        if (fqdns_set->nelems == 0) return matcher;
+
+        matcher->wild = calloc(fqdns_set->nelems, sizeof(*matcher->wild));
+        if (matcher->wild == NULL) goto err_free_matcher;
+
+        for (i = 0; i < fqdns_set->nelems; i++)
+        {
+            rc = fsm_fqdn_wild_compile(&matcher->wild[i],
+                                       fqdns_set->array[i]);
+            if (!rc) goto err_free_matcher;
+
+            matcher->nwild++;
+        }
+
+        return matcher;
+    }
+
+    matcher->root = calloc(1, sizeof(*matcher->root));
+    if (matcher->root == NULL) goto err_free_matcher;
+
+    reverse = (op == FSM_FQDN_OP_SFR);
+    for (i = 0; i < fqdns_set->nelems; i++)
+    {
+        rc = fsm_fqdn_trie_insert(matcher, fqdns_set->array[i], reverse);
+        if (!rc) goto err_free_matcher;
+    }
+
+    LOGT("%s: compiled %zu entries in %zu trie nodes", __func__,
+         fqdns_set->nelems, matcher->nnodes);
+
+    return matcher;
+
+err_free_matcher:
+    LOGE("%s: failed to compile fqdn set", __func__);
+    fsm_fqdn_matcher_free(matcher);
+
+    return NULL;
+}
+
+
+/**
+ * @brief frees a compiled fqdn set
+ *
+ * @param matcher the compiled set
+ */
+void
+fsm_fqdn_matcher_free(struct fsm_fqdn_matcher *matcher)
+{
+    size_t i;
+
+    if (matcher == NULL) return;
+
+    fsm_fqdn_trie_free(matcher->root);
+
+    for (i = 0; i < matcher->nwild; i++)
+    {
+        fsm_fqdn_wild_free(&matcher->wild[i]);
+    }
+    free(matcher->wild);
+    free(matcher);
+}
+
+
+/**
+ * @brief looks up a fqdn in a compiled fqdn set
+ *
+ * Matches the semantics of fsm_fqdn_linear_in_set().
+ *
+ * @param matcher the compiled set
+ * @param fqdn the fqdn to look up
+ * @return true if found, false otherwise
+ */
+bool
+fsm_fqdn_matcher_lookup(struct fsm_fqdn_matcher *matcher, char *fqdn)
+{
+    bool reverse;
+
+    if (matcher == NULL) return false;
+    if (fqdn == NULL) return false;
+
+    if (matcher->op == FSM_FQDN_OP_WILD)
+    {
+        return fsm_fqdn_wild_lookup(matcher, fqdn);
+    }
+
+    reverse = (matcher->op == FSM_FQDN_OP_SFR);
+    return fsm_fqdn_trie_lookup(matcher->root, fqdn, reverse);
+}
@@ -218,11 +218,16 @@ fsm_free_rules(struct fsm_policy_rules *rules)
     rules->mac_rule_present = false;
     rules->mac_op = -1;
     free_str_set(rules->macs);
+    om_mac_set_free(rules->mac_set);
+    rules->mac_set = NULL;
 
     /* Reset fqdn check */
     rules->fqdn_rule_present = false;
     rules->fqdn_op = -1;
     free_str_set(rules->fqdns);
+    rules->fqdns = NULL;
+    fsm_fqdn_matcher_free(rules->fqdn_matcher);
+    rules->fqdn_matcher = NULL;
 
     /* Reset web categorization check */
     rules->cat_rule_present = false;
@@ -272,7 +277,14 @@ bool fsm_set_mac_rules(struct fsm_policy_rules *rules,
                                  spolicy->macs_len,
                                  spolicy->macs);
     check = fsm_check_conversion(rules->macs, spolicy->macs_len);
-    return check;
+    if (!check) return false;
+    if (rules->macs == NULL) return true;
+
+    /* Compile the macs set. Lookups fall back to the set walk on failure */
+    rules->mac_set = om_mac_set_alloc(rules->macs->array,
+                                      rules->macs->nelems);
+
+    return true;
 }
 
 
@@ -281,6 +293,7 @@ bool fsm_set_fqdn_rules(struct fsm_policy_rules *rules,
 {
     int cmp;
     bool check;
+    int op;
 
     rules->fqdn_rule_present = spolicy->fqdn_op_exists;
     if (!rules->fqdn_rule_present) return true;
@@ -316,7 +329,13 @@ bool fsm_set_fqdn_rules(struct fsm_policy_rules *rules,
                                   spolicy->fqdns_len,
                                   spolicy->fqdns);
     check = fsm_check_conversion(rules->fqdns, spolicy->fqdns_len);
-    return check;
+    if (!check) return false;
+
+    /* Compile the fqdn set. Lookups fall back to the set walk on failure */
+    op = fsm_fqdn_get_op(rules->fqdn_op);
+    rules->fqdn_matcher = fsm_fqdn_matcher_compile(rules->fqdns, op);
+
+    return true;
 }
 
 bool fsm_set_cats_rules(struct fsm_policy_rules *rules,
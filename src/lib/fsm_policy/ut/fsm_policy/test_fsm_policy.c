@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <time.h>
 
 #include "fsm.h"
 #include "log.h"
@@ -1267,6 +1268,207 @@ void test_ip_threat_blacklist(void)
 }
 
 
+static char *g_fqdn_entries[] =
+{
+    "www.google.com",
+    "mail.",
+    "facebook.com",
+    "cdn.example.org",
+};
+
+static char *g_fqdn_wild_entries[] =
+{
+    "www.bo*.google.com",
+    "*.facebook.com",
+    "api.?.example.org",
+    "cdn[0-9].net",
+};
+
+static char *g_fqdn_queries[] =
+{
+    "www.google.com",
+    "www.google.com.evil.net",
+    "mail.yahoo.com",
+    "www.facebook.com",
+    "facebook.com",
+    "notfacebook.com",
+    "api.a.example.org",
+    "api.ab.example.org",
+    "cdn.example.org",
+    "cdn7.net",
+    "cdnx.net",
+    "www.books.google.com",
+    "www.bo.google.com",
+    "www..books.google.com",
+    "",
+};
+
+
+static struct str_set *
+test_fqdn_build_set(char **entries, size_t nelems)
+{
+    struct str_set *set;
+
+    set = calloc(1, sizeof(*set));
+    TEST_ASSERT_NOT_NULL(set);
+
+    set->array = entries;
+    set->nelems = nelems;
+
+    return set;
+}
+
+
+/**
+ * @brief validates that the compiled fqdn sets match the set walk
+ */
+void test_fqdn_matcher_vs_linear(void)
+{
+    struct fsm_fqdn_matcher *matcher;
+    struct str_set *wild_set;
+    struct str_set *set;
+    bool expected;
+    size_t nqueries;
+    bool rc;
+    size_t i;
+    int op;
+
+    set = test_fqdn_build_set(g_fqdn_entries, ARRAY_SIZE(g_fqdn_entries));
+    wild_set = test_fqdn_build_set(g_fqdn_wild_entries,
+                                   ARRAY_SIZE(g_fqdn_wild_entries));
+    nqueries = ARRAY_SIZE(g_fqdn_queries);
+
+    for (op = FSM_FQDN_OP_XM; op <= FSM_FQDN_OP_WILD; op++)
+    {
+        struct str_set *s;
+
+        s = (op == FSM_FQDN_OP_WILD) ? wild_set : set;
+        matcher = fsm_fqdn_matcher_compile(s, op);
+        TEST_ASSERT_NOT_NULL(matcher);
+
+        for (i = 0; i < nqueries; i++)
+        {
+            expected = fsm_fqdn_linear_in_set(s, g_fqdn_queries[i], op);
+            rc = fsm_fqdn_matcher_lookup(matcher, g_fqdn_queries[i]);
+            LOGT("%s: op %d, %s: expected %s, got %s", __func__, op,
+                 g_fqdn_queries[i], expected ? "true" : "false",
+                 rc ? "true" : "false");
+            TEST_ASSERT_EQUAL(expected, rc);
+        }
+        fsm_fqdn_matcher_free(matcher);
+    }
+
+    /* Spot check a few well known results */
+    matcher = fsm_fqdn_matcher_compile(set, FSM_FQDN_OP_SFR);
+    TEST_ASSERT_NOT_NULL(matcher);
+    TEST_ASSERT_TRUE(fsm_fqdn_matcher_lookup(matcher, "www.facebook.com"));
+    TEST_ASSERT_FALSE(fsm_fqdn_matcher_lookup(matcher, "mail.yahoo.com"));
+    fsm_fqdn_matcher_free(matcher);
+
+    matcher = fsm_fqdn_matcher_compile(set, FSM_FQDN_OP_SFL);
+    TEST_ASSERT_NOT_NULL(matcher);
+    TEST_ASSERT_TRUE(fsm_fqdn_matcher_lookup(matcher, "mail.yahoo.com"));
+    TEST_ASSERT_FALSE(fsm_fqdn_matcher_lookup(matcher, "www.facebook.com"));
+    fsm_fqdn_matcher_free(matcher);
+
+    matcher = fsm_fqdn_matcher_compile(wild_set, FSM_FQDN_OP_WILD);
+    TEST_ASSERT_NOT_NULL(matcher);
+    TEST_ASSERT_TRUE(fsm_fqdn_matcher_lookup(matcher, "www.bo.google.com"));
+    TEST_ASSERT_TRUE(fsm_fqdn_matcher_lookup(matcher, "cdn7.net"));
+    TEST_ASSERT_FALSE(fsm_fqdn_matcher_lookup(matcher, "api.ab.example.org"));
+    fsm_fqdn_matcher_free(matcher);
+
+    free(wild_set);
+    free(set);
+}
+
+
+#define FQDN_BENCH_ENTRIES 5000
+#define FQDN_BENCH_LOOKUPS 10000
+
+static double
+test_fqdn_elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    double ms;
+
+    ms = (end->tv_sec - start->tv_sec) * 1000.0;
+    ms += (end->tv_nsec - start->tv_nsec) / 1000000.0;
+
+    return ms;
+}
+
+
+/**
+ * @brief compares the compiled fqdn sets against the set walk
+ *
+ * Not a pass/fail test beyond result consistency: logs the time spent
+ * by both lookup paths over a large provisioned set.
+ */
+void test_fqdn_matcher_benchmark(void)
+{
+    struct fsm_fqdn_matcher *matcher;
+    struct timespec start, end;
+    double linear_ms, compiled_ms;
+    size_t linear_hits;
+    size_t hits;
+    struct str_set set;
+    char query[64];
+    size_t i;
+    int op;
+
+    set.nelems = FQDN_BENCH_ENTRIES;
+    set.array = calloc(set.nelems, sizeof(*set.array));
+    TEST_ASSERT_NOT_NULL(set.array);
+
+    for (i = 0; i < set.nelems; i++)
+    {
+        set.array[i] = calloc(1, 64);
+        TEST_ASSERT_NOT_NULL(set.array[i]);
+        snprintf(set.array[i], 64, "host%zu.domain%zu.com", i, i % 97);
+    }
+
+    for (op = FSM_FQDN_OP_XM; op <= FSM_FQDN_OP_SFL; op++)
+    {
+        matcher = fsm_fqdn_matcher_compile(&set, op);
+        TEST_ASSERT_NOT_NULL(matcher);
+
+        linear_hits = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < FQDN_BENCH_LOOKUPS; i++)
+        {
+            /* The first FQDN_BENCH_ENTRIES lookups hit, the others miss */
+            snprintf(query, sizeof(query), "host%zu.domain%zu.com",
+                     i, i % 97);
+            linear_hits += fsm_fqdn_linear_in_set(&set, query, op);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        linear_ms = test_fqdn_elapsed_ms(&start, &end);
+
+        hits = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < FQDN_BENCH_LOOKUPS; i++)
+        {
+            snprintf(query, sizeof(query), "host%zu.domain%zu.com",
+                     i, i % 97);
+            hits += fsm_fqdn_matcher_lookup(matcher, query);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        compiled_ms = test_fqdn_elapsed_ms(&start, &end);
+
+        TEST_ASSERT_EQUAL_UINT(linear_hits, hits);
+        LOGI("%s: op %d, %d entries, %d lookups (%zu hits): "
+             "linear %.2f ms, compiled %.2f ms (%zu trie nodes)",
+             __func__, op, FQDN_BENCH_ENTRIES, FQDN_BENCH_LOOKUPS, hits,
+             linear_ms, compiled_ms, matcher->nnodes);
+
+        fsm_fqdn_matcher_free(matcher);
+    }
+
+    for (i = 0; i < set.nelems; i++) free(set.array[i]);
+    free(set.array);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -1291,6 +1493,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_apply_wildcard_policy_match_in);
     RUN_TEST(test_apply_wildcard_policy_no_match);
     RUN_TEST(test_ip_threat_blacklist);
+    RUN_TEST(test_fqdn_matcher_vs_linear);
+    RUN_TEST(test_fqdn_matcher_benchmark);
 
     return UNITY_END();
 }
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef GK_CACHE_H_INCLUDED
 #define GK_CACHE_H_INCLUDED
 
+#include <pthread.h>
 #include <stdint.h>
 #include <time.h>
 #include <netinet/in.h>
@@ -36,12 +37,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "os_types.h"
 #include "fsm_policy.h"
 #include "ds_tree.h"
+#include "ds_dlist.h"
 #include "util.h"
 #include "os.h"
 
 #define GK_MAX_CACHE_ENTRIES 100000
 #define GK_DEFAULT_TTL 300
 
+/* memory budget of the cache entries, in bytes */
+#ifdef CONFIG_GATEKEEPER_CACHE_MAX_MEM
+#define GK_CACHE_MAX_MEM ((size_t)CONFIG_GATEKEEPER_CACHE_MAX_MEM * 1024)
+#else
+#define GK_CACHE_MAX_MEM ((size_t)16384 * 1024)
+#endif
+
+/* number of one second slots of the TTL timer wheel */
+#define GKC_TIMER_WHEEL_SLOTS 512
+
 /* enum with supported request types */
 enum gk_cache_request_type
 {
@@ -78,18 +90,24 @@ enum gkc_flow_direction
     GKC_FLOW_DIRECTION_LAN2LAN,
 };
 
+struct per_device_cache;
+
 /**
- * @brief structure to store parameters
- * required for checking and deleting
- * entries with expired TTL values.
+ * @brief cache bookkeeping embedded in every attribute and flow entry
+ *
+ * Links the entry in the global LRU list and in the timer wheel slot
+ * of its expiry time, so that neither eviction nor TTL expiry has to
+ * walk the per device trees.
  */
-struct gkc_del_info_s
+struct gkc_entry_node
 {
-    enum gk_cache_request_type attr_type;
-    struct per_device_cache *pdevice;
-    uint64_t attr_del_count;
-    uint64_t flow_del_count;
-    ds_tree_t *tree;
+    int type;                         /* gk_cache_request_type of the entry */
+    struct per_device_cache *pdevice; /* device owning the entry */
+    time_t expiry;                    /* time when the TTL expires */
+    size_t mem_size;                  /* memory accounted for the entry */
+    int slot;                         /* timer wheel slot */
+    ds_dlist_node_t lru_node;         /* global LRU list */
+    ds_dlist_node_t timer_node;       /* timer wheel slot list */
 };
 
 /**
@@ -119,6 +137,7 @@ struct attr_cache
     uint64_t hit_count;        /* number of times lookup is performed */
     int categorized;           /* categorized */
     struct fqdn_redirect_s *fqdn_redirect;
+    struct gkc_entry_node node;
     ds_tree_node_t attr_tnode;
 };
 
@@ -142,6 +161,7 @@ struct ip_flow_cache
     uint32_t confidence_level; /* risk/confidence level */
     time_t cache_ts;      /* time when the entry was added */
     uint64_t hit_count;   /* number of times lookup is performed */
+    struct gkc_entry_node node;
     ds_tree_node_t ipflow_tnode;
 };
 
@@ -177,15 +197,39 @@ struct per_device_cache
     ds_tree_node_t perdevice_tnode;
 };
 
+/**
+ * @brief cache activity counters
+ */
+struct gkc_stats
+{
+    uint64_t hits;      /* lookups found in the cache */
+    uint64_t misses;    /* lookups not found in the cache */
+    uint64_t evictions; /* entries evicted to stay within the budget */
+    uint64_t expired;   /* entries removed on TTL expiry */
+};
+
 /**
  * @brief tree structure for storing devices with its
  *        attributes and flows
+ *
+ * Entries are also kept in a global LRU list, the least recently used
+ * entry being evicted when adding a new one would exceed either
+ * max_entries or mem_budget. TTL expiry is driven by a hashed timer
+ * wheel indexed by the expiry time in seconds.
  */
 struct gk_cache_mgr
 {
     bool initialized;
     uint64_t count;
+    uint64_t max_entries;      /* maximum number of entries */
+    size_t mem_budget;         /* maximum memory used by the entries */
+    size_t mem_used;           /* memory used by the entries */
+    ds_dlist_t lru_list;       /* gkc_entry_node, most recent first */
+    ds_dlist_t timer_wheel[GKC_TIMER_WHEEL_SLOTS]; /* gkc_entry_node */
+    time_t wheel_ts;           /* last second processed by the wheel */
+    struct gkc_stats stats;
     ds_tree_t per_device_tree; /* per_device_cache */
+    pthread_mutex_t lock;      /* cache vs fsm nfqueue workers */
 };
 
 /**
@@ -278,17 +322,6 @@ gkc_cleanup_mgr(void);
 void
 gk_cache_cleanup(void);
 
-/**
- * @brief check ttl value for the given attribue
- *        or flow tree
- *
- * @params: attribute or flow tree
- *
- * @return void.
- */
-void
-gk_cache_check_ttl_device_tree(ds_tree_t *tree);
-
 /**
  * @brief get the count of devices having allowed action
  *
@@ -374,11 +407,91 @@ gkc_del_attr_from_dev(struct per_device_cache *pdevice,
 /**
  * @brief remove old cache entres.
  *
- * @param ttl the cache entry time to live
+ * Advances the timer wheel up to the current time, removing the
+ * entries whose TTL expired.
  */
 void
 gkc_ttl_cleanup(void);
 
+/**
+ * @brief remove the entries expiring up to the given time
+ *
+ * @params: now the current time
+ */
+void
+gkc_timer_wheel_expire(time_t now);
+
+/******************************************************************************
+ *  LRU and timer wheel bookkeeping
+ *******************************************************************************/
+
+/**
+ * @brief initialize the LRU list and the timer wheel slots
+ *
+ * @params: mgr the cache manager
+ */
+void
+gkc_lru_init(struct gk_cache_mgr *mgr);
+
+/**
+ * @brief link a new entry in the LRU list and the timer wheel,
+ *        and account for it
+ *
+ * @params: node the entry bookkeeping node, with expiry and mem_size set
+ */
+void
+gkc_entry_link(struct gkc_entry_node *node);
+
+/**
+ * @brief unlink an entry from the LRU list and the timer wheel,
+ *        and release its accounting
+ *
+ * @params: node the entry bookkeeping node
+ */
+void
+gkc_entry_unlink(struct gkc_entry_node *node);
+
+/**
+ * @brief mark the entry as the most recently used one
+ *
+ * @params: node the entry bookkeeping node
+ */
+void
+gkc_entry_touch(struct gkc_entry_node *node);
+
+/**
+ * @brief evict least recently used entries until an entry of the
+ *        given size fits within the cache limits
+ *
+ * @params: mem_size memory needed by the new entry
+ */
+void
+gkc_make_room(size_t mem_size);
+
+/**
+ * @brief free an attribute entry, removing it from its device tree
+ *
+ * @params: attr_entry the entry to free
+ */
+void
+gkc_free_attr_entry(struct attr_cache *attr_entry);
+
+/**
+ * @brief free a flow entry, removing it from its device tree
+ *
+ * @params: flow_entry the entry to free
+ */
+void
+gkc_free_flow_entry(struct ip_flow_cache *flow_entry);
+
+/**
+ * @brief returns the cache activity counters
+ *
+ * @return pointer to the counters
+ */
+struct gkc_stats *
+gkc_get_stats(void);
+
 /******************************************************************************
  * IP flow related operations
  *******************************************************************************/
@@ -469,15 +582,6 @@ gkc_flow_entry_cmp(void *_a, void *_b);
 bool
 gkc_is_input_valid(struct gkc_ip_flow_interface *req);
 
-/**
- * @brief delete the given flow from the flow
- *        tree if TTL is expired
- *
- * @params: gk_del_info cache delete info structure
- */
-void
-gkc_cleanup_ttl_flow_tree(struct gkc_del_info_s *gk_del_info);
-
 unsigned long
 gk_get_cache_count(void);
 
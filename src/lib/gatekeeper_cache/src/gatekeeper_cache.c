@@ -39,6 +39,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 static struct gk_cache_mgr mgr = {
     .initialized = false,
+    .max_entries = GK_MAX_CACHE_ENTRIES,
+    .mem_budget = GK_CACHE_MAX_MEM,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
 };
 
 struct gk_cache_mgr *
@@ -192,6 +195,9 @@ gk_cache_init_mgr(struct gk_cache_mgr *mgr)
                  struct per_device_cache,
                  perdevice_tnode);
 
+    gkc_lru_init(mgr);
+    mgr->wheel_ts = time(NULL);
+
     mgr->initialized = true;
 
     return;
@@ -295,6 +301,19 @@ gkc_new_attr_entry(struct gk_attr_cache_interface *entry)
         new_attr->gk_policy = strdup(entry->gk_policy);
     }
 
+    /* set the LRU and timer wheel bookkeeping */
+    new_attr->node.type = entry->attribute_type;
+    new_attr->node.expiry = new_attr->cache_ts + new_attr->cache_ttl;
+    new_attr->node.mem_size = sizeof(*new_attr) + strlen(entry->attr_name) + 1;
+    if (new_attr->fqdn_redirect != NULL)
+    {
+        new_attr->node.mem_size += sizeof(*new_attr->fqdn_redirect);
+    }
+    if (new_attr->gk_policy != NULL)
+    {
+        new_attr->node.mem_size += strlen(new_attr->gk_policy) + 1;
+    }
+
     return new_attr;
 }
 
@@ -319,6 +338,11 @@ gkc_add_attr_tree(struct per_device_cache *pdevice_cache,
     new_attr_cache = gkc_new_attr_entry(entry);
     if (new_attr_cache == NULL) return false;
 
+    new_attr_cache->node.pdevice = pdevice_cache;
+
+    /* evict the least recently used entries if the cache is full */
+    gkc_make_room(new_attr_cache->node.mem_size);
+
     switch (entry->attribute_type)
     {
     case GK_CACHE_REQ_TYPE_FQDN:
@@ -361,6 +385,8 @@ gkc_add_attr_tree(struct per_device_cache *pdevice_cache,
         break;
     }
 
+    if (ret) gkc_entry_link(&new_attr_cache->node);
+
     return ret;
 }
 
@@ -371,8 +397,11 @@ gkc_add_attr_tree(struct per_device_cache *pdevice_cache,
  * @params: entry: interface structure with input values
  * @return: true or success false on failure
  */
-bool
-gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
+static bool
+gkc_lookup_attribute_locked(struct gk_attr_cache_interface *req, bool update_count);
+
+static bool
+gkc_add_attribute_locked(struct gk_attr_cache_interface *entry)
 {
     struct gk_cache_mgr *mgr;
     struct per_device_cache *pdevice_cache;
@@ -381,7 +410,7 @@ gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
     mgr = gk_cache_get_mgr();
     if (!mgr->initialized) return false;
 
-    ret = gkc_lookup_attribute_entry(entry, false);
+    ret = gkc_lookup_attribute_locked(entry, false);
     if (ret)
     {
         LOGT("%s(): attribute entry " PRI_os_macaddr_lower_t " already present",
@@ -389,13 +418,6 @@ gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
         return false;
     }
 
-    if (mgr->count >= GK_MAX_CACHE_ENTRIES)
-    {
-        LOGN("%s() max cache entries %" PRIu64 " reached, cannot add entry to GK cache",
-             __func__, mgr->count);
-        return false;
-    }
-
     /* return if attribute type is not valid */
     if (entry->attribute_type < GK_CACHE_REQ_TYPE_FQDN
         || entry->attribute_type > GK_CACHE_REQ_TYPE_APP)
@@ -415,9 +437,6 @@ gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
     ret = gkc_add_attr_tree(pdevice_cache, entry);
     if (ret == false) return false;
 
-     /* increment cache entries counter */
-    mgr->count++;
-
     if (entry->action == FSM_ALLOW)
     {
         pdevice_cache->allowed[entry->attribute_type]++;
@@ -430,6 +449,20 @@ gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
     return true;
 }
 
+bool
+gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
+{
+    struct gk_cache_mgr *mgr;
+    bool ret;
+
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+    ret = gkc_add_attribute_locked(entry);
+    pthread_mutex_unlock(&mgr->lock);
+
+    return ret;
+}
+
 /**
  * @brief initializes the per device tree if not initialized and then
  *        adds the IP flow entry to it.
@@ -437,8 +470,11 @@ gkc_add_attribute_entry(struct gk_attr_cache_interface *entry)
  * @params: entry: IP flow interface structure with input values
  * @return: true or success false on failure
  */
-bool
-gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
+static bool
+gkc_lookup_flow_locked(struct gkc_ip_flow_interface *req, int update_count);
+
+static bool
+gkc_add_flow_locked(struct gkc_ip_flow_interface *entry)
 {
     struct per_device_cache *pdevice;
     enum gk_cache_request_type attr_type;
@@ -450,7 +486,7 @@ gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
 
     if (!entry->device_mac) return false;
 
-    ret = gkc_lookup_flow(entry, false);
+    ret = gkc_lookup_flow_locked(entry, false);
     if (ret)
     {
         LOGT("%s(): entry " PRI_os_macaddr_lower_t " already present",
@@ -458,13 +494,6 @@ gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
         return false;
     }
 
-    if (mgr->count >= GK_MAX_CACHE_ENTRIES)
-    {
-        LOGN("%s() max cache entries of %" PRIu64 " reached, cannot add entry to GK cache",
-             __func__, mgr->count);
-        return false;
-    }
-
     pdevice = ds_tree_find(&mgr->per_device_tree, entry->device_mac);
     if (pdevice == NULL)
     {
@@ -478,9 +507,6 @@ gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
     ret = gkc_add_flow_tree(pdevice, entry);
     if (ret == false) return false;
 
-    /* increment cache entries counter */
-    mgr->count++;
-
     /* set the attribute type */
     attr_type = (entry->direction == GKC_FLOW_DIRECTION_INBOUND
                  ? GK_CACHE_REQ_TYPE_INBOUND
@@ -492,12 +518,26 @@ gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
     }
     else
     {
-        pdevice->blocked[attr_type]--;
+        pdevice->blocked[attr_type]++;
     }
 
     return true;
 }
 
+bool
+gkc_add_flow_entry(struct gkc_ip_flow_interface *entry)
+{
+    struct gk_cache_mgr *mgr;
+    bool ret;
+
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+    ret = gkc_add_flow_locked(entry);
+    pthread_mutex_unlock(&mgr->lock);
+
+    return ret;
+}
+
 /**
  * @brief look up the device tree to the find the given
  *        device.
@@ -520,6 +560,25 @@ gkc_lookup_device_tree(os_macaddr_t *device_mac)
     return pdevice_cache;
 }
 
+/**
+ * @brief account for a cache lookup
+ *
+ * @params: found: whether the lookup succeeded
+ * @params: update_count: lookups done internally when adding
+ *          entries are not accounted for
+ */
+static void
+gkc_count_lookup(bool found, int update_count)
+{
+    struct gk_cache_mgr *mgr;
+
+    if (!update_count) return;
+
+    mgr = gk_cache_get_mgr();
+    if (found) mgr->stats.hits++;
+    else mgr->stats.misses++;
+}
+
 /**
  * @brief check if the given flow is present in the cache
  *
@@ -527,8 +586,8 @@ gkc_lookup_device_tree(os_macaddr_t *device_mac)
  *          tuple to find
  * @return: true if found false if not present
  */
-bool
-gkc_lookup_flow(struct gkc_ip_flow_interface *req, int update_count)
+static bool
+gkc_lookup_flow_locked(struct gkc_ip_flow_interface *req, int update_count)
 {
     struct per_device_cache *pdevice;
     int ret;
@@ -539,10 +598,29 @@ gkc_lookup_flow(struct gkc_ip_flow_interface *req, int update_count)
 
     /* look up the per device tree first */
     pdevice = gkc_lookup_device_tree(req->device_mac);
-    if (pdevice == NULL) return false;
+    if (pdevice == NULL)
+    {
+        gkc_count_lookup(false, update_count);
+        return false;
+    }
 
     /* lookup flows tree */
     ret = gkc_lookup_flows_for_device(pdevice, req, update_count);
+    gkc_count_lookup(ret, update_count);
+
+    return ret;
+}
+
+bool
+gkc_lookup_flow(struct gkc_ip_flow_interface *req, int update_count)
+{
+    struct gk_cache_mgr *mgr;
+    bool ret;
+
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+    ret = gkc_lookup_flow_locked(req, update_count);
+    pthread_mutex_unlock(&mgr->lock);
 
     return ret;
 }
@@ -567,14 +645,13 @@ gkc_del_flow(struct gkc_ip_flow_interface *req)
     ret = gkc_is_input_valid(req);
     if (ret == false) return false;
 
+    pthread_mutex_lock(&mgr->lock);
+
     /* first check if the device is present */
     pdevice = gkc_lookup_device_tree(req->device_mac);
-    if (pdevice == NULL) return false;
-
-    ret = gkc_del_flow_from_dev(pdevice, req);
-    if (ret == false) return false;
+    ret = (pdevice != NULL ? gkc_del_flow_from_dev(pdevice, req) : false);
 
-    mgr->count--;
+    pthread_mutex_unlock(&mgr->lock);
     return ret;
 }
 
@@ -591,7 +668,9 @@ gk_cache_init(void)
     struct gk_cache_mgr *mgr;
 
     mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
     gk_cache_init_mgr(mgr);
+    pthread_mutex_unlock(&mgr->lock);
 
     return true;
 }
@@ -608,10 +687,13 @@ gkc_cleanup_mgr(void)
 {
     struct gk_cache_mgr *mgr = gk_cache_get_mgr();
 
-    if (!mgr->initialized) return;
+    /* locks the cache on its own */
     gk_cache_cleanup();
+
+    pthread_mutex_lock(&mgr->lock);
     mgr->initialized = false;
     mgr->count = 0;
+    pthread_mutex_unlock(&mgr->lock);
 }
 
 void
@@ -652,6 +734,7 @@ gkc_lookup_attr_tree(ds_tree_t *tree, struct gk_attr_cache_interface *req, int u
     if (update_count)
     {
         attr_entry->hit_count++;
+        gkc_entry_touch(&attr_entry->node);
     }
 
     /* update the request with hit counter */
@@ -765,8 +848,8 @@ gkc_lookup_attributes_tree(struct per_device_cache *pdevice,
  *
  * @return true for success and false for failure.
  */
-bool
-gkc_lookup_attribute_entry(struct gk_attr_cache_interface *req, bool update_count)
+static bool
+gkc_lookup_attribute_locked(struct gk_attr_cache_interface *req, bool update_count)
 {
     struct per_device_cache *pdevice;
     bool ret;
@@ -779,10 +862,15 @@ gkc_lookup_attribute_entry(struct gk_attr_cache_interface *req, bool update_coun
 
     /* look up the per device tree first */
     pdevice = gkc_lookup_device_tree(req->device_mac);
-    if (pdevice == NULL) return false;
+    if (pdevice == NULL)
+    {
+        gkc_count_lookup(false, update_count);
+        return false;
+    }
 
     /* lookup the attributes tree */
     ret = gkc_lookup_attributes_tree(pdevice, req, update_count);
+    gkc_count_lookup(ret, update_count);
     if (ret == false) return ret;
 
     /* update the time statmp */
@@ -791,6 +879,20 @@ gkc_lookup_attribute_entry(struct gk_attr_cache_interface *req, bool update_coun
     return ret;
 }
 
+bool
+gkc_lookup_attribute_entry(struct gk_attr_cache_interface *req, bool update_count)
+{
+    struct gk_cache_mgr *mgr;
+    bool ret;
+
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+    ret = gkc_lookup_attribute_locked(req, update_count);
+    pthread_mutex_unlock(&mgr->lock);
+
+    return ret;
+}
+
 /**
  * @brief Delete fqdn entry.
  *
@@ -810,34 +912,31 @@ gkc_del_attribute(struct gk_attr_cache_interface *req)
 
     if (!req || !req->device_mac) return false;
 
+    pthread_mutex_lock(&mgr->lock);
+
     /* first check if the device is present */
     pdevice = gkc_lookup_device_tree(req->device_mac);
-    if (pdevice == NULL) return false;
-
-    ret = gkc_del_attr_from_dev(pdevice, req);
-    if (ret == false) return false;
-
-    mgr->count--;
+    ret = (pdevice != NULL ? gkc_del_attr_from_dev(pdevice, req) : false);
 
+    pthread_mutex_unlock(&mgr->lock);
     return ret;
 }
 
 /**
  * @brief remove old cache entres.
  *
- * @param ttl the cache entry time to live
+ * Only the timer wheel slots elapsed since the previous call are
+ * visited.
  */
 void
 gkc_ttl_cleanup(void)
 {
     struct gk_cache_mgr *mgr;
-    ds_tree_t *tree;
 
     mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
-
-    tree = &mgr->per_device_tree;
-    gk_cache_check_ttl_device_tree(tree);
+    pthread_mutex_lock(&mgr->lock);
+    gkc_timer_wheel_expire(time(NULL));
+    pthread_mutex_unlock(&mgr->lock);
 }
 
 /**
@@ -872,12 +971,15 @@ gk_get_device_count(void)
     mgr       = gk_cache_get_mgr();
     tree      = &mgr->per_device_tree;
 
-    if (!mgr->initialized) return count;
-
-    ds_tree_foreach(tree, pdevice)
+    pthread_mutex_lock(&mgr->lock);
+    if (mgr->initialized)
     {
-        count++;
+        ds_tree_foreach(tree, pdevice)
+        {
+            count++;
+        }
     }
+    pthread_mutex_unlock(&mgr->lock);
 
     return count;
 }
@@ -894,6 +996,8 @@ gkc_get_allowed_counter(os_macaddr_t *device_mac,
                         enum gk_cache_request_type attr_type)
 {
     struct per_device_cache *pdevice;
+    struct gk_cache_mgr *mgr;
+    uint64_t counter;
 
     if (!device_mac) return 0;
 
@@ -901,11 +1005,15 @@ gkc_get_allowed_counter(os_macaddr_t *device_mac,
         || attr_type >= GK_CACHE_MAX_REQ_TYPES)
         return 0;
 
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+
     /* look up the per device tree first */
     pdevice = gkc_lookup_device_tree(device_mac);
-    if (pdevice == NULL) return 0;
+    counter = (pdevice != NULL ? pdevice->allowed[attr_type] : 0);
 
-    return pdevice->allowed[attr_type];
+    pthread_mutex_unlock(&mgr->lock);
+    return counter;
 }
 
 /**
@@ -921,6 +1029,8 @@ gkc_get_blocked_counter(os_macaddr_t *device_mac,
                         enum gk_cache_request_type attr_type)
 {
     struct per_device_cache *pdevice;
+    struct gk_cache_mgr *mgr;
+    uint64_t counter;
 
     if (!device_mac) return 0;
 
@@ -928,11 +1038,15 @@ gkc_get_blocked_counter(os_macaddr_t *device_mac,
         || attr_type >= GK_CACHE_MAX_REQ_TYPES)
         return 0;
 
+    mgr = gk_cache_get_mgr();
+    pthread_mutex_lock(&mgr->lock);
+
     /* look up the per device tree first */
     pdevice = gkc_lookup_device_tree(device_mac);
-    if (pdevice == NULL) return 0;
+    counter = (pdevice != NULL ? pdevice->blocked[attr_type] : 0);
 
-    return pdevice->blocked[attr_type];
+    pthread_mutex_unlock(&mgr->lock);
+    return counter;
 }
 
 static void
@@ -1019,7 +1133,12 @@ gkc_cache_entries(void)
     ds_tree_t *subtree = NULL;
 
     mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
+    pthread_mutex_lock(&mgr->lock);
+    if (!mgr->initialized)
+    {
+        pthread_mutex_unlock(&mgr->lock);
+        return;
+    }
 
     tree = &mgr->per_device_tree;
 
@@ -1072,6 +1191,7 @@ gkc_cache_entries(void)
         dump_flow_tree(subtree);
     }
     LOGT("=====END=====");
+    pthread_mutex_unlock(&mgr->lock);
     return;
 }
 
@@ -179,71 +179,15 @@ gk_cache_cleanup(void)
     ds_tree_t *tree;
 
     mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
-
-    tree = &mgr->per_device_tree;
-    gk_free_cache_tree(tree);
-    mgr->count = 0;
-}
-
-/**
- * @brief check if the TTL is expired for the given
- *        attribute
- * @params: attr_entry pointer to attribute tree
- * @return true on success, false on failure
- */
-static bool
-gkc_attr_ttl_expired(struct attr_cache *attr_entry)
-{
-    time_t now;
-    now = time(NULL);
-
-    /* check if TTL is expired*/
-    if ((now - attr_entry->cache_ts) < attr_entry->cache_ttl)
+    pthread_mutex_lock(&mgr->lock);
+    if (mgr->initialized)
     {
-        return false;
-    }
-    return true;
-}
-
-static const char *
-gk_get_attribute_value(struct attr_cache *attr_entry,
-                       enum gk_cache_request_type attr_type)
-{
-    switch (attr_type)
-    {
-        case GK_CACHE_REQ_TYPE_FQDN:
-            return attr_entry->attr.fqdn;
-            break;
-
-        case GK_CACHE_REQ_TYPE_URL:
-            return attr_entry->attr.url;
-            break;
-
-        case GK_CACHE_REQ_TYPE_HOST:
-            return attr_entry->attr.host;
-            break;
-
-        case GK_CACHE_REQ_TYPE_SNI:
-            return attr_entry->attr.sni;
-            break;
-
-        case GK_CACHE_REQ_TYPE_IPV4:
-            return attr_entry->attr.ipv4;
-            break;
-
-        case GK_CACHE_REQ_TYPE_IPV6:
-            return attr_entry->attr.ipv6;
-            break;
-
-        case GK_CACHE_REQ_TYPE_APP:
-            return attr_entry->attr.app_name;
-            break;
-
-        default:
-            return "unknown";
-            break;
+        tree = &mgr->per_device_tree;
+        gk_free_cache_tree(tree);
+        gkc_lru_init(mgr);
+        mgr->count = 0;
     }
+    pthread_mutex_unlock(&mgr->lock);
 }
 
 static ds_tree_t *
@@ -290,161 +234,24 @@ gk_get_attribute_tree(struct per_device_cache *pdevice, int attr_type)
 }
 
 /**
- * @brief delete the given attribute from the attr
- *        tree if TTL is expired
- *
- * @params: gk_del_info cache delete info structure
- */
-
-static void
-gkc_cleanup_ttl_attribute_tree(struct gkc_del_info_s *gk_del_info)
-{
-    struct attr_cache *attr_entry, *remove;
-    struct gk_cache_mgr *mgr;
-    bool ttl_expired;
-
-    mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
-
-    attr_entry = ds_tree_head(gk_del_info->tree);
-    while (attr_entry != NULL)
-    {
-        remove      = attr_entry;
-        attr_entry  = ds_tree_next(gk_del_info->tree, attr_entry);
-        ttl_expired = gkc_attr_ttl_expired(remove);
-        if (ttl_expired == false) continue;
-
-        LOGT("%s: Removing attribute '%s', for device " PRI_os_macaddr_lower_t
-             " due to expired TTL",
-             __func__,
-             gk_get_attribute_value(remove, gk_del_info->attr_type),
-             FMT_os_macaddr_pt(gk_del_info->pdevice->device_mac));
-
-        free_attr_members(remove, gk_del_info->attr_type);
-
-        gk_del_info->attr_del_count++;
-
-        /* decrement the cache entries counter */
-        mgr->count--;
-        if (remove->gk_policy) free(remove->gk_policy);
-        ds_tree_remove(gk_del_info->tree, remove);
-        free(remove);
-    }
-}
-
-/**
- * @brief deletes attributes with expired TTL value
- *
- * @params: pdevice pointer to device structure
- */
-static void
-gk_cache_check_ttl_per_device(struct per_device_cache *pdevice)
-{
-    struct gkc_del_info_s *gk_del_info;
-    int attr_type;
-
-    gk_del_info = calloc(1, sizeof(struct gkc_del_info_s));
-    if (gk_del_info == NULL) return;
-
-    gk_del_info->pdevice = pdevice;
-
-    /* loop through all the attributes and check for TTL expiry */
-    for (attr_type = GK_CACHE_REQ_TYPE_FQDN; attr_type <= GK_CACHE_REQ_TYPE_APP; attr_type++)
-    {
-        gk_del_info->attr_type = attr_type;
-        /* get the tree for this attribute type */
-        gk_del_info->tree = gk_get_attribute_tree(pdevice, attr_type);
-        gkc_cleanup_ttl_attribute_tree(gk_del_info);
-    }
-
-    /* check the flow inbound tree */
-    gk_del_info->attr_type = GK_CACHE_REQ_TYPE_INBOUND;
-    gk_del_info->tree = &pdevice->inbound_tree;
-    gkc_cleanup_ttl_flow_tree(gk_del_info);
-
-    /* check the flow outbound tree */
-    gk_del_info->attr_type = GK_CACHE_REQ_TYPE_OUTBOUDND;
-    gk_del_info->tree = &pdevice->outbound_tree;
-    gkc_cleanup_ttl_flow_tree(gk_del_info);
-
-    LOGT("%s: number of expired TTL entries for device: " PRI_os_macaddr_lower_t
-         " attribute type: %"PRIu64", flow type %"PRIu64,
-         __func__,
-         FMT_os_macaddr_pt(pdevice->device_mac),
-         gk_del_info->attr_del_count,
-         gk_del_info->flow_del_count);
-
-    free(gk_del_info);
-}
-
-/**
- * @brief deletes all the flows and attributes with
- *        expired TTL
+ * @brief free an attribute entry, removing it from its device tree,
+ *        the LRU list and the timer wheel
  *
- * @params: tree device tree structure check and
- *          and delete entries.
+ * @params: attr_entry the entry to free
  */
 void
-gk_cache_check_ttl_device_tree(ds_tree_t *tree)
-{
-    struct per_device_cache *pdevice, *current;
-
-    LOGT("%s cache entries before flushing expired TTL entries: %lu",
-         __func__, gk_get_cache_count());
-
-    pdevice = ds_tree_head(tree);
-    while (pdevice != NULL)
-    {
-        current = pdevice;
-        pdevice = ds_tree_next(tree, pdevice);
-        gk_cache_check_ttl_per_device(current);
-    }
-    LOGT("%s cache entries after flushing expired TTL entries: %lu",
-         __func__, gk_get_cache_count());
-}
-
-static bool
-gkc_is_attr_present(struct attr_cache *attr_entry,
-                    struct gk_attr_cache_interface *req)
+gkc_free_attr_entry(struct attr_cache *attr_entry)
 {
-    int rc;
-
-    switch (req->attribute_type)
-    {
-    case GK_CACHE_REQ_TYPE_FQDN:
-        rc = strcmp(attr_entry->attr.fqdn, req->attr_name);
-        break;
-
-    case GK_CACHE_REQ_TYPE_URL:
-        rc = strcmp(attr_entry->attr.url, req->attr_name);
-        break;
-
-    case GK_CACHE_REQ_TYPE_HOST:
-        rc = strcmp(attr_entry->attr.host, req->attr_name);
-        break;
-
-    case GK_CACHE_REQ_TYPE_SNI:
-        rc = strcmp(attr_entry->attr.sni, req->attr_name);
-        break;
-
-    case GK_CACHE_REQ_TYPE_IPV4:
-        rc = strcmp(attr_entry->attr.ipv4, req->attr_name);
-        break;
+    ds_tree_t *tree;
 
-    case GK_CACHE_REQ_TYPE_IPV6:
-        rc = strcmp(attr_entry->attr.ipv6, req->attr_name);
-        break;
+    tree = gk_get_attribute_tree(attr_entry->node.pdevice, attr_entry->node.type);
+    if (tree != NULL) ds_tree_remove(tree, attr_entry);
 
-    case GK_CACHE_REQ_TYPE_APP:
-        rc = strcmp(attr_entry->attr.app_name, req->attr_name);
-        break;
+    gkc_entry_unlink(&attr_entry->node);
 
-    default:
-        return false;
-        break;
-    }
-
-    return (rc == 0);
+    free_attr_members(attr_entry, attr_entry->node.type);
+    if (attr_entry->gk_policy) free(attr_entry->gk_policy);
+    free(attr_entry);
 }
 
 /**
@@ -459,31 +266,18 @@ gkc_is_attr_present(struct attr_cache *attr_entry,
 static bool
 gkc_del_attr(ds_tree_t *attr_tree, struct gk_attr_cache_interface *req)
 {
-    struct attr_cache *attr_entry, *remove;
-    int rc;
+    struct attr_cache *remove;
 
-    attr_entry = ds_tree_head(attr_tree);
-    while (attr_entry != NULL)
-    {
-        remove     = attr_entry;
-        attr_entry = ds_tree_next(attr_tree, attr_entry);
+    remove = ds_tree_find(attr_tree, req->attr_name);
+    if (remove == NULL) return false;
 
-        rc = gkc_is_attr_present(remove, req);
-        if (rc == false) continue;
-
-        LOGD("%s: deleting attribute %s for device " PRI_os_macaddr_lower_t " ",
-             __func__,
-             req->attr_name,
-             FMT_os_macaddr_pt(req->device_mac));
-
-        free_attr_members(remove, req->attribute_type);
-        if (remove->gk_policy) free(remove->gk_policy);
-        ds_tree_remove(attr_tree, remove);
-        free(remove);
-        return true;
-    }
+    LOGD("%s: deleting attribute %s for device " PRI_os_macaddr_lower_t " ",
+         __func__,
+         req->attr_name,
+         FMT_os_macaddr_pt(req->device_mac));
 
-    return false;
+    gkc_free_attr_entry(remove);
+    return true;
 }
 
 /**
@@ -65,6 +65,13 @@ gkc_new_flow_entry(struct gkc_ip_flow_interface *req)
     flow_entry->cache_ttl = req->cache_ttl;
     flow_entry->action    = req->action;
 
+    /* set the LRU and timer wheel bookkeeping */
+    flow_entry->node.type = (req->direction == GKC_FLOW_DIRECTION_INBOUND
+                             ? GK_CACHE_REQ_TYPE_INBOUND
+                             : GK_CACHE_REQ_TYPE_OUTBOUDND);
+    flow_entry->node.expiry = flow_entry->cache_ts + flow_entry->cache_ttl;
+    flow_entry->node.mem_size = sizeof(*flow_entry) + 2 * sizeof(struct in6_addr);
+
     return flow_entry;
 
 err_free_sip:
@@ -124,6 +131,11 @@ gkc_add_flow_tree(struct per_device_cache *pdevice,
     flow_entry = gkc_new_flow_entry(req);
     if (flow_entry == NULL) return false;
 
+    flow_entry->node.pdevice = pdevice;
+
+    /* evict the least recently used entries if the cache is full */
+    gkc_make_room(flow_entry->node.mem_size);
+
     if (req->direction == GKC_FLOW_DIRECTION_INBOUND)
     {
         ds_tree_insert(&pdevice->inbound_tree, flow_entry, flow_entry);
@@ -133,5 +145,7 @@ gkc_add_flow_tree(struct per_device_cache *pdevice,
         ds_tree_insert(&pdevice->outbound_tree, flow_entry, flow_entry);
     }
 
+    gkc_entry_link(&flow_entry->node);
+
     return true;
 }
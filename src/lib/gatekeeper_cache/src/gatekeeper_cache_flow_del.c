@@ -31,33 +31,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  * @params: true is same, false if different
  */
-static bool
-gkc_is_flow_present(struct ip_flow_cache *cur_flow_entry,
-                    struct gkc_ip_flow_interface *req)
-{
-    struct ip_flow_cache flow_entry;
-    int ret = false;
-    int rc;
-
-    flow_entry.ip_version  = req->ip_version;
-    flow_entry.src_ip_addr = req->src_ip_addr;
-    flow_entry.dst_ip_addr = req->dst_ip_addr;
-    flow_entry.src_port    = req->src_port;
-    flow_entry.dst_port    = req->dst_port;
-    flow_entry.protocol    = req->protocol;
-    flow_entry.direction   = req->direction;
-
-    /* check if the 5-tuples are equal */
-    rc = gkc_flow_entry_cmp(cur_flow_entry, &flow_entry);
-    if (rc == 0)
-    {
-        /* found the flow entry */
-        ret = true;
-    }
-
-    return ret;
-}
-
 /**
  * @brief free memory used by the flow entry
  *
@@ -71,6 +44,34 @@ free_flow_members(struct ip_flow_cache *flow_entry)
     free(flow_entry->src_ip_addr);
 }
 
+/**
+ * @brief free a flow entry, removing it from its device tree,
+ *        the LRU list and the timer wheel
+ *
+ * @params: flow_entry the entry to free
+ */
+void
+gkc_free_flow_entry(struct ip_flow_cache *flow_entry)
+{
+    struct per_device_cache *pdevice;
+
+    pdevice = flow_entry->node.pdevice;
+    if (flow_entry->node.type == GK_CACHE_REQ_TYPE_INBOUND)
+    {
+        ds_tree_remove(&pdevice->inbound_tree, flow_entry);
+    }
+    else
+    {
+        ds_tree_remove(&pdevice->outbound_tree, flow_entry);
+    }
+
+    gkc_entry_unlink(&flow_entry->node);
+
+    free_flow_members(flow_entry);
+    if (flow_entry->gk_policy) free(flow_entry->gk_policy);
+    free(flow_entry);
+}
+
 /**
  * @brief delete the given flow from the flow tree
  *
@@ -82,35 +83,27 @@ free_flow_members(struct ip_flow_cache *flow_entry)
 static bool
 gkc_del_flow_from_tree(ds_tree_t *flow_tree, struct gkc_ip_flow_interface *req)
 {
-    struct ip_flow_cache *flow_entry, *remove;
-    int rc;
+    struct ip_flow_cache flow_entry;
+    struct ip_flow_cache *remove;
 
-    /* loop through all flows in the tree */
-    flow_entry = ds_tree_head(flow_tree);
-    while (flow_entry != NULL)
-    {
-        remove = flow_entry;
-        flow_entry = ds_tree_next(flow_tree, flow_entry);
-
-        /* check if this is the flow that needs to be removed */
-        rc = gkc_is_flow_present(remove, req);
-        if (rc == false) continue;
-
-        LOGT("%s: deleting flow for device " PRI_os_macaddr_lower_t " ",
-             __func__,
-             FMT_os_macaddr_pt(req->device_mac));
-
-        /* found the flow. Free memory used by the flow structure.*/
-        free_flow_members(remove);
-        if (remove->gk_policy) free(remove->gk_policy);
-        /* remove it from the tree*/
-        ds_tree_remove(flow_tree, remove);
-        /* free the entry */
-        free(remove);
-        return true;
-    }
+    flow_entry.ip_version  = req->ip_version;
+    flow_entry.src_ip_addr = req->src_ip_addr;
+    flow_entry.dst_ip_addr = req->dst_ip_addr;
+    flow_entry.src_port    = req->src_port;
+    flow_entry.dst_port    = req->dst_port;
+    flow_entry.protocol    = req->protocol;
+    flow_entry.direction   = req->direction;
+
+    /* search for the flow that needs to be removed */
+    remove = ds_tree_find(flow_tree, &flow_entry);
+    if (remove == NULL) return false;
+
+    LOGT("%s: deleting flow for device " PRI_os_macaddr_lower_t " ",
+         __func__,
+         FMT_os_macaddr_pt(req->device_mac));
 
-    return false;
+    gkc_free_flow_entry(remove);
+    return true;
 }
 
 /**
@@ -146,62 +139,3 @@ gkc_del_flow_from_dev(struct per_device_cache *pdevice,
 
     return ret;
 }
-
-static bool
-gkc_flow_ttl_expired(struct ip_flow_cache *flow_entry)
-{
-    time_t now;
-    now = time(NULL);
-
-    /* check if TTL is expired */
-    if ((now - flow_entry->cache_ts) < flow_entry->cache_ttl) return false;
-
-    return true;
-}
-
-/**
- * @brief delete the given flow from the flow
- *        tree if TTL is expired
- *
- * @params: gk_del_info cache delete info structure
- */
-void
-gkc_cleanup_ttl_flow_tree(struct gkc_del_info_s *gk_del_info)
-{
-    struct ip_flow_cache *flow_entry, *remove;
-    struct gk_cache_mgr *mgr;
-    bool ttl_expired;
-
-    mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
-
-    /* loop through all flows in the tree */
-    flow_entry = ds_tree_head(gk_del_info->tree);
-    while (flow_entry != NULL)
-    {
-        remove     = flow_entry;
-        flow_entry = ds_tree_next(gk_del_info->tree, flow_entry);
-
-        /* check if the TTL value is expired for this flow */
-        ttl_expired = gkc_flow_ttl_expired(remove);
-        if (ttl_expired == false) continue;
-
-        LOGD("%s: deleting flow for device " PRI_os_macaddr_lower_t
-             " with expired TTL",
-             __func__,
-             FMT_os_macaddr_pt(gk_del_info->pdevice->device_mac));
-
-        gk_del_info->flow_del_count++;
-
-        /* decrement the cache count */
-        mgr->count--;
-
-        /* found the flow. Free memory used by the flow structure.*/
-        free_flow_members(remove);
-        if (remove->gk_policy) free(remove->gk_policy);
-        /* remove it from the tree*/
-        ds_tree_remove(gk_del_info->tree, remove);
-        /* free the entry */
-        free(remove);
-    }
-}
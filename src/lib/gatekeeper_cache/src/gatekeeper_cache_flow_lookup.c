@@ -58,6 +58,7 @@ gkc_lookup_flows_tree(ds_tree_t *tree, struct gkc_ip_flow_interface *req, int up
         if (update_count)
         {
             target_entry->hit_count++;
+            gkc_entry_touch(&target_entry->node);
         }
         req->hit_counter = target_entry->hit_count;
     }
@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "gatekeeper_cache.h"
+#include "log.h"
+#include "ds.h"
+
+/**
+ * @brief initialize the LRU list and the timer wheel slots
+ *
+ * @params: mgr the cache manager
+ */
+void
+gkc_lru_init(struct gk_cache_mgr *mgr)
+{
+    int i;
+
+    ds_dlist_init(&mgr->lru_list, struct gkc_entry_node, lru_node);
+    for (i = 0; i < GKC_TIMER_WHEEL_SLOTS; i++)
+    {
+        ds_dlist_init(&mgr->timer_wheel[i], struct gkc_entry_node, timer_node);
+    }
+    mgr->mem_used = 0;
+}
+
+/**
+ * @brief free an attribute or flow entry given its bookkeeping node
+ *
+ * @params: node the entry bookkeeping node
+ */
+static void
+gkc_free_entry(struct gkc_entry_node *node)
+{
+    if (node->type == GK_CACHE_REQ_TYPE_INBOUND
+        || node->type == GK_CACHE_REQ_TYPE_OUTBOUDND)
+    {
+        gkc_free_flow_entry(CONTAINER_OF(node, struct ip_flow_cache, node));
+    }
+    else
+    {
+        gkc_free_attr_entry(CONTAINER_OF(node, struct attr_cache, node));
+    }
+}
+
+void
+gkc_entry_link(struct gkc_entry_node *node)
+{
+    struct gk_cache_mgr *mgr;
+    time_t slot_ts;
+
+    mgr = gk_cache_get_mgr();
+
+    ds_dlist_insert_head(&mgr->lru_list, node);
+
+    /* already expired entries go in the next slot to be processed */
+    slot_ts = node->expiry;
+    if (slot_ts <= mgr->wheel_ts) slot_ts = mgr->wheel_ts + 1;
+    node->slot = slot_ts % GKC_TIMER_WHEEL_SLOTS;
+    ds_dlist_insert_tail(&mgr->timer_wheel[node->slot], node);
+
+    mgr->mem_used += node->mem_size;
+    mgr->count++;
+}
+
+void
+gkc_entry_unlink(struct gkc_entry_node *node)
+{
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+
+    ds_dlist_remove(&mgr->lru_list, node);
+    ds_dlist_remove(&mgr->timer_wheel[node->slot], node);
+
+    mgr->mem_used -= node->mem_size;
+    mgr->count--;
+}
+
+void
+gkc_entry_touch(struct gkc_entry_node *node)
+{
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+    if (ds_dlist_head(&mgr->lru_list) == node) return;
+
+    ds_dlist_remove(&mgr->lru_list, node);
+    ds_dlist_insert_head(&mgr->lru_list, node);
+}
+
+void
+gkc_make_room(size_t mem_size)
+{
+    struct gkc_entry_node *node;
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+
+    while (mgr->count >= mgr->max_entries
+           || mgr->mem_used + mem_size > mgr->mem_budget)
+    {
+        node = ds_dlist_tail(&mgr->lru_list);
+        if (node == NULL) return;
+
+        LOGD("%s: evicting entry type %d for device " PRI_os_macaddr_lower_t,
+             __func__, node->type, FMT_os_macaddr_pt(node->pdevice->device_mac));
+
+        gkc_free_entry(node);
+        mgr->stats.evictions++;
+    }
+}
+
+void
+gkc_timer_wheel_expire(time_t now)
+{
+    struct gkc_entry_node *node, *next;
+    struct gk_cache_mgr *mgr;
+    uint64_t expired;
+    ds_dlist_t *slot;
+    time_t ticks;
+    time_t i;
+
+    mgr = gk_cache_get_mgr();
+    if (!mgr->initialized) return;
+
+    /* the clock went backward: restart the wheel from now */
+    if (now < mgr->wheel_ts)
+    {
+        mgr->wheel_ts = now;
+        return;
+    }
+
+    /* a full turn of the wheel visits every slot */
+    ticks = now - mgr->wheel_ts;
+    if (ticks > GKC_TIMER_WHEEL_SLOTS) ticks = GKC_TIMER_WHEEL_SLOTS;
+
+    expired = mgr->stats.expired;
+    for (i = 1; i <= ticks; i++)
+    {
+        slot = &mgr->timer_wheel[(mgr->wheel_ts + i) % GKC_TIMER_WHEEL_SLOTS];
+
+        node = ds_dlist_head(slot);
+        while (node != NULL)
+        {
+            next = ds_dlist_next(slot, node);
+
+            /* entries due in a later turn of the wheel are kept */
+            if (node->expiry <= now)
+            {
+                LOGT("%s: removing entry type %d for device " PRI_os_macaddr_lower_t
+                     " due to expired TTL",
+                     __func__, node->type,
+                     FMT_os_macaddr_pt(node->pdevice->device_mac));
+
+                gkc_free_entry(node);
+                mgr->stats.expired++;
+            }
+            node = next;
+        }
+    }
+    mgr->wheel_ts = now;
+
+    LOGT("%s: %" PRIu64 " expired entries removed, %" PRIu64 " entries left",
+         __func__, mgr->stats.expired - expired, mgr->count);
+}
+
+struct gkc_stats *
+gkc_get_stats(void)
+{
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+    return &mgr->stats;
+}
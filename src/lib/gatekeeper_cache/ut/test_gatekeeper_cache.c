@@ -1027,7 +1027,9 @@ test_max_attr_entries(void)
 {
     LOGI("starting test: %s ...", __func__);
     struct gk_attr_cache_interface *entry;
+    struct gk_cache_mgr *mgr;
     int current_count;
+    int deleted;
     int ret;
     int i;
 
@@ -1050,8 +1052,16 @@ test_max_attr_entries(void)
     }
 
     current_count = gk_get_cache_count();
+    mgr = gk_cache_get_mgr();
+    TEST_ASSERT_TRUE(mgr->count <= mgr->max_entries);
+    TEST_ASSERT_TRUE(mgr->mem_used <= mgr->mem_budget);
 
-    for (i = 0; i < 10; i++)
+    /*
+     * the oldest entries were evicted, delete the most recent ones.
+     * The sample has duplicated entries, only count the actual deletions.
+     */
+    deleted = 0;
+    for (i = MAX_CACHE_ENTRIES - 1; deleted < 10; i--)
     {
         entry->action         = 1;
         entry->device_mac     = gkc_str2os_mac(test_attr_entries[i].mac_str);
@@ -1059,7 +1069,7 @@ test_max_attr_entries(void)
         entry->cache_ttl      = 1000;
         entry->action         = FSM_BLOCK;
         entry->attr_name      = strdup(test_attr_entries[i].attr_name);
-        gkc_del_attribute(entry);
+        if (gkc_del_attribute(entry)) deleted++;
 
         free(entry->device_mac);
         free(entry->attr_name);
@@ -1158,6 +1168,178 @@ error:
 
 }
 
+void
+test_lru_eviction(void)
+{
+    struct gk_cache_mgr *mgr;
+    uint64_t evictions;
+    int ret;
+
+    LOGI("starting test: %s ...", __func__);
+
+    mgr = gk_cache_get_mgr();
+    mgr->max_entries = 4;
+    evictions = gkc_get_stats()->evictions;
+
+    gkc_add_attribute_entry(entry1);
+    gkc_add_attribute_entry(entry2);
+    gkc_add_attribute_entry(entry3);
+    gkc_add_attribute_entry(entry4);
+    TEST_ASSERT_EQUAL_INT(4, gk_get_cache_count());
+
+    /* entry1 becomes the most recently used entry */
+    ret = gkc_lookup_attribute_entry(entry1, true);
+    TEST_ASSERT_TRUE(ret);
+
+    /* the cache is full: entry2, the least recently used, is evicted */
+    ret = gkc_add_attribute_entry(entry5);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_INT(4, gk_get_cache_count());
+    TEST_ASSERT_EQUAL_INT(evictions + 1, gkc_get_stats()->evictions);
+
+    ret = gkc_lookup_attribute_entry(entry2, true);
+    TEST_ASSERT_FALSE(ret);
+    ret = gkc_lookup_attribute_entry(entry1, true);
+    TEST_ASSERT_TRUE(ret);
+    ret = gkc_lookup_attribute_entry(entry5, true);
+    TEST_ASSERT_TRUE(ret);
+
+    /* flows share the same LRU list: entry3 goes next */
+    ret = gkc_add_flow_entry(flow_entry1);
+    TEST_ASSERT_TRUE(ret);
+    ret = gkc_lookup_attribute_entry(entry3, true);
+    TEST_ASSERT_FALSE(ret);
+    ret = gkc_lookup_flow(flow_entry1, true);
+    TEST_ASSERT_TRUE(ret);
+
+    /* a memory budget exhausted evicts entries as well */
+    mgr->max_entries = GK_MAX_CACHE_ENTRIES;
+    mgr->mem_budget = mgr->mem_used;
+    ret = gkc_add_attribute_entry(entry2);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_TRUE(mgr->mem_used <= mgr->mem_budget);
+    ret = gkc_lookup_attribute_entry(entry4, true);
+    TEST_ASSERT_FALSE(ret);
+
+    mgr->mem_budget = GK_CACHE_MAX_MEM;
+
+    LOGI("ending test: %s", __func__);
+}
+
+void
+test_timer_wheel(void)
+{
+    struct gk_cache_mgr *mgr;
+    uint64_t expired;
+    time_t now;
+    int ret;
+
+    LOGI("starting test: %s ...", __func__);
+
+    mgr = gk_cache_get_mgr();
+    expired = gkc_get_stats()->expired;
+    now = time(NULL);
+
+    entry1->cache_ttl = 10;
+    gkc_add_attribute_entry(entry1);
+    entry2->cache_ttl = 1000;
+    gkc_add_attribute_entry(entry2);
+    flow_entry1->cache_ttl = 10;
+    gkc_add_flow_entry(flow_entry1);
+
+    gkc_timer_wheel_expire(now + 5);
+    TEST_ASSERT_EQUAL_INT(3, gk_get_cache_count());
+
+    gkc_timer_wheel_expire(now + 11);
+    TEST_ASSERT_EQUAL_INT(1, gk_get_cache_count());
+    TEST_ASSERT_EQUAL_INT(expired + 2, gkc_get_stats()->expired);
+    ret = gkc_lookup_attribute_entry(entry1, true);
+    TEST_ASSERT_FALSE(ret);
+    ret = gkc_lookup_flow(flow_entry1, true);
+    TEST_ASSERT_FALSE(ret);
+
+    /* entry2 is not due on this turn of the wheel */
+    gkc_timer_wheel_expire(now + 11 + GKC_TIMER_WHEEL_SLOTS);
+    ret = gkc_lookup_attribute_entry(entry2, true);
+    TEST_ASSERT_TRUE(ret);
+
+    gkc_timer_wheel_expire(now + 1001);
+    ret = gkc_lookup_attribute_entry(entry2, true);
+    TEST_ASSERT_FALSE(ret);
+    TEST_ASSERT_EQUAL_INT(0, gk_get_cache_count());
+    TEST_ASSERT_EQUAL_INT(0, mgr->mem_used);
+
+    mgr->wheel_ts = time(NULL);
+
+    LOGI("ending test: %s", __func__);
+}
+
+void
+test_lru_benchmark(void)
+{
+    struct gk_attr_cache_interface entry;
+    struct timespec start, end;
+    struct gk_cache_mgr *mgr;
+    double add_time, lookup_time, expire_time;
+    char name[64];
+    int nentries;
+    int hits;
+    int i;
+
+    LOGI("starting test: %s ...", __func__);
+
+    mgr = gk_cache_get_mgr();
+    mgr->max_entries = 50000;
+    nentries = 2 * mgr->max_entries;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.device_mac = entry1->device_mac;
+    entry.attribute_type = GK_CACHE_REQ_TYPE_FQDN;
+    entry.action = FSM_ALLOW;
+    entry.attr_name = name;
+
+    /* the second half of the adds evicts the first half */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nentries; i++)
+    {
+        snprintf(name, sizeof(name), "www.bench%d.com", i);
+        entry.cache_ttl = 60 + (i % 600);
+        gkc_add_attribute_entry(&entry);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    add_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    TEST_ASSERT_EQUAL_INT(mgr->max_entries, gk_get_cache_count());
+
+    hits = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nentries; i++)
+    {
+        snprintf(name, sizeof(name), "www.bench%d.com", i);
+        hits += gkc_lookup_attribute_entry(&entry, true);
+        FREE(entry.gk_policy);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lookup_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    TEST_ASSERT_EQUAL_INT(mgr->max_entries, hits);
+
+    /* one second of the wheel only visits the entries due then */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    gkc_timer_wheel_expire(mgr->wheel_ts + 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    expire_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    LOGI("%s: %d adds (%" PRIu64 " evictions) in %.3f s, %d lookups in %.3f s,"
+         " expiry tick over %" PRIu64 " entries in %.6f s, memory used %zu",
+         __func__, nentries, gkc_get_stats()->evictions, add_time,
+         nentries, lookup_time, gk_get_cache_count(), expire_time,
+         mgr->mem_used);
+
+    mgr->max_entries = GK_MAX_CACHE_ENTRIES;
+    mgr->wheel_ts = time(NULL);
+
+    LOGI("ending test: %s", __func__);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1189,5 +1371,8 @@ main(int argc, char *argv[])
     RUN_TEST(test_max_attr_entries);
     RUN_TEST(test_max_flow_entries);
     RUN_TEST(test_host_entry_in_fqdn);
+    RUN_TEST(test_lru_eviction);
+    RUN_TEST(test_timer_wheel);
+    RUN_TEST(test_lru_benchmark);
     return UNITY_END();
 }
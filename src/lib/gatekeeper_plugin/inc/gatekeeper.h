@@ -234,6 +234,21 @@ gatekeeper_category_check(struct fsm_session *session,
                           struct fsm_policy_req *req,
                           struct fsm_policy *policy);
 
+/**
+ * @brief performs check whether to allow or block this packet.
+ *        by connecting ot the guard server.
+ *
+ * Attribute lookups are not blocking when CONFIG_GATEKEEPER_ASYNC_LOOKUP
+ * is set: the request is then marked FSM_FQDN_CAT_PENDING, and resumed
+ * through its gatekeeper_resume callback if provided.
+ * @param session the fsm session
+ * @param req the request being processed
+ * @return true if the verdict was set, false otherwise
+ */
+bool
+gatekeeper_get_verdict(struct fsm_session *session,
+                       struct fsm_policy_req *req);
+
 /**
  * @brief frees fsm_gk_verdict structure
  *
@@ -29,27 +29,114 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <curl/curl.h>
 #include <ev.h>
+#include <pthread.h>
+#include <time.h>
 
+#include "gatekeeper_single_curl.h"
+#include "ds_dlist.h"
 #include "ds_tree.h"
 #include "os_types.h"
 
+/* maximum number of lookups sent upstream at any time */
+#ifdef CONFIG_GATEKEEPER_MAX_INFLIGHT
+#define GK_MCURL_MAX_INFLIGHT CONFIG_GATEKEEPER_MAX_INFLIGHT
+#else
+#define GK_MCURL_MAX_INFLIGHT 32
+#endif
+
+/* maximum number of lookups waiting for an in-flight slot */
+#define GK_MCURL_MAX_BACKLOG 1024
+
+struct gk_conn_info;
+
+/**
+ * @brief called when a lookup completes, successfully or not
+ */
+typedef void (*gk_mcurl_done_cb)(struct gk_conn_info *conn);
+
+struct gk_mcurl_stats
+{
+    uint32_t lookups;       /* upstream lookups issued */
+    uint32_t coalesced;     /* requests attached to a pending lookup */
+    uint32_t failures;      /* lookups completed with a transfer error */
+    uint32_t dropped;       /* lookups refused, backlog full */
+    uint32_t max_inflight;  /* in-flight high watermark */
+    uint32_t max_backlog;   /* backlog high watermark */
+};
+
+/*
+ * Lookups are requested from the nfqueue workers as well as from the
+ * main loop. The lock serializes the requesters on the pending lookups.
+ * The curl handles and the main loop watchers are only driven from the
+ * main loop, which runs its callbacks with the workers excluded: a
+ * worker queues its lookup and signals start_async.
+ */
 struct http2_curl
 {
     struct ev_loop *loop;
     struct ev_io fifo_event;
     struct ev_timer timer_event;
+    struct ev_async start_async;    /* starts the lookups queued by workers */
+    pthread_t loop_thread;
+    pthread_mutex_t lock;
     CURLM *multi;
     int still_running;
+    bool initialized;
+    ds_tree_t lookups;          /* pending lookups, keyed by gk_lookup_key */
+    ds_dlist_t backlog;         /* lookups waiting for an in-flight slot */
+    int max_inflight;
+    int inflight;
+    int backlog_len;
+    gk_mcurl_done_cb done_cb;
+    struct gk_mcurl_stats stats;
 };
 
+struct gk_lookup_key
+{
+    int req_type;
+    char *attr;
+};
+
+/**
+ * @brief an upstream lookup, shared by all the requests
+ *        for the same attribute
+ */
 struct gk_conn_info
 {
     CURL *easy;
     char *url;
+    struct gk_lookup_key key;
+    struct gk_packed_buffer *gk_pb;  /* request body */
+    struct gk_curl_data data;        /* reply body */
+    CURLcode result;
+    long response_code;
+    struct timespec start;
+    ds_dlist_t waiters;              /* struct gk_pending_req */
+    void *ctx;                       /* owner context */
+    bool queued;
+    ds_tree_node_t conn_node;
+    ds_dlist_node_t backlog_node;
     struct http2_curl *global;
     char error[CURL_ERROR_SIZE];
 };
 
+/**
+ * @brief a verdict request waiting on a lookup
+ *
+ * fqdn_req is set when the requester parked its request,
+ * otherwise the verdict is only added to the cache.
+ */
+struct gk_pending_req
+{
+    os_macaddr_t dev_id;
+    struct fqdn_pending_req *fqdn_req;
+    struct gk_conn_info *conn;
+    CURLcode result;
+    long response_code;
+    struct gk_curl_data data;        /* copy of the reply once completed */
+    ds_dlist_node_t waiter_node;
+};
+
 struct gk_sock_info
 {
     curl_socket_t sockfd;
@@ -61,14 +148,55 @@ struct gk_sock_info
     struct http2_curl *global;
 };
 
+
+/**
+ * @brief returns the lookup engine
+ */
+struct http2_curl *
+get_curl_multi_mgr(void);
+
+
+/**
+ * @brief looks up a pending lookup
+ *
+ * Called with the manager locked.
+ * @param req_type the request type
+ * @param attr the attribute value
+ * @return the pending lookup, NULL if none
+ */
+struct gk_conn_info *
+gk_lookup_find(int req_type, char *attr);
+
+
 /**
  * @brief Create a new easy handle, and add it to the global curl_multi
- * @param url url to add.
- * @return true if the initialization succeeded,
- *         false otherwise
+ *
+ * The lookup is started right away if the in-flight window allows it,
+ * queued otherwise. Off the main loop, it is queued and started from
+ * the main loop. The request body ownership is transferred to the
+ * lookup on success. Called with the manager locked.
+ * @param ecurl the server and tls parameters
+ * @param url url to post to
+ * @param req_type the request type
+ * @param attr the attribute value
+ * @param gk_pb the serialized request
+ * @param ctx owner context, passed back on completion
+ * @return the lookup, NULL on failure
  */
-bool
-gk_new_conn(char *url);
+struct gk_conn_info *
+gk_new_conn(struct gk_curl_easy_info *ecurl, char *url,
+            int req_type, char *attr,
+            struct gk_packed_buffer *gk_pb, void *ctx);
+
+
+/**
+ * @brief frees a lookup and its remaining waiters
+ *
+ * Parked requesters are detached, they will not be resumed.
+ * @param conn the lookup to free
+ */
+void
+gk_free_conn(struct gk_conn_info *conn);
 
 
 /**
@@ -82,11 +210,12 @@ gk_curl_exit(void);
 /**
  * @brief initialize curl library
  * @param loop pointer to ev_loop structure
+ * @param done_cb lookup completion callback
  * @return true if the initialization succeeded,
  *         false otherwise
  */
 bool
-gk_multi_curl_init(struct ev_loop *loop);
+gk_multi_curl_init(struct ev_loop *loop, gk_mcurl_done_cb done_cb);
 
 
 #endif /* GK_CURL_H_INCLUDED */
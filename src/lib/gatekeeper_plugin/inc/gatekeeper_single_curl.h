@@ -67,6 +67,32 @@ gk_send_request(struct fsm_session *session,
                 struct fsm_gk_session *fsm_gk_session,
                 struct fsm_gk_verdict *gk_verdict);
 
+/**
+ * @brief processes the outcome of a gatekeeper request
+ *        and updates the action.
+ *
+ * @param session the fsm session of the requester
+ * @param fsm_gk_session gatekeeper session
+ * @param gk_verdict structure containing the fsm_policy_req
+ * @param res curl result of the transfer
+ * @param response_code http response code
+ * @param chunk the received reply
+ * @return gatekeeper response code.
+ */
+int
+gk_process_reply(struct fsm_session *session,
+                 struct fsm_gk_session *fsm_gk_session,
+                 struct fsm_gk_verdict *gk_verdict,
+                 CURLcode res, long response_code,
+                 struct gk_curl_data *chunk);
+
+/**
+ * @brief CURLOPT_WRITEFUNCTION callback accumulating the reply
+ *        in a struct gk_curl_data
+ */
+size_t
+gk_curl_callback(void *contents, size_t size, size_t nmemb, void *userp);
+
 /**
  * @brief returns the attribute string value based on the request type.
  *
@@ -97,12 +97,34 @@ gatekeeper_log_health_stats(struct fsm_gk_session *fsm_gk_session,
          hs->uncategorized);
     LOGI("%s: cache entries: [%u/%u]", __func__,
          hs->cached_entries, hs->cache_size);
+    {
+        struct gk_cache_mgr *cache_mgr = gk_cache_get_mgr();
+        struct gkc_stats *cstats = gkc_get_stats();
+
+        LOGI("%s: cache hits: %" PRIu64 ", misses: %" PRIu64
+             ", evictions: %" PRIu64 ", expired: %" PRIu64, __func__,
+             cstats->hits, cstats->misses, cstats->evictions, cstats->expired);
+        LOGI("%s: cache memory: [%zu/%zu]", __func__,
+             cache_mgr->mem_used, cache_mgr->mem_budget);
+    }
     LOGI("%s: min lookup latency in ms: %u", __func__,
          hs->min_latency);
     LOGI("%s: max lookup latency in ms: %u", __func__,
          hs->max_latency);
     LOGI("%s: avg lookup latency in ms: %u", __func__,
          hs->avg_latency);
+
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    {
+        struct gk_mcurl_stats *mstats = &get_curl_multi_mgr()->stats;
+
+        LOGI("%s: async lookups: %u, coalesced: %u, failed: %u, dropped: %u",
+             __func__, mstats->lookups, mstats->coalesced,
+             mstats->failures, mstats->dropped);
+        LOGI("%s: max in-flight lookups: %u, max queued lookups: %u",
+             __func__, mstats->max_inflight, mstats->max_backlog);
+    }
+#endif
 }
 
 /**
@@ -172,7 +194,7 @@ gatekeeper_report_compute_health_stats(struct fsm_gk_session *fsm_gk_session,
     hs->cached_entries = count;
 
     /* Compute cache size */
-    stats->cache_size = GK_MAX_CACHE_ENTRIES;
+    stats->cache_size = gk_cache_get_mgr()->max_entries;
     count = (uint32_t)(stats->cache_size);
     hs->cache_size = count;
 }
@@ -705,6 +727,309 @@ fsm_gk_update_latencies(struct fsm_gk_session *gk_session,
     return latency;
 }
 
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+/**
+ * @brief detaches a parked request from its lookup
+ *
+ * Called by the requester when it frees a request still
+ * waiting on a lookup.
+ * @param fqdn_req the parked request
+ */
+static void
+gatekeeper_cancel_lookup(struct fqdn_pending_req *fqdn_req)
+{
+    struct gk_pending_req *pending;
+    struct http2_curl *mgr;
+
+    pending = fqdn_req->gk_lookup;
+    fqdn_req->gk_lookup = NULL;
+    fqdn_req->gatekeeper_cancel = NULL;
+    if (pending == NULL) return;
+
+    mgr = get_curl_multi_mgr();
+    pthread_mutex_lock(&mgr->lock);
+    if (pending->conn != NULL) ds_dlist_remove(&pending->conn->waiters, pending);
+    pthread_mutex_unlock(&mgr->lock);
+
+    free(pending->data.memory);
+    free(pending);
+}
+
+
+/**
+ * @brief completes the verdict of a request resumed after its lookup
+ *
+ * @param session the requesting session
+ * @param fsm_gk_session the gatekeeper session
+ * @param req the request being processed
+ * @return true if the verdict was set, false otherwise
+ */
+static bool
+gatekeeper_resume_verdict(struct fsm_session *session,
+                          struct fsm_gk_session *fsm_gk_session,
+                          struct fsm_policy_req *req)
+{
+    struct fqdn_pending_req *fqdn_req;
+    struct gk_pending_req *pending;
+    struct fsm_gk_verdict gk_verdict;
+    int gk_response;
+
+    fqdn_req = req->fqdn_req;
+    pending = fqdn_req->gk_lookup;
+    fqdn_req->gk_lookup = NULL;
+    fqdn_req->gatekeeper_cancel = NULL;
+
+    memset(&gk_verdict, 0, sizeof(gk_verdict));
+    gk_verdict.policy_req = req;
+
+    fqdn_req->categorized = FSM_FQDN_CAT_SUCCESS;
+    gk_response = gk_process_reply(session, fsm_gk_session, &gk_verdict,
+                                   pending->result, pending->response_code,
+                                   &pending->data);
+    free(pending->data.memory);
+    free(pending);
+
+    if (gk_response != GK_LOOKUP_SUCCESS)
+    {
+        fqdn_req->categorized = FSM_FQDN_CAT_FAILED;
+        LOGD("%s() lookup failed for %s, not updating cache", __func__, req->url);
+        return false;
+    }
+
+    gk_add_policy_to_cache(req);
+
+    LOGT("%s(): verdict for '%s' is %d", __func__, req->url, req->reply.action);
+    return true;
+}
+
+
+/**
+ * @brief sends a non-blocking lookup, or joins the pending one
+ *        for the same attribute
+ *
+ * The request is parked if the requester provided a resume routine,
+ * otherwise the verdict is only added to the cache on completion.
+ * @param session the requesting session
+ * @param fsm_gk_session the gatekeeper session
+ * @param req the request being processed
+ * @return false, the verdict is pending
+ */
+static bool
+gatekeeper_async_verdict(struct fsm_session *session,
+                         struct fsm_gk_session *fsm_gk_session,
+                         struct fsm_policy_req *req)
+{
+    struct gk_curl_easy_info *ecurl_info;
+    struct fqdn_pending_req *fqdn_req;
+    struct gk_pending_req *pending;
+    struct gk_packed_buffer *gk_pb;
+    struct gk_conn_info *conn;
+    struct http2_curl *mgr;
+    char url[1024];
+    int req_type;
+
+    fqdn_req = req->fqdn_req;
+    fqdn_req->categorized = FSM_FQDN_CAT_FAILED;
+    ecurl_info = &fsm_gk_session->ecurl;
+    req_type = fsm_policy_get_req_type(req);
+    mgr = get_curl_multi_mgr();
+
+    pending = calloc(1, sizeof(*pending));
+    if (pending == NULL) return false;
+
+    /* nfqueue workers may request the same attribute concurrently */
+    pthread_mutex_lock(&mgr->lock);
+    conn = gk_lookup_find(req_type, req->url);
+    if (conn != NULL)
+    {
+        mgr->stats.coalesced++;
+        LOGT("%s(): joining pending lookup for %s", __func__, req->url);
+    }
+    else
+    {
+        gk_pb = gatekeeper_get_req(session, req);
+        if (gk_pb == NULL)
+        {
+            LOGD("%s() curl request serialization failed", __func__);
+            goto err_free_pending;
+        }
+
+#ifdef CONFIG_GATEKEEPER_ENDPOINT
+        /* populate the end point url */
+        snprintf(url, sizeof(url), "%s/%s", ecurl_info->server_url,
+                 gk_request_str(req_type));
+#else
+        STRSCPY(url, ecurl_info->server_url);
+#endif
+
+        conn = gk_new_conn(ecurl_info, url, req_type, req->url, gk_pb,
+                           session->service);
+        if (conn == NULL)
+        {
+            gk_free_packed_buffer(gk_pb);
+            goto err_free_pending;
+        }
+    }
+
+    memcpy(&pending->dev_id, req->device_id, sizeof(pending->dev_id));
+    pending->conn = conn;
+    ds_dlist_insert_tail(&conn->waiters, pending);
+
+    if (fqdn_req->gatekeeper_resume != NULL)
+    {
+        pending->fqdn_req = fqdn_req;
+        fqdn_req->gk_lookup = pending;
+        fqdn_req->gatekeeper_cancel = gatekeeper_cancel_lookup;
+    }
+
+    pthread_mutex_unlock(&mgr->lock);
+
+    fqdn_req->categorized = FSM_FQDN_CAT_PENDING;
+    return false;
+
+err_free_pending:
+    pthread_mutex_unlock(&mgr->lock);
+    free(pending);
+    return false;
+}
+
+
+/**
+ * @brief adds the verdict of a completed lookup to the cache
+ *        on behalf of a requester which did not wait for it
+ *
+ * @param session the gatekeeper session
+ * @param fsm_gk_session the gatekeeper session context
+ * @param conn the completed lookup
+ * @param pending the waiting request
+ */
+static void
+gatekeeper_cache_verdict(struct fsm_session *session,
+                         struct fsm_gk_session *fsm_gk_session,
+                         struct gk_conn_info *conn,
+                         struct gk_pending_req *pending)
+{
+    struct fsm_policy_req policy_req;
+    struct fqdn_pending_req fqdn_req;
+    struct fsm_url_request req_info;
+    struct fsm_gk_verdict gk_verdict;
+    int gk_response;
+
+    memset(&policy_req, 0, sizeof(policy_req));
+    memset(&fqdn_req, 0, sizeof(fqdn_req));
+    memset(&req_info, 0, sizeof(req_info));
+    memset(&gk_verdict, 0, sizeof(gk_verdict));
+
+    req_info.reply = calloc(1, sizeof(struct fsm_url_reply));
+    if (req_info.reply == NULL) return;
+
+    req_info.reply->service_id = URL_GK_SVC;
+    STRSCPY(req_info.url, conn->key.attr);
+    fqdn_req.req_info = &req_info;
+    fqdn_req.req_type = conn->key.req_type;
+    fqdn_req.numq = 1;
+    memcpy(&fqdn_req.dev_id, &pending->dev_id, sizeof(fqdn_req.dev_id));
+    policy_req.device_id = &fqdn_req.dev_id;
+    policy_req.url = req_info.url;
+    policy_req.fqdn_req = &fqdn_req;
+    gk_verdict.policy_req = &policy_req;
+
+    gk_response = gk_process_reply(session, fsm_gk_session, &gk_verdict,
+                                   conn->result, conn->response_code,
+                                   &conn->data);
+    if (gk_response == GK_LOOKUP_SUCCESS)
+    {
+        fqdn_req.categorized = FSM_FQDN_CAT_SUCCESS;
+        gk_add_policy_to_cache(&policy_req);
+    }
+
+    fsm_free_url_reply(req_info.reply);
+}
+
+
+/**
+ * @brief lookup completion callback
+ *
+ * Accounts for the lookup, then hands the reply over to each
+ * request waiting on it.
+ * @param conn the completed lookup
+ */
+static void
+gatekeeper_lookup_done(struct gk_conn_info *conn)
+{
+    struct fsm_gk_session *fsm_gk_session;
+    struct gatekeeper_offline *offline;
+    struct fqdn_pending_req *fqdn_req;
+    struct gk_pending_req *pending;
+    struct fsm_url_stats *stats;
+    struct fsm_session *session;
+    struct fsm_gk_mgr *mgr;
+    struct timespec end;
+    long lookup_latency;
+
+    mgr = gatekeeper_get_mgr();
+    if (!mgr->initialized) return;
+
+    /* the gatekeeper session may have been deleted meanwhile */
+    session = conn->ctx;
+    fsm_gk_session = ds_tree_find(&mgr->fsm_sessions, session);
+    if (fsm_gk_session == NULL) return;
+
+    stats = &fsm_gk_session->health_stats;
+    offline = &fsm_gk_session->gk_offline;
+
+    /* lookups aborted on exit do not reflect the provider state */
+    if (conn->result == CURLE_ABORTED_BY_CALLBACK)
+    {
+        LOGD("%s(): lookup for '%s' aborted", __func__, conn->key.attr);
+    }
+    else if (conn->result != CURLE_OK || conn->data.size == 0)
+    {
+        /* connection error, start the backoff timer */
+        offline->provider_offline = true;
+        offline->offline_ts = time(NULL);
+        offline->connection_failures++;
+    }
+
+    if (conn->result == CURLE_OK)
+    {
+        stats->cloud_lookups++;
+        clock_gettime(CLOCK_REALTIME, &end);
+        lookup_latency = fsm_gk_update_latencies(fsm_gk_session, &conn->start, &end);
+        LOGT("%s(): cloud lookup latency for '%s' is %ld ms", __func__,
+             conn->key.attr, lookup_latency);
+    }
+
+    while ((pending = ds_dlist_remove_head(&conn->waiters)) != NULL)
+    {
+        pending->conn = NULL;
+        fqdn_req = pending->fqdn_req;
+        if (fqdn_req == NULL)
+        {
+            gatekeeper_cache_verdict(session, fsm_gk_session, conn, pending);
+            free(pending);
+            continue;
+        }
+
+        /* hand a copy of the reply over to the parked request */
+        pending->result = conn->result;
+        pending->response_code = conn->response_code;
+        if (conn->data.size != 0)
+        {
+            pending->data.memory = malloc(conn->data.size);
+            if (pending->data.memory != NULL)
+            {
+                memcpy(pending->data.memory, conn->data.memory, conn->data.size);
+                pending->data.size = conn->data.size;
+            }
+        }
+
+        fqdn_req->gatekeeper_resume(fqdn_req);
+    }
+}
+#endif /* CONFIG_GATEKEEPER_ASYNC_LOOKUP */
+
+
 /**
  * @brief performs check whether to allow or block this packet.
  *        by connecting ot the guard server.
@@ -733,6 +1058,10 @@ gatekeeper_get_verdict(struct fsm_session *session,
     bool ret = true;
     bool incache;
     int gk_response;
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    int req_type;
+    bool async;
+#endif
 
     fqdn_req = req->fqdn_req;
     req_info = fqdn_req->req_info;
@@ -750,6 +1079,14 @@ gatekeeper_get_verdict(struct fsm_session *session,
     stats = &fsm_gk_session->health_stats;
     offline = &fsm_gk_session->gk_offline;
 
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    /* resumed after the completion of the lookup the request was parked on */
+    if (fqdn_req->gk_lookup != NULL)
+    {
+        return gatekeeper_resume_verdict(session, fsm_gk_session, req);
+    }
+#endif
+
     incache = gk_check_policy_in_cache(req);
     if (incache == true)
     {
@@ -776,6 +1113,13 @@ gatekeeper_get_verdict(struct fsm_session *session,
     ecurl_info = &fsm_gk_session->ecurl;
     if (!ecurl_info->server_url) return false;
 
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    async = (get_curl_multi_mgr()->initialized && req->url != NULL);
+    req_type = fsm_policy_get_req_type(req);
+    async &= (req_type >= FSM_FQDN_REQ && req_type <= FSM_APP_REQ);
+    if (async) return gatekeeper_async_verdict(session, fsm_gk_session, req);
+#endif
+
     gk_verdict = calloc(1, sizeof(*gk_verdict));
     if (gk_verdict == NULL) return false;
 
@@ -794,9 +1138,6 @@ gatekeeper_get_verdict(struct fsm_session *session,
 
     fqdn_req->categorized = FSM_FQDN_CAT_SUCCESS;
 
-#ifdef CURL_MULTI
-    gk_new_conn(req->url);
-#else
     memset(&start, 0, sizeof(start));
     memset(&end, 0, sizeof(end));
 
@@ -822,7 +1163,6 @@ gatekeeper_get_verdict(struct fsm_session *session,
     /* update stats for processing the request */
     lookup_latency = fsm_gk_update_latencies(fsm_gk_session, &start, &end);
     LOGT("%s(): cloud lookup latency for '%s' is %ld ms", __func__, req->url, lookup_latency);
-#endif
 
     gk_add_policy_to_cache(req);
 
@@ -899,11 +1239,10 @@ gatekeeper_init_curl(struct fsm_session *session)
     memset(ecurl_info, 0, sizeof(struct gk_curl_easy_info));
     ecurl_info->server_url = session->ops.get_config(session, "gk_url");
 
-#ifdef MULTI_CURL
-    gk_multi_curl_init(session->loop);
-#else
-    gk_curl_easy_init(fsm_gk_session, session->loop);
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    gk_multi_curl_init(session->loop, gatekeeper_lookup_done);
 #endif
+    gk_curl_easy_init(fsm_gk_session, session->loop);
 
     return true;
 }
@@ -1042,6 +1381,9 @@ gatekeeper_exit(struct fsm_session *session)
     if (!fsm_gk_session) return;
 
     gk_curl_easy_cleanup(fsm_gk_session);
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    gk_curl_exit();
+#endif
     mgr->initialized = false;
 
     gatekeeper_delete_session(session);
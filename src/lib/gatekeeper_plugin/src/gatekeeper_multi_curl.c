@@ -27,13 +27,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <curl/curl.h>
 #include <ev.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include <mxml.h>
 
 #include "gatekeeper_multi_curl.h"
+#include "gatekeeper_msg.h"
 #include "log.h"
 
-static struct http2_curl curl_mgr;
+static struct http2_curl curl_mgr =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 struct http2_curl *get_curl_multi_mgr(void)
 {
@@ -85,43 +90,167 @@ mcode_or_die(const char *where, CURLMcode code)
 
 
 /**
- * @brief clean up curl library.
+ * @brief compare lookup keys
  *
+ * @param a key pointer
+ * @param b key pointer
+ * @return 0 if keys match
  */
-bool
-gk_curl_exit(void)
+static int
+gk_lookup_key_cmp(void *a, void *b)
 {
-    CURLMcode mret;
+    struct gk_lookup_key *key_a = a;
+    struct gk_lookup_key *key_b = b;
 
-    struct http2_curl *cmgr = get_curl_multi_mgr();
+    if (key_a->req_type != key_b->req_type)
+    {
+        return key_a->req_type - key_b->req_type;
+    }
 
-    mret = curl_multi_cleanup(cmgr->multi);
-    if (mret != CURLM_OK) return false;
+    return strcmp(key_a->attr, key_b->attr);
+}
 
-    curl_global_cleanup();
-    return true;
+
+/**
+ * @brief looks up a pending lookup
+ *
+ * @param req_type the request type
+ * @param attr the attribute value
+ * @return the pending lookup, NULL if none
+ */
+struct gk_conn_info *
+gk_lookup_find(int req_type, char *attr)
+{
+    struct http2_curl *mgr = get_curl_multi_mgr();
+    struct gk_lookup_key key;
+
+    if (!mgr->initialized) return NULL;
+
+    key.req_type = req_type;
+    key.attr = attr;
+
+    return ds_tree_find(&mgr->lookups, &key);
 }
 
 
 /**
  * @brief cleanup connection info
  *
+ * Parked requesters are detached, they will not be resumed.
  */
 void
 gk_free_conn(struct gk_conn_info *conn)
 {
     struct http2_curl *mgr = get_curl_multi_mgr();
+    struct gk_pending_req *pending;
+    struct fqdn_pending_req *fqdn_req;
+
     if (conn->easy)
     {
         curl_multi_remove_handle(mgr->multi, conn->easy);
         curl_easy_cleanup(conn->easy);
     }
 
+    while ((pending = ds_dlist_remove_head(&conn->waiters)) != NULL)
+    {
+        fqdn_req = pending->fqdn_req;
+        if (fqdn_req != NULL)
+        {
+            fqdn_req->gk_lookup = NULL;
+            fqdn_req->gatekeeper_cancel = NULL;
+        }
+        free(pending->data.memory);
+        free(pending);
+    }
+
+    gk_free_packed_buffer(conn->gk_pb);
+    free(conn->data.memory);
+    free(conn->key.attr);
     free(conn->url);
     free(conn);
 }
 
 
+/**
+ * @brief hands a lookup over to curl
+ *
+ * @param mgr curl data
+ * @param conn the lookup to start
+ * @return true if the lookup was added to the multi handle
+ */
+static bool
+gk_start_conn(struct http2_curl *mgr, struct gk_conn_info *conn)
+{
+    CURLMcode rc;
+
+    LOGT("http2: %s() adding easy %p to multi %p (%s)",
+         __func__, conn->easy, mgr->multi, conn->key.attr);
+
+    clock_gettime(CLOCK_REALTIME, &conn->start);
+
+    rc = curl_multi_add_handle(mgr->multi, conn->easy);
+    mcode_or_die("gk_start_conn: curl_multi_add_handle", rc);
+    if (rc != CURLM_OK) return false;
+
+    mgr->inflight++;
+    mgr->stats.lookups++;
+    if ((uint32_t)mgr->inflight > mgr->stats.max_inflight)
+    {
+        mgr->stats.max_inflight = mgr->inflight;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief completes a lookup: notifies the owner and frees it
+ *
+ * @param mgr curl data
+ * @param conn the completed lookup
+ */
+static void
+gk_complete_conn(struct http2_curl *mgr, struct gk_conn_info *conn)
+{
+    /* requests for the same attribute now start a new lookup */
+    ds_tree_remove(&mgr->lookups, conn);
+
+    if (conn->result != CURLE_OK) mgr->stats.failures++;
+
+    if (mgr->done_cb != NULL) mgr->done_cb(conn);
+
+    gk_free_conn(conn);
+}
+
+
+/**
+ * @brief starts queued lookups while the in-flight window allows it
+ *
+ * @param mgr curl data
+ */
+static void
+gk_start_backlog(struct http2_curl *mgr)
+{
+    struct gk_conn_info *conn;
+    bool rc;
+
+    while (mgr->inflight < mgr->max_inflight)
+    {
+        conn = ds_dlist_remove_head(&mgr->backlog);
+        if (conn == NULL) return;
+
+        mgr->backlog_len--;
+        conn->queued = false;
+
+        rc = gk_start_conn(mgr, conn);
+        if (rc) continue;
+
+        conn->result = CURLE_FAILED_INIT;
+        gk_complete_conn(mgr, conn);
+    }
+}
+
+
 /**
  * @brief Check for completed transfers, and remove
  *        their easy handles.
@@ -131,11 +260,9 @@ static void
 check_multi_info(struct http2_curl *mgr)
 {
     struct gk_conn_info *conn;
-    char *eff_url;
     CURLMsg *msg;
     int msgs_left;
     CURL *easy;
-    CURLcode res;
 
     LOGT("http2: %s() Remaining: %d", __func__, mgr->still_running);
     while ((msg = curl_multi_info_read(mgr->multi, &msgs_left)))
@@ -145,15 +272,21 @@ check_multi_info(struct http2_curl *mgr)
         if (msg->msg != CURLMSG_DONE) continue;
 
         easy = msg->easy_handle;
-        res = msg->data.result;
         curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&conn);
-        curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &eff_url);
-        LOGT("%s(): DONE: %s => (%d) %s", __func__, eff_url, res, conn->error);
+        conn->result = msg->data.result;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &conn->response_code);
+        LOGT("%s(): DONE: %s => (%d) %s", __func__, conn->url,
+             conn->result, conn->error);
+
         curl_multi_remove_handle(mgr->multi, easy);
-        free(conn->url);
         curl_easy_cleanup(easy);
-        free(conn);
+        conn->easy = NULL;
+        mgr->inflight--;
+
+        gk_complete_conn(mgr, conn);
     }
+
+    gk_start_backlog(mgr);
 }
 
 
@@ -162,7 +295,7 @@ check_multi_info(struct http2_curl *mgr)
  * @param w event that is received
  * @param revents type of the event
  */
-void
+static void
 event_cb(EV_P_ struct ev_io *w, int revents)
 {
     struct http2_curl *mgr = (struct http2_curl *) w->data;
@@ -176,7 +309,9 @@ event_cb(EV_P_ struct ev_io *w, int revents)
                                   &mgr->still_running);
     mcode_or_die("event_cb: curl_multi_socket_action", rc);
     check_multi_info(mgr);
-    if (mgr->still_running <= 0)
+
+    /* lookups may have been started from the backlog meanwhile */
+    if (mgr->still_running <= 0 && mgr->inflight == 0)
     {
         LOGT("last transfer done, kill timeout");
         ev_timer_stop(mgr->loop, &mgr->timer_event);
@@ -203,6 +338,20 @@ timer_cb(EV_P_ struct ev_timer *w, int revents)
 }
 
 
+/**
+ * @brief invoked by libev when a worker queued lookups
+ * @param w async event
+ * @param revents type of the event
+ */
+static void
+start_async_cb(EV_P_ struct ev_async *w, int revents)
+{
+    struct http2_curl *mgr = w->data;
+
+    gk_start_backlog(mgr);
+}
+
+
 /**
  * @brief cleans up sock_info structure.
  * @param f sock_info structure to free
@@ -260,6 +409,7 @@ addsock(curl_socket_t s, CURL *easy, int action,
     LOGT("http2: %s %p, %d, %d, %p", __func__, easy, s, action, mgr);
 
     fdp = calloc(1, sizeof(struct gk_sock_info));
+    if (fdp == NULL) return;
 
     fdp->global = mgr;
     setsock(fdp, s, easy, action, mgr);
@@ -301,17 +451,18 @@ curl_sock_cb(CURL *e, curl_socket_t s, int what, void *userp, void *sockp)
  * @param mgr private callback pointer
  * @return CURLM_OK
  */
-int
-multi_timer_cb(CURLM *multi, long timeout_ms,
-               struct http2_curl *mgr)
+static int
+multi_timer_cb(CURLM *multi, long timeout_ms, void *userp)
 {
+    struct http2_curl *mgr = userp;
+
     LOGT("http2: %s() %p, %li, %p ", __func__, multi, timeout_ms, mgr);
 
     ev_timer_stop(mgr->loop, &mgr->timer_event);
 
     if (timeout_ms >= 0)
     {
-        double  t = timeout_ms / 1000;
+        double  t = timeout_ms / 1000.0;
         ev_timer_init(&mgr->timer_event, timer_cb, t, 0.);
         ev_timer_start(mgr->loop, &mgr->timer_event);
     }
@@ -320,132 +471,203 @@ multi_timer_cb(CURLM *multi, long timeout_ms,
 }
 
 
-/**
- * @brief CURLOPT_WRITEFUNCTION callback when data is received
- * @param ptr pointer to received data
- * @param size value is always 1
- * @param nmemb size of the data received
- * @param data user data argument
- * @return realsize size that is actually read.
- */
-static size_t
-curl_write_cb(void *ptr, size_t size, size_t nmemb, void *data)
-{
-    size_t realsize;
-
-    realsize = size * nmemb;
-
-    LOGT("http2: %s(): %p %zu %zu %p", __func__, ptr, size, nmemb, data);
-    return realsize;
-}
-
-
-/**
- * @brief CURLOPT_PROGRESSFUNCTION callback to progress meter function
- * @param p is the pointer set with CURLOPT_PROGRESSDATA()
- * @param dltotal the total number of bytes libcurl expects to
- *        download in  this  transfer
- * @param dlnow number of bytes downloaded so far
- * @param ult total number of bytes libcurl expects to upload in this transfer
- * @param uln is the number of bytes uploaded so far
- * @return returns CURLE_OK
- */
-static int
-prog_cb(void *p, double dltotal, double dlnow, double ult,
-                   double uln)
-{
-  struct gk_conn_info *conn = (struct gk_conn_info *)p;
-
-  LOGT("%s() Progress: %s (%g/%g)\n", __func__, conn->url, dlnow, dltotal);
-  return CURLE_OK;
-}
-
-
 /**
  * @brief Create a new easy handle, and add it to the global curl_multi
- * @param url url to add.
- * @return true if the initialization succeeded,
- *         false otherwise
+ *
+ * The lookup is started right away if the in-flight window allows it,
+ * queued otherwise. The request body ownership is transferred to the
+ * lookup on success.
+ * @param ecurl the server and tls parameters
+ * @param url url to post to
+ * @param req_type the request type
+ * @param attr the attribute value
+ * @param gk_pb the serialized request
+ * @param ctx owner context, passed back on completion
+ * @return the lookup, NULL on failure
  */
-bool
-gk_new_conn(char *url)
+struct gk_conn_info *
+gk_new_conn(struct gk_curl_easy_info *ecurl, char *url,
+            int req_type, char *attr,
+            struct gk_packed_buffer *gk_pb, void *ctx)
 {
     struct http2_curl *cmgr;
     struct gk_conn_info *conn;
-    CURLMcode rc;
+    bool on_loop;
+    bool rc;
 
-    LOGN("http2: %s() adding url %s", __func__, url);
     cmgr = get_curl_multi_mgr();
+    if (!cmgr->initialized) return NULL;
 
-    conn = calloc(1, sizeof(struct gk_conn_info));
-    if (conn == NULL) return false;
+    if (cmgr->inflight >= cmgr->max_inflight &&
+        cmgr->backlog_len >= GK_MCURL_MAX_BACKLOG)
+    {
+        cmgr->stats.dropped++;
+        LOGD("http2: %s() backlog full, dropping lookup for %s",
+             __func__, attr);
+        return NULL;
+    }
 
-    conn->error[0]='\0';
-    conn->easy = curl_easy_init();
-    if (!conn->easy) goto err_free_conn;
+    LOGT("http2: %s() adding url %s for %s", __func__, url, attr);
+
+    conn = calloc(1, sizeof(struct gk_conn_info));
+    if (conn == NULL) return NULL;
 
+    ds_dlist_init(&conn->waiters, struct gk_pending_req, waiter_node);
     conn->global = cmgr;
+    conn->ctx = ctx;
+    conn->key.req_type = req_type;
+    conn->key.attr = strdup(attr);
     conn->url = strdup(url);
+    if (conn->key.attr == NULL || conn->url == NULL) goto err_free_conn;
+
+    conn->error[0] = '\0';
+    conn->easy = curl_easy_init();
+    if (!conn->easy) goto err_free_conn;
 
     curl_easy_setopt(conn->easy, CURLOPT_URL, conn->url);
-    curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, conn);
+    curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, gk_pb->buf);
+    curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, (long)gk_pb->len);
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION, gk_curl_callback);
+    curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, &conn->data);
     curl_easy_setopt(conn->easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
-    curl_easy_setopt(conn->easy, CURLOPT_VERBOSE, 1L);
+
+    /* multiplex over the established connection rather than open a new one */
+    curl_easy_setopt(conn->easy, CURLOPT_PIPEWAIT, 1L);
     curl_easy_setopt(conn->easy, CURLOPT_ERRORBUFFER, conn->error);
     curl_easy_setopt(conn->easy, CURLOPT_PRIVATE, conn);
-    curl_easy_setopt(conn->easy, CURLOPT_NOPROGRESS, 0L);
-    curl_easy_setopt(conn->easy, CURLOPT_PROGRESSFUNCTION, prog_cb);
-    curl_easy_setopt(conn->easy, CURLOPT_PROGRESSDATA, conn);
-    curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_TIME, 3L);
-    curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_LIMIT, 10L);
-    curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, 0L);
-    curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(conn->easy, CURLOPT_CONNECTTIMEOUT, 2L);
+    curl_easy_setopt(conn->easy, CURLOPT_TIMEOUT, 2L);
+    curl_easy_setopt(conn->easy, CURLOPT_CAINFO, ecurl->ca_path);
+    curl_easy_setopt(conn->easy, CURLOPT_SSLCERT, ecurl->ssl_cert);
+    curl_easy_setopt(conn->easy, CURLOPT_SSLKEY, ecurl->ssl_key);
+    curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYHOST, 1L);
+
+    /* curl drives the main loop watchers, only started from there */
+    on_loop = pthread_equal(pthread_self(), cmgr->loop_thread);
+    if (on_loop && cmgr->inflight < cmgr->max_inflight)
+    {
+        rc = gk_start_conn(cmgr, conn);
+        if (!rc) goto err_free_conn;
+    }
+    else
+    {
+        conn->queued = true;
+        ds_dlist_insert_tail(&cmgr->backlog, conn);
+        cmgr->backlog_len++;
+        if ((uint32_t)cmgr->backlog_len > cmgr->stats.max_backlog)
+        {
+            cmgr->stats.max_backlog = cmgr->backlog_len;
+        }
+        if (!on_loop) ev_async_send(cmgr->loop, &cmgr->start_async);
+    }
 
-    LOGT("http2: %s() adding easy %p to multi %p (%s)",
-         __func__, conn->easy, cmgr->multi, url);
+    conn->gk_pb = gk_pb;
+    ds_tree_insert(&cmgr->lookups, conn, &conn->key);
 
-    /* add curl easy handle */
-    rc = curl_multi_add_handle(cmgr->multi, conn->easy);
-    mcode_or_die("gk_new_conn: curl_multi_add_handle", rc);
-    if (rc == CURLM_OK) return true;
+    return conn;
 
 err_free_conn:
+    if (conn->easy)
+    {
+        curl_easy_cleanup(conn->easy);
+        conn->easy = NULL;
+    }
     gk_free_conn(conn);
 
-    return false;
+    return NULL;
+}
+
+
+/**
+ * @brief clean up curl library.
+ *
+ * Pending lookups are completed with an error, so that parked
+ * requesters are resumed before the lookups are freed.
+ */
+bool
+gk_curl_exit(void)
+{
+    struct http2_curl *cmgr = get_curl_multi_mgr();
+    struct gk_conn_info *conn;
+    CURLMcode mret;
+
+    if (!cmgr->initialized) return true;
+
+    while ((conn = ds_tree_head(&cmgr->lookups)) != NULL)
+    {
+        if (conn->queued) ds_dlist_remove(&cmgr->backlog, conn);
+        conn->queued = false;
+        conn->result = CURLE_ABORTED_BY_CALLBACK;
+        gk_complete_conn(cmgr, conn);
+    }
+    cmgr->inflight = 0;
+    cmgr->backlog_len = 0;
+
+    ev_timer_stop(cmgr->loop, &cmgr->timer_event);
+    ev_async_stop(cmgr->loop, &cmgr->start_async);
+    cmgr->initialized = false;
+
+    mret = curl_multi_cleanup(cmgr->multi);
+    if (mret != CURLM_OK) return false;
+
+    curl_global_cleanup();
+    return true;
 }
 
 
 /**
  * @brief initialize curl library
  * @param loop pointer to ev_loop structure
+ * @param done_cb lookup completion callback
  * @return true if the initialization succeeded,
  *         false otherwise
  */
 bool
-gk_multi_curl_init(struct ev_loop *loop)
+gk_multi_curl_init(struct ev_loop *loop, gk_mcurl_done_cb done_cb)
 {
     struct http2_curl *cmgr = get_curl_multi_mgr();
     CURLcode  rc;
     CURLMcode cmret;
 
+    if (cmgr->initialized) return true;
+
     LOGT("http2: initializing curl");
 
     /* initialize curl library */
     rc = curl_global_init(CURL_GLOBAL_DEFAULT);
     if (rc != CURLE_OK) return false;
 
-    memset(cmgr, 0, sizeof(struct http2_curl));
     cmgr->loop = loop;
+    cmgr->loop_thread = pthread_self();
+    cmgr->still_running = 0;
+    cmgr->inflight = 0;
+    cmgr->backlog_len = 0;
+    memset(&cmgr->stats, 0, sizeof(cmgr->stats));
+    cmgr->done_cb = done_cb;
+    cmgr->max_inflight = GK_MCURL_MAX_INFLIGHT;
+    ds_tree_init(&cmgr->lookups, gk_lookup_key_cmp,
+                 struct gk_conn_info, conn_node);
+    ds_dlist_init(&cmgr->backlog, struct gk_conn_info, backlog_node);
 
     /* initialize multi curl handle*/
     cmgr->multi = curl_multi_init();
+    if (cmgr->multi == NULL)
+    {
+        curl_global_cleanup();
+        return false;
+    }
+    cmgr->initialized = true;
 
     /* initialize event timer callback */
     ev_timer_init(&cmgr->timer_event, timer_cb, 0.0, 0.0);
     cmgr->timer_event.data = cmgr;
 
+    /* start the lookups queued by the nfqueue workers */
+    ev_async_init(&cmgr->start_async, start_async_cb);
+    cmgr->start_async.data = cmgr;
+    ev_async_start(loop, &cmgr->start_async);
+
     /* initialize socket callback */
     cmret = curl_multi_setopt(cmgr->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     if (cmret != CURLM_OK)
@@ -474,6 +696,14 @@ gk_multi_curl_init(struct ev_loop *loop)
         goto err;
     }
 
+    /* multiplex lookups as http/2 streams of a single connection */
+    cmret = curl_multi_setopt(cmgr->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (cmret != CURLM_OK)
+    {
+        LOGE("http2: failed to enable multiplexing");
+        goto err;
+    }
+
     LOGT("http2: curl initialization successful");
     return true;
 
@@ -46,7 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * @param response unpacked curl response
  * @return None
  */
-static size_t
+size_t
 gk_curl_callback(void *contents, size_t size, size_t nmemb, void *userp)
 {
     struct gk_curl_data *mem = (struct gk_curl_data *)userp;
@@ -569,6 +569,67 @@ gk_update_categorization_count(struct fsm_gk_session *fsm_gk_session)
     stats->categorization_failures++;
 }
 
+/**
+ * @brief processes the outcome of a gatekeeper request
+ *        and updates the action.
+ *
+ * Shared by the synchronous and the asynchronous lookups.
+ *
+ * @param session the fsm session of the requester
+ * @param fsm_gk_session gatekeeper session
+ * @param gk_verdict structure containing the fsm_policy_req
+ * @param res curl result of the transfer
+ * @param response_code http response code
+ * @param chunk the received reply
+ * @return gatekeeper response code.
+ */
+int
+gk_process_reply(struct fsm_session *session,
+                 struct fsm_gk_session *fsm_gk_session,
+                 struct fsm_gk_verdict *gk_verdict,
+                 CURLcode res, long response_code,
+                 struct gk_curl_data *chunk)
+{
+    struct fsm_policy_req *policy_req;
+    struct fqdn_pending_req *fqdn_req;
+    struct fsm_url_request *req_info;
+    struct fsm_url_reply *url_reply;
+    int gk_response = GK_LOOKUP_SUCCESS;
+    bool ret;
+
+    policy_req = gk_verdict->policy_req;
+    fqdn_req = policy_req->fqdn_req;
+    fqdn_req->provider = session->provider;
+    req_info = fqdn_req->req_info;
+    url_reply = req_info->reply;
+
+    url_reply->lookup_status = response_code;
+    if (res != CURLE_OK)
+    {
+        LOGT("%s(): curl request failed!!", __func__);
+        url_reply->connection_error = true;
+        fqdn_req->to_report = false;
+        url_reply->error = res;
+        return GK_CONNECTION_ERROR;
+    }
+
+    LOGT("%s(): %zu bytes retrieved", __func__, chunk->size);
+    if (chunk->size == 0) return GK_CONNECTION_ERROR;
+
+    ret = gk_process_curl_response(chunk, gk_verdict);
+    if (ret == false) gk_response = GK_SERVICE_ERROR;
+
+    /* if the curl reponse was successful and reply processing failed
+     * treate it as service failures.
+     */
+    if (gk_response == GK_SERVICE_ERROR) gk_update_categorization_count(fsm_gk_session);
+
+    /* update uncategorized counter (reply with category-id 15) */
+    gk_update_uncategorized_count(fsm_gk_session, gk_verdict);
+
+    return gk_response;
+}
+
 /**
  * @brief sends request to the gatekeeper services
  *        parses and updates the action.
@@ -583,23 +644,12 @@ gk_send_request(struct fsm_session *session,
                 struct fsm_gk_verdict *gk_verdict)
 {
     struct gk_curl_easy_info *curl_info;
-    struct fsm_policy_req *policy_req;
-    struct fqdn_pending_req *fqdn_req;
-    struct fsm_url_request *req_info;
-    struct fsm_url_reply *url_reply;
     struct fsm_url_stats *stats;
     struct gk_curl_data chunk;
     long response_code;
-    int gk_response = GK_LOOKUP_SUCCESS;
+    int gk_response;
     CURLcode res;
-    bool ret;
 
-    policy_req = gk_verdict->policy_req;
-    fqdn_req = policy_req->fqdn_req;
-    fqdn_req->provider = session->provider;
-    req_info = fqdn_req->req_info;
-
-    url_reply = req_info->reply;
     curl_info = &fsm_gk_session->ecurl;
 
     if (curl_info->connection_active == false)
@@ -620,39 +670,15 @@ gk_send_request(struct fsm_session *session,
     res = gk_send_curl_request(curl_info, &chunk, gk_verdict);
 
     curl_easy_getinfo(curl_info->curl_handle, CURLINFO_RESPONSE_CODE, &response_code);
-    url_reply->lookup_status = response_code;
-    if (res != CURLE_OK)
+    if (res == CURLE_OK)
     {
-        LOGT("%s(): curl request failed!!", __func__);
-        url_reply->connection_error = true;
-        fqdn_req->to_report = false;
-        url_reply->error = res;
-        gk_response = GK_CONNECTION_ERROR;
-        goto error;
-    }
-
-    stats = &fsm_gk_session->health_stats;
-    stats->cloud_lookups++;
-
-    LOGT("%s(): %zu bytes retrieved", __func__, chunk.size);
-    if (chunk.size == 0)
-    {
-        gk_response = GK_CONNECTION_ERROR;
-        goto error;
+        stats = &fsm_gk_session->health_stats;
+        stats->cloud_lookups++;
     }
 
-    ret = gk_process_curl_response(&chunk, gk_verdict);
-    if (ret == false) gk_response = GK_SERVICE_ERROR;
+    gk_response = gk_process_reply(session, fsm_gk_session, gk_verdict,
+                                   res, response_code, &chunk);
 
-    /* if the curl reponse was successful and reply processing failed
-     * treate it as service failures.
-     */
-    if (gk_response == GK_SERVICE_ERROR) gk_update_categorization_count(fsm_gk_session);
-
-    /* update uncategorized counter (reply with category-id 15) */
-    gk_update_uncategorized_count(fsm_gk_session, gk_verdict);
-
-error:
     free(chunk.memory);
     return gk_response;
 }
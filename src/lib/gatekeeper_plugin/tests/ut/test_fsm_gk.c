@@ -31,6 +31,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/socket.h>
 #include <curl/curl.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "gatekeeper_multi_curl.h"
 #include "gatekeeper_single_curl.h"
@@ -38,6 +42,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "fsm_dpi_sni.h"
 #include "gatekeeper_data.h"
 #include "gatekeeper.h"
+#include "gatekeeper.pb-c.h"
 #include "wc_telemetry.h"
 #include "json_util.h"
 #include "json_mqtt.h"
@@ -364,9 +369,6 @@ dummy_gatekeeper_get_verdict(struct fsm_session *session,
 
     fqdn_req->categorized = FSM_FQDN_CAT_SUCCESS;
 
-#ifdef CURL_MULTI
-    gk_new_conn(req->url);
-#else
     gk_response = gk_send_request(session, fsm_gk_session, gk_verdict);
     if (gk_response != GK_LOOKUP_SUCCESS)
     {
@@ -382,7 +384,6 @@ dummy_gatekeeper_get_verdict(struct fsm_session *session,
         ret = false;
         goto error;
     }
-#endif
 
     gk_add_policy_to_cache(req);
 
@@ -1517,6 +1518,411 @@ test_endpoint_url(void)
     LOGN("**** Ending test %s ***** ", __func__);
 }
 
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+/*
+ * Mock gatekeeper server: answers each lookup with an accept verdict
+ * after a fixed delay, simulating the cloud round trip.
+ */
+#define MOCK_GK_DELAY 0.02
+#define ASYNC_NUM_FQDNS 128
+#define ASYNC_NUM_DEVICES 2
+
+struct mock_gk_conn
+{
+    struct ev_io io;
+    struct ev_timer timer;
+    char buf[8192];
+    size_t len;
+    int pending;
+};
+
+static struct
+{
+    int fd;
+    struct ev_io io;
+    char url[64];
+    uint8_t reply[64];
+    size_t reply_len;
+    int requests;
+} g_mock_gk;
+
+struct async_req
+{
+    os_macaddr_t dev_mac;
+    struct fqdn_pending_req fqdn_req;
+    struct fsm_url_request req_info;
+    struct fsm_policy_req req;
+};
+
+static int g_async_verdicts;
+
+static void
+mock_gk_close(struct ev_loop *loop, struct mock_gk_conn *conn)
+{
+    ev_io_stop(loop, &conn->io);
+    ev_timer_stop(loop, &conn->timer);
+    close(conn->io.fd);
+    free(conn);
+}
+
+static void
+mock_gk_reply_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    struct mock_gk_conn *conn;
+    char hdr[128];
+    ssize_t rc;
+    int len;
+
+    conn = w->data;
+    len = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: application/octet-stream\r\n"
+                   "Content-Length: %zu\r\n\r\n", g_mock_gk.reply_len);
+    for (; conn->pending > 0; conn->pending--)
+    {
+        rc = write(conn->io.fd, hdr, len);
+        if (rc != len) break;
+        rc = write(conn->io.fd, g_mock_gk.reply, g_mock_gk.reply_len);
+        if (rc != (ssize_t)g_mock_gk.reply_len) break;
+    }
+}
+
+static void
+mock_gk_read_cb(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    struct mock_gk_conn *conn;
+    size_t content_len;
+    size_t req_len;
+    char *hdr_end;
+    char *cl;
+    ssize_t n;
+
+    conn = w->data;
+    n = read(w->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len - 1);
+    if (n <= 0)
+    {
+        mock_gk_close(loop, conn);
+        return;
+    }
+    conn->len += n;
+    conn->buf[conn->len] = '\0';
+
+    /* consume the complete requests */
+    while ((hdr_end = strstr(conn->buf, "\r\n\r\n")) != NULL)
+    {
+        content_len = 0;
+        cl = strstr(conn->buf, "Content-Length:");
+        if (cl != NULL && cl < hdr_end) content_len = strtoul(cl + 15, NULL, 10);
+
+        req_len = (hdr_end + 4 - conn->buf) + content_len;
+        if (conn->len < req_len) break;
+
+        memmove(conn->buf, conn->buf + req_len, conn->len - req_len);
+        conn->len -= req_len;
+        conn->buf[conn->len] = '\0';
+        conn->pending++;
+        g_mock_gk.requests++;
+    }
+
+    if (conn->pending == 0 || ev_is_active(&conn->timer)) return;
+
+    ev_timer_set(&conn->timer, MOCK_GK_DELAY, 0.);
+    ev_timer_start(loop, &conn->timer);
+}
+
+static void
+mock_gk_accept_cb(struct ev_loop *loop, struct ev_io *w, int revents)
+{
+    struct mock_gk_conn *conn;
+    int fd;
+
+    fd = accept(w->fd, NULL, NULL);
+    if (fd < 0) return;
+
+    conn = calloc(1, sizeof(*conn));
+    TEST_ASSERT_NOT_NULL(conn);
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    ev_io_init(&conn->io, mock_gk_read_cb, fd, EV_READ);
+    conn->io.data = conn;
+    ev_io_start(loop, &conn->io);
+    ev_init(&conn->timer, mock_gk_reply_cb);
+    conn->timer.data = conn;
+}
+
+static void
+mock_gk_start(struct ev_loop *loop)
+{
+    Gatekeeper__Southbound__V1__GatekeeperCommonReply header =
+        GATEKEEPER__SOUTHBOUND__V1__GATEKEEPER_COMMON_REPLY__INIT;
+    Gatekeeper__Southbound__V1__GatekeeperFqdnReply fqdn =
+        GATEKEEPER__SOUTHBOUND__V1__GATEKEEPER_FQDN_REPLY__INIT;
+    Gatekeeper__Southbound__V1__GatekeeperReply reply =
+        GATEKEEPER__SOUTHBOUND__V1__GATEKEEPER_REPLY__INIT;
+    struct sockaddr_in addr;
+    socklen_t len;
+    int rc;
+
+    header.action = GATEKEEPER__SOUTHBOUND__V1__GATEKEEPER_ACTION__GATEKEEPER_ACTION_ACCEPT;
+    header.ttl = 300;
+    header.category_id = 1;
+    fqdn.header = &header;
+    reply.reply_fqdn = &fqdn;
+    g_mock_gk.reply_len = gatekeeper__southbound__v1__gatekeeper_reply__get_packed_size(&reply);
+    TEST_ASSERT_TRUE(g_mock_gk.reply_len <= sizeof(g_mock_gk.reply));
+    gatekeeper__southbound__v1__gatekeeper_reply__pack(&reply, g_mock_gk.reply);
+
+    g_mock_gk.fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(g_mock_gk.fd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    rc = bind(g_mock_gk.fd, (struct sockaddr *)&addr, sizeof(addr));
+    TEST_ASSERT_EQUAL_INT(0, rc);
+    rc = listen(g_mock_gk.fd, 128);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    len = sizeof(addr);
+    getsockname(g_mock_gk.fd, (struct sockaddr *)&addr, &len);
+    snprintf(g_mock_gk.url, sizeof(g_mock_gk.url), "http://127.0.0.1:%u",
+             ntohs(addr.sin_port));
+
+    ev_io_init(&g_mock_gk.io, mock_gk_accept_cb, g_mock_gk.fd, EV_READ);
+    ev_io_start(loop, &g_mock_gk.io);
+}
+
+static void
+async_resume(struct fqdn_pending_req *fqdn_req)
+{
+    struct async_req *areq;
+
+    areq = CONTAINER_OF(fqdn_req, struct async_req, fqdn_req);
+    fsm_free_url_reply(areq->req_info.reply);
+    areq->req_info.reply = NULL;
+    gatekeeper_get_verdict(fqdn_req->fsm_context, &areq->req);
+    if (areq->req.reply.action == FSM_ALLOW) g_async_verdicts++;
+    if (g_async_verdicts == ASYNC_NUM_FQDNS * ASYNC_NUM_DEVICES)
+    {
+        ev_break(fqdn_req->fsm_context->loop, EVBREAK_ALL);
+    }
+}
+
+static void
+async_timeout_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    ev_break(loop, EVBREAK_ALL);
+}
+
+/**
+ * @brief issues lookups for a burst of fqdns from several devices,
+ *        and waits for all the verdicts
+ *
+ * @return the elapsed time in seconds
+ */
+static double
+run_async_lookups(struct fsm_session *session, int run, int max_inflight)
+{
+    struct async_req *areqs;
+    struct async_req *areq;
+    struct ev_timer timeout;
+    struct http2_curl *cmgr;
+    struct timespec start;
+    struct timespec end;
+    int nreqs;
+    int i;
+
+    cmgr = get_curl_multi_mgr();
+    cmgr->max_inflight = max_inflight;
+    g_async_verdicts = 0;
+
+    nreqs = ASYNC_NUM_FQDNS * ASYNC_NUM_DEVICES;
+    areqs = calloc(nreqs, sizeof(*areqs));
+    TEST_ASSERT_NOT_NULL(areqs);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nreqs; i++)
+    {
+        areq = &areqs[i];
+        areq->dev_mac.addr[5] = (i % ASYNC_NUM_DEVICES) + 1;
+        snprintf(areq->req_info.url, sizeof(areq->req_info.url),
+                 "run%d-host%d.example.com", run, i / ASYNC_NUM_DEVICES);
+        areq->fqdn_req.req_info = &areq->req_info;
+        areq->fqdn_req.numq = 1;
+        areq->fqdn_req.req_type = FSM_FQDN_REQ;
+        areq->fqdn_req.fsm_context = session;
+        areq->fqdn_req.gatekeeper_resume = async_resume;
+        areq->req.device_id = &areq->dev_mac;
+        areq->req.url = areq->req_info.url;
+        areq->req.fqdn_req = &areq->fqdn_req;
+
+        gatekeeper_get_verdict(session, &areq->req);
+        TEST_ASSERT_EQUAL_INT(FSM_FQDN_CAT_PENDING, areq->fqdn_req.categorized);
+    }
+
+    ev_timer_init(&timeout, async_timeout_cb, 10.0, 0.);
+    ev_timer_start(session->loop, &timeout);
+    ev_run(session->loop, 0);
+    ev_timer_stop(session->loop, &timeout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    TEST_ASSERT_EQUAL_INT(nreqs, g_async_verdicts);
+
+    /* the verdicts are now served from the cache */
+    for (i = 0; i < nreqs; i++)
+    {
+        areq = &areqs[i];
+        fsm_free_url_reply(areq->req_info.reply);
+        areq->req_info.reply = NULL;
+        areq->fqdn_req.gatekeeper_resume = NULL;
+        TEST_ASSERT_TRUE(gatekeeper_get_verdict(session, &areq->req));
+        fsm_free_url_reply(areq->req_info.reply);
+    }
+    free(areqs);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void
+test_async_lookups(void)
+{
+    struct fsm_gk_session *fsm_gk_session;
+    struct gk_curl_easy_info *ecurl;
+    struct fsm_session *session;
+    struct http2_curl *cmgr;
+    char *server_url;
+    double serial;
+    double window;
+    int nreqs;
+
+    session = &g_sessions[0];
+    session->service = session;
+    cmgr = get_curl_multi_mgr();
+    TEST_ASSERT_TRUE(cmgr->initialized);
+
+    fsm_gk_session = gatekeeper_lookup_session(session);
+    ecurl = &fsm_gk_session->ecurl;
+    server_url = ecurl->server_url;
+
+    mock_gk_start(session->loop);
+    ecurl->server_url = g_mock_gk.url;
+    nreqs = ASYNC_NUM_FQDNS * ASYNC_NUM_DEVICES;
+
+    /* one lookup at a time, as the blocking client did */
+    memset(&cmgr->stats, 0, sizeof(cmgr->stats));
+    g_mock_gk.requests = 0;
+    serial = run_async_lookups(session, 0, 1);
+    TEST_ASSERT_EQUAL_INT(ASYNC_NUM_FQDNS, g_mock_gk.requests);
+    TEST_ASSERT_EQUAL_INT(ASYNC_NUM_FQDNS, cmgr->stats.coalesced);
+    TEST_ASSERT_EQUAL_INT(1, cmgr->stats.max_inflight);
+
+    /* default in-flight window */
+    memset(&cmgr->stats, 0, sizeof(cmgr->stats));
+    g_mock_gk.requests = 0;
+    window = run_async_lookups(session, 1, GK_MCURL_MAX_INFLIGHT);
+    TEST_ASSERT_EQUAL_INT(ASYNC_NUM_FQDNS, g_mock_gk.requests);
+    TEST_ASSERT_EQUAL_INT(GK_MCURL_MAX_INFLIGHT, cmgr->stats.max_inflight);
+
+    LOGI("%s: %d verdicts, %d upstream lookups: "
+         "serial %.3f s (%.0f verdicts/s), window of %d %.3f s (%.0f verdicts/s)",
+         __func__, nreqs, ASYNC_NUM_FQDNS,
+         serial, nreqs / serial, GK_MCURL_MAX_INFLIGHT,
+         window, nreqs / window);
+    TEST_ASSERT_TRUE(window < serial);
+
+    ev_io_stop(session->loop, &g_mock_gk.io);
+    close(g_mock_gk.fd);
+    ecurl->server_url = server_url;
+    session->service = NULL;
+}
+
+static int g_exit_resumed;
+
+static void
+exit_resume(struct fqdn_pending_req *fqdn_req)
+{
+    struct async_req *areq;
+    bool ret;
+
+    areq = CONTAINER_OF(fqdn_req, struct async_req, fqdn_req);
+    fsm_free_url_reply(areq->req_info.reply);
+    areq->req_info.reply = NULL;
+    ret = gatekeeper_get_verdict(fqdn_req->fsm_context, &areq->req);
+    TEST_ASSERT_FALSE(ret);
+    TEST_ASSERT_EQUAL_INT(FSM_FQDN_CAT_FAILED, fqdn_req->categorized);
+    TEST_ASSERT_NULL(fqdn_req->gk_lookup);
+    g_exit_resumed++;
+}
+
+/**
+ * @brief the requests parked on pending lookups are resumed with
+ *        an error when curl is torn down
+ */
+void
+test_async_lookups_exit(void)
+{
+    struct fsm_gk_session *fsm_gk_session;
+    struct gk_curl_easy_info *ecurl;
+    struct fsm_session *session;
+    gk_mcurl_done_cb done_cb;
+    struct http2_curl *cmgr;
+    struct async_req *areqs;
+    struct async_req *areq;
+    char *server_url;
+    int nreqs;
+    int i;
+
+    session = &g_sessions[0];
+    session->service = session;
+    cmgr = get_curl_multi_mgr();
+    TEST_ASSERT_TRUE(cmgr->initialized);
+    done_cb = cmgr->done_cb;
+
+    fsm_gk_session = gatekeeper_lookup_session(session);
+    ecurl = &fsm_gk_session->ecurl;
+    server_url = ecurl->server_url;
+    ecurl->server_url = "http://127.0.0.1:9";
+
+    /* some lookups in flight, the others in the backlog */
+    cmgr->max_inflight = 2;
+    g_exit_resumed = 0;
+    nreqs = ASYNC_NUM_FQDNS * ASYNC_NUM_DEVICES;
+    areqs = calloc(nreqs, sizeof(*areqs));
+    TEST_ASSERT_NOT_NULL(areqs);
+
+    for (i = 0; i < nreqs; i++)
+    {
+        areq = &areqs[i];
+        areq->dev_mac.addr[5] = (i % ASYNC_NUM_DEVICES) + 1;
+        snprintf(areq->req_info.url, sizeof(areq->req_info.url),
+                 "exit-host%d.example.com", i / ASYNC_NUM_DEVICES);
+        areq->fqdn_req.req_info = &areq->req_info;
+        areq->fqdn_req.numq = 1;
+        areq->fqdn_req.req_type = FSM_FQDN_REQ;
+        areq->fqdn_req.fsm_context = session;
+        areq->fqdn_req.gatekeeper_resume = exit_resume;
+        areq->req.device_id = &areq->dev_mac;
+        areq->req.url = areq->req_info.url;
+        areq->req.fqdn_req = &areq->fqdn_req;
+
+        gatekeeper_get_verdict(session, &areq->req);
+        TEST_ASSERT_EQUAL_INT(FSM_FQDN_CAT_PENDING, areq->fqdn_req.categorized);
+    }
+    TEST_ASSERT_EQUAL_INT(2, cmgr->inflight);
+
+    TEST_ASSERT_TRUE(gk_curl_exit());
+    TEST_ASSERT_EQUAL_INT(nreqs, g_exit_resumed);
+    TEST_ASSERT_FALSE(fsm_gk_session->gk_offline.provider_offline);
+
+    for (i = 0; i < nreqs; i++) fsm_free_url_reply(areqs[i].req_info.reply);
+    free(areqs);
+
+    TEST_ASSERT_TRUE(gk_multi_curl_init(session->loop, done_cb));
+    ecurl->server_url = server_url;
+    session->service = NULL;
+}
+#endif
+
 int
 main(int argc, char *argv[])
 {
@@ -1529,6 +1935,12 @@ main(int argc, char *argv[])
 
     UnityBegin(test_name);
 
+#ifdef CONFIG_GATEKEEPER_ASYNC_LOOKUP
+    /* runs against a local mock server */
+    RUN_TEST(test_async_lookups);
+    RUN_TEST(test_async_lookups_exit);
+#endif
+
     ret = file_present(g_certs_file);
     if (ret == false)
     {
@@ -44,6 +44,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * distributed under a MIT license
  */
 
+/**
+ * @brief endpoint of the fsm -> fcm flow reports channel
+ *
+ * shm:// endpoints select the shared memory transport.
+ */
+#if defined(CONFIG_FSM_SHM_IMC)
+#define IMC_FSM2FCM_ENDPOINT "shm:///tmp/imc_fsm2fcm_shm"
+#else
+#define IMC_FSM2FCM_ENDPOINT "ipc:///tmp/imc_fsm2fcm"
+#endif
+
 /**
  * @brief Receive callback provided by the manager
  *
@@ -54,6 +65,7 @@ typedef void (*unix_recv)(void *, size_t);
 struct imc_context;
 struct imc_dso;
 struct imc_sockoption;
+struct imc_shm;
 struct unix_context;
 
 typedef void (*imc_ev_cbfn)(struct ev_loop *, struct imc_context *, int);
@@ -63,6 +75,8 @@ typedef void (*imc_free_sndmsg)(void *, void *);
 typedef int (*init_client)(struct imc_context *, imc_free_sndmsg, void *);
 typedef void (*terminate_client)(struct imc_context *);
 typedef int (*client_send)(struct imc_context *, void *, size_t , int);
+typedef void *(*client_reserve)(struct imc_context *, size_t);
+typedef int (*client_commit)(struct imc_context *, size_t);
 
 typedef int (*init_server)(struct imc_context *, struct ev_loop *, imc_recv);
 typedef void (*terminate_server)(struct imc_context *);
@@ -88,6 +102,8 @@ struct imc_dso
     init_client init_client;
     terminate_client terminate_client;
     client_send client_send;
+    client_reserve client_reserve;
+    client_commit client_commit;
 
     init_server init_server;
     terminate_server terminate_server;
@@ -139,6 +155,7 @@ struct imc_context
     ev_io w_io;
     bool initialized;
     ds_list_t options;
+    struct imc_shm *shm;    /* shared memory transport, shm:// endpoints */
     uint64_t io_success_cnt;
     uint64_t io_failure_cnt;
 };
@@ -298,6 +315,31 @@ int
 imc_send(struct imc_context *context, void *buf, size_t buflen, int flags);
 
 
+/**
+ * @brief reserves room for a message in a shared memory client's ring
+ *
+ * Lets the caller build the message in place, skipping the copy
+ * done by imc_send(). Only supported by shm:// endpoints.
+ *
+ * @param context the client context
+ * @param len the message size
+ * @return a pointer to the message buffer, NULL if no room is available
+ */
+void *
+imc_reserve(struct imc_context *context, size_t len);
+
+
+/**
+ * @brief sends the message previously reserved with imc_reserve()
+ *
+ * @param context the client context
+ * @param len the message size, up to the reserved size
+ * @return 0 if successful, -1 otherwise
+ */
+int
+imc_commit(struct imc_context *context, size_t len);
+
+
 /**
  * @brief send data to a unix server
  *
@@ -393,6 +435,20 @@ imc_send(struct imc_context *context, void *buf, size_t buflen, int flags)
 }
 
 
+static inline void *
+imc_reserve(struct imc_context *context, size_t len)
+{
+    return NULL;
+}
+
+
+static inline int
+imc_commit(struct imc_context *context, size_t len)
+{
+    return -1;
+}
+
+
 static inline int
 unix_send(struct unix_context *context, void *buf, size_t buflen, int flags)
 {
@@ -0,0 +1,199 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef IMC_SHM_H_INCLUDED
+#define IMC_SHM_H_INCLUDED
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "imc.h"
+
+/**
+ * Shared memory transport of the imc library.
+ *
+ * Selected by a "shm://<path>" endpoint. The server (consumer) owns a
+ * memfd backed single producer, single consumer ring and an eventfd
+ * doorbell. It listens on the unix socket <path> and hands both file
+ * descriptors to the one producer it accepts at a time.
+ * Records are written in place in the ring by the producer, and passed
+ * in place to the server's receive routine.
+ */
+
+#define IMC_SHM_SCHEME "shm://"
+
+#define IMC_SHM_MAGIC 0x494d4353 /* "IMCS" */
+#define IMC_SHM_VERSION 1
+
+#define IMC_SHM_RING_SIZE (4 * 1024 * 1024)
+
+#define IMC_SHM_ATTACH_TIMEOUT_MS 100
+
+#define IMC_SHM_REC_PAD 0x1
+
+
+/**
+ * @brief shared ring header, at the start of the shared memory
+ *
+ * head and tail are free running byte offsets, each on its own cache line.
+ * head is only written by the producer, tail only by the consumer.
+ */
+struct imc_shm_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;       /* ring data size, power of 2 */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+
+/**
+ * @brief ring record header. The payload follows, padded to 8 bytes.
+ */
+struct imc_shm_rec
+{
+    uint32_t len;
+    uint32_t flags;
+};
+
+
+/**
+ * @brief shared memory transport state of an imc context
+ */
+struct imc_shm
+{
+    char *path;                /* unix socket path of the endpoint */
+    struct imc_shm_hdr *hdr;
+    uint8_t *data;
+    size_t map_size;
+    int mem_fd;
+    int event_fd;
+    int sock_fd;               /* listening socket or producer connection */
+    int peer_fd;               /* server: accepted producer connection */
+    bool attached;             /* client: ring mapped */
+    uint64_t rsv_head;         /* client: head of the pending reservation */
+    size_t rsv_len;            /* client: reserved payload length */
+    ev_io w_accept;
+    ev_io w_peer;
+    ev_io w_event;
+    uint64_t doorbells;        /* client: # of consumer wake ups */
+    uint64_t drops;            /* client: # of records not sent */
+    uint64_t wakeups;          /* server: # of doorbell events */
+    uint64_t records;          /* server: # of records received */
+    uint64_t resets;           /* server: # of corrupted rings discarded */
+};
+
+
+/**
+ * @brief checks if an endpoint selects the shared memory transport
+ *
+ * @param endpoint the imc endpoint
+ * @return true if the endpoint starts with IMC_SHM_SCHEME
+ */
+bool
+imc_shm_endpoint(const char *endpoint);
+
+
+/**
+ * @brief initiates a shared memory imc server
+ *
+ * @param server the server context
+ * @param loop the ev loop
+ * @param recv_cb user provided data processing routine
+ * @return 0 if successful, -1 otherwise
+ */
+int
+imc_shm_init_server(struct imc_context *server, struct ev_loop *loop,
+                    imc_recv recv_cb);
+
+
+/**
+ * @brief terminates a shared memory imc server
+ *
+ * @param server the server context
+ */
+void
+imc_shm_terminate_server(struct imc_context *server);
+
+
+/**
+ * @brief initiates a shared memory imc client
+ *
+ * A client not yet attached to its server retries attaching on send.
+ *
+ * @param client the client context
+ * @return 0 if successful, -1 otherwise
+ */
+int
+imc_shm_init_client(struct imc_context *client);
+
+
+/**
+ * @brief terminates a shared memory imc client
+ *
+ * @param client the client context
+ */
+void
+imc_shm_terminate_client(struct imc_context *client);
+
+
+/**
+ * @brief copies a buffer in the ring
+ *
+ * @param client the client context
+ * @param buf the buffer to send
+ * @param buflen the buffer size
+ * @return 0 if successful, -1 otherwise
+ */
+int
+imc_shm_send(struct imc_context *client, void *buf, size_t buflen);
+
+
+/**
+ * @brief reserves room for a record in the ring
+ *
+ * @param client the client context
+ * @param len the record length
+ * @return a pointer to the record payload, NULL if the ring is full
+ */
+void *
+imc_shm_reserve(struct imc_context *client, size_t len);
+
+
+/**
+ * @brief publishes the record previously reserved
+ *
+ * @param client the client context
+ * @param len the record length, up to the reserved length
+ * @return 0 if successful, -1 otherwise
+ */
+int
+imc_shm_commit(struct imc_context *client, size_t len);
+
+#endif /* IMC_SHM_H_INCLUDED */
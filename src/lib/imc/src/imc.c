@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <zmq.h>
 
 #include "imc.h"
+#include "imc_shm.h"
 #include "log.h"
 
 #define MAX_BUFFER_SIZE 64000
@@ -434,6 +435,11 @@ imc_init_server(struct imc_context *server, struct ev_loop *loop,
     void *zctx;
     int rc;
 
+    if (imc_shm_endpoint(server->endpoint))
+    {
+        return imc_shm_init_server(server, loop, recv_cb);
+    }
+
     server->recv_fn = recv_cb;
     server->imc_ev_cb = imc_ev_recv_cb;
 
@@ -507,6 +513,12 @@ err_free_zctx:
 void
 imc_terminate_server(struct imc_context *server)
 {
+    if (server->shm != NULL)
+    {
+        imc_shm_terminate_server(server);
+        return;
+    }
+
     ev_prepare_stop(server->loop, &server->w_prepare);
     ev_check_stop(server->loop, &server->w_check);
     ev_idle_stop(server->loop, &server->w_idle);
@@ -567,6 +579,13 @@ imc_init_client(struct imc_context *client, imc_free_sndmsg free_snd_msg,
     void *zctx;
     int rc;
 
+    if (imc_shm_endpoint(client->endpoint))
+    {
+        client->imc_free_sndmsg = free_snd_msg;
+        client->free_msg_hint = free_msg_hint;
+        return imc_shm_init_client(client);
+    }
+
     /* Allocate a zmq context */
     zctx = zmq_ctx_new();
     if (zctx == NULL)
@@ -648,6 +667,12 @@ unix_terminate_client(struct unix_context *client)
 void
 imc_terminate_client(struct imc_context *client)
 {
+    if (client->shm != NULL)
+    {
+        imc_shm_terminate_client(client);
+        return;
+    }
+
     if (client->zctx == NULL) return;
 
     zmq_close(client->zsock);
@@ -666,6 +691,8 @@ imc_terminate_client(struct imc_context *client)
  * The data to be sent must be dynamically allocated as opposed to be
  * coming from the stack, as the zmq_msg_send() might have just queued
  * the message for transmission (see man page)
+ * The shared memory transport copies the data in its ring and frees
+ * it right away.
  *
  * @param context the socket context
  * @param buf the buffer to send
@@ -678,6 +705,16 @@ imc_send(struct imc_context *client, void *buf, size_t buflen, int flags)
     zmq_msg_t msg;
     int rc;
 
+    if (client->shm != NULL)
+    {
+        rc = imc_shm_send(client, buf, buflen);
+        if (client->imc_free_sndmsg != NULL)
+        {
+            client->imc_free_sndmsg(buf, client->free_msg_hint);
+        }
+        return rc;
+    }
+
     zmq_msg_init_data(&msg, buf, buflen, client->imc_free_sndmsg, NULL);
     rc = zmq_msg_send(&msg, client->zsock, flags);
     if (rc == -1)
@@ -692,6 +729,35 @@ imc_send(struct imc_context *client, void *buf, size_t buflen, int flags)
     return 0;
 }
 
+/**
+ * @brief reserves room for a message in a shared memory client's ring
+ *
+ * @param client the client context
+ * @param len the message size
+ */
+void *
+imc_reserve(struct imc_context *client, size_t len)
+{
+    if (client->shm == NULL) return NULL;
+
+    return imc_shm_reserve(client, len);
+}
+
+
+/**
+ * @brief sends the message previously reserved with imc_reserve()
+ *
+ * @param client the client context
+ * @param len the message size
+ */
+int
+imc_commit(struct imc_context *client, size_t len)
+{
+    if (client->shm == NULL) return -1;
+
+    return imc_shm_commit(client, len);
+}
+
 /**
  * @brief send data to a unix server
  *
@@ -730,6 +796,8 @@ imc_init_dso(struct imc_dso *dso)
     dso->init_client = imc_init_client;
     dso->terminate_client = imc_terminate_client;
     dso->client_send = imc_send;
+    dso->client_reserve = imc_reserve;
+    dso->client_commit = imc_commit;
     dso->init_server = imc_init_server;
     dso->terminate_server = imc_terminate_server;
     dso->add_sockopt = imc_add_sockopt;
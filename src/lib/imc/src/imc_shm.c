@@ -0,0 +1,766 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ev.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "imc.h"
+#include "imc_shm.h"
+#include "log.h"
+
+#define IMC_SHM_ALIGN(len) (((len) + 7) & ~((size_t)7))
+
+
+/**
+ * @brief checks if an endpoint selects the shared memory transport
+ */
+bool
+imc_shm_endpoint(const char *endpoint)
+{
+    if (endpoint == NULL) return false;
+
+    return (strncmp(endpoint, IMC_SHM_SCHEME, strlen(IMC_SHM_SCHEME)) == 0);
+}
+
+
+/**
+ * @brief allocates the transport state of a context
+ */
+static struct imc_shm *
+imc_shm_alloc(struct imc_context *context)
+{
+    struct sockaddr_un addr;
+    struct imc_shm *shm;
+    const char *path;
+
+    path = context->endpoint + strlen(IMC_SHM_SCHEME);
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        LOGE("%s: endpoint %s too long", __func__, context->endpoint);
+        return NULL;
+    }
+
+    shm = calloc(1, sizeof(*shm));
+    if (shm == NULL) return NULL;
+
+    shm->path = strdup(path);
+    if (shm->path == NULL)
+    {
+        free(shm);
+        return NULL;
+    }
+
+    shm->mem_fd = -1;
+    shm->event_fd = -1;
+    shm->sock_fd = -1;
+    shm->peer_fd = -1;
+
+    return shm;
+}
+
+
+/**
+ * @brief releases the transport state of a context
+ */
+static void
+imc_shm_free(struct imc_shm *shm)
+{
+    if (shm->hdr != NULL) munmap(shm->hdr, shm->map_size);
+    if (shm->mem_fd >= 0) close(shm->mem_fd);
+    if (shm->event_fd >= 0) close(shm->event_fd);
+    if (shm->sock_fd >= 0) close(shm->sock_fd);
+    if (shm->peer_fd >= 0) close(shm->peer_fd);
+    free(shm->path);
+    free(shm);
+}
+
+
+static void
+imc_shm_set_addr(struct imc_shm *shm, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, shm->path);
+}
+
+
+/**
+ * @brief discards the records of a corrupted ring
+ *
+ * The head and the records are written by the producer: the whole
+ * ring up to the current head is dropped.
+ */
+static uint64_t
+imc_shm_reset(struct imc_context *server, uint64_t head, const char *reason)
+{
+    struct imc_shm *shm;
+
+    shm = server->shm;
+    LOGE("%s: %s: %s, discarding the ring", __func__, server->endpoint, reason);
+    shm->resets++;
+
+    return head;
+}
+
+
+/**
+ * @brief consumes the records available in the ring
+ *
+ * The records are passed in place to the receive routine, and released
+ * to the producer once the routine returns.
+ * The ring size is the one set by the server: the producer can only
+ * move the head and write records, which are validated before use.
+ */
+static void
+imc_shm_drain(struct imc_context *server)
+{
+    struct imc_shm_hdr *hdr;
+    struct imc_shm_rec *rec;
+    struct imc_shm *shm;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t mask;
+    uint64_t avail;
+    uint64_t need;
+    uint32_t flags;
+    uint32_t len;
+    size_t pos;
+
+    shm = server->shm;
+    hdr = shm->hdr;
+    mask = IMC_SHM_RING_SIZE - 1;
+    tail = hdr->tail;
+
+    /*
+     * Publishing the tail then reading the head again pairs with the
+     * producer publishing the head then reading the tail: either the
+     * producer sees the ring drained and rings the doorbell, or the new
+     * records are seen here.
+     */
+    head = __atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST);
+    while (head != tail)
+    {
+        if (head - tail > IMC_SHM_RING_SIZE)
+        {
+            tail = imc_shm_reset(server, head, "head out of the ring");
+        }
+
+        while (tail != head)
+        {
+            pos = tail & mask;
+            rec = (struct imc_shm_rec *)(shm->data + pos);
+
+            /* Read once: the producer may rewrite the record */
+            len = __atomic_load_n(&rec->len, __ATOMIC_RELAXED);
+            flags = __atomic_load_n(&rec->flags, __ATOMIC_RELAXED);
+            avail = head - tail;
+            need = sizeof(*rec) + IMC_SHM_ALIGN((uint64_t)len);
+            if (avail < sizeof(*rec) || len > avail || need > avail)
+            {
+                tail = imc_shm_reset(server, head, "record past the head");
+                break;
+            }
+
+            /* Records never wrap */
+            if (need > IMC_SHM_RING_SIZE - pos)
+            {
+                tail = imc_shm_reset(server, head, "record past the ring end");
+                break;
+            }
+
+            if (!(flags & IMC_SHM_REC_PAD))
+            {
+                server->recv_fn(rec + 1, len);
+                shm->records++;
+            }
+            tail += need;
+        }
+        __atomic_store_n(&hdr->tail, tail, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/**
+ * @brief ev callback of the doorbell
+ */
+static void
+imc_shm_event_cb(EV_P_ ev_io *w, int revents)
+{
+    struct imc_context *server;
+    uint64_t cnt;
+    ssize_t rc;
+
+    server = w->data;
+
+    rc = read(server->shm->event_fd, &cnt, sizeof(cnt));
+    if (rc == sizeof(cnt)) server->shm->wakeups++;
+
+    imc_shm_drain(server);
+}
+
+
+/**
+ * @brief ev callback of the producer connection
+ *
+ * The producer never writes on its connection. Readability means
+ * the producer is gone, and a new one can be accepted.
+ */
+static void
+imc_shm_peer_cb(EV_P_ ev_io *w, int revents)
+{
+    struct imc_context *server;
+    struct imc_shm *shm;
+    char c;
+    ssize_t rc;
+
+    server = w->data;
+    shm = server->shm;
+
+    rc = recv(shm->peer_fd, &c, sizeof(c), MSG_DONTWAIT);
+    if (rc == -1 && (errno == EAGAIN || errno == EINTR)) return;
+
+    LOGD("%s: producer detached from %s", __func__, server->endpoint);
+
+    /* Consume what the producer committed before leaving */
+    imc_shm_drain(server);
+
+    ev_io_stop(EV_A_ w);
+    close(shm->peer_fd);
+    shm->peer_fd = -1;
+}
+
+
+/**
+ * @brief ev callback of the listening socket
+ *
+ * Hands the ring and doorbell descriptors to the producer.
+ * A single producer is accepted at a time.
+ */
+static void
+imc_shm_accept_cb(EV_P_ ev_io *w, int revents)
+{
+    char cbuf[CMSG_SPACE(2 * sizeof(int))];
+    struct imc_context *server;
+    struct cmsghdr *cmsg;
+    struct imc_shm *shm;
+    struct msghdr msg;
+    struct iovec iov;
+    char c = 0;
+    int fds[2];
+    ssize_t rc;
+    int fd;
+
+    server = w->data;
+    shm = server->shm;
+
+    fd = accept4(shm->sock_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) return;
+
+    if (shm->peer_fd >= 0)
+    {
+        LOGN("%s: %s already has a producer", __func__, server->endpoint);
+        close(fd);
+        return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &c;
+    iov.iov_len = sizeof(c);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    fds[0] = shm->mem_fd;
+    fds[1] = shm->event_fd;
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (rc != sizeof(c))
+    {
+        LOGE("%s: failed to hand over the ring of %s: %s", __func__,
+             server->endpoint, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    shm->peer_fd = fd;
+    ev_io_init(&shm->w_peer, imc_shm_peer_cb, fd, EV_READ);
+    shm->w_peer.data = server;
+    ev_io_start(EV_A_ &shm->w_peer);
+
+    LOGD("%s: producer attached to %s", __func__, server->endpoint);
+}
+
+
+/**
+ * @brief initiates a shared memory imc server
+ */
+int
+imc_shm_init_server(struct imc_context *server, struct ev_loop *loop,
+                    imc_recv recv_cb)
+{
+    struct sockaddr_un addr;
+    struct imc_shm *shm;
+    int rc;
+
+    shm = imc_shm_alloc(server);
+    if (shm == NULL) return -1;
+
+    shm->map_size = sizeof(struct imc_shm_hdr) + IMC_SHM_RING_SIZE;
+    shm->mem_fd = memfd_create("imc_shm", MFD_CLOEXEC);
+    if (shm->mem_fd < 0)
+    {
+        LOGE("%s: memfd_create failed: %s", __func__, strerror(errno));
+        goto err_free_shm;
+    }
+
+    rc = ftruncate(shm->mem_fd, shm->map_size);
+    if (rc != 0)
+    {
+        LOGE("%s: ftruncate failed: %s", __func__, strerror(errno));
+        goto err_free_shm;
+    }
+
+    shm->hdr = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, shm->mem_fd, 0);
+    if (shm->hdr == MAP_FAILED)
+    {
+        LOGE("%s: mmap failed: %s", __func__, strerror(errno));
+        shm->hdr = NULL;
+        goto err_free_shm;
+    }
+
+    shm->hdr->magic = IMC_SHM_MAGIC;
+    shm->hdr->version = IMC_SHM_VERSION;
+    shm->hdr->size = IMC_SHM_RING_SIZE;
+    shm->data = (uint8_t *)(shm->hdr + 1);
+
+    shm->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shm->event_fd < 0)
+    {
+        LOGE("%s: eventfd failed: %s", __func__, strerror(errno));
+        goto err_free_shm;
+    }
+
+    shm->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (shm->sock_fd < 0)
+    {
+        LOGE("%s: failed opening a unix socket: %s", __func__, strerror(errno));
+        goto err_free_shm;
+    }
+
+    imc_shm_set_addr(shm, &addr);
+    unlink(shm->path);
+    rc = bind(shm->sock_fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (rc == 0) rc = listen(shm->sock_fd, 1);
+    if (rc != 0)
+    {
+        LOGE("%s: failed to bind %s: %s", __func__, shm->path, strerror(errno));
+        goto err_free_shm;
+    }
+
+    server->shm = shm;
+    server->recv_fn = recv_cb;
+    server->loop = loop;
+    server->events = EV_READ;
+
+    ev_io_init(&shm->w_accept, imc_shm_accept_cb, shm->sock_fd, EV_READ);
+    shm->w_accept.data = server;
+    ev_io_start(loop, &shm->w_accept);
+
+    ev_io_init(&shm->w_event, imc_shm_event_cb, shm->event_fd, EV_READ);
+    shm->w_event.data = server;
+    ev_io_start(loop, &shm->w_event);
+
+    server->initialized = true;
+
+    return 0;
+
+err_free_shm:
+    imc_shm_free(shm);
+
+    return -1;
+}
+
+
+/**
+ * @brief terminates a shared memory imc server
+ */
+void
+imc_shm_terminate_server(struct imc_context *server)
+{
+    struct imc_shm *shm;
+
+    shm = server->shm;
+    if (shm == NULL) return;
+
+    ev_io_stop(server->loop, &shm->w_accept);
+    ev_io_stop(server->loop, &shm->w_event);
+    if (shm->peer_fd >= 0) ev_io_stop(server->loop, &shm->w_peer);
+
+    unlink(shm->path);
+    imc_shm_free(shm);
+    server->shm = NULL;
+    server->initialized = false;
+}
+
+
+/**
+ * @brief releases the ring of a client
+ */
+static void
+imc_shm_detach(struct imc_shm *shm)
+{
+    if (shm->hdr != NULL) munmap(shm->hdr, shm->map_size);
+    shm->hdr = NULL;
+    shm->data = NULL;
+    if (shm->mem_fd >= 0) close(shm->mem_fd);
+    shm->mem_fd = -1;
+    if (shm->event_fd >= 0) close(shm->event_fd);
+    shm->event_fd = -1;
+    if (shm->sock_fd >= 0) close(shm->sock_fd);
+    shm->sock_fd = -1;
+    shm->rsv_len = 0;
+    shm->attached = false;
+}
+
+
+/**
+ * @brief maps the ring handed over by the server
+ */
+static bool
+imc_shm_map(struct imc_shm *shm, int mem_fd, int event_fd)
+{
+    struct imc_shm_hdr *hdr;
+    struct stat st;
+    int rc;
+
+    shm->mem_fd = mem_fd;
+    shm->event_fd = event_fd;
+
+    rc = fstat(mem_fd, &st);
+    if (rc != 0) return false;
+    if ((size_t)st.st_size <= sizeof(*hdr)) return false;
+
+    hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               mem_fd, 0);
+    if (hdr == MAP_FAILED) return false;
+
+    shm->hdr = hdr;
+    shm->map_size = st.st_size;
+    if (hdr->magic != IMC_SHM_MAGIC || hdr->version != IMC_SHM_VERSION)
+    {
+        LOGE("%s: bad ring header", __func__);
+        return false;
+    }
+
+    if (hdr->size + sizeof(*hdr) > shm->map_size) return false;
+    if (hdr->size & (hdr->size - 1)) return false;
+
+    shm->data = (uint8_t *)(hdr + 1);
+
+    return true;
+}
+
+
+/**
+ * @brief attaches a client to its server's ring
+ *
+ * The connection is kept open: the server accepts one producer at a time
+ * and the client learns of the server's departure through it.
+ *
+ * @param shm the client transport state
+ * @param timeout_ms how long to wait for the server's hand over
+ * @return true if attached, false otherwise
+ */
+static bool
+imc_shm_attach(struct imc_shm *shm, int timeout_ms)
+{
+    char cbuf[CMSG_SPACE(2 * sizeof(int))];
+    struct sockaddr_un addr;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    struct msghdr msg;
+    struct iovec iov;
+    int fds[2];
+    ssize_t rc;
+    char c;
+
+    if (shm->attached) return true;
+
+    if (shm->sock_fd < 0)
+    {
+        shm->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (shm->sock_fd < 0) return false;
+
+        imc_shm_set_addr(shm, &addr);
+        rc = connect(shm->sock_fd, (struct sockaddr *)&addr, sizeof(addr));
+        if (rc != 0) goto err_detach;
+    }
+
+    /* The server hands the ring over from its ev loop */
+    pfd.fd = shm->sock_fd;
+    pfd.events = POLLIN;
+    rc = poll(&pfd, 1, timeout_ms);
+    if (rc == 0) return false;
+    if (rc < 0) goto err_detach;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = sizeof(c);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    rc = recvmsg(shm->sock_fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (rc != sizeof(c)) goto err_detach;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        goto err_detach;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (!imc_shm_map(shm, fds[0], fds[1])) goto err_detach;
+
+    shm->attached = true;
+
+    return true;
+
+err_detach:
+    imc_shm_detach(shm);
+
+    return false;
+}
+
+
+/**
+ * @brief checks if the server closed the client's connection
+ */
+static bool
+imc_shm_server_gone(struct imc_shm *shm)
+{
+    struct pollfd pfd;
+
+    pfd.fd = shm->sock_fd;
+    pfd.events = POLLIN;
+
+    return (poll(&pfd, 1, 0) != 0);
+}
+
+
+/**
+ * @brief initiates a shared memory imc client
+ */
+int
+imc_shm_init_client(struct imc_context *client)
+{
+    struct imc_shm *shm;
+
+    shm = imc_shm_alloc(client);
+    if (shm == NULL) return -1;
+
+    client->shm = shm;
+    client->initialized = true;
+
+    /* Not fatal, the client retries on send */
+    imc_shm_attach(shm, IMC_SHM_ATTACH_TIMEOUT_MS);
+
+    return 0;
+}
+
+
+/**
+ * @brief terminates a shared memory imc client
+ */
+void
+imc_shm_terminate_client(struct imc_context *client)
+{
+    struct imc_shm *shm;
+
+    shm = client->shm;
+    if (shm == NULL) return;
+
+    imc_shm_detach(shm);
+    imc_shm_free(shm);
+    client->shm = NULL;
+    client->initialized = false;
+}
+
+
+/**
+ * @brief reserves room for a record in the ring
+ *
+ * A record never wraps around the end of the ring: the end is skipped
+ * with a padding record, published along with the reserved record.
+ */
+void *
+imc_shm_reserve(struct imc_context *client, size_t len)
+{
+    struct imc_shm_hdr *hdr;
+    struct imc_shm_rec *rec;
+    struct imc_shm *shm;
+    uint64_t head;
+    uint64_t tail;
+    size_t need;
+    size_t room;
+    size_t pos;
+    bool wrap;
+
+    shm = client->shm;
+    if (shm == NULL) return NULL;
+
+    if (!imc_shm_attach(shm, 0)) goto err_drop;
+
+    hdr = shm->hdr;
+    need = sizeof(*rec) + IMC_SHM_ALIGN(len);
+    if (need > hdr->size / 2)
+    {
+        LOGD("%s: %zu bytes record too large", __func__, len);
+        goto err_drop;
+    }
+
+    head = hdr->head;
+    tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    pos = head & (hdr->size - 1);
+    room = hdr->size - pos;
+    wrap = (room < need);
+    if (wrap) need += room;
+
+    if (hdr->size - (head - tail) < need)
+    {
+        /* A consumer gone for good never catches up */
+        if (imc_shm_server_gone(shm)) imc_shm_detach(shm);
+        goto err_drop;
+    }
+
+    if (wrap)
+    {
+        rec = (struct imc_shm_rec *)(shm->data + pos);
+        rec->len = room - sizeof(*rec);
+        rec->flags = IMC_SHM_REC_PAD;
+        head += room;
+        pos = 0;
+    }
+
+    rec = (struct imc_shm_rec *)(shm->data + pos);
+    shm->rsv_head = head;
+    shm->rsv_len = len;
+
+    return rec + 1;
+
+err_drop:
+    shm->drops++;
+
+    return NULL;
+}
+
+
+/**
+ * @brief publishes the record previously reserved
+ */
+int
+imc_shm_commit(struct imc_context *client, size_t len)
+{
+    struct imc_shm_hdr *hdr;
+    struct imc_shm_rec *rec;
+    struct imc_shm *shm;
+    uint64_t old_head;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t one;
+    ssize_t rc;
+
+    shm = client->shm;
+    if (shm == NULL || !shm->attached) return -1;
+    if (len > shm->rsv_len) return -1;
+
+    hdr = shm->hdr;
+    old_head = hdr->head;
+    head = shm->rsv_head;
+    rec = (struct imc_shm_rec *)(shm->data + (head & (hdr->size - 1)));
+    rec->len = len;
+    rec->flags = 0;
+    head += sizeof(*rec) + IMC_SHM_ALIGN(len);
+    shm->rsv_len = 0;
+
+    __atomic_store_n(&hdr->head, head, __ATOMIC_SEQ_CST);
+    tail = __atomic_load_n(&hdr->tail, __ATOMIC_SEQ_CST);
+
+    /* Only wake up a consumer which drained the ring */
+    if (tail != old_head) return 0;
+
+    one = 1;
+    rc = write(shm->event_fd, &one, sizeof(one));
+    if (rc != sizeof(one) && errno != EAGAIN)
+    {
+        LOGD("%s: doorbell failed: %s", __func__, strerror(errno));
+    }
+    shm->doorbells++;
+
+    if (imc_shm_server_gone(shm)) imc_shm_detach(shm);
+
+    return 0;
+}
+
+
+/**
+ * @brief copies a buffer in the ring
+ */
+int
+imc_shm_send(struct imc_context *client, void *buf, size_t buflen)
+{
+    void *rec;
+
+    rec = imc_shm_reserve(client, buflen);
+    if (rec == NULL) return -1;
+
+    memcpy(rec, buf, buflen);
+
+    return imc_shm_commit(client, buflen);
+}
@@ -40,6 +40,7 @@ else
 endif
 
 UNIT_SRC := src/imc.c
+UNIT_SRC += src/imc_shm.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 
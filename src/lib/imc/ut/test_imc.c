@@ -27,9 +27,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ev.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <zmq.h>
 
 #include "imc.h"
+#include "imc_shm.h"
 #include "log.h"
 #include "os.h"
 #include "target.h"
@@ -63,6 +67,16 @@ struct test_mgr
 } g_test_mgr;
 
 
+struct test_imc_bench
+{
+    size_t received;
+    size_t bytes;
+    double latency;
+    bool timed_out;
+    ev_timer guard;
+} g_bench;
+
+
 /**
  * @brief breaks the ev loop to terminate a test
  */
@@ -432,6 +446,290 @@ setup_repeated_send(size_t send_size, int sndhwm, int repeat)
 }
 
 
+static double
+test_elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/**
+ * @brief benchmark receive routine. Messages start with their send time.
+ */
+static void
+bench_recv_cb(void *data, size_t len)
+{
+    struct timespec sent;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TEST_ASSERT_TRUE(len >= sizeof(sent));
+    memcpy(&sent, data, sizeof(sent));
+
+    g_bench.latency += test_elapsed(&sent, &now);
+    g_bench.bytes += len;
+    g_bench.received++;
+}
+
+
+static void
+bench_guard_cb(EV_P_ ev_timer *w, int revents)
+{
+    g_bench.timed_out = true;
+}
+
+
+/**
+ * @brief sends bursts of messages, and waits for each burst's reception
+ *
+ * @param endpoint the imc endpoint to benchmark
+ * @param nmsgs the number of messages to send
+ * @param msg_size the size of the messages
+ * @param burst the number of messages sent before waiting for the server
+ */
+static void
+run_imc_benchmark(char *endpoint, size_t nmsgs, size_t msg_size, size_t burst)
+{
+    struct timespec start, end;
+    struct ev_loop *loop;
+    struct timespec now;
+    double elapsed;
+    size_t sent;
+    uint8_t *buf;
+    size_t i;
+    int rc;
+
+    loop = g_test_mgr.loop;
+    memset(&g_bench, 0, sizeof(g_bench));
+    g_test_mgr.endpoint = strdup(endpoint);
+    TEST_ASSERT_NOT_NULL(g_test_mgr.endpoint);
+
+    allocate_sender_and_receiver();
+
+    rc = imc_init_server(g_test_mgr.server, loop, bench_recv_cb);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    rc = imc_init_client(g_test_mgr.client, free_send_msg, NULL);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    ev_timer_init(&g_bench.guard, bench_guard_cb, 30.0, 0);
+    ev_timer_start(loop, &g_bench.guard);
+
+    sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (sent < nmsgs && !g_bench.timed_out)
+    {
+        for (i = 0; i < burst && sent < nmsgs; i++)
+        {
+            buf = calloc(1, msg_size);
+            TEST_ASSERT_NOT_NULL(buf);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            memcpy(buf, &now, sizeof(now));
+
+            rc = imc_send(g_test_mgr.client, buf, msg_size, IMC_DONTWAIT);
+            if (rc != 0) break;
+            sent++;
+        }
+
+        /* Let the server catch up, or finish connecting */
+        if (g_bench.received == sent) ev_run(loop, EVRUN_NOWAIT);
+        while (g_bench.received < sent && !g_bench.timed_out)
+        {
+            ev_run(loop, EVRUN_ONCE);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ev_timer_stop(loop, &g_bench.guard);
+
+    TEST_ASSERT_FALSE(g_bench.timed_out);
+    TEST_ASSERT_EQUAL_UINT(nmsgs, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(nmsgs * msg_size, g_bench.bytes);
+
+    elapsed = test_elapsed(&start, &end);
+    LOGI("%s: %s: %zu x %zu bytes, burst %zu: %.0f msgs/s, %.1f MB/s, "
+         "avg latency %.1f us", __func__, endpoint, nmsgs, msg_size, burst,
+         nmsgs / elapsed, (nmsgs * msg_size) / elapsed / 1e6,
+         g_bench.latency / nmsgs * 1e6);
+
+    imc_terminate_client(g_test_mgr.client);
+    imc_terminate_server(g_test_mgr.server);
+    free_sender_and_receiver();
+}
+
+
+/**
+ * @brief zmq transport throughput and latency
+ */
+void
+test_imc_benchmark_zmq(void)
+{
+    run_imc_benchmark("ipc:///tmp/bench_test_imc", 10000, 512, 1);
+    run_imc_benchmark("ipc:///tmp/bench_test_imc", 100000, 512, 64);
+}
+
+
+/**
+ * @brief shared memory transport throughput and latency
+ *
+ * The 100k messages wrap around the ring many times.
+ */
+void
+test_imc_benchmark_shm(void)
+{
+    run_imc_benchmark("shm:///tmp/bench_test_imc_shm", 10000, 512, 1);
+    run_imc_benchmark("shm:///tmp/bench_test_imc_shm", 100000, 512, 64);
+}
+
+
+/**
+ * @brief records built in place in the shared memory ring
+ */
+void
+test_imc_shm_reserve_commit(void)
+{
+    struct ev_loop *loop;
+    struct timespec now;
+    uint8_t *rec;
+    int rc;
+
+    loop = g_test_mgr.loop;
+    memset(&g_bench, 0, sizeof(g_bench));
+    g_test_mgr.endpoint = strdup("shm:///tmp/test_imc_shm");
+    TEST_ASSERT_NOT_NULL(g_test_mgr.endpoint);
+
+    allocate_sender_and_receiver();
+
+    rc = imc_init_server(g_test_mgr.server, loop, bench_recv_cb);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    rc = imc_init_client(g_test_mgr.client, free_send_msg, NULL);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    /* The server hands its ring over from the ev loop */
+    rec = imc_reserve(g_test_mgr.client, 64);
+    if (rec == NULL)
+    {
+        ev_run(loop, EVRUN_NOWAIT);
+        rec = imc_reserve(g_test_mgr.client, 64);
+    }
+    TEST_ASSERT_NOT_NULL(rec);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    memcpy(rec, &now, sizeof(now));
+    rc = imc_commit(g_test_mgr.client, sizeof(now));
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    /* Nothing left to commit */
+    rc = imc_commit(g_test_mgr.client, sizeof(now));
+    TEST_ASSERT_EQUAL_INT(-1, rc);
+
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(1, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(sizeof(now), g_bench.bytes);
+
+    imc_terminate_client(g_test_mgr.client);
+    imc_terminate_server(g_test_mgr.server);
+    free_sender_and_receiver();
+}
+
+
+/**
+ * @brief commits a record of the given size in the shared memory ring
+ *
+ * @return the ring header of the record
+ */
+static struct imc_shm_rec *
+test_imc_shm_send(size_t len)
+{
+    uint8_t *rec;
+    int rc;
+
+    rec = imc_reserve(g_test_mgr.client, len);
+    if (rec == NULL)
+    {
+        ev_run(g_test_mgr.loop, EVRUN_NOWAIT);
+        rec = imc_reserve(g_test_mgr.client, len);
+    }
+    TEST_ASSERT_NOT_NULL(rec);
+
+    memset(rec, 0, len);
+    rc = imc_commit(g_test_mgr.client, len);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    return (struct imc_shm_rec *)rec - 1;
+}
+
+
+/**
+ * @brief the server discards a ring corrupted by its producer
+ */
+void
+test_imc_shm_corrupted_ring(void)
+{
+    struct imc_shm_rec *rec;
+    struct imc_shm *server;
+    struct imc_shm *client;
+    struct ev_loop *loop;
+    uint64_t one;
+    ssize_t wr;
+    int rc;
+
+    loop = g_test_mgr.loop;
+    memset(&g_bench, 0, sizeof(g_bench));
+    g_test_mgr.endpoint = strdup("shm:///tmp/test_imc_shm");
+    TEST_ASSERT_NOT_NULL(g_test_mgr.endpoint);
+
+    allocate_sender_and_receiver();
+
+    rc = imc_init_server(g_test_mgr.server, loop, bench_recv_cb);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    rc = imc_init_client(g_test_mgr.client, free_send_msg, NULL);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    server = g_test_mgr.server->shm;
+    client = g_test_mgr.client->shm;
+
+    test_imc_shm_send(64);
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(1, g_bench.received);
+
+    /* A record longer than what the producer published */
+    rec = test_imc_shm_send(64);
+    rec->len = 4096;
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(1, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(1, server->resets);
+
+    /* A record longer than the ring */
+    rec = test_imc_shm_send(64);
+    rec->len = UINT32_MAX;
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(1, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(2, server->resets);
+
+    /* A head beyond the ring size */
+    client->hdr->head += 2 * IMC_SHM_RING_SIZE;
+    one = 1;
+    wr = write(client->event_fd, &one, sizeof(one));
+    TEST_ASSERT_EQUAL_INT(sizeof(one), wr);
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(1, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(3, server->resets);
+
+    /* The ring is usable again */
+    test_imc_shm_send(64);
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_UINT(2, g_bench.received);
+    TEST_ASSERT_EQUAL_UINT(3, server->resets);
+
+    imc_terminate_client(g_test_mgr.client);
+    imc_terminate_server(g_test_mgr.server);
+    free_sender_and_receiver();
+}
+
+
 void test_events(void)
 {
     setup_basic_send_receive();
@@ -458,6 +756,10 @@ main(int argc, char *argv[])
     imc_global_test_setup();
 
     RUN_TEST(test_events);
+    RUN_TEST(test_imc_shm_reserve_commit);
+    RUN_TEST(test_imc_shm_corrupted_ring);
+    RUN_TEST(test_imc_benchmark_zmq);
+    RUN_TEST(test_imc_benchmark_shm);
 
     return UNITY_END();
 }
@@ -456,6 +456,16 @@ ipthreat_dpi_policy_req(struct ipthreat_dpi_req *ip_req)
     policy_req.acc = ip_req->acc;
     fsm_apply_policies(session, &policy_req);
 
+    /* Verdict pending. Keep inspecting, the next lookup will hit the cache */
+    if (fqdn_req.categorized == FSM_FQDN_CAT_PENDING)
+    {
+        free(policy_req.reply.policy);
+        free(policy_req.reply.rule_name);
+        fsm_free_url_reply(fqdn_req.req_info->reply);
+        free(fqdn_req.req_info);
+        return FSM_DPI_INSPECT;
+    }
+
     fqdn_req.action = policy_req.reply.action;
     fqdn_req.policy = policy_req.reply.policy;
     fqdn_req.policy_idx = policy_req.reply.policy_idx;
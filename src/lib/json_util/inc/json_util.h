@@ -49,6 +49,30 @@ extern char *JSON_SPLIT_ERROR;
 
 extern char        *json_split(char *str);
 
+/*
+ * Incremental framer for a stream of concatenated JSON objects, as read
+ * from a JSON-RPC socket. Data is appended at the tail of the buffer and
+ * complete messages are returned in place, the scan resuming where it
+ * stopped.
+ */
+struct json_stream
+{
+    char               *jss_buf;        /* Stream buffer */
+    size_t              jss_size;       /* Allocated size */
+    size_t              jss_head;       /* Start of the first unconsumed message */
+    size_t              jss_tail;       /* End of received data */
+    size_t              jss_scan;       /* Framer position */
+    int                 jss_level;      /* {} nesting level at jss_scan */
+    int                 jss_mode;       /* Framer state at jss_scan */
+};
+
+extern void         json_stream_init(struct json_stream *jss);
+extern void         json_stream_reset(struct json_stream *jss);
+extern size_t       json_stream_used(struct json_stream *jss);
+extern char        *json_stream_reserve(struct json_stream *jss, size_t min_free, size_t *free_sz);
+extern void         json_stream_commit(struct json_stream *jss, size_t len);
+extern int          json_stream_next(struct json_stream *jss, char **msg, size_t *msg_len);
+
 extern const char  *json_dumps_static(const json_t *json, int flags);
 extern bool         json_gets(const json_t *json, char *output, size_t output_sz, int flags);
 extern bool         json_get_str(const json_t *json, char *output, size_t output_sz);
@@ -0,0 +1,208 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "json_util.h"
+
+/*
+ * Framer states; the scan position is either between messages, inside the
+ * braces of a message, inside a string or right after a \ in a string
+ */
+enum json_stream_mode
+{
+    JSON_STREAM_IDLE,
+    JSON_STREAM_BRACES,
+    JSON_STREAM_QUOTES,
+    JSON_STREAM_ESCAPE
+};
+
+/*
+ * A buffer emptied of a message larger than this many reservations is
+ * released rather than kept around
+ */
+#define JSON_STREAM_SHRINK_FACTOR   4
+
+void json_stream_init(struct json_stream *jss)
+{
+    memset(jss, 0, sizeof(*jss));
+    jss->jss_mode = JSON_STREAM_IDLE;
+}
+
+void json_stream_reset(struct json_stream *jss)
+{
+    free(jss->jss_buf);
+    json_stream_init(jss);
+}
+
+size_t json_stream_used(struct json_stream *jss)
+{
+    return jss->jss_tail - jss->jss_head;
+}
+
+/**
+ * Return a pointer to at least min_free bytes of free space at the tail of
+ * the stream buffer, the available size is stored in free_sz.
+ *
+ * Consumed data is dropped by moving the pending partial message to the
+ * front of the buffer, which happens at most once per buffer fill. The
+ * buffer grows as needed, there is no ceiling on the message size.
+ *
+ * Returns NULL if the buffer could not be allocated.
+ */
+char *json_stream_reserve(struct json_stream *jss, size_t min_free, size_t *free_sz)
+{
+    size_t new_size;
+    size_t used;
+    char *new_buf;
+
+    used = json_stream_used(jss);
+
+    /* Everything was consumed, release a buffer grown by a large message */
+    if (used == 0)
+    {
+        jss->jss_head = jss->jss_tail = jss->jss_scan = 0;
+        if (jss->jss_size > JSON_STREAM_SHRINK_FACTOR * min_free)
+        {
+            free(jss->jss_buf);
+            jss->jss_buf = NULL;
+            jss->jss_size = 0;
+        }
+    }
+
+    if (jss->jss_size - jss->jss_tail < min_free && jss->jss_head > 0)
+    {
+        memmove(jss->jss_buf, jss->jss_buf + jss->jss_head, used);
+        jss->jss_scan -= jss->jss_head;
+        jss->jss_tail = used;
+        jss->jss_head = 0;
+    }
+
+    if (jss->jss_size - jss->jss_tail < min_free)
+    {
+        new_size = jss->jss_size * 2;
+        if (new_size < used + min_free) new_size = used + min_free;
+
+        new_buf = realloc(jss->jss_buf, new_size);
+        if (new_buf == NULL)
+        {
+            LOG(ERR, "json_stream: realloc(%zu -> %zu) failed", jss->jss_size, new_size);
+            return NULL;
+        }
+
+        if (jss->jss_size > 0)
+        {
+            LOG(TRACE, "json_stream: buffer resized %zu -> %zu", jss->jss_size, new_size);
+        }
+
+        jss->jss_buf = new_buf;
+        jss->jss_size = new_size;
+    }
+
+    *free_sz = jss->jss_size - jss->jss_tail;
+    return jss->jss_buf + jss->jss_tail;
+}
+
+/**
+ * Account for len bytes written at the pointer returned by json_stream_reserve()
+ */
+void json_stream_commit(struct json_stream *jss, size_t len)
+{
+    jss->jss_tail += len;
+}
+
+/**
+ * Extract the next complete JSON object from the stream. The scan resumes
+ * where the previous call stopped, so each byte is examined only once.
+ *
+ * On success, msg points to the message inside the stream buffer and
+ * msg_len holds its length; the message is not NUL terminated (use
+ * json_loadb()) and stays valid until the next json_stream_reserve().
+ *
+ * Returns 1 if a message was extracted, 0 if more data is needed and -1 if
+ * the stream does not contain a JSON object.
+ */
+int json_stream_next(struct json_stream *jss, char **msg, size_t *msg_len)
+{
+    char c;
+
+    while (jss->jss_scan < jss->jss_tail)
+    {
+        c = jss->jss_buf[jss->jss_scan++];
+
+        switch (jss->jss_mode)
+        {
+            /* Between messages, skip whitespaces */
+            case JSON_STREAM_IDLE:
+                if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+                {
+                    jss->jss_head = jss->jss_scan;
+                    break;
+                }
+
+                if (c != '{') return -1;
+
+                jss->jss_level = 1;
+                jss->jss_mode = JSON_STREAM_BRACES;
+                break;
+
+            /* Standard {} match */
+            case JSON_STREAM_BRACES:
+                if (c == '{')
+                {
+                    jss->jss_level++;
+                }
+                else if (c == '"')
+                {
+                    jss->jss_mode = JSON_STREAM_QUOTES;
+                }
+                else if (c == '}' && --jss->jss_level == 0)
+                {
+                    *msg = jss->jss_buf + jss->jss_head;
+                    *msg_len = jss->jss_scan - jss->jss_head;
+                    jss->jss_head = jss->jss_scan;
+                    jss->jss_mode = JSON_STREAM_IDLE;
+                    return 1;
+                }
+                break;
+
+            /* "" match, escape sequences are validated by the parser */
+            case JSON_STREAM_QUOTES:
+                if (c == '"') jss->jss_mode = JSON_STREAM_BRACES;
+                else if (c == '\\') jss->jss_mode = JSON_STREAM_ESCAPE;
+                break;
+
+            case JSON_STREAM_ESCAPE:
+                jss->jss_mode = JSON_STREAM_QUOTES;
+                break;
+        }
+    }
+
+    /* End reached before a complete message was found */
+    return 0;
+}
@@ -31,6 +31,7 @@ UNIT_NAME := jsutil
 UNIT_TYPE := LIB
 
 UNIT_SRC := src/string.c
+UNIT_SRC += src/stream.c
 UNIT_SRC += src/memdbg.c
 UNIT_SRC += src/future.c
 
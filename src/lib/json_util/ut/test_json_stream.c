@@ -0,0 +1,316 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <jansson.h>
+#include <string.h>
+
+#include "json_util.h"
+#include "log.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "json_util_tests";
+
+#define TEST_JSS_MAX_MSGS 16
+
+static struct json_stream g_jss;
+
+/**
+ * @brief messages extracted from the stream, NUL terminated
+ */
+static char *g_msgs[TEST_JSS_MAX_MSGS];
+static int g_nmsgs;
+
+
+void
+setUp(void)
+{
+    json_stream_init(&g_jss);
+    memset(g_msgs, 0, sizeof(g_msgs));
+    g_nmsgs = 0;
+}
+
+
+void
+tearDown(void)
+{
+    int i;
+
+    for (i = 0; i < g_nmsgs; i++) free(g_msgs[i]);
+    json_stream_reset(&g_jss);
+}
+
+
+/**
+ * @brief appends one read of len bytes to the stream, then extracts all
+ *        the complete messages
+ *
+ * Returns the last json_stream_next() return code.
+ */
+static int
+test_jss_read(const char *data, size_t len)
+{
+    size_t msg_len;
+    size_t free_sz;
+    char *msg;
+    char *buf;
+    int rc;
+
+    buf = json_stream_reserve(&g_jss, len > 0 ? len : 1, &free_sz);
+    TEST_ASSERT_NOT_NULL(buf);
+    TEST_ASSERT_TRUE(free_sz >= len);
+    memcpy(buf, data, len);
+    json_stream_commit(&g_jss, len);
+
+    while ((rc = json_stream_next(&g_jss, &msg, &msg_len)) > 0)
+    {
+        TEST_ASSERT_TRUE(g_nmsgs < TEST_JSS_MAX_MSGS);
+        g_msgs[g_nmsgs++] = strndup(msg, msg_len);
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief feeds a stream in reads of chunk bytes
+ */
+static int
+test_jss_feed(const char *data, size_t chunk)
+{
+    size_t len;
+    size_t off;
+    int rc;
+
+    rc = 0;
+    for (off = 0; off < strlen(data); off += len)
+    {
+        len = strlen(data) - off;
+        if (len > chunk) len = chunk;
+
+        rc = test_jss_read(data + off, len);
+        if (rc < 0) break;
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief checks that an extracted message parses to the expected value
+ */
+static void
+test_jss_check_msg(int idx, const char *key, const char *value)
+{
+    json_error_t error;
+    json_t *json;
+
+    TEST_ASSERT_TRUE(idx < g_nmsgs);
+    json = json_loads(g_msgs[idx], 0, &error);
+    TEST_ASSERT_NOT_NULL_MESSAGE(json, error.text);
+    TEST_ASSERT_EQUAL_STRING(value, json_string_value(json_object_get(json, key)));
+    json_decref(json);
+}
+
+
+/**
+ * @brief a message split across reads is returned once complete, whatever
+ *        the split point
+ */
+void
+test_stream_split_reads(void)
+{
+    const char *msg = "{\"method\":\"update\",\"params\":[null,{\"Wifi_Stats_Config\":{}}],\"id\":null}";
+    size_t chunk;
+    int i;
+
+    for (chunk = 1; chunk < strlen(msg); chunk++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, test_jss_feed(msg, chunk));
+        TEST_ASSERT_EQUAL_INT(1, g_nmsgs);
+        TEST_ASSERT_EQUAL_STRING(msg, g_msgs[0]);
+        test_jss_check_msg(0, "method", "update");
+        TEST_ASSERT_EQUAL_UINT(0, json_stream_used(&g_jss));
+
+        for (i = 0; i < g_nmsgs; i++) free(g_msgs[i]);
+        g_nmsgs = 0;
+    }
+
+    /* Nothing is returned until the closing brace arrives */
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read(msg, strlen(msg) - 1));
+    TEST_ASSERT_EQUAL_INT(0, g_nmsgs);
+    TEST_ASSERT_EQUAL_UINT(strlen(msg) - 1, json_stream_used(&g_jss));
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read("}", 1));
+    TEST_ASSERT_EQUAL_INT(1, g_nmsgs);
+}
+
+
+/**
+ * @brief several messages in one read, with or without whitespaces in
+ *        between, and a partial message trailing them
+ */
+void
+test_stream_multiple_messages(void)
+{
+    const char *read_1 = "{\"id\":\"1\"}{\"id\":\"2\"}\n{\"id\":\"3\"} \r\n\t{\"id\":\"4\",\"r\":{\"x\":[1,{\"y\":2}]}}{\"id\"";
+    const char *read_2 = ":\"5\"}";
+
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read(read_1, strlen(read_1)));
+    TEST_ASSERT_EQUAL_INT(4, g_nmsgs);
+    test_jss_check_msg(0, "id", "1");
+    test_jss_check_msg(1, "id", "2");
+    test_jss_check_msg(2, "id", "3");
+    test_jss_check_msg(3, "id", "4");
+    TEST_ASSERT_EQUAL_UINT(strlen("{\"id\""), json_stream_used(&g_jss));
+
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read(read_2, strlen(read_2)));
+    TEST_ASSERT_EQUAL_INT(5, g_nmsgs);
+    test_jss_check_msg(4, "id", "5");
+    TEST_ASSERT_EQUAL_UINT(0, json_stream_used(&g_jss));
+}
+
+
+/**
+ * @brief braces and escaped quotes inside strings do not end a message
+ */
+void
+test_stream_strings(void)
+{
+    const char *stream =
+        "{\"s\":\"}\"}"
+        "{\"s\":\"{{{\"}"
+        "{\"s\":\"a\\\"}b\"}"
+        "{\"s\":\"\\\\\"}"
+        "{\"s\":\"\\\\\\\"}\"}"
+        "{\"s\":\"\\u007d\"}"
+        "{\"}\":\"{\"}";
+    size_t chunk;
+    int i;
+
+    /* Split at every byte, including between a \ and the escaped char */
+    for (chunk = 1; chunk <= strlen(stream); chunk++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, test_jss_feed(stream, chunk));
+        TEST_ASSERT_EQUAL_INT(7, g_nmsgs);
+        test_jss_check_msg(0, "s", "}");
+        test_jss_check_msg(1, "s", "{{{");
+        test_jss_check_msg(2, "s", "a\"}b");
+        test_jss_check_msg(3, "s", "\\");
+        test_jss_check_msg(4, "s", "\\\"}");
+        test_jss_check_msg(5, "s", "}");
+        test_jss_check_msg(6, "}", "{");
+        TEST_ASSERT_EQUAL_UINT(0, json_stream_used(&g_jss));
+
+        for (i = 0; i < g_nmsgs; i++) free(g_msgs[i]);
+        g_nmsgs = 0;
+    }
+}
+
+
+/**
+ * @brief a stream which does not start with an object is rejected
+ */
+void
+test_stream_malformed(void)
+{
+    /* Not an object */
+    TEST_ASSERT_EQUAL_INT(-1, test_jss_read("[1,2]", 5));
+    json_stream_reset(&g_jss);
+
+    TEST_ASSERT_EQUAL_INT(-1, test_jss_read(" \n\"str\"", 7));
+    json_stream_reset(&g_jss);
+
+    /* Garbage after a complete message, which is still returned */
+    TEST_ASSERT_EQUAL_INT(-1, test_jss_read("{\"id\":\"1\"}x{}", 13));
+    TEST_ASSERT_EQUAL_INT(1, g_nmsgs);
+    test_jss_check_msg(0, "id", "1");
+    json_stream_reset(&g_jss);
+
+    /* Stray closing brace between messages */
+    TEST_ASSERT_EQUAL_INT(-1, test_jss_read("{}}", 3));
+    TEST_ASSERT_EQUAL_INT(2, g_nmsgs);
+    json_stream_reset(&g_jss);
+
+    /* Balanced braces are framed, the parser rejects the content */
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read("{\"a\" 1 {}}", 10));
+    TEST_ASSERT_EQUAL_INT(3, g_nmsgs);
+    TEST_ASSERT_NULL(json_loads(g_msgs[2], 0, NULL));
+}
+
+
+/**
+ * @brief a large message grows the buffer, which is released once consumed
+ */
+void
+test_stream_large_message(void)
+{
+    size_t size;
+    size_t len;
+    char *msg;
+    int i;
+
+    size = 256 * 1024;
+    msg = malloc(size);
+    TEST_ASSERT_NOT_NULL(msg);
+
+    len = snprintf(msg, size, "{\"s\":\"");
+    for (i = 0; len < size - 64; i++) msg[len++] = "{}x"[i % 3];
+    len += snprintf(msg + len, size - len, "\"}");
+
+    TEST_ASSERT_EQUAL_INT(0, test_jss_feed(msg, 4096));
+    TEST_ASSERT_EQUAL_INT(1, g_nmsgs);
+    TEST_ASSERT_EQUAL_UINT(len, strlen(g_msgs[0]));
+    TEST_ASSERT_TRUE(g_jss.jss_size >= len);
+
+    /* The next reservation releases the grown buffer */
+    TEST_ASSERT_EQUAL_INT(0, test_jss_read("{}", 2));
+    TEST_ASSERT_EQUAL_INT(2, g_nmsgs);
+    TEST_ASSERT_TRUE(g_jss.jss_size < len);
+
+    free(msg);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_stream_split_reads);
+    RUN_TEST(test_stream_multiple_messages);
+    RUN_TEST(test_stream_strings);
+    RUN_TEST(test_stream_malformed);
+    RUN_TEST(test_stream_large_message);
+
+    return UNITY_END();
+}
@@ -27,6 +27,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef LAN_STATS_H_INCLUDED
 #define LAN_STATS_H_INCLUDED
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <libmnl/libmnl.h>
+
+#include "ds_tree.h"
+#include "os_types.h"
+
 #define MAC_ADDR_STR_LEN     (18)
 #define OVS_DPCTL_DUMP_FLOWS "ovs-dpctl dump-flows -m"
 #define LINE_BUFF_LEN        (2048)
@@ -78,4 +85,112 @@ typedef struct dp_ctl_stats_
 } dp_ctl_stats_t;
 
 
+#define LAN_STATS_DP_NAME          "ovs-system"
+#define LAN_STATS_DPIF_BUF_SIZE    (32768)
+
+/*
+ * Counters of a datapath flow as of the previous dump, keyed by ufid.
+ */
+struct lan_stats_dp_counters
+{
+    ovs_u128        ufid;
+    uint64_t        pkts;
+    uint64_t        bytes;
+    uint32_t        generation;     // dump the flow was last seen in
+    ds_tree_node_t  node;
+};
+
+/*
+ * Datapath flows collector speaking the OVS generic netlink flow family.
+ */
+struct lan_stats_dpif
+{
+    struct mnl_socket   *nl;
+    char                *buf;           // LAN_STATS_DPIF_BUF_SIZE bytes
+    uint16_t            flow_family;    // ovs_flow generic netlink family
+    int                 dp_ifindex;     // datapath local port ifindex
+    uint32_t            seq;
+    bool                changed_only;   // skip flows whose counters did not move
+    ds_tree_t           last_stats;     // struct lan_stats_dp_counters
+    uint32_t            generation;     // current dump
+    size_t              nflows;         // flows seen in the current dump
+    size_t              nskipped;       // unchanged flows skipped
+};
+
+
+/**
+ * @brief adds a datapath flow to the flows collected in this interval
+ *
+ * Takes ownership of the flow. Flows sharing the same key are merged.
+ */
+void
+lan_stats_merge_flow(dp_ctl_stats_t *stats);
+
+
+/**
+ * @brief initializes the flows bookkeeping of a collector
+ *
+ * Leaves the collector without a netlink socket, able to decode replies.
+ */
+void
+lan_stats_dpif_ctx_init(struct lan_stats_dpif *dpif, bool changed_only);
+
+
+/**
+ * @brief opens the netlink collector of a datapath
+ *
+ * @param dpif the collector to initialize
+ * @param dp_name the datapath name
+ * @param changed_only report only flows whose counters moved since the
+ *        previous dump
+ * @return 0 if successful, -1 otherwise
+ */
+int
+lan_stats_dpif_init(struct lan_stats_dpif *dpif, const char *dp_name,
+                    bool changed_only);
+
+
+/**
+ * @brief closes a netlink collector and frees its resources
+ */
+void
+lan_stats_dpif_exit(struct lan_stats_dpif *dpif);
+
+
+/**
+ * @brief dumps the datapath flows into the collected flows
+ *
+ * @return 0 if successful, -1 otherwise
+ */
+int
+lan_stats_dpif_dump(struct lan_stats_dpif *dpif);
+
+
+/**
+ * @brief starts processing a flows dump
+ */
+void
+lan_stats_dpif_dump_start(struct lan_stats_dpif *dpif);
+
+
+/**
+ * @brief decodes an OVS_FLOW_CMD_GET reply
+ *
+ * @param nlh the netlink message
+ * @param data the struct lan_stats_dpif collector
+ * @return MNL_CB_OK
+ */
+int
+lan_stats_dpif_data_cb(const struct nlmsghdr *nlh, void *data);
+
+
+/**
+ * @brief ends processing a flows dump
+ *
+ * Forgets the counters of the flows which were not part of the dump.
+ */
+void
+lan_stats_dpif_dump_end(struct lan_stats_dpif *dpif);
+
+
 #endif /* LAN_STATS_H_INCLUDED */
@@ -49,6 +49,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static char *dflt_fltr_name = "none";
 static char *collect_cmd = OVS_DPCTL_DUMP_FLOWS;
 
+/* Netlink datapath flows collector, used unless dp_collect is "dpctl" */
+static struct lan_stats_dpif lan_stats_dpif;
+static bool lan_stats_dpif_active;
+
 /* Copied from openvswitchd */
 /* Returns the value of 'c' as a hexadecimal digit. */
 int
@@ -326,7 +330,7 @@ static dp_ctl_stats_t *parse_lan_stats(char *buf[])
     return stats;
 }
 
-static void merge_flows(dp_ctl_stats_t *new)
+void lan_stats_merge_flow(dp_ctl_stats_t *new)
 {
     dp_ctl_stats_t *old = NULL;
 
@@ -362,7 +366,7 @@ static void parse_flows(char *buf)
     }
     tokens[i] = NULL;
     new = parse_lan_stats(tokens);
-    merge_flows(new);
+    lan_stats_merge_flow(new);
 }
 
 
@@ -459,14 +463,17 @@ static void send_aggr_report(fcm_collect_plugin_t *collector)
     }
 }
 
-static void set_filter_info(fcm_filter_l2_info_t *l2_filter_info,
+static void set_filter_info(fcm_filter_flow_t *l2_filter_info,
                             fcm_filter_stats_t *l2_filter_pkts,
                             dp_ctl_stats_t *stats)
 {
-    STRSCPY(l2_filter_info->src_mac, stats->smac_addr);
-    STRSCPY(l2_filter_info->dst_mac, stats->dmac_addr);
+    memset(l2_filter_info, 0, sizeof(*l2_filter_info));
+    l2_filter_info->has_l2 = true;
+    l2_filter_info->smac = stats->smac_key;
+    l2_filter_info->smac_valid = true;
+    l2_filter_info->dmac = stats->dmac_key;
+    l2_filter_info->dmac_valid = true;
     l2_filter_info->vlan_id = stats->vlan_id;
-    l2_filter_info->eth_type = stats->eth_val;
 
     l2_filter_pkts->pkt_cnt = stats->pkts;
     l2_filter_pkts->bytes = stats->bytes;
@@ -532,10 +539,25 @@ static void lan_stats_send_report_cb(fcm_collect_plugin_t *collector)
 }
 
 
+static void lan_stats_clean_flows(ds_tree_t *tree);
+
 static void lan_stats_collect_flows(fcm_collect_plugin_t *collector)
 {
     FILE *fp = NULL;
     char line_buf[LINE_BUFF_LEN] = {0,};
+    int rc;
+
+    if (lan_stats_dpif_active)
+    {
+        rc = lan_stats_dpif_dump(&lan_stats_dpif);
+        if (rc == 0) return;
+
+        LOGI("%s: netlink dump failed, falling back to %s", __func__,
+             OVS_DPCTL_DUMP_FLOWS);
+        lan_stats_dpif_exit(&lan_stats_dpif);
+        lan_stats_dpif_active = false;
+        lan_stats_clean_flows(&flow_tracker_list);
+    }
 
     collect_cmd  = collector->fcm_plugin_ctx;
     if (collect_cmd == NULL)
@@ -559,7 +581,7 @@ static void lan_stats_collect_flows(fcm_collect_plugin_t *collector)
 
 static void lan_stats_flows_filter(fcm_collect_plugin_t *collector, ds_tree_t *tree)
 {
-    fcm_filter_l2_info_t l2_filter_info;
+    fcm_filter_flow_t    l2_filter_info;
     fcm_filter_stats_t   l2_filter_pkts;
     bool allow = false;
     dp_ctl_stats_t *stats, *next;
@@ -570,28 +592,30 @@ static void lan_stats_flows_filter(fcm_collect_plugin_t *collector, ds_tree_t *t
         set_filter_info(&l2_filter_info, &l2_filter_pkts, stats);
         if (collector->filters.collect != NULL)
         {
-            fcm_filter_layer2_apply(collector->filters.collect,
-                                  &l2_filter_info, &l2_filter_pkts, &allow);
+            fcm_filter_flow_apply(collector->filters.collect,
+                                  &l2_filter_info, &l2_filter_pkts, NULL, &allow);
             if (allow)
             {
                 LOGD("Flow collect allowed: filter_name: %s, ufid: "PRI_os_ufid_t \
-                     " smac: %s, dmac: %s, vlan_id: %d, eth_type: %d, pks: %ld, " \
-                     "bytes: %ld\n",\
+                     " smac: "PRI_os_macaddr_lower_t", dmac: "PRI_os_macaddr_lower_t \
+                     ", vlan_id: %d, eth_type: %d, pks: %ld, bytes: %ld\n",\
                       collector->filters.collect ?
                       collector->filters.collect : dflt_fltr_name,
                       FMT_os_ufid_t_pt(&stats->ufid.id),
-                      stats->smac_addr,
-                      stats->dmac_addr, stats->vlan_id, stats->eth_val,
+                      FMT_os_macaddr_pt(&stats->smac_key),
+                      FMT_os_macaddr_pt(&stats->dmac_key),
+                      stats->vlan_id, stats->eth_val,
                       stats->pkts, stats->bytes);
                 aggr_add_sample(collector, stats);
             }
             else
-                LOGD("Flow collect dropped: filter_name: %s, smac: %s, "\
-                     "dmac: %s, vlan_id: %d, eth_type: %d, pks: %ld, "\
-                     "bytes: %ld\n",\
+                LOGD("Flow collect dropped: filter_name: %s, smac: "\
+                     PRI_os_macaddr_lower_t", dmac: "PRI_os_macaddr_lower_t\
+                     ", vlan_id: %d, eth_type: %d, pks: %ld, bytes: %ld\n",\
                       collector->filters.collect ?
                       collector->filters.collect : dflt_fltr_name,
-                      stats->smac_addr, stats->dmac_addr,
+                      FMT_os_macaddr_pt(&stats->smac_key),
+                      FMT_os_macaddr_pt(&stats->dmac_key),
                       stats->vlan_id, stats->eth_val, stats->pkts, stats->bytes);
         }
         else
@@ -639,6 +663,9 @@ void lan_stats_plugin_close_cb(fcm_collect_plugin_t *collector)
 {
     struct net_md_aggregator *aggr = NULL;
 
+    if (lan_stats_dpif_active) lan_stats_dpif_exit(&lan_stats_dpif);
+    lan_stats_dpif_active = false;
+
     aggr = collector->plugin_ctx;
     if (aggr == NULL)
     {
@@ -650,6 +677,50 @@ void lan_stats_plugin_close_cb(fcm_collect_plugin_t *collector)
 }
 
 
+static char *lan_stats_get_other_config(fcm_collect_plugin_t *collector,
+                                        char *key)
+{
+    if (collector->get_other_config == NULL) return NULL;
+
+    return collector->get_other_config(collector, key);
+}
+
+
+/*
+ * Datapath flows are dumped over netlink unless dp_collect is set to
+ * "dpctl", or the ovs_flow family is not available.
+ */
+static void lan_stats_dpif_setup(fcm_collect_plugin_t *collector)
+{
+    char *changed_only;
+    char *dp_collect;
+    char *dp_name;
+    int rc;
+
+    lan_stats_dpif_active = false;
+
+    dp_collect = lan_stats_get_other_config(collector, "dp_collect");
+    if (dp_collect != NULL && strcmp(dp_collect, "dpctl") == 0) return;
+
+    /* A custom collect command implies the dpctl text output */
+    if (collector->fcm_plugin_ctx != NULL) return;
+
+    dp_name = lan_stats_get_other_config(collector, "ovs_dp_name");
+    changed_only = lan_stats_get_other_config(collector, "dp_changed_only");
+
+    rc = lan_stats_dpif_init(&lan_stats_dpif, dp_name,
+                             changed_only != NULL &&
+                             strcmp(changed_only, "true") == 0);
+    if (rc != 0)
+    {
+        LOGI("%s: falling back to %s", __func__, OVS_DPCTL_DUMP_FLOWS);
+        return;
+    }
+
+    lan_stats_dpif_active = true;
+}
+
+
 /* Entry function for plugin */
 int lan_stats_plugin_init(fcm_collect_plugin_t *collector)
 {
@@ -659,6 +730,7 @@ int lan_stats_plugin_init(fcm_collect_plugin_t *collector)
     collect_cmd  = collector->fcm_plugin_ctx;
     if (collect_cmd == NULL)
         collect_cmd = OVS_DPCTL_DUMP_FLOWS;
+    lan_stats_dpif_setup(collector);
     alloc_aggr(collector);
     activate_window(collector);
     return 0;
@@ -0,0 +1,509 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libmnl/libmnl.h>
+#include <linux/genetlink.h>
+#include <linux/openvswitch.h>
+
+#include "ds_tree.h"
+#include "log.h"
+#include "os_types.h"
+#include "lan_stats.h"
+
+/*
+ * Datapath flows collection over the OVS generic netlink flow family.
+ *
+ * Spares the ovs-dpctl fork and its text output parsing: the datapath flows
+ * are dumped with OVS_FLOW_CMD_GET and their attributes decoded in place.
+ * Masks and actions are not requested, only the flow key and stats.
+ */
+
+
+static int
+lan_stats_dpif_ufid_cmp(void *a, void *b)
+{
+    return memcmp(a, b, sizeof(ovs_u128));
+}
+
+
+static int
+lan_stats_dpif_family_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+    int type;
+
+    if (mnl_attr_type_valid(attr, CTRL_ATTR_MAX) < 0) return MNL_CB_OK;
+
+    type = mnl_attr_get_type(attr);
+    if (type == CTRL_ATTR_FAMILY_ID &&
+        mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+    {
+        return MNL_CB_ERROR;
+    }
+
+    tb[type] = attr;
+    return MNL_CB_OK;
+}
+
+
+static int
+lan_stats_dpif_family_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct nlattr *tb[CTRL_ATTR_MAX + 1] = { NULL };
+    struct lan_stats_dpif *dpif;
+
+    dpif = data;
+    mnl_attr_parse(nlh, sizeof(struct genlmsghdr),
+                   lan_stats_dpif_family_attr_cb, tb);
+    if (tb[CTRL_ATTR_FAMILY_ID] == NULL) return MNL_CB_ERROR;
+
+    dpif->flow_family = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief runs a netlink request until its reply is complete
+ */
+static int
+lan_stats_dpif_talk(struct lan_stats_dpif *dpif, struct nlmsghdr *nlh,
+                    mnl_cb_t cb)
+{
+    unsigned int portid;
+    int ret;
+
+    portid = mnl_socket_get_portid(dpif->nl);
+    ret = mnl_socket_sendto(dpif->nl, nlh, nlh->nlmsg_len);
+    if (ret == -1)
+    {
+        LOGE("%s: mnl_socket_sendto failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    ret = mnl_socket_recvfrom(dpif->nl, dpif->buf, LAN_STATS_DPIF_BUF_SIZE);
+    while (ret > 0)
+    {
+        ret = mnl_cb_run(dpif->buf, ret, nlh->nlmsg_seq, portid, cb, dpif);
+        if (ret <= MNL_CB_STOP) break;
+        ret = mnl_socket_recvfrom(dpif->nl, dpif->buf, LAN_STATS_DPIF_BUF_SIZE);
+    }
+
+    if (ret == -1)
+    {
+        LOGE("%s: netlink request failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static struct nlmsghdr *
+lan_stats_dpif_put_header(struct lan_stats_dpif *dpif, uint16_t type,
+                          uint16_t flags, uint8_t cmd, uint8_t version)
+{
+    struct genlmsghdr *genl;
+    struct nlmsghdr *nlh;
+
+    nlh = mnl_nlmsg_put_header(dpif->buf);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = ++dpif->seq;
+
+    genl = mnl_nlmsg_put_extra_header(nlh, sizeof(*genl));
+    genl->cmd = cmd;
+    genl->version = version;
+
+    return nlh;
+}
+
+
+/**
+ * @brief resolves the id of the ovs_flow generic netlink family
+ */
+static int
+lan_stats_dpif_get_family(struct lan_stats_dpif *dpif)
+{
+    struct nlmsghdr *nlh;
+    int rc;
+
+    nlh = lan_stats_dpif_put_header(dpif, GENL_ID_CTRL, NLM_F_ACK,
+                                    CTRL_CMD_GETFAMILY, 1);
+    mnl_attr_put_strz(nlh, CTRL_ATTR_FAMILY_NAME, OVS_FLOW_FAMILY);
+
+    dpif->flow_family = 0;
+    rc = lan_stats_dpif_talk(dpif, nlh, lan_stats_dpif_family_cb);
+    if (rc != 0 || dpif->flow_family == 0) return -1;
+
+    return 0;
+}
+
+
+void
+lan_stats_dpif_ctx_init(struct lan_stats_dpif *dpif, bool changed_only)
+{
+    memset(dpif, 0, sizeof(*dpif));
+    ds_tree_init(&dpif->last_stats, lan_stats_dpif_ufid_cmp,
+                 struct lan_stats_dp_counters, node);
+    dpif->changed_only = changed_only;
+}
+
+
+int
+lan_stats_dpif_init(struct lan_stats_dpif *dpif, const char *dp_name,
+                    bool changed_only)
+{
+    int rc;
+
+    lan_stats_dpif_ctx_init(dpif, changed_only);
+
+    if (dp_name == NULL) dp_name = LAN_STATS_DP_NAME;
+
+    /* The datapath is addressed by the ifindex of its local port */
+    dpif->dp_ifindex = if_nametoindex(dp_name);
+    if (dpif->dp_ifindex == 0)
+    {
+        LOGI("%s: datapath %s not found", __func__, dp_name);
+        return -1;
+    }
+
+    dpif->buf = calloc(1, LAN_STATS_DPIF_BUF_SIZE);
+    if (dpif->buf == NULL) return -1;
+
+    dpif->nl = mnl_socket_open(NETLINK_GENERIC);
+    if (dpif->nl == NULL)
+    {
+        LOGE("%s: mnl_socket_open failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    rc = mnl_socket_bind(dpif->nl, 0, MNL_SOCKET_AUTOPID);
+    if (rc < 0)
+    {
+        LOGE("%s: mnl_socket_bind failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    dpif->seq = time(NULL);
+    rc = lan_stats_dpif_get_family(dpif);
+    if (rc != 0)
+    {
+        LOGI("%s: %s family not available", __func__, OVS_FLOW_FAMILY);
+        goto err;
+    }
+
+    LOGI("%s: collecting %s flows over netlink, family %u%s", __func__,
+         dp_name, dpif->flow_family,
+         changed_only ? ", changed flows only" : "");
+
+    return 0;
+
+err:
+    lan_stats_dpif_exit(dpif);
+    return -1;
+}
+
+
+void
+lan_stats_dpif_exit(struct lan_stats_dpif *dpif)
+{
+    struct lan_stats_dp_counters *counters, *next;
+
+    counters = ds_tree_head(&dpif->last_stats);
+    while (counters != NULL)
+    {
+        next = ds_tree_next(&dpif->last_stats, counters);
+        ds_tree_remove(&dpif->last_stats, counters);
+        free(counters);
+        counters = next;
+    }
+
+    if (dpif->nl != NULL) mnl_socket_close(dpif->nl);
+    dpif->nl = NULL;
+
+    free(dpif->buf);
+    dpif->buf = NULL;
+}
+
+
+void
+lan_stats_dpif_dump_start(struct lan_stats_dpif *dpif)
+{
+    dpif->generation++;
+    dpif->nflows = 0;
+    dpif->nskipped = 0;
+}
+
+
+void
+lan_stats_dpif_dump_end(struct lan_stats_dpif *dpif)
+{
+    struct lan_stats_dp_counters *counters, *next;
+    size_t purged;
+
+    purged = 0;
+    counters = ds_tree_head(&dpif->last_stats);
+    while (counters != NULL)
+    {
+        next = ds_tree_next(&dpif->last_stats, counters);
+        if (counters->generation != dpif->generation)
+        {
+            ds_tree_remove(&dpif->last_stats, counters);
+            free(counters);
+            purged++;
+        }
+        counters = next;
+    }
+
+    LOGD("%s: %zu flows dumped, %zu unchanged skipped, %zu expired",
+         __func__, dpif->nflows, dpif->nskipped, purged);
+}
+
+
+/**
+ * @brief checks whether the counters of a flow moved since the last dump
+ *
+ * Records the flow's current counters along the way.
+ */
+static bool
+lan_stats_dpif_flow_changed(struct lan_stats_dpif *dpif, dp_ctl_stats_t *stats)
+{
+    struct lan_stats_dp_counters *counters;
+    bool changed;
+
+    counters = ds_tree_find(&dpif->last_stats, &stats->ufid);
+    if (counters == NULL)
+    {
+        counters = calloc(1, sizeof(*counters));
+        if (counters == NULL) return true;
+
+        counters->ufid = stats->ufid;
+        ds_tree_insert(&dpif->last_stats, counters, &counters->ufid);
+        changed = true;
+    }
+    else
+    {
+        changed = (counters->pkts != stats->pkts ||
+                   counters->bytes != stats->bytes);
+    }
+
+    counters->pkts = stats->pkts;
+    counters->bytes = stats->bytes;
+    counters->generation = dpif->generation;
+
+    return changed;
+}
+
+
+static int
+lan_stats_dpif_flow_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+
+    if (mnl_attr_type_valid(attr, OVS_FLOW_ATTR_MAX) < 0) return MNL_CB_OK;
+
+    tb[mnl_attr_get_type(attr)] = attr;
+    return MNL_CB_OK;
+}
+
+
+static int
+lan_stats_dpif_key_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+
+    if (mnl_attr_type_valid(attr, OVS_KEY_ATTR_MAX) < 0) return MNL_CB_OK;
+
+    tb[mnl_attr_get_type(attr)] = attr;
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief reads a big endian 16 bits key attribute
+ */
+static bool
+lan_stats_dpif_key_be16(const struct nlattr *attr, uint16_t *val)
+{
+    uint16_t be16;
+
+    if (attr == NULL) return false;
+    if (mnl_attr_get_payload_len(attr) != sizeof(be16)) return false;
+
+    memcpy(&be16, mnl_attr_get_payload(attr), sizeof(be16));
+    *val = ntohs(be16);
+
+    return true;
+}
+
+
+/**
+ * @brief decodes the layer 2 fields of a flow key
+ */
+static bool
+lan_stats_dpif_parse_key(const struct nlattr *key, dp_ctl_stats_t *stats)
+{
+    const struct nlattr *encap[OVS_KEY_ATTR_MAX + 1] = { NULL };
+    const struct nlattr *tb[OVS_KEY_ATTR_MAX + 1] = { NULL };
+    struct ovs_key_ethernet eth;
+    uint16_t eth_type;
+    uint16_t tci;
+    int rc;
+
+    rc = mnl_attr_parse_nested(key, lan_stats_dpif_key_attr_cb, tb);
+    if (rc < 0) return false;
+
+    if (tb[OVS_KEY_ATTR_ETHERNET] == NULL) return false;
+    if (mnl_attr_get_payload_len(tb[OVS_KEY_ATTR_ETHERNET]) != sizeof(eth))
+    {
+        return false;
+    }
+    memcpy(&eth, mnl_attr_get_payload(tb[OVS_KEY_ATTR_ETHERNET]), sizeof(eth));
+    memcpy(stats->smac_key.addr, eth.eth_src, sizeof(stats->smac_key.addr));
+    memcpy(stats->dmac_key.addr, eth.eth_dst, sizeof(stats->dmac_key.addr));
+
+    if (lan_stats_dpif_key_be16(tb[OVS_KEY_ATTR_ETHERTYPE], &eth_type))
+    {
+        stats->eth_val = eth_type;
+    }
+
+    if (!lan_stats_dpif_key_be16(tb[OVS_KEY_ATTR_VLAN], &tci)) return true;
+
+    stats->vlan_id = tci & 0x0fff;
+
+    if (tb[OVS_KEY_ATTR_ENCAP] == NULL) return true;
+
+    rc = mnl_attr_parse_nested(tb[OVS_KEY_ATTR_ENCAP],
+                               lan_stats_dpif_key_attr_cb, encap);
+    if (rc < 0) return false;
+
+    if (lan_stats_dpif_key_be16(encap[OVS_KEY_ATTR_ETHERTYPE], &eth_type))
+    {
+        stats->vlan_eth_val = eth_type;
+    }
+
+    return true;
+}
+
+
+int
+lan_stats_dpif_data_cb(const struct nlmsghdr *nlh, void *data)
+{
+    const struct nlattr *tb[OVS_FLOW_ATTR_MAX + 1] = { NULL };
+    struct ovs_flow_stats flow_stats;
+    struct lan_stats_dpif *dpif;
+    dp_ctl_stats_t *stats;
+    bool changed;
+    bool rc;
+
+    dpif = data;
+
+    mnl_attr_parse(nlh, sizeof(struct genlmsghdr) + sizeof(struct ovs_header),
+                   lan_stats_dpif_flow_attr_cb, tb);
+
+    if (tb[OVS_FLOW_ATTR_UFID] == NULL || tb[OVS_FLOW_ATTR_KEY] == NULL)
+    {
+        LOGD("%s: skipping flow without ufid or key", __func__);
+        return MNL_CB_OK;
+    }
+
+    if (mnl_attr_get_payload_len(tb[OVS_FLOW_ATTR_UFID]) != sizeof(ovs_u128))
+    {
+        LOGD("%s: skipping flow with a malformed ufid", __func__);
+        return MNL_CB_OK;
+    }
+
+    stats = calloc(1, sizeof(*stats));
+    if (stats == NULL) return MNL_CB_OK;
+
+    memcpy(&stats->ufid, mnl_attr_get_payload(tb[OVS_FLOW_ATTR_UFID]),
+           sizeof(stats->ufid));
+
+    rc = lan_stats_dpif_parse_key(tb[OVS_FLOW_ATTR_KEY], stats);
+    if (!rc)
+    {
+        LOGD("%s: skipping flow "PRI_os_ufid_t" without layer 2 key",
+             __func__, FMT_os_ufid_t_pt(&stats->ufid.id));
+        free(stats);
+        return MNL_CB_OK;
+    }
+
+    /* Flows which never saw a packet carry no stats attribute */
+    if (tb[OVS_FLOW_ATTR_STATS] != NULL &&
+        mnl_attr_get_payload_len(tb[OVS_FLOW_ATTR_STATS]) == sizeof(flow_stats))
+    {
+        memcpy(&flow_stats, mnl_attr_get_payload(tb[OVS_FLOW_ATTR_STATS]),
+               sizeof(flow_stats));
+        stats->pkts = flow_stats.n_packets;
+        stats->bytes = flow_stats.n_bytes;
+    }
+    stats->stime = time(NULL);
+
+    dpif->nflows++;
+    changed = true;
+    if (dpif->changed_only) changed = lan_stats_dpif_flow_changed(dpif, stats);
+    if (!changed)
+    {
+        dpif->nskipped++;
+        free(stats);
+        return MNL_CB_OK;
+    }
+
+    lan_stats_merge_flow(stats);
+
+    return MNL_CB_OK;
+}
+
+
+int
+lan_stats_dpif_dump(struct lan_stats_dpif *dpif)
+{
+    struct ovs_header *ovs_hdr;
+    struct nlmsghdr *nlh;
+    int rc;
+
+    if (dpif->nl == NULL) return -1;
+
+    nlh = lan_stats_dpif_put_header(dpif, dpif->flow_family, NLM_F_DUMP,
+                                    OVS_FLOW_CMD_GET, OVS_FLOW_VERSION);
+    ovs_hdr = mnl_nlmsg_put_extra_header(nlh, sizeof(*ovs_hdr));
+    ovs_hdr->dp_ifindex = dpif->dp_ifindex;
+    mnl_attr_put_u32(nlh, OVS_FLOW_ATTR_UFID_FLAGS,
+                     OVS_UFID_F_OMIT_MASK | OVS_UFID_F_OMIT_ACTIONS);
+
+    lan_stats_dpif_dump_start(dpif);
+    rc = lan_stats_dpif_talk(dpif, nlh, lan_stats_dpif_data_cb);
+    lan_stats_dpif_dump_end(dpif);
+
+    return rc;
+}
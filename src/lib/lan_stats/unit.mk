@@ -36,11 +36,15 @@ UNIT_TYPE := SHLIB
 UNIT_DIR := lib
 
 UNIT_SRC := src/lan_stats.c
+UNIT_SRC += src/lan_stats_dpif.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_CFLAGS += -Isrc/fcm/inc
 UNIT_CFLAGS += -I3rdparty/plume/src/lib/fcm_filter/inc
+UNIT_LDFLAGS := -lmnl
+
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
+UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
 
 UNIT_DEPS := src/lib/const
 UNIT_DEPS += src/lib/log
@@ -0,0 +1,244 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * OVS_FLOW_CMD_GET dump replies of the ovs_flow family to a dump requested
+ * with OVS_UFID_F_OMIT_MASK | OVS_UFID_F_OMIT_ACTIONS, dp_ifindex 7, as
+ * laid out by the kernel datapath (ovs_flow_cmd_fill_info) on x86_64: full
+ * flow keys in __ovs_nla_put_key() order, USED/STATS/TCP_FLAGS only when
+ * set, and the NLMSG_DONE trailing the last flow in the same read.
+ *
+ * First dump:
+ * - 8f1c2a3d: port 2, 00:11:22:33:44:55 > 66:77:88:99:aa:bb, IPv4 TCP
+ *   192.168.40.10:51514 > 93.184.216.34:443, 10 packets, 1000 bytes
+ * - 510be9c4: port 3, 00:11:22:33:44:55 > de:ad:be:ef:00:01, vlan 100,
+ *   IPv6 UDP 2001:db8:40::10:53211 > 2001:db8:40::1:53, 5 packets,
+ *   500 bytes
+ * - e3d2079a: port 4, 02:00:00:00:00:03 > ff:ff:ff:ff:ff:ff, ARP request,
+ *   never hit, so without used and stats attributes
+ * - 0af4b3e1: port 5, layer 3 port, no ethernet key
+ *
+ * Second dump:
+ * - 8f1c2a3d: counters unchanged
+ * - 510be9c4: 7 packets, 700 bytes
+ * - e3d2079a and 0af4b3e1 expired
+ */
+struct mnl_buf
+g_ovs_flow_dump_1[] =
+{
+    {
+        .len = 888,
+        .data =
+        {
+     0xe4, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x02, 0x00,
+     0xd0, 0xe6, 0x7a, 0x5f, 0xb2, 0x9d, 0x2f, 0x00,
+     0x03, 0x01, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x09, 0x00, 0x3d, 0x2a, 0x1c, 0x8f,
+     0x5b, 0x7e, 0x4c, 0x1a, 0x9d, 0x2e, 0x6f, 0x4b,
+     0x8a, 0x0c, 0x7e, 0x13, 0x90, 0x00, 0x01, 0x00,
+     0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x04, 0x00,
+     0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+     0x88, 0x99, 0xaa, 0xbb, 0x06, 0x00, 0x06, 0x00,
+     0x08, 0x00, 0x00, 0x00, 0x10, 0x00, 0x07, 0x00,
+     0xc0, 0xa8, 0x28, 0x0a, 0x5d, 0xb8, 0xd8, 0x22,
+     0x06, 0x00, 0x40, 0x00, 0x08, 0x00, 0x09, 0x00,
+     0xc9, 0x3a, 0x01, 0xbb, 0x06, 0x00, 0x12, 0x00,
+     0x00, 0x18, 0x00, 0x00, 0x0c, 0x00, 0x05, 0x00,
+     0x48, 0xdb, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x03, 0x00, 0x0a, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x04, 0x00,
+     0x18, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00,
+     0x1e, 0x00, 0x02, 0x00, 0xd0, 0xe6, 0x7a, 0x5f,
+     0xb2, 0x9d, 0x2f, 0x00, 0x03, 0x01, 0x00, 0x00,
+     0x07, 0x00, 0x00, 0x00, 0x14, 0x00, 0x09, 0x00,
+     0xc4, 0xe9, 0x0b, 0x51, 0x72, 0xa8, 0x4f, 0x3d,
+     0xb6, 0x1e, 0x09, 0xa7, 0xd3, 0x5c, 0x2f, 0x88,
+     0xb8, 0x00, 0x01, 0x00, 0x08, 0x00, 0x14, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x13, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x02, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x03, 0x00,
+     0x03, 0x00, 0x00, 0x00, 0x08, 0x00, 0x0f, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x16, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x17, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x18, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x19, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x10, 0x00, 0x04, 0x00, 0x00, 0x11, 0x22, 0x33,
+     0x44, 0x55, 0xde, 0xad, 0xbe, 0xef, 0x00, 0x01,
+     0x06, 0x00, 0x06, 0x00, 0x81, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x05, 0x00, 0x10, 0x64, 0x00, 0x00,
+     0x40, 0x00, 0x01, 0x00, 0x06, 0x00, 0x06, 0x00,
+     0x86, 0xdd, 0x00, 0x00, 0x2c, 0x00, 0x08, 0x00,
+     0x20, 0x01, 0x0d, 0xb8, 0x00, 0x40, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+     0x20, 0x01, 0x0d, 0xb8, 0x00, 0x40, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+     0x00, 0x00, 0x00, 0x00, 0x11, 0x00, 0x40, 0x00,
+     0x08, 0x00, 0x0a, 0x00, 0xcf, 0xdb, 0x00, 0x35,
+     0x0c, 0x00, 0x05, 0x00, 0xca, 0xdc, 0x29, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x03, 0x00,
+     0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xf4, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xb8, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x02, 0x00,
+     0xd0, 0xe6, 0x7a, 0x5f, 0xb2, 0x9d, 0x2f, 0x00,
+     0x03, 0x01, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x09, 0x00, 0x9a, 0x07, 0xd2, 0xe3,
+     0x18, 0x4b, 0x4e, 0x6a, 0x8c, 0x5f, 0x7d, 0x21,
+     0xb0, 0xe4, 0xa9, 0xc6, 0x8c, 0x00, 0x01, 0x00,
+     0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x04, 0x00,
+     0x02, 0x00, 0x00, 0x00, 0x00, 0x03, 0xff, 0xff,
+     0xff, 0xff, 0xff, 0xff, 0x06, 0x00, 0x06, 0x00,
+     0x08, 0x06, 0x00, 0x00, 0x1a, 0x00, 0x0d, 0x00,
+     0xc0, 0xa8, 0x28, 0x17, 0xc0, 0xa8, 0x28, 0x01,
+     0x00, 0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x03,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xc4, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x02, 0x00,
+     0xd0, 0xe6, 0x7a, 0x5f, 0xb2, 0x9d, 0x2f, 0x00,
+     0x03, 0x01, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x09, 0x00, 0xe1, 0xb3, 0xf4, 0x0a,
+     0x6d, 0x2c, 0x47, 0xe9, 0xa0, 0x85, 0x3b, 0x7f,
+     0xc1, 0xd6, 0xe2, 0x54, 0x78, 0x00, 0x01, 0x00,
+     0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x03, 0x00, 0x05, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x06, 0x00,
+     0x08, 0x00, 0x00, 0x00, 0x10, 0x00, 0x07, 0x00,
+     0x0a, 0x0a, 0x00, 0x02, 0x0a, 0x0a, 0x00, 0x01,
+     0x11, 0x00, 0x40, 0x00, 0x08, 0x00, 0x0a, 0x00,
+     0x12, 0xb5, 0x12, 0xb5, 0x0c, 0x00, 0x05, 0x00,
+     0x1c, 0xd3, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+     0x03, 0x00, 0x02, 0x00, 0xd0, 0xe6, 0x7a, 0x5f,
+     0xb2, 0x9d, 0x2f, 0x00, 0x00, 0x00, 0x00, 0x00,
+        },
+    },
+};
+
+struct mnl_buf
+g_ovs_flow_dump_2[] =
+{
+    {
+        .len = 508,
+        .data =
+        {
+     0xe4, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x02, 0x00,
+     0xd0, 0xe6, 0x7a, 0x5f, 0xb2, 0x9d, 0x2f, 0x00,
+     0x03, 0x01, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x09, 0x00, 0x3d, 0x2a, 0x1c, 0x8f,
+     0x5b, 0x7e, 0x4c, 0x1a, 0x9d, 0x2e, 0x6f, 0x4b,
+     0x8a, 0x0c, 0x7e, 0x13, 0x90, 0x00, 0x01, 0x00,
+     0x08, 0x00, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x13, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x03, 0x00, 0x02, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x16, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x17, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x08, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x04, 0x00,
+     0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+     0x88, 0x99, 0xaa, 0xbb, 0x06, 0x00, 0x06, 0x00,
+     0x08, 0x00, 0x00, 0x00, 0x10, 0x00, 0x07, 0x00,
+     0xc0, 0xa8, 0x28, 0x0a, 0x5d, 0xb8, 0xd8, 0x22,
+     0x06, 0x00, 0x40, 0x00, 0x08, 0x00, 0x09, 0x00,
+     0xc9, 0x3a, 0x01, 0xbb, 0x06, 0x00, 0x12, 0x00,
+     0x00, 0x18, 0x00, 0x00, 0x0c, 0x00, 0x05, 0x00,
+     0x48, 0xdb, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x03, 0x00, 0x0a, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x05, 0x00, 0x04, 0x00,
+     0x18, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00,
+     0x1e, 0x00, 0x02, 0x00, 0xd0, 0xe6, 0x7a, 0x5f,
+     0xb2, 0x9d, 0x2f, 0x00, 0x03, 0x01, 0x00, 0x00,
+     0x07, 0x00, 0x00, 0x00, 0x14, 0x00, 0x09, 0x00,
+     0xc4, 0xe9, 0x0b, 0x51, 0x72, 0xa8, 0x4f, 0x3d,
+     0xb6, 0x1e, 0x09, 0xa7, 0xd3, 0x5c, 0x2f, 0x88,
+     0xb8, 0x00, 0x01, 0x00, 0x08, 0x00, 0x14, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x13, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x02, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x03, 0x00,
+     0x03, 0x00, 0x00, 0x00, 0x08, 0x00, 0x0f, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x16, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x17, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x18, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x19, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x10, 0x00, 0x04, 0x00, 0x00, 0x11, 0x22, 0x33,
+     0x44, 0x55, 0xde, 0xad, 0xbe, 0xef, 0x00, 0x01,
+     0x06, 0x00, 0x06, 0x00, 0x81, 0x00, 0x00, 0x00,
+     0x06, 0x00, 0x05, 0x00, 0x10, 0x64, 0x00, 0x00,
+     0x40, 0x00, 0x01, 0x00, 0x06, 0x00, 0x06, 0x00,
+     0x86, 0xdd, 0x00, 0x00, 0x2c, 0x00, 0x08, 0x00,
+     0x20, 0x01, 0x0d, 0xb8, 0x00, 0x40, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+     0x20, 0x01, 0x0d, 0xb8, 0x00, 0x40, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+     0x00, 0x00, 0x00, 0x00, 0x11, 0x00, 0x40, 0x00,
+     0x08, 0x00, 0x0a, 0x00, 0xcf, 0xdb, 0x00, 0x35,
+     0x0c, 0x00, 0x05, 0x00, 0x55, 0x05, 0x2a, 0x00,
+     0x00, 0x00, 0x00, 0x00, 0x14, 0x00, 0x03, 0x00,
+     0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0xbc, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x14, 0x00, 0x00, 0x00, 0x03, 0x00, 0x02, 0x00,
+     0xd0, 0xe6, 0x7a, 0x5f, 0xb2, 0x9d, 0x2f, 0x00,
+     0x00, 0x00, 0x00, 0x00,
+        },
+    },
+};
@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libmnl/libmnl.h>
+
+#include "ds_tree.h"
+#include "lan_stats.h"
+#include "log.h"
+#include "os_types.h"
+#include "target.h"
+#include "unity.h"
+
+struct mnl_buf
+{
+    uint32_t portid;
+    uint32_t seq;
+    size_t len;
+    uint8_t data[4096];
+};
+
+#include "ovs_flow_dump.c"
+
+extern ds_tree_t flow_tracker_list;
+const char *test_name = "fcm_lan_stats_tests";
+
+/* Port id and sequence number of the replies. See mnl_cb_run() */
+int g_portid = 3120562;
+int g_seq = 1601890000;
+
+/* Leading 32 bits of the ufids of the flows dumped in ovs_flow_dump.c */
+#define TEST_UFID_TCP 0x8f1c2a3d
+#define TEST_UFID_VLAN 0x510be9c4
+#define TEST_UFID_ARP 0xe3d2079a
+
+
+char *
+fcm_get_mqtt_hdr_node_id(void)
+{
+    return "4C718002B3";
+}
+
+
+char *
+fcm_get_mqtt_hdr_loc_id(void)
+{
+    return "59efd33d2c93832025330a3e";
+}
+
+
+static void
+test_clean_flows(void)
+{
+    dp_ctl_stats_t *stats, *next;
+
+    stats = ds_tree_head(&flow_tracker_list);
+    while (stats != NULL)
+    {
+        next = ds_tree_next(&flow_tracker_list, stats);
+        ds_tree_remove(&flow_tracker_list, stats);
+        free(stats);
+        stats = next;
+    }
+}
+
+
+static size_t
+test_count_flows(void)
+{
+    dp_ctl_stats_t *stats;
+    size_t count;
+
+    count = 0;
+    ds_tree_foreach(&flow_tracker_list, stats) count++;
+
+    return count;
+}
+
+
+static dp_ctl_stats_t *
+test_find_flow(uint32_t ufid_lo)
+{
+    dp_ctl_stats_t *stats;
+    uint32_t lo;
+
+    ds_tree_foreach(&flow_tracker_list, stats)
+    {
+        memcpy(&lo, &stats->ufid, sizeof(lo));
+        if (lo == ufid_lo) return stats;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief replays a flows dump through the netlink data callback
+ */
+static void
+test_replay(struct lan_stats_dpif *dpif, struct mnl_buf *bufs, size_t nbufs)
+{
+    struct mnl_buf *p_mnl;
+    size_t idx;
+    int ret;
+
+    lan_stats_dpif_dump_start(dpif);
+    for (idx = 0; idx < nbufs; idx++)
+    {
+        p_mnl = &bufs[idx];
+        ret = mnl_cb_run(p_mnl->data, p_mnl->len, g_seq, g_portid,
+                         lan_stats_dpif_data_cb, dpif);
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_cb_run failed: %s", __func__, strerror(errno));
+        }
+        TEST_ASSERT_NOT_EQUAL(-1, ret);
+        if (ret <= MNL_CB_STOP) break;
+    }
+    lan_stats_dpif_dump_end(dpif);
+}
+
+
+static size_t
+test_count_counters(struct lan_stats_dpif *dpif)
+{
+    struct lan_stats_dp_counters *counters;
+    size_t count;
+
+    count = 0;
+    ds_tree_foreach(&dpif->last_stats, counters) count++;
+
+    return count;
+}
+
+
+void
+setUp(void)
+{
+    test_clean_flows();
+}
+
+
+void
+tearDown(void)
+{
+    test_clean_flows();
+}
+
+
+/**
+ * @brief validates the decoding of the flows attributes
+ */
+void
+test_dpif_decode(void)
+{
+    os_macaddr_t smac = {{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55 }};
+    os_macaddr_t dmac_1 = {{ 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb }};
+    os_macaddr_t dmac_2 = {{ 0xde, 0xad, 0xbe, 0xef, 0x00, 0x01 }};
+    struct lan_stats_dpif dpif;
+    dp_ctl_stats_t *stats;
+
+    lan_stats_dpif_ctx_init(&dpif, false);
+    test_replay(&dpif, g_ovs_flow_dump_1, ARRAY_SIZE(g_ovs_flow_dump_1));
+
+    /* The flow without ethernet key is dropped */
+    TEST_ASSERT_EQUAL_UINT(3, dpif.nflows);
+    TEST_ASSERT_EQUAL_UINT(0, dpif.nskipped);
+    TEST_ASSERT_EQUAL_UINT(3, test_count_flows());
+
+    stats = test_find_flow(TEST_UFID_TCP);
+    TEST_ASSERT_NOT_NULL(stats);
+    TEST_ASSERT_EQUAL_MEMORY(&smac, &stats->smac_key, sizeof(smac));
+    TEST_ASSERT_EQUAL_MEMORY(&dmac_1, &stats->dmac_key, sizeof(dmac_1));
+    TEST_ASSERT_EQUAL_UINT(0x0800, stats->eth_val);
+    TEST_ASSERT_EQUAL_UINT(0, stats->vlan_id);
+    TEST_ASSERT_EQUAL_UINT64(10, stats->pkts);
+    TEST_ASSERT_EQUAL_UINT64(1000, stats->bytes);
+
+    stats = test_find_flow(TEST_UFID_VLAN);
+    TEST_ASSERT_NOT_NULL(stats);
+    TEST_ASSERT_EQUAL_MEMORY(&smac, &stats->smac_key, sizeof(smac));
+    TEST_ASSERT_EQUAL_MEMORY(&dmac_2, &stats->dmac_key, sizeof(dmac_2));
+    TEST_ASSERT_EQUAL_UINT(0x8100, stats->eth_val);
+    TEST_ASSERT_EQUAL_UINT(100, stats->vlan_id);
+    TEST_ASSERT_EQUAL_UINT(0x86dd, stats->vlan_eth_val);
+    TEST_ASSERT_EQUAL_UINT64(5, stats->pkts);
+    TEST_ASSERT_EQUAL_UINT64(500, stats->bytes);
+
+    stats = test_find_flow(TEST_UFID_ARP);
+    TEST_ASSERT_NOT_NULL(stats);
+    TEST_ASSERT_EQUAL_UINT(0x0806, stats->eth_val);
+    TEST_ASSERT_EQUAL_UINT64(0, stats->pkts);
+    TEST_ASSERT_EQUAL_UINT64(0, stats->bytes);
+
+    /* Counters are only tracked in changed only mode */
+    TEST_ASSERT_EQUAL_UINT(0, test_count_counters(&dpif));
+
+    lan_stats_dpif_exit(&dpif);
+}
+
+
+/**
+ * @brief validates the changed only mode across two dumps
+ */
+void
+test_dpif_changed_only(void)
+{
+    struct lan_stats_dpif dpif;
+    dp_ctl_stats_t *stats;
+
+    lan_stats_dpif_ctx_init(&dpif, true);
+
+    /* All flows are new */
+    test_replay(&dpif, g_ovs_flow_dump_1, ARRAY_SIZE(g_ovs_flow_dump_1));
+    TEST_ASSERT_EQUAL_UINT(3, test_count_flows());
+    TEST_ASSERT_EQUAL_UINT(0, dpif.nskipped);
+    TEST_ASSERT_EQUAL_UINT(3, test_count_counters(&dpif));
+    test_clean_flows();
+
+    /* Only the flow whose counters moved is reported */
+    test_replay(&dpif, g_ovs_flow_dump_2, ARRAY_SIZE(g_ovs_flow_dump_2));
+    TEST_ASSERT_EQUAL_UINT(2, dpif.nflows);
+    TEST_ASSERT_EQUAL_UINT(1, dpif.nskipped);
+    TEST_ASSERT_EQUAL_UINT(1, test_count_flows());
+
+    stats = test_find_flow(TEST_UFID_VLAN);
+    TEST_ASSERT_NOT_NULL(stats);
+    TEST_ASSERT_EQUAL_UINT64(7, stats->pkts);
+    TEST_ASSERT_EQUAL_UINT64(700, stats->bytes);
+
+    /* The flow gone from the datapath is forgotten */
+    TEST_ASSERT_EQUAL_UINT(2, test_count_counters(&dpif));
+    test_clean_flows();
+
+    /* Replaying the second dump reports nothing */
+    test_replay(&dpif, g_ovs_flow_dump_2, ARRAY_SIZE(g_ovs_flow_dump_2));
+    TEST_ASSERT_EQUAL_UINT(2, dpif.nskipped);
+    TEST_ASSERT_EQUAL_UINT(0, test_count_flows());
+
+    lan_stats_dpif_exit(&dpif);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_dpif_decode);
+    RUN_TEST(test_dpif_changed_only);
+
+    return UNITY_END();
+}
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef NEIGH_TABLE_H_INCLUDED
 #define NEIGH_TABLE_H_INCLUDED
 
+#include <pthread.h>
 #include <stdint.h>
 #include <time.h>
 #include <netinet/in.h>
@@ -68,11 +69,33 @@ struct neigh_interface
     ds_tree_node_t intf_node;
 };
 
+/*
+ * Number of sources walked by neigh_table_lookup(), see lookup_sources[]
+ */
+#define NEIGH_LOOKUP_SOURCES 7
+
+/*
+ * IP index node.
+ * Gathers the entries of an IP address, one slot per source in lookup
+ * priority order, so that neigh_table_lookup() resolves an IP in one probe.
+ */
+struct neigh_ip_node
+{
+    int af_family;
+    uint8_t ip[16];
+    struct neighbour_entry *slots[NEIGH_LOOKUP_SOURCES];
+    struct neigh_ip_node *next;
+};
+
 struct neigh_table_mgr
 {
     bool initialized;
+    pthread_rwlock_t lock;  /* serializes updates against worker lookups */
     ds_tree_t neigh_table;
     ds_tree_t interfaces;
+    struct neigh_ip_node **ip_index;    /* IP keyed hash buckets */
+    size_t ip_index_size;               /* number of buckets, power of 2 */
+    size_t ip_index_count;              /* number of indexed IPs */
     bool (*update_ovsdb_tables)(struct neighbour_entry *key, bool remove);
 };
 
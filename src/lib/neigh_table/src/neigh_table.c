@@ -108,8 +108,248 @@ struct neigh_table_mgr
 }
 
 
+/* Sources in lookup priority order */
+int lookup_sources[NEIGH_LOOKUP_SOURCES] =
+{
+    OVSDB_DHCP_LEASE,
+    NEIGH_TBL_SYSTEM,
+    OVSDB_NDP,
+    OVSDB_ARP,
+    OVSDB_INET_STATE,
+    NEIGH_SRC_NOT_SET,
+    NEIGH_UT,
+};
+
+#define NEIGH_IP_INDEX_MIN_SIZE 256
+
+
+/**
+ * @brief returns the IP index slot of a source
+ *
+ * The slot is the position of the highest priority source matched.
+ * @return the slot, -1 if the source is not looked up
+ */
+static int
+neigh_table_source_slot(uint32_t source)
+{
+    int i;
+
+    for (i = 0; i < NEIGH_LOOKUP_SOURCES; i++)
+    {
+        if (source & lookup_sources[i]) return i;
+    }
+
+    return -1;
+}
+
+
+static size_t
+neigh_table_ip_len(int af_family)
+{
+    if (af_family == AF_INET) return 4;
+    if (af_family == AF_INET6) return 16;
+
+    return 0;
+}
+
+
+/**
+ * @brief hashes an IP address (FNV-1a)
+ */
+static uint32_t
+neigh_table_ip_hash(int af_family, const uint8_t *ip)
+{
+    uint32_t hash;
+    size_t len;
+    size_t i;
+
+    hash = 2166136261u ^ (uint32_t)af_family;
+    len = neigh_table_ip_len(af_family);
+    for (i = 0; i < len; i++)
+    {
+        hash ^= ip[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+static struct neigh_ip_node *
+neigh_table_index_find(struct neigh_table_mgr *mgr, int af_family,
+                       const uint8_t *ip)
+{
+    struct neigh_ip_node *node;
+    uint32_t hash;
+    size_t len;
+
+    if (mgr->ip_index == NULL) return NULL;
+
+    len = neigh_table_ip_len(af_family);
+    if (len == 0) return NULL;
+
+    hash = neigh_table_ip_hash(af_family, ip);
+    node = mgr->ip_index[hash & (mgr->ip_index_size - 1)];
+    for (; node != NULL; node = node->next)
+    {
+        if (node->af_family != af_family) continue;
+        if (memcmp(node->ip, ip, len) == 0) return node;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief resizes the IP index buckets array
+ *
+ * On allocation failure, the index keeps its current size.
+ */
+static void
+neigh_table_index_resize(struct neigh_table_mgr *mgr, size_t size)
+{
+    struct neigh_ip_node **buckets;
+    struct neigh_ip_node *node;
+    struct neigh_ip_node *next;
+    uint32_t hash;
+    size_t i;
+
+    buckets = calloc(size, sizeof(*buckets));
+    if (buckets == NULL) return;
+
+    for (i = 0; i < mgr->ip_index_size; i++)
+    {
+        node = mgr->ip_index[i];
+        while (node != NULL)
+        {
+            next = node->next;
+            hash = neigh_table_ip_hash(node->af_family, node->ip);
+            node->next = buckets[hash & (size - 1)];
+            buckets[hash & (size - 1)] = node;
+            node = next;
+        }
+    }
+
+    free(mgr->ip_index);
+    mgr->ip_index = buckets;
+    mgr->ip_index_size = size;
+}
+
+
+/**
+ * @brief adds a cache entry to the IP index
+ *
+ * @return true if indexed, false otherwise
+ */
+static bool
+neigh_table_index_add(struct neigh_table_mgr *mgr,
+                      struct neighbour_entry *entry)
+{
+    struct neigh_ip_node *node;
+    uint32_t hash;
+    size_t len;
+    int slot;
+
+    slot = neigh_table_source_slot(entry->source);
+    if (slot < 0) return true;
+
+    len = neigh_table_ip_len(entry->af_family);
+    if (len == 0) return false;
+
+    if (mgr->ip_index == NULL)
+    {
+        neigh_table_index_resize(mgr, NEIGH_IP_INDEX_MIN_SIZE);
+        if (mgr->ip_index == NULL) return false;
+    }
+
+    node = neigh_table_index_find(mgr, entry->af_family, entry->ip_tbl);
+    if (node == NULL)
+    {
+        /* Keep the average chain length under 1 */
+        if (mgr->ip_index_count >= mgr->ip_index_size)
+        {
+            neigh_table_index_resize(mgr, mgr->ip_index_size * 2);
+        }
+
+        node = calloc(1, sizeof(*node));
+        if (node == NULL) return false;
+
+        node->af_family = entry->af_family;
+        memcpy(node->ip, entry->ip_tbl, len);
+        hash = neigh_table_ip_hash(node->af_family, node->ip);
+        node->next = mgr->ip_index[hash & (mgr->ip_index_size - 1)];
+        mgr->ip_index[hash & (mgr->ip_index_size - 1)] = node;
+        mgr->ip_index_count++;
+    }
+
+    if (node->slots[slot] == NULL) node->slots[slot] = entry;
+
+    return true;
+}
+
+
+/**
+ * @brief removes a cache entry from the IP index
+ *
+ * The IP node is released with its last slot.
+ */
+static void
+neigh_table_index_del(struct neigh_table_mgr *mgr,
+                      struct neighbour_entry *entry)
+{
+    struct neigh_ip_node **pnode;
+    struct neigh_ip_node *node;
+    uint32_t hash;
+    size_t len;
+    int slot;
+    int i;
+
+    if (mgr->ip_index == NULL) return;
+
+    slot = neigh_table_source_slot(entry->source);
+    if (slot < 0) return;
+
+    len = neigh_table_ip_len(entry->af_family);
+    if (len == 0) return;
+
+    hash = neigh_table_ip_hash(entry->af_family, entry->ip_tbl);
+    pnode = &mgr->ip_index[hash & (mgr->ip_index_size - 1)];
+    for (node = *pnode; node != NULL; pnode = &node->next, node = *pnode)
+    {
+        if (node->af_family != entry->af_family) continue;
+        if (memcmp(node->ip, entry->ip_tbl, len) == 0) break;
+    }
+    if (node == NULL) return;
+
+    if (node->slots[slot] != entry) return;
+    node->slots[slot] = NULL;
+
+    for (i = 0; i < NEIGH_LOOKUP_SOURCES; i++)
+    {
+        if (node->slots[i] != NULL) return;
+    }
+
+    *pnode = node->next;
+    free(node);
+    mgr->ip_index_count--;
+}
+
+
+/**
+ * @brief removes an entry from the cache tree and the IP index
+ */
+static void
+neigh_table_remove_entry(struct neigh_table_mgr *mgr,
+                         struct neighbour_entry *entry)
+{
+    neigh_table_index_del(mgr, entry);
+    ds_tree_remove(&mgr->neigh_table, entry);
+}
+
+
 void process_neigh_event(struct nf_neigh_info *neigh_info)
 {
+    struct neigh_table_mgr *mgr = neigh_table_get_mgr();
     char ipstr[INET6_ADDRSTRLEN] = { 0 };
     struct neighbour_entry entry;
     struct neigh_interface *intf;
@@ -147,14 +387,18 @@ void process_neigh_event(struct nf_neigh_info *neigh_info)
             return;
         }
 
+        pthread_rwlock_wrlock(&mgr->lock);
         intf = neigh_table_get_intf(entry.ifindex);
         if (intf != NULL) intf->entries_count++;
+        pthread_rwlock_unlock(&mgr->lock);
     }
     else if (neigh_info->delete)
     {
         neigh_table_delete_from_cache(&entry);
+        pthread_rwlock_wrlock(&mgr->lock);
         intf = neigh_table_lookup_intf(entry.ifindex);
         if (intf != NULL) intf->entries_count--;
+        pthread_rwlock_unlock(&mgr->lock);
     }
 }
 
@@ -175,10 +419,19 @@ void process_link_event(struct nf_neigh_info *neigh_info)
          neigh_info->ifindex, neigh_info->event,
          (ifn != NULL) ? ifn : "none");
 
+    /*
+     * The entries may be read concurrently by the nfqueue workers,
+     * see neigh_table_lookup()
+     */
+    pthread_rwlock_wrlock(&mgr->lock);
+
     /* Remove neighbor cache entries bound to the interface if any */
     intf = neigh_table_lookup_intf(neigh_info->ifindex);
-    if (intf == NULL) return;
-    if (intf->entries_count <= 0) return;
+    if (intf == NULL || intf->entries_count <= 0)
+    {
+        pthread_rwlock_unlock(&mgr->lock);
+        return;
+    }
 
     tree = &mgr->neigh_table;
     entry_node = ds_tree_head(tree);
@@ -194,14 +447,18 @@ void process_link_event(struct nf_neigh_info *neigh_info)
         {
             LOGT("%s: removing entry: ", __func__);
             print_neigh_entry(remove_node);
-            ds_tree_remove(tree, remove_node);
+            neigh_table_remove_entry(mgr, remove_node);
             free_neigh_entry(remove_node);
+            intf->entries_count--;
         }
     }
 
     /* Remove interface from tree interfaces */
     tree = &mgr->interfaces;
     ds_tree_remove(tree, intf);
+    pthread_rwlock_unlock(&mgr->lock);
+
+    free(intf);
 
     return;
 }
@@ -281,6 +538,7 @@ void neigh_table_init_manager(void)
     if (mgr->initialized) return;
 
     mgr->update_ovsdb_tables = update_ip_in_ovsdb_table;
+    pthread_rwlock_init(&mgr->lock, NULL);
 
     ds_tree_init(&mgr->neigh_table, neigh_table_cmp,
                  struct neighbour_entry, entry_node);
@@ -332,6 +590,7 @@ void neigh_table_cache_cleanup(void)
 
     if (!mgr->initialized) return;
 
+    pthread_rwlock_wrlock(&mgr->lock);
     tree = &mgr->neigh_table;
     entry_node = ds_tree_head(tree);
     while (entry_node != NULL)
@@ -344,7 +603,7 @@ void neigh_table_cache_cleanup(void)
         }
 
         entry_node = ds_tree_next(tree, entry_node);
-        ds_tree_remove(tree, remove_node);
+        neigh_table_remove_entry(mgr, remove_node);
         free_neigh_entry(remove_node);
     }
 
@@ -355,8 +614,9 @@ void neigh_table_cache_cleanup(void)
         remove_intf = intf_node;
         intf_node = ds_tree_next(tree, intf_node);
         ds_tree_remove(tree, remove_intf);
-        free(intf_node);
+        free(remove_intf);
     }
+    pthread_rwlock_unlock(&mgr->lock);
     return;
 }
 /**
@@ -366,7 +626,14 @@ void neigh_table_cleanup(void)
 {
     struct neigh_table_mgr *mgr = neigh_table_get_mgr();
 
+    if (!mgr->initialized) return;
+
     neigh_table_cache_cleanup();
+    free(mgr->ip_index);
+    mgr->ip_index = NULL;
+    mgr->ip_index_size = 0;
+    mgr->ip_index_count = 0;
+    pthread_rwlock_destroy(&mgr->lock);
     mgr->initialized = false;
 
     return;
@@ -439,8 +706,8 @@ neigh_table_populate_sockaddr(struct neighbour_entry *to_add,
 }
 
 
-struct neighbour_entry *
-neigh_table_add_to_cache(struct neighbour_entry *to_add)
+static struct neighbour_entry *
+neigh_table_insert_entry(struct neighbour_entry *to_add)
 {
     struct neighbour_entry *entry;
     struct neigh_table_mgr *mgr;
@@ -490,10 +757,14 @@ neigh_table_add_to_cache(struct neighbour_entry *to_add)
     LOGT("%s: adding to cache: ", __func__);
     print_neigh_entry(entry);
 
+    if (!neigh_table_index_add(mgr, entry)) goto err_free_ifname;
     ds_tree_insert(&mgr->neigh_table, entry, entry);
 
     return entry;
 
+err_free_ifname:
+    free(entry->ifname);
+
 err_free_mac:
     free(entry->mac);
 
@@ -506,6 +777,20 @@ err_free_entry:
     return NULL;
 }
 
+
+struct neighbour_entry *
+neigh_table_add_to_cache(struct neighbour_entry *to_add)
+{
+    struct neigh_table_mgr *mgr = neigh_table_get_mgr();
+    struct neighbour_entry *entry;
+
+    pthread_rwlock_wrlock(&mgr->lock);
+    entry = neigh_table_insert_entry(to_add);
+    pthread_rwlock_unlock(&mgr->lock);
+
+    return entry;
+}
+
 bool neigh_table_add(struct neighbour_entry *to_add)
 {
     struct neigh_table_mgr *mgr = neigh_table_get_mgr();
@@ -542,14 +827,17 @@ void neigh_table_delete_from_cache(struct neighbour_entry *to_del)
     if (!to_del) return;
 
     neigh_table_set_entry(to_del);
+    pthread_rwlock_wrlock(&mgr->lock);
     lookup = neigh_table_cache_lookup(to_del);
     if (lookup == NULL)
     {
+        pthread_rwlock_unlock(&mgr->lock);
         LOGD("%s: entry not found", __func__);
         return;
     }
 
-    ds_tree_remove(&mgr->neigh_table, lookup);
+    neigh_table_remove_entry(mgr, lookup);
+    pthread_rwlock_unlock(&mgr->lock);
     free_neigh_entry(lookup);
 }
 
@@ -561,14 +849,17 @@ void neigh_table_delete(struct neighbour_entry *to_del)
     if (!to_del) return;
 
     neigh_table_set_entry(to_del);
+    pthread_rwlock_wrlock(&mgr->lock);
     lookup = neigh_table_cache_lookup(to_del);
     if (lookup == NULL)
     {
+        pthread_rwlock_unlock(&mgr->lock);
         LOGD("%s: entry not found", __func__);
         return;
     }
 
-    ds_tree_remove(&mgr->neigh_table, lookup);
+    neigh_table_remove_entry(mgr, lookup);
+    pthread_rwlock_unlock(&mgr->lock);
 
     // Update ovsdb tables if required.
     if (mgr->update_ovsdb_tables &&
@@ -586,35 +877,44 @@ bool neigh_table_cache_update(struct neighbour_entry *entry)
 {
     struct neigh_table_mgr *mgr = neigh_table_get_mgr();
     struct neighbour_entry *lookup;
+    bool ret;
 
     if (!entry) return false;
 
     neigh_table_set_entry(entry);
 
+    pthread_rwlock_wrlock(&mgr->lock);
     lookup = ds_tree_find(&mgr->neigh_table, entry);
 
     // We dont have it. Add it.
     if (!lookup)
     {
-        if (!neigh_table_add_to_cache(entry))
-        {
-            LOGD("%s: Couldn't cache the entry.", __func__);
-            return false;
-        }
-        return true;
+        ret = (neigh_table_insert_entry(entry) != NULL);
+        pthread_rwlock_unlock(&mgr->lock);
+        if (!ret) LOGD("%s: Couldn't cache the entry.", __func__);
+
+        return ret;
     }
 
     memcpy(lookup->mac, entry->mac, sizeof(os_macaddr_t));
 
+    ret = true;
     free(lookup->ifname);
+    lookup->ifname = NULL;
     if (entry->ifname != NULL)
     {
         lookup->ifname = strdup(entry->ifname);
-        if (lookup->ifname == NULL) return false;
+        ret = (lookup->ifname != NULL);
     }
-    lookup->source = entry->source;
+    if (lookup->source != entry->source)
+    {
+        neigh_table_index_del(mgr, lookup);
+        lookup->source = entry->source;
+        if (!neigh_table_index_add(mgr, lookup)) ret = false;
+    }
+    pthread_rwlock_unlock(&mgr->lock);
 
-    return true;
+    return ret;
 }
 
 struct neighbour_entry *
@@ -640,48 +940,41 @@ neigh_table_cache_lookup(struct neighbour_entry *key)
     return lookup;
 }
 
-int lookup_sources[] =
-{
-    OVSDB_DHCP_LEASE,
-    NEIGH_TBL_SYSTEM,
-    OVSDB_NDP,
-    OVSDB_ARP,
-    OVSDB_INET_STATE,
-    NEIGH_SRC_NOT_SET,
-    NEIGH_UT,
-};
-
 /**
  * @brief lookup for a neighbor table entry.
  *
+ * Safe to call from nfqueue worker threads.
+ * Probes the IP index once and returns the mac of the highest priority source.
+ *
  * @return true if found and false if not.
  */
 bool neigh_table_lookup(struct sockaddr_storage *ip_in, os_macaddr_t *mac_out)
 {
+    struct neigh_table_mgr *mgr = neigh_table_get_mgr();
     struct neighbour_entry *lookup;
+    struct neigh_ip_node *node;
     struct neighbour_entry key;
-    size_t len;
     size_t i;
-    bool ret;
 
     if (!ip_in || !mac_out) return false;
 
     memset(&key, 0, sizeof(key));
     key.ipaddr = ip_in;
-    key.mac    = mac_out;
-    key.ifname = NULL;
     neigh_table_set_entry(&key);
+    if (key.ip_tbl == NULL) return false;
 
-    len = sizeof(lookup_sources) / sizeof(lookup_sources[0]);
-    for (i = 0; i < len; i++)
+    lookup = NULL;
+    pthread_rwlock_rdlock(&mgr->lock);
+    node = neigh_table_index_find(mgr, key.af_family, key.ip_tbl);
+    for (i = 0; node != NULL && i < NEIGH_LOOKUP_SOURCES; i++)
     {
-        key.source = lookup_sources[i];
-        lookup = neigh_table_cache_lookup(&key);
-        ret = (lookup != NULL);
-        if (ret) break;
+        lookup = node->slots[i];
+        if (lookup != NULL) break;
     }
+    if (lookup != NULL) memcpy(mac_out, lookup->mac, sizeof(os_macaddr_t));
+    pthread_rwlock_unlock(&mgr->lock);
 
-    return ret;
+    return (lookup != NULL);
 }
 
 
@@ -701,6 +994,7 @@ void neigh_table_ttl_cleanup(int64_t ttl, uint32_t source_mask)
     if (!mgr->initialized) return;
 
     now = time(NULL);
+    pthread_rwlock_wrlock(&mgr->lock);
     tree = &mgr->neigh_table;
     entry_node = ds_tree_head(tree);
     while (entry_node != NULL)
@@ -726,9 +1020,10 @@ void neigh_table_ttl_cleanup(int64_t ttl, uint32_t source_mask)
         }
 
         entry_node = ds_tree_next(tree, entry_node);
-        ds_tree_remove(tree, remove_node);
+        neigh_table_remove_entry(mgr, remove_node);
         free_neigh_entry(remove_node);
     }
+    pthread_rwlock_unlock(&mgr->lock);
 }
 
 
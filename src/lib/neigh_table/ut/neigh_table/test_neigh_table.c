@@ -31,7 +31,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/socket.h>
 #include <netdb.h>
 #include <net/if.h>
+#include <time.h>
+#include <pthread.h>
 
+#include "const.h"
 #include "log.h"
 #include "ovsdb.h"
 #include "os.h"
@@ -824,6 +827,293 @@ void test_source_map(void)
 }
 
 
+#define NEIGH_BENCH_ENTRIES 10000
+#define NEIGH_BENCH_LOOKUPS 200000
+
+static void
+neigh_bench_ip(int i, struct sockaddr_storage *ss)
+{
+    uint32_t v6ip[4] = { htonl(0x20010db8), 0, 0, 0 };
+    uint32_t v4ip;
+
+    /* One in 4 neighbours is IPv6 */
+    if (i % 4 == 3)
+    {
+        v6ip[3] = htonl(i);
+        util_populate_sockaddr(AF_INET6, v6ip, ss);
+        return;
+    }
+
+    v4ip = htonl(0x0a000000 + i);
+    util_populate_sockaddr(AF_INET, &v4ip, ss);
+}
+
+
+static double
+neigh_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * @brief resolves an IP walking the tree once per source, as done
+ *        before the IP index was introduced
+ */
+static bool
+neigh_bench_tree_lookup(struct sockaddr_storage *ip_in, os_macaddr_t *mac_out)
+{
+    int sources[] =
+    {
+        OVSDB_DHCP_LEASE, NEIGH_TBL_SYSTEM, OVSDB_NDP, OVSDB_ARP,
+        OVSDB_INET_STATE, NEIGH_SRC_NOT_SET, NEIGH_UT,
+    };
+    struct neighbour_entry key;
+    size_t i;
+
+    memset(&key, 0, sizeof(key));
+    key.ipaddr = ip_in;
+    key.mac = mac_out;
+    neigh_table_set_entry(&key);
+
+    for (i = 0; i < ARRAY_SIZE(sources); i++)
+    {
+        key.source = sources[i];
+        if (neigh_table_cache_lookup(&key) != NULL) return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief benchmarks lookups on 10k neighbours with a mixed hit/miss workload
+ *
+ * Every 8th neighbour is also learnt from the lower priority ARP source,
+ * which the lookup must not return.
+ */
+void test_lookup_bench(void)
+{
+    uint32_t sources[] = { NEIGH_TBL_SYSTEM, OVSDB_DHCP_LEASE, OVSDB_NDP };
+    struct sockaddr_storage ipaddr;
+    struct neighbour_entry entry;
+    os_macaddr_t mac_out;
+    os_macaddr_t mac;
+    double tree_time;
+    double start;
+    double index_time;
+    int hits;
+    bool rc;
+    int idx;
+    int i;
+
+    LOGI("\n******************** %s: starting ****************\n", __func__);
+
+    /* Per entry logs would dominate the measurements */
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    for (i = 0; i < NEIGH_BENCH_ENTRIES; i++)
+    {
+        memset(&entry, 0, sizeof(entry));
+        memset(&mac, 0, sizeof(mac));
+        neigh_bench_ip(i, &ipaddr);
+        mac.addr[0] = 0x02;
+        mac.addr[4] = (i >> 8) & 0xff;
+        mac.addr[5] = i & 0xff;
+        entry.ipaddr = &ipaddr;
+        entry.mac = &mac;
+        entry.source = sources[i % ARRAY_SIZE(sources)];
+        TEST_ASSERT_NOT_NULL(neigh_table_add_to_cache(&entry));
+
+        if (i % 8 != 0) continue;
+
+        memset(&entry, 0, sizeof(entry));
+        mac.addr[0] = 0x06;
+        entry.ipaddr = &ipaddr;
+        entry.mac = &mac;
+        entry.source = OVSDB_ARP;
+        TEST_ASSERT_NOT_NULL(neigh_table_add_to_cache(&entry));
+    }
+
+    /* Even lookups hit, odd lookups miss */
+    hits = 0;
+    start = neigh_bench_now();
+    for (i = 0; i < NEIGH_BENCH_LOOKUPS; i++)
+    {
+        idx = (i * 7919) % NEIGH_BENCH_ENTRIES;
+        if (i & 1) idx += NEIGH_BENCH_ENTRIES;
+        neigh_bench_ip(idx, &ipaddr);
+
+        memset(&mac_out, 0, sizeof(mac_out));
+        rc = neigh_table_lookup(&ipaddr, &mac_out);
+        TEST_ASSERT_EQUAL(!(i & 1), rc);
+        if (!rc) continue;
+
+        hits++;
+        TEST_ASSERT_EQUAL_UINT8(0x02, mac_out.addr[0]);
+        TEST_ASSERT_EQUAL_UINT8(idx & 0xff, mac_out.addr[5]);
+    }
+    index_time = neigh_bench_now() - start;
+    TEST_ASSERT_EQUAL_INT(NEIGH_BENCH_LOOKUPS / 2, hits);
+
+    start = neigh_bench_now();
+    for (i = 0; i < NEIGH_BENCH_LOOKUPS; i++)
+    {
+        idx = (i * 7919) % NEIGH_BENCH_ENTRIES;
+        if (i & 1) idx += NEIGH_BENCH_ENTRIES;
+        neigh_bench_ip(idx, &ipaddr);
+
+        rc = neigh_bench_tree_lookup(&ipaddr, &mac_out);
+        TEST_ASSERT_EQUAL(!(i & 1), rc);
+    }
+    tree_time = neigh_bench_now() - start;
+
+    LOGI("%s: %d lookups on %d neighbours: index %.0f ns/lookup, "
+         "tree walk %.0f ns/lookup", __func__, NEIGH_BENCH_LOOKUPS,
+         NEIGH_BENCH_ENTRIES, index_time * 1e9 / NEIGH_BENCH_LOOKUPS,
+         tree_time * 1e9 / NEIGH_BENCH_LOOKUPS);
+
+    /* Dropping the preferred source falls back to ARP */
+    neigh_bench_ip(8, &ipaddr);
+    memset(&entry, 0, sizeof(entry));
+    entry.ipaddr = &ipaddr;
+    entry.source = sources[8 % ARRAY_SIZE(sources)];
+    neigh_table_delete_from_cache(&entry);
+    rc = neigh_table_lookup(&ipaddr, &mac_out);
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_EQUAL_UINT8(0x06, mac_out.addr[0]);
+
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    LOGI("\n******************** %s: completed ****************", __func__);
+}
+
+
+#define NEIGH_FLAP_IFINDEX 4242
+#define NEIGH_FLAP_ENTRIES 64
+#define NEIGH_FLAP_ROUNDS  200
+#define NEIGH_FLAP_READERS 4
+
+void process_neigh_event(struct nf_neigh_info *neigh_info);
+void process_link_event(struct nf_neigh_info *neigh_info);
+
+static volatile int neigh_flap_stop;
+
+/**
+ * @brief looks up the flapping neighbours until told to stop
+ *
+ * A hit must always return the mac learnt for the IP.
+ */
+static void *
+neigh_flap_reader(void *arg)
+{
+    struct sockaddr_storage ipaddr;
+    os_macaddr_t mac_out;
+    long *errors = arg;
+    uint32_t v4ip;
+    bool rc;
+    int i;
+
+    while (!__atomic_load_n(&neigh_flap_stop, __ATOMIC_ACQUIRE))
+    {
+        for (i = 0; i < NEIGH_FLAP_ENTRIES; i++)
+        {
+            v4ip = htonl(0x0a010000 + i);
+            util_populate_sockaddr(AF_INET, &v4ip, &ipaddr);
+            memset(&mac_out, 0, sizeof(mac_out));
+            rc = neigh_table_lookup(&ipaddr, &mac_out);
+            if (!rc) continue;
+
+            if (mac_out.addr[0] != 0x02 || mac_out.addr[5] != i) (*errors)++;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief flaps a link while lookups run in concurrent threads
+ */
+void test_link_flap_concurrent_lookups(void)
+{
+    pthread_t readers[NEIGH_FLAP_READERS];
+    long errors[NEIGH_FLAP_READERS];
+    struct sockaddr_storage ipaddr;
+    struct nf_neigh_info info;
+    os_macaddr_t mac_out;
+    os_macaddr_t mac;
+    uint32_t v4ip;
+    int round;
+    bool rc;
+    int ret;
+    int i;
+
+    LOGI("\n******************** %s: starting ****************\n", __func__);
+
+    /* Per entry logs would serialize the threads on stdout */
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    neigh_flap_stop = 0;
+    for (i = 0; i < NEIGH_FLAP_READERS; i++)
+    {
+        errors[i] = 0;
+        ret = pthread_create(&readers[i], NULL, neigh_flap_reader, &errors[i]);
+        TEST_ASSERT_EQUAL_INT(0, ret);
+    }
+
+    for (round = 0; round < NEIGH_FLAP_ROUNDS; round++)
+    {
+        /* Link up: learn the neighbours */
+        for (i = 0; i < NEIGH_FLAP_ENTRIES; i++)
+        {
+            memset(&info, 0, sizeof(info));
+            memset(&mac, 0, sizeof(mac));
+            mac.addr[0] = 0x02;
+            mac.addr[5] = i;
+            v4ip = htonl(0x0a010000 + i);
+            info.af_family = AF_INET;
+            info.ifindex = NEIGH_FLAP_IFINDEX;
+            info.ipaddr = &v4ip;
+            info.hwaddr = &mac;
+            info.source = NEIGH_TBL_SYSTEM;
+            info.add = true;
+            process_neigh_event(&info);
+        }
+
+        /* Link down: flush the neighbours bound to the interface */
+        memset(&info, 0, sizeof(info));
+        info.ifindex = NEIGH_FLAP_IFINDEX;
+        info.source = NEIGH_TBL_SYSTEM;
+        process_link_event(&info);
+    }
+
+    __atomic_store_n(&neigh_flap_stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < NEIGH_FLAP_READERS; i++)
+    {
+        pthread_join(readers[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, errors[i]);
+    }
+
+    /* The last link down left nothing behind */
+    TEST_ASSERT_NULL(neigh_table_lookup_intf(NEIGH_FLAP_IFINDEX));
+    for (i = 0; i < NEIGH_FLAP_ENTRIES; i++)
+    {
+        v4ip = htonl(0x0a010000 + i);
+        util_populate_sockaddr(AF_INET, &v4ip, &ipaddr);
+        rc = neigh_table_lookup(&ipaddr, &mac_out);
+        TEST_ASSERT_FALSE(rc);
+    }
+
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    LOGI("\n******************** %s: completed ****************", __func__);
+}
+
+
 void add_neigh_entry_into_ovsdb_cb(EV_P_ ev_timer *w, int revents)
 {
     struct neigh_table_mgr *mgr = neigh_table_get_mgr();
@@ -1860,6 +2150,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_upd_neigh_entry);
     RUN_TEST(test_source_map);
     RUN_TEST(test_lookup_neigh_entry_not_in_cache);
+    RUN_TEST(test_lookup_bench);
+    RUN_TEST(test_link_flap_concurrent_lookups);
 
     RUN_TEST(test_events);
 
@@ -33,7 +33,7 @@ UNIT_SRC := test_neigh_table.c
 UNIT_CFLAGS := -I$(UNIT_PATH)/../inc
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
 
-UNIT_LDFLAGS := -lev -ljansson -lpcap -lmnl
+UNIT_LDFLAGS := -lev -ljansson -lpcap -lmnl -lpthread
 UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
 
 
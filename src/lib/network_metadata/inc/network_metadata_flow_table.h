@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NETWORK_METADATA_FLOW_TABLE_H_INCLUDED
+#define NETWORK_METADATA_FLOW_TABLE_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ds_dlist.h"
+
+struct net_md_flow;
+struct net_md_flow_key;
+
+/**
+ * @brief compact, fixed size flow key
+ *
+ * Flattens the fields compared by net_md_eth_cmp() and net_md_5tuple_cmp()
+ * so that a flow lookup boils down to a hash and a memcmp().
+ * Fields which do not participate in the lookup of a given flow are zeroed.
+ */
+struct net_md_tkey
+{
+    uint8_t src_ip[16];   /* Network byte order */
+    uint8_t dst_ip[16];   /* Network byte order */
+    uint8_t smac[6];
+    uint8_t dmac[6];
+    int16_t vlan_id;
+    uint16_t ethertype;   /* L2 only flows */
+    uint16_t sport;       /* Network byte order */
+    uint16_t dport;       /* Network byte order */
+    uint8_t ip_version;
+    uint8_t ipprotocol;
+    uint8_t eth_flags;    /* NET_MD_TKEY_SMAC | NET_MD_TKEY_DMAC */
+    uint8_t pad;
+};
+
+#define NET_MD_TKEY_SMAC 0x1
+#define NET_MD_TKEY_DMAC 0x2
+
+#define NET_MD_FLOW_TABLE_INIT_SIZE 1024
+
+
+/**
+ * @brief flow table slot
+ *
+ * The precomputed hash avoids dereferencing the flow of colliding slots.
+ */
+struct net_md_flow_slot
+{
+    uint32_t hash;
+    struct net_md_flow *flow;
+};
+
+
+/**
+ * @brief open addressing (linear probing) index of the aggregator flows
+ *
+ * Indexes the flows stored in the aggregator trees. The slots array is
+ * cache line aligned and sized to a power of 2, kept below a 75% load.
+ * Flows with a ufid are not indexed, as the eth pairs comparison
+ * of ufids is not an equality.
+ */
+struct net_md_flow_table
+{
+    struct net_md_flow_slot *slots;
+    size_t size;          /* # of slots, power of 2 */
+    size_t count;         /* # of indexed flows */
+    bool complete;        /* false once a flow is tracked outside of the table */
+    ds_dlist_t flows;     /* indexed net_md_flow, in insertion order */
+};
+
+
+/**
+ * @brief initializes a flow table
+ *
+ * @param table the table to initialize
+ * @param size the initial number of slots, rounded up to a power of 2
+ * @return true if successful, false otherwise
+ */
+bool
+net_md_flow_table_init(struct net_md_flow_table *table, size_t size);
+
+
+/**
+ * @brief releases a flow table's slots. Does not free the flows.
+ *
+ * @param table the table to release
+ */
+void
+net_md_flow_table_fini(struct net_md_flow_table *table);
+
+
+/**
+ * @brief builds the compact key of a lookup key
+ *
+ * @param key the lookup key
+ * @param tkey the compact key to fill
+ * @return true if the flow can be indexed, false otherwise
+ */
+bool
+net_md_tkey_set(struct net_md_flow_key *key, struct net_md_tkey *tkey);
+
+
+/**
+ * @brief computes the hash of a compact key
+ *
+ * @param tkey the compact key
+ * @return the key hash
+ */
+uint32_t
+net_md_tkey_hash(struct net_md_tkey *tkey);
+
+
+/**
+ * @brief looks up a flow
+ *
+ * @param table the flow table
+ * @param tkey the compact key of the flow
+ * @param hash the hash of the compact key
+ * @return the flow if found, NULL otherwise
+ */
+struct net_md_flow *
+net_md_flow_table_find(struct net_md_flow_table *table,
+                       struct net_md_tkey *tkey, uint32_t hash);
+
+
+/**
+ * @brief looks up a batch of flows
+ *
+ * Hashes all keys and prefetches their slots before probing, so that
+ * the memory accesses of the lookups overlap.
+ *
+ * @param table the flow table
+ * @param tkeys the compact keys of the flows
+ * @param hashes the hashes of the compact keys
+ * @param n the number of keys
+ * @param flows the returned flows, NULL for the keys not found
+ * @return the number of flows found
+ */
+size_t
+net_md_flow_table_find_batch(struct net_md_flow_table *table,
+                             struct net_md_tkey *tkeys, uint32_t *hashes,
+                             size_t n, struct net_md_flow **flows);
+
+
+/**
+ * @brief indexes a flow
+ *
+ * The flow's tkey and hash must be set.
+ *
+ * @param table the flow table
+ * @param flow the flow to index
+ * @return true if successful, false otherwise
+ */
+bool
+net_md_flow_table_insert(struct net_md_flow_table *table,
+                         struct net_md_flow *flow);
+
+
+/**
+ * @brief removes a flow from the index
+ *
+ * @param table the flow table
+ * @param flow the flow to remove
+ */
+void
+net_md_flow_table_remove(struct net_md_flow_table *table,
+                         struct net_md_flow *flow);
+
+#endif /* NETWORK_METADATA_FLOW_TABLE_H_INCLUDED */
@@ -158,6 +158,7 @@ struct net_md_aggregator
 {
     ds_tree_t eth_pairs;          /* tracked flows projected at the eth level */
     ds_tree_t five_tuple_flows;   /* 5 tuple only flows */
+    struct net_md_flow_table flow_table; /* flat index of the above flows */
     bool report_all_samples;      /* Do not aggregate ethernet samples */
     struct flow_report *report;   /* report to serialize */
     size_t max_windows;           /* maximum number of windows */
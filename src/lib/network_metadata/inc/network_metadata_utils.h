@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "os_types.h"
 
 #include "network_metadata.h"
+#include "network_metadata_flow_table.h"
 
 enum acc_state
 {
@@ -51,6 +52,10 @@ enum acc_state
 struct net_md_flow
 {
     struct net_md_stats_accumulator *tuple_stats;
+    struct net_md_tkey tkey;    /* compact key, set when indexed */
+    uint32_t thash;             /* compact key hash */
+    bool indexed;               /* present in the aggregator's flow table */
+    ds_dlist_node_t table_node;
     ds_tree_node_t flow_node;
 };
 
@@ -124,6 +129,9 @@ net_md_lookup_eth_acc(struct net_md_aggregator *aggr,
 struct net_md_stats_accumulator *
 net_md_lookup_5tuple_acc(struct net_md_aggregator *aggr,
                          struct net_md_flow_key *key);
+size_t net_md_lookup_accs(struct net_md_aggregator *aggr,
+                          struct net_md_flow_key **keys, size_t n,
+                          struct net_md_stats_accumulator **accs);
 struct flow_window * net_md_active_window(struct net_md_aggregator *aggr);
 void net_md_set_counters(struct net_md_aggregator *aggr,
                          struct net_md_stats_accumulator *acc,
@@ -0,0 +1,334 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "network_metadata_report.h"
+#include "network_metadata_utils.h"
+#include "network_metadata_flow_table.h"
+
+#define NET_MD_CACHE_LINE 64
+#define NET_MD_FLOW_TABLE_MIN_SIZE 64
+
+
+static struct net_md_flow_slot *
+net_md_flow_table_alloc_slots(size_t size)
+{
+    struct net_md_flow_slot *slots;
+    size_t len;
+
+    len = size * sizeof(*slots);
+    slots = aligned_alloc(NET_MD_CACHE_LINE, len);
+    if (slots == NULL) return NULL;
+
+    memset(slots, 0, len);
+
+    return slots;
+}
+
+
+bool
+net_md_flow_table_init(struct net_md_flow_table *table, size_t size)
+{
+    size_t n;
+
+    n = NET_MD_FLOW_TABLE_MIN_SIZE;
+    while (n < size) n <<= 1;
+
+    table->slots = net_md_flow_table_alloc_slots(n);
+    if (table->slots == NULL) return false;
+
+    table->size = n;
+    table->count = 0;
+    table->complete = true;
+    ds_dlist_init(&table->flows, struct net_md_flow, table_node);
+
+    return true;
+}
+
+
+void
+net_md_flow_table_fini(struct net_md_flow_table *table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->size = 0;
+    table->count = 0;
+}
+
+
+bool
+net_md_tkey_set(struct net_md_flow_key *key, struct net_md_tkey *tkey)
+{
+    size_t ipl;
+    bool has_eth;
+
+    /* ufids are only compared when both keys carry one */
+    if (key->ufid != NULL) return false;
+
+    has_eth = (key->smac != NULL) || (key->dmac != NULL);
+
+    /* L2 only flows are tracked in eth pairs */
+    if ((key->ip_version == 0) && !has_eth) return false;
+
+    memset(tkey, 0, sizeof(*tkey));
+
+    if (has_eth)
+    {
+        if (key->smac != NULL)
+        {
+            memcpy(tkey->smac, key->smac->addr, sizeof(tkey->smac));
+            tkey->eth_flags |= NET_MD_TKEY_SMAC;
+        }
+        if (key->dmac != NULL)
+        {
+            memcpy(tkey->dmac, key->dmac->addr, sizeof(tkey->dmac));
+            tkey->eth_flags |= NET_MD_TKEY_DMAC;
+        }
+        tkey->vlan_id = key->vlan_id;
+    }
+
+    if (key->ip_version == 0)
+    {
+        tkey->ethertype = key->ethertype;
+        return true;
+    }
+
+    if ((key->src_ip == NULL) || (key->dst_ip == NULL)) return false;
+
+    ipl = (key->ip_version == 4 ? 4 : 16);
+    memcpy(tkey->src_ip, key->src_ip, ipl);
+    memcpy(tkey->dst_ip, key->dst_ip, ipl);
+    tkey->ip_version = key->ip_version;
+    tkey->ipprotocol = key->ipprotocol;
+    tkey->sport = key->sport;
+    tkey->dport = key->dport;
+
+    return true;
+}
+
+
+uint32_t
+net_md_tkey_hash(struct net_md_tkey *tkey)
+{
+    uint64_t words[sizeof(*tkey) / sizeof(uint64_t)];
+    uint64_t h;
+    size_t i;
+
+    memcpy(words, tkey, sizeof(words));
+
+    h = 0x9e3779b97f4a7c15ULL;
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    {
+        h ^= words[i];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 32;
+
+    return (uint32_t)h;
+}
+
+
+struct net_md_flow *
+net_md_flow_table_find(struct net_md_flow_table *table,
+                       struct net_md_tkey *tkey, uint32_t hash)
+{
+    struct net_md_flow_slot *slot;
+    struct net_md_flow *flow;
+    size_t mask;
+    size_t i;
+
+    if (table->slots == NULL) return NULL;
+
+    mask = table->size - 1;
+    i = hash & mask;
+    for (;;)
+    {
+        slot = &table->slots[i];
+        flow = slot->flow;
+        if (flow == NULL) return NULL;
+
+        if ((slot->hash == hash) &&
+            (memcmp(&flow->tkey, tkey, sizeof(*tkey)) == 0))
+        {
+            return flow;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+
+size_t
+net_md_flow_table_find_batch(struct net_md_flow_table *table,
+                             struct net_md_tkey *tkeys, uint32_t *hashes,
+                             size_t n, struct net_md_flow **flows)
+{
+    size_t found;
+    size_t mask;
+    size_t i;
+
+    if (table->slots == NULL) return 0;
+
+    mask = table->size - 1;
+    for (i = 0; i < n; i++)
+    {
+        __builtin_prefetch(&table->slots[hashes[i] & mask]);
+    }
+
+    found = 0;
+    for (i = 0; i < n; i++)
+    {
+        flows[i] = net_md_flow_table_find(table, &tkeys[i], hashes[i]);
+        if (flows[i] != NULL) found++;
+    }
+
+    return found;
+}
+
+
+static void
+net_md_flow_table_place(struct net_md_flow_slot *slots, size_t size,
+                        struct net_md_flow *flow)
+{
+    size_t mask;
+    size_t i;
+
+    mask = size - 1;
+    i = flow->thash & mask;
+    while (slots[i].flow != NULL) i = (i + 1) & mask;
+
+    slots[i].hash = flow->thash;
+    slots[i].flow = flow;
+}
+
+
+static bool
+net_md_flow_table_grow(struct net_md_flow_table *table)
+{
+    struct net_md_flow_slot *slots;
+    size_t size;
+    size_t i;
+
+    size = table->size << 1;
+    slots = net_md_flow_table_alloc_slots(size);
+    if (slots == NULL) return false;
+
+    for (i = 0; i < table->size; i++)
+    {
+        if (table->slots[i].flow == NULL) continue;
+        net_md_flow_table_place(slots, size, table->slots[i].flow);
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->size = size;
+
+    return true;
+}
+
+
+bool
+net_md_flow_table_insert(struct net_md_flow_table *table,
+                         struct net_md_flow *flow)
+{
+    bool ret;
+
+    if (table->slots == NULL) return false;
+
+    /* Keep the load factor under 75% */
+    if ((table->count + 1) * 4 > table->size * 3)
+    {
+        ret = net_md_flow_table_grow(table);
+        if (!ret && (table->count + 1 == table->size))
+        {
+            LOGD("%s: flow table full (%zu flows)", __func__, table->count);
+            return false;
+        }
+    }
+
+    net_md_flow_table_place(table->slots, table->size, flow);
+    ds_dlist_insert_tail(&table->flows, flow);
+    flow->indexed = true;
+    table->count++;
+
+    return true;
+}
+
+
+void
+net_md_flow_table_remove(struct net_md_flow_table *table,
+                         struct net_md_flow *flow)
+{
+    struct net_md_flow_slot *slots;
+    size_t mask;
+    size_t i, j, k;
+
+    if (!flow->indexed) return;
+
+    slots = table->slots;
+    mask = table->size - 1;
+
+    /* Locate the flow's slot */
+    i = flow->thash & mask;
+    while (slots[i].flow != flow) i = (i + 1) & mask;
+
+    /*
+     * Backward shift deletion: move back the following entries of the
+     * cluster which would otherwise become unreachable from their home slot.
+     */
+    j = i;
+    for (;;)
+    {
+        slots[i].flow = NULL;
+        for (;;)
+        {
+            j = (j + 1) & mask;
+            if (slots[j].flow == NULL) goto out;
+
+            k = slots[j].hash & mask;
+
+            /* The entry's home slot lies in (i, j]: it stays in place */
+            if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+            break;
+        }
+        slots[i] = slots[j];
+        i = j;
+    }
+
+out:
+    ds_dlist_remove(&table->flows, flow);
+    flow->indexed = false;
+    table->count--;
+}
@@ -61,6 +61,7 @@ void net_md_free_aggregator(struct net_md_aggregator *aggr)
     }
 
     net_md_free_flow_tree(&aggr->five_tuple_flows);
+    net_md_flow_table_fini(&aggr->flow_table);
 
     free(aggr);
 }
@@ -88,6 +89,12 @@ net_md_allocate_aggregator(struct net_md_aggregator_set *aggr_set)
     aggr = calloc(1, sizeof(*aggr));
     if (aggr == NULL) return NULL;
 
+    /* Allocate aggregator's flow index */
+    if (!net_md_flow_table_init(&aggr->flow_table, NET_MD_FLOW_TABLE_INIT_SIZE))
+    {
+        goto err_free_aggr;
+    }
+
     /* Allocate aggregator's report memory */
     report = calloc(1, sizeof(*report));
     if (report == NULL) goto err_free_aggr;
@@ -134,6 +141,7 @@ err_free_report:
     free(report);
 
 err_free_aggr:
+    net_md_flow_table_fini(&aggr->flow_table);
     free(aggr);
 
     return NULL;
@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "network_metadata_report.h"
 
 #define MAX_STRLEN 256
+#define NET_MD_LOOKUP_BATCH 16
 
 /**
  * @brief compares 2 flow keys'ethernet content
@@ -644,8 +645,16 @@ err_free_acc:
 
 void net_md_free_flow(struct net_md_flow *flow)
 {
+    struct net_md_stats_accumulator *acc;
+
     if (flow == NULL) return;
 
+    acc = flow->tuple_stats;
+    if (flow->indexed && (acc != NULL) && (acc->aggr != NULL))
+    {
+        net_md_flow_table_remove(&acc->aggr->flow_table, flow);
+    }
+
     net_md_free_acc(flow->tuple_stats);
     free(flow);
 }
@@ -742,6 +751,21 @@ net_md_tree_lookup_acc(struct net_md_aggregator *aggr,
     ds_tree_insert(tree, flow, acc->key);
     aggr->total_flows++;
 
+    /* Index the flow */
+    if (net_md_tkey_set(acc->key, &flow->tkey))
+    {
+        flow->thash = net_md_tkey_hash(&flow->tkey);
+        if (!net_md_flow_table_insert(&aggr->flow_table, flow))
+        {
+            aggr->flow_table.complete = false;
+        }
+    }
+    else if (acc->key->ufid != NULL)
+    {
+        /* Found by lookups without a ufid, which the table would miss */
+        aggr->flow_table.complete = false;
+    }
+
     return acc;
 
 err_free_flow:
@@ -818,20 +842,134 @@ net_md_lookup_eth_acc(struct net_md_aggregator *aggr,
 }
 
 
+/**
+ * @brief checks if a flow table lookup result is final
+ *
+ * @param aggr the aggregator
+ * @param key the lookup key
+ * @param flow the flow found in the flow table, if any
+ * @return true if the tree lookup can be skipped, false otherwise
+ */
+static bool
+net_md_table_lookup_done(struct net_md_aggregator *aggr,
+                        struct net_md_flow_key *key,
+                        struct net_md_flow *flow)
+{
+    if (flow != NULL) return true;
+
+    /* The flow is not tracked, unless it could not be indexed */
+    return ((key->flags == NET_MD_ACC_LOOKUP_ONLY) &&
+            aggr->flow_table.complete);
+}
+
+
+static struct net_md_stats_accumulator *
+net_md_tree_lookup_any_acc(struct net_md_aggregator *aggr,
+                           struct net_md_flow_key *key)
+{
+    struct net_md_stats_accumulator *acc;
+
+    if (has_eth_info(key)) return net_md_lookup_eth_acc(aggr, key);
+
+    acc = net_md_tree_lookup_acc(aggr, &aggr->five_tuple_flows, key);
+    if (acc != NULL) acc->aggr = aggr;
+
+    return acc;
+}
+
+
 struct net_md_stats_accumulator *
 net_md_lookup_acc(struct net_md_aggregator *aggr,
                   struct net_md_flow_key *key)
 {
     struct net_md_stats_accumulator *acc;
+    struct net_md_flow *flow;
+    struct net_md_tkey tkey;
 
     if (aggr == NULL) return NULL;
 
-    if (has_eth_info(key)) return net_md_lookup_eth_acc(aggr, key);
+    /* Look the flow up in the flow table first */
+    if (net_md_tkey_set(key, &tkey))
+    {
+        flow = net_md_flow_table_find(&aggr->flow_table, &tkey,
+                                      net_md_tkey_hash(&tkey));
+        if (net_md_table_lookup_done(aggr, key, flow))
+        {
+            if (flow == NULL) return NULL;
 
-    acc = net_md_tree_lookup_acc(aggr, &aggr->five_tuple_flows, key);
-    if (acc != NULL) acc->aggr = aggr;
+            acc = flow->tuple_stats;
+            acc->aggr = aggr;
+            return acc;
+        }
+    }
 
-    return acc;
+    return net_md_tree_lookup_any_acc(aggr, key);
+}
+
+
+/**
+ * @brief looks up a batch of accumulators
+ *
+ * Looks up the batch in the flow table, then creates the missing
+ * accumulators as net_md_lookup_acc() would.
+ *
+ * @param aggr the aggregator
+ * @param keys the lookup keys
+ * @param n the number of keys
+ * @param accs the returned accumulators
+ * @return the number of accumulators returned
+ */
+size_t
+net_md_lookup_accs(struct net_md_aggregator *aggr,
+                   struct net_md_flow_key **keys, size_t n,
+                   struct net_md_stats_accumulator **accs)
+{
+    struct net_md_flow *flows[NET_MD_LOOKUP_BATCH];
+    struct net_md_tkey tkeys[NET_MD_LOOKUP_BATCH];
+    uint32_t hashes[NET_MD_LOOKUP_BATCH];
+    bool indexed[NET_MD_LOOKUP_BATCH];
+    size_t found;
+    size_t batch;
+    size_t i, j;
+
+    if (aggr == NULL) return 0;
+
+    found = 0;
+    for (i = 0; i < n; i += batch)
+    {
+        batch = n - i;
+        if (batch > NET_MD_LOOKUP_BATCH) batch = NET_MD_LOOKUP_BATCH;
+
+        for (j = 0; j < batch; j++)
+        {
+            indexed[j] = net_md_tkey_set(keys[i + j], &tkeys[j]);
+            hashes[j] = indexed[j] ? net_md_tkey_hash(&tkeys[j]) : 0;
+        }
+
+        net_md_flow_table_find_batch(&aggr->flow_table, tkeys, hashes,
+                                     batch, flows);
+
+        for (j = 0; j < batch; j++)
+        {
+            struct net_md_flow_key *key = keys[i + j];
+            struct net_md_stats_accumulator *acc;
+
+            if (indexed[j] && net_md_table_lookup_done(aggr, key, flows[j]))
+            {
+                acc = (flows[j] != NULL ? flows[j]->tuple_stats : NULL);
+                if (acc != NULL) acc->aggr = aggr;
+            }
+            else
+            {
+                acc = net_md_tree_lookup_any_acc(aggr, key);
+            }
+
+            accs[i + j] = acc;
+            if (acc != NULL) found++;
+        }
+    }
+
+    return found;
 }
 
 
@@ -38,6 +38,7 @@ UNIT_SRC := src/network_metadata.pb-c.c
 UNIT_SRC += src/network_metadata.c
 UNIT_SRC += src/network_metadata_report.c
 UNIT_SRC += src/network_metadata_utils.c
+UNIT_SRC += src/network_metadata_flow_table.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_LDFLAGS := -lprotobuf-c
@@ -1615,6 +1615,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_direction_originator_data_serialize_deserialize);
     RUN_TEST(test_acc_flow_info_report);
     RUN_TEST(test_net_md_ufid);
+    RUN_TEST(test_flow_table);
+    RUN_TEST(test_flow_table_ufid);
+    RUN_TEST(test_flow_table_benchmark);
 
     return UNITY_END();
 }
@@ -103,4 +103,7 @@ void test_reverse_lookup_acc(void);
 void test_direction_originator_data_serialize_deserialize(void);
 void test_acc_flow_info_report(void);
 void test_net_md_ufid(void);
+void test_flow_table(void);
+void test_flow_table_ufid(void);
+void test_flow_table_benchmark(void);
 #endif // __TEST_NETWORK_METADATA_H__
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -2971,3 +2972,316 @@ test_net_md_ufid(void)
     validate_counters(&counters[1], &eth_acc->report_counters);
     net_md_free_aggregator(aggr);
 }
+
+
+/**
+ * @brief validates the lookups of flows carrying a ufid
+ *
+ * Flows with a ufid are not indexed: lookups without a ufid still find
+ * them, and lookup only misses do not create flows.
+ */
+void
+test_flow_table_ufid(void)
+{
+    struct net_md_stats_accumulator *reverse_acc;
+    struct net_md_stats_accumulator *acc;
+    struct net_md_flow_key *keys[1];
+    struct net_md_flow_key lookup_key;
+    struct flow_counters counters;
+    struct net_md_aggregator *aggr;
+    struct net_md_flow_key *key;
+    size_t nflows;
+    bool ret;
+
+    TEST_ASSERT_TRUE(g_nd_test.initialized);
+    counters.bytes_count = 10000;
+    counters.packets_count = 100;
+
+    g_nd_test.aggr_set.report_type = NET_MD_REPORT_RELATIVE;
+    aggr = net_md_allocate_aggregator(&g_nd_test.aggr_set);
+    TEST_ASSERT_NOT_NULL(aggr);
+    ret = net_md_activate_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+
+    /* Add a flow and its reverse, both with a ufid */
+    key = g_nd_test.net_md_keys[15];
+    key->ufid = &ufid[0];
+    ret = net_md_add_sample(aggr, key, &counters);
+    TEST_ASSERT_TRUE(ret);
+    acc = net_md_lookup_acc(aggr, key);
+    TEST_ASSERT_NOT_NULL(acc);
+
+    key = g_nd_test.net_md_keys[16];
+    key->ufid = &ufid[1];
+    ret = net_md_add_sample(aggr, key, &counters);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_UINT(0, aggr->flow_table.count);
+    TEST_ASSERT_FALSE(aggr->flow_table.complete);
+
+    /* The reverse lookup key carries no ufid */
+    reverse_acc = net_md_lookup_reverse_acc(aggr, acc);
+    TEST_ASSERT_NOT_NULL(reverse_acc);
+    TEST_ASSERT_EQUAL_PTR(net_md_lookup_acc(aggr, key), reverse_acc);
+
+    /* A lookup only miss on a ufid does not create a flow */
+    nflows = aggr->total_flows;
+    lookup_key = *g_nd_test.net_md_keys[15];
+    lookup_key.ufid = &ufid[1];
+    lookup_key.flags = NET_MD_ACC_LOOKUP_ONLY;
+    TEST_ASSERT_NULL(net_md_lookup_acc(aggr, &lookup_key));
+    keys[0] = &lookup_key;
+    TEST_ASSERT_EQUAL_UINT(0, net_md_lookup_accs(aggr, keys, 1, &acc));
+    TEST_ASSERT_NULL(acc);
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->total_flows);
+
+    g_nd_test.net_md_keys[15]->ufid = NULL;
+    g_nd_test.net_md_keys[16]->ufid = NULL;
+    net_md_free_aggregator(aggr);
+}
+
+
+/**
+ * @brief allocates a set of 5 tuple keys spread across eth pairs
+ *
+ * @param nflows the number of keys to allocate
+ * @param keys the array of key pointers to fill
+ * @return the backing storage of the keys, to be freed by the caller
+ */
+static void *
+test_alloc_flow_table_keys(size_t nflows, struct net_md_flow_key **keys)
+{
+    struct test_ft_key
+    {
+        struct net_md_flow_key key;
+        os_macaddr_t smac;
+        os_macaddr_t dmac;
+        uint8_t src_ip[4];
+        uint8_t dst_ip[4];
+    } *storage, *k;
+    size_t i;
+
+    storage = calloc(nflows, sizeof(*storage));
+    TEST_ASSERT_NOT_NULL(storage);
+
+    for (i = 0; i < nflows; i++)
+    {
+        k = &storage[i];
+        /* 100 devices talking to the same gateway */
+        k->smac.addr[0] = 0x02;
+        k->smac.addr[5] = (uint8_t)(i % 100);
+        k->dmac.addr[0] = 0x02;
+        k->dmac.addr[5] = 0xff;
+        k->src_ip[0] = 10;
+        k->src_ip[3] = (uint8_t)(i % 100);
+        k->dst_ip[0] = 192;
+        k->dst_ip[1] = 168;
+        k->dst_ip[2] = (uint8_t)(i >> 8);
+        k->dst_ip[3] = (uint8_t)i;
+
+        k->key.smac = &k->smac;
+        k->key.dmac = &k->dmac;
+        k->key.ip_version = 4;
+        k->key.src_ip = k->src_ip;
+        k->key.dst_ip = k->dst_ip;
+        k->key.ipprotocol = IPPROTO_TCP;
+        k->key.sport = htons((uint16_t)(1024 + (i / 65536)));
+        k->key.dport = htons(443);
+        keys[i] = &k->key;
+    }
+
+    return storage;
+}
+
+
+static double
+test_elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/**
+ * @brief validates the flow table index against the aggregator trees
+ */
+void
+test_flow_table(void)
+{
+    struct net_md_stats_accumulator *accs[64];
+    struct net_md_flow_table table;
+    struct net_md_flow_key *keys[4096];
+    struct net_md_flow *flows, *flow;
+    struct net_md_aggregator *aggr;
+    struct flow_counters counters;
+    size_t i, n, nflows;
+    void *storage;
+    bool ret;
+
+    TEST_ASSERT_TRUE(g_nd_test.initialized);
+
+    nflows = sizeof(keys) / sizeof(keys[0]);
+    storage = test_alloc_flow_table_keys(nflows, keys);
+
+    /* Exercise the table directly, growth and backward shift removal */
+    ret = net_md_flow_table_init(&table, 8);
+    TEST_ASSERT_TRUE(ret);
+    flows = calloc(nflows, sizeof(*flows));
+    TEST_ASSERT_NOT_NULL(flows);
+    for (i = 0; i < nflows; i++)
+    {
+        ret = net_md_tkey_set(keys[i], &flows[i].tkey);
+        TEST_ASSERT_TRUE(ret);
+        flows[i].thash = net_md_tkey_hash(&flows[i].tkey);
+        ret = net_md_flow_table_insert(&table, &flows[i]);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows, table.count);
+    TEST_ASSERT_TRUE(table.count * 4 <= table.size * 3);
+
+    for (i = 0; i < nflows; i += 2)
+    {
+        net_md_flow_table_remove(&table, &flows[i]);
+        TEST_ASSERT_FALSE(flows[i].indexed);
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows / 2, table.count);
+    for (i = 0; i < nflows; i++)
+    {
+        flow = net_md_flow_table_find(&table, &flows[i].tkey, flows[i].thash);
+        if (i & 1)
+        {
+            TEST_ASSERT_EQUAL_PTR(&flows[i], flow);
+        }
+        else
+        {
+            TEST_ASSERT_NULL(flow);
+        }
+    }
+
+    /* The intrusive list holds the remaining flows */
+    n = 0;
+    ds_dlist_foreach(&table.flows, flow)
+    {
+        n++;
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows / 2, n);
+    net_md_flow_table_fini(&table);
+    free(flows);
+
+    /* Exercise the table through the aggregator */
+    g_nd_test.aggr_set.report_type = NET_MD_REPORT_RELATIVE;
+    aggr = net_md_allocate_aggregator(&g_nd_test.aggr_set);
+    TEST_ASSERT_NOT_NULL(aggr);
+    ret = net_md_activate_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+
+    counters.bytes_count = 1000;
+    counters.packets_count = 10;
+    for (i = 0; i < nflows; i++)
+    {
+        ret = net_md_add_sample(aggr, keys[i], &counters);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->flow_table.count);
+    TEST_ASSERT_TRUE(aggr->flow_table.complete);
+
+    /* Table and tree lookups agree */
+    for (i = 0; i < nflows; i++)
+    {
+        TEST_ASSERT_EQUAL_PTR(net_md_lookup_eth_acc(aggr, keys[i]),
+                              net_md_lookup_acc(aggr, keys[i]));
+    }
+
+    /* Batch lookups agree too */
+    n = net_md_lookup_accs(aggr, keys, 64, accs);
+    TEST_ASSERT_EQUAL_UINT(64, n);
+    for (i = 0; i < 64; i++)
+    {
+        TEST_ASSERT_EQUAL_PTR(net_md_lookup_eth_acc(aggr, keys[i]), accs[i]);
+    }
+
+    /* Freeing the aggregator unindexes its flows */
+    net_md_free_aggregator(aggr);
+    free(storage);
+}
+
+
+/**
+ * @brief compares the tree and flow table lookups over 100k flows
+ */
+void
+test_flow_table_benchmark(void)
+{
+    struct net_md_stats_accumulator *accs[16];
+    struct net_md_stats_accumulator *acc;
+    struct timespec start, end;
+    struct net_md_aggregator *aggr;
+    struct net_md_flow_key **keys;
+    struct flow_counters counters;
+    size_t i, j, found, nflows;
+    double t_tree, t_table, t_batch;
+    void *storage;
+    bool ret;
+
+    TEST_ASSERT_TRUE(g_nd_test.initialized);
+
+    nflows = 100000;
+    keys = calloc(nflows, sizeof(*keys));
+    TEST_ASSERT_NOT_NULL(keys);
+    storage = test_alloc_flow_table_keys(nflows, keys);
+
+    g_nd_test.aggr_set.report_type = NET_MD_REPORT_RELATIVE;
+    aggr = net_md_allocate_aggregator(&g_nd_test.aggr_set);
+    TEST_ASSERT_NOT_NULL(aggr);
+    ret = net_md_activate_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+
+    counters.bytes_count = 1000;
+    counters.packets_count = 10;
+    for (i = 0; i < nflows; i++)
+    {
+        ret = net_md_add_sample(aggr, keys[i], &counters);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->flow_table.count);
+
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nflows; i++)
+    {
+        acc = net_md_lookup_eth_acc(aggr, keys[i]);
+        if (acc != NULL) found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    t_tree = test_elapsed(&start, &end);
+    TEST_ASSERT_EQUAL_UINT(nflows, found);
+
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nflows; i++)
+    {
+        acc = net_md_lookup_acc(aggr, keys[i]);
+        if (acc != NULL) found++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    t_table = test_elapsed(&start, &end);
+    TEST_ASSERT_EQUAL_UINT(nflows, found);
+
+    found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nflows; i += j)
+    {
+        j = nflows - i;
+        if (j > 16) j = 16;
+        found += net_md_lookup_accs(aggr, &keys[i], j, accs);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    t_batch = test_elapsed(&start, &end);
+    TEST_ASSERT_EQUAL_UINT(nflows, found);
+
+    LOGI("%s: %zu lookups: tree %.3f ms, table %.3f ms, batched table %.3f ms",
+         __func__, nflows, t_tree * 1e3, t_table * 1e3, t_batch * 1e3);
+
+    net_md_free_aggregator(aggr);
+    free(storage);
+    free(keys);
+}
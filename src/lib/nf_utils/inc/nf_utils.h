@@ -72,6 +72,7 @@ typedef struct nf_flow_
     uint16_t zone;
     uint32_t mark;
     ev_timer timeout;
+    struct nf_flow_ *next;  /* timeouts queued for the main loop */
 } nf_flow_t;
 
 struct nf_neigh_info
@@ -141,10 +142,31 @@ struct nfq_settings
 {
     struct ev_loop *loop;
     process_nfq_event_cb nfq_cb;
-    int queue_num;
+    int queue_num;          /* first queue of the range */
+    int num_queues;         /* number of queues, 0 means 1 */
+    bool worker_threads;    /* one thread and event loop per queue */
+    uint32_t batch_size;    /* 0 means NF_QUEUE_DEFAULT_BATCH_SIZE */
     void *data;
 };
 
+/**
+ * @brief nfq batching counters.
+ *
+ * Used to assess how many packets and verdicts each syscall carries.
+ */
+struct nfq_batch_stats
+{
+    uint64_t rcv_calls;      /* recv() calls issued on the nfqueue socket */
+    uint64_t rcv_pkts;       /* packets received */
+    uint64_t verdict_calls;  /* sendto() calls issued for verdicts */
+    uint64_t verdict_msgs;   /* verdict netlink messages sent */
+    uint64_t verdicts;       /* packets given a verdict */
+    uint64_t wakeups;        /* read events processed */
+};
+
+#define NF_QUEUE_DEFAULT_BATCH_SIZE 32
+#define NF_QUEUE_MAX_QUEUES 16
+
 enum
 {
     NF_UTIL_NFQ_DROP = 0,
@@ -161,4 +183,8 @@ bool nf_queue_set_verdict(uint32_t packet_id, int action);
 bool nf_queue_set_nlsock_buffsz(uint32_t sock_buff_sz);
 
 bool nf_queue_set_queue_maxlen(uint32_t queue_maxlen);
+
+bool nf_queue_set_batch_size(uint32_t batch_size);
+
+void nf_queue_get_batch_stats(struct nfq_batch_stats *stats);
 #endif /* NF_UTILS_H_INCLUDED */
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
 #include <ev.h>
+#include <pthread.h>
 #include <libmnl/libmnl.h>
 #include <linux/netfilter/nfnetlink_conntrack.h>
 #include <errno.h>
@@ -50,7 +51,14 @@ static struct nf_ct
     struct ev_io wmnl;
     struct mnl_socket *mnl;
     int fd;
-} nf_ct;
+    ev_async wtimers;           /* starts the timeouts set by nfqueue workers */
+    pthread_t loop_thread;
+    pthread_mutex_t lock;
+    nf_flow_t *timers;
+} nf_ct =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 
 
@@ -464,6 +472,23 @@ static struct nlmsghdr * nf_build_ip_nl_msg(
     return nlh;
 }
 
+static void nf_ct_timers_cbk(EV_P_ ev_async *w, int revents)
+{
+    nf_flow_t *ctx;
+    nf_flow_t *next;
+
+    pthread_mutex_lock(&nf_ct.lock);
+    ctx = nf_ct.timers;
+    nf_ct.timers = NULL;
+    pthread_mutex_unlock(&nf_ct.lock);
+
+    for (; ctx != NULL; ctx = next)
+    {
+        next = ctx->next;
+        ev_timer_start(EV_A_ &ctx->timeout);
+    }
+}
+
 static void nf_ct_timeout_cbk(EV_P_ ev_timer *timer, int revents)
 {
     nf_flow_t *ctx = container_of(timer, nf_flow_t, timeout);
@@ -550,7 +575,18 @@ int nf_ct_set_mark_timeout(nf_flow_t *flow, uint32_t timeout)
         goto err_set_mark;
     }
     ev_timer_init(&timer_ctx->timeout, nf_ct_timeout_cbk, timeout, 0);
-    ev_timer_start(nf_ct.loop, &timer_ctx->timeout);
+    if (pthread_equal(pthread_self(), nf_ct.loop_thread))
+    {
+        ev_timer_start(nf_ct.loop, &timer_ctx->timeout);
+        return 0;
+    }
+
+    /* The timer belongs to the main loop, have it start the timer */
+    pthread_mutex_lock(&nf_ct.lock);
+    timer_ctx->next = nf_ct.timers;
+    nf_ct.timers = timer_ctx;
+    pthread_mutex_unlock(&nf_ct.lock);
+    ev_async_send(nf_ct.loop, &nf_ct.wtimers);
     return 0;
 
 err_set_mark:
@@ -823,12 +859,16 @@ int nf_ct_init(struct ev_loop *loop)
     nf_ct.fd = mnl_socket_get_fd(nl);
     ev_io_init(&nf_ct.wmnl, read_mnl_socket_cbk, nf_ct.fd, EV_READ);
     ev_io_start(loop, &nf_ct.wmnl);
+    nf_ct.loop_thread = pthread_self();
+    ev_async_init(&nf_ct.wtimers, nf_ct_timers_cbk);
+    ev_async_start(loop, &nf_ct.wtimers);
     LOGD("%s: nf_ct initialized", __func__);
     return 0;
 }
 
 int nf_ct_exit(void)
 {
+    if (nf_ct.loop != NULL) ev_async_stop(nf_ct.loop, &nf_ct.wtimers);
     mnl_socket_close(nf_ct.mnl);
     return 0;
 }
@@ -26,7 +26,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <net/if.h>
@@ -46,7 +48,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "nf_utils.h"
 #include "os_types.h"
 
-static struct nf_queue_context
+#define NF_QUEUE_RCV_BUF_SIZE 0xFFFF
+
+/* Room reserved for a single verdict message, conntrack mark included */
+#define NF_QUEUE_VERDICT_MSG_SIZE 64
+
+/**
+ * @brief verdict pending for a received packet
+ */
+struct nf_queue_verdict
+{
+    uint32_t packet_id;
+    int verdict;
+};
+
+struct nf_queue_context
 {
     int queue_num;
     struct ev_loop *loop;
@@ -56,15 +72,39 @@ static struct nf_queue_context
     process_nfq_event_cb nfq_cb;
     int    nfq_fd;
     void *user_data;
+    char *rcv_buf;
+    char *verdict_buf;
+    struct nf_queue_verdict *verdicts;
+    uint32_t nverdicts;
+    uint32_t batch_size;
+    struct nfq_batch_stats stats;
+    pthread_t worker;
+    ev_async stop;
+    bool worker_started;
+};
+
+static struct nf_queue_mgr
+{
+    struct nf_queue_context queues[NF_QUEUE_MAX_QUEUES];
+    int num_queues;
+    bool threaded;
     bool initialized;
-} nf_queue_context;
+} nf_queue_mgr;
+
+/* Queue processed by the calling thread */
+static __thread struct nf_queue_context *nf_queue_cur_context;
 
 static struct nf_queue_context *
 nf_queue_get_context(void)
 {
-    return &nf_queue_context;
+    if (nf_queue_cur_context != NULL) return nf_queue_cur_context;
+
+    return &nf_queue_mgr.queues[0];
 }
 
+static void
+nf_queue_flush_verdicts(struct nf_queue_context *ctxt);
+
 
 
 static int
@@ -101,6 +141,15 @@ nf_queue_parse_attr_cb(const struct nlattr *attr, void *data)
             return MNL_CB_ERROR;
         }
         break;
+    case NFQA_PACKET_HDR:
+        rc = mnl_attr_validate2(attr, MNL_TYPE_UNSPEC,
+                                sizeof(struct nfqnl_msg_packet_hdr));
+        if (rc < 0)
+        {
+            LOGE("%s: mnl_attr_validate2 failed", __func__);
+            return MNL_CB_ERROR;
+        }
+        break;
     case NFQA_HWADDR:
         rc = mnl_attr_validate2(attr, MNL_TYPE_UNSPEC,
                                 sizeof(struct nfqnl_msg_packet_hw));
@@ -126,27 +175,49 @@ nf_queue_cb(const struct nlmsghdr *nlh, void *data)
     struct nlattr *tb[NFQA_MAX+1] = {};
     struct nf_queue_context *ctxt;
     struct nfq_pkt_info *pkt_info;
-    struct nfqnl_msg_packet_hdr *ph = NULL;
+    struct nfqnl_msg_packet_hdr *ph;
     struct nfqnl_msg_packet_hw  *phw = NULL;
-    uint32_t id = 0;
+    struct nf_queue_verdict *verdict;
+    uint32_t id;
     int ret;
 
-    ctxt = nf_queue_get_context();
+    ctxt = (struct nf_queue_context *)data;
     ret = mnl_attr_parse(nlh, sizeof(struct nfgenmsg), nf_queue_parse_attr_cb, tb);
-    if (ret == MNL_CB_ERROR) return MNL_CB_ERROR;
 
-    pkt_info = &ctxt->pkt_info;
-    if (tb[NFQA_PACKET_HDR])
+    /* Without a packet id there is nothing to give a verdict to */
+    if (tb[NFQA_PACKET_HDR] == NULL)
     {
-        ph = mnl_attr_get_payload(tb[NFQA_PACKET_HDR]);
-        id = ntohl(ph->packet_id);
+        LOGD("%s: skipping message without packet header", __func__);
+        return MNL_CB_OK;
     }
 
+    ph = mnl_attr_get_payload(tb[NFQA_PACKET_HDR]);
+    id = ntohl(ph->packet_id);
 
-    if (tb[NFQA_HWADDR]) phw = mnl_attr_get_payload(tb[NFQA_HWADDR]);
+    /* Flush the pending verdicts if the ring is full */
+    if (ctxt->nverdicts == ctxt->batch_size) nf_queue_flush_verdicts(ctxt);
 
     /* Default verdict is Inspect */
+    verdict = &ctxt->verdicts[ctxt->nverdicts++];
+    verdict->packet_id = id;
+    verdict->verdict = NF_UTIL_NFQ_INSPECT;
+    ctxt->stats.rcv_pkts++;
+
+    /*
+     * A malformed packet still gets the default verdict, and the rest of
+     * the buffer is processed
+     */
+    if (ret == MNL_CB_ERROR || tb[NFQA_PAYLOAD] == NULL)
+    {
+        LOGD("%s: malformed packet %u, default verdict", __func__, id);
+        return MNL_CB_OK;
+    }
+
+    if (tb[NFQA_HWADDR]) phw = mnl_attr_get_payload(tb[NFQA_HWADDR]);
+
+    pkt_info = &ctxt->pkt_info;
     pkt_info->verdict = NF_UTIL_NFQ_INSPECT;
+    pkt_info->queue_num = ctxt->queue_num;
     pkt_info->packet_id = id;
     pkt_info->payload = mnl_attr_get_payload(tb[NFQA_PAYLOAD]);
     pkt_info->payload_len = mnl_attr_get_payload_len(tb[NFQA_PAYLOAD]);
@@ -181,14 +252,12 @@ nf_queue_set_nlh_request(char *buf, uint8_t type, int queue_num)
 
 
 static void
-nf_queue_send_nlh_request(struct nlmsghdr *nlh, uint8_t cfg_type, void *cmd_opts)
+nf_queue_send_nlh_request(struct nf_queue_context *ctxt, struct nlmsghdr *nlh,
+                          uint8_t cfg_type, void *cmd_opts)
 {
-    struct nf_queue_context *ctxt;
     int ret;
     uint32_t *queue_maxlen;
 
-    ctxt = nf_queue_get_context();
-
     switch (cfg_type)
     {
     case NFQA_CFG_CMD:
@@ -230,37 +299,42 @@ nf_queue_send_nlh_request(struct nlmsghdr *nlh, uint8_t cfg_type, void *cmd_opts
 }
 
 
+/**
+ * @brief append the verdict attributes of a packet to a verdict message
+ *
+ * @param nlh the verdict message
+ * @param packet_id the packet id
+ * @param verdict the nf_utils verdict of the packet
+ */
 static void
-nf_queue_send_verdict(struct nlmsghdr *nlh, struct nfqnl_msg_verdict_hdr *vhdr)
+nf_queue_put_verdict(struct nlmsghdr *nlh, uint32_t packet_id, int verdict)
 {
-    struct nf_queue_context *ctxt;
-    struct nfq_pkt_info *pkt_info;
+    struct nfqnl_msg_verdict_hdr vhdr;
     struct nlattr *nest;
-    int ret;
     uint32_t mark = 1;
 
-    ctxt = nf_queue_get_context();
-    pkt_info = &ctxt->pkt_info;
+    memset(&vhdr, 0, sizeof(struct nfqnl_msg_verdict_hdr));
+    vhdr.id = htonl(packet_id);
 
-    switch(pkt_info->verdict)
+    switch(verdict)
     {
         case NF_UTIL_NFQ_ACCEPT:
                 LOGT("%s: Setting mark 2, no more packets needed.",__func__);
                 mark = 2;
-                vhdr->verdict = htonl(NF_ACCEPT);
+                vhdr.verdict = htonl(NF_ACCEPT);
                 break;
         case NF_UTIL_NFQ_INSPECT:
                 LOGT("%s: Continue inspection, need more packets.",__func__);
-                vhdr->verdict = htonl(NF_ACCEPT);
+                vhdr.verdict = htonl(NF_ACCEPT);
                 break;
         case NF_UTIL_NFQ_DROP:
                 LOGT("%s: Setting mark to 3, drop packets",__func__);
                 mark = 3;
-                vhdr->verdict = htonl(NF_DROP);
+                vhdr.verdict = htonl(NF_DROP);
                 break;
     }
 
-    mnl_attr_put(nlh, NFQA_VERDICT_HDR, sizeof(struct nfqnl_msg_verdict_hdr), vhdr);
+    mnl_attr_put(nlh, NFQA_VERDICT_HDR, sizeof(struct nfqnl_msg_verdict_hdr), &vhdr);
 
     if (mark == 2 || mark == 3)
     {
@@ -268,29 +342,91 @@ nf_queue_send_verdict(struct nlmsghdr *nlh, struct nfqnl_msg_verdict_hdr *vhdr)
         mnl_attr_put_u32(nlh, CTA_MARK, htonl(mark));
         mnl_attr_nest_end(nlh, nest);
     }
+}
 
-    ret = mnl_socket_sendto(ctxt->nfq_mnl, nlh, nlh->nlmsg_len);
+
+/**
+ * @brief send the verdicts of all the pending packets in one syscall
+ *
+ * Consecutive packets left to inspection need neither a conntrack mark
+ * nor a drop, so they are covered by a single NFQNL_MSG_VERDICT_BATCH
+ * message acknowledging all queued packets up to the highest id.
+ * Packets carrying a final verdict get their own NFQNL_MSG_VERDICT
+ * message to set the conntrack mark. All messages are packed
+ * in the same netlink datagram.
+ *
+ * @param ctxt the nfqueue context
+ */
+static void
+nf_queue_flush_verdicts(struct nf_queue_context *ctxt)
+{
+    struct nf_queue_verdict *verdict;
+    struct nlmsghdr *nlh;
+    uint32_t nmsgs;
+    uint8_t type;
+    size_t len;
+    uint32_t i;
+    uint32_t j;
+    int ret;
+
+    if (ctxt->nverdicts == 0) return;
+
+    len = 0;
+    nmsgs = 0;
+    i = 0;
+    while (i < ctxt->nverdicts)
+    {
+        verdict = &ctxt->verdicts[i];
+        j = i;
+        if (verdict->verdict == NF_UTIL_NFQ_INSPECT)
+        {
+            /* Extend the run of increasing ids left to inspection */
+            while ((j + 1) < ctxt->nverdicts &&
+                   ctxt->verdicts[j + 1].verdict == NF_UTIL_NFQ_INSPECT &&
+                   ctxt->verdicts[j + 1].packet_id > ctxt->verdicts[j].packet_id)
+            {
+                j++;
+            }
+        }
+
+        type = (j > i) ? NFQNL_MSG_VERDICT_BATCH : NFQNL_MSG_VERDICT;
+        nlh = nf_queue_set_nlh_request(ctxt->verdict_buf + len, type,
+                                       ctxt->queue_num);
+        nf_queue_put_verdict(nlh, ctxt->verdicts[j].packet_id,
+                             verdict->verdict);
+        len += MNL_ALIGN(nlh->nlmsg_len);
+        nmsgs++;
+        i = j + 1;
+    }
+
+    ret = mnl_socket_sendto(ctxt->nfq_mnl, ctxt->verdict_buf, len);
     if (ret == -1)
     {
-        LOGE("%s: Failed to send verdict for packet_id[%d]",__func__,ntohl(vhdr->id));
+        LOGE("%s: Failed to send %u verdicts: %s", __func__,
+             ctxt->nverdicts, strerror(errno));
     }
-    return;
+
+    ctxt->stats.verdict_calls++;
+    ctxt->stats.verdict_msgs += nmsgs;
+    ctxt->stats.verdicts += ctxt->nverdicts;
+    ctxt->nverdicts = 0;
 }
 
 
 /**
  * @brief ev callback to nfq events
+ *
+ * Drains up to batch_size messages from the socket without blocking,
+ * then sends the verdicts of all the packets received in one go.
  */
 static void
 nf_queue_read_mnl_cbk(EV_P_ ev_io *ev, int revents)
 {
     struct nf_queue_context *ctxt;
-    struct nfq_pkt_info *pkt_info;
-    struct nfqnl_msg_verdict_hdr vhdr;
-    char rcv_buf[0xFFFF];
-    struct nlmsghdr *nlh;
-    int portid = 0;
-    int ret = 0;
+    uint32_t portid;
+    uint32_t i;
+    ssize_t len;
+    int ret;
 
     if (EV_ERROR & revents)
     {
@@ -298,39 +434,39 @@ nf_queue_read_mnl_cbk(EV_P_ ev_io *ev, int revents)
         return;
     }
 
-    ctxt = nf_queue_get_context();
-    pkt_info = &ctxt->pkt_info;
-    pkt_info->verdict = NF_UTIL_NFQ_INSPECT;
+    ctxt = (struct nf_queue_context *)ev->data;
+    nf_queue_cur_context = ctxt;
+    portid = mnl_socket_get_portid(ctxt->nfq_mnl);
+    ctxt->stats.wakeups++;
 
-    ret = mnl_socket_recvfrom(ctxt->nfq_mnl, rcv_buf, sizeof(rcv_buf));
-    if (ret == -1)
+    for (i = 0; i < ctxt->batch_size; i++)
     {
-        LOGE("%s: mnl_socket_recvfrom failed: %s", __func__, strerror(errno));
-        return;
-    }
+        len = recv(ctxt->nfq_fd, ctxt->rcv_buf, NF_QUEUE_RCV_BUF_SIZE,
+                   MSG_DONTWAIT);
+        ctxt->stats.rcv_calls++;
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
 
-    portid = mnl_socket_get_portid(ctxt->nfq_mnl);
-    ret = mnl_cb_run(rcv_buf, ret, 0, portid, nf_queue_cb, NULL);
-    if (ret == -1)
-    {
-        LOGE("%s: mnl_cb_run failed [%u]", __func__, errno);
-        return;
-    }
+            LOGE("%s: recv failed: %s", __func__, strerror(errno));
+            break;
+        }
 
-    /* TODO: Sending Batch verdict is efficient */
-    memset(&vhdr, 0, sizeof(struct nfqnl_msg_verdict_hdr));
-    vhdr.id = htonl(pkt_info->packet_id);
+        ret = mnl_cb_run(ctxt->rcv_buf, len, 0, portid, nf_queue_cb, ctxt);
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_cb_run failed [%u]", __func__, errno);
+        }
+    }
 
-    nlh = nf_queue_set_nlh_request(rcv_buf, NFQNL_MSG_VERDICT, ctxt->queue_num);
-    nf_queue_send_verdict(nlh, &vhdr);
+    nf_queue_flush_verdicts(ctxt);
 
     return;
 }
 
 static bool
-nf_queue_event_init(void)
+nf_queue_event_init(struct nf_queue_context *ctxt)
 {
-    struct nf_queue_context *ctxt;
     char buf[MNL_SOCKET_BUFFER_SIZE];
     struct mnl_socket *nl;
     struct nlmsghdr *nlh;
@@ -338,9 +474,7 @@ nf_queue_event_init(void)
     struct nfqnl_msg_config_params params;
     int ret;
 
-    ctxt = nf_queue_get_context();
-
-    LOGI("%s: Starting nfqueue ", __func__);
+    LOGI("%s: Starting nfqueue %d", __func__, ctxt->queue_num);
 
     nl = mnl_socket_open(NETLINK_NETFILTER);
     if (nl == NULL)
@@ -363,17 +497,18 @@ nf_queue_event_init(void)
     memset(&cmd, 0, sizeof(struct nfqnl_msg_config_cmd));
     cmd.command = NFQNL_CFG_CMD_BIND;
     cmd.pf = htons(AF_INET);
-    nf_queue_send_nlh_request(nlh, NFQA_CFG_CMD, &cmd);
+    nf_queue_send_nlh_request(ctxt, nlh, NFQA_CFG_CMD, &cmd);
 
     nlh = nf_queue_set_nlh_request(buf, NFQNL_MSG_CONFIG, ctxt->queue_num);
     /* Set config params. */
     memset(&params, 0, sizeof(struct nfqnl_msg_config_params));
     params.copy_range = htonl(0xFFFF);
     params.copy_mode = NFQNL_COPY_PACKET;
-    nf_queue_send_nlh_request(nlh, NFQA_CFG_PARAMS, &params);
+    nf_queue_send_nlh_request(ctxt, nlh, NFQA_CFG_PARAMS, &params);
 
     ctxt->nfq_fd = mnl_socket_get_fd(ctxt->nfq_mnl);
     ev_io_init(&ctxt->nfq_io_mnl, nf_queue_read_mnl_cbk, ctxt->nfq_fd, EV_READ);
+    ctxt->nfq_io_mnl.data = ctxt;
     ev_io_start(ctxt->loop, &ctxt->nfq_io_mnl);
 
     return true;
@@ -385,6 +520,167 @@ error:
 }
 
 
+/**
+ * @brief ev callback breaking a queue worker loop
+ */
+static void
+nf_queue_worker_stop_cbk(EV_P_ ev_async *w, int revents)
+{
+    (void)w;
+    (void)revents;
+
+    ev_break(EV_A_ EVBREAK_ALL);
+}
+
+
+/**
+ * @brief queue worker thread, runs the queue's own event loop
+ *
+ * @param arg the queue context
+ */
+static void *
+nf_queue_worker(void *arg)
+{
+    struct nf_queue_context *ctxt;
+
+    ctxt = (struct nf_queue_context *)arg;
+    nf_queue_cur_context = ctxt;
+
+    LOGI("%s: nfqueue %d worker started", __func__, ctxt->queue_num);
+    ev_run(ctxt->loop, 0);
+    LOGI("%s: nfqueue %d worker stopped", __func__, ctxt->queue_num);
+
+    return NULL;
+}
+
+
+/**
+ * @brief start the worker thread of a queue
+ *
+ * @param ctxt the queue context
+ * @return true if the worker was started, false otherwise
+ */
+static bool
+nf_queue_worker_start(struct nf_queue_context *ctxt)
+{
+    int rc;
+
+    ev_async_init(&ctxt->stop, nf_queue_worker_stop_cbk);
+    ev_async_start(ctxt->loop, &ctxt->stop);
+
+    rc = pthread_create(&ctxt->worker, NULL, nf_queue_worker, ctxt);
+    if (rc != 0)
+    {
+        LOGE("%s: failed to start nfqueue %d worker: %s", __func__,
+             ctxt->queue_num, strerror(rc));
+        return false;
+    }
+    ctxt->worker_started = true;
+
+    return true;
+}
+
+
+/**
+ * @brief resize the verdict ring of a queue
+ *
+ * @param ctxt the queue context
+ * @param batch_size the max number of packets per batch
+ * @return true if the batch was resized, false otherwise
+ */
+static bool
+nf_queue_resize_batch(struct nf_queue_context *ctxt, uint32_t batch_size)
+{
+    struct nf_queue_verdict *verdicts;
+    char *verdict_buf;
+
+    if (batch_size == ctxt->batch_size) return true;
+
+    verdicts = calloc(batch_size, sizeof(*verdicts));
+    if (verdicts == NULL) return false;
+
+    verdict_buf = calloc(batch_size, NF_QUEUE_VERDICT_MSG_SIZE);
+    if (verdict_buf == NULL)
+    {
+        free(verdicts);
+        return false;
+    }
+
+    /* Do not lose any pending verdict */
+    if (ctxt->nfq_mnl != NULL) nf_queue_flush_verdicts(ctxt);
+
+    free(ctxt->verdicts);
+    free(ctxt->verdict_buf);
+    ctxt->verdicts = verdicts;
+    ctxt->verdict_buf = verdict_buf;
+    ctxt->batch_size = batch_size;
+    ctxt->nverdicts = 0;
+
+    return true;
+}
+
+
+/**
+ * @brief release the resources of a queue
+ *
+ * Stops the queue's worker if any and unbinds the queue.
+ *
+ * @param ctxt the queue context
+ */
+static void
+nf_queue_context_exit(struct nf_queue_context *ctxt)
+{
+    struct nlmsghdr *nlh;
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nfqnl_msg_config_cmd cmd;
+
+    if (ctxt->worker_started)
+    {
+        ev_async_send(ctxt->loop, &ctxt->stop);
+        pthread_join(ctxt->worker, NULL);
+        ctxt->worker_started = false;
+    }
+
+    if (ctxt->nfq_mnl != NULL)
+    {
+        nlh = nf_queue_set_nlh_request(buf, NFQNL_MSG_CONFIG, ctxt->queue_num);
+
+        /* UnBind for packets.*/
+        memset(&cmd, 0, sizeof(struct nfqnl_msg_config_cmd));
+        cmd.command = NFQNL_CFG_CMD_UNBIND;
+        cmd.pf = htons(AF_INET);
+        nf_queue_send_nlh_request(ctxt, nlh, NFQA_CFG_CMD, &cmd);
+
+        if (ev_is_active(&ctxt->nfq_io_mnl))
+        {
+            ev_io_stop(ctxt->loop, &ctxt->nfq_io_mnl);
+        }
+
+        nf_queue_flush_verdicts(ctxt);
+        mnl_socket_close(ctxt->nfq_mnl);
+        ctxt->nfq_mnl = NULL;
+    }
+
+    if (nf_queue_mgr.threaded && ctxt->loop != NULL)
+    {
+        if (ev_is_active(&ctxt->stop)) ev_async_stop(ctxt->loop, &ctxt->stop);
+        ev_loop_destroy(ctxt->loop);
+    }
+    ctxt->loop = NULL;
+
+    free(ctxt->verdict_buf);
+    free(ctxt->verdicts);
+    free(ctxt->rcv_buf);
+    ctxt->verdict_buf = NULL;
+    ctxt->verdicts = NULL;
+    ctxt->rcv_buf = NULL;
+
+    /* A later nf_queue_init() must start from an empty batch */
+    ctxt->batch_size = 0;
+    ctxt->nverdicts = 0;
+}
+
+
 /**
  * @brief set max socket buffer size of netlink.
  *
@@ -395,21 +691,26 @@ bool
 nf_queue_set_nlsock_buffsz(uint32_t sock_buff_sz)
 {
     struct nf_queue_context *ctxt;
+    bool success;
     int ret;
+    int i;
 
-    ctxt = nf_queue_get_context();
-    if (ctxt == NULL) return false;
-    ret = setsockopt(ctxt->nfq_fd, SOL_SOCKET,
-                     SO_RCVBUFFORCE, &sock_buff_sz,
-                     sizeof(sock_buff_sz));
-    if (ret == -1)
+    success = true;
+    for (i = 0; i < nf_queue_mgr.num_queues; i++)
     {
-        LOGE("%s: Failed to set nfq socket buff size to %u: error[%s]",
-              __func__, sock_buff_sz, strerror(errno));
-        return false;
+        ctxt = &nf_queue_mgr.queues[i];
+        ret = setsockopt(ctxt->nfq_fd, SOL_SOCKET,
+                         SO_RCVBUFFORCE, &sock_buff_sz,
+                         sizeof(sock_buff_sz));
+        if (ret == -1)
+        {
+            LOGE("%s: Failed to set nfq %d socket buff size to %u: error[%s]",
+                  __func__, ctxt->queue_num, sock_buff_sz, strerror(errno));
+            success = false;
+        }
     }
 
-    return true;
+    return success;
 }
 
 
@@ -425,12 +726,14 @@ nf_queue_set_queue_maxlen(uint32_t queue_maxlen)
     struct nf_queue_context *ctxt;
     struct nlmsghdr *nlh;
     char buf[MNL_SOCKET_BUFFER_SIZE];
+    int i;
 
-    ctxt = nf_queue_get_context();
-    if (ctxt == NULL) return false;
-
-    nlh = nf_queue_set_nlh_request(buf, NFQNL_MSG_CONFIG, ctxt->queue_num);
-    nf_queue_send_nlh_request(nlh, NFQA_CFG_QUEUE_MAXLEN, &queue_maxlen);
+    for (i = 0; i < nf_queue_mgr.num_queues; i++)
+    {
+        ctxt = &nf_queue_mgr.queues[i];
+        nlh = nf_queue_set_nlh_request(buf, NFQNL_MSG_CONFIG, ctxt->queue_num);
+        nf_queue_send_nlh_request(ctxt, nlh, NFQA_CFG_QUEUE_MAXLEN, &queue_maxlen);
+    }
     return true;
 }
 
@@ -438,6 +741,12 @@ nf_queue_set_queue_maxlen(uint32_t queue_maxlen)
 /**
  * @brief initialize nfqueues
  *
+ * Binds the queues [queue_num, queue_num + num_queues - 1], matching
+ * an iptables NFQUEUE --queue-balance range. The kernel hashes each
+ * flow to a single queue. With worker_threads set, each queue is
+ * processed by its own thread and event loop, and the packet callback
+ * is invoked from these threads.
+ *
  * @param struct nfq_settings.
  * @return 0 if the nfqueue initialization successful, -1 otherwise
  */
@@ -445,25 +754,78 @@ bool
 nf_queue_init(struct nfq_settings *nfqs)
 {
     struct nf_queue_context *ctxt;
+    uint32_t batch_size;
+    int num_queues;
     bool ret;
+    int i;
 
-    ctxt = nf_queue_get_context();
-    if (ctxt->initialized) return true;
-
-    memset(ctxt, 0, sizeof(struct nf_queue_context));
-    ctxt->loop = nfqs->loop;
-    ctxt->nfq_cb = nfqs->nfq_cb;
-    ctxt->user_data = nfqs->data;
-    ctxt->queue_num = nfqs->queue_num;
+    if (nf_queue_mgr.initialized) return true;
 
-    ret = nf_queue_event_init();
-    if (ret == false)
+    num_queues = nfqs->num_queues;
+    if (num_queues <= 0) num_queues = 1;
+    if (num_queues > NF_QUEUE_MAX_QUEUES)
     {
-        LOGE("%s: nf queue event monitor init failure.", __func__);
+        LOGE("%s: %d queues requested, max %d", __func__,
+             num_queues, NF_QUEUE_MAX_QUEUES);
         return false;
     }
-    ctxt->initialized = true;
+
+    batch_size = nfqs->batch_size;
+    if (batch_size == 0) batch_size = NF_QUEUE_DEFAULT_BATCH_SIZE;
+
+    memset(&nf_queue_mgr, 0, sizeof(nf_queue_mgr));
+    nf_queue_mgr.threaded = nfqs->worker_threads;
+    nf_queue_mgr.num_queues = num_queues;
+
+    for (i = 0; i < num_queues; i++)
+    {
+        ctxt = &nf_queue_mgr.queues[i];
+        ctxt->nfq_cb = nfqs->nfq_cb;
+        ctxt->user_data = nfqs->data;
+        ctxt->queue_num = nfqs->queue_num + i;
+        ctxt->loop = nfqs->loop;
+        if (nf_queue_mgr.threaded)
+        {
+            ctxt->loop = ev_loop_new(EVFLAG_AUTO);
+            if (ctxt->loop == NULL) goto err_exit;
+        }
+
+        ctxt->rcv_buf = calloc(1, NF_QUEUE_RCV_BUF_SIZE);
+        if (ctxt->rcv_buf == NULL) goto err_exit;
+
+        ret = nf_queue_resize_batch(ctxt, batch_size);
+        if (ret == false) goto err_exit;
+
+        ret = nf_queue_event_init(ctxt);
+        if (ret == false)
+        {
+            LOGE("%s: nf queue event monitor init failure.", __func__);
+            goto err_exit;
+        }
+    }
+
+    /* Start the workers once all the queues are bound */
+    for (i = 0; nf_queue_mgr.threaded && i < num_queues; i++)
+    {
+        ret = nf_queue_worker_start(&nf_queue_mgr.queues[i]);
+        if (ret == false) goto err_exit;
+    }
+
+    LOGI("%s: %d queue(s) from %d, batch size %u, %s", __func__,
+         num_queues, nfqs->queue_num, batch_size,
+         nf_queue_mgr.threaded ? "worker threads" : "main loop");
+
+    nf_queue_mgr.initialized = true;
     return true;
+
+err_exit:
+    for (i = 0; i < num_queues; i++)
+    {
+        nf_queue_context_exit(&nf_queue_mgr.queues[i]);
+    }
+    nf_queue_mgr.num_queues = 0;
+
+    return false;
 }
 
 
@@ -474,30 +836,17 @@ nf_queue_init(struct nfq_settings *nfqs)
 void
 nf_queue_exit(void)
 {
-    struct nlmsghdr *nlh;
-    char buf[MNL_SOCKET_BUFFER_SIZE];
-    struct nfqnl_msg_config_cmd cmd;
-    struct nf_queue_context *ctxt;;
-
-    ctxt = nf_queue_get_context();
-
-    if (ctxt->nfq_mnl == NULL) return;
+    int i;
 
-    nlh = nf_queue_set_nlh_request(buf, NFQNL_MSG_CONFIG, ctxt->queue_num);
-
-    /* UnBind for packets.*/
-    memset(&cmd, 0, sizeof(struct nfqnl_msg_config_cmd));
-    cmd.command = NFQNL_CFG_CMD_UNBIND;
-    cmd.pf = htons(AF_INET);
-    nf_queue_send_nlh_request(nlh, NFQA_CFG_CMD, &cmd);
+    if (!nf_queue_mgr.initialized) return;
 
-    if (ev_is_active(&ctxt->nfq_io_mnl))
+    for (i = 0; i < nf_queue_mgr.num_queues; i++)
     {
-        ev_io_stop(ctxt->loop, &ctxt->nfq_io_mnl);
+        nf_queue_context_exit(&nf_queue_mgr.queues[i]);
     }
 
-    mnl_socket_close(ctxt->nfq_mnl);
-    ctxt->initialized = false;
+    nf_queue_mgr.num_queues = 0;
+    nf_queue_mgr.initialized = false;
     return;
 }
 
@@ -505,21 +854,98 @@ nf_queue_exit(void)
 /**
  *
  * @brief  Set verdict for given pktid.
+ *
+ * The packet must be part of the batch being processed
+ * by the calling thread.
  */
 bool
 nf_queue_set_verdict(uint32_t packet_id, int action)
 {
     struct nf_queue_context  *ctxt;
+    struct nf_queue_verdict *verdict;
     struct nfq_pkt_info *pkt_info;
+    uint32_t i;
 
     ctxt = nf_queue_get_context();
-    pkt_info = &ctxt->pkt_info;
-    if (pkt_info->packet_id != packet_id) return false;
 
-    pkt_info->verdict = action;
+    /* The most recent packet is the likely target, search backwards */
+    verdict = NULL;
+    for (i = ctxt->nverdicts; i > 0; i--)
+    {
+        if (ctxt->verdicts[i - 1].packet_id != packet_id) continue;
+
+        verdict = &ctxt->verdicts[i - 1];
+        break;
+    }
+    if (verdict == NULL) return false;
+
+    verdict->verdict = action;
+
+    pkt_info = &ctxt->pkt_info;
+    if (pkt_info->packet_id == packet_id) pkt_info->verdict = action;
 
     LOGD("%s: Setting verdict for packet_id[%d] to [%d/%s]",
-         __func__, packet_id, pkt_info->verdict,
-         pkt_info->verdict == NF_UTIL_NFQ_DROP ? "Drop" : "Accept/Inspect");
+         __func__, packet_id, action,
+         action == NF_UTIL_NFQ_DROP ? "Drop" : "Accept/Inspect");
     return true;
 }
+
+
+/**
+ * @brief set the max number of packets processed per read event.
+ *
+ * Verdicts of the packets received in one read event are sent at once.
+ * A batch size of 1 restores one verdict per received packet.
+ * Queues served by worker threads get their batch size at init time.
+ *
+ * @param batch_size the max number of packets per batch
+ * @return true if the batch was resized, false otherwise
+ */
+bool
+nf_queue_set_batch_size(uint32_t batch_size)
+{
+    bool ret;
+    int i;
+
+    if (batch_size == 0) return false;
+    if (nf_queue_mgr.threaded) return false;
+
+    for (i = 0; i < nf_queue_mgr.num_queues; i++)
+    {
+        ret = nf_queue_resize_batch(&nf_queue_mgr.queues[i], batch_size);
+        if (ret == false) return false;
+    }
+
+    LOGI("%s: nfqueue batch size set to %u", __func__, batch_size);
+    return true;
+}
+
+
+/**
+ * @brief retrieve the nfqueue batching counters
+ *
+ * Counters of all queues are summed up. Counters updated by worker
+ * threads are read without synchronization, they are for reporting only.
+ *
+ * @param stats the counters container
+ */
+void
+nf_queue_get_batch_stats(struct nfq_batch_stats *stats)
+{
+    struct nf_queue_context *ctxt;
+    int i;
+
+    if (stats == NULL) return;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < nf_queue_mgr.num_queues; i++)
+    {
+        ctxt = &nf_queue_mgr.queues[i];
+        stats->rcv_calls += ctxt->stats.rcv_calls;
+        stats->rcv_pkts += ctxt->stats.rcv_pkts;
+        stats->verdict_calls += ctxt->stats.verdict_calls;
+        stats->verdict_msgs += ctxt->stats.verdict_msgs;
+        stats->verdicts += ctxt->stats.verdicts;
+        stats->wakeups += ctxt->stats.wakeups;
+    }
+}
@@ -0,0 +1,473 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_queue.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "nf_utils.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "nf_queue_tests";
+
+#define TEST_NFQ_QUEUE_NUM 10
+#define TEST_NFQ_MAX_PKTS 128
+
+/**
+ * @brief verdict received by the (simulated) kernel for a queued packet
+ */
+struct test_nfq_verdict
+{
+    bool queued;
+    int count;
+    uint32_t verdict;
+    uint32_t mark;
+};
+
+static struct ev_loop *g_loop;
+static int g_sock[2];
+static char g_mnl_sock;
+static struct test_nfq_verdict g_verdicts[TEST_NFQ_MAX_PKTS];
+static int g_delivered[TEST_NFQ_MAX_PKTS];
+static int g_sendto_calls;
+
+
+/*
+ * The nfqueue netlink socket is replaced by a socketpair: the test writes
+ * the packet messages at one end and the verdicts sent by nf_queue.c are
+ * applied the way the kernel does.
+ */
+struct mnl_socket *
+mnl_socket_open(int bus)
+{
+    TEST_ASSERT_EQUAL_INT(NETLINK_NETFILTER, bus);
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, g_sock));
+
+    return (struct mnl_socket *)&g_mnl_sock;
+}
+
+int
+mnl_socket_bind(struct mnl_socket *nl, unsigned int groups, pid_t pid)
+{
+    return 0;
+}
+
+int
+mnl_socket_get_fd(const struct mnl_socket *nl)
+{
+    return g_sock[0];
+}
+
+unsigned int
+mnl_socket_get_portid(const struct mnl_socket *nl)
+{
+    return 0;
+}
+
+int
+mnl_socket_close(struct mnl_socket *nl)
+{
+    close(g_sock[0]);
+    close(g_sock[1]);
+    return 0;
+}
+
+
+static int
+test_nfq_verdict_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+
+    if (mnl_attr_type_valid(attr, NFQA_MAX) < 0) return MNL_CB_OK;
+    tb[mnl_attr_get_type(attr)] = attr;
+
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief gives a verdict to a queued packet
+ */
+static void
+test_nfq_apply(uint32_t id, uint32_t verdict, uint32_t mark)
+{
+    struct test_nfq_verdict *v;
+
+    TEST_ASSERT_TRUE(id < TEST_NFQ_MAX_PKTS);
+    v = &g_verdicts[id];
+    TEST_ASSERT_TRUE_MESSAGE(v->queued, "verdict for a packet not queued");
+    v->queued = false;
+    v->count++;
+    v->verdict = verdict;
+    v->mark = mark;
+}
+
+
+ssize_t
+mnl_socket_sendto(const struct mnl_socket *nl, const void *buf, size_t len)
+{
+    const struct nlattr *tb[NFQA_MAX + 1];
+    struct nfqnl_msg_verdict_hdr *vhdr;
+    const struct nlattr *ct;
+    const struct nlmsghdr *nlh;
+    uint32_t mark;
+    uint32_t id;
+    int remain;
+    uint8_t type;
+
+    g_sendto_calls++;
+
+    remain = len;
+    for (nlh = buf; mnl_nlmsg_ok(nlh, remain); nlh = mnl_nlmsg_next(nlh, &remain))
+    {
+        type = nlh->nlmsg_type & 0xff;
+        if (type == NFQNL_MSG_CONFIG) continue;
+
+        TEST_ASSERT_EQUAL_UINT(NFNL_SUBSYS_QUEUE, nlh->nlmsg_type >> 8);
+        TEST_ASSERT_TRUE(type == NFQNL_MSG_VERDICT || type == NFQNL_MSG_VERDICT_BATCH);
+
+        memset(tb, 0, sizeof(tb));
+        mnl_attr_parse(nlh, sizeof(struct nfgenmsg), test_nfq_verdict_attr_cb, tb);
+        TEST_ASSERT_NOT_NULL(tb[NFQA_VERDICT_HDR]);
+        vhdr = mnl_attr_get_payload(tb[NFQA_VERDICT_HDR]);
+        id = ntohl(vhdr->id);
+
+        mark = 0;
+        if (tb[NFQA_CT] != NULL)
+        {
+            mnl_attr_for_each_nested(ct, tb[NFQA_CT])
+            {
+                if (mnl_attr_get_type(ct) == CTA_MARK) mark = ntohl(mnl_attr_get_u32(ct));
+            }
+        }
+
+        if (type == NFQNL_MSG_VERDICT)
+        {
+            test_nfq_apply(id, ntohl(vhdr->verdict), mark);
+            continue;
+        }
+
+        /* A batch verdict applies to all the queued packets up to id */
+        TEST_ASSERT_NULL(tb[NFQA_CT]);
+        for (; id > 0; id--)
+        {
+            if (g_verdicts[id].queued) test_nfq_apply(id, ntohl(vhdr->verdict), 0);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(0, remain);
+
+    return len;
+}
+
+
+/**
+ * @brief packet callback: drops one packet in 5, accepts one in 7 and
+ *        leaves the others to inspection
+ */
+static void
+test_nfq_cb(struct nfq_pkt_info *pkt_info, void *data)
+{
+    uint32_t id;
+
+    id = pkt_info->packet_id;
+    TEST_ASSERT_TRUE(id < TEST_NFQ_MAX_PKTS);
+    TEST_ASSERT_EQUAL_INT(TEST_NFQ_QUEUE_NUM, pkt_info->queue_num);
+    TEST_ASSERT_EQUAL_UINT(sizeof(id), pkt_info->payload_len);
+    TEST_ASSERT_EQUAL_MEMORY(&id, pkt_info->payload, sizeof(id));
+    g_delivered[id]++;
+
+    if (id % 5 == 0) TEST_ASSERT_TRUE(nf_queue_set_verdict(id, NF_UTIL_NFQ_DROP));
+    else if (id % 7 == 0) TEST_ASSERT_TRUE(nf_queue_set_verdict(id, NF_UTIL_NFQ_ACCEPT));
+}
+
+
+/**
+ * @brief appends a queued packet message to buf
+ *
+ * @return the length of the message
+ */
+static size_t
+test_nfq_put_packet(char *buf, uint32_t id)
+{
+    struct nfqnl_msg_packet_hdr ph;
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfg;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | NFQNL_MSG_PACKET;
+    nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(*nfg));
+    nfg->nfgen_family = AF_INET;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(TEST_NFQ_QUEUE_NUM);
+
+    memset(&ph, 0, sizeof(ph));
+    ph.packet_id = htonl(id);
+    ph.hw_protocol = htons(0x0800);
+    ph.hook = NF_INET_FORWARD;
+    mnl_attr_put(nlh, NFQA_PACKET_HDR, sizeof(ph), &ph);
+    mnl_attr_put(nlh, NFQA_PAYLOAD, sizeof(id), &id);
+
+    g_verdicts[id].queued = true;
+
+    return MNL_ALIGN(nlh->nlmsg_len);
+}
+
+
+/**
+ * @brief queues packets [first, first + count), npkts per datagram
+ */
+static void
+test_nfq_queue(uint32_t first, uint32_t count, uint32_t npkts)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    uint32_t id;
+    size_t len;
+    ssize_t rc;
+
+    len = 0;
+    for (id = first; id < first + count; id++)
+    {
+        len += test_nfq_put_packet(buf + len, id);
+        if ((id - first + 1) % npkts != 0 && id + 1 < first + count) continue;
+
+        rc = send(g_sock[1], buf, len, 0);
+        TEST_ASSERT_EQUAL_INT(len, rc);
+        len = 0;
+    }
+}
+
+
+/**
+ * @brief checks that packets [first, first + count) got a single verdict
+ */
+static void
+test_nfq_check_verdicts(uint32_t first, uint32_t count)
+{
+    struct test_nfq_verdict *v;
+    uint32_t id;
+
+    for (id = first; id < first + count; id++)
+    {
+        v = &g_verdicts[id];
+        TEST_ASSERT_FALSE(v->queued);
+        TEST_ASSERT_EQUAL_INT(1, v->count);
+
+        if (g_delivered[id] == 0 || (id % 5 != 0 && id % 7 != 0))
+        {
+            TEST_ASSERT_EQUAL_UINT(NF_ACCEPT, v->verdict);
+            TEST_ASSERT_EQUAL_UINT(0, v->mark);
+        }
+        else if (id % 5 == 0)
+        {
+            TEST_ASSERT_EQUAL_UINT(NF_DROP, v->verdict);
+            TEST_ASSERT_EQUAL_UINT(3, v->mark);
+        }
+        else
+        {
+            TEST_ASSERT_EQUAL_UINT(NF_ACCEPT, v->verdict);
+            TEST_ASSERT_EQUAL_UINT(2, v->mark);
+        }
+    }
+}
+
+
+static void
+test_nfq_init(uint32_t batch_size)
+{
+    struct nfq_settings nfqs;
+
+    memset(&nfqs, 0, sizeof(nfqs));
+    nfqs.loop = g_loop;
+    nfqs.nfq_cb = test_nfq_cb;
+    nfqs.queue_num = TEST_NFQ_QUEUE_NUM;
+    nfqs.batch_size = batch_size;
+    TEST_ASSERT_TRUE(nf_queue_init(&nfqs));
+
+    g_sendto_calls = 0;
+}
+
+
+void
+setUp(void)
+{
+    memset(g_verdicts, 0, sizeof(g_verdicts));
+    memset(g_delivered, 0, sizeof(g_delivered));
+    g_loop = ev_loop_new(0);
+}
+
+
+void
+tearDown(void)
+{
+    nf_queue_exit();
+    ev_loop_destroy(g_loop);
+    g_loop = NULL;
+}
+
+
+/**
+ * @brief all the packets of a read event get a verdict in one sendto()
+ */
+void
+test_nfq_batch(void)
+{
+    struct nfq_batch_stats stats;
+
+    test_nfq_init(32);
+    test_nfq_queue(1, 20, 1);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    test_nfq_check_verdicts(1, 20);
+    TEST_ASSERT_EQUAL_INT(1, g_sendto_calls);
+
+    nf_queue_get_batch_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(20, stats.rcv_pkts);
+    TEST_ASSERT_EQUAL_UINT64(20, stats.verdicts);
+}
+
+
+/**
+ * @brief several packets per datagram overflowing the verdict ring
+ */
+void
+test_nfq_multi_packet_reads(void)
+{
+    test_nfq_init(8);
+    test_nfq_queue(1, 30, 10);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    /* The ring was flushed each time it filled up mid-datagram */
+    test_nfq_check_verdicts(1, 30);
+    TEST_ASSERT_EQUAL_INT(4, g_sendto_calls);
+}
+
+
+/**
+ * @brief a read event processing only part of the queued packets gives a
+ *        verdict to those, and to none of the others
+ */
+void
+test_nfq_partial_batch(void)
+{
+    uint32_t id;
+    int i;
+
+    test_nfq_init(8);
+    test_nfq_queue(1, 20, 1);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    test_nfq_check_verdicts(1, 8);
+    for (id = 9; id <= 20; id++)
+    {
+        TEST_ASSERT_TRUE(g_verdicts[id].queued);
+        TEST_ASSERT_EQUAL_INT(0, g_delivered[id]);
+    }
+
+    /* The remaining packets are processed by the next read events */
+    for (i = 0; i < 4 && g_verdicts[20].queued; i++) ev_run(g_loop, EVRUN_NOWAIT);
+    test_nfq_check_verdicts(1, 20);
+    TEST_ASSERT_EQUAL_INT(3, g_sendto_calls);
+}
+
+
+/**
+ * @brief malformed packets in a datagram get the default verdict and do not
+ *        prevent the processing of the next ones
+ */
+void
+test_nfq_malformed(void)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    uint16_t bad_mark;
+    size_t len;
+    ssize_t rc;
+
+    test_nfq_init(32);
+
+    len = test_nfq_put_packet(buf, 1);
+
+    /* Packet 2 carries an invalid mark attribute */
+    nlh = (struct nlmsghdr *)(buf + len);
+    len += test_nfq_put_packet(buf + len, 2);
+    bad_mark = 0;
+    mnl_attr_put(nlh, NFQA_MARK, sizeof(bad_mark), &bad_mark);
+    len = (char *)nlh - buf + MNL_ALIGN(nlh->nlmsg_len);
+
+    /* Packet 3 has no payload */
+    nlh = (struct nlmsghdr *)(buf + len);
+    len += test_nfq_put_packet(buf + len, 3);
+    nlh->nlmsg_len -= MNL_ATTR_HDRLEN + MNL_ALIGN(sizeof(uint32_t));
+    len = (char *)nlh - buf + MNL_ALIGN(nlh->nlmsg_len);
+
+    /* A message without packet header cannot get a verdict */
+    nlh = mnl_nlmsg_put_header(buf + len);
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | NFQNL_MSG_PACKET;
+    mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    len += MNL_ALIGN(nlh->nlmsg_len);
+
+    len += test_nfq_put_packet(buf + len, 4);
+
+    rc = send(g_sock[1], buf, len, 0);
+    TEST_ASSERT_EQUAL_INT(len, rc);
+    ev_run(g_loop, EVRUN_NOWAIT);
+
+    test_nfq_check_verdicts(1, 4);
+    TEST_ASSERT_EQUAL_INT(1, g_delivered[1]);
+    TEST_ASSERT_EQUAL_INT(0, g_delivered[2]);
+    TEST_ASSERT_EQUAL_INT(0, g_delivered[3]);
+    TEST_ASSERT_EQUAL_INT(1, g_delivered[4]);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_nfq_batch);
+    RUN_TEST(test_nfq_multi_packet_reads);
+    RUN_TEST(test_nfq_partial_batch);
+    RUN_TEST(test_nfq_malformed);
+
+    return UNITY_END();
+}
@@ -251,7 +251,7 @@ int ovsdb_conn()
     int success;
     socklen_t addrlen;
 
-    sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
     if (sock_fd < 0)
     {
@@ -101,6 +101,9 @@ bool osfw_chain_del(int family, enum osfw_table table, const char *chain);
  *      - match: A string using iptables match syntax
  *      - target: User defined chain or one of the target actions : "ACCEPT,
  *        DROP, REJECT"
+ * Depending on the implementation, the rule may be validated only when the
+ * configuration is applied; rules rejected then are not applied and are
+ * reported to the function registered with osfw_rule_error_notify().
  */
 bool osfw_rule_add(int family, enum osfw_table table, const char *chain,
 		int prio, const char *match, const char *target);
@@ -118,6 +121,19 @@ bool osfw_rule_add(int family, enum osfw_table table, const char *chain,
 bool osfw_rule_del(int family, enum osfw_table table, const char *chain,
 		int prio, const char *match, const char *target);
 
+/*
+ * Rule rejected by the system when the configuration was applied. The rule
+ * remains known by the implementation until it is deleted with osfw_rule_del().
+ */
+typedef void osfw_rule_error_fn_t(int family, enum osfw_table table, const char *chain,
+		int prio, const char *match, const char *target);
+
+/*
+ * Register the function notified of the rules rejected by osfw_apply(), NULL
+ * to unregister it
+ */
+void osfw_rule_error_notify(osfw_rule_error_fn_t *fn);
+
 /*
  * Apply configuration to the system
  * The implementation should apply the configuration in the firewall subsystem
@@ -45,8 +45,14 @@
 #define OSFW_STR_FAMILY_INET "inet"
 #define OSFW_STR_FAMILY_INET6 "inet6"
 
+#ifndef OSFW_STR_CMD_IPTABLES_RESTORE
 #define OSFW_STR_CMD_IPTABLES_RESTORE "iptables-restore"
+#endif
+#ifndef OSFW_STR_CMD_IP6TABLES_RESTORE
 #define OSFW_STR_CMD_IP6TABLES_RESTORE "ip6tables-restore"
+#endif
+#define OSFW_STR_OPT_TEST "-t"
+#define OSFW_STR_OPT_NOFLUSH "--noflush"
 
 #define OSFW_STR_TABLE_FILTER "filter"
 #define OSFW_STR_TABLE_NAT "nat"
@@ -71,6 +77,7 @@ struct osfw_nfchain {
 	struct ds_dlist_node elt;
 	struct ds_dlist *parent;
 	char chain[OSFW_SIZE_CHAIN];
+	bool isapplied; /* The chain exists in the system */
 };
 
 struct osfw_nfrule {
@@ -80,6 +87,8 @@ struct osfw_nfrule {
 	int prio;
 	char match[OSFW_SIZE_MATCH];
 	char target[OSFW_SIZE_TARGET];
+	bool isapplied; /* The rule exists in the system */
+	bool isinvalid; /* The rule was rejected by the system, it is never applied */
 };
 
 struct osfw_nftable {
@@ -89,6 +98,10 @@ struct osfw_nftable {
 	bool isinitialized;
 	struct ds_dlist chains;
 	struct ds_dlist rules;
+	bool ismodified; /* The table has changes to apply */
+	bool isrestore; /* The table must be fully restored instead of updated */
+	struct ds_dlist chains_removed; /* Applied chains to remove from the system */
+	struct ds_dlist rules_removed; /* Applied rules to remove from the system */
 };
 
 struct osfw_nfinet {
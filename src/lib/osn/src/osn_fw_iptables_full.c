@@ -74,6 +74,7 @@ static char *osfw_target_builtin[] =
 };
 
 static struct osfw_nfbase osfw_nfbase;
+static osfw_rule_error_fn_t *osfw_rule_error_fn;
 
 static const char *osfw_convert_family(int family)
 {
@@ -390,7 +391,7 @@ static bool osfw_nfrule_match(const struct osfw_nfrule *self, const char *chain,
 
 static void osfw_nfrule_print(const struct osfw_nfrule *self, FILE *stream)
 {
-	if (!self || !stream) {
+	if (!self || !stream || self->isinvalid) {
 		return;
 	}
 	fprintf(stream, "-A %s -j %s %s\n", self->chain, self->target, self->match);
@@ -483,6 +484,110 @@ static void osfw_nftable_print(struct osfw_nftable *self, bool nfrules, struct o
 	osfw_nftable_print_footer(self, stream);
 }
 
+/*
+ * Rules are deleted by specification, which removes the first matching rule
+ * of the chain: the delta is only usable when no rule left in the system
+ * shares the specification of a removed one.
+ */
+static bool osfw_nftable_is_delta_safe(struct osfw_nftable *self)
+{
+	struct osfw_nfrule *removed = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+
+	ds_dlist_foreach(&self->rules_removed, removed) {
+		ds_dlist_foreach(&self->rules, nfrule) {
+			if (nfrule->isapplied && osfw_nfrule_match(nfrule, removed->chain, nfrule->prio, removed->match,
+					removed->target)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * Rule position counter, per chain
+ */
+struct osfw_nfpos {
+	const char *chain;
+	int pos;
+};
+
+/*
+ * Print the changes since the last apply, for iptables-restore --noflush:
+ * new chains are declared, removed rules deleted, new rules inserted at their
+ * position and removed chains deleted.
+ */
+static bool osfw_nftable_print_delta(struct osfw_nftable *self, FILE *stream)
+{
+	struct osfw_nfchain *nfchain = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+	struct osfw_nfpos *nfpos = NULL;
+	struct osfw_nfpos *tmp = NULL;
+	int npos = 0;
+	int ii = 0;
+
+	if (!self) {
+		return false;
+	} else if (self->isinitialized && !self->issupported) {
+		return true;
+	}
+
+	fprintf(stream, "*%s\n", osfw_convert_table(self->table));
+	ds_dlist_foreach(&self->chains, nfchain) {
+		if (!nfchain->isapplied) {
+			fprintf(stream, ":%s - [0:0]\n", nfchain->chain);
+		}
+	}
+
+	ds_dlist_foreach(&self->rules_removed, nfrule) {
+		fprintf(stream, "-D %s -j %s %s\n", nfrule->chain, nfrule->target, nfrule->match);
+	}
+
+	/*
+	 * Rules are ordered by priority and applied rules are already in the
+	 * system in that order, so a new rule is inserted after all the rules
+	 * of its chain preceding it
+	 */
+	ds_dlist_foreach(&self->rules, nfrule) {
+		if (nfrule->isinvalid) {
+			continue;
+		}
+
+		for (ii = 0; ii < npos; ii++) {
+			if (!strncmp(nfpos[ii].chain, nfrule->chain, sizeof(nfrule->chain))) {
+				break;
+			}
+		}
+
+		if (ii == npos) {
+			tmp = realloc(nfpos, (npos + 1) * sizeof(*nfpos));
+			if (!tmp) {
+				LOGE("Print OSFW table delta: memory allocation failed");
+				free(nfpos);
+				return false;
+			}
+			nfpos = tmp;
+			nfpos[npos].chain = nfrule->chain;
+			nfpos[npos].pos = 0;
+			npos++;
+		}
+
+		nfpos[ii].pos++;
+		if (!nfrule->isapplied) {
+			fprintf(stream, "-I %s %d -j %s %s\n", nfrule->chain, nfpos[ii].pos,
+					nfrule->target, nfrule->match);
+		}
+	}
+	free(nfpos);
+
+	ds_dlist_foreach(&self->chains_removed, nfchain) {
+		fprintf(stream, "-X %s\n", nfchain->chain);
+	}
+	osfw_nftable_print_footer(self, stream);
+	return true;
+}
+
 static bool osfw_nftable_check(struct osfw_nftable *self, struct osfw_nfrule *nfrule)
 {
 	bool errcode = true;
@@ -502,7 +607,7 @@ static bool osfw_nftable_check(struct osfw_nftable *self, struct osfw_nfrule *nf
 	osfw_nftable_print(self, false, nfrule, stream);
 	fclose(stream);
 
-	snprintf(cmd, sizeof(cmd) - 1, "cat %s | %s -t", path, osfw_convert_cmd(self->family));
+	snprintf(cmd, sizeof(cmd) - 1, "%s %s < %s", osfw_convert_cmd(self->family), OSFW_STR_OPT_TEST, path);
 	cmd[sizeof(cmd) - 1] = '\0';
 	err = cmd_log(cmd);
 	if (err) {
@@ -525,11 +630,92 @@ static bool osfw_nftable_set(struct osfw_nftable *self, int family, enum osfw_ta
 	self->table = table;
 	ds_dlist_init(&self->chains, struct osfw_nfchain, elt);
 	ds_dlist_init(&self->rules, struct osfw_nfrule, elt);
+	ds_dlist_init(&self->chains_removed, struct osfw_nfchain, elt);
+	ds_dlist_init(&self->rules_removed, struct osfw_nfrule, elt);
+	self->ismodified = true;
+	self->isrestore = true;
 	self->issupported = osfw_nftable_check(self, NULL);
 	self->isinitialized = true;
 	return true;
 }
 
+static bool osfw_nftable_purge(struct osfw_nftable *self)
+{
+	bool errcode = true;
+	struct osfw_nfchain *nfchain = NULL;
+	struct osfw_nfchain *nfchain_tmp = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+	struct osfw_nfrule *nfrule_tmp = NULL;
+
+	nfrule = ds_dlist_head(&self->rules_removed);
+	while (nfrule) {
+		nfrule_tmp = ds_dlist_next(&self->rules_removed, nfrule);
+		errcode = osfw_nfrule_del(nfrule);
+		if (!errcode) {
+			return false;
+		}
+		nfrule = nfrule_tmp;
+	}
+
+	nfchain = ds_dlist_head(&self->chains_removed);
+	while (nfchain) {
+		nfchain_tmp = ds_dlist_next(&self->chains_removed, nfchain);
+		errcode = osfw_nfchain_del(nfchain);
+		if (!errcode) {
+			return false;
+		}
+		nfchain = nfchain_tmp;
+	}
+	return true;
+}
+
+/*
+ * Keep the chain or rule until the removal is applied to the system, free
+ * it otherwise
+ */
+static bool osfw_nftable_retire_nfchain(struct osfw_nftable *self, struct osfw_nfchain *nfchain)
+{
+	if (!kconfig_enabled(CONFIG_OSN_FW_IPTABLES_BATCH) || !nfchain->isapplied) {
+		return osfw_nfchain_del(nfchain);
+	}
+
+	ds_dlist_remove(nfchain->parent, nfchain);
+	nfchain->parent = &self->chains_removed;
+	ds_dlist_insert_tail(nfchain->parent, nfchain);
+	return true;
+}
+
+static bool osfw_nftable_retire_nfrule(struct osfw_nftable *self, struct osfw_nfrule *nfrule)
+{
+	if (!kconfig_enabled(CONFIG_OSN_FW_IPTABLES_BATCH) || !nfrule->isapplied) {
+		return osfw_nfrule_del(nfrule);
+	}
+
+	ds_dlist_remove(nfrule->parent, nfrule);
+	nfrule->parent = &self->rules_removed;
+	ds_dlist_insert_tail(nfrule->parent, nfrule);
+	return true;
+}
+
+/*
+ * The table content was applied to the system
+ */
+static bool osfw_nftable_commit(struct osfw_nftable *self)
+{
+	struct osfw_nfchain *nfchain = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+
+	ds_dlist_foreach(&self->chains, nfchain) {
+		nfchain->isapplied = true;
+	}
+	ds_dlist_foreach(&self->rules, nfrule) {
+		nfrule->isapplied = !nfrule->isinvalid;
+	}
+	self->ismodified = false;
+	self->isrestore = false;
+	return osfw_nftable_purge(self);
+}
+
 static bool osfw_nftable_unset(struct osfw_nftable *self)
 {
 	bool errcode = true;
@@ -538,6 +724,9 @@ static bool osfw_nftable_unset(struct osfw_nftable *self)
 	struct osfw_nfrule *nfrule = NULL;
 	struct osfw_nfrule *nfrule_tmp = NULL;
 
+	self->ismodified = true;
+	self->isrestore = true;
+
 	nfrule = ds_dlist_head(&self->rules);
 	while (nfrule) {
 		nfrule_tmp = ds_dlist_next(&self->rules, nfrule);
@@ -557,7 +746,7 @@ static bool osfw_nftable_unset(struct osfw_nftable *self)
 		}
 		nfchain = nfchain_tmp;
 	}
-	return true;
+	return osfw_nftable_purge(self);
 }
 
 static struct osfw_nfchain *osfw_nftable_get_nfchain(struct osfw_nftable *self, const char *chain)
@@ -596,6 +785,24 @@ static bool osfw_nftable_add_nfchain(struct osfw_nftable *self, const char *chai
 		return false;
 	}
 
+	self->ismodified = true;
+
+	if (kconfig_enabled(CONFIG_OSN_FW_IPTABLES_BATCH)) {
+		/* The chain is still in the system if it was removed since the last apply */
+		ds_dlist_foreach(&self->chains_removed, nfchain) {
+			if (osfw_nfchain_match(nfchain, chain)) {
+				ds_dlist_remove(nfchain->parent, nfchain);
+				nfchain->parent = &self->chains;
+				ds_dlist_insert_tail(nfchain->parent, nfchain);
+				return true;
+			}
+		}
+
+		/* The chain is validated by osfw_apply() */
+		nfchain = osfw_nfchain_add(&self->chains, chain);
+		return nfchain != NULL;
+	}
+
 	nfchain = osfw_nfchain_add(&self->chains, chain);
 	if (!nfchain) {
 		return false;
@@ -620,7 +827,8 @@ static bool osfw_nftable_del_nfchain(struct osfw_nftable *self, const char *chai
 		return false;
 	}
 
-	errcode = osfw_nfchain_del(nfchain);
+	self->ismodified = true;
+	errcode = osfw_nftable_retire_nfchain(self, nfchain);
 	if (!errcode) {
 		return false;
 	}
@@ -644,6 +852,12 @@ static bool osfw_nftable_add_nfrule(struct osfw_nftable *self, const char *chain
 		return false;
 	}
 
+	self->ismodified = true;
+	if (kconfig_enabled(CONFIG_OSN_FW_IPTABLES_BATCH)) {
+		/* The rule is validated by osfw_apply() */
+		return true;
+	}
+
 	errcode = osfw_nftable_check(self, nfrule);
 	if (!errcode) {
 		osfw_nfrule_del(nfrule);
@@ -664,7 +878,8 @@ static bool osfw_nftable_del_nfrule(struct osfw_nftable *self, const char *chain
 		return false;
 	}
 
-	errcode = osfw_nfrule_del(nfrule);
+	self->ismodified = true;
+	errcode = osfw_nftable_retire_nfrule(self, nfrule);
 	if (!errcode) {
 		return false;
 	}
@@ -856,6 +1071,247 @@ static bool osfw_nfinet_del_nfrule(struct osfw_nfinet *self, enum osfw_table tab
 	return true;
 }
 
+#define osfw_nfinet_foreach_nftable(self, table, nftable) \
+	for (table = OSFW_TABLE_FILTER; \
+			(table <= OSFW_TABLE_SECURITY) && (nftable = osfw_nfinet_get_nftable(self, table)); \
+			table++)
+
+static FILE *osfw_nfinet_open(struct osfw_nfinet *self, char *path, size_t size)
+{
+	FILE *stream = NULL;
+
+	snprintf(path, size - 1, "/tmp/osfw-%s.%d", osfw_convert_family(self->family), (int) getpid());
+	path[size - 1] = '\0';
+	stream = fopen(path, "w+");
+	if (!stream) {
+		LOGE("Open %s failed: %d - %s", path, errno, strerror(errno));
+	}
+	return stream;
+}
+
+static bool osfw_nfinet_exec(struct osfw_nfinet *self, const char *path, const char *opts)
+{
+	bool errcode = true;
+	int err = 0;
+	char cmd[OSFW_SIZE_CMD];
+
+	snprintf(cmd, sizeof(cmd) - 1, "%s %s < %s", osfw_convert_cmd(self->family), opts, path);
+	cmd[sizeof(cmd) - 1] = '\0';
+	err = cmd_log(cmd);
+	if (err) {
+		errcode = false;
+	}
+	return errcode;
+}
+
+static void osfw_nfinet_save_error(const char *path)
+{
+	char cmd[OSFW_SIZE_CMD];
+
+	snprintf(cmd, sizeof(cmd) - 1, "cp %s %s.error", path, path);
+	cmd[sizeof(cmd) - 1] = '\0';
+	cmd_log(cmd);
+}
+
+/*
+ * Get the line number reported by a failed iptables-restore run: older
+ * versions report "line N failed", newer ones "Error occurred at line: N"
+ */
+static int osfw_nfinet_get_error_line(const char *output)
+{
+	const char *str = NULL;
+	char tail = '\0';
+	int line = 0;
+
+	str = strstr(output, "at line:");
+	if (str && (sscanf(str, "at line: %d", &line) == 1)) {
+		return line;
+	}
+
+	for (str = strstr(output, "line "); str; str = strstr(str + 1, "line ")) {
+		if (sscanf(str, "line %d faile%c", &line, &tail) == 2) {
+			return line;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Get the rule printed at the given line of an iptables-restore file
+ */
+static struct osfw_nfrule *osfw_nfinet_get_nfrule_at(struct osfw_nfinet *self, const char *path, int line)
+{
+	char buf[OSFW_SIZE_CHAIN + OSFW_SIZE_MATCH + OSFW_SIZE_TARGET + 16];
+	char spec[sizeof(buf)];
+	struct osfw_nftable *nftable = NULL;
+	struct osfw_nftable *current = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+	enum osfw_table table;
+	FILE *stream = NULL;
+	bool found = false;
+	char *str = NULL;
+	int ii = 0;
+
+	stream = fopen(path, "r");
+	if (!stream) {
+		LOGE("Open %s failed: %d - %s", path, errno, strerror(errno));
+		return NULL;
+	}
+
+	for (ii = 1; fgets(buf, sizeof(buf), stream); ii++) {
+		str = strchr(buf, '\n');
+		if (str) {
+			*str = '\0';
+		}
+
+		if (buf[0] == '*') {
+			current = NULL;
+			osfw_nfinet_foreach_nftable(self, table, nftable) {
+				if (!strcmp(buf + 1, osfw_convert_table(table))) {
+					current = nftable;
+					break;
+				}
+			}
+		}
+
+		if (ii == line) {
+			found = true;
+			break;
+		}
+	}
+	fclose(stream);
+
+	if (!found || !current || strncmp(buf, "-A ", 3)) {
+		return NULL;
+	}
+
+	ds_dlist_foreach(&current->rules, nfrule) {
+		snprintf(spec, sizeof(spec), "-A %s -j %s %s", nfrule->chain, nfrule->target, nfrule->match);
+		if (!nfrule->isinvalid && !strcmp(spec, buf)) {
+			return nfrule;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Validate all modified tables with a single iptables-restore test run. A
+ * rule failing validation is marked invalid, reported and the test run is
+ * repeated without it.
+ */
+static bool osfw_nfinet_check(struct osfw_nfinet *self)
+{
+	char output[OSFW_SIZE_CMD * 2];
+	char path[OSFW_SIZE_CMD];
+	char cmd[OSFW_SIZE_CMD];
+	struct osfw_nftable *nftable = NULL;
+	struct osfw_nfrule *nfrule = NULL;
+	enum osfw_table table;
+	FILE *stream = NULL;
+	int err = 0;
+
+	for (;;) {
+		stream = osfw_nfinet_open(self, path, sizeof(path));
+		if (!stream) {
+			return false;
+		}
+		osfw_nfinet_foreach_nftable(self, table, nftable) {
+			if (nftable->ismodified) {
+				osfw_nftable_print(nftable, true, NULL, stream);
+			}
+		}
+		fclose(stream);
+
+		snprintf(cmd, sizeof(cmd) - 1, "%s %s < %s 2>&1", osfw_convert_cmd(self->family),
+				OSFW_STR_OPT_TEST, path);
+		cmd[sizeof(cmd) - 1] = '\0';
+		err = cmd_buf(cmd, output, sizeof(output));
+		if (!err) {
+			unlink(path);
+			return true;
+		}
+
+		nfrule = osfw_nfinet_get_nfrule_at(self, path, osfw_nfinet_get_error_line(output));
+		if (!nfrule) {
+			LOGE("Check OSFW %s configuration failed: %s", osfw_convert_family(self->family), output);
+			osfw_nfinet_save_error(path);
+			unlink(path);
+			return false;
+		}
+		unlink(path);
+
+		nftable = container_of(nfrule->parent, struct osfw_nftable, rules);
+		LOGE("Check OSFW %s %s rule failed, it is not applied: -A %s -j %s %s",
+				osfw_convert_family(self->family), osfw_convert_table(nftable->table),
+				nfrule->chain, nfrule->target, nfrule->match);
+		nfrule->isinvalid = true;
+		if (osfw_rule_error_fn) {
+			osfw_rule_error_fn(self->family, nftable->table, nfrule->chain, nfrule->prio,
+					nfrule->match, nfrule->target);
+		}
+	}
+}
+
+/*
+ * Apply the modified tables: fully restore them, or apply their deltas using
+ * --noflush. Tables are committed on success.
+ */
+static bool osfw_nfinet_restore(struct osfw_nfinet *self, bool delta)
+{
+	bool errcode = true;
+	char path[OSFW_SIZE_CMD];
+	struct osfw_nftable *nftable = NULL;
+	FILE *stream = NULL;
+	bool isempty = true;
+	enum osfw_table table;
+
+	stream = osfw_nfinet_open(self, path, sizeof(path));
+	if (!stream) {
+		return false;
+	}
+	osfw_nfinet_foreach_nftable(self, table, nftable) {
+		if (!nftable->ismodified || (nftable->isrestore == delta)) {
+			continue;
+		}
+
+		if (delta && !osfw_nftable_is_delta_safe(nftable)) {
+			nftable->isrestore = true;
+			continue;
+		}
+
+		if (delta) {
+			errcode = osfw_nftable_print_delta(nftable, stream);
+		} else {
+			osfw_nftable_print(nftable, true, NULL, stream);
+		}
+		isempty = false;
+	}
+	fclose(stream);
+
+	if (errcode && !isempty) {
+		errcode = osfw_nfinet_exec(self, path, delta ? OSFW_STR_OPT_NOFLUSH : "");
+	}
+
+	if (!errcode && !delta) {
+		osfw_nfinet_save_error(path);
+	}
+	unlink(path);
+
+	osfw_nfinet_foreach_nftable(self, table, nftable) {
+		if (!nftable->ismodified || (nftable->isrestore == delta)) {
+			continue;
+		}
+
+		if (errcode) {
+			osfw_nftable_commit(nftable);
+		} else {
+			/* Start over from the whole table */
+			nftable->isrestore = true;
+		}
+	}
+	return errcode;
+}
+
 static bool osfw_nfinet_apply(struct osfw_nfinet *self)
 {
 	bool errcode = true;
@@ -868,6 +1324,29 @@ static bool osfw_nfinet_apply(struct osfw_nfinet *self)
 		return true;
 	}
 
+	if (kconfig_enabled(CONFIG_OSN_FW_IPTABLES_BATCH)) {
+		self->ismodified = false;
+
+		errcode = osfw_nfinet_check(self);
+		if (!errcode) {
+			/* Nothing was applied, try again on the next apply */
+			self->ismodified = true;
+			return false;
+		}
+
+		errcode = osfw_nfinet_restore(self, true);
+		if (!errcode) {
+			LOGW("Apply OSFW %s changes failed, restoring the modified tables",
+					osfw_convert_family(self->family));
+		}
+
+		errcode = osfw_nfinet_restore(self, false);
+		if (!errcode) {
+			LOGE("Apply OSFW configuration failed");
+		}
+		return errcode;
+	}
+
 	snprintf(path, sizeof(path) - 1, "/tmp/osfw-%s.%d", osfw_convert_family(self->family), (int) getpid());
 	path[sizeof(path) - 1] = '\0';
 	stream = fopen(path, "w+");
@@ -921,7 +1400,6 @@ static bool osfw_nfbase_unset(struct osfw_nfbase *self)
 {
 	bool errcode = true;
 
-	memset(self, 0, sizeof(*self));
 	errcode = osfw_nfinet_unset(&self->inet);
 	if (!errcode) {
 		LOGE("Unset OSFW base: unset OSFW inet failed");
@@ -1120,6 +1598,11 @@ bool osfw_rule_del(int family, enum osfw_table table, const char *chain,
 	return true;
 }
 
+void osfw_rule_error_notify(osfw_rule_error_fn_t *fn)
+{
+	osfw_rule_error_fn = fn;
+}
+
 bool osfw_apply(void)
 {
 	bool errcode = true;
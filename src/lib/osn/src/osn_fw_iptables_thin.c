@@ -316,6 +316,12 @@ bool osfw_rule_del(
     return true;
 }
 
+/* A rule failing to apply fails osfw_apply(), it is not reported per rule */
+void osfw_rule_error_notify(osfw_rule_error_fn_t *fn)
+{
+    (void)fn;
+}
+
 bool osfw_apply(void)
 {
     struct osfw_rule *prule;
@@ -139,6 +139,11 @@ bool osfw_rule_del(
     return true;
 }
 
+void osfw_rule_error_notify(osfw_rule_error_fn_t *fn)
+{
+    (void)fn;
+}
+
 bool osfw_apply(void)
 {
     LOG(INFO, "osfw: null apply");
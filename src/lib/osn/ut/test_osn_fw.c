@@ -0,0 +1,294 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "const.h"
+#include "log.h"
+#include "osn_fw_pri.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "osn_fw_tests";
+
+#define TEST_OSFW_EXEC_LOG OSFW_STR_CMD_IPTABLES_RESTORE ".log"
+#define TEST_OSFW_LEGACY OSFW_STR_CMD_IPTABLES_RESTORE ".legacy"
+#define TEST_OSFW_CHAIN "TEST_CHAIN"
+#define TEST_OSFW_INVALID "INVALID"
+
+/*
+ * Stands for iptables-restore: logs each run and rejects the rules jumping
+ * to TEST_OSFW_INVALID, reporting the line as iptables-restore does
+ */
+static const char test_osfw_restore[] =
+    "#!/bin/sh\n"
+    "echo \"$*\" >> " TEST_OSFW_EXEC_LOG "\n"
+    "n=0\n"
+    "while IFS= read -r line; do\n"
+    "    n=$((n + 1))\n"
+    "    case \"$line\" in\n"
+    "    *\" -j " TEST_OSFW_INVALID "\"*)\n"
+    "        if [ -e " TEST_OSFW_LEGACY " ]; then\n"
+    "            echo \"iptables-restore: line $n failed\"\n"
+    "        else\n"
+    "            echo \"iptables-restore v1.8.7 (legacy): Couldn't load target \\`" TEST_OSFW_INVALID "'\"\n"
+    "            echo \"Error occurred at line: $n\"\n"
+    "        fi\n"
+    "        exit 1;;\n"
+    "    esac\n"
+    "done\n"
+    "exit 0\n";
+
+struct test_osfw_errors
+{
+    int count;
+    int prio[8];
+} g_errors;
+
+
+static void
+test_osfw_on_error(int family, enum osfw_table table, const char *chain,
+                   int prio, const char *match, const char *target)
+{
+    TEST_ASSERT_EQUAL_INT(AF_INET, family);
+    TEST_ASSERT_EQUAL_INT(OSFW_TABLE_FILTER, table);
+    TEST_ASSERT_EQUAL_STRING(TEST_OSFW_CHAIN, chain);
+    TEST_ASSERT_EQUAL_STRING(TEST_OSFW_INVALID, target);
+    TEST_ASSERT_TRUE(g_errors.count < (int)ARRAY_LEN(g_errors.prio));
+    g_errors.prio[g_errors.count++] = prio;
+}
+
+
+/**
+ * @brief counts the iptables-restore runs since the last call
+ */
+static int
+test_osfw_execs(void)
+{
+    char line[256];
+    FILE *stream;
+    int execs;
+
+    execs = 0;
+    stream = fopen(TEST_OSFW_EXEC_LOG, "r");
+    if (stream == NULL) return 0;
+
+    while (fgets(line, sizeof(line), stream) != NULL) execs++;
+    fclose(stream);
+    unlink(TEST_OSFW_EXEC_LOG);
+
+    return execs;
+}
+
+
+static double
+test_osfw_elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3 +
+           (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+
+static void
+test_osfw_add_rules(int nrules)
+{
+    char match[64];
+    bool ret;
+    int i;
+
+    for (i = 0; i < nrules; i++)
+    {
+        snprintf(match, sizeof(match), "-s 10.%d.%d.%d", i >> 16, (i >> 8) & 0xff, i & 0xff);
+        ret = osfw_rule_add(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN, i, match, "ACCEPT");
+        TEST_ASSERT_TRUE(ret);
+    }
+}
+
+
+void
+setUp(void)
+{
+    FILE *stream;
+    bool ret;
+
+    stream = fopen(OSFW_STR_CMD_IPTABLES_RESTORE, "w");
+    TEST_ASSERT_NOT_NULL(stream);
+    fputs(test_osfw_restore, stream);
+    fclose(stream);
+    chmod(OSFW_STR_CMD_IPTABLES_RESTORE, 0755);
+    unlink(TEST_OSFW_LEGACY);
+
+    memset(&g_errors, 0, sizeof(g_errors));
+    osfw_rule_error_notify(test_osfw_on_error);
+
+    ret = osfw_init();
+    TEST_ASSERT_TRUE(ret);
+    test_osfw_execs();
+
+    ret = osfw_chain_add(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN);
+    TEST_ASSERT_TRUE(ret);
+}
+
+
+void
+tearDown(void)
+{
+    osfw_fini();
+    osfw_rule_error_notify(NULL);
+    unlink(OSFW_STR_CMD_IPTABLES_RESTORE);
+    unlink(TEST_OSFW_EXEC_LOG);
+    unlink(TEST_OSFW_LEGACY);
+}
+
+
+/**
+ * @brief applying N new rules takes one test run and one restore,
+ *        whatever N
+ */
+void
+test_osfw_apply_execs(void)
+{
+    static const int nrules[] = { 100, 1000, 5000 };
+    struct timespec start, end;
+    double t_add;
+    double t_apply;
+    size_t i;
+    bool ret;
+
+    for (i = 0; i < ARRAY_LEN(nrules); i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        test_osfw_add_rules(nrules[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t_add = test_osfw_elapsed(&start, &end);
+        TEST_ASSERT_EQUAL_INT(0, test_osfw_execs());
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = osfw_apply();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t_apply = test_osfw_elapsed(&start, &end);
+        TEST_ASSERT_TRUE(ret);
+        TEST_ASSERT_EQUAL_INT(2, test_osfw_execs());
+
+        LOGI("%s: %d rules: add %.1f ms, apply %.1f ms, 2 execs",
+             __func__, nrules[i], t_add, t_apply);
+
+        /* Nothing left to apply */
+        ret = osfw_apply();
+        TEST_ASSERT_TRUE(ret);
+        TEST_ASSERT_EQUAL_INT(0, test_osfw_execs());
+
+        osfw_fini();
+        test_osfw_execs();
+        osfw_init();
+        test_osfw_execs();
+        ret = osfw_chain_add(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN);
+        TEST_ASSERT_TRUE(ret);
+    }
+}
+
+
+/**
+ * @brief the rules rejected by the test run are reported from the
+ *        failing line and the others are applied
+ */
+static void
+test_osfw_apply_invalid_rules(bool legacy)
+{
+    FILE *stream;
+    bool ret;
+
+    if (legacy)
+    {
+        stream = fopen(TEST_OSFW_LEGACY, "w");
+        TEST_ASSERT_NOT_NULL(stream);
+        fclose(stream);
+    }
+
+    test_osfw_add_rules(100);
+    ret = osfw_rule_add(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN, 10, "-p tcp", TEST_OSFW_INVALID);
+    TEST_ASSERT_TRUE(ret);
+    ret = osfw_rule_add(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN, 50, "-p udp", TEST_OSFW_INVALID);
+    TEST_ASSERT_TRUE(ret);
+
+    /* One test run per rejected rule, a last one and the restore */
+    ret = osfw_apply();
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_INT(4, test_osfw_execs());
+    TEST_ASSERT_EQUAL_INT(2, g_errors.count);
+    TEST_ASSERT_EQUAL_INT(10, g_errors.prio[0]);
+    TEST_ASSERT_EQUAL_INT(50, g_errors.prio[1]);
+
+    /* Rejected rules are still known and can be deleted */
+    ret = osfw_rule_del(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN, 10, "-p tcp", TEST_OSFW_INVALID);
+    TEST_ASSERT_TRUE(ret);
+    ret = osfw_rule_del(AF_INET, OSFW_TABLE_FILTER, TEST_OSFW_CHAIN, 50, "-p udp", TEST_OSFW_INVALID);
+    TEST_ASSERT_TRUE(ret);
+
+    ret = osfw_apply();
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_INT(2, test_osfw_execs());
+    TEST_ASSERT_EQUAL_INT(2, g_errors.count);
+}
+
+
+void
+test_osfw_apply_invalid(void)
+{
+    test_osfw_apply_invalid_rules(false);
+}
+
+
+void
+test_osfw_apply_invalid_legacy(void)
+{
+    test_osfw_apply_invalid_rules(true);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_osfw_apply_execs);
+    RUN_TEST(test_osfw_apply_invalid);
+    RUN_TEST(test_osfw_apply_invalid_legacy);
+
+    return UNITY_END();
+}
@@ -411,6 +411,41 @@ bool ovsdb_delete_with_parent_s(char * table,
                                 json_t * parent_where,
                                 char * parent_column);
 
+/*
+ * Set the idle timeout of the synchronous connection, in seconds;
+ * 0 closes the connection after each request
+ */
+void ovsdb_sync_set_idle_timeout(double timeout);
+
+/*
+ * Batch of operations sent in a single synchronous transaction
+ */
+typedef struct ovsdb_batch
+{
+    json_t     *ob_tran;        /* Transact params, NULL while empty */
+    int         ob_nops;        /* Number of operations */
+} ovsdb_batch_t;
+
+void ovsdb_batch_init(ovsdb_batch_t *batch);
+
+/*
+ * Add an operation to a batch, takes ownership of where and row. Returns
+ * the index of the operation result in the commit result, -1 on error.
+ */
+int ovsdb_batch_add(ovsdb_batch_t *batch,
+                    const char *table,
+                    ovsdb_tro_t oper,
+                    json_t *where,
+                    json_t *row);
+
+/*
+ * Send a batch in a single transaction and empty it. Returns the result
+ * array or NULL if the transport layer fails.
+ */
+json_t *ovsdb_batch_commit_s(ovsdb_batch_t *batch);
+
+void ovsdb_batch_reset(ovsdb_batch_t *batch);
+
 /**
  * The following set of functions filters all json key-value pairs
  * except those for which key names are submitted
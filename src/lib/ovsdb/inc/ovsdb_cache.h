@@ -62,6 +62,8 @@ bool ovsdb_cache_monitor_filter(ovsdb_table_t *table,
         ovsdb_cache_callback_t *callback, char **filter);
 void ovsdb_cache_dump_table(ovsdb_table_t *table, char *str);
 void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self);
+// lookups go through the uuid, key and key2 index trees of the table:
+// the key columns of a cached record must not be modified in place
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_uuid(ovsdb_table_t *table, const char *uuid);
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_key(ovsdb_table_t *table, const char *key);
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_key2(ovsdb_table_t *table, const char *key2);
@@ -41,13 +41,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "os.h"
 #include "os_socket.h"
 #include "ovsdb.h"
+#include "ovsdb_priv.h"
 #include "json_util.h"
 
 /*****************************************************************************/
 
 #define MODULE_ID LOG_MODULE_ID_OVSDB
 
-#define MAX_BUFFER_SIZE     (256*1024)
 #define CHUNK_SIZE          (8*1024)
 // typically ovs messages are below 4k, occasionally they are 6k, rarely more than 8k
 
@@ -58,9 +58,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /*global to avoid any potential issues with stack */
 struct ev_io wovsdb;
-/* Don't use this buffer unless you are cb_ovsdb_read */
-static char *ovs_buffer;
-static int ovs_buffer_size;
+/* Don't use this stream unless you are cb_ovsdb_read */
+static struct json_stream ovs_stream;
 const char *ovsdb_comment = NULL;
 
 int json_rpc_fd = -1;
@@ -86,7 +85,7 @@ static bool ovsdb_process_update(json_t *jsup);
 static bool ovsdb_rpc_callback(int id, bool is_error, json_t *jsmsg);
 
 static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int revents);
-static bool cb_ovsdb_read_json(char *buffer);
+static bool cb_ovsdb_read_json(struct json_stream *jss);
 
 /******************************************************************************
  *  PROTECTED definitions
@@ -96,10 +95,8 @@ static bool cb_ovsdb_read_json(char *buffer);
 static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int revents)
 {
     ssize_t nr = 0;
-    ssize_t used_size = ovs_buffer ? strlen(ovs_buffer) : 0;
-    ssize_t free_size = ovs_buffer_size - used_size;
-    ssize_t new_size;
-    char *new_buf;
+    size_t free_size;
+    char *buf;
 
     if (EV_ERROR & revents)
     {
@@ -107,31 +104,15 @@ static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int reven
         return;
     }
 
-    // resize buffer if neccesary
-    if (!ovs_buffer || (free_size < CHUNK_SIZE && ovs_buffer_size < MAX_BUFFER_SIZE)) {
-        new_size = ovs_buffer_size + CHUNK_SIZE;
-        new_buf = realloc(ovs_buffer, new_size);
-        if (!new_buf) {
-            LOG(ERR,"cb_ovsdb_read: realloc(%p, %d -> %d)", ovs_buffer, (int)ovs_buffer_size, (int)new_size);
-            goto error;
-        }
-        if (ovs_buffer_size > 0) {
-            // only log trace when increasing size, skip initial allocs
-            LOG(TRACE,"cb_ovsdb_read: realloc(%p, %d -> %d) = %p",
-                    ovs_buffer, (int)ovs_buffer_size, (int)new_size, new_buf);
-        }
-        ovs_buffer = new_buf;
-        ovs_buffer_size = new_size;
-        free_size = ovs_buffer_size - used_size;
-    }
-    // check if buffer full (need at least 2 bytes free: 1 is for zero termination)
-    if (free_size < 2) {
-        LOG(ERR,"cb_ovsdb_read: buffer full %d/%d", (int)free_size, (int)ovs_buffer_size);
+    // make room for the next chunk, the buffer grows with the pending message
+    buf = json_stream_reserve(&ovs_stream, CHUNK_SIZE, &free_size);
+    if (buf == NULL) {
+        LOG(ERR,"cb_ovsdb_read: no buffer space, %zu bytes pending", json_stream_used(&ovs_stream));
         goto error;
     }
 
     // Receive message from client socket
-    nr = recv(watcher->fd, ovs_buffer + used_size, free_size - 1, 0);
+    nr = recv(watcher->fd, buf, free_size, 0);
     if (nr < 0 && errno == EAGAIN)
     {
         /* Need more data */
@@ -151,32 +132,20 @@ static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int reven
         goto error;
     }
 
-    /* Pad the buffer with \0 */
-    used_size += nr;
-    ovs_buffer[used_size] = '\0';
+    json_stream_commit(&ovs_stream, nr);
 
-    if (!cb_ovsdb_read_json(ovs_buffer))
+    if (!cb_ovsdb_read_json(&ovs_stream))
     {
         LOG(WARNING, "OVSDB read: Error parsing JSON.");
         goto error;
     }
-
-    // free buffer if the contents were fully consumed
-    used_size = strlen(ovs_buffer);
-    if (used_size == 0) {
-        free(ovs_buffer);
-        ovs_buffer_size = 0;
-        ovs_buffer = NULL;
-    }
     return;
 
 error:
     /*
      * Restart the connection and clear the buffer on errors
      */
-    free(ovs_buffer);
-    ovs_buffer = NULL;
-    ovs_buffer_size = 0;
+    json_stream_reset(&ovs_stream);
 
     // peer closed, stop watching, close socket
     ev_io_stop(loop, watcher);
@@ -202,43 +171,28 @@ error:
     return;
 }
 
-static bool cb_ovsdb_read_json(char *buf)
+static bool cb_ovsdb_read_json(struct json_stream *jss)
 {
-    char *next;
     json_error_t jerror;
+    size_t len;
+    char *str;
+    int rc;
 
     json_t *js = NULL;
-    char *str = buf;
 
-    while ((next = json_split(str)) != NULL)
+    while ((rc = json_stream_next(jss, &str, &len)) > 0)
     {
-        if (next == JSON_SPLIT_ERROR)
-        {
-            LOG(ERR, "OVSDB RECV: Error parsing input string.::json=%s", buf);
-            return false;
-        }
-
+        LOG(DEBUG, "JSON RECV: %.*s\n", (int)len, str);
         /*
-         * Note that "next" points to the end of the message, which might be the beginning of the next message. Pad it with \0, but
-         * remember the character that we overwrote. We will patch it back once we're json_dumps() has finished.
+         * Convert the message to json_t in place, it is not NUL terminated
          */
-        char save = *next;
-        *next = '\0';
-
-        LOG(DEBUG, "JSON RECV: %s\n", str);
-        /*
-         * Convert string to json_t
-         */
-        js = json_loads(str, 0, &jerror);
+        js = json_loadb(str, len, 0, &jerror);
         if (js == NULL)
         {
-            LOG(ERR, "OVSB RECV: Error processing JSON message.::json=%s", str);
+            LOG(ERR, "OVSB RECV: Error processing JSON message.::json=%.*s", (int)len, str);
             return false;
         }
 
-        /* Patch it back */
-        *next = save;
-
         if (!ovsdb_process_recv(js))
         {
             char *msg;
@@ -249,13 +203,13 @@ static bool cb_ovsdb_read_json(char *buf)
         }
 
         json_decref(js);
-
-        /* Move buffer to the next one */
-        str = next;
     }
 
-    /* Shift the buffer */
-    memmove(buf, str, strlen(str) + 1);
+    if (rc < 0)
+    {
+        LOG(ERR, "OVSDB RECV: Error parsing input string.::pending=%zu", json_stream_used(jss));
+        return false;
+    }
 
     return true;
 }
@@ -490,6 +444,8 @@ bool ovsdb_init_loop(struct ev_loop *loop, const char *name)
         ev_io_init(&wovsdb, cb_ovsdb_read, json_rpc_fd, EV_READ);
         ev_io_start(loop, &wovsdb);
 
+        ovsdb_sync_set_loop(loop);
+
         success = true;
     }
     else
@@ -542,6 +498,8 @@ bool ovsdb_stop_loop(struct ev_loop *loop)
 
     close(json_rpc_fd);
 
+    ovsdb_sync_close();
+
     json_rpc_fd = -1;
 
     LOG(NOTICE, "Closing OVSDB connection.");
@@ -106,23 +106,63 @@ void ovsdb_cache_dump_table(ovsdb_table_t *table, char *str)
     }
 }
 
+// link row into the key indexes, keys point into the row record
+static void _ovsdb_cache_insert_keys(ovsdb_table_t *table, ovsdb_cache_row_t *row)
+{
+    if (table->key_offset >= 0)
+    {
+        ds_tree_insert(&table->rows_k, row, row->record + table->key_offset);
+    }
+    if (table->key2_offset >= 0)
+    {
+        ds_tree_insert(&table->rows_k2, row, row->record + table->key2_offset);
+    }
+}
+
+// unlink row from the key indexes, must be done before the key columns
+// of the record are overwritten
+static void _ovsdb_cache_remove_keys(ovsdb_table_t *table, ovsdb_cache_row_t *row)
+{
+    if (table->key_offset >= 0)
+    {
+        ds_tree_remove(&table->rows_k, row);
+    }
+    if (table->key2_offset >= 0)
+    {
+        ds_tree_remove(&table->rows_k2, row);
+    }
+}
+
+// replace the cached record, re-indexing the row if a key changed
+static void _ovsdb_cache_update_row(ovsdb_table_t *table, ovsdb_cache_row_t *row, void *record)
+{
+    char *rec = record;
+    bool rekey = false;
+
+    if (table->key_offset >= 0)
+    {
+        rekey |= strcmp(row->record + table->key_offset, rec + table->key_offset) != 0;
+    }
+    if (table->key2_offset >= 0)
+    {
+        rekey |= strcmp(row->record + table->key2_offset, rec + table->key2_offset) != 0;
+    }
+    if (rekey) _ovsdb_cache_remove_keys(table, row);
+    memcpy(row->record, record, table->schema_size);
+    if (rekey) _ovsdb_cache_insert_keys(table, row);
+}
+
 void _ovsdb_cache_insert_row(ovsdb_table_t *table, ovsdb_cache_row_t *row)
 {
     char *row_uuid = row->record + table->uuid_offset;
     char *key = "";
-    char *key2 = "";
     char msg[128];
 
     ds_tree_insert(&table->rows, row, row_uuid);
+    _ovsdb_cache_insert_keys(table, row);
     if (table->key_offset >= 0)
     {
         key = row->record + table->key_offset;
-        ds_tree_insert(&table->rows_k, row, key);
-    }
-    if (table->key2_offset >= 0)
-    {
-        key2 = row->record + table->key2_offset;
-        ds_tree_insert(&table->rows_k2, row, key2);
     }
     snprintf(msg, sizeof(msg), "insert %s key: %s", row_uuid, key);
     ovsdb_cache_dump_table(table, msg);
@@ -293,7 +333,7 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
                 // mark _changed
                 table->mark_changed(old_record, record);
             }
-            memcpy(row->record, record, sizeof(record));
+            _ovsdb_cache_update_row(table, row, record);
             break;
 
         case OVSDB_UPDATE_DEL:
@@ -305,14 +345,7 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
             }
             // remove row from the list
             ds_tree_remove(&table->rows, row);
-            if (table->key_offset >= 0)
-            {
-                ds_tree_remove(&table->rows_k, row);
-            }
-            if (table->key2_offset >= 0)
-            {
-                ds_tree_remove(&table->rows_k2, row);
-            }
+            _ovsdb_cache_remove_keys(table, row);
             // callback
             if (table->cache_callback) table->cache_callback(self, old_record, row->record, row);
             // free row
@@ -332,20 +365,17 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
 }
 
 
-ovsdb_cache_row_t* _ovsdb_cache_find_row_by_offset(ovsdb_table_t *table, int offset, const char *kname, const char *key)
+// lookup through the index tree maintained for the column at offset
+ovsdb_cache_row_t* _ovsdb_cache_find_row_by_offset(ovsdb_table_t *table, ds_tree_t *index, int offset, const char *kname, const char *key)
 {
     ovsdb_cache_row_t *row;
-    char *row_key;
     if (offset < 0) return NULL;
 
-    ds_tree_foreach(&table->rows, row)
+    row = ds_tree_find(index, (void *)key);
+    if (row)
     {
-        row_key = row->record + offset;
-        if (strcmp(row_key, key) == 0)
-        {
-            LOG(TRACE, "found table: %s %s: %s", table->table_name, kname, key);
-            return row;
-        }
+        LOG(TRACE, "found table: %s %s: %s", table->table_name, kname, key);
+        return row;
     }
     LOG(TRACE, "NOT found table: %s %s: %s", table->table_name, kname, key);
     return NULL;
@@ -353,17 +383,17 @@ ovsdb_cache_row_t* _ovsdb_cache_find_row_by_offset(ovsdb_table_t *table, int off
 
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_uuid(ovsdb_table_t *table, const char *uuid)
 {
-    return _ovsdb_cache_find_row_by_offset(table, table->uuid_offset, "uuid", uuid);
+    return _ovsdb_cache_find_row_by_offset(table, &table->rows, table->uuid_offset, "uuid", uuid);
 }
 
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_key(ovsdb_table_t *table, const char *key)
 {
-    return _ovsdb_cache_find_row_by_offset(table, table->key_offset, "key", key);
+    return _ovsdb_cache_find_row_by_offset(table, &table->rows_k, table->key_offset, "key", key);
 }
 
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_key2(ovsdb_table_t *table, const char *key2)
 {
-    return _ovsdb_cache_find_row_by_offset(table, table->key2_offset, "key2", key2);
+    return _ovsdb_cache_find_row_by_offset(table, &table->rows_k2, table->key2_offset, "key2", key2);
 }
 
 void* ovsdb_cache_find_by_uuid(ovsdb_table_t *table, const char *uuid)
@@ -469,7 +499,7 @@ int ovsdb_cache_upsert(ovsdb_table_t *table, void *record)
     if (row)
     {
         // update existing
-        memcpy(row->record, record, table->schema_size);
+        _ovsdb_cache_update_row(table, row, record);
     }
     else
     {
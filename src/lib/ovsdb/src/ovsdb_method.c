@@ -84,7 +84,8 @@ int ovsdb_jsonrpc_id_new(void)
 {
     static int jsonrpc_id = 1;  /* Start RPC sequence */
 
-    return jsonrpc_id++;
+    /* Synchronous requests may come from several threads */
+    return __atomic_fetch_add(&jsonrpc_id, 1, __ATOMIC_RELAXED);
 }
 
 /**
@@ -50,4 +50,10 @@ extern bool ovsdb_tran_comment(json_t *js_array, ovsdb_tro_t oper, json_t *where
 /* Return a transaction operation as JSON string */
 extern json_t *ovsdb_tran_operation(ovsdb_tro_t tran);
 
+/* Set the event loop running the idle timer of the synchronous connection */
+extern void ovsdb_sync_set_loop(struct ev_loop *loop);
+
+/* Close the synchronous connection */
+extern void ovsdb_sync_close(void);
+
 #endif /* OVSDB_PRIV_H_INCLUDED */
@@ -34,6 +34,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <jansson.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#include <ev.h>
 
 #include "os_socket.h"
 #include "log.h"
@@ -47,109 +51,385 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "pjs_gen_c.h"
 
 
-/* OVSDB response buffers can be HUGE */
-static char ovsdb_write_buf[256*1024];
+#define OVSDB_SYNC_CHUNK_SIZE       (8*1024)
+
+/* Seconds of inactivity after which the synchronous connection is closed */
+#define OVSDB_SYNC_IDLE_TIMEOUT     5.0
+
+/*
+ * Persistent connection of the synchronous API.
+ *
+ * The connection is opened on the first request and kept across requests,
+ * replies being matched to requests by their JSON-RPC id. When an event
+ * loop is known (see ovsdb_init_loop()), the connection is closed after
+ * ovsdb_sync_idle_timeout seconds without requests; otherwise it is kept
+ * until ovsdb_stop_loop().
+ *
+ * Requests may come from threads other than the loop's (fsm nfqueue
+ * workers), ovsdb_sync_lock serializes the request/reply exchanges. Such
+ * threads only record their activity; the idle timer is armed by the loop
+ * thread, woken up through ovsdb_sync_async when needed.
+ */
+static pthread_mutex_t ovsdb_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ovsdb_sync_fd = -1;
+static struct json_stream ovsdb_sync_stream;
+static struct ev_loop *ovsdb_sync_loop = NULL;
+static pthread_t ovsdb_sync_thread;
+static struct ev_async ovsdb_sync_async;
+static struct ev_timer ovsdb_sync_idle_timer;
+static bool ovsdb_sync_idle_armed = false;
+static ev_tstamp ovsdb_sync_last = 0.0;
+static double ovsdb_sync_idle_timeout = OVSDB_SYNC_IDLE_TIMEOUT;
+
+/**
+ * Close the synchronous connection, called with ovsdb_sync_lock held
+ */
+static void ovsdb_sync_disconnect(void)
+{
+    /* Off the loop thread, the armed timer stops itself when it fires */
+    if (ovsdb_sync_idle_armed && pthread_equal(pthread_self(), ovsdb_sync_thread))
+    {
+        ev_timer_stop(ovsdb_sync_loop, &ovsdb_sync_idle_timer);
+        ovsdb_sync_idle_armed = false;
+    }
+
+    if (ovsdb_sync_fd >= 0)
+    {
+        LOGD("SYNC: Closing connection to OVSDB.");
+        close(ovsdb_sync_fd);
+        ovsdb_sync_fd = -1;
+    }
+
+    json_stream_reset(&ovsdb_sync_stream);
+}
+
+/**
+ * Close the synchronous connection
+ */
+void ovsdb_sync_close(void)
+{
+    pthread_mutex_lock(&ovsdb_sync_lock);
+    ovsdb_sync_disconnect();
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+}
+
+/**
+ * Arm the idle timer for the remainder of the timeout, called on the loop
+ * thread with ovsdb_sync_lock held
+ */
+static void ovsdb_sync_idle_arm(void)
+{
+    ev_tstamp remaining;
+
+    remaining = ovsdb_sync_last + ovsdb_sync_idle_timeout - ev_now(ovsdb_sync_loop);
+    if (ovsdb_sync_fd < 0 || remaining <= 0.0)
+    {
+        ovsdb_sync_disconnect();
+        return;
+    }
+
+    ovsdb_sync_idle_timer.repeat = remaining;
+    ev_timer_again(ovsdb_sync_loop, &ovsdb_sync_idle_timer);
+    ovsdb_sync_idle_armed = true;
+}
+
+static void ovsdb_sync_idle_cb(struct ev_loop *loop, struct ev_timer *w, int revents)
+{
+    (void)loop;
+    (void)w;
+    (void)revents;
+
+    /* Requests since the timer was armed push the deadline further */
+    pthread_mutex_lock(&ovsdb_sync_lock);
+    ovsdb_sync_idle_arm();
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+}
+
+static void ovsdb_sync_async_cb(struct ev_loop *loop, struct ev_async *w, int revents)
+{
+    (void)loop;
+    (void)w;
+    (void)revents;
+
+    pthread_mutex_lock(&ovsdb_sync_lock);
+    if (!ovsdb_sync_idle_armed && ovsdb_sync_fd >= 0) ovsdb_sync_idle_arm();
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+}
 
 /**
- * Callback for json_dump_callback() -- called from ovsb_write_s()
+ * Set the event loop running the idle timer of the synchronous connection
  *
- * Per Jansson documentation, this function shall return -1 on error or 0 on
- * success
+ * Must be called from the thread running the loop.
  */
-int ovsdb_sync_write_fn(const char *buf, size_t sz, void *self)
+void ovsdb_sync_set_loop(struct ev_loop *loop)
 {
-    int     ovs_fd = (long)self;
-    ssize_t rc;
+    pthread_mutex_lock(&ovsdb_sync_lock);
+
+    if (ovsdb_sync_loop != NULL)
+    {
+        if (ovsdb_sync_idle_armed) ev_timer_stop(ovsdb_sync_loop, &ovsdb_sync_idle_timer);
+        ovsdb_sync_idle_armed = false;
 
-    rc = write(ovs_fd, buf, sz);
-    if (rc <= 0)
+        ev_ref(ovsdb_sync_loop);
+        ev_async_stop(ovsdb_sync_loop, &ovsdb_sync_async);
+    }
+
+    ovsdb_sync_loop = loop;
+    ovsdb_sync_thread = pthread_self();
+    ev_timer_init(&ovsdb_sync_idle_timer, ovsdb_sync_idle_cb, 0.0, ovsdb_sync_idle_timeout);
+    ev_async_init(&ovsdb_sync_async, ovsdb_sync_async_cb);
+
+    if (loop != NULL)
     {
-        LOGE("Synchronous write() to OVSDB failed: %s", strerror(errno));
-        return -1;
+        /* The wake up watcher alone does not keep the loop running */
+        ev_async_start(loop, &ovsdb_sync_async);
+        ev_unref(loop);
     }
 
-    return 0;
+    pthread_mutex_unlock(&ovsdb_sync_lock);
 }
 
 /**
- * Synchronous write to OVSDB -- similar to ovsdb_write() except it doesn't require a callback
+ * Set the idle timeout of the synchronous connection, in seconds
  *
- * This function opens a new connection to OVSDB for each request. In the future, if needed, this
- * can be changed to use a timer to close the connection after a period of inactivity.
+ * A timeout of 0 closes the connection after each request.
  */
+void ovsdb_sync_set_idle_timeout(double timeout)
+{
+    pthread_mutex_lock(&ovsdb_sync_lock);
 
-json_t *ovsdb_write_s(json_t *jsdata)
+    ovsdb_sync_idle_timeout = timeout;
+    if (timeout <= 0.0) ovsdb_sync_disconnect();
+
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+}
+
+/**
+ * Restart the idle timer after a request, called with ovsdb_sync_lock held
+ */
+static void ovsdb_sync_idle_restart(void)
 {
-    int     ovs_fd = -1;
-    json_t *retval = NULL;
+    if (ovsdb_sync_idle_timeout <= 0.0)
+    {
+        ovsdb_sync_disconnect();
+        return;
+    }
+
+    if (ovsdb_sync_loop == NULL) return;
+
+    /* An armed timer picks the new deadline up when it fires */
+    ovsdb_sync_last = ev_time();
+    if (ovsdb_sync_idle_armed) return;
 
-    /* Initiate new connection to OVSDB */
-    ovs_fd = ovsdb_conn();
-    if (ovs_fd < 0)
+    if (pthread_equal(pthread_self(), ovsdb_sync_thread))
     {
-        LOGE("SYNC: Error initiating connection to OVSDB.");
-        goto error;
+        ev_now_update(ovsdb_sync_loop);
+        ovsdb_sync_idle_arm();
     }
+    else
+    {
+        ev_async_send(ovsdb_sync_loop, &ovsdb_sync_async);
+    }
+}
 
-    LOGD("SYNC: Writing sync operation: %s", json_dumps_static(jsdata, 0));
+static bool ovsdb_sync_connect(void)
+{
+    if (ovsdb_sync_fd >= 0) return true;
 
-    if (json_dump_callback(jsdata, ovsdb_sync_write_fn, (void *)(intptr_t)ovs_fd, JSON_COMPACT) != 0)
+    ovsdb_sync_fd = ovsdb_conn();
+    if (ovsdb_sync_fd < 0)
     {
-        LOGE("SYNC: Error during sync write to OVSDB: %s", strerror(errno));
-        goto error;
+        LOGE("SYNC: Error initiating connection to OVSDB.");
+        ovsdb_sync_fd = -1;
+        return false;
     }
 
-    /* Read a response and return */
-    size_t buflen = 0;
-    ssize_t nr;
+    json_stream_reset(&ovsdb_sync_stream);
 
-    while (buflen < sizeof(ovsdb_write_buf) - 1)
+    return true;
+}
+
+/**
+ * Write buf to the synchronous connection
+ *
+ * Returns the number of bytes written, less than len on error.
+ */
+static size_t ovsdb_sync_send(const char *buf, size_t len)
+{
+    size_t sent = 0;
+    ssize_t rc;
+
+    while (sent < len)
     {
-        nr = read(ovs_fd, &ovsdb_write_buf[buflen], sizeof(ovsdb_write_buf) - 1 - buflen);
-        if (nr <= 0)
+        /* Don't get killed by SIGPIPE if the server dropped the connection */
+        rc = send(ovsdb_sync_fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0)
         {
-            /* Treat errors and short reads the same -- error while reading response. */
-            LOGE("Sync: Short read or EOF while waiting for JSON response.");
-            goto error;
+            LOGD("SYNC: send() to OVSDB failed: %s", strerror(errno));
+            break;
         }
 
-        buflen += nr;
+        sent += rc;
+    }
+
+    return sent;
+}
+
+/**
+ * Answer an echo request of the server, see RFC 7047 4.1.11
+ */
+static void ovsdb_sync_echo(json_t *jsreq)
+{
+    json_t *js;
+    char *str;
 
-        ovsdb_write_buf[buflen] = '\0';
+    js = json_object();
+    json_object_set(js, "id", json_object_get(jsreq, "id"));
+    json_object_set(js, "result", json_object_get(jsreq, "params"));
+    json_object_set_new(js, "error", json_null());
+
+    str = json_dumps(js, JSON_COMPACT);
+    if (str != NULL)
+    {
+        ovsdb_sync_send(str, strlen(str));
+        json_free(str);
+    }
+
+    json_decref(js);
+}
 
-        char *res = json_split(ovsdb_write_buf);
-        if (res == JSON_SPLIT_ERROR)
+/**
+ * Read messages from the synchronous connection until the reply carrying id
+ *
+ * Replies to other requests are dropped.
+ */
+static json_t *ovsdb_sync_recv(json_t *id)
+{
+    json_error_t err;
+    json_t *jsmsg;
+    json_t *jsid;
+    json_t *jst;
+    size_t free_size;
+    size_t len;
+    ssize_t nr;
+    char *buf;
+    int rc;
+
+    while (true)
+    {
+        while ((rc = json_stream_next(&ovsdb_sync_stream, &buf, &len)) > 0)
         {
-            LOGE("Sync: Error parsing JSON-RPC response: %s\n", ovsdb_write_buf);
-            goto error;
+            jsmsg = json_loadb(buf, len, 0, &err);
+            if (jsmsg == NULL)
+            {
+                LOGE("Sync: Error parsing OVSDB response (%s):\n%.*s", err.text, (int)len, buf);
+                return NULL;
+            }
+
+            jst = json_object_get(jsmsg, "method");
+            if (json_is_string(jst))
+            {
+                if (strcmp(json_string_value(jst), "echo") == 0)
+                {
+                    ovsdb_sync_echo(jsmsg);
+                }
+                else
+                {
+                    LOGW("Sync: Ignoring %s request.", json_string_value(jst));
+                }
+                json_decref(jsmsg);
+                continue;
+            }
+
+            jsid = json_object_get(jsmsg, "id");
+            if (id == NULL || json_equal(jsid, id)) return jsmsg;
+
+            LOGW("Sync: Dropping response to request %s.", json_dumps_static(jsid, JSON_ENCODE_ANY));
+            json_decref(jsmsg);
         }
 
-        if (res != NULL)
+        if (rc < 0)
         {
-            if (strlen(res))
-                LOGW("Sync: trailing garbage found: '%s'", res);
-            *res = 0;
-            /* Success */
-            break;
+            LOGE("Sync: Error parsing JSON-RPC response.::pending=%zu", json_stream_used(&ovsdb_sync_stream));
+            return NULL;
         }
+
+        buf = json_stream_reserve(&ovsdb_sync_stream, OVSDB_SYNC_CHUNK_SIZE, &free_size);
+        if (buf == NULL) return NULL;
+
+        nr = recv(ovsdb_sync_fd, buf, free_size, 0);
+        if (nr < 0 && errno == EINTR) continue;
+        if (nr <= 0)
+        {
+            /* Treat errors and short reads the same -- error while reading response. */
+            LOGE("Sync: Short read or EOF while waiting for JSON response.");
+            return NULL;
+        }
+
+        json_stream_commit(&ovsdb_sync_stream, nr);
     }
+}
 
-    json_error_t err;
-    retval = json_loads(ovsdb_write_buf, 0, &err);
-    if (retval == NULL)
+/**
+ * Synchronous write to OVSDB -- similar to ovsdb_write() except it doesn't require a callback
+ *
+ * Requests go through the persistent synchronous connection; the reply is
+ * the message carrying the id of jsdata.
+ */
+
+json_t *ovsdb_write_s(json_t *jsdata)
+{
+    json_t *retval = NULL;
+    bool reused;
+    size_t len;
+    char *str;
+
+    str = json_dumps(jsdata, JSON_COMPACT);
+    if (str == NULL)
     {
-        LOGE("Sync: Error parsing OVSDB response (%s):\n%s", err.text, ovsdb_write_buf);
-        goto error;
+        LOGE("SYNC: Error encoding sync operation.");
+        return NULL;
     }
+    len = strlen(str);
 
-error:
-    /* Terminate connection */
-    if (ovs_fd >= 0)
+    LOGD("SYNC: Writing sync operation: %s", str);
+
+    pthread_mutex_lock(&ovsdb_sync_lock);
+
+    reused = (ovsdb_sync_fd >= 0);
+    if (!ovsdb_sync_connect()) goto error;
+
+    if (ovsdb_sync_send(str, len) != len)
     {
-        close(ovs_fd);
+        /*
+         * The server may have dropped the idle connection. A request that
+         * did not reach it can be safely sent over a new one.
+         */
+        ovsdb_sync_disconnect();
+        if (!reused || !ovsdb_sync_connect() || ovsdb_sync_send(str, len) != len)
+        {
+            LOGE("SYNC: Error during sync write to OVSDB: %s", strerror(errno));
+            goto error;
+        }
     }
 
+    retval = ovsdb_sync_recv(json_object_get(jsdata, "id"));
+    if (retval == NULL) goto error;
+
+    ovsdb_sync_idle_restart();
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+    json_free(str);
+
     return retval;
+
+error:
+    /* The connection state is unknown, start over with the next request */
+    ovsdb_sync_disconnect();
+    pthread_mutex_unlock(&ovsdb_sync_lock);
+    json_free(str);
+
+    return NULL;
 }
 
 /**
@@ -362,3 +642,66 @@ bool ovsdb_delete_with_parent_s(char * table,
     json_decref(resp);
     return true;
 }
+
+/*
+ * Batched synchronous transactions
+ *
+ * Operations added to a batch are sent in a single transact request by
+ * ovsdb_batch_commit_s(), and applied atomically by the server.
+ */
+void ovsdb_batch_init(ovsdb_batch_t *batch)
+{
+    batch->ob_tran = NULL;
+    batch->ob_nops = 0;
+}
+
+/*
+ * Add an operation to a batch, takes ownership of where and row
+ *
+ * Returns the index of the operation result in the array returned by
+ * ovsdb_batch_commit_s(), or -1 on error.
+ */
+int ovsdb_batch_add(ovsdb_batch_t *batch,
+                    const char *table,
+                    ovsdb_tro_t oper,
+                    json_t *where,
+                    json_t *row)
+{
+    json_t *tran;
+
+    tran = ovsdb_tran_multi(batch->ob_tran, NULL, table, oper, where, row);
+    if (tran == NULL) return -1;
+
+    batch->ob_tran = tran;
+    batch->ob_nops++;
+
+    /* The first element of the params is the database name */
+    return json_array_size(tran) - 2;
+}
+
+/*
+ * Send the operations of a batch in a single transaction
+ *
+ * The batch is emptied. Returns the JSON-RPC result array, or NULL if the
+ * transport layer fails.
+ */
+json_t *ovsdb_batch_commit_s(ovsdb_batch_t *batch)
+{
+    json_t *tran;
+
+    tran = batch->ob_tran;
+    ovsdb_batch_init(batch);
+
+    if (tran == NULL) return json_array();
+
+    return ovsdb_method_send_s(MT_TRANS, tran);
+}
+
+/*
+ * Drop the operations of a batch
+ */
+void ovsdb_batch_reset(ovsdb_batch_t *batch)
+{
+    json_decref(batch->ob_tran);
+    ovsdb_batch_init(batch);
+}
@@ -43,6 +43,7 @@ UNIT_SRC += src/ovsdb_utils.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
+UNIT_EXPORT_LDFLAGS := -lpthread
 
 UNIT_DEPS := src/lib/common
 UNIT_DEPS += src/lib/ds
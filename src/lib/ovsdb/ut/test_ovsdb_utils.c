@@ -24,7 +24,28 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <jansson.h>
+#include <ev.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "json_util.h"
+#include "os_socket.h"
+#include "ovsdb.h"
+#include "ovsdb_sync.h"
 #include "ovsdb_utils.h"
+#include "ovsdb_cache.h"
+#include "ovsdb_priv.h"
+#include "util.h"
+#include "schema.h"
 #include "log.h"
 #include "target.h"
 #include "unity.h"
@@ -256,6 +277,535 @@ test_schema2itree(void)
     free_str_itree(converted);
 }
 
+#define CACHE_BENCH_ROWS 10000
+
+static ovsdb_table_t table_Wifi_Associated_Clients;
+static size_t g_cache_bench_hits;
+static uint32_t g_cache_bench_version;
+
+
+/**
+ * @brief cache callback looking up the updated row the way managers do
+ */
+static void
+callback_Wifi_Associated_Clients(ovsdb_update_monitor_t *mon,
+                                 struct schema_Wifi_Associated_Clients *old_rec,
+                                 struct schema_Wifi_Associated_Clients *client,
+                                 ovsdb_cache_row_t *row)
+{
+    if (mon->mon_type == OVSDB_UPDATE_DEL) return;
+
+    if (ovsdb_cache_find_row_by_key(&table_Wifi_Associated_Clients,
+                                    client->mac) != row) return;
+    if (ovsdb_cache_find_row_by_uuid(&table_Wifi_Associated_Clients,
+                                     client->_uuid.uuid) != row) return;
+
+    g_cache_bench_hits++;
+}
+
+
+/**
+ * @brief feeds one synthetic monitor update to the cache
+ *
+ * @return the time spent in the cache update, in nanoseconds
+ */
+static uint64_t
+test_cache_replay(ovsdb_update_monitor_t *mon, ovsdb_update_type_t type,
+                  size_t idx, const char *mac, const char *old_mac)
+{
+    struct timespec start, end;
+    char version[37];
+    char uuid[37];
+    json_t *jold;
+    json_t *jnew;
+
+    snprintf(uuid, sizeof(uuid), "00000000-0000-0000-0000-%012zx", idx);
+    snprintf(version, sizeof(version), "%08x-0000-0000-0000-%012zx",
+             g_cache_bench_version++, idx);
+
+    /* Monitor updates carry the full row, empty sets included */
+    jnew = json_pack("{s:[s,s], s:[s,s], s:s, s:s, s:[s,[]], s:[s,[]],"
+                     " s:[s,[]], s:[s,[]], s:[s,[]], s:[s,[]]}",
+                     "_uuid", "uuid", uuid,
+                     "_version", "uuid", version,
+                     "mac", mac,
+                     "state", (type == OVSDB_UPDATE_NEW) ? "idle" : "active",
+                     "capabilities", "set",
+                     "key_id", "set",
+                     "oftag", "set",
+                     "uapsd", "set",
+                     "kick", "map",
+                     "dpp_netaccesskey_sha256_hex", "set");
+    TEST_ASSERT_NOT_NULL(jnew);
+    jold = json_pack("{s:s, s:s}", "mac", old_mac, "state", "idle");
+    TEST_ASSERT_NOT_NULL(jold);
+
+    mon->mon_type = type;
+    mon->mon_uuid = uuid;
+    mon->mon_json_new = jnew;
+    mon->mon_json_old = jold;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ovsdb_cache_update_cb(mon);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    json_decref(jnew);
+    json_decref(jold);
+
+    return (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+
+/**
+ * @brief replays a synthetic monitor stream through the ovsdb cache
+ *
+ * Inserts, modifies and deletes CACHE_BENCH_ROWS rows, one in ten
+ * modifications renaming the primary key. Validates the key and uuid
+ * indexes along the way and logs the average cost of an update.
+ */
+void
+test_cache_update_benchmark(void)
+{
+    ovsdb_table_t *table = &table_Wifi_Associated_Clients;
+    ovsdb_update_monitor_t mon;
+    char old_mac[32];
+    char mac[32];
+    uint64_t new_ns;
+    uint64_t mod_ns;
+    uint64_t del_ns;
+    size_t i;
+
+    OVSDB_TABLE_INIT(Wifi_Associated_Clients, mac);
+    table->cache_callback = cache_cb_cast_Wifi_Associated_Clients(callback_Wifi_Associated_Clients);
+
+    memset(&mon, 0, sizeof(mon));
+    mon.mon_table = SCHEMA_TABLE(Wifi_Associated_Clients);
+    mon.mon_data = table;
+
+    /* Per-update logs would dominate the measure */
+    log_module_severity_set(LOG_MODULE_ID_OVSDB, LOG_SEVERITY_WARNING);
+
+    g_cache_bench_hits = 0;
+    new_ns = 0;
+    for (i = 0; i < CACHE_BENCH_ROWS; i++)
+    {
+        snprintf(mac, sizeof(mac), "00:00:00:00:%02zx:%02zx", i >> 8, i & 0xff);
+        new_ns += test_cache_replay(&mon, OVSDB_UPDATE_NEW, i, mac, "");
+    }
+    TEST_ASSERT_EQUAL_UINT(CACHE_BENCH_ROWS, g_cache_bench_hits);
+
+    g_cache_bench_hits = 0;
+    mod_ns = 0;
+    for (i = 0; i < CACHE_BENCH_ROWS; i++)
+    {
+        snprintf(old_mac, sizeof(old_mac), "00:00:00:00:%02zx:%02zx", i >> 8, i & 0xff);
+        if (i % 10) STRSCPY(mac, old_mac);
+        else snprintf(mac, sizeof(mac), "00:00:00:01:%02zx:%02zx", i >> 8, i & 0xff);
+        mod_ns += test_cache_replay(&mon, OVSDB_UPDATE_MODIFY, i, mac, old_mac);
+
+        /* A renamed row is only reachable through its new key */
+        if (strcmp(mac, old_mac)) TEST_ASSERT_NULL(ovsdb_cache_find_by_key(table, old_mac));
+    }
+    TEST_ASSERT_EQUAL_UINT(CACHE_BENCH_ROWS, g_cache_bench_hits);
+
+    del_ns = 0;
+    for (i = 0; i < CACHE_BENCH_ROWS; i++)
+    {
+        if (i % 10) snprintf(mac, sizeof(mac), "00:00:00:00:%02zx:%02zx", i >> 8, i & 0xff);
+        else snprintf(mac, sizeof(mac), "00:00:00:01:%02zx:%02zx", i >> 8, i & 0xff);
+        del_ns += test_cache_replay(&mon, OVSDB_UPDATE_DEL, i, mac, mac);
+        TEST_ASSERT_NULL(ovsdb_cache_find_by_key(table, mac));
+    }
+    TEST_ASSERT_NULL(ds_tree_head(&table->rows));
+    TEST_ASSERT_NULL(ds_tree_head(&table->rows_k));
+
+    log_module_severity_set(LOG_MODULE_ID_OVSDB, LOG_SEVERITY_INFO);
+
+    LOGI("%s: %d rows, per update: new %.2f us, modify %.2f us, delete %.2f us",
+         __func__, CACHE_BENCH_ROWS,
+         new_ns / 1000.0 / CACHE_BENCH_ROWS,
+         mod_ns / 1000.0 / CACHE_BENCH_ROWS,
+         del_ns / 1000.0 / CACHE_BENCH_ROWS);
+}
+
+
+#define SYNC_BENCH_ROWS 2000
+
+static char g_sync_sock_path[64];
+static pid_t g_sync_server_pid;
+
+
+/**
+ * @brief answers a transact request of the fake OVSDB server
+ *
+ * Each operation gets a {"count": 1, "conn": <connection number>} result.
+ * The connection is closed after replying to an operation on the
+ * "close_after" table.
+ */
+static bool
+test_sync_server_reply(int fd, json_t *req, int nconn, size_t nreq)
+{
+    json_t *params;
+    json_t *result;
+    json_t *reply;
+    json_t *op;
+    bool close_after;
+    size_t i;
+    char *str;
+    char *msg;
+
+    params = json_object_get(req, "params");
+    result = json_array();
+    close_after = false;
+    json_array_foreach(params, i, op)
+    {
+        if (i == 0) continue;
+        if (!strcmp(json_string_value(json_object_get(op, "table")) ?: "", "close_after"))
+        {
+            close_after = true;
+        }
+        json_array_append_new(result, json_pack("{s:i,s:i}", "count", 1, "conn", nconn));
+    }
+
+    str = NULL;
+    /*
+     * Exercise the id matching: the second request of a connection gets an
+     * echo request and a stale reply first
+     */
+    if (nreq == 1)
+    {
+        msg = "{\"method\":\"echo\",\"params\":[],\"id\":\"echo\"}"
+              "{\"id\":-1,\"result\":[],\"error\":null}";
+        if (write(fd, msg, strlen(msg)) < 0) return false;
+    }
+
+    reply = json_pack("{s:O,s:o,s:n}", "id", json_object_get(req, "id"), "result", result, "error");
+    str = json_dumps(reply, JSON_COMPACT);
+    json_decref(reply);
+    if (write(fd, str, strlen(str)) < 0) close_after = true;
+    free(str);
+
+    return !close_after;
+}
+
+
+/**
+ * @brief fake OVSDB server, serves one connection at a time
+ */
+static void
+test_sync_server(int lfd)
+{
+    struct json_stream jss;
+    json_error_t err;
+    size_t free_size;
+    size_t nreq;
+    size_t len;
+    json_t *req;
+    bool open;
+    int nconn;
+    char *buf;
+    ssize_t nr;
+    int fd;
+
+    nconn = 0;
+    while ((fd = accept(lfd, NULL, NULL)) >= 0)
+    {
+        nconn++;
+        nreq = 0;
+        json_stream_init(&jss);
+        open = true;
+        while (open)
+        {
+            buf = json_stream_reserve(&jss, 8192, &free_size);
+            nr = read(fd, buf, free_size);
+            if (nr <= 0) break;
+            json_stream_commit(&jss, nr);
+
+            while (open && json_stream_next(&jss, &buf, &len) > 0)
+            {
+                req = json_loadb(buf, len, 0, &err);
+                if (req == NULL) _exit(1);
+
+                /* Skip echo replies */
+                if (json_object_get(req, "method") != NULL)
+                {
+                    open = test_sync_server_reply(fd, req, nconn, nreq++);
+                }
+                json_decref(req);
+            }
+        }
+        json_stream_reset(&jss);
+        close(fd);
+    }
+
+    _exit(0);
+}
+
+
+static void
+test_sync_server_start(void)
+{
+    struct sockaddr_un addr;
+    int lfd;
+
+    snprintf(g_sync_sock_path, sizeof(g_sync_sock_path), "/tmp/test_ovsdb_sync.%d", (int)getpid());
+    unlink(g_sync_sock_path);
+
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(lfd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    STRSCPY(addr.sun_path, g_sync_sock_path);
+    TEST_ASSERT_EQUAL_INT(0, bind(lfd, (struct sockaddr *)&addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL_INT(0, listen(lfd, 4));
+
+    g_sync_server_pid = fork();
+    TEST_ASSERT_TRUE(g_sync_server_pid >= 0);
+    if (g_sync_server_pid == 0) test_sync_server(lfd);
+
+    close(lfd);
+    setenv(ENV_OVSDB_SOCK_PATH, g_sync_sock_path, 1);
+}
+
+
+static void
+test_sync_server_stop(void)
+{
+    /* Close the synchronous connection */
+    ovsdb_sync_set_idle_timeout(0);
+    ovsdb_sync_set_idle_timeout(5.0);
+
+    kill(g_sync_server_pid, SIGTERM);
+    waitpid(g_sync_server_pid, NULL, 0);
+    unlink(g_sync_sock_path);
+    unsetenv(ENV_OVSDB_SOCK_PATH);
+}
+
+
+/**
+ * @brief returns the connection number a single operation went through
+ */
+static int
+test_sync_update(const char *table)
+{
+    json_t *result;
+    int conn;
+
+    result = ovsdb_tran_call_s(table, OTR_UPDATE,
+                               ovsdb_where_simple("name", "row"),
+                               json_pack("{s:s}", "value", "x"));
+    if (result == NULL) return -1;
+
+    TEST_ASSERT_EQUAL_INT(1, json_integer_value(json_object_get(json_array_get(result, 0), "count")));
+    conn = json_integer_value(json_object_get(json_array_get(result, 0), "conn"));
+    json_decref(result);
+
+    return conn;
+}
+
+
+/**
+ * @brief validates the persistent synchronous connection
+ */
+void
+test_sync_persistent(void)
+{
+    int i;
+
+    test_sync_server_start();
+
+    /* Requests share a connection, the echo and the stale reply are skipped */
+    for (i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(1, test_sync_update("Test_Table"));
+    }
+
+    /* A connection dropped by the server is replaced */
+    TEST_ASSERT_EQUAL_INT(1, test_sync_update("close_after"));
+    usleep(100000);
+    TEST_ASSERT_EQUAL_INT(2, test_sync_update("Test_Table"));
+
+    /* No idle timeout: one connection per request */
+    ovsdb_sync_set_idle_timeout(0);
+    TEST_ASSERT_EQUAL_INT(3, test_sync_update("Test_Table"));
+    TEST_ASSERT_EQUAL_INT(4, test_sync_update("Test_Table"));
+
+    test_sync_server_stop();
+}
+
+
+/**
+ * @brief validates a batch is sent in a single transaction
+ */
+void
+test_sync_batch(void)
+{
+    ovsdb_batch_t batch;
+    json_t *result;
+    int idx;
+    int i;
+
+    test_sync_server_start();
+
+    ovsdb_batch_init(&batch);
+    for (i = 0; i < 3; i++)
+    {
+        idx = ovsdb_batch_add(&batch, "Test_Table", OTR_UPDATE,
+                              ovsdb_where_simple("name", "row"),
+                              json_pack("{s:i}", "value", i));
+        TEST_ASSERT_EQUAL_INT(i, idx);
+    }
+    TEST_ASSERT_EQUAL_INT(3, batch.ob_nops);
+
+    result = ovsdb_batch_commit_s(&batch);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_UINT(3, json_array_size(result));
+    TEST_ASSERT_EQUAL_INT(0, batch.ob_nops);
+    json_decref(result);
+
+    /* An empty batch does not reach the server */
+    result = ovsdb_batch_commit_s(&batch);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_UINT(0, json_array_size(result));
+    json_decref(result);
+
+    /* The batch went through the connection of the first request */
+    TEST_ASSERT_EQUAL_INT(1, test_sync_update("Test_Table"));
+
+    ovsdb_batch_add(&batch, "Test_Table", OTR_DELETE, NULL, NULL);
+    ovsdb_batch_reset(&batch);
+    TEST_ASSERT_NULL(batch.ob_tran);
+
+    test_sync_server_stop();
+}
+
+
+#define SYNC_THREADS 4
+#define SYNC_THREAD_ROWS 200
+
+/**
+ * @brief issues requests over the shared synchronous connection
+ */
+static void *
+test_sync_thread(void *arg)
+{
+    int *failed = arg;
+    int i;
+
+    for (i = 0; i < SYNC_THREAD_ROWS; i++)
+    {
+        if (test_sync_update("Test_Table") != 1) (*failed)++;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief validates requests from several threads share the connection
+ *
+ * Replies are matched to their own request, and the idle timer armed on
+ * behalf of the threads closes the connection from the loop.
+ */
+void
+test_sync_threads(void)
+{
+    pthread_t threads[SYNC_THREADS];
+    int failed[SYNC_THREADS];
+    struct ev_loop *loop;
+    int i;
+
+    loop = ev_loop_new(EVFLAG_AUTO);
+    TEST_ASSERT_NOT_NULL(loop);
+
+    test_sync_server_start();
+    ovsdb_sync_set_loop(loop);
+    ovsdb_sync_set_idle_timeout(0.1);
+
+    for (i = 0; i < SYNC_THREADS; i++)
+    {
+        failed[i] = 0;
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, test_sync_thread, &failed[i]));
+    }
+
+    for (i = 0; i < SYNC_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_INT(0, failed[i]);
+    }
+
+    /* The loop runs until the idle timer closed the connection */
+    ev_run(loop, 0);
+    TEST_ASSERT_EQUAL_INT(2, test_sync_update("Test_Table"));
+
+    ovsdb_sync_set_loop(NULL);
+    ev_loop_destroy(loop);
+    test_sync_server_stop();
+}
+
+
+static double
+test_sync_rate(struct timespec *start, int rows)
+{
+    struct timespec end;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+
+    return rows / elapsed;
+}
+
+
+/**
+ * @brief compares row updates rates of the synchronous access modes
+ */
+void
+test_sync_benchmark(void)
+{
+    struct timespec start;
+    ovsdb_batch_t batch;
+    double per_call;
+    double persist;
+    double batched;
+    json_t *result;
+    int i;
+
+    test_sync_server_start();
+
+    /* Former behavior, a connection per request */
+    ovsdb_sync_set_idle_timeout(0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < SYNC_BENCH_ROWS; i++) TEST_ASSERT_TRUE(test_sync_update("Test_Table") > 0);
+    per_call = test_sync_rate(&start, SYNC_BENCH_ROWS);
+
+    ovsdb_sync_set_idle_timeout(5.0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < SYNC_BENCH_ROWS; i++) TEST_ASSERT_TRUE(test_sync_update("Test_Table") > 0);
+    persist = test_sync_rate(&start, SYNC_BENCH_ROWS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ovsdb_batch_init(&batch);
+    for (i = 0; i < SYNC_BENCH_ROWS; i++)
+    {
+        ovsdb_batch_add(&batch, "Test_Table", OTR_UPDATE,
+                        ovsdb_where_simple("name", "row"),
+                        json_pack("{s:i}", "value", i));
+    }
+    result = ovsdb_batch_commit_s(&batch);
+    batched = test_sync_rate(&start, SYNC_BENCH_ROWS);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_UINT(SYNC_BENCH_ROWS, json_array_size(result));
+    json_decref(result);
+
+    LOGI("%s: %d rows, row updates/s: connection per call %.0f, persistent %.0f, batched %.0f",
+         __func__, SYNC_BENCH_ROWS, per_call, persist, batched);
+
+    test_sync_server_stop();
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -270,6 +820,11 @@ int main(int argc, char *argv[])
     RUN_TEST(test_schema2tree);
     RUN_TEST(test_schema2int_set);
     RUN_TEST(test_schema2itree);
+    RUN_TEST(test_cache_update_benchmark);
+    RUN_TEST(test_sync_persistent);
+    RUN_TEST(test_sync_batch);
+    RUN_TEST(test_sync_threads);
+    RUN_TEST(test_sync_benchmark);
 
     return UNITY_END();
 }
@@ -27,6 +27,9 @@ UNIT_NAME := test_ovsdb_utils
 UNIT_TYPE := TEST_BIN
 
 UNIT_SRC := test_ovsdb_utils.c
+
+UNIT_CFLAGS := -I$(UNIT_PATH)/../src
+
 UNIT_DEPS := src/lib/common
 UNIT_DEPS += src/lib/log
 UNIT_DEPS += src/lib/osa
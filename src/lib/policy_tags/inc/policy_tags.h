@@ -37,6 +37,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "schema.h"
 #include "log.h"
 #include "ds_tree.h"
+#include "ds_dlist.h"
+#include "os_types.h"
 
 
 
@@ -151,6 +153,7 @@ extern om_tag_t *
                 om_tag_alloc(const char *name, bool group);
 extern om_tag_t *
                 om_tag_find_by_name(const char *name, bool group);
+extern uint32_t om_tag_generation(void);
 
 
 struct tag_mgr {
@@ -184,6 +187,49 @@ extern om_tag_group_t *
                 om_tag_group_find_by_name(char *name);
 
 
+/******************************************************************************
+ * MAC Set Definitions
+ *****************************************************************************/
+
+/*
+ * A mac set is the binary, hashed representation of a list of values
+ * made of mac addresses and opensync tags or group tags. Membership checks
+ * against such a list need neither string formatting nor tag lookups.
+ * The sets are registered with the tags library and are kept in sync when
+ * the referenced tags are added, removed or updated.
+ */
+typedef struct om_mac_set_entry {
+    os_macaddr_t    mac;
+    uint32_t        refcnt;     // Number of values contributing this mac
+    struct om_mac_set_entry *next;
+} om_mac_set_entry_t;
+
+typedef struct {
+    char            *name;      // Tag name, markers removed
+    bool            group;      // Group tag
+    int             match_flags;// Tag value flags to match, 0 for any
+} om_mac_set_ref_t;
+
+typedef struct om_mac_set {
+    om_mac_set_entry_t  **buckets;
+    size_t          nbuckets;   // Always a power of 2
+    size_t          nelems;
+
+    om_mac_set_ref_t    *refs;  // Tags referenced by the set
+    size_t          nrefs;
+
+    ds_dlist_node_t dst_node;
+} om_mac_set_t;
+
+extern om_mac_set_t *
+                om_mac_set_alloc(char **values, size_t nvalues);
+extern void     om_mac_set_free(om_mac_set_t *set);
+extern bool     om_mac_set_in(om_mac_set_t *set, os_macaddr_t *mac);
+extern void     om_mac_sets_tag_add(om_tag_t *tag);
+extern void     om_mac_sets_tag_remove(om_tag_t *tag);
+extern void     om_mac_sets_tag_update(om_tag_t *tag, om_tag_list_diff_t *diff);
+
+
 /******************************************************************************
  * Utilities Definitions
  *****************************************************************************/
@@ -0,0 +1,527 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "policy_tags.h"
+
+#define OM_MAC_SET_MIN_BUCKETS 16
+#define OM_MAC_STR_LEN 17
+
+static ds_dlist_t om_mac_sets = DS_DLIST_INIT(om_mac_set_t, dst_node);
+
+
+/**
+ * @brief hashes a mac address (FNV-1a)
+ */
+static inline uint32_t
+om_mac_set_hash(os_macaddr_t *mac)
+{
+    uint32_t hash;
+    size_t i;
+
+    hash = 2166136261u;
+    for (i = 0; i < sizeof(mac->addr); i++)
+    {
+        hash ^= mac->addr[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief converts the string representation of a mac address
+ *
+ * The tags library and its users compare mac addresses as lower case
+ * strings. Only strings which would compare equal to the lower case
+ * representation of the mac are converted.
+ *
+ * @param value the string to convert
+ * @param mac the converted mac
+ * @param exact true if the string must not have trailing characters
+ * @return true if the string was converted, false otherwise
+ */
+static bool
+om_mac_set_str2mac(char *value, os_macaddr_t *mac, bool exact)
+{
+    char mac_s[32];
+    int ret;
+
+    if (value == NULL) return false;
+
+    ret = sscanf(value, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx",
+                 &mac->addr[0], &mac->addr[1], &mac->addr[2],
+                 &mac->addr[3], &mac->addr[4], &mac->addr[5]);
+    if (ret != 6) return false;
+
+    snprintf(mac_s, sizeof(mac_s), PRI_os_macaddr_lower_t,
+             FMT_os_macaddr_pt(mac));
+
+    if (exact) return (strcmp(mac_s, value) == 0);
+
+    return (strncmp(mac_s, value, OM_MAC_STR_LEN) == 0);
+}
+
+
+static om_mac_set_entry_t *
+om_mac_set_find(om_mac_set_t *set, os_macaddr_t *mac)
+{
+    om_mac_set_entry_t *e;
+    size_t idx;
+
+    idx = om_mac_set_hash(mac) & (set->nbuckets - 1);
+    for (e = set->buckets[idx]; e != NULL; e = e->next)
+    {
+        if (!memcmp(&e->mac, mac, sizeof(*mac))) return e;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief doubles the number of buckets of a set
+ */
+static bool
+om_mac_set_grow(om_mac_set_t *set)
+{
+    om_mac_set_entry_t **buckets;
+    om_mac_set_entry_t *next;
+    om_mac_set_entry_t *e;
+    size_t nbuckets;
+    size_t idx;
+    size_t i;
+
+    nbuckets = set->nbuckets * 2;
+    buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL) return false;
+
+    for (i = 0; i < set->nbuckets; i++)
+    {
+        for (e = set->buckets[i]; e != NULL; e = next)
+        {
+            next = e->next;
+            idx = om_mac_set_hash(&e->mac) & (nbuckets - 1);
+            e->next = buckets[idx];
+            buckets[idx] = e;
+        }
+    }
+
+    free(set->buckets);
+    set->buckets = buckets;
+    set->nbuckets = nbuckets;
+
+    return true;
+}
+
+
+/**
+ * @brief adds a reference to a mac in the set
+ */
+static bool
+om_mac_set_get(om_mac_set_t *set, os_macaddr_t *mac)
+{
+    om_mac_set_entry_t *e;
+    size_t idx;
+
+    e = om_mac_set_find(set, mac);
+    if (e != NULL)
+    {
+        e->refcnt++;
+        return true;
+    }
+
+    /* Growing is best effort, the set remains usable if it fails */
+    if (set->nelems >= set->nbuckets) om_mac_set_grow(set);
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL) return false;
+
+    e->mac = *mac;
+    e->refcnt = 1;
+    idx = om_mac_set_hash(mac) & (set->nbuckets - 1);
+    e->next = set->buckets[idx];
+    set->buckets[idx] = e;
+    set->nelems++;
+
+    return true;
+}
+
+
+/**
+ * @brief drops a reference to a mac in the set
+ */
+static void
+om_mac_set_put(om_mac_set_t *set, os_macaddr_t *mac)
+{
+    om_mac_set_entry_t **prev;
+    om_mac_set_entry_t *e;
+    size_t idx;
+
+    idx = om_mac_set_hash(mac) & (set->nbuckets - 1);
+    for (prev = &set->buckets[idx]; *prev != NULL; prev = &(*prev)->next)
+    {
+        e = *prev;
+        if (memcmp(&e->mac, mac, sizeof(*mac))) continue;
+
+        e->refcnt--;
+        if (e->refcnt != 0) return;
+
+        *prev = e->next;
+        free(e);
+        set->nelems--;
+        return;
+    }
+}
+
+
+/**
+ * @brief checks if a tag value contributes to the set through a reference
+ */
+static bool
+om_mac_set_ref_match(om_mac_set_ref_t *ref, int flags)
+{
+    if (ref->match_flags == 0) return true;
+
+    return ((flags & ref->match_flags) != 0);
+}
+
+
+/**
+ * @brief adds or removes the macs of a tag values list
+ *
+ * @param set the mac set
+ * @param ref the set's reference to the tag
+ * @param values the tag values
+ * @param add true to add the values, false to remove them
+ */
+static void
+om_mac_set_apply_values(om_mac_set_t *set, om_mac_set_ref_t *ref,
+                        ds_tree_t *values, bool add)
+{
+    om_tag_list_entry_t *tle;
+    os_macaddr_t mac;
+    bool rc;
+
+    if (values == NULL) return;
+
+    ds_tree_foreach(values, tle)
+    {
+        if (!om_mac_set_ref_match(ref, tle->flags)) continue;
+
+        rc = om_mac_set_str2mac(tle->value, &mac, true);
+        if (!rc) continue;
+
+        if (!add)
+        {
+            om_mac_set_put(set, &mac);
+            continue;
+        }
+
+        rc = om_mac_set_get(set, &mac);
+        if (!rc) LOGE("%s: failed to add %s", __func__, tle->value);
+    }
+}
+
+
+/**
+ * @brief initializes a set reference from a tag string
+ *
+ * @param ref the reference to initialize
+ * @param value the tag string, i.e. ${tag}, ${@tag}, $[group]
+ * @return true if the reference was initialized, false otherwise
+ */
+static bool
+om_mac_set_ref_init(om_mac_set_ref_t *ref, char *value, int tag_type)
+{
+    char name[256];
+    char *tag_s;
+
+    ref->match_flags = 0;
+    tag_s = value + 2;
+    if (*tag_s == TEMPLATE_DEVICE_CHAR)
+    {
+        ref->match_flags = OM_TLE_FLAG_DEVICE;
+        tag_s += 1;
+    }
+    else if (*tag_s == TEMPLATE_CLOUD_CHAR)
+    {
+        ref->match_flags = OM_TLE_FLAG_CLOUD;
+        tag_s += 1;
+    }
+    else if (*tag_s == TEMPLATE_LOCAL_CHAR)
+    {
+        ref->match_flags = OM_TLE_FLAG_LOCAL;
+        tag_s += 1;
+    }
+
+    /* Copy tag name, remove end marker */
+    STRSCPY_LEN(name, tag_s, -1);
+
+    ref->name = strdup(name);
+    if (ref->name == NULL) return false;
+
+    ref->group = (tag_type == OPENSYNC_GROUP_TAG);
+
+    return true;
+}
+
+
+/**
+ * @brief allocates a mac set from a list of values
+ *
+ * A value is either the string representation of a mac address or an
+ * opensync tag or group tag. The set is registered for tag updates
+ * until freed.
+ *
+ * @param values the array of values
+ * @param nvalues the number of values
+ * @return the mac set if successful, NULL otherwise
+ */
+om_mac_set_t *
+om_mac_set_alloc(char **values, size_t nvalues)
+{
+    om_mac_set_ref_t *ref;
+    os_macaddr_t mac;
+    om_mac_set_t *set;
+    int tag_type;
+    om_tag_t *tag;
+    size_t i;
+    bool rc;
+
+    set = calloc(1, sizeof(*set));
+    if (set == NULL) return NULL;
+
+    set->nbuckets = OM_MAC_SET_MIN_BUCKETS;
+    set->buckets = calloc(set->nbuckets, sizeof(*set->buckets));
+    if (set->buckets == NULL) goto err_free_set;
+
+    if (nvalues != 0)
+    {
+        set->refs = calloc(nvalues, sizeof(*set->refs));
+        if (set->refs == NULL) goto err_free_set;
+    }
+
+    for (i = 0; i < nvalues; i++)
+    {
+        tag_type = om_tag_get_type(values[i]);
+        if (tag_type == NOT_A_OPENSYNC_TAG)
+        {
+            rc = om_mac_set_str2mac(values[i], &mac, false);
+            if (!rc) continue;
+
+            rc = om_mac_set_get(set, &mac);
+            if (!rc) goto err_free_set;
+
+            continue;
+        }
+
+        ref = &set->refs[set->nrefs];
+        rc = om_mac_set_ref_init(ref, values[i], tag_type);
+        if (!rc) goto err_free_set;
+        set->nrefs++;
+
+        tag = om_tag_find_by_name(ref->name, ref->group);
+        if (tag == NULL) continue;
+
+        om_mac_set_apply_values(set, ref, &tag->values, true);
+    }
+
+    ds_dlist_insert_tail(&om_mac_sets, set);
+
+    return set;
+
+err_free_set:
+    LOGE("%s: failed to allocate mac set", __func__);
+    om_mac_set_free(set);
+
+    return NULL;
+}
+
+
+/**
+ * @brief frees a mac set and unregisters it from tag updates
+ *
+ * @param set the set to free
+ */
+void
+om_mac_set_free(om_mac_set_t *set)
+{
+    om_mac_set_entry_t *next;
+    om_mac_set_entry_t *e;
+    om_mac_set_t *s;
+    size_t i;
+
+    if (set == NULL) return;
+
+    ds_dlist_foreach(&om_mac_sets, s)
+    {
+        if (s != set) continue;
+
+        ds_dlist_remove(&om_mac_sets, set);
+        break;
+    }
+
+    if (set->buckets != NULL)
+    {
+        for (i = 0; i < set->nbuckets; i++)
+        {
+            for (e = set->buckets[i]; e != NULL; e = next)
+            {
+                next = e->next;
+                free(e);
+            }
+        }
+    }
+    free(set->buckets);
+
+    for (i = 0; i < set->nrefs; i++) free(set->refs[i].name);
+    free(set->refs);
+    free(set);
+}
+
+
+/**
+ * @brief checks if a mac address is in a set
+ *
+ * @param set the mac set
+ * @param mac the mac address to check
+ * @return true if the mac is in the set, false otherwise
+ */
+bool
+om_mac_set_in(om_mac_set_t *set, os_macaddr_t *mac)
+{
+    if (set == NULL) return false;
+    if (mac == NULL) return false;
+    if (set->nelems == 0) return false;
+
+    return (om_mac_set_find(set, mac) != NULL);
+}
+
+
+/**
+ * @brief walks the set references to a tag
+ *
+ * @param tag the tag
+ * @param removed values to remove from the sets
+ * @param added values to add to the sets
+ */
+static void
+om_mac_sets_apply(om_tag_t *tag, ds_tree_t *removed, ds_tree_t *added)
+{
+    om_mac_set_ref_t *ref;
+    om_mac_set_t *set;
+    size_t i;
+
+    ds_dlist_foreach(&om_mac_sets, set)
+    {
+        for (i = 0; i < set->nrefs; i++)
+        {
+            ref = &set->refs[i];
+            if (ref->group != tag->group) continue;
+            if (strcmp(ref->name, tag->name)) continue;
+
+            om_mac_set_apply_values(set, ref, removed, false);
+            om_mac_set_apply_values(set, ref, added, true);
+        }
+    }
+}
+
+
+/**
+ * @brief updates the mac sets referencing a tag being added
+ */
+void
+om_mac_sets_tag_add(om_tag_t *tag)
+{
+    om_mac_sets_apply(tag, NULL, &tag->values);
+}
+
+
+/**
+ * @brief updates the mac sets referencing a tag being removed
+ */
+void
+om_mac_sets_tag_remove(om_tag_t *tag)
+{
+    om_mac_sets_apply(tag, &tag->values, NULL);
+}
+
+
+/**
+ * @brief updates the mac sets referencing a tag being updated
+ *
+ * Must be called before the diff is applied to the tag: values with updated
+ * flags are looked up in the tag to retrieve their previous flags.
+ *
+ * @param tag the tag being updated
+ * @param diff the tag values diff
+ */
+void
+om_mac_sets_tag_update(om_tag_t *tag, om_tag_list_diff_t *diff)
+{
+    om_tag_list_entry_t *otle;
+    om_tag_list_entry_t *tle;
+    om_mac_set_ref_t *ref;
+    om_mac_set_t *set;
+    os_macaddr_t mac;
+    bool was_in;
+    bool is_in;
+    size_t i;
+
+    om_mac_sets_apply(tag, &diff->removed, &diff->added);
+
+    ds_tree_foreach(&diff->updated, tle)
+    {
+        if (!om_mac_set_str2mac(tle->value, &mac, true)) continue;
+
+        otle = om_tag_list_entry_find_by_value(&tag->values, tle->value);
+        if (otle == NULL) continue;
+
+        ds_dlist_foreach(&om_mac_sets, set)
+        {
+            for (i = 0; i < set->nrefs; i++)
+            {
+                ref = &set->refs[i];
+                if (ref->group != tag->group) continue;
+                if (strcmp(ref->name, tag->name)) continue;
+
+                was_in = om_mac_set_ref_match(ref, otle->flags);
+                is_in = om_mac_set_ref_match(ref, tle->flags);
+                if (was_in == is_in) continue;
+
+                if (is_in) om_mac_set_get(set, &mac);
+                else om_mac_set_put(set, &mac);
+            }
+        }
+    }
+}
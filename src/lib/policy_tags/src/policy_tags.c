@@ -61,6 +61,9 @@ static ds_tree_t            om_tags = DS_TREE_INIT((ds_key_cmp_t *)strcmp,
 static struct tag_mgr my_mgr_s = { 0 };
 static struct tag_mgr *my_mgr = &my_mgr_s;
 
+// Bumped on every change to the tags tree or to a tag's values
+static uint32_t             om_tags_generation = 0;
+
 /******************************************************************************
  * Local Functions
  *****************************************************************************/
@@ -254,6 +257,13 @@ om_tag_find_by_name(const char *name, bool group)
     return NULL;
 }
 
+// Return the tags generation, changed whenever a tag or its values change
+uint32_t
+om_tag_generation(void)
+{
+    return om_tags_generation;
+}
+
 // Add a tag to the global tree
 bool
 om_tag_add(om_tag_t *tag)
@@ -267,6 +277,8 @@ om_tag_add(om_tag_t *tag)
     }
 
     ds_tree_insert(&om_tags, tag, tag->name);
+    om_tags_generation++;
+    om_mac_sets_tag_add(tag);
 
     om_tag_list_to_buf(&tag->values, 0, dbuf, sizeof(dbuf)-1);
     LOGN("[%s] %sTag added, values:%s",
@@ -289,6 +301,8 @@ om_tag_remove(om_tag_t *tag)
     char                dbuf[2048];
 
     ds_tree_remove(&om_tags, tag);
+    om_tags_generation++;
+    om_mac_sets_tag_remove(tag);
 
     om_tag_list_to_buf(&tag->values, 0, dbuf, sizeof(dbuf)-1);
     LOGN("[%s] %sTag removed, values:%s",
@@ -334,6 +348,9 @@ om_tag_update(om_tag_t *tag, ds_tree_t *new_values)
         my_mgr->service_tag_update(tag, &diff.removed, &diff.added, &diff.updated);
     }
 
+    // Sync mac sets while the tag still holds its previous values
+    om_mac_sets_tag_update(tag, &diff);
+
     // Apply the diff to our tag's list
     if (!om_tag_list_apply_diff(&tag->values, &diff)) {
         LOGE("[%s] Failed to allocate memory to apply diff for update", tag->name);
@@ -341,6 +358,7 @@ om_tag_update(om_tag_t *tag, ds_tree_t *new_values)
     }
 
     om_tag_list_diff_free(&diff);
+    om_tags_generation++;
 
     if (!tag->group) {
         om_tag_group_update_by_tag(tag->name);
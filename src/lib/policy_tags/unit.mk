@@ -34,6 +34,7 @@ UNIT_SRC := src/policy_tags.c
 UNIT_SRC += src/policy_tag_groups.c
 UNIT_SRC += src/policy_tag_list.c
 UNIT_SRC += src/policy_tag_utils.c
+UNIT_SRC += src/policy_tag_mac_set.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 
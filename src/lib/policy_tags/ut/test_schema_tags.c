@@ -26,9 +26,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "json_util.h"
 #include "log.h"
+#include "os_nif.h"
 #include "policy_tags.h"
 #include "target.h"
 #include "unity.h"
+#include "util.h"
 
 char *
 g_test_name = "test_policy_tags";
@@ -348,6 +350,107 @@ void test_val_in_tag_group(void)
 }
 
 
+/**
+ * @brief checks a mac against both a mac set and om_tag_in()
+ */
+static void
+test_check_mac_set(om_mac_set_t *set, char *tag_name, char *mac_s,
+                   bool expected)
+{
+    os_macaddr_t mac;
+    bool ret;
+
+    ret = os_nif_macaddr_from_str(&mac, mac_s);
+    TEST_ASSERT_TRUE(ret);
+
+    ret = om_mac_set_in(set, &mac);
+    TEST_ASSERT_EQUAL(expected, ret);
+
+    if (tag_name == NULL) return;
+
+    ret = om_tag_in(mac_s, tag_name);
+    TEST_ASSERT_EQUAL(expected, ret);
+}
+
+
+void
+test_mac_set_tag_updates(void)
+{
+    struct schema_Openflow_Tag mac_tag;
+    om_mac_set_t *cloud_set;
+    om_mac_set_t *plain_set;
+    om_mac_set_t *all_set;
+    char *cloud_name;
+    char *all_name;
+    char *plain;
+    bool ret;
+
+    all_name = "${mac_tag}";
+    cloud_name = "${#mac_tag}";
+    plain = "aa:bb:cc:dd:ee:ff";
+
+    /* Allocate the sets before the tag exists */
+    all_set = om_mac_set_alloc(&all_name, 1);
+    TEST_ASSERT_NOT_NULL(all_set);
+    cloud_set = om_mac_set_alloc(&cloud_name, 1);
+    TEST_ASSERT_NOT_NULL(cloud_set);
+    plain_set = om_mac_set_alloc(&plain, 1);
+    TEST_ASSERT_NOT_NULL(plain_set);
+
+    test_check_mac_set(all_set, all_name, "11:11:11:11:11:11", false);
+    test_check_mac_set(plain_set, NULL, "aa:bb:cc:dd:ee:ff", true);
+    test_check_mac_set(plain_set, NULL, "aa:bb:cc:dd:ee:00", false);
+
+    /* Add the tag */
+    memset(&mac_tag, 0, sizeof(mac_tag));
+    mac_tag.name_exists = true;
+    STRSCPY(mac_tag.name, "mac_tag");
+    mac_tag.device_value_len = 1;
+    STRSCPY(mac_tag.device_value[0], "11:11:11:11:11:11");
+    mac_tag.cloud_value_len = 2;
+    STRSCPY(mac_tag.cloud_value[0], "22:22:22:22:22:22");
+    STRSCPY(mac_tag.cloud_value[1], "not a mac");
+    ret = om_tag_add_from_schema(&mac_tag);
+    TEST_ASSERT_TRUE(ret);
+
+    test_check_mac_set(all_set, all_name, "11:11:11:11:11:11", true);
+    test_check_mac_set(all_set, all_name, "22:22:22:22:22:22", true);
+    test_check_mac_set(cloud_set, cloud_name, "11:11:11:11:11:11", false);
+    test_check_mac_set(cloud_set, cloud_name, "22:22:22:22:22:22", true);
+    TEST_ASSERT_EQUAL_UINT(2, all_set->nelems);
+
+    /* Move the device value to the cloud values, add a device value */
+    memset(&mac_tag.device_value, 0, sizeof(mac_tag.device_value));
+    memset(&mac_tag.cloud_value, 0, sizeof(mac_tag.cloud_value));
+    mac_tag.device_value_len = 1;
+    STRSCPY(mac_tag.device_value[0], "33:33:33:33:33:33");
+    mac_tag.cloud_value_len = 2;
+    STRSCPY(mac_tag.cloud_value[0], "11:11:11:11:11:11");
+    STRSCPY(mac_tag.cloud_value[1], "22:22:22:22:22:22");
+    ret = om_tag_update_from_schema(&mac_tag);
+    TEST_ASSERT_TRUE(ret);
+
+    test_check_mac_set(all_set, all_name, "11:11:11:11:11:11", true);
+    test_check_mac_set(all_set, all_name, "33:33:33:33:33:33", true);
+    test_check_mac_set(cloud_set, cloud_name, "11:11:11:11:11:11", true);
+    test_check_mac_set(cloud_set, cloud_name, "33:33:33:33:33:33", false);
+    TEST_ASSERT_EQUAL_UINT(3, all_set->nelems);
+    TEST_ASSERT_EQUAL_UINT(2, cloud_set->nelems);
+
+    /* Remove the tag */
+    ret = om_tag_remove_from_schema(&mac_tag);
+    TEST_ASSERT_TRUE(ret);
+
+    TEST_ASSERT_EQUAL_UINT(0, all_set->nelems);
+    TEST_ASSERT_EQUAL_UINT(0, cloud_set->nelems);
+    test_check_mac_set(all_set, all_name, "11:11:11:11:11:11", false);
+
+    om_mac_set_free(all_set);
+    om_mac_set_free(cloud_set);
+    om_mac_set_free(plain_set);
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -363,6 +466,7 @@ main(int argc, char *argv[])
     RUN_TEST(test_type_of_tag);
     RUN_TEST(test_val_in_tag);
     RUN_TEST(test_val_in_tag_group);
+    RUN_TEST(test_mac_set_tag_updates);
 
     return UNITY_END();
 }
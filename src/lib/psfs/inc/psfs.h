@@ -40,6 +40,9 @@ struct psfs
     ds_tree_t       psfs_root;          /* Key/Value cache */
     ssize_t         psfs_used;          /* Number of bytes used by "good" records
                                            in this store */
+    void           *psfs_map;           /* Store file mapping, records loaded
+                                           by psfs_load() point into it */
+    size_t          psfs_mapsz;         /* Size of the mapping */
 };
 
 typedef struct psfs psfs_t;
@@ -50,6 +53,8 @@ struct psfs_record
     uint8_t        *pr_data;            /* Data */
     size_t          pr_datasz;          /* Data size in bytes */
     bool            pr_dirty;           /* True if record is dirty */
+    bool            pr_mapped;          /* True if key and data reside in the
+                                           store mapping */
     ds_tree_node_t  pr_tnode;           /* Tree node */
     ssize_t         pr_used;            /* On-disk bytes used by disk record */
     off_t           pr_off;             /* Record offset */
@@ -24,6 +24,7 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
 #include <sys/uio.h>
@@ -57,6 +58,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* Running a CRC32 over a "data + CRC32" buffer will always yield this number */
 #define PSFS_CRC32_VERIFY                   0x2144DF1C
 
+/* Use the ARMv8 CRC32 instructions, which implement the same polynomial */
+#if defined(__ARM_FEATURE_CRC32) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PSFS_CRC32_HW
+#include <arm_acle.h>
+#endif
+
+/* Size of the write buffer used when pruning */
+#define PSFS_WBUF_SZ                        16384
+
+/* Record header (magic + size) and CRC sizes */
+#define PSFS_RECORD_HDR_SZ                  (2 * sizeof(uint32_t))
+#define PSFS_RECORD_CRC_SZ                  sizeof(uint32_t)
+
 #define PSFS_INIT (psfs_t)      \
 {                               \
     .psfs_fd = -1,              \
@@ -72,10 +86,12 @@ static bool psfs_file_unlock(int fd);
 static void psfs_drop_record(psfs_t *ps, struct psfs_record *pr, ds_tree_iter_t *iter);
 ssize_t psfs_record_write(int fd, struct psfs_record *pr);
 ssize_t psfs_record_read(int fd, struct psfs_record *pr);
+static bool psfs_load_map(psfs_t *ps);
+static void psfs_unmap(psfs_t *ps);
 void psfs_record_init(struct psfs_record *pr, const char *key, const void *data, size_t datasz);
 void psfs_record_fini(struct psfs_record *pr);
 
-static uint32_t psfs_crc32(uint32_t crc, void *buf, ssize_t bufsz);
+static uint32_t psfs_crc32(uint32_t crc, const void *buf, ssize_t bufsz);
 
 /*
  * ===========================================================================
@@ -254,6 +270,8 @@ bool psfs_close(psfs_t *ps)
         psfs_drop_record(ps, pr, &iter);
     }
 
+    psfs_unmap(ps);
+
     if (!psfs_dir_close(ps->psfs_flags & OSP_PS_PRESERVE))
     {
         retval = false;
@@ -339,6 +357,9 @@ bool psfs_sync(psfs_t *ps, bool force_prune)
  * Load all current data from physical media to memory. This function must
  * be called before psfs_get() can be used to read stored data.
  *
+ * The store file is memory mapped and records are indexed in place; reading
+ * the file record by record is used only if the mapping is not possible.
+ *
  * @param[in]   ps      Store object as previously acquired by psfs_open()
  *
  * @return
@@ -350,6 +371,8 @@ bool psfs_load(psfs_t *ps)
 
     struct psfs_record *pr = NULL;
 
+    if (psfs_load_map(ps)) return true;
+
     /*
      * Cache all records in the database to RAM
      */
@@ -413,6 +436,19 @@ bool psfs_erase(psfs_t *ps)
         return false;
     }
 
+    /*
+     * Drop all in-memory records and release the mapping first: loaded
+     * records point into it, and accessing the mapping past the end of
+     * the truncated file raises SIGBUS.
+     */
+    ds_tree_foreach_iter(&ps->psfs_root, pr, &iter)
+    {
+        LOG(DEBUG, "psfs: %s: Deleting record '%s'.", ps->psfs_name, pr->pr_key);
+        psfs_drop_record(ps, pr, &iter);
+    }
+
+    psfs_unmap(ps);
+
     /* Truncate file to 0 bytes  */
     if (ftruncate(ps->psfs_fd, 0) != 0)
     {
@@ -427,13 +463,6 @@ bool psfs_erase(psfs_t *ps)
         return false;
     }
 
-    /* Drop all in-memory records */
-    ds_tree_foreach_iter(&ps->psfs_root, pr, &iter)
-    {
-        LOG(DEBUG, "psfs: %s: Deleting record '%s'.", ps->psfs_name, pr->pr_key);
-        psfs_drop_record(ps, pr, &iter);
-    }
-
     return true;
 }
 
@@ -803,8 +832,59 @@ void psfs_record_fini(struct psfs_record *pr)
     /*
      * No need to free pr->pr_data as it is allocated in the same buffer as
      * pr_key -- see psfs_record_init()
+     *
+     * Records loaded by psfs_load_map() point into the store mapping instead
      */
-    if (pr->pr_key != NULL) free(pr->pr_key);
+    if (pr->pr_key != NULL && !pr->pr_mapped) free(pr->pr_key);
+}
+
+/**
+ * Calculate the on-disk header and CRC of a record.
+ *
+ * @param[in]   pr      Initialized record structure
+ * @param[out]  wmagic  Magic number, in network order
+ * @param[out]  wsz     Key + data size, in network order
+ * @param[out]  wcrc    CRC, in the on-disk byte order
+ *
+ * @return
+ * This function returns the number of bytes used by this record on physical
+ * media, excluding padding.
+ */
+static ssize_t psfs_record_hdr(
+        struct psfs_record *pr,
+        uint32_t *wmagic,
+        uint32_t *wsz,
+        uint8_t wcrc[4])
+{
+    ssize_t ksz;
+
+    uint32_t crc = 0x0;
+    ssize_t retval = 0;
+
+    *wmagic = htonl(PSFS_MAGIC);
+    ksz = strlen(pr->pr_key) + sizeof(char);
+    *wsz = htonl(ksz + pr->pr_datasz);
+
+    /* Refresh CRC */
+    crc = psfs_crc32(crc, wmagic, sizeof(*wmagic));
+    retval += sizeof(*wmagic);
+    crc = psfs_crc32(crc, wsz, sizeof(*wsz));
+    retval += sizeof(*wsz);
+    crc = psfs_crc32(crc, pr->pr_key, ksz);
+    retval += ksz;
+    crc = psfs_crc32(crc, pr->pr_data, pr->pr_datasz);
+    retval += pr->pr_datasz;
+
+    /*
+     * The CRC must be written out in big-endian order
+     */
+    wcrc[0] = (crc >> 0) & 0xFF;
+    wcrc[1] = (crc >> 8) & 0xFF;
+    wcrc[2] = (crc >> 16) & 0xFF;
+    wcrc[3] = (crc >> 24) & 0xFF;
+    retval += PSFS_RECORD_CRC_SZ;
+
+    return retval;
 }
 
 /*
@@ -835,7 +915,6 @@ ssize_t psfs_record_write(int fd, struct psfs_record *pr)
     ssize_t epadlen;
     ssize_t rc;
 
-    uint32_t crc = 0x0;
     ssize_t retval = 0;
 
     /* Initialize the padding buffer */
@@ -859,28 +938,8 @@ ssize_t psfs_record_write(int fd, struct psfs_record *pr)
         bpadlen = 4 - ((st.st_size) & 0x3);
     }
 
-    wmagic = htonl(PSFS_MAGIC);
     ksz = strlen(pr->pr_key) + sizeof(char);
-    wsz = htonl(ksz + pr->pr_datasz);
-
-    /* Refresh CRC */
-    crc = psfs_crc32(crc, &wmagic, sizeof(wmagic));
-    retval += sizeof(wmagic);
-    crc = psfs_crc32(crc, &wsz, sizeof(wsz));
-    retval += sizeof(wsz);
-    crc = psfs_crc32(crc, pr->pr_key, ksz);
-    retval += ksz;
-    crc = psfs_crc32(crc, pr->pr_data, pr->pr_datasz);
-    retval += pr->pr_datasz;
-
-    /*
-     * The CRC must be written out in big-endian order
-     */
-    wcrc[0] = (crc >> 0) & 0xFF;
-    wcrc[1] = (crc >> 8) & 0xFF;
-    wcrc[2] = (crc >> 16) & 0xFF;
-    wcrc[3] = (crc >> 24) & 0xFF;
-    retval += sizeof(wcrc);
+    retval = psfs_record_hdr(pr, &wmagic, &wsz, wcrc);
 
     /*
      * Calculate padding size
@@ -1119,6 +1178,168 @@ seek_on_error:
     return -1;
 }
 
+/**
+ * Validate a single record in a memory buffer, without copying it.
+ *
+ * @param[in]   buf     Buffer, pointing to the record magic number
+ * @param[in]   bufsz   Bytes available in the buffer
+ * @param[out]  pr      Record, key and data are set to point into @p buf
+ *
+ * @return
+ * This function returns the number of bytes used by the record (excluding
+ * padding) or a negative number if @p buf does not hold a valid record.
+ */
+static ssize_t psfs_record_map(const uint8_t *buf, size_t bufsz, struct psfs_record *pr)
+{
+    uint32_t pr_magic;
+    uint32_t pr_size;
+    size_t doff;
+    size_t len;
+
+    if (bufsz < PSFS_RECORD_HDR_SZ + PSFS_RECORD_CRC_SZ) return -1;
+
+    memcpy(&pr_magic, buf, sizeof(pr_magic));
+    if (pr_magic != ntohl(PSFS_MAGIC)) return -1;
+
+    memcpy(&pr_size, buf + sizeof(pr_magic), sizeof(pr_size));
+    pr_size = ntohl(pr_size);
+
+    /* Check if the record size points past the end of the buffer */
+    if (pr_size > bufsz - PSFS_RECORD_HDR_SZ - PSFS_RECORD_CRC_SZ)
+    {
+        LOG(ERR, "psfs: record_map: Corrupted record size points past end of file.");
+        return -1;
+    }
+
+    len = PSFS_RECORD_HDR_SZ + pr_size + PSFS_RECORD_CRC_SZ;
+    if (psfs_crc32(0, buf, len) != PSFS_CRC32_VERIFY)
+    {
+        LOG(ERR, "psfs: record_map: Invalid record CRC.");
+        return -1;
+    }
+
+    /* Get the data offset relative to the key by calculating the key length */
+    pr->pr_key = (char *)buf + PSFS_RECORD_HDR_SZ;
+    doff = strnlen(pr->pr_key, pr_size);
+    if (doff >= pr_size)
+    {
+        LOG(ERR, "psfs: record_map: Key is corrupted.");
+        return -1;
+    }
+    doff++;
+
+    pr->pr_data = (uint8_t *)pr->pr_key + doff;
+    pr->pr_datasz = pr_size - doff;
+    pr->pr_used = len;
+    pr->pr_mapped = true;
+
+    return len;
+}
+
+/**
+ * Load all records from the current file position by memory mapping the store
+ * file. Records are indexed in place and only the record structures are
+ * allocated, the mapping is kept until the store is closed or erased.
+ *
+ * @param[in]   ps      Store object as previously acquired by psfs_open()
+ *
+ * @return
+ * This function returns true if the records were loaded, or false if the
+ * store could not be mapped and must be read instead.
+ */
+bool psfs_load_map(psfs_t *ps)
+{
+    struct psfs_record rec;
+    struct psfs_record *opr;
+    struct psfs_record *pr;
+    struct stat st;
+    uint8_t *map;
+    ssize_t rc;
+    off_t off;
+
+    /* Records appended after a previous load are read */
+    if (ps->psfs_map != NULL) return false;
+
+    off = lseek(ps->psfs_fd, 0, SEEK_CUR);
+    if (off < 0 || fstat(ps->psfs_fd, &st) != 0) return false;
+
+    if (st.st_size <= off) return false;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ps->psfs_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG(DEBUG, "psfs: %s: Error mapping store, reading it instead. Error: %s",
+                ps->psfs_name,
+                strerror(errno));
+        return false;
+    }
+
+    (void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    ps->psfs_map = map;
+    ps->psfs_mapsz = st.st_size;
+
+    while (off < st.st_size)
+    {
+        /* All records start at a 4 byte offset */
+        off = (off + 0x3) & ~(off_t)0x3;
+        if (off >= st.st_size) break;
+
+        memset(&rec, 0, sizeof(rec));
+        rc = psfs_record_map(map + off, st.st_size - off, &rec);
+        if (rc < 0)
+        {
+            /* Look for the next record at the next aligned offset */
+            off += sizeof(uint32_t);
+            continue;
+        }
+        off += rc;
+
+        opr = ds_tree_find(&ps->psfs_root, rec.pr_key);
+        if (opr != NULL)
+        {
+            /* Replace the old record -- remove it from the store cache */
+            psfs_drop_record(ps, opr, NULL);
+        }
+
+        /* Do not cache deleted keys */
+        if (rec.pr_datasz == 0) continue;
+
+        pr = calloc(1, sizeof(*pr));
+        if (pr == NULL)
+        {
+            LOG(ERR, "psfs: %s: Error allocating record.", ps->psfs_name);
+            break;
+        }
+        *pr = rec;
+
+        ds_tree_insert(&ps->psfs_root, pr, pr->pr_key);
+        /* Account read data */
+        ps->psfs_used += pr->pr_used;
+    }
+
+    /* Leave the file position where psfs_record_read() would have */
+    (void)lseek(ps->psfs_fd, st.st_size, SEEK_SET);
+
+    return true;
+}
+
+/**
+ * Release the store mapping. Records pointing into it must have been dropped.
+ */
+void psfs_unmap(psfs_t *ps)
+{
+    if (ps->psfs_map == NULL) return;
+
+    if (munmap(ps->psfs_map, ps->psfs_mapsz) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error unmapping store. Error: %s", ps->psfs_name, strerror(errno));
+    }
+
+    ps->psfs_map = NULL;
+    ps->psfs_mapsz = 0;
+}
+
 /**
  * Transfer all dirty records to physical media (flush). This function works
  * in "append" mode, which just appends dirty records to the journal.
@@ -1160,12 +1381,131 @@ bool psfs_sync_append(psfs_t *ps)
     return true;
 }
 
+/**
+ * Buffered writer used to stream records to a file
+ */
+struct psfs_wbuf
+{
+    int             wb_fd;                  /* File descriptor */
+    size_t          wb_len;                 /* Bytes buffered */
+    uint8_t         wb_buf[PSFS_WBUF_SZ];   /* Buffer */
+};
+
+/**
+ * Write out all buffered data.
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+static bool psfs_wbuf_flush(struct psfs_wbuf *wb)
+{
+    size_t off;
+    ssize_t rc;
+
+    for (off = 0; off < wb->wb_len; off += rc)
+    {
+        rc = write(wb->wb_fd, wb->wb_buf + off, wb->wb_len - off);
+        if (rc < 0 && errno == EINTR)
+        {
+            rc = 0;
+            continue;
+        }
+
+        if (rc <= 0)
+        {
+            LOG(ERR, "psfs: wbuf_flush: Error writing data. Error: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    wb->wb_len = 0;
+
+    return true;
+}
+
+/**
+ * Append @p len bytes of @p data to the write buffer, flushing it when full.
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+static bool psfs_wbuf_put(struct psfs_wbuf *wb, const void *data, size_t len)
+{
+    const uint8_t *pdata = data;
+    size_t n;
+
+    while (len > 0)
+    {
+        if (wb->wb_len == sizeof(wb->wb_buf) && !psfs_wbuf_flush(wb))
+        {
+            return false;
+        }
+
+        n = sizeof(wb->wb_buf) - wb->wb_len;
+        if (n > len) n = len;
+
+        memcpy(wb->wb_buf + wb->wb_len, pdata, n);
+        wb->wb_len += n;
+        pdata += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Stream a record to the write buffer. The stream must be positioned at a
+ * 4 byte offset, which is preserved.
+ *
+ * @param[in]   wb      Write buffer
+ * @param[in]   pr      Initialized record structure
+ *
+ * @return
+ * This function returns the number of bytes used by this record on physical
+ * (excluding padding) media or a negative number on error.
+ */
+static ssize_t psfs_record_stream(struct psfs_wbuf *wb, struct psfs_record *pr)
+{
+    uint8_t wpad[4];
+    uint8_t wcrc[4];
+    uint32_t wmagic;
+    uint32_t wsz;
+    ssize_t epadlen;
+    ssize_t retval;
+
+    memset(wpad, PSFS_PADDING, sizeof(wpad));
+
+    retval = psfs_record_hdr(pr, &wmagic, &wsz, wcrc);
+
+    epadlen = 0;
+    if ((retval & 0x3) != 0)
+    {
+        epadlen = 4 - (retval & 0x3);
+    }
+
+    if (!psfs_wbuf_put(wb, &wmagic, sizeof(wmagic)) ||
+            !psfs_wbuf_put(wb, &wsz, sizeof(wsz)) ||
+            !psfs_wbuf_put(wb, pr->pr_key, strlen(pr->pr_key) + sizeof(char)) ||
+            !psfs_wbuf_put(wb, pr->pr_data, pr->pr_datasz) ||
+            !psfs_wbuf_put(wb, wcrc, sizeof(wcrc)) ||
+            !psfs_wbuf_put(wb, wpad, epadlen))
+    {
+        LOG(ERR, "psfs: Error writing key %s to storage.", pr->pr_key);
+        return -1;
+    }
+
+    return retval;
+}
+
 /**
  * Transfer all dirty records to physical media (flush). This function performs
  * a prune (copy-over) operation where the full database content is dumped
  * to a temporary file, flushed to disk and then renamed to the original store
  * name,
  *
+ * Records are streamed to the temporary file through a write buffer in a
+ * single pass, without per-record system calls.
+ *
  * @param[in]   ps      Pointer to a valid psfs store object
  *
  * @return
@@ -1177,6 +1517,7 @@ bool psfs_sync_prune(psfs_t *ps)
     struct psfs_record *pr;
     ds_tree_iter_t iter;
 
+    struct psfs_wbuf *wb = NULL;
     int tfd = -1;
     bool retval = false;
 
@@ -1216,6 +1557,15 @@ bool psfs_sync_prune(psfs_t *ps)
         goto error;
     }
 
+    wb = malloc(sizeof(*wb));
+    if (wb == NULL)
+    {
+        LOG(ERR, "psfs: %s: Error allocating prune buffer.", ps->psfs_name);
+        goto error;
+    }
+    wb->wb_fd = tfd;
+    wb->wb_len = 0;
+
     /* Write the current content of the database to file */
     ds_tree_foreach_iter(&ps->psfs_root, pr, &iter)
     {
@@ -1226,13 +1576,19 @@ bool psfs_sync_prune(psfs_t *ps)
             continue;
         }
 
-        if (psfs_record_write(tfd, pr) <= 0)
+        if (psfs_record_stream(wb, pr) <= 0)
         {
             LOG(ERR, "psfs: %s: Error writing record during a prune operation.",
                      ps->psfs_name);
-            continue;
+            goto error;
         }
-        pr->pr_dirty = false;
+    }
+
+    if (!psfs_wbuf_flush(wb))
+    {
+        LOG(ERR, "psfs: %s: Error writing records during a prune operation.",
+                 ps->psfs_name);
+        goto error;
     }
 
     /* Flush data to storage */
@@ -1256,6 +1612,12 @@ bool psfs_sync_prune(psfs_t *ps)
         goto error;
     }
 
+    /* All records are on physical media now */
+    ds_tree_foreach(&ps->psfs_root, pr)
+    {
+        pr->pr_dirty = false;
+    }
+
     /* Close old store file descriptor ... */
     (void)psfs_file_unlock(ps->psfs_fd);
     (void)close(ps->psfs_fd);
@@ -1267,13 +1629,54 @@ bool psfs_sync_prune(psfs_t *ps)
     retval = true;
 
 error:
+    if (wb != NULL) free(wb);
     if (tfd >= 0) close(tfd);
 
     return retval;
 }
 
+#if !defined(PSFS_CRC32_HW)
+/* Slice-by-8 lookup tables, generated on first use */
+static uint32_t psfs_crc32_table[8][256];
+static bool psfs_crc32_table_init = false;
+
+/**
+ * Generate the slice-by-8 CRC32 lookup tables.
+ */
+static void psfs_crc32_init(void)
+{
+    uint32_t crc;
+    int ii;
+    int jj;
+
+    for (ii = 0; ii < 256; ii++)
+    {
+        crc = ii;
+        for (jj = 0; jj < 8; jj++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ PSFS_CRC32_POLY : crc >> 1;
+        }
+        psfs_crc32_table[0][ii] = crc;
+    }
+
+    for (ii = 0; ii < 256; ii++)
+    {
+        crc = psfs_crc32_table[0][ii];
+        for (jj = 1; jj < 8; jj++)
+        {
+            crc = (crc >> 8) ^ psfs_crc32_table[0][crc & 0xFF];
+            psfs_crc32_table[jj][ii] = crc;
+        }
+    }
+
+    psfs_crc32_table_init = true;
+}
+#endif
+
 /**
- * Table-less CRC32 function implementation.
+ * CRC32 function implementation. The ARMv8 CRC32 instructions are used when
+ * available, otherwise the data is processed 8 bytes at a time using the
+ * slice-by-8 lookup tables.
  *
  * @param[in]   crc     Previous CRC value
  * @param[in]   buf     Data
@@ -1286,20 +1689,54 @@ error:
  * By appending the CRC in big-endian order to a buffer and re-calculating the
  * CRC, this function should always yield PSFS_CRC32_VERIFY
  */
-uint32_t psfs_crc32(uint32_t crc, void *buf, ssize_t bufsz)
+uint32_t psfs_crc32(uint32_t crc, const void *buf, ssize_t bufsz)
 {
-    uint8_t *pbuf;
-    int ii;
+    const uint8_t *pbuf = buf;
 
     crc = ~crc;
-    for (pbuf = buf; bufsz-- > 0; pbuf++)
+
+#if defined(PSFS_CRC32_HW)
+    uint64_t d;
+
+    for (; bufsz >= 8; bufsz -= 8, pbuf += 8)
     {
-        crc ^= *pbuf;
-        for (ii = 0; ii < 8; ii++)
-        {
-            crc = (crc & 1) ? (crc >> 1) ^ PSFS_CRC32_POLY : crc >> 1;
-        }
+        memcpy(&d, pbuf, sizeof(d));
+        crc = __crc32d(crc, d);
+    }
+
+    for (; bufsz > 0; bufsz--, pbuf++)
+    {
+        crc = __crc32b(crc, *pbuf);
+    }
+#else
+    uint32_t lo;
+    uint32_t hi;
+
+    if (!psfs_crc32_table_init) psfs_crc32_init();
+
+    for (; bufsz >= 8; bufsz -= 8, pbuf += 8)
+    {
+        /* Byte-wise loads keep this endian-neutral */
+        lo = crc ^ ((uint32_t)pbuf[0] | (uint32_t)pbuf[1] << 8 |
+                (uint32_t)pbuf[2] << 16 | (uint32_t)pbuf[3] << 24);
+        hi = (uint32_t)pbuf[4] | (uint32_t)pbuf[5] << 8 |
+                (uint32_t)pbuf[6] << 16 | (uint32_t)pbuf[7] << 24;
+
+        crc = psfs_crc32_table[7][lo & 0xFF] ^
+              psfs_crc32_table[6][(lo >> 8) & 0xFF] ^
+              psfs_crc32_table[5][(lo >> 16) & 0xFF] ^
+              psfs_crc32_table[4][lo >> 24] ^
+              psfs_crc32_table[3][hi & 0xFF] ^
+              psfs_crc32_table[2][(hi >> 8) & 0xFF] ^
+              psfs_crc32_table[1][(hi >> 16) & 0xFF] ^
+              psfs_crc32_table[0][hi >> 24];
+    }
+
+    for (; bufsz > 0; bufsz--, pbuf++)
+    {
+        crc = (crc >> 8) ^ psfs_crc32_table[0][(crc ^ *pbuf) & 0xFF];
     }
+#endif
 
     return ~crc;
 }
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "log.h"
+#include "osp_ps.h"
+#include "psfs.h"
+#include "target.h"
+#include "unity.h"
+
+#define TEST_PSFS_STORE "test_psfs"
+
+const char *test_name = "psfs_tests";
+
+
+/**
+ * @brief opens the test store and loads its records
+ */
+static void
+test_psfs_open_load(psfs_t *ps)
+{
+    bool rc;
+
+    rc = psfs_open(ps, TEST_PSFS_STORE, OSP_PS_RDWR);
+    TEST_ASSERT_TRUE(rc);
+
+    rc = psfs_load(ps);
+    TEST_ASSERT_TRUE(rc);
+}
+
+
+void
+setUp(void)
+{
+    psfs_t ps;
+
+    /* Start from an empty store */
+    test_psfs_open_load(&ps);
+    TEST_ASSERT_TRUE(psfs_erase(&ps));
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+}
+
+
+void
+tearDown(void)
+{
+    return;
+}
+
+
+/**
+ * @brief erases a store whose records were loaded from the mapped file
+ *
+ * The records point into the file mapping: the erase must release them
+ * before truncating the file.
+ */
+void
+test_erase_loaded_store(void)
+{
+    char value[32];
+    ssize_t rc;
+    psfs_t ps;
+
+    test_psfs_open_load(&ps);
+    rc = psfs_set(&ps, "key_1", "value_1", sizeof("value_1"));
+    TEST_ASSERT_EQUAL_INT(sizeof("value_1"), rc);
+    rc = psfs_set(&ps, "key_2", "value_2", sizeof("value_2"));
+    TEST_ASSERT_EQUAL_INT(sizeof("value_2"), rc);
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    /* The records are now loaded from the mapped file */
+    test_psfs_open_load(&ps);
+    TEST_ASSERT_NOT_NULL(ps.psfs_map);
+    rc = psfs_get(&ps, "key_1", value, sizeof(value));
+    TEST_ASSERT_EQUAL_INT(sizeof("value_1"), rc);
+    TEST_ASSERT_EQUAL_STRING("value_1", value);
+
+    TEST_ASSERT_TRUE(psfs_erase(&ps));
+    TEST_ASSERT_NULL(ps.psfs_map);
+    rc = psfs_get(&ps, "key_1", value, sizeof(value));
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    /* The store remains usable after the erase */
+    rc = psfs_set(&ps, "key_3", "value_3", sizeof("value_3"));
+    TEST_ASSERT_EQUAL_INT(sizeof("value_3"), rc);
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    test_psfs_open_load(&ps);
+    rc = psfs_get(&ps, "key_1", value, sizeof(value));
+    TEST_ASSERT_EQUAL_INT(0, rc);
+    rc = psfs_get(&ps, "key_2", value, sizeof(value));
+    TEST_ASSERT_EQUAL_INT(0, rc);
+    rc = psfs_get(&ps, "key_3", value, sizeof(value));
+    TEST_ASSERT_EQUAL_INT(sizeof("value_3"), rc);
+    TEST_ASSERT_EQUAL_STRING("value_3", value);
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_TRACE);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_erase_loaded_store);
+
+    return UNITY_END();
+}
@@ -13,6 +13,7 @@ UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_CFLAGS += -fasynchronous-unwind-tables
 UNIT_CFLAGS += -D UNITY_INCLUDE_EXEC_TIME
 UNIT_CFLAGS += -D UNITY_INCLUDE_PRINT_FORMATTED
+UNIT_CFLAGS += -D UNITY_SUPPORT_64
 
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
 UNIT_EXPORT_LDFLAGS := -lm
@@ -73,7 +73,7 @@ static bool nfm_osfw_is_valid_chain(const char *chain)
 	return true;
 }
 
-static enum osfw_table nfm_osfw_convert_table(const char *table)
+enum osfw_table nfm_osfw_convert_table(const char *table)
 {
 	enum osfw_table value = OSFW_TABLE_FILTER;
 
@@ -33,6 +33,7 @@
 #define NFM_OSFW_H_INCLUDED
 
 #include "schema.h"
+#include "osn_fw.h"
 #include <ev.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
@@ -46,6 +47,7 @@ bool nfm_osfw_init(struct ev_loop *loop);
 bool nfm_osfw_fini(void);
 bool nfm_osfw_is_inet4(const char *protocol);
 bool nfm_osfw_is_inet6(const char *protocol);
+enum osfw_table nfm_osfw_convert_table(const char *table);
 bool nfm_osfw_add_chain(int family, const char *table, const char *chain);
 bool nfm_osfw_del_chain(int family, const char *table, const char *chain);
 bool nfm_osfw_add_rule(const struct schema_Netfilter *conf);
@@ -275,8 +275,36 @@ static struct nfm_rule *nfm_rule_get(const char *name)
 	return (struct nfm_rule *) ds_tree_find(&nfm_rule_tree, (void *) name);
 }
 
+/*
+ * The firewall rejected a rule of an enabled Netfilter entry when applying the
+ * configuration
+ */
+static void nfm_rule_on_osfw_error(int family, enum osfw_table table, const char *chain,
+		int prio, const char *match, const char *target)
+{
+	struct nfm_rule *self = NULL;
+
+	ds_tree_foreach(&nfm_rule_tree, self) {
+		if (!(self->flags & NFM_FLAG_RULE_APPLIED)) {
+			continue;
+		} else if ((family == AF_INET) && !nfm_osfw_is_inet4(self->conf.protocol)) {
+			continue;
+		} else if ((family == AF_INET6) && !nfm_osfw_is_inet6(self->conf.protocol)) {
+			continue;
+		} else if ((nfm_osfw_convert_table(self->conf.table) != table) || (self->conf.priority != prio) ||
+				strcmp(self->conf.chain, chain) || strcmp(self->conf.rule, match) ||
+				strcmp(self->conf.target, target)) {
+			continue;
+		}
+
+		LOGE("[%s] Netfilter rule rejected by the firewall", self->conf.name);
+		nfm_rule_set_status(self, "error");
+	}
+}
+
 bool nfm_rule_init(void)
 {
+	osfw_rule_error_notify(nfm_rule_on_osfw_error);
 	return true;
 }
 
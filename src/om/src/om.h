@@ -111,6 +111,35 @@ extern bool     om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
 extern bool     om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf);
 extern bool     om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf);
 
+/******************************************************************************
+ * Openflow rules batching Definitions
+ *
+ * Flows added/deleted during an event loop iteration are applied in a single
+ * batch per bridge. A rejected batch is applied again flow by flow.
+ *****************************************************************************/
+struct ev_loop;
+
+// Applies the flows listed in the file at path, in ovs-ofctl add-flows syntax
+typedef bool (*om_flow_batch_exec_t)(const char *bridge, const char *path);
+
+struct om_flow_batch_stats {
+    uint64_t    batches;            /* Batches applied */
+    uint64_t    flows;              /* Flows applied in batches */
+    uint64_t    adds;               /* Flows added */
+    uint64_t    dels;               /* Flows deleted */
+    uint64_t    failures;           /* Batches applied flow by flow */
+    uint32_t    last_flows;         /* Flows in the last batch */
+    double      last_latency;       /* Last batch duration, in seconds */
+    double      max_latency;        /* Longest batch duration, in seconds */
+    double      total_latency;      /* Total batches duration, in seconds */
+};
+
+extern void     om_flow_batch_init(struct ev_loop *loop, om_flow_batch_exec_t exec);
+extern void     om_flow_batch_exit(void);
+extern bool     om_flow_batch_flush(void);
+extern const struct om_flow_batch_stats *
+                om_flow_batch_get_stats(void);
+
 /******************************************************************************
  * Misc External Function Definitions
  *****************************************************************************/
@@ -94,6 +94,8 @@ int main( int argc, char **argv )
         return(1);
     }
 
+    om_flow_batch_init(ev_loop, NULL);
+
     memset(&tag_mgr, 0, sizeof(tag_mgr));
     tag_mgr.service_tag_update = om_template_tag_update;
     om_tag_init(&tag_mgr);
@@ -112,6 +114,8 @@ int main( int argc, char **argv )
     // Cleanup and Exit
     LOGN( "Openflow Manager shutting down" );
 
+    om_flow_batch_exit();
+
     target_close( TARGET_INIT_MGR_OM, ev_loop );
 
     if (!ovsdb_stop_loop( ev_loop )) {
@@ -242,32 +242,6 @@ om_range_get_range_type(char *str_range)
     }
 }
 
-// Convert IP string into integer
-static uint32_t
-om_range_dot_to_long_ip(char* ipstring)
-{
-    if (ipstring == NULL) {
-        return 0;
-    }
-
-    uint32_t ip = ntohl(inet_addr(ipstring));
-    return ip;
-}
-
-// Convert IP integer into string
-static char*
-om_range_long_to_dot_ip(uint32_t ipnum)
-{
-    uint8_t bytes[4];
-    char* buf = malloc (sizeof (char) * 16);
-    bytes[0] = (ipnum >> 24) & 0xFF;
-    bytes[1] = (ipnum >> 16) & 0xFF;
-    bytes[2] = (ipnum >> 8) & 0xFF;
-    bytes[3] = ipnum & 0xFF;
-    snprintf(buf, (sizeof (char) * 16), "%d.%d.%d.%d", bytes[0], bytes[1], bytes[2], bytes[3]);
-    return buf;
-}
-
 //  Remove substring from string ( remove $<range> from rule )
 static void
 om_range_rmv_substr(char *s,const char *toremove)
@@ -323,6 +297,56 @@ err:
     return rc;
 }
 
+/*
+ * Ranges are split into the minimal set of aligned blocks, each matched by a
+ * single prefix or value/mask flow: the number of flows grows with the
+ * logarithm of the range size instead of the range size.
+ *
+ * Values are handled as big endian byte arrays of len bytes.
+ */
+
+// Number of low bits of the largest aligned block starting at cur within end
+static int
+om_range_block_bits(const uint8_t *cur, const uint8_t *end, size_t len)
+{
+    uint8_t last[sizeof(struct in6_addr)];
+    int     bits = len * 8;
+    int     k;
+    int     i;
+
+    // The block is aligned on the trailing zeros of cur
+    for (k = 0; k < bits; k++) {
+        if (cur[len - 1 - k / 8] & (1 << (k % 8))) break;
+    }
+
+    // Shrink it until its last value is within the range
+    for ( ; k > 0; k--) {
+        memcpy(last, cur, len);
+        for (i = 0; i < k; i++) {
+            last[len - 1 - i / 8] |= (1 << (i % 8));
+        }
+        if (memcmp(last, end, len) <= 0) break;
+    }
+
+    return k;
+}
+
+// Move cur past a block of k low bits, returns false on wrap around
+static bool
+om_range_next_block(uint8_t *cur, size_t len, int k)
+{
+    unsigned int carry = 1 << (k % 8);
+    int          i;
+
+    for (i = len - 1 - k / 8; i >= 0 && carry != 0; i--) {
+        carry += cur[i];
+        cur[i] = carry & 0xFF;
+        carry >>= 8;
+    }
+
+    return carry == 0;
+}
+
 static bool
 om_range_generate_ipv6_rules( char *s, char *e, struct schema_Openflow_Config *sflow, bool is_src)
 {
@@ -330,16 +354,18 @@ om_range_generate_ipv6_rules( char *s, char *e, struct schema_Openflow_Config *s
 
     char            output[64], rule[1024];
     struct in6_addr sn, en;
-    int             octet;
+    int             k;
     bool            ret = true;
 
     memset(&out, 0, sizeof(out));
     memcpy(&out, sflow, sizeof(out));
 
-    inet_pton(AF_INET6,s,&sn);
-    inet_pton(AF_INET6,e,&en);
+    if (inet_pton(AF_INET6, s, &sn) != 1 || inet_pton(AF_INET6, e, &en) != 1) {
+        LOGE("Invalid IPv6 range %s-%s", s, e);
+        return false;
+    }
 
-    for ( ; ; ) {
+    while (memcmp(sn.s6_addr, en.s6_addr, 16) <= 0) {
         memset(output, 0, (sizeof(char)*64));
         memset(rule,   0, (sizeof(char)*1024));
 
@@ -349,6 +375,11 @@ om_range_generate_ipv6_rules( char *s, char *e, struct schema_Openflow_Config *s
             break;
         }
 
+        k = om_range_block_bits(sn.s6_addr, en.s6_addr, 16);
+        if (k > 0) {
+            snprintf(output + strlen(output), sizeof(output) - strlen(output), "/%d", 128 - k);
+        }
+
         if (is_src) {
             sprintf(rule, "%s,ipv6_src=%s", sflow->rule, output);
         } else {
@@ -358,22 +389,7 @@ om_range_generate_ipv6_rules( char *s, char *e, struct schema_Openflow_Config *s
         STRSCPY(out.rule, rule);
         ret = ret && om_range_recurse_parse(&out);
 
-        /* break if we hit the last address or (sn > en) */
-        if (memcmp(sn.s6_addr, en.s6_addr, 16) >= 0) {
-            break;
-        }
-
-        /* increment sn, and move towards en */
-        for (octet = 15; octet >= 0; --octet) {
-            if (sn.s6_addr[octet] < 255) {
-                sn.s6_addr[octet]++;
-                break;
-            } else {
-                sn.s6_addr[octet] = 0;
-            }
-        }
-
-        if (octet < 0) {
+        if (!om_range_next_block(sn.s6_addr, 16, k)) {
             break; /* top of logical address range */
         }
     }
@@ -388,31 +404,36 @@ om_range_generate_ipv4_rules( char *start, char *end,
     struct schema_Openflow_Config   out;
     bool                            ret = true;
     char                            rule[1024];
-    char                            *ipv4buff;
+    char                            ipv4buff[INET_ADDRSTRLEN];
+    struct in_addr                  sn, en;
+    int                             k;
 
-    unsigned long                   startIP = om_range_dot_to_long_ip(start);
-    unsigned long                   endIP = om_range_dot_to_long_ip(end);
-
-    unsigned int                    iterator;
-    
     memcpy(&out, sflow, sizeof(out));
 
-    for (iterator=startIP; iterator <= endIP; iterator++)
+    if (inet_pton(AF_INET, start, &sn) != 1 || inet_pton(AF_INET, end, &en) != 1) {
+        LOGE("Invalid IPv4 range %s-%s", start, end);
+        return false;
+    }
+
+    // s_addr is in network order, its bytes are big endian
+    while (memcmp(&sn.s_addr, &en.s_addr, 4) <= 0)
     {
         memset( rule, 0, sizeof(char) * 1024);
 
-        ipv4buff = om_range_long_to_dot_ip(iterator);
+        inet_ntop(AF_INET, &sn, ipv4buff, sizeof(ipv4buff));
+        k = om_range_block_bits((uint8_t *)&sn.s_addr, (uint8_t *)&en.s_addr, 4);
 
-        if (is_src) {
-            sprintf(rule, "%s,nw_src=%s", sflow->rule, ipv4buff);
+        if (k > 0) {
+            sprintf(rule, "%s,%s=%s/%d", sflow->rule, is_src ? "nw_src" : "nw_dst",
+                    ipv4buff, 32 - k);
         } else {
-            sprintf(rule, "%s,nw_dst=%s", sflow->rule, ipv4buff);
+            sprintf(rule, "%s,%s=%s", sflow->rule, is_src ? "nw_src" : "nw_dst", ipv4buff);
         }
 
-        free(ipv4buff);
-
         STRSCPY(out.rule, rule);
         ret = ret && om_range_recurse_parse(&out);
+
+        if (!om_range_next_block((uint8_t *)&sn.s_addr, 4, k)) break;
     }
 
     return ret;
@@ -424,25 +445,43 @@ om_range_generate_port_rules( int start, int end,
 {
     struct schema_Openflow_Config   out;
     bool                            ret = true;
-    int                             i = 0;
+    uint8_t                         cur[2], last[2];
     char                            rule[1024];
+    int                             port;
+    int                             k;
+
+    if (start < 0 || end > UINT16_MAX) {
+        LOGE("Invalid port range %d-%d", start, end);
+        return false;
+    }
 
     memset(&out, 0, sizeof(out));
     memcpy(&out, sflow, sizeof(out));
 
-    for (i = start; i <= end; i++) {
+    cur[0]  = (start >> 8) & 0xFF;
+    cur[1]  = start & 0xFF;
+    last[0] = (end >> 8) & 0xFF;
+    last[1] = end & 0xFF;
+
+    while (memcmp(cur, last, 2) <= 0) {
         memset(rule, 0, sizeof(char) * 1024);
 
-        if (is_src) {
-            sprintf(rule, "%s,tp_src=%d", sflow->rule, i);
+        port = (cur[0] << 8) | cur[1];
+        k = om_range_block_bits(cur, last, 2);
+
+        if (k > 0) {
+            sprintf(rule, "%s,%s=0x%04x/0x%04x", sflow->rule, is_src ? "tp_src" : "tp_dst",
+                    port, (0xFFFFu << k) & 0xFFFF);
         } else {
-            sprintf(rule, "%s,tp_dst=%d", sflow->rule, i);
+            sprintf(rule, "%s,%s=%d", sflow->rule, is_src ? "tp_src" : "tp_dst", port);
         }
 
         STRSCPY(out.rule, rule);
 
         // Set ret to false if it is ever false
         ret = om_range_recurse_parse(&out) && ret;
+
+        if (!om_range_next_block(cur, 2, k)) break;
     }
 
     return ret;
@@ -610,6 +649,9 @@ om_monitor_update_flows(om_action_t type, json_t *js)
 
     memcpy(&ofconf_cpy, &ofconf, sizeof(ofconf_cpy));
 
+    // Apply the flows queued so far, the result reported below is this row's only
+    (void)om_flow_batch_flush();
+
     // Handle the condition where a range exists in the rule
     if (om_range_is_range_specified(ofconf.rule)) {
         (void)om_range_clear_range_rules();
@@ -640,6 +682,9 @@ om_monitor_update_flows(om_action_t type, json_t *js)
         ret = om_monitor_update_flows_parsed(type, &ofconf);
     }
 
+    // Apply this row's flows in a single batch
+    ret = om_flow_batch_flush() && ret;
+
     // Update the result in Openflow_State table so the cloud knows
     om_monitor_update_openflow_state( &ofconf, type, ret );
 
@@ -28,12 +28,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * Openflow Manager - openflow rules processing
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ev.h>
 
 #include "schema.h"
 #include "os.h"
+#include "os_time.h"
 #include "log.h"
+#include "kconfig.h"
 #include "target.h"
 #include "om.h"
 
@@ -41,48 +50,282 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MODULE_ID LOG_MODULE_ID_MAIN
 /*****************************************************************************/
 
-bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+struct om_flow_entry {
+    bool            add;
+    char            *bridge;
+    char            *rule;
+    char            *line;          /* Flow in ovs-ofctl add-flows syntax */
+    ds_dlist_node_t node;
+};
+
+static bool om_flow_batch_ofctl(const char *bridge, const char *path);
+
+static struct {
+    struct ev_loop              *loop;
+    ev_prepare                  prepare;
+    om_flow_batch_exec_t        exec;
+    ds_dlist_t                  queue;
+    struct om_flow_batch_stats  stats;
+} om_flow_batch = {
+    .exec   = om_flow_batch_ofctl,
+    .queue  = DS_DLIST_INIT(struct om_flow_entry, node),
+};
+
+/******************************************************************************
+ * Flow programming queue
+ *
+ * Flows added and deleted during an event loop iteration are queued, and
+ * applied per bridge with a single ovs-ofctl invocation once the iteration
+ * is done. Without an event loop, flows are applied right away.
+ *****************************************************************************/
+
+// Default batch executor, feeds the batch file to ovs-ofctl
+static bool
+om_flow_batch_ofctl(const char *bridge, const char *path)
 {
-    char    flow_entry[512];
-    bool    success = false;
+    char    cmd[512];
 
-    snprintf(flow_entry, sizeof( flow_entry ),
-             "ovs-ofctl add-flow %s \"table=%d,priority=%d%s%s,actions=%s\"",
-             ofconf->bridge, ofconf->table, ofconf->priority,
-             strlen(ofconf->rule) > 0 ? "," : "",
-             ofconf->rule, ofconf->action );
+    snprintf(cmd, sizeof(cmd), "ovs-ofctl%s add-flows %s %s",
+             kconfig_enabled(CONFIG_MANAGER_OM_FLOW_BUNDLE) ? " --bundle" : "",
+             bridge, path);
 
-    // Execute ovs-ofctl to add the flow
     // cmd_log returns 0 on success
-    success = (cmd_log(flow_entry) == 0);
-    if(!success) {
-        LOGE("Flow entry add failed: %s", flow_entry);
+    return (cmd_log(cmd) == 0);
+}
+
+static void
+om_flow_entry_free(struct om_flow_entry *entry)
+{
+    free(entry->bridge);
+    free(entry->rule);
+    free(entry->line);
+    free(entry);
+}
+
+// Applies the queued flows of first's bridge, or only first if single is set
+static bool
+om_flow_batch_exec(struct om_flow_entry *first, bool single, int *nflows)
+{
+    struct om_flow_entry    *entry;
+    char                    path[] = "/tmp/om_flows_XXXXXX";
+    FILE                    *stream;
+    bool                    ret;
+    int                     fd;
+
+    *nflows = 0;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        LOGE("Flow batch file creation failed: %s", strerror(errno));
+        return false;
+    }
+
+    stream = fdopen(fd, "w");
+    if (stream == NULL) {
+        LOGE("Flow batch file open failed: %s", strerror(errno));
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    for (entry = first; entry != NULL; entry = ds_dlist_next(&om_flow_batch.queue, entry)) {
+        if (strcmp(entry->bridge, first->bridge) != 0) {
+            continue;
+        }
+
+        fprintf(stream, "%s\n", entry->line);
+        (*nflows)++;
+
+        if (single) {
+            break;
+        }
     }
+    fclose(stream);
 
-    target_om_hook(TARGET_OM_POST_ADD, ofconf->rule); 
+    ret = om_flow_batch.exec(first->bridge, path);
+    unlink(path);
 
-    return success;
+    return ret;
 }
 
-bool om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+// Applies and dequeues the queued flows of first's bridge
+static bool
+om_flow_batch_apply_bridge(struct om_flow_entry *first)
 {
-    char    flow_entry[512];
-    bool    success = false;
+    struct om_flow_batch_stats  *stats = &om_flow_batch.stats;
+    struct om_flow_entry        *entry;
+    struct om_flow_entry        *next;
+    const char                  *bridge = first->bridge;
+    double                      start;
+    double                      latency;
+    bool                        batch_ok;
+    bool                        ret;
+    int                         nflows;
+    int                         n;
 
-    snprintf( flow_entry, sizeof( flow_entry ),
-              "ovs-ofctl del-flows %s \"table=%d,priority=%d%s%s\" --strict",
-              ofconf->bridge, ofconf->table, ofconf->priority,
-              strlen( ofconf->rule ) > 0 ? "," : "",
-              ofconf->rule );
+    start = clock_mono_double();
 
-    // Execute ovs-ofctl to del the flow
-    // cmd_log returns 0 on success
-    success = (cmd_log(flow_entry) == 0);
-    if(!success) {
-        LOGE("Flow entry del failed: %s", flow_entry);
+    batch_ok = om_flow_batch_exec(first, false, &nflows);
+    if (!batch_ok) {
+        /*
+         * The batch is rejected as a whole: apply its flows one by one, so
+         * that the valid ones still make it to the switch
+         */
+        LOGW("Flow batch of %d flows failed on %s, applying them one by one",
+             nflows, bridge);
+        stats->failures++;
+    }
+
+    ret = true;
+    for (entry = first; entry != NULL; entry = next) {
+        next = ds_dlist_next(&om_flow_batch.queue, entry);
+        if (strcmp(entry->bridge, bridge) != 0) {
+            continue;
+        }
+
+        if (!batch_ok && !om_flow_batch_exec(entry, true, &n)) {
+            LOGE("Flow entry %s failed: %s", entry->add ? "add" : "del", entry->line);
+            ret = false;
+        }
+
+        if (entry->add) {
+            stats->adds++;
+            target_om_hook(TARGET_OM_POST_ADD, entry->rule);
+        } else {
+            stats->dels++;
+            target_om_hook(TARGET_OM_POST_DEL, entry->rule);
+        }
+
+        // first holds the bridge name, it goes last
+        ds_dlist_remove(&om_flow_batch.queue, entry);
+        if (entry != first) {
+            om_flow_entry_free(entry);
+        }
+    }
+
+    latency = clock_mono_double() - start;
+
+    stats->batches++;
+    stats->flows += nflows;
+    stats->last_flows = nflows;
+    stats->last_latency = latency;
+    stats->total_latency += latency;
+    if (latency > stats->max_latency) {
+        stats->max_latency = latency;
     }
 
-    target_om_hook(TARGET_OM_POST_DEL, ofconf->rule);
+    LOGD("Applied %d flows to %s in %.1f ms (%" PRIu64 " batches, %" PRIu64 " flows, "
+         "%" PRIu64 " failed batches, max %.1f ms)", nflows, bridge, latency * 1000.0,
+         stats->batches, stats->flows, stats->failures, stats->max_latency * 1000.0);
+
+    om_flow_entry_free(first);
+    return ret;
+}
 
-    return success;
+static void
+om_flow_batch_prepare_cb(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+    (void)om_flow_batch_flush();
+}
+
+static bool
+om_flow_batch_queue(bool add, const struct schema_Openflow_Config *ofconf)
+{
+    struct om_flow_entry    *entry;
+    const char              *sep;
+    int                     len;
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        LOGE("Flow entry %s: memory allocation failed", add ? "add" : "del");
+        return false;
+    }
+
+    sep = (strlen(ofconf->rule) > 0) ? "," : "";
+    if (add) {
+        len = asprintf(&entry->line, "add table=%d,priority=%d%s%s,actions=%s",
+                       ofconf->table, ofconf->priority, sep, ofconf->rule, ofconf->action);
+    } else {
+        len = asprintf(&entry->line, "delete_strict table=%d,priority=%d%s%s",
+                       ofconf->table, ofconf->priority, sep, ofconf->rule);
+    }
+
+    entry->add = add;
+    entry->bridge = strdup(ofconf->bridge);
+    entry->rule = strdup(ofconf->rule);
+    if (len < 0 || entry->bridge == NULL || entry->rule == NULL) {
+        LOGE("Flow entry %s: memory allocation failed", add ? "add" : "del");
+        if (len < 0) {
+            entry->line = NULL;
+        }
+        om_flow_entry_free(entry);
+        return false;
+    }
+
+    ds_dlist_insert_tail(&om_flow_batch.queue, entry);
+
+    if (om_flow_batch.loop == NULL) {
+        return om_flow_batch_flush();
+    }
+
+    if (!ev_is_active(&om_flow_batch.prepare)) {
+        ev_prepare_start(om_flow_batch.loop, &om_flow_batch.prepare);
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+void
+om_flow_batch_init(struct ev_loop *loop, om_flow_batch_exec_t exec)
+{
+    om_flow_batch.loop = loop;
+    om_flow_batch.exec = (exec != NULL) ? exec : om_flow_batch_ofctl;
+    memset(&om_flow_batch.stats, 0, sizeof(om_flow_batch.stats));
+    ev_prepare_init(&om_flow_batch.prepare, om_flow_batch_prepare_cb);
+}
+
+void
+om_flow_batch_exit(void)
+{
+    (void)om_flow_batch_flush();
+    om_flow_batch.loop = NULL;
+    om_flow_batch.exec = om_flow_batch_ofctl;
+}
+
+// Applies the queued flows, returns false if any of them failed
+bool
+om_flow_batch_flush(void)
+{
+    struct om_flow_entry    *first;
+    bool                    ret = true;
+
+    if (om_flow_batch.loop != NULL) {
+        ev_prepare_stop(om_flow_batch.loop, &om_flow_batch.prepare);
+    }
+
+    while ((first = ds_dlist_head(&om_flow_batch.queue)) != NULL) {
+        ret = om_flow_batch_apply_bridge(first) && ret;
+    }
+
+    return ret;
+}
+
+const struct om_flow_batch_stats *
+om_flow_batch_get_stats(void)
+{
+    return &om_flow_batch.stats;
+}
+
+bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+{
+    return om_flow_batch_queue(true, ofconf);
+}
+
+bool om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+{
+    return om_flow_batch_queue(false, ofconf);
 }
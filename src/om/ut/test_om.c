@@ -26,8 +26,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ev.h>
 
 #include "log.h"
 #include "os.h"
@@ -77,6 +79,45 @@ print_rules_test(ds_list_t *range_rules)
     return;
 }
 
+/*
+ * Number of flows matched by the generated rules, from the masks of their
+ * range fields
+ */
+static uint64_t
+get_range_rules_coverage(ds_list_t *range_rules)
+{
+    struct om_rule_node *data;
+    uint64_t            coverage = 0;
+    uint64_t            flows;
+    char                rule[1024];
+    char                *field;
+    char                *mask;
+    char                *saveptr;
+    int                 width;
+    int                 bits;
+
+    ds_list_foreach(range_rules, data) {
+        flows = 1;
+        STRSCPY(rule, data->rule.rule);
+        for (field = strtok_r(rule, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr)) {
+            mask = strchr(field, '/');
+            if (mask == NULL) continue;
+
+            if (!strncmp(field, "tp_", 3)) {
+                width = 16;
+                bits  = __builtin_popcount(strtoul(mask + 1, NULL, 16));
+            } else {
+                width = !strncmp(field, "ipv6_", 5) ? 128 : 32;
+                bits  = atoi(mask + 1);
+            }
+            flows <<= (width - bits);
+        }
+        coverage += flows;
+    }
+
+    return coverage;
+}
+
 static bool
 pattern_is_in_rules(ds_list_t *list, char *rule)
 {
@@ -156,10 +197,16 @@ test_generate_port_range_rules(void)
     exists          = pattern_is_in_rules(list, "tcp,tp_src=1");
     TEST_ASSERT_TRUE(exists);
 
+    exists          = pattern_is_in_rules(list, "tcp,tp_src=0x0002/0xfffe,tp_dst=2");
+    TEST_ASSERT_TRUE(exists);
+
+    exists          = !pattern_is_in_rules(list, "tcp,tp_src=3");
+    TEST_ASSERT_TRUE(exists);
+
     ret = om_range_clear_range_rules();
     TEST_ASSERT_TRUE(ret);
 
-    TEST_ASSERT_EQUAL_INT(6, count);
+    TEST_ASSERT_EQUAL_INT(4, count);
 }
 
 static void
@@ -189,19 +236,19 @@ test_generate_ipv4_range_rules(void)
     exists          = pattern_is_in_rules(list, "nw_src=192.168.1.1");
     TEST_ASSERT_TRUE(exists);
      
-    exists          = pattern_is_in_rules(list, "nw_src=192.168.1.3");
+    exists          = pattern_is_in_rules(list, "nw_src=192.168.1.2/31");
     TEST_ASSERT_TRUE(exists);
 
-    exists          = pattern_is_in_rules(list, "nw_src=192.168.1.5");
+    exists          = pattern_is_in_rules(list, "nw_src=192.168.1.4/31");
     TEST_ASSERT_TRUE(exists);
 
-    exists          = !pattern_is_in_rules(list, "nw_src=192.168.1.6");
+    exists          = !pattern_is_in_rules(list, "nw_src=192.168.1.3");
     TEST_ASSERT_TRUE(exists);
 
     ret = om_range_clear_range_rules();
     TEST_ASSERT_TRUE(ret);
 
-    TEST_ASSERT_EQUAL_INT(5, count);
+    TEST_ASSERT_EQUAL_INT(3, count);
 }
 
 static void
@@ -233,12 +280,14 @@ test_generate_ipv6_range_rules(void)
     exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13e1");
     TEST_ASSERT_TRUE(exists);
      
-    exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13e3");
+    exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13e2/127");
     TEST_ASSERT_TRUE(exists);
 
-    exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13f4");
+    exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13f0/126");
     TEST_ASSERT_TRUE(exists);
 
+    exists          = pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13f4");
+    TEST_ASSERT_TRUE(exists);
 
     exists          = !pattern_is_in_rules(list, "ipv6_src=2a03:6300:1:103:219:5bff:fe31:13f5");
     TEST_ASSERT_TRUE(exists);
@@ -246,7 +295,183 @@ test_generate_ipv6_range_rules(void)
     ret = om_range_clear_range_rules();
     TEST_ASSERT_TRUE(ret);
 
-    TEST_ASSERT_EQUAL_INT(20, count);
+    TEST_ASSERT_EQUAL_INT(6, count);
+}
+
+/*
+ * Reports the number of flows generated for representative ranges, along
+ * with the number of flows a per value expansion would install
+ */
+static void
+test_range_flow_counts(void)
+{
+    struct schema_Openflow_Config conf;
+    ds_list_t   *range_rules = om_range_get_range_rules();
+    bool        ret;
+    int         count;
+    size_t      i;
+
+    struct {
+        char    *rule;
+        uint64_t expanded;
+        int      expected;
+    } ranges[] = {
+        { "tcp,tp_dst=$<80-80>", 1, 1 },
+        { "tcp,tp_dst=$<1024-65535>", 64512, 6 },
+        { "udp,tp_dst=$<1-65534>", 65534, 30 },
+        { "tcp,tp_src=$<0-65535>", 65536, 1 },
+        { "tcp,tp_dst=$<6881-6999>", 119, 8 },
+        { "ip,nw_src=$<192.168.1.0-192.168.1.255>", 256, 1 },
+        { "ip,nw_src=$<10.0.0.1-10.0.255.254>", 65534, 30 },
+        { "ip,nw_dst=$<0.0.0.0-255.255.255.255>", 4294967296ULL, 1 },
+        { "tcp,nw_src=$<192.168.1.10-192.168.1.20>,tp_dst=$<1024-65535>", 11 * 64512, 4 * 6 },
+        { "dl_type=0x86DD,ipv6_dst=$<fd00::-fd00::ffff:ffff>", 4294967296ULL, 1 },
+        { "dl_type=0x86DD,ipv6_dst=$<fd00::1-fd00::fffe>", 65534, 30 },
+    };
+
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        memset(&conf, 0, sizeof(conf));
+        STRSCPY(conf.bridge, "br-home");
+        STRSCPY(conf.token, "12345");
+        STRSCPY(conf.action, "normal");
+        STRSCPY(conf.rule, ranges[i].rule);
+
+        ret   = om_range_generate_range_rules(&conf);
+        count = get_range_rules_len(range_rules);
+
+        LOGI("%s: %d flows (%" PRIu64 " without masking)", ranges[i].rule, count, ranges[i].expanded);
+
+        TEST_ASSERT_TRUE(ret);
+        TEST_ASSERT_EQUAL_INT(ranges[i].expected, count);
+        TEST_ASSERT_EQUAL_UINT64(ranges[i].expanded, get_range_rules_coverage(range_rules));
+
+        ret = om_range_clear_range_rules();
+        TEST_ASSERT_TRUE(ret);
+    }
+}
+
+/*
+ * Stub switch: keeps a flow table of the flows it was given, and rejects a
+ * whole batch when it contains an unknown field
+ */
+static struct {
+    char    flows[256][256];
+    int     nflows;
+    int     execs;
+} stub_switch;
+
+static bool
+stub_switch_exec(const char *bridge, const char *path)
+{
+    char    lines[256][256];
+    char    *match;
+    int     nlines = 0;
+    int     i, j;
+    FILE    *stream;
+
+    stub_switch.execs++;
+
+    stream = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(stream);
+    while (nlines < 256 && fgets(lines[nlines], sizeof(lines[nlines]), stream)) {
+        lines[nlines][strcspn(lines[nlines], "\n")] = '\0';
+        if (strstr(lines[nlines], "bad_field") != NULL) {
+            fclose(stream);
+            return false;
+        }
+        nlines++;
+    }
+    fclose(stream);
+
+    for (i = 0; i < nlines; i++) {
+        if (strncmp(lines[i], "add ", 4) == 0) {
+            match = lines[i] + 4;
+            *strstr(match, ",actions=") = '\0';
+            TEST_ASSERT_TRUE(stub_switch.nflows < 256);
+            STRSCPY(stub_switch.flows[stub_switch.nflows++], match);
+            continue;
+        }
+
+        TEST_ASSERT_EQUAL_INT(0, strncmp(lines[i], "delete_strict ", 14));
+        match = lines[i] + 14;
+        for (j = 0; j < stub_switch.nflows; j++) {
+            if (strcmp(stub_switch.flows[j], match) == 0) {
+                memmove(stub_switch.flows[j], stub_switch.flows[j + 1],
+                        (stub_switch.nflows - j - 1) * sizeof(stub_switch.flows[0]));
+                stub_switch.nflows--;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void
+test_flow_batch(void)
+{
+    const struct om_flow_batch_stats    *stats;
+    struct ev_loop                      *loop = EV_DEFAULT;
+    int                                 i;
+
+    struct schema_Openflow_Config conf = {
+            .table = 0,
+            .bridge = "br-home",
+            .priority = 100,
+            .action = "normal",
+            .token = "12345",
+    };
+
+    memset(&stub_switch, 0, sizeof(stub_switch));
+    om_flow_batch_init(loop, stub_switch_exec);
+    stats = om_flow_batch_get_stats();
+
+    // Flows are queued until the loop iteration is done
+    for (i = 0; i < 100; i++) {
+        snprintf(conf.rule, sizeof(conf.rule), "tcp,tp_dst=%d", 1000 + i);
+        TEST_ASSERT_TRUE(om_add_flow(conf.token, &conf));
+    }
+    TEST_ASSERT_EQUAL_INT(0, stub_switch.execs);
+
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_INT(1, stub_switch.execs);
+    TEST_ASSERT_EQUAL_INT(100, stub_switch.nflows);
+    TEST_ASSERT_TRUE(strcmp(stub_switch.flows[0], "table=0,priority=100,tcp,tp_dst=1000") == 0);
+    TEST_ASSERT_EQUAL_INT(1, stats->batches);
+    TEST_ASSERT_EQUAL_INT(100, stats->last_flows);
+
+    // Deletes and adds share the batch, in order
+    for (i = 0; i < 50; i++) {
+        snprintf(conf.rule, sizeof(conf.rule), "tcp,tp_dst=%d", 1000 + i);
+        TEST_ASSERT_TRUE(om_del_flow(conf.token, &conf));
+    }
+    for (i = 0; i < 10; i++) {
+        snprintf(conf.rule, sizeof(conf.rule), "udp,tp_dst=%d", 2000 + i);
+        TEST_ASSERT_TRUE(om_add_flow(conf.token, &conf));
+    }
+    TEST_ASSERT_TRUE(om_flow_batch_flush());
+    TEST_ASSERT_EQUAL_INT(2, stub_switch.execs);
+    TEST_ASSERT_EQUAL_INT(60, stub_switch.nflows);
+    TEST_ASSERT_EQUAL_INT(60, stats->last_flows);
+
+    // A rejected batch is applied flow by flow
+    for (i = 0; i < 4; i++) {
+        snprintf(conf.rule, sizeof(conf.rule), "%s,tp_dst=%d", (i == 2) ? "bad_field" : "udp", 3000 + i);
+        TEST_ASSERT_TRUE(om_add_flow(conf.token, &conf));
+    }
+    ev_run(loop, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_INT(2 + 1 + 4, stub_switch.execs);
+    TEST_ASSERT_EQUAL_INT(63, stub_switch.nflows);
+    TEST_ASSERT_EQUAL_INT(1, stats->failures);
+    TEST_ASSERT_EQUAL_INT(3, stats->batches);
+    TEST_ASSERT_EQUAL_INT(164, stats->flows);
+    TEST_ASSERT_EQUAL_INT(114, stats->adds);
+    TEST_ASSERT_EQUAL_INT(50, stats->dels);
+
+    LOGI("Flow batches: %" PRIu64 ", flows: %" PRIu64 ", max latency: %.3f ms",
+         stats->batches, stats->flows, stats->max_latency * 1000.0);
+
+    om_flow_batch_exit();
 }
 
 int main(int argc, char *argv[])
@@ -267,6 +492,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_generate_port_range_rules);
     RUN_TEST(test_generate_ipv4_range_rules);
     RUN_TEST(test_generate_ipv6_range_rules);
+    RUN_TEST(test_range_flow_counts);
+    RUN_TEST(test_flow_batch);
 
     return UNITY_END();
 }
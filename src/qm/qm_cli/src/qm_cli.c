@@ -138,6 +138,9 @@ void cli_print_res(qm_response_t *res)
     PR(qdrop);
     PR(log_size);
     PR(log_drop);
+    PR(spool_len);
+    PR(spool_size);
+    PR(spool_drop);
 #undef PR
 }
 
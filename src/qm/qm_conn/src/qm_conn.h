@@ -87,7 +87,7 @@ typedef struct qm_request
 // response
 
 #define QM_RESPONSE_TAG "RESP"
-#define QM_RESPONSE_VER 1
+#define QM_RESPONSE_VER 2
 
 enum qm_response_type
 {
@@ -131,6 +131,9 @@ typedef struct qm_response
     uint32_t qdrop; // num queued messages dropped due to queue full
     uint32_t log_size; // log buffer size
     uint32_t log_drop; // log dropped lines
+    uint32_t spool_len;  // messages held in the persistent spool
+    uint32_t spool_size; // bytes held in the persistent spool
+    uint32_t spool_drop; // spooled messages dropped due to spool full
 } qm_response_t;
 
 char *qm_data_type_str(enum qm_req_data_type type);
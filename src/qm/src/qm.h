@@ -27,6 +27,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef QM_H_INCLUDED
 #define QM_H_INCLUDED
 
+#include <string.h>
+
 #include "ev.h"
 
 #include "schema.h"
@@ -92,6 +94,37 @@ bool qm_queue_get(qm_item_t **qitem);
 
 bool qm_event_init();
 
+// persistent spool
+
+typedef struct qm_spool_stats
+{
+    int depth;      // messages held in the spool
+    int bytes;      // bytes held in the spool
+    int segments;   // number of segment files
+    int drops;      // messages dropped because the spool was full
+    int replayed;   // messages published from the spool
+} qm_spool_stats_t;
+
+typedef bool qm_spool_publish_t(qm_item_t *qi, int *mid);
+
+#ifdef CONFIG_QM_USE_SPOOL
+bool qm_spool_init(void);
+void qm_spool_fini(void);
+bool qm_spool_put(qm_item_t *qi);
+void qm_spool_save_queue(void);
+bool qm_spool_replay(qm_spool_publish_t *publish);
+void qm_spool_publish_ack(int mid);
+void qm_spool_get_stats(qm_spool_stats_t *stats);
+#else
+static inline bool qm_spool_init(void) { return true; }
+static inline void qm_spool_fini(void) { }
+static inline bool qm_spool_put(qm_item_t *qi) { return false; }
+static inline void qm_spool_save_queue(void) { }
+static inline bool qm_spool_replay(qm_spool_publish_t *publish) { return true; }
+static inline void qm_spool_publish_ack(int mid) { }
+static inline void qm_spool_get_stats(qm_spool_stats_t *stats) { memset(stats, 0, sizeof(*stats)); }
+#endif
+
 // Time-event logs collector and report generator
 void mqtt_telog_init(struct ev_loop *ev);
 void mqtt_telog_fini(void);
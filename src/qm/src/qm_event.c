@@ -60,6 +60,8 @@ qm_async_ctx_t g_qm_async[QM_MAX_CTX];
 
 void qm_res_status(qm_response_t *res)
 {
+    qm_spool_stats_t spool;
+
     res->qlen = qm_queue_length();
     res->qsize = qm_queue_size();
     if (!qm_mqtt_config_valid()) {
@@ -73,6 +75,10 @@ void qm_res_status(qm_response_t *res)
     }
     res->log_size = g_qm_log_buf_size;
     res->log_drop = g_qm_log_drop_count;
+    qm_spool_get_stats(&spool);
+    res->spool_len = spool.depth;
+    res->spool_size = spool.bytes;
+    res->spool_drop = spool.drops;
 }
 
 void qm_enqueue_and_reply(int fd, qm_item_t *qi)
@@ -107,6 +107,10 @@ int main(int argc, char ** argv)
 
     // exit:
 
+    // keep whatever was not published yet for the next run
+    qm_spool_save_queue();
+    qm_spool_fini();
+
     qm_mqtt_stop();
 
     target_close(TARGET_INIT_MGR_QM, loop);
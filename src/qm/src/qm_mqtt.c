@@ -36,7 +36,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "osp_unit.h"
 #include "log.h"
 #include "ds_dlist.h"
-#include "opensync_stats.pb-c.h"
 
 #include "qm.h"
 
@@ -176,7 +175,7 @@ void qm_mqtt_stop(void)
     LOG(NOTICE, "Closing MQTT connection.");
 }
 
-bool qm_mqtt_publish(mosqev_t *mqtt, qm_item_t *qi)
+static bool qm_mqtt_publish_mid(mosqev_t *mqtt, qm_item_t *qi, int *mid)
 {
     long mlen = qi->size;
     void *mbuf = qi->buf;
@@ -227,12 +226,29 @@ bool qm_mqtt_publish(mosqev_t *mqtt, qm_item_t *qi)
         mbuf = buf;
     }
     LOGI("MQTT: Publishing %ld bytes", mlen);
-    ret = mosqev_publish(mqtt, NULL, topic, mlen, mbuf, qos, false);
+    ret = mosqev_publish(mqtt, mid, topic, mlen, mbuf, qos, false);
 exit:
     if (buf) free(buf);
     return ret;
 }
 
+bool qm_mqtt_publish(mosqev_t *mqtt, qm_item_t *qi)
+{
+    return qm_mqtt_publish_mid(mqtt, qi, NULL);
+}
+
+static bool qm_mqtt_publish_spooled(qm_item_t *qi, int *mid)
+{
+    return qm_mqtt_publish_mid(&qm_mqtt, qi, mid);
+}
+
+static void qm_mqtt_publish_cbk(mosqev_t *mqtt, void *data, int mid)
+{
+    (void)mqtt;
+    (void)data;
+    qm_spool_publish_ack(mid);
+}
+
 bool qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res)
 {
     bool result;
@@ -248,89 +264,131 @@ bool qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res)
     return result;
 }
 
-void qm_append_report(qm_item_t *qi, qm_item_t *rep)
+/*
+ * Encoded protobuf messages can be merged by concatenation: repeated fields
+ * of the second message are appended to the first one's. Stats reports are
+ * merged this way, without decoding the per-item stats. Only the singular
+ * Report.nodeID field is kept from the first report.
+ */
+#define QM_REPORT_NODE_ID_FIELD 1
+
+/**
+ * @brief parse a base 128 varint
+ *
+ * @param buf the encoded buffer
+ * @param size the buffer size
+ * @param off the varint offset, advanced past the varint
+ * @param value the decoded value
+ * @return true if a valid varint was parsed, false otherwise
+ */
+static bool qm_report_parse_varint(const uint8_t *buf, size_t size, size_t *off, uint64_t *value)
 {
-    Sts__Report *rqi = NULL;
-    Sts__Report *rpt = NULL;
-    int          num;
+    unsigned shift;
+    uint8_t b;
 
-    // have stats, unpack
-    rqi = sts__report__unpack(NULL, qi->size, qi->buf);
-    if (!rqi) {
-        // decode failed
-        goto out;
+    *value = 0;
+    for (shift = 0; shift < 64; shift += 7)
+    {
+        if (*off >= size) return false;
+        b = buf[(*off)++];
+        *value |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
     }
+    return false;
+}
 
-    // first reprot
-    if (rep->size == 0) {
-        rpt = rqi;
-        rqi = NULL;
+/**
+ * @brief delimit the next top level field of an encoded report
+ *
+ * @param buf the encoded report
+ * @param size the report size
+ * @param off the field offset, advanced to the next field
+ * @param field the field number
+ * @return true if the field is well formed, false otherwise
+ */
+static bool qm_report_next_field(const uint8_t *buf, size_t size, size_t *off, uint32_t *field)
+{
+    uint64_t key;
+    uint64_t len;
 
-        goto first;
-    }
+    if (!qm_report_parse_varint(buf, size, off, &key)) return false;
+    *field = key >> 3;
+    if (*field == 0) return false;
 
-    rpt = sts__report__unpack(NULL, rep->size, rep->buf);
-    if (!rpt) {
-        goto out;
+    switch (key & 0x7)
+    {
+        case 0: // varint
+            return qm_report_parse_varint(buf, size, off, &len);
+        case 1: // 64-bit
+            len = 8;
+            break;
+        case 2: // length-delimited
+            if (!qm_report_parse_varint(buf, size, off, &len)) return false;
+            break;
+        case 5: // 32-bit
+            len = 4;
+            break;
+        default:
+            return false;
     }
+    if (len > size - *off) return false;
+    *off += len;
+    return true;
+}
 
-#define APPEND(_name, _type) do {\
-        num = rpt->n_##_name;  \
-        rpt->n_##_name += rqi->n_##_name; \
-        rpt->_name = \
-            realloc(rpt->_name, \
-                    rpt->n_##_name * sizeof(Sts__##_type*)); \
-        memcpy (&rpt->_name[num], \
-                rqi->_name, \
-                rqi->n_##_name * sizeof(Sts__##_type*)); \
-        memset(rqi->_name, \
-               0, \
-               rqi->n_##_name * sizeof(Sts__##_type*)); \
-    } while (0)
-
-    // append messages
-    if (rqi->survey) {
-        APPEND(survey, Survey);
-    }
-    if (rqi->neighbors) {
-        APPEND(neighbors, Neighbor);
-    }
-    if (rqi->capacity) {
-        APPEND(capacity, Capacity);
-    }
-    if (rqi->clients) {
-        APPEND(clients, ClientReport);
-    }
-    if (rqi->device) {
-        APPEND(device, Device);
+/**
+ * @brief append an encoded stats report to the merged report
+ *
+ * rep->buf must have room for qi->size more bytes.
+ * A malformed report is skipped.
+ *
+ * @param qi the queued report
+ * @param rep the merged report
+ * @return true if the report was appended, false otherwise
+ */
+bool qm_append_report(qm_item_t *qi, qm_item_t *rep)
+{
+    const uint8_t *buf = qi->buf;
+    uint8_t *dst = rep->buf;
+    bool has_node_id = false;
+    uint32_t field;
+    size_t start;
+    size_t off;
+
+    // validate the report before touching the merged one
+    off = 0;
+    while (off < qi->size)
+    {
+        if (!qm_report_next_field(buf, qi->size, &off, &field)) {
+            LOGE("merge reports: skipping malformed report (%zd bytes)", qi->size);
+            return false;
+        }
+        if (field == QM_REPORT_NODE_ID_FIELD) has_node_id = true;
     }
-    if (rqi->rssi_report) {
-        APPEND(rssi_report, RssiReport);
+    if (!has_node_id) {
+        LOGE("merge reports: skipping report without node id");
+        return false;
     }
-    if (rqi->bs_report) {
-        APPEND(bs_report, BSReport);
+
+    // first report
+    if (rep->size == 0) {
+        memcpy(dst, buf, qi->size);
+        rep->size = qi->size;
+        return true;
     }
-#undef APPEND
 
-first:
+    // append all but the node id
+    off = 0;
+    while (off < qi->size)
     {
-        // pack new message
-        int size = sts__report__get_packed_size(rpt);
-        void *buf = malloc(size);
-        if (!buf) goto out;
-        size = sts__report__pack(rpt, buf);
-        LOGI("merged reports stats %zd + %zd = %d", rep->size, qi->size, size);
-
-        // replace message
-        if(rep->buf) free(rep->buf);
-        rep->buf = buf;
-        rep->size = size;
-    }
-
-out:
-    // cleanup
-    if (rpt) sts__report__free_unpacked(rpt, NULL);
-    if (rqi) sts__report__free_unpacked(rqi, NULL);
+        start = off;
+        qm_report_next_field(buf, qi->size, &off, &field);
+        if (field == QM_REPORT_NODE_ID_FIELD) continue;
+        memcpy(dst + rep->size, buf + start, off - start);
+        rep->size += off - start;
+    }
+    LOGD("merged reports stats + %zd = %zd", qi->size, rep->size);
+    return true;
 }
 
 // merge STATS to a single report
@@ -338,6 +396,21 @@ void qm_queue_merge_stats(qm_item_t *rep)
 {
     qm_item_t *qi = NULL;
     qm_item_t *next = NULL;
+    size_t total = 0;
+    int count = 0;
+
+    // the merged report is at most as big as the queued ones together
+    ds_dlist_foreach(&g_qm_queue.queue, qi)
+    {
+        if (qi->req.data_type == QM_DATA_STATS) total += qi->size;
+    }
+    if (total == 0) return;
+
+    rep->buf = malloc(total);
+    if (!rep->buf) {
+        LOGE("merge reports: allocate %zd bytes: out of mem.", total);
+        return;
+    }
 
     for (qi = ds_dlist_head(&g_qm_queue.queue); qi != NULL; qi = next)
     {
@@ -345,10 +418,17 @@ void qm_queue_merge_stats(qm_item_t *rep)
         //LOGT("t:%d s:%d\n", qi->req.data_type, (int)qi->size);
         if (qi->req.data_type == QM_DATA_STATS)
         {
-            qm_append_report(qi, rep);
+            if (qm_append_report(qi, rep)) count++;
             qm_queue_remove(qi);
         }
     }
+
+    if (rep->size == 0) {
+        free(rep->buf);
+        rep->buf = NULL;
+        return;
+    }
+    LOGI("merged %d reports stats = %zd", count, rep->size);
 }
 
 void qm_mqtt_publish_queue()
@@ -361,6 +441,11 @@ void qm_mqtt_publish_queue()
     qm_item_t *qi = NULL;
     qm_item_t *next = NULL;
 
+    // spooled messages are older than anything in the queue
+    if (!qm_spool_replay(qm_mqtt_publish_spooled)) {
+        return;
+    }
+
     memset(&rep, 0, sizeof(rep));
     qm_queue_merge_stats(&rep);
     // publish merged reports
@@ -435,6 +520,8 @@ void qm_mqtt_send_queue()
     // Do not report any stats if we're not connected
     if (!qm_mqtt_is_connected())
     {
+        // keep the queued messages across the outage
+        qm_spool_save_queue();
         return;
     }
 
@@ -559,6 +646,9 @@ bool qm_mqtt_init(void)
     /* Initialize logging */
     mosqev_log_cbk_set(&qm_mqtt, qm_mqtt_log);
 
+    /* Spool segments are released once their messages are published */
+    mosqev_publish_cbk_set(&qm_mqtt, qm_mqtt_publish_cbk);
+
     qm_mosqev_init = true;
 
     // publish timer
@@ -64,6 +64,7 @@ void qm_queue_item_free(qm_item_t *qi)
 void qm_queue_init()
 {
     ds_dlist_init(&g_qm_queue.queue, qm_item_t, qnode);
+    qm_spool_init();
 }
 
 int qm_queue_length()
@@ -109,6 +110,8 @@ bool qm_queue_drop_head()
 
 bool qm_queue_make_room(qm_item_t *qi, qm_response_t *res)
 {
+    qm_item_t *head;
+
     if (qi->size > QM_MAX_QUEUE_SIZE_BYTES) {
         // message too big to fit in queue
         return false;
@@ -116,8 +119,12 @@ bool qm_queue_make_room(qm_item_t *qi, qm_response_t *res)
     while (g_qm_queue.length >= QM_MAX_QUEUE_DEPTH
             || g_qm_queue.size + qi->size > QM_MAX_QUEUE_SIZE_BYTES)
     {
-        qm_queue_drop_head();
-        res->qdrop++;
+        if (!qm_queue_head(&head)) break;
+        // move the oldest message to the spool, drop it if there's none
+        if (!qm_spool_put(head)) {
+            res->qdrop++;
+        }
+        qm_queue_remove(head);
     }
     return true;
 }
@@ -0,0 +1,639 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+ * Persistent spool for the QM message queue
+ *
+ * Messages that can not be published -- the broker is unreachable or the
+ * in-memory queue overflows -- are moved to append-only segment files in
+ * CONFIG_QM_SPOOL_PATH instead of being dropped. When the connection is
+ * back, segments are replayed oldest first, before the in-memory queue, so
+ * the cloud receives messages in the order they were queued. A segment file
+ * is removed once the publish of each of its messages has been acknowledged.
+ *
+ * To limit flash wear, records are collected in memory and written to the
+ * current segment with a single write and fdatasync per publish interval
+ * (or when the segment fills up), never per message. The spool is bounded
+ * by CONFIG_QM_SPOOL_MAX_SIZE; the oldest segment is discarded when full.
+ *
+ * Delivery from the spool is at-least-once: segments replayed right before
+ * a disconnect, or a restart, are replayed again.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "ds_dlist.h"
+#include "log.h"
+#include "qm.h"
+
+#define QM_SPOOL_MAGIC          0x514d5350      /* "QMSP" */
+#define QM_SPOOL_SEG_PREFIX     "qm_"
+#define QM_SPOOL_SEG_SUFFIX     ".seg"
+#define QM_SPOOL_MAX_BYTES      ((size_t)CONFIG_QM_SPOOL_MAX_SIZE * 1024)
+#define QM_SPOOL_SEG_BYTES      ((size_t)CONFIG_QM_SPOOL_SEGMENT_SIZE * 1024)
+
+/*
+ * On-storage record: the header is followed by the NUL terminated topic and
+ * the message payload. The checksum covers topic and payload and catches
+ * records torn by a power loss in the middle of a write.
+ */
+typedef struct qm_spool_rec
+{
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t topic_len;         // including the terminating NUL
+    uint32_t size;
+    qm_request_t req;
+} qm_spool_rec_t;
+
+typedef struct qm_spool_seg
+{
+    uint32_t seq;
+    size_t size;                // bytes, including records not yet written
+    int count;                  // number of records
+    bool inflight;              // replayed, waiting for publish acks
+    int replayed;               // records published by the last replay
+    int acked;                  // publish acks received since the last replay
+    int first_mid;
+    int last_mid;
+    ds_dlist_node_t node;
+} qm_spool_seg_t;
+
+static struct
+{
+    bool initialized;
+    ds_dlist_t segs;            // oldest first
+    qm_spool_seg_t *wseg;       // segment new records are appended to
+    qm_spool_seg_t *replay_seg; // segment being replayed
+    uint8_t *wbuf;              // records not yet written to wseg
+    size_t wbuf_len;
+    int wbuf_count;
+    uint32_t next_seq;
+    qm_spool_stats_t stats;
+} g_qm_spool;
+
+static void qm_spool_seg_path(uint32_t seq, char *path, size_t len)
+{
+    snprintf(path, len, "%s/" QM_SPOOL_SEG_PREFIX "%08u" QM_SPOOL_SEG_SUFFIX,
+            CONFIG_QM_SPOOL_PATH, seq);
+}
+
+static qm_spool_seg_t *qm_spool_seg_new(uint32_t seq)
+{
+    qm_spool_seg_t *seg;
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL) return NULL;
+    seg->seq = seq;
+    g_qm_spool.stats.segments++;
+    return seg;
+}
+
+static void qm_spool_seg_remove(qm_spool_seg_t *seg)
+{
+    char path[256];
+
+    qm_spool_seg_path(seg->seq, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) {
+        LOGE("%s: unlink %s: %s", __func__, path, strerror(errno));
+    }
+    if (seg == g_qm_spool.wseg) {
+        // records not written yet go away with the segment
+        free(g_qm_spool.wbuf);
+        g_qm_spool.wbuf = NULL;
+        g_qm_spool.wbuf_len = 0;
+        g_qm_spool.wbuf_count = 0;
+        g_qm_spool.wseg = NULL;
+    }
+    if (seg == g_qm_spool.replay_seg) g_qm_spool.replay_seg = NULL;
+    g_qm_spool.stats.depth -= seg->count;
+    g_qm_spool.stats.bytes -= seg->size;
+    g_qm_spool.stats.segments--;
+    ds_dlist_remove(&g_qm_spool.segs, seg);
+    free(seg);
+}
+
+static bool qm_spool_write_all(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t rc;
+
+    while (len > 0) {
+        rc = write(fd, buf, len);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+/**
+ * @brief read a whole segment file
+ *
+ * @param seg the segment
+ * @param len returns the number of bytes read
+ * @return a buffer to be freed by the caller, NULL on error
+ */
+static uint8_t *qm_spool_seg_read(qm_spool_seg_t *seg, size_t *len)
+{
+    char path[256];
+    struct stat st;
+    uint8_t *buf = NULL;
+    size_t off = 0;
+    ssize_t rc;
+    int fd;
+
+    qm_spool_seg_path(seg->seq, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("%s: open %s: %s", __func__, path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) goto err_close;
+
+    // allocate at least one byte so an empty segment is not an error
+    buf = malloc(st.st_size + 1);
+    if (buf == NULL) goto err_close;
+
+    while (off < (size_t)st.st_size) {
+        rc = read(fd, buf + off, st.st_size - off);
+        if (rc < 0 && errno == EINTR) continue;
+        if (rc <= 0) break;
+        off += rc;
+    }
+    close(fd);
+    *len = off;
+    return buf;
+
+err_close:
+    LOGE("%s: read %s: %s", __func__, path, strerror(errno));
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+/**
+ * @brief parse the record at *off
+ *
+ * On success qi references the topic and payload in buf and *off is moved
+ * past the record.
+ *
+ * @return false at the end of the buffer or on a truncated or corrupt record
+ */
+static bool qm_spool_rec_parse(uint8_t *buf, size_t len, size_t *off, qm_item_t *qi)
+{
+    qm_spool_rec_t rec;
+    uint8_t *topic;
+    uint8_t *data;
+    uint32_t crc;
+
+    if (len - *off < sizeof(rec)) return false;
+    memcpy(&rec, buf + *off, sizeof(rec));
+    if (rec.magic != QM_SPOOL_MAGIC) return false;
+    if (rec.topic_len == 0) return false;
+    if (rec.topic_len > len - *off - sizeof(rec)) return false;
+    if (rec.size > len - *off - sizeof(rec) - rec.topic_len) return false;
+
+    topic = buf + *off + sizeof(rec);
+    data = topic + rec.topic_len;
+    if (topic[rec.topic_len - 1] != '\0') return false;
+
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, topic, rec.topic_len);
+    crc = crc32(crc, data, rec.size);
+    if (crc != rec.crc) return false;
+
+    memset(qi, 0, sizeof(*qi));
+    qi->req = rec.req;
+    qi->topic = rec.topic_len > 1 ? (char *)topic : NULL;
+    qi->size = rec.size;
+    qi->buf = data;
+
+    *off += sizeof(rec) + rec.topic_len + rec.size;
+    return true;
+}
+
+/**
+ * @brief write the buffered records to the current segment
+ *
+ * The whole batch is written with one write() and one fdatasync(). A full
+ * segment is closed, further records start a new one.
+ */
+static bool qm_spool_flush(void)
+{
+    qm_spool_seg_t *seg = g_qm_spool.wseg;
+    char path[256];
+    bool ok = false;
+    int fd;
+
+    if (seg == NULL || g_qm_spool.wbuf_len == 0) return true;
+
+    qm_spool_seg_path(seg->seq, path, sizeof(path));
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) {
+        LOGE("%s: open %s: %s", __func__, path, strerror(errno));
+    } else {
+        ok = qm_spool_write_all(fd, g_qm_spool.wbuf, g_qm_spool.wbuf_len)
+                && fdatasync(fd) == 0;
+        if (!ok) {
+            LOGE("%s: write %s: %s", __func__, path, strerror(errno));
+            // cut off a partial write
+            if (ftruncate(fd, seg->size - g_qm_spool.wbuf_len) != 0) {
+                LOGE("%s: truncate %s: %s", __func__, path, strerror(errno));
+            }
+        }
+        close(fd);
+    }
+
+    if (!ok) {
+        // the batch is lost, account for it as dropped
+        seg->size -= g_qm_spool.wbuf_len;
+        seg->count -= g_qm_spool.wbuf_count;
+        g_qm_spool.stats.bytes -= g_qm_spool.wbuf_len;
+        g_qm_spool.stats.depth -= g_qm_spool.wbuf_count;
+        g_qm_spool.stats.drops += g_qm_spool.wbuf_count;
+    }
+
+    free(g_qm_spool.wbuf);
+    g_qm_spool.wbuf = NULL;
+    g_qm_spool.wbuf_len = 0;
+    g_qm_spool.wbuf_count = 0;
+
+    if (seg->count == 0) {
+        qm_spool_seg_remove(seg);
+    } else if (seg->size >= QM_SPOOL_SEG_BYTES) {
+        g_qm_spool.wseg = NULL;
+    }
+    return ok;
+}
+
+/**
+ * @brief discard the oldest segments until len more bytes fit in the spool
+ */
+static bool qm_spool_make_room(size_t len)
+{
+    qm_spool_seg_t *seg;
+
+    if (len > QM_SPOOL_MAX_BYTES) return false;
+
+    while (g_qm_spool.stats.bytes + len > QM_SPOOL_MAX_BYTES) {
+        seg = ds_dlist_head(&g_qm_spool.segs);
+        if (seg == NULL) break;
+        // segments in flight were already published
+        if (!seg->inflight) {
+            LOGW("%s: spool full, dropping %d messages", __func__, seg->count);
+            g_qm_spool.stats.drops += seg->count;
+        }
+        qm_spool_seg_remove(seg);
+    }
+    return true;
+}
+
+bool qm_spool_put(qm_item_t *qi)
+{
+    const char *topic = qi->topic ? qi->topic : "";
+    qm_spool_seg_t *seg = g_qm_spool.wseg;
+    qm_spool_rec_t rec;
+    uint8_t *wbuf;
+    size_t len;
+    uint8_t *p;
+
+    if (!g_qm_spool.initialized) return false;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = QM_SPOOL_MAGIC;
+    rec.topic_len = strlen(topic) + 1;
+    rec.size = qi->size;
+    rec.req = qi->req;
+    len = sizeof(rec) + rec.topic_len + rec.size;
+
+    // start a new segment if the record does not fit in the current one
+    if (seg != NULL && seg->size > 0 && seg->size + len > QM_SPOOL_SEG_BYTES) {
+        qm_spool_flush();
+        g_qm_spool.wseg = NULL;
+    }
+
+    if (!qm_spool_make_room(len)) {
+        LOGW("%s: message too big (%zu bytes), dropping", __func__, len);
+        g_qm_spool.stats.drops++;
+        return false;
+    }
+
+    wbuf = realloc(g_qm_spool.wbuf, g_qm_spool.wbuf_len + len);
+    if (wbuf == NULL) {
+        LOGE("%s: out of memory", __func__);
+        g_qm_spool.stats.drops++;
+        return false;
+    }
+    g_qm_spool.wbuf = wbuf;
+
+    if (g_qm_spool.wseg == NULL) {
+        seg = qm_spool_seg_new(g_qm_spool.next_seq++);
+        if (seg == NULL) {
+            LOGE("%s: out of memory", __func__);
+            g_qm_spool.stats.drops++;
+            return false;
+        }
+        ds_dlist_insert_tail(&g_qm_spool.segs, seg);
+        g_qm_spool.wseg = seg;
+    }
+    seg = g_qm_spool.wseg;
+
+    rec.crc = crc32(0L, Z_NULL, 0);
+    rec.crc = crc32(rec.crc, (const uint8_t *)topic, rec.topic_len);
+    rec.crc = crc32(rec.crc, qi->buf, rec.size);
+
+    p = g_qm_spool.wbuf + g_qm_spool.wbuf_len;
+    memcpy(p, &rec, sizeof(rec));
+    memcpy(p + sizeof(rec), topic, rec.topic_len);
+    if (rec.size > 0) memcpy(p + sizeof(rec) + rec.topic_len, qi->buf, rec.size);
+
+    g_qm_spool.wbuf_len += len;
+    g_qm_spool.wbuf_count++;
+    seg->size += len;
+    seg->count++;
+    g_qm_spool.stats.depth++;
+    g_qm_spool.stats.bytes += len;
+
+    // bound the memory held by not yet written records
+    if (g_qm_spool.wbuf_len >= QM_SPOOL_SEG_BYTES) qm_spool_flush();
+
+    return true;
+}
+
+void qm_spool_save_queue(void)
+{
+    qm_spool_seg_t *seg;
+    qm_item_t *next;
+    qm_item_t *qi;
+    int n = 0;
+
+    if (!g_qm_spool.initialized) return;
+
+    for (qi = ds_dlist_head(&g_qm_queue.queue); qi != NULL; qi = next) {
+        next = ds_dlist_next(&g_qm_queue.queue, qi);
+        if (!qm_spool_put(qi)) continue;
+        qm_queue_remove(qi);
+        n++;
+    }
+    qm_spool_flush();
+
+    // messages replayed before the connection dropped may have been lost
+    ds_dlist_foreach(&g_qm_spool.segs, seg) {
+        seg->inflight = false;
+        seg->acked = 0;
+    }
+
+    if (n > 0) {
+        LOGI("%s: spooled %d messages, spool: %d messages %d bytes %d segments, %d dropped",
+                __func__, n, g_qm_spool.stats.depth, g_qm_spool.stats.bytes,
+                g_qm_spool.stats.segments, g_qm_spool.stats.drops);
+    }
+}
+
+static bool qm_spool_mid_in_range(int mid, int first, int last)
+{
+    // message ids wrap around
+    if (first <= last) return mid >= first && mid <= last;
+    return mid >= first || mid <= last;
+}
+
+void qm_spool_publish_ack(int mid)
+{
+    qm_spool_seg_t *seg;
+
+    if (!g_qm_spool.initialized) return;
+
+    ds_dlist_foreach(&g_qm_spool.segs, seg) {
+        if (!seg->inflight) continue;
+        if (!qm_spool_mid_in_range(mid, seg->first_mid, seg->last_mid)) continue;
+        seg->acked++;
+        if (seg->acked >= seg->replayed) {
+            LOGD("%s: segment %u published", __func__, seg->seq);
+            qm_spool_seg_remove(seg);
+        }
+        return;
+    }
+
+    /*
+     * libmosquitto may call the publish callback from within the publish
+     * call, before the message id is known to the replay loop.
+     */
+    if (g_qm_spool.replay_seg != NULL) g_qm_spool.replay_seg->acked++;
+}
+
+bool qm_spool_replay(qm_spool_publish_t *publish)
+{
+    qm_spool_seg_t *next;
+    qm_spool_seg_t *seg;
+    qm_item_t qi;
+    uint8_t *buf;
+    size_t len;
+    size_t off;
+    int count;
+    int mid;
+    bool ok;
+
+    if (!g_qm_spool.initialized) return true;
+    if (ds_dlist_is_empty(&g_qm_spool.segs)) return true;
+
+    // close the current segment, new records go to the next one
+    qm_spool_flush();
+    g_qm_spool.wseg = NULL;
+
+    for (seg = ds_dlist_head(&g_qm_spool.segs); seg != NULL; seg = next) {
+        next = ds_dlist_next(&g_qm_spool.segs, seg);
+        if (seg->inflight) continue;
+
+        buf = qm_spool_seg_read(seg, &len);
+        if (buf == NULL) {
+            g_qm_spool.stats.drops += seg->count;
+            qm_spool_seg_remove(seg);
+            continue;
+        }
+
+        g_qm_spool.replay_seg = seg;
+        seg->acked = 0;
+        ok = true;
+        count = 0;
+        off = 0;
+        while (qm_spool_rec_parse(buf, len, &off, &qi)) {
+            mid = 0;
+            if (!publish(&qi, &mid)) {
+                ok = false;
+                break;
+            }
+            if (count == 0) seg->first_mid = mid;
+            seg->last_mid = mid;
+            count++;
+        }
+        free(buf);
+        g_qm_spool.replay_seg = NULL;
+        g_qm_spool.stats.replayed += count;
+
+        if (!ok) {
+            // keep the order: retry from this segment on the next interval
+            LOGE("%s: replay of segment %u failed", __func__, seg->seq);
+            return false;
+        }
+
+        LOGD("%s: replayed segment %u: %d messages", __func__, seg->seq, count);
+        seg->replayed = count;
+        seg->inflight = true;
+        if (count == 0 || seg->acked >= count) qm_spool_seg_remove(seg);
+    }
+
+    LOGI("%s: spool: %d messages %d bytes %d segments, %d replayed, %d dropped",
+            __func__, g_qm_spool.stats.depth, g_qm_spool.stats.bytes,
+            g_qm_spool.stats.segments, g_qm_spool.stats.replayed,
+            g_qm_spool.stats.drops);
+    return true;
+}
+
+/**
+ * @brief load a segment left over from a previous run
+ *
+ * Counts the valid records and cuts off a torn tail.
+ */
+static bool qm_spool_seg_load(qm_spool_seg_t *seg)
+{
+    char path[256];
+    qm_item_t qi;
+    uint8_t *buf;
+    size_t len;
+    size_t off = 0;
+
+    buf = qm_spool_seg_read(seg, &len);
+    if (buf == NULL) return false;
+
+    while (qm_spool_rec_parse(buf, len, &off, &qi)) {
+        seg->count++;
+    }
+    free(buf);
+
+    if (off < len) {
+        qm_spool_seg_path(seg->seq, path, sizeof(path));
+        LOGW("%s: %s: discarding %zu bytes of a damaged record", __func__, path, len - off);
+        if (truncate(path, off) != 0) {
+            LOGE("%s: truncate %s: %s", __func__, path, strerror(errno));
+        }
+    }
+    seg->size = off;
+    g_qm_spool.stats.depth += seg->count;
+    g_qm_spool.stats.bytes += seg->size;
+    return seg->count > 0;
+}
+
+bool qm_spool_init(void)
+{
+    qm_spool_seg_t *next;
+    qm_spool_seg_t *seg;
+    qm_spool_seg_t *s;
+    struct dirent *de;
+    uint32_t seq;
+    DIR *dir;
+    int n;
+
+    memset(&g_qm_spool, 0, sizeof(g_qm_spool));
+    ds_dlist_init(&g_qm_spool.segs, qm_spool_seg_t, node);
+
+    if (mkdir(CONFIG_QM_SPOOL_PATH, 0700) != 0 && errno != EEXIST) {
+        LOGE("%s: mkdir %s: %s", __func__, CONFIG_QM_SPOOL_PATH, strerror(errno));
+        return false;
+    }
+
+    dir = opendir(CONFIG_QM_SPOOL_PATH);
+    if (dir == NULL) {
+        LOGE("%s: opendir %s: %s", __func__, CONFIG_QM_SPOOL_PATH, strerror(errno));
+        return false;
+    }
+
+    // collect the segments sorted by sequence number
+    while ((de = readdir(dir)) != NULL) {
+        n = 0;
+        if (sscanf(de->d_name, QM_SPOOL_SEG_PREFIX "%u" QM_SPOOL_SEG_SUFFIX "%n", &seq, &n) != 1) continue;
+        if (n == 0 || de->d_name[n] != '\0') continue;
+
+        seg = qm_spool_seg_new(seq);
+        if (seg == NULL) break;
+        ds_dlist_foreach(&g_qm_spool.segs, s) {
+            if (s->seq > seq) break;
+        }
+        if (s != NULL) {
+            ds_dlist_insert_before(&g_qm_spool.segs, s, seg);
+        } else {
+            ds_dlist_insert_tail(&g_qm_spool.segs, seg);
+        }
+        if (seq >= g_qm_spool.next_seq) g_qm_spool.next_seq = seq + 1;
+    }
+    closedir(dir);
+
+    g_qm_spool.initialized = true;
+
+    for (seg = ds_dlist_head(&g_qm_spool.segs); seg != NULL; seg = next) {
+        next = ds_dlist_next(&g_qm_spool.segs, seg);
+        if (!qm_spool_seg_load(seg)) qm_spool_seg_remove(seg);
+    }
+
+    // the configured bound may have shrunk since the segments were written
+    qm_spool_make_room(0);
+
+    LOGI("%s: %s: %d messages %d bytes in %d segments", __func__,
+            CONFIG_QM_SPOOL_PATH, g_qm_spool.stats.depth,
+            g_qm_spool.stats.bytes, g_qm_spool.stats.segments);
+    return true;
+}
+
+void qm_spool_fini(void)
+{
+    qm_spool_seg_t *seg;
+
+    if (!g_qm_spool.initialized) return;
+
+    qm_spool_flush();
+    while ((seg = ds_dlist_remove_head(&g_qm_spool.segs)) != NULL) {
+        free(seg);
+    }
+    g_qm_spool.wseg = NULL;
+    g_qm_spool.initialized = false;
+}
+
+void qm_spool_get_stats(qm_spool_stats_t *stats)
+{
+    *stats = g_qm_spool.stats;
+}
@@ -43,6 +43,10 @@ UNIT_SRC += src/qm_queue.c
 UNIT_SRC += src/qm_event.c
 UNIT_SRC += src/qm_teserver.c
 
+ifeq ($(CONFIG_QM_USE_SPOOL),y)
+UNIT_SRC += src/qm_spool.c
+endif
+
 UNIT_CFLAGS += -I$(TOP_DIR)/src/lib/common/inc/
 
 UNIT_LDFLAGS += -lev
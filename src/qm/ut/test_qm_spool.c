@@ -0,0 +1,329 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "qm.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "qm_spool_tests";
+
+/* Defined by qm_mqtt.c */
+bool qm_log_enabled = false;
+
+#define TEST_SPOOL_MAX_BYTES ((size_t)CONFIG_QM_SPOOL_MAX_SIZE * 1024)
+#define TEST_SPOOL_MAX_MSGS 1024
+
+/**
+ * @brief messages published from the spool
+ */
+struct test_spool_published
+{
+    int ids[TEST_SPOOL_MAX_MSGS];
+    int mids[TEST_SPOOL_MAX_MSGS];
+    int count;
+    int fail_after;     // publish failures start after this many messages
+    int next_mid;
+} g_published;
+
+
+/**
+ * @brief removes the segment files left by a previous test
+ */
+static void
+test_spool_clean(void)
+{
+    char path[512];
+    struct dirent *de;
+    DIR *dir;
+
+    dir = opendir(CONFIG_QM_SPOOL_PATH);
+    if (dir == NULL) return;
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (strncmp(de->d_name, "qm_", 3) != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", CONFIG_QM_SPOOL_PATH, de->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+
+void
+setUp(void)
+{
+    test_spool_clean();
+    memset(&g_published, 0, sizeof(g_published));
+    g_published.fail_after = -1;
+    qm_queue_init();
+}
+
+
+void
+tearDown(void)
+{
+    qm_item_t *qi;
+
+    while (qm_queue_get(&qi)) qm_queue_item_free(qi);
+    qm_spool_fini();
+    test_spool_clean();
+}
+
+
+/**
+ * @brief queues a message carrying its id in its payload
+ */
+static bool
+test_spool_queue_msg(int id, size_t size)
+{
+    qm_response_t res;
+    qm_item_t *qi;
+    bool ret;
+
+    qi = calloc(1, sizeof(*qi));
+    TEST_ASSERT_NOT_NULL(qi);
+    qi->topic = strdup("test/spool");
+    qi->req.data_type = QM_DATA_STATS;
+    qi->req.data_size = size;
+    qi->buf = calloc(1, size);
+    TEST_ASSERT_NOT_NULL(qi->buf);
+    memcpy(qi->buf, &id, sizeof(id));
+
+    memset(&res, 0, sizeof(res));
+    ret = qm_queue_put(&qi, &res);
+    if (qi != NULL) qm_queue_item_free(qi);
+    TEST_ASSERT_EQUAL_UINT(0, res.qdrop);
+
+    return ret;
+}
+
+
+/**
+ * @brief records the message published from the spool
+ */
+static bool
+test_spool_publish(qm_item_t *qi, int *mid)
+{
+    struct test_spool_published *pub = &g_published;
+    int id;
+
+    if (pub->fail_after >= 0 && pub->count >= pub->fail_after) return false;
+    TEST_ASSERT_TRUE(pub->count < TEST_SPOOL_MAX_MSGS);
+    TEST_ASSERT_EQUAL_STRING("test/spool", qi->topic);
+    TEST_ASSERT_TRUE(qi->size >= sizeof(id));
+
+    memcpy(&id, qi->buf, sizeof(id));
+    *mid = ++pub->next_mid;
+    pub->ids[pub->count] = id;
+    pub->mids[pub->count] = *mid;
+    pub->count++;
+
+    return true;
+}
+
+
+/**
+ * @brief acknowledges the messages published from the spool
+ */
+static void
+test_spool_ack_all(void)
+{
+    int i;
+
+    for (i = 0; i < g_published.count; i++) qm_spool_publish_ack(g_published.mids[i]);
+}
+
+
+/**
+ * @brief validates queued messages are spooled, replayed in order and
+ *        released once acknowledged
+ */
+void
+test_spool_enqueue_drain(void)
+{
+    qm_spool_stats_t stats;
+    int i;
+
+    for (i = 0; i < 10; i++) TEST_ASSERT_TRUE(test_spool_queue_msg(i, 64));
+    TEST_ASSERT_EQUAL_INT(10, qm_queue_length());
+
+    /* Broker unreachable: the queue moves to the spool */
+    qm_spool_save_queue();
+    TEST_ASSERT_EQUAL_INT(0, qm_queue_length());
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(10, stats.depth);
+    TEST_ASSERT_EQUAL_INT(1, stats.segments);
+    TEST_ASSERT_EQUAL_INT(0, stats.drops);
+
+    /* Spooled messages survive a restart */
+    qm_spool_fini();
+    TEST_ASSERT_TRUE(qm_spool_init());
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(10, stats.depth);
+
+    /* Back online: replayed oldest first */
+    TEST_ASSERT_TRUE(qm_spool_replay(test_spool_publish));
+    TEST_ASSERT_EQUAL_INT(10, g_published.count);
+    for (i = 0; i < 10; i++) TEST_ASSERT_EQUAL_INT(i, g_published.ids[i]);
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(10, stats.replayed);
+
+    /* Segments are kept until every message is acknowledged */
+    TEST_ASSERT_EQUAL_INT(1, stats.segments);
+    test_spool_ack_all();
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(0, stats.depth);
+    TEST_ASSERT_EQUAL_INT(0, stats.bytes);
+    TEST_ASSERT_EQUAL_INT(0, stats.segments);
+}
+
+
+/**
+ * @brief validates a failed replay resumes in order
+ */
+void
+test_spool_replay_resume(void)
+{
+    qm_spool_stats_t stats;
+    int i;
+
+    for (i = 0; i < 10; i++) TEST_ASSERT_TRUE(test_spool_queue_msg(i, 64));
+    qm_spool_save_queue();
+
+    g_published.fail_after = 4;
+    TEST_ASSERT_FALSE(qm_spool_replay(test_spool_publish));
+    TEST_ASSERT_EQUAL_INT(4, g_published.count);
+
+    /* The whole segment is published again */
+    memset(&g_published, 0, sizeof(g_published));
+    g_published.fail_after = -1;
+    TEST_ASSERT_TRUE(qm_spool_replay(test_spool_publish));
+    TEST_ASSERT_EQUAL_INT(10, g_published.count);
+    for (i = 0; i < 10; i++) TEST_ASSERT_EQUAL_INT(i, g_published.ids[i]);
+
+    test_spool_ack_all();
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(0, stats.depth);
+}
+
+
+/**
+ * @brief validates messages overflowing the queue go to the spool
+ */
+void
+test_spool_queue_overflow(void)
+{
+    qm_spool_stats_t stats;
+    int total;
+    int i;
+
+    total = QM_MAX_QUEUE_DEPTH + 20;
+    for (i = 0; i < total; i++) TEST_ASSERT_TRUE(test_spool_queue_msg(i, 64));
+
+    /* The oldest messages moved to the spool, none was dropped */
+    TEST_ASSERT_EQUAL_INT(QM_MAX_QUEUE_DEPTH, qm_queue_length());
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(20, stats.depth);
+    TEST_ASSERT_EQUAL_INT(0, stats.drops);
+
+    /* and are published before the queue */
+    TEST_ASSERT_TRUE(qm_spool_replay(test_spool_publish));
+    TEST_ASSERT_EQUAL_INT(20, g_published.count);
+    for (i = 0; i < 20; i++) TEST_ASSERT_EQUAL_INT(i, g_published.ids[i]);
+    test_spool_ack_all();
+}
+
+
+/**
+ * @brief validates the oldest segments are dropped when the spool is full
+ */
+void
+test_spool_overflow(void)
+{
+    qm_spool_stats_t stats;
+    size_t msg_size;
+    int total;
+    int first;
+    int i;
+
+    /* Twice the spool capacity */
+    msg_size = 4096;
+    total = 2 * TEST_SPOOL_MAX_BYTES / msg_size;
+    TEST_ASSERT_TRUE(total <= TEST_SPOOL_MAX_MSGS);
+    for (i = 0; i < total; i++)
+    {
+        TEST_ASSERT_TRUE(test_spool_queue_msg(i, msg_size));
+        qm_spool_save_queue();
+    }
+
+    qm_spool_get_stats(&stats);
+    LOGI("%s: %d messages %d bytes %d segments, %d dropped", __func__,
+         stats.depth, stats.bytes, stats.segments, stats.drops);
+    TEST_ASSERT_TRUE(stats.drops > 0);
+    TEST_ASSERT_EQUAL_INT(total, stats.depth + stats.drops);
+    TEST_ASSERT_TRUE((size_t)stats.bytes <= TEST_SPOOL_MAX_BYTES);
+
+    /* The newest messages are kept, in order */
+    TEST_ASSERT_TRUE(qm_spool_replay(test_spool_publish));
+    TEST_ASSERT_EQUAL_INT(stats.depth, g_published.count);
+    first = total - g_published.count;
+    for (i = 0; i < g_published.count; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(first + i, g_published.ids[i]);
+    }
+
+    test_spool_ack_all();
+    qm_spool_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(0, stats.depth);
+    TEST_ASSERT_EQUAL_INT(0, stats.segments);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_spool_enqueue_drain);
+    RUN_TEST(test_spool_replay_resume);
+    RUN_TEST(test_spool_queue_overflow);
+    RUN_TEST(test_spool_overflow);
+
+    return UNITY_END();
+}
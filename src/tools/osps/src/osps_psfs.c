@@ -30,7 +30,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * ===========================================================================
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "module.h"
 #include "osp_ps.h"
@@ -41,6 +44,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 static int osps_list(int argc, char *argv[]);
 static int osps_prune(int argc, char *argv[]);
+static int osps_bench(int argc, char *argv[]);
 
 /*
  * ===========================================================================
@@ -185,6 +189,162 @@ error:
     return retval;
 }
 
+/*
+ * ===========================================================================
+ *  Bench command
+ * ===========================================================================
+ */
+static struct osps_command osps_bench_cmd = OSPS_COMMAND_INIT(
+        "bench",
+        osps_bench,
+        "bench STORE [SIZE_KB] ; Measure store load and prune times [PSFS extension]",
+        "The STORE is overwritten with SIZE_KB (default 1024) of records.\n"
+        "\n"
+        "Arguments:\n"
+        "\n"
+        "   STORE   - The persistent store name\n"
+        "   SIZE_KB - Store file size in kB\n");
+
+#define OSPS_BENCH_VALUE_SZ     256
+#define OSPS_BENCH_LOAD_RUNS    20
+
+static double osps_bench_ms(struct timespec *ts)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - ts->tv_sec) * 1000.0 + (now.tv_nsec - ts->tv_nsec) / 1000000.0;
+}
+
+int osps_bench(int argc, char *argv[])
+{
+    char value[OSPS_BENCH_VALUE_SZ];
+    struct timespec ts;
+    char key[32];
+    double load_ms;
+    int nrecords;
+    int flags;
+    psfs_t ps;
+    int ii;
+
+    long size_kb = 1024;
+
+    if (argc != 2 && argc != 3)
+    {
+        osps_usage("bench", "Invalid number of arguments.");
+        return OSPS_CLI_ERROR;
+    }
+
+    if (argc == 3) size_kb = strtol(argv[2], NULL, 0);
+    if (size_kb <= 0)
+    {
+        osps_usage("bench", "Invalid size: %s", argv[2]);
+        return OSPS_CLI_ERROR;
+    }
+
+    /* Each record takes the value, its key and 12 bytes of header and CRC */
+    nrecords = (size_kb * 1024) / (OSPS_BENCH_VALUE_SZ + 24);
+
+    flags = OSP_PS_RDWR;
+    if (osps_preserve) flags |= OSP_PS_PRESERVE;
+
+    /*
+     * Fill the store
+     */
+    if (!psfs_open(&ps, argv[1], flags))
+    {
+        fprintf(stderr, "Error opening store: %s\n", argv[1]);
+        return 1;
+    }
+
+    if (!psfs_erase(&ps) || !psfs_sync(&ps, true))
+    {
+        fprintf(stderr, "Error erasing store: %s\n", argv[1]);
+        psfs_close(&ps);
+        return 1;
+    }
+
+    for (ii = 0; ii < nrecords; ii++)
+    {
+        snprintf(key, sizeof(key), "bench_key_%06d", ii);
+        memset(value, 'a' + (ii % 26), sizeof(value));
+        psfs_set(&ps, key, value, sizeof(value));
+    }
+
+    if (!psfs_sync(&ps, false))
+    {
+        fprintf(stderr, "Error filling store: %s\n", argv[1]);
+        psfs_close(&ps);
+        return 1;
+    }
+
+    if (!psfs_close(&ps))
+    {
+        fprintf(stderr, "Error closing store: %s\n", argv[1]);
+        return 1;
+    }
+
+    /*
+     * Measure the time it takes to open and load the store
+     */
+    flags = OSP_PS_READ;
+    if (osps_preserve) flags |= OSP_PS_PRESERVE;
+
+    load_ms = 0.0;
+    for (ii = 0; ii < OSPS_BENCH_LOAD_RUNS; ii++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        if (!psfs_open(&ps, argv[1], flags) || !psfs_load(&ps))
+        {
+            fprintf(stderr, "Error loading store: %s\n", argv[1]);
+            return 1;
+        }
+
+        load_ms += osps_bench_ms(&ts);
+
+        if (ds_tree_is_empty(&ps.psfs_root) || !psfs_close(&ps))
+        {
+            fprintf(stderr, "Error verifying store: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    printf("load:  %d records, %ld kB, %0.3f ms\n",
+            nrecords, size_kb, load_ms / OSPS_BENCH_LOAD_RUNS);
+
+    /*
+     * Measure the time it takes to prune the store
+     */
+    flags = OSP_PS_RDWR;
+    if (osps_preserve) flags |= OSP_PS_PRESERVE;
+
+    if (!psfs_open(&ps, argv[1], flags) || !psfs_load(&ps))
+    {
+        fprintf(stderr, "Error loading store: %s\n", argv[1]);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (!psfs_sync(&ps, true))
+    {
+        fprintf(stderr, "Error pruning store: %s\n", argv[1]);
+        psfs_close(&ps);
+        return 1;
+    }
+
+    printf("prune: %d records, %0.3f ms\n", nrecords, osps_bench_ms(&ts));
+
+    if (!psfs_close(&ps))
+    {
+        fprintf(stderr, "Warning: Error closing store %s.\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
 /*
  * ===========================================================================
  *  Module section
@@ -196,6 +356,7 @@ void osps_psfs_init(void *data)
 {
     osps_command_register(&osps_list_cmd);
     osps_command_register(&osps_prune_cmd);
+    osps_command_register(&osps_bench_cmd);
 }
 
 void osps_psfs_fini(void *data)